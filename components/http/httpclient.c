@@ -7,9 +7,13 @@
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <time.h>
 #include <sys/types.h>
+#include <sys/stat.h>
 #include "lwip/sockets.h"
 #include "lwip/netdb.h"
+#include <pthread/pthread.h>
 #include <ctype.h>
 
 
@@ -17,6 +21,16 @@
 #define HTTP_PORT         80
 #define HTTPS_PORT        443		// no https support for now
 #define HTTP_1_1_STR      "HTTP/1.1"
+
+#define HTTP_HEADER_MAX       2048  /* max size of a response header */
+#define HTTP_TIMEOUT          10    /* seconds without data before a read fails */
+#define HTTP_MAX_REDIRECTS    8
+#define HTTP_KEEP_ALIVE_CONNS 2     /* connections kept open for reuse */
+#define HTTP_KEEP_ALIVE_IDLE  15    /* seconds an idle connection is kept open */
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
 static const char* HTTP_REQUESTS[] =
 {
   "GET",
@@ -64,12 +78,12 @@ static char* URL_encode(char* const addr)
 static void word_to_string(const char* const word, char** str)
 {
   uint32_t i = 0;
-  while (word[i] == ' ' || word[i] == '\r' || word[i] == '\n' || word[i] == '\0')
+  while (word[i] == ' ')
     ++i;
 
   uint32_t start = i;
 
-  while (word[i] != ' ' && word[i] != '\r' && word[i] != '\n')
+  while (word[i] != ' ' && word[i] != '\r' && word[i] != '\n' && word[i] != '\0')
     ++i;
   
   *str = (char*) malloc(i - start + 1);
@@ -174,6 +188,12 @@ void print_status(http_ret_t status, char *buf)
     case HTTP_ERR_FILEWRITTING:
       sprintf(buf, "ERROR: WRITTING FILE TO SOKKET.");
       return;
+    case HTTP_ERR_SINK:
+      sprintf(buf, "ERROR: RECEIVING BODY ABORTED");
+      return;
+    case HTTP_ERR_INFLATE:
+      sprintf(buf, "ERROR: INFLATING BODY");
+      return;
     default:
       sprintf(buf, "ERROR: UNKNOWN STATUS CODE (%d)", status);
   }
@@ -205,43 +225,6 @@ static bool build_http_request(const char* host, const char* resource, const htt
   return true;
 }
 
-/*
-static bool http_body_get(const char* http_resp, char* body, size_t max_body_length)
-{
-
-  uint32_t i, j = 0;
-  char matchseq[] = {'\r', '\n', '\r', '\n'};
-
-  for (i = 0; i < 80000; ++i)
-  {
-    if (http_resp[i] == matchseq[j])
-    {
-      ++j;
-      if (j == sizeof(matchseq))
-      {
-        body = (char*) &http_resp[i];
-        return true;
-      }
-    }
-    else
-    {
-      j = 0;
-    }
-  }
-  return false;
-}
-*/
-
-/*
-static void print(uint8_t* msg, uint32_t len)
-{
-  printf("-----------------\n");
-  uint32_t i = 0;
-  for (; i < len; ++i)
-    printf("%2X ", msg[i]);
-  printf("\n");
-}  
-*/
 
 static void socket_set_timeout(socket_t socket, uint32_t seconds, uint32_t usec)
 {
@@ -274,6 +257,7 @@ static socket_t socket_open(struct hostent* host, int portno)
   int res =  connect(sock, (struct sockaddr*) &server_addr, sizeof(server_addr));
   if (res < 0)
   {
+    close(sock);
     return -1;
   }
 
@@ -286,151 +270,179 @@ static void socket_close(socket_t socket)
     close(socket);
 }
 
-static void free_header(http_header_t* p_header)
+static bool socket_write(socket_t socket, const void* data, size_t len)
 {
-  if (p_header != NULL) {
-	  if (p_header->content_type != NULL) {
-		free(p_header->content_type);
-		p_header->content_type = NULL;
-	  }
-	  if (p_header->encoding != NULL) {
-		free(p_header->encoding);
-		p_header->encoding = NULL;
-	  }
-	  if (p_header->status_text != NULL) {
-		free(p_header->status_text);
-		p_header->status_text = NULL;
-	  }
-	  if (p_header->redirect_addr != NULL) {
-		free(p_header->redirect_addr);
-		p_header->redirect_addr = NULL;
-	  }
-	  if (p_header->content != NULL) {
-		free(p_header->content);
-		p_header->content = NULL;
-	  }
+  while (len > 0)
+  {
+    int sent = send(socket, data, len, MSG_NOSIGNAL);
+    if (sent <= 0)
+      return false;
 
-    free(p_header);
+    data = (const char*) data + sent;
+    len -= sent;
   }
+
+  return true;
 }
 
-static void dissect_header(char* data, http_response_t* p_resp)
+/*
+ * Connections kept open after a response, for the next request to the same host. They
+ * are taken out of the pool while in use, so each one is used by a single request.
+ */
+typedef struct
 {
-  if (strlen(data) == 0)
-  {
-    p_resp->p_header = NULL;
-    return;
-  }
-  p_resp->p_header = (http_header_t*) malloc(sizeof(http_header_t));
+  socket_t sock;
+  time_t released;    /* when it was put in the pool */
+  char host[64];      /* host[:port] */
+} http_conn_t;
 
-  char* content = data;
-  char* header_end = strstr(content, "\r\n\r\n");
-  if (header_end == NULL)
-  {
-    header_end = content + strlen(content);
-  }
-  else
-  {
-    /* explicitly null terminate header, to satisfy strstr() */
-    header_end[0] = '\0';
-  }
-  p_resp->p_header->content = NULL;
-  p_resp->p_header->content = malloc(strlen(content)+1);
-  sprintf(p_resp->p_header->content, "%s", content);
+static http_conn_t conns[HTTP_KEEP_ALIVE_CONNS];
+static pthread_mutex_t conns_mtx;
+static pthread_once_t conns_once = PTHREAD_ONCE_INIT;
 
-  /* handle first line. FORMAT:[HTTP/1.1 <STATUS_CODE> <STATUS_TEXT>] */
-  content = strchr(data, ' ');
-  if (content == NULL)
-    return;
-  
-  p_resp->p_header->status_code = atoi(content);
-  content = strchr(content + 1, ' ') + 1;
+static void conns_init()
+{
+  pthread_mutex_init(&conns_mtx, NULL);
 
-  size_t status_text_len = strchr(content, '\r') - content;
-  
-  p_resp->p_header->status_text = (char*) malloc(status_text_len);
-  memcpy(p_resp->p_header->status_text, content, status_text_len);
+  for (int i = 0; i < HTTP_KEEP_ALIVE_CONNS; ++i)
+    conns[i].sock = -1;
+}
 
-  p_resp->p_header->content_type = NULL;
-  p_resp->p_header->encoding = NULL;
-  p_resp->p_header->redirect_addr = NULL;
+/* takes an open connection to host from the pool, or returns -1 */
+static socket_t conn_get(const char* host)
+{
+  socket_t sock = -1;
+  time_t now = time(NULL);
 
-  while (content <= header_end)
+  pthread_once(&conns_once, conns_init);
+  pthread_mutex_lock(&conns_mtx);
+
+  for (int i = 0; i < HTTP_KEEP_ALIVE_CONNS; ++i)
   {
-    if (content == NULL)
-      return;
-    content = strstr(content, "\r\n");
-    if (content == NULL)
-      return;
-    content += 2;
+    if (conns[i].sock < 0)
+      continue;
 
-    if (strstr(content, "Content-Type:") == content)
+    if (now - conns[i].released > HTTP_KEEP_ALIVE_IDLE)
     {
-      content = strchr(content, ' ');
-      word_to_string(content, &p_resp->p_header->content_type);
+      socket_close(conns[i].sock);
+      conns[i].sock = -1;
     }
-    else if (strstr(content, "Content-Encoding:") == content)
+    else if (sock < 0 && strcmp(conns[i].host, host) == 0)
     {
-      content = strchr(content, ' ');
-      word_to_string(content, &p_resp->p_header->encoding);
+      sock = conns[i].sock;
+      conns[i].sock = -1;
     }
-    else if (strstr(content, "Location:") == content || strstr(content, "location:") == content)
+  }
+
+  pthread_mutex_unlock(&conns_mtx);
+
+  /* if the server closed it, it's readable (EOF), while an idle connection has no data */
+  if (sock >= 0)
+  {
+    char c;
+
+    if (recv(sock, &c, 1, MSG_PEEK | MSG_DONTWAIT) >= 0)
     {
-      content = strchr(content, ' ');
-      word_to_string(content, &p_resp->p_header->redirect_addr);
+      socket_close(sock);
+      sock = -1;
     }
   }
+
+  return sock;
 }
 
-/**
-* performs the actual http request. 
-*/
-static uint8_t* _http_request(char* const address, http_req_t http_req, http_ret_t* p_ret,
-    uint32_t* resp_len, char* header_lines, char* const body)
+/* puts a connection to host in the pool, in place of the one idle for longer if it's full */
+static void conn_put(const char* host, socket_t sock)
 {
-  int portno = HTTP_PORT;
+  int slot = 0;
 
-  if (strstr(address, "https://") != NULL)
+  if (strlen(host) >= sizeof(conns[0].host))
   {
-    *p_ret = HTTP_ERR_IS_HTTPS;
-    return NULL;
+    socket_close(sock);
+    return;
   }
 
-  struct hostent* server;
-
-  char host_addr[256];
-  char resource_addr[256];
+  pthread_once(&conns_once, conns_init);
+  pthread_mutex_lock(&conns_mtx);
 
-  if (!dissect_address(address, host_addr, 256, resource_addr, 256))
+  for (int i = 0; i < HTTP_KEEP_ALIVE_CONNS; ++i)
   {
-    *p_ret = HTTP_ERR_DISSECT_ADDR;
-    return NULL;
+    if (conns[i].sock < 0)
+    {
+      slot = i;
+      break;
+    }
+
+    if (conns[i].released < conns[slot].released)
+      slot = i;
   }
 
-  /* do DNS lookup */
-  server = gethostbyname(host_addr);
+  socket_close(conns[slot].sock);
+  conns[slot].sock = sock;
+  conns[slot].released = time(NULL);
+  strcpy(conns[slot].host, host);
 
-  if (server == NULL)
+  pthread_mutex_unlock(&conns_mtx);
+}
+
+void http_close_connections()
+{
+  pthread_once(&conns_once, conns_init);
+  pthread_mutex_lock(&conns_mtx);
+
+  for (int i = 0; i < HTTP_KEEP_ALIVE_CONNS; ++i)
   {
-    *p_ret = HTTP_ERR_NO_SUCH_HOST;
-    return NULL;
+    socket_close(conns[i].sock);
+    conns[i].sock = -1;
   }
-  
-  /* open socket to host */
-  socket_t sock = socket_open(server, portno);
 
-  if (sock < 0)
+  pthread_mutex_unlock(&conns_mtx);
+}
+
+static http_ret_t http_connect(const char* host, socket_t* p_sock)
+{
+  char name[256];
+  int portno = HTTP_PORT;
+
+  strcpy(name, host);
+
+  /* host can have a port */
+  char* port_pos = strchr(name, ':');
+  if (port_pos != NULL)
   {
-    *p_ret = HTTP_ERR_OPENING_SOCKET;
-    return NULL;
+    *port_pos = '\0';
+    portno = atoi(port_pos + 1);
   }
 
-  FILE* fd = NULL;
+  /* do DNS lookup */
+  struct hostent* server = gethostbyname(name);
+
+  if (server == NULL)
+    return HTTP_ERR_NO_SUCH_HOST;
+
+  /* open socket to host */
+  *p_sock = socket_open(server, portno);
+
+  if (*p_sock < 0)
+    return HTTP_ERR_OPENING_SOCKET;
 
-  /* Default timeout is too long */
-  socket_set_timeout(sock, 1, 0);
+  /* responses end as their header says, the timeout is only for stalled connections */
+  socket_set_timeout(*p_sock, HTTP_TIMEOUT, 0);
 
-  size_t http_req_size = 256 + strlen(address);
+  /* the request and a file body are sent with several writes, don't wait for the ACK of each one */
+  int flag = 1;
+  setsockopt(*p_sock, IPPROTO_TCP, TCP_NODELAY, (char *)&flag, sizeof(flag));
+
+  return HTTP_SUCCESS;
+}
+
+/* sends the request, and the file of a file body after it */
+static http_ret_t http_send(socket_t sock, const char* host, const char* resource, const http_req_t http_req,
+    char* header_lines, char* const body)
+{
+  FILE* fd = NULL;
+
+  size_t http_req_size = 256 + strlen(host) + strlen(resource);
   if (header_lines != NULL) http_req_size += strlen(header_lines);
 
   if (body != NULL) {
@@ -447,318 +459,700 @@ static uint8_t* _http_request(char* const address, http_req_t http_req, http_ret
 
   char* http_req_str = (char*) malloc(http_req_size+8);
   if (http_req_str == NULL) {
-      *p_ret = HTTP_ERR_OUT_OF_MEM;
       if (fd != NULL) fclose(fd);
-      socket_close(sock);
-      return NULL;
+      return HTTP_ERR_OUT_OF_MEM;
   }
 
-  build_http_request(host_addr, resource_addr, http_req, http_req_str, http_req_size, header_lines, body);
+  build_http_request(host, resource, http_req, http_req_str, http_req_size, header_lines, body);
 
   #if HTTP_DEBUG
   printf("REQUEST STRING:\r\n[%s]\r\n", http_req_str);
   #endif
 
   /* send http request */
-  int len = write(sock, http_req_str, strlen(http_req_str));
+  bool sent = socket_write(sock, http_req_str, strlen(http_req_str));
 
   free(http_req_str);
 
-  if (len < 0)
+  if (!sent)
   {
-    *p_ret = HTTP_ERR_WRITING;
     if (fd != NULL) fclose(fd);
-    socket_close(sock);
-    return NULL;
+    return HTTP_ERR_WRITING;
   }
 
   if (fd != NULL) {
 	  // Send the file content after header
 	  unsigned char *fbuf = (unsigned char *)malloc(BUFFER_CHUNK_SIZE);
 	  if (fbuf == NULL) {
-	      *p_ret = HTTP_ERR_OUT_OF_MEM;
 	      fclose(fd);
-	      socket_close(sock);
-	      return NULL;
-	  }
-	  int rdlen = fread(fbuf, 1, BUFFER_CHUNK_SIZE, fd);
-	  if (rdlen < 0) {
-	    *p_ret = HTTP_ERR_FILEWRITTING;
-		free(fbuf);
-	    fclose(fd);
-	    socket_close(sock);
-	    return NULL;
+	      return HTTP_ERR_OUT_OF_MEM;
 	  }
 	  #if HTTP_DEBUG
 	  printf("SENDING FILE\r\n");
 	  #endif
-	  // send file content
-	  int error = 0;
-	  socklen_t len = sizeof (error);
-	  int sock_state = 0;
-	  int sent = 0;
-      while (rdlen > 0) {
-    	  sock_state = getsockopt(sock, SOL_SOCKET, SO_ERROR, &error, &len);
-    	  if (sock_state != 0) {
-    		    *p_ret = HTTP_ERR_FILEWRITTING;
-    			free(fbuf);
-    		    fclose(fd);
-    		    socket_close(sock);
-    		    return NULL;
+	  size_t rdlen;
+      while ((rdlen = fread(fbuf, 1, BUFFER_CHUNK_SIZE, fd)) > 0) {
+    	  if (!socket_write(sock, fbuf, rdlen)) {
+    		  free(fbuf);
+    		  fclose(fd);
+    		  return HTTP_ERR_FILEWRITTING;
     	  }
-    	  sent += write(sock, fbuf, rdlen);
-		  #if HTTP_DEBUG
-		  printf("SENT %d\r\n", sent);
-		  #endif
-    	  rdlen = fread(fbuf, 1, BUFFER_CHUNK_SIZE, fd);
       }
 	  fclose(fd);
-	  #if HTTP_DEBUG
-	  printf("SENT %d\r\n", sent);
-	  #endif
 
 	  // send closing boundary
-	  memset(fbuf, 0, 32);
 	  sprintf((char *)fbuf, "\r\n--%s--\r\n", http_boundary);
-	  write(sock, fbuf, strlen((char *)fbuf));
+	  sent = socket_write(sock, fbuf, strlen((char *)fbuf));
 
 	  free(fbuf);
-	  if (http_boundary != NULL) {
-		  free(http_boundary);
-		  http_boundary = NULL;
-	  }
+	  if (!sent) return HTTP_ERR_FILEWRITTING;
   }
 
+  return HTTP_SUCCESS;
+}
+
+/* buffered reads from the response socket */
+typedef struct
+{
+  socket_t sock;
+  char* buf;          /* BUFFER_CHUNK_SIZE bytes */
+  int pos;            /* next byte to read */
+  int len;            /* bytes in buf */
+} http_reader_t;
+
+/* returns the number of bytes available in the buffer, 0 at end of stream, or < 0 on error */
+static int reader_fill(http_reader_t* r)
+{
+  if (r->pos < r->len)
+    return r->len - r->pos;
+
+  int len = recv(r->sock, r->buf, BUFFER_CHUNK_SIZE, 0);
   #if HTTP_DEBUG
-  printf("WAITING RESPONSE\r\n");
+  printf("RECEIVED %d\r\n", len);
   #endif
 
-  uint32_t buffer_len = BUFFER_CHUNK_SIZE;
-  uint8_t* resp_str = (uint8_t*) malloc(buffer_len);
-  if (resp_str == NULL) {
-      *p_ret = HTTP_ERR_OUT_OF_MEM;
-      socket_close(sock);
-      return NULL;
-  }
-  memset(resp_str, 0, buffer_len);
-  int32_t tot_len = 0;
-  uint32_t cycles = 0;
-  
-  /* Read response from host */
-  do
+  r->pos = 0;
+  r->len = ((len > 0) ? len : 0);
+
+  return len;
+}
+
+/* reads a line without the CRLF, truncated to max - 1 characters */
+static http_ret_t reader_line(http_reader_t* r, char* line, size_t max)
+{
+  size_t len = 0;
+
+  for (;;)
   {
-    len = recv(sock, &resp_str[tot_len], buffer_len - tot_len, 0);
-	#if HTTP_DEBUG
-    printf("RECEIVED %d (%d)\r\n", len, cycles);
-	#endif
+    if (reader_fill(r) <= 0)
+      return HTTP_ERR_READING;
 
-    if (len <= 0 && cycles > 0) break;
+    char c = r->buf[r->pos++];
+    if (c == '\n')
+      break;
 
-    if (len >= 0) tot_len += len;
+    if (c != '\r' && len < max - 1)
+      line[len++] = c;
+  }
 
-    if (tot_len >= buffer_len)
-    {
-	  #if HTTP_DEBUG
-	  printf("INCREASING recv buffer size\r\n");
-	  #endif
-      buffer_len += BUFFER_CHUNK_SIZE;
-      uint8_t* newbuf = (uint8_t*) realloc(resp_str, buffer_len);
+  line[len] = '\0';
+  return HTTP_SUCCESS;
+}
 
-      if (newbuf == NULL)
-      {
-        *p_ret = HTTP_ERR_OUT_OF_MEM;
-        socket_close(sock);
-        free(resp_str);
-        return NULL;
-      }
+/* reads a response header, up to the empty line, into header */
+static http_ret_t reader_header(http_reader_t* r, char* header, size_t max, size_t* p_len)
+{
+  size_t len = 0;
+  http_ret_t ret = HTTP_SUCCESS;
 
-	  #if HTTP_DEBUG
-	  printf("NEW SIZE %d\r\n", buffer_len);
-	  #endif
-      resp_str = newbuf;
-      memset(&resp_str[buffer_len - BUFFER_CHUNK_SIZE], 0, BUFFER_CHUNK_SIZE);
+  while (len < 4 || memcmp(&header[len - 4], "\r\n\r\n", 4) != 0)
+  {
+    if (reader_fill(r) <= 0)
+    {
+      ret = HTTP_ERR_READING;
+      break;
     }
-    
-    ++cycles;
 
-  } while (true);
+    if (len == max - 1)
+    {
+      ret = HTTP_ERR_BAD_HEADER;
+      break;
+    }
+
+    header[len++] = r->buf[r->pos++];
+  }
+
+  header[len] = '\0';
+  *p_len = len;
+
+  return ret;
+}
+
+static bool header_is(const char* line, const char* name)
+{
+  return strncasecmp(line, name, strlen(name)) == 0;
+}
+
+/* true if the value of the header line contains token, f.e. "chunked" in "Transfer-Encoding: gzip, chunked" */
+static bool header_has(const char* line, const char* token)
+{
+  const char* end = strchr(line, '\r');
+  size_t len = strlen(token);
+
+  if (end == NULL)
+    end = line + strlen(line);
 
-  if (tot_len <= 0)
+  for (const char* c = strchr(line, ':'); c != NULL && c + len <= end; ++c)
   {
-	#if HTTP_DEBUG
-	printf("NOTHING RECEIVED\r\n");
-	#endif
-    *p_ret = HTTP_ERR_READING;
-    socket_close(sock);
-    free(resp_str);
-	#if HTTP_DEBUG
-	printf("RETURNING\r\n");
-	#endif
+    if (strncasecmp(c, token, len) == 0)
+      return true;
+  }
+
+  return false;
+}
+
+static void free_header(http_header_t* p_header)
+{
+  if (p_header != NULL) {
+	  if (p_header->content_type != NULL) {
+		free(p_header->content_type);
+		p_header->content_type = NULL;
+	  }
+	  if (p_header->encoding != NULL) {
+		free(p_header->encoding);
+		p_header->encoding = NULL;
+	  }
+	  if (p_header->status_text != NULL) {
+		free(p_header->status_text);
+		p_header->status_text = NULL;
+	  }
+	  if (p_header->redirect_addr != NULL) {
+		free(p_header->redirect_addr);
+		p_header->redirect_addr = NULL;
+	  }
+	  if (p_header->content != NULL) {
+		free(p_header->content);
+		p_header->content = NULL;
+	  }
+
+    free(p_header);
+  }
+}
+
+void http_header_free(http_header_t* p_header)
+{
+  free_header(p_header);
+}
+
+static http_header_t* dissect_header(char* data)
+{
+  if (strlen(data) == 0)
     return NULL;
+
+  http_header_t* p_header = (http_header_t*) calloc(1, sizeof(http_header_t));
+  if (p_header == NULL)
+    return NULL;
+
+  p_header->content_length = -1;
+
+  /* HTTP/1.1 connections are persistent by default */
+  p_header->keep_alive = (strncmp(data, "HTTP/1.0", 8) != 0);
+
+  char* content = data;
+  char* header_end = strstr(content, "\r\n\r\n");
+  if (header_end == NULL)
+  {
+    header_end = content + strlen(content);
   }
-  /* shave buffer */
-  uint8_t* new_str = (uint8_t*) realloc(resp_str, tot_len);
-  
-  if (new_str == NULL)
+  else
   {
-	#if HTTP_DEBUG
-	printf("ERROR REALLOCATING RECV BUF\r\n");
-	#endif
-    *p_ret = HTTP_ERR_OUT_OF_MEM;
-    socket_close(sock);
-    free(resp_str);
+    /* explicitly null terminate header, to satisfy strstr() */
+    header_end[0] = '\0';
+  }
+  p_header->content = malloc(strlen(content)+1);
+  if (p_header->content == NULL)
+  {
+    free_header(p_header);
     return NULL;
   }
-  resp_str = new_str;
+  sprintf(p_header->content, "%s", content);
 
-  *resp_len = (tot_len);
+  /* handle first line. FORMAT:[HTTP/1.1 <STATUS_CODE> <STATUS_TEXT>] */
+  content = strchr(data, ' ');
+  if (content == NULL)
+  {
+    free_header(p_header);
+    return NULL;
+  }
   
-  socket_close(sock);
+  p_header->status_code = atoi(content);
 
-  #if HTTP_DEBUG
-  printf("RECEIVED OK; LEN=%d:\r\n", tot_len);
-  #endif
+  char* line_end = strchr(content, '\r');
+  if (line_end == NULL)
+    line_end = content + strlen(content);
+
+  content = strchr(content + 1, ' ');
+  content = ((content == NULL || content > line_end) ? line_end : content + 1);
+
+  size_t status_text_len = line_end - content;
+  
+  p_header->status_text = (char*) malloc(status_text_len + 1);
+  if (p_header->status_text == NULL)
+  {
+    free_header(p_header);
+    return NULL;
+  }
+  memcpy(p_header->status_text, content, status_text_len);
+  p_header->status_text[status_text_len] = '\0';
+
+  while (content <= header_end)
+  {
+    content = strstr(content, "\r\n");
+    if (content == NULL)
+      break;
+    content += 2;
 
-  return resp_str;
+    if (header_is(content, "Content-Type:"))
+    {
+      word_to_string(content + 13, &p_header->content_type);
+    }
+    else if (header_is(content, "Content-Encoding:"))
+    {
+      word_to_string(content + 17, &p_header->encoding);
+    }
+    else if (header_is(content, "Location:"))
+    {
+      word_to_string(content + 9, &p_header->redirect_addr);
+    }
+    else if (header_is(content, "Content-Length:"))
+    {
+      p_header->content_length = atol(content + 15);
+    }
+    else if (header_is(content, "Transfer-Encoding:"))
+    {
+      p_header->chunked = header_has(content, "chunked");
+    }
+    else if (header_is(content, "Connection:"))
+    {
+      if (header_has(content, "close"))
+        p_header->keep_alive = false;
+      else if (header_has(content, "keep-alive"))
+        p_header->keep_alive = true;
+    }
+  }
+
+  return p_header;
 }
 
-http_response_t* http_request_w_body(char* const address, const http_req_t http_req, char* header_lines, char* const body)
+/* decodes the content encoding of the body, and passes it to the sink */
+typedef struct
 {
-  http_response_t* p_resp = (http_response_t*) malloc(sizeof(http_response_t));
-  if (p_resp == NULL) {
-	  printf("ERROR allocating response structure\r\n");
-	  return NULL;
-  }
-  memset(p_resp, 0, sizeof(http_response_t));
-  
-  uint32_t tot_len, header_len, body_len;
-  char *body_pos, *resp_str;
+  http_sink_t sink;
+  void* arg;
+  bool inflating;
+  bool inflate_end;
+  z_stream zs;
+  char* out;          /* inflate output, BUFFER_CHUNK_SIZE bytes */
+} http_body_t;
+
+static int discard_sink(void* arg, const char* data, size_t len)
+{
+  return 0;
+}
 
-  char* address_copy = address;
+static http_ret_t body_put(http_body_t* b, const char* data, size_t len)
+{
+  if (!b->inflating)
+    return ((b->sink(b->arg, data, len) == 0) ? HTTP_SUCCESS : HTTP_ERR_SINK);
 
-  /* loop until a non-redirect page is found (up to 5 times, as per spec recommendation) */
-  for (uint8_t redirects = 0; redirects < 8; ++redirects)
+  b->zs.next_in = (Bytef*) data;
+  b->zs.avail_in = len;
+
+  /* inflate the data, passing the output to sink each time the output buffer is filled */
+  do
   {
-    resp_str = (char *)_http_request(address_copy, http_req, &p_resp->status, &tot_len, header_lines, body);
-	#if HTTP_DEBUG
-	printf("HTTP_REQUEST FINISHED\r\n");
-	#endif
-    
-    if (resp_str == NULL) return p_resp;
-	#if HTTP_DEBUG
-	printf("HTTP_REQUEST OK\r\n");
-	#endif
+    if (b->inflate_end)
+      break;
 
-    /* header ends with an empty line */
-    body_pos = strstr(resp_str, "\r\n\r\n") + 4;
-    header_len = (body_pos - resp_str);
-    body_len = (tot_len - header_len);
+    b->zs.next_out = (Bytef*) b->out;
+    b->zs.avail_out = BUFFER_CHUNK_SIZE;
 
-    /* place data in response header */
-    dissect_header(resp_str, p_resp);
-	#if HTTP_DEBUG
-	printf("HEADER DISSECTED\r\n");
-	#endif
+    int res = inflate(&b->zs, Z_NO_FLUSH);
 
-    if (p_resp->p_header == NULL)
-    {
-      p_resp->status = HTTP_ERR_BAD_HEADER;
-      return p_resp;
-    }
-    
-    if (p_resp->p_header->status_code >= 300 && p_resp->p_header->status_code < 400)
+    /* no progress, needs more input */
+    if (res == Z_BUF_ERROR)
+      break;
+
+    if (res != Z_OK && res != Z_STREAM_END)
+      return HTTP_ERR_INFLATE;
+
+    size_t out_len = BUFFER_CHUNK_SIZE - b->zs.avail_out;
+    if (out_len > 0 && b->sink(b->arg, b->out, out_len) != 0)
+      return HTTP_ERR_SINK;
+
+    b->inflate_end = (res == Z_STREAM_END);
+  } while (b->zs.avail_in > 0 || b->zs.avail_out == 0);
+
+  return HTTP_SUCCESS;
+}
+
+/* reads the body, as framed by the header. Sets reusable if the connection can take another request */
+static http_ret_t read_body(http_reader_t* r, const http_header_t* p_header, http_body_t* b, bool* reusable)
+{
+  http_ret_t ret;
+  uint32_t size;
+  int avail;
+
+  *reusable = p_header->keep_alive;
+
+  if (p_header->chunked)
+  {
+    char line[32];
+
+    for (;;)
     {
-      if (p_resp->p_header->redirect_addr == NULL)
+      /* chunk size, in hex, maybe followed by extensions */
+      if ((ret = reader_line(r, line, sizeof(line))) != HTTP_SUCCESS)
+        return ret;
+
+      char* end;
+      size = strtoul(line, &end, 16);
+      if (end == line)
+        return HTTP_ERR_BAD_HEADER;
+
+      if (size == 0)
+        break;
+
+      while (size > 0)
       {
-        p_resp->status = HTTP_ERR_BAD_HEADER;
-        return p_resp;
-      }
+        if ((avail = reader_fill(r)) <= 0)
+          return HTTP_ERR_READING;
+
+        if ((uint32_t) avail > size)
+          avail = size;
 
-      if (address_copy != address) free(address_copy);
+        if ((ret = body_put(b, &r->buf[r->pos], avail)) != HTTP_SUCCESS)
+          return ret;
 
-      address_copy = (char*) malloc(strlen(p_resp->p_header->redirect_addr));
-      if (address_copy == NULL) {
-    	  p_resp->status = HTTP_ERR_OUT_OF_MEM;
-          return p_resp;
+        r->pos += avail;
+        size -= avail;
       }
-      strcpy(address_copy, p_resp->p_header->redirect_addr);
 
-      free_header(p_resp->p_header);
-      p_resp->p_header = NULL;
+      /* CRLF after the chunk data */
+      if ((ret = reader_line(r, line, sizeof(line))) != HTTP_SUCCESS)
+        return ret;
+    }
+
+    /* trailer, up to an empty line */
+    do
+    {
+      if ((ret = reader_line(r, line, sizeof(line))) != HTTP_SUCCESS)
+        return ret;
+    } while (line[0] != '\0');
+  }
+  else if (p_header->content_length >= 0)
+  {
+    size = p_header->content_length;
+
+    while (size > 0)
+    {
+      if ((avail = reader_fill(r)) <= 0)
+        return HTTP_ERR_READING;
+
+      if ((uint32_t) avail > size)
+        avail = size;
 
-      free(resp_str);
-      resp_str = NULL;
+      if ((ret = body_put(b, &r->buf[r->pos], avail)) != HTTP_SUCCESS)
+        return ret;
+
+      r->pos += avail;
+      size -= avail;
     }
-    else
+  }
+  else
+  {
+    /* the body ends when the server closes the connection */
+    *reusable = false;
+
+    while ((avail = reader_fill(r)) > 0)
     {
-      break;
+      if ((ret = body_put(b, &r->buf[r->pos], avail)) != HTTP_SUCCESS)
+        return ret;
+
+      r->pos += avail;
     }
+
+    if (avail < 0)
+      return HTTP_ERR_READING;
   }
 
-  if (p_resp->p_header == NULL)
+  return HTTP_SUCCESS;
+}
+
+/**
+* performs the actual http request, to a single address. If the response is a redirect, its body is
+* discarded and p_location is set to the address to follow.
+*/
+static http_ret_t _http_request(char* const address, const http_req_t http_req, char* header_lines, char* const body,
+    http_reader_t* r, char* header, http_header_t** p_header, http_sink_t sink, void* arg, char** p_location)
+{
+  char host_addr[256];
+  char resource_addr[256];
+  size_t header_len = 0;
+  http_ret_t ret;
+
+  if (strstr(address, "https://") != NULL)
+    return HTTP_ERR_IS_HTTPS;
+
+  if (!dissect_address(address, host_addr, 256, resource_addr, 256))
+    return HTTP_ERR_DISSECT_ADDR;
+
+  /*
+   * a connection kept open by the server may be closed at any time, if it fails it's retried with
+   * another, but only for idempotent methods, as the server may have processed the request
+   */
+  bool idempotent = (http_req != HTTP_REQ_POST && http_req != HTTP_REQ_PATCH && http_req != HTTP_REQ_CONNECT);
+
+  for (int attempt = 0;; ++attempt)
   {
-    p_resp->status = HTTP_ERR_TOO_MANY_REDIRECTS;
-    return p_resp;
+    bool reused = ((r->sock = conn_get(host_addr)) >= 0);
+
+    header_len = 0;
+
+    if (!reused && (ret = http_connect(host_addr, &r->sock)) != HTTP_SUCCESS)
+      return ret;
+
+    r->pos = r->len = 0;
+
+    ret = http_send(r->sock, host_addr, resource_addr, http_req, header_lines, body);
+    if (ret == HTTP_SUCCESS)
+      ret = reader_header(r, header, HTTP_HEADER_MAX, &header_len);
+
+    /* skip interim responses (100 Continue) */
+    while (ret == HTTP_SUCCESS && strncmp(header, "HTTP/1.1 1", 10) == 0)
+      ret = reader_header(r, header, HTTP_HEADER_MAX, &header_len);
+
+    if (ret == HTTP_SUCCESS)
+      break;
+
+    socket_close(r->sock);
+    r->sock = -1;
+
+    if (!reused || !idempotent || header_len > 0 || ret == HTTP_ERR_OUT_OF_MEM || attempt >= HTTP_KEEP_ALIVE_CONNS)
+      return ret;
   }
 
- 
-  /* if contents are compressed, uncompress it before placing it in the struct */
-  if (p_resp->p_header->encoding != NULL && strstr(p_resp->p_header->encoding, "gzip") != NULL)
+  #if HTTP_DEBUG
+  printf("RESPONSE HEADER:\r\n[%s]\r\n", header);
+  #endif
+
+  /* place data in response header */
+  *p_header = dissect_header(header);
+  if (*p_header == NULL)
   {
-    /* content length is always stored in the 4 last bytes */
-    uint32_t content_len = 0;
-    memcpy(&content_len, resp_str + tot_len - 4, 4);
+    socket_close(r->sock);
+    r->sock = -1;
+    return HTTP_ERR_BAD_HEADER;
+  }
 
-    /* safe guard against insane sizes */
-    content_len = ((content_len < 30 * body_len) ? content_len : 30 * body_len);
+  /* a 3xx without location (304 Not Modified, 300 Multiple Choices) is returned as is */
+  uint16_t status_code = (*p_header)->status_code;
+  bool redirect = (status_code >= 300 && status_code < 400 && (*p_header)->redirect_addr != NULL);
+  bool has_body = (http_req != HTTP_REQ_HEAD && status_code >= 200 && status_code != 204 && status_code != 304);
+  bool reusable = (*p_header)->keep_alive;
 
-    p_resp->contents = (char*) malloc(content_len);
+  http_body_t b;
+  memset(&b, 0, sizeof(http_body_t));
+  b.sink = (redirect ? discard_sink : sink);
+  b.arg = arg;
 
-    if (p_resp->contents == NULL)
+  /* compressed contents are inflated as received, with a fixed window (gzip or zlib header) */
+  char* encoding = (*p_header)->encoding;
+  if (has_body && !redirect && encoding != NULL && (strstr(encoding, "gzip") != NULL || strstr(encoding, "deflate") != NULL))
+  {
+    b.out = (char*) malloc(BUFFER_CHUNK_SIZE);
+    if (b.out == NULL || inflateInit2(&b.zs, 32 + MAX_WBITS) != Z_OK)
     {
-      p_resp->status = HTTP_ERR_OUT_OF_MEM;
-      return p_resp;
+      free(b.out);
+      socket_close(r->sock);
+      r->sock = -1;
+      return HTTP_ERR_OUT_OF_MEM;
     }
 
-	#if HTTP_DEBUG
-	printf("HTTP_REQUEST DECOMPRESSING\r\n");
-	#endif
-    /* zlib decompression (gzip) */
-    z_stream infstream;
-    memset(&infstream, 0, sizeof(z_stream));
-    infstream.avail_in = (uInt)(body_len);
-    infstream.next_in = (Bytef *)body_pos; 
-    infstream.avail_out = (uInt)content_len;
-    infstream.next_out = (Bytef *)p_resp->contents;
+    b.inflating = true;
+  }
 
-    inflateInit2(&infstream, 16 + MAX_WBITS);
-    inflate(&infstream, Z_NO_FLUSH);
-    inflateEnd(&infstream);
+  ret = HTTP_SUCCESS;
+  if (has_body)
+    ret = read_body(r, *p_header, &b, &reusable);
+
+  if (b.inflating)
+  {
+    /* a truncated stream */
+    if (ret == HTTP_SUCCESS && !b.inflate_end && b.zs.total_in > 0)
+      ret = HTTP_ERR_INFLATE;
 
-    p_resp->length = content_len;
+    inflateEnd(&b.zs);
+    free(b.out);
   }
-  else if (body_len > 0)
+
+  /* keep the connection if the response was read to its end, and nothing else was received */
+  if (ret == HTTP_SUCCESS && reusable && r->pos == r->len)
+    conn_put(host_addr, r->sock);
+  else
+    socket_close(r->sock);
+
+  r->sock = -1;
+
+  if (ret == HTTP_SUCCESS && redirect)
   {
-    p_resp->contents = (char*) malloc(body_len + 1);
-    if (p_resp->contents == NULL)
+    char* location = (*p_header)->redirect_addr;
+
+    /* a location without host is relative to this one */
+    if (strstr(location, "://") == NULL)
     {
-      p_resp->status = HTTP_ERR_OUT_OF_MEM;
-      return p_resp;
+      *p_location = (char*) malloc(strlen(host_addr) + strlen(location) + 9);
+      if (*p_location != NULL)
+        sprintf(*p_location, "http://%s%s%s", host_addr, ((location[0] == '/') ? "" : "/"), location);
     }
-    p_resp->contents[body_len] = '\0';
-    memcpy(p_resp->contents, body_pos, body_len);
-    p_resp->length = body_len;
+    else
+    {
+      *p_location = (char*) malloc(strlen(location) + 1);
+      if (*p_location != NULL)
+        strcpy(*p_location, location);
+    }
+
+    if (*p_location == NULL)
+      ret = HTTP_ERR_OUT_OF_MEM;
   }
-  else
+
+  return ret;
+}
+
+http_ret_t http_request_stream(char* const address, const http_req_t http_req, char* header_lines, char* const body,
+    http_header_t** p_header, http_sink_t sink, void* arg)
+{
+  http_ret_t ret = HTTP_ERR_TOO_MANY_REDIRECTS;
+  http_reader_t r;
+  char* address_copy = address;
+
+  *p_header = NULL;
+
+  memset(&r, 0, sizeof(http_reader_t));
+  r.sock = -1;
+  r.buf = (char*) malloc(BUFFER_CHUNK_SIZE);
+
+  char* header = (char*) malloc(HTTP_HEADER_MAX);
+
+  if (r.buf == NULL || header == NULL)
+  {
+    free(r.buf);
+    free(header);
+    return HTTP_ERR_OUT_OF_MEM;
+  }
+
+  /* loop until a non-redirect page is found */
+  for (uint8_t redirects = 0; redirects < HTTP_MAX_REDIRECTS; ++redirects)
+  {
+    char* location = NULL;
+
+    free_header(*p_header);
+    *p_header = NULL;
+
+    ret = _http_request(address_copy, http_req, header_lines, body, &r, header, p_header, sink, arg, &location);
+	#if HTTP_DEBUG
+	printf("HTTP_REQUEST FINISHED (%d)\r\n", ret);
+	#endif
+
+    if (address_copy != address) free(address_copy);
+    address_copy = location;
+
+    if (ret != HTTP_SUCCESS || location == NULL)
+      break;
+
+    ret = HTTP_ERR_TOO_MANY_REDIRECTS;
+  }
+
+  if (address_copy != address) free(address_copy);
+
+  free(r.buf);
+  free(header);
+
+  /* the boundary of a file body was set by the caller for this request */
+  if (body != NULL && strstr(body, HTTP_FILE_ID) == body && http_boundary != NULL) {
+	  free(http_boundary);
+	  http_boundary = NULL;
+  }
+
+  return ret;
+}
+
+/* sink of http_request_w_body(), that keeps the body in memory */
+typedef struct
+{
+  char* data;
+  uint32_t length;
+  uint32_t size;
+} mem_sink_t;
+
+static int mem_sink(void* arg, const char* data, size_t len)
+{
+  mem_sink_t* m = (mem_sink_t*) arg;
+
+  /* keep room for a terminating null */
+  if (m->length + len + 1 > m->size)
+  {
+    uint32_t size = ((m->size > 0) ? m->size : BUFFER_CHUNK_SIZE);
+    while (size < m->length + len + 1)
+      size *= 2;
+
+    char* data = (char*) realloc(m->data, size);
+    if (data == NULL)
+      return -1;
+
+    m->data = data;
+    m->size = size;
+  }
+
+  memcpy(&m->data[m->length], data, len);
+  m->length += len;
+  m->data[m->length] = '\0';
+
+  return 0;
+}
+
+http_response_t* http_request_w_body(char* const address, const http_req_t http_req, char* header_lines, char* const body)
+{
+  http_response_t* p_resp = (http_response_t*) malloc(sizeof(http_response_t));
+  if (p_resp == NULL) {
+	  printf("ERROR allocating response structure\r\n");
+	  return NULL;
+  }
+  memset(p_resp, 0, sizeof(http_response_t));
+
+  mem_sink_t m;
+  memset(&m, 0, sizeof(mem_sink_t));
+
+  p_resp->status = http_request_stream(address, http_req, header_lines, body, &p_resp->p_header, mem_sink, &m);
+  if (p_resp->status == HTTP_ERR_SINK)
+    p_resp->status = HTTP_ERR_OUT_OF_MEM;
+
+  if (p_resp->status == HTTP_SUCCESS && m.length == 0)
   {
     /* response without body */
-    free(resp_str);
-    p_resp->contents = NULL;
     p_resp->status = HTTP_EMPTY_BODY;
+  }
+  else if (p_resp->status == HTTP_SUCCESS)
+  {
+    /* shave buffer */
+    char* contents = (char*) realloc(m.data, m.length + 1);
+
+    p_resp->contents = ((contents != NULL) ? contents : m.data);
+    p_resp->length = m.length;
     return p_resp;
   }
 
-  free(resp_str);
+  free(m.data);
   return p_resp;
 }
 
@@ -3,6 +3,7 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <string.h>
+#include <stddef.h>
 
 #define HTTP_DEBUG 0
 
@@ -35,7 +36,9 @@ typedef enum
   HTTP_ERR_BAD_HEADER,
   HTTP_ERR_TOO_MANY_REDIRECTS,
   HTTP_ERR_IS_HTTPS,
-  HTTP_ERR_FILEWRITTING
+  HTTP_ERR_FILEWRITTING,
+  HTTP_ERR_SINK,
+  HTTP_ERR_INFLATE
 } http_ret_t;
 
 
@@ -47,6 +50,9 @@ typedef struct
   char* status_text;
   char* redirect_addr;
   char* content;
+  int32_t content_length;   /* -1 if not known */
+  bool chunked;
+  bool keep_alive;
 } http_header_t;
 
 typedef struct
@@ -57,6 +63,12 @@ typedef struct
   http_ret_t status;
 } http_response_t;
 
+/**
+* @brief: Receives the response body, in chunks of up to 2 KB, as they arrive.
+* Returns 0 to go on, or any other value to abort the request (HTTP_ERR_SINK).
+*/
+typedef int (*http_sink_t)(void* arg, const char* data, size_t len);
+
 char *http_boundary;
 
 /**
@@ -81,6 +93,31 @@ http_response_t* http_request_w_body(char* const address, const http_req_t http_
 */
 void http_response_free(http_response_t* p_http_resp);
 
+/**
+* @brief: Make a HTTP request, and pass the response body to sink as it's received, without
+* buffering it. Bodies with chunked transfer encoding and gzip / deflate content encoding are
+* decoded, so peak memory doesn't depend on the body size. The connection is kept open after the
+* response if the server allows it, and it's reused by the next request to the same host.
+* @param address, http_req, header_lines, body: as in http_request_w_body()
+* @param p_header: set to the response header before the first call to sink, if the request
+* gets a response. Must be free'd with http_header_free(), even on error.
+* @param sink: called with each decoded chunk of the body
+* @param arg: argument for sink
+* @return: HTTP_SUCCESS, or the error
+*/
+http_ret_t http_request_stream(char* const address, const http_req_t http_req, char* header_lines, char* const body,
+    http_header_t** p_header, http_sink_t sink, void* arg);
+
+/**
+* @brief: Destructor for the http_header_t structs returned by http_request_stream()
+*/
+void http_header_free(http_header_t* p_header);
+
+/**
+* @brief: Close the connections kept open for reuse
+*/
+void http_close_connections();
+
 void print_status(http_ret_t status, char *buf);
 
 #endif
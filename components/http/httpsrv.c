@@ -29,26 +29,70 @@
 
 #if LUA_USE_HTTP
 
-#include "lwip/err.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+
 #include "lwip/sockets.h"
-#include "lwip/sys.h"
-#include "lwip/netdb.h"
-#include "lwip/dns.h"
-#include "lwip/ip_addr.h"
 
 #include <pthread/pthread.h>
 
 #include <time.h>
+#include <errno.h>
 #include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
 #include <sys/dirent.h>
+#include <sys/mount.h>
 #include <sys/syslog.h>
 
-#define PORT           80
+#define PORT           CONFIG_LUA_RTOS_HTTP_SERVER_PORT
 #define SERVER         "lua-rtos-http-server/1.0"
 #define PROTOCOL       "HTTP/1.1"
 #define RFC1123FMT     "%a, %d %b %Y %H:%M:%S GMT"
-#define HTPP_BUFF_SIZE 1024
+
+#define HTTP_WORKERS           CONFIG_LUA_RTOS_HTTP_SERVER_WORKERS
+#define HTTP_WORKER_STACK_SIZE CONFIG_LUA_RTOS_HTTP_SERVER_STACK_SIZE
+#define HTTP_KEEP_ALIVE        CONFIG_LUA_RTOS_HTTP_SERVER_KEEP_ALIVE_TIMEOUT
+#define HTTP_BUFF_SIZE         CONFIG_LUA_RTOS_HTTP_SERVER_BUFFER_SIZE
+
+#define HTTP_REQ_SIZE     1024 // Max size of a request header
+#define HTTP_REQ_TIMEOUT  10   // Seconds to wait for the first request of a connection
+#define HTTP_THREAD_STACK_SIZE 2048 // Stack size of the thread that accepts the connections
+#define HTTP_MAX_REQUESTS 100  // Max requests served in a connection
+
+// In chunked responses, room in the output buffer for the chunk size line,
+// and for the chunk end plus the last chunk
+#define HTTP_CHUNK_HEAD   6
+#define HTTP_CHUNK_TAIL   7
+
+typedef struct {
+	int socket;
+	int requests;   // requests served in the connection
+	int keep_alive; // keep the connection open after the response
+	int chunked;    // response body is sent with chunked transfer encoding
+	int chunk;      // chunk size line position in out
+	int error;      // a send failed, connection must be closed
+	int req_len;    // bytes in req
+	int out_len;    // bytes in out
+	char req[HTTP_REQ_SIZE + 1];
+	char path[PATH_MAX + 1];
+	char out[HTTP_BUFF_SIZE];
+} http_worker_t;
+
+// Accepted connections, waiting for a free worker
+static QueueHandle_t queue = NULL;
+
+// Listening socket, and threads. running is only changed by http_start and http_stop
+static int server = -1;
+static pthread_t thread;
+static pthread_t workers[HTTP_WORKERS];
+static volatile int running = 0;
 
 char *get_mime_type(char *name) {
 
@@ -73,298 +117,639 @@ char *get_mime_type(char *name) {
     return NULL;
 }
 
-void send_headers(FILE *f, int status, char *title, char *extra, char *mime, int length) {
-    fprintf(f, "%s %d %s\r\n", PROTOCOL, status, title);
-    fprintf(f, "Server: %s\r\n", SERVER);
-    if (extra) fprintf(f, "%s\r\n", extra);
-    if (mime) fprintf(f, "Content-Type: %s\r\n", mime);
-
-    if (length >= 0) {
-    	fprintf(f, "Content-Length: %d\r\n", length);
-    } else {
-    	fprintf(f, "Transfer-Encoding: chunked\r\n");
-    }
+/*
+ * Output. Responses are built in the worker's output buffer, and sent to the
+ * socket when it's full, so headers and the beginning of the body go in the
+ * same segment, and file contents are read directly in it.
+ */
 
-    fprintf(f, "Connection: close\r\n");
+static void http_send(http_worker_t *w, const char *data, int len) {
+	int n;
 
-    fprintf(f, "Cache-Control: no-cache, no-store, must-revalidate\r\n");
-    fprintf(f, "no-cache\r\n");
-    fprintf(f, "0\r\n");
+	while (!w->error && (len > 0)) {
+		n = send(w->socket, data, len, 0);
+		if (n <= 0) {
+			w->error = 1;
+			return;
+		}
 
-	fprintf(f, "\r\n");
+		data += n;
+		len -= n;
+	}
 }
 
-#define HTTP_STATUS_LEN     3
-#define HTTP_ERROR_LINE_1   "<HTML><HEAD><TITLE>%d %s</TITLE></HEAD>\r\n"
-#define HTTP_ERROR_LINE_2   "<BODY><H4>%d %s</H4>\r\n"
-#define HTTP_ERROR_LINE_3   "%s\r\n"
-#define HTTP_ERROR_LINE_4   "</BODY></HTML>\r\n"
-#define HTTP_ERROR_VARS_LEN (2 * 5)
-
-void send_error(FILE *f, int status, char *title, char *extra, char *text) {
-	int len = strlen(title) * 2 +
-			  HTTP_STATUS_LEN * 2 +
-			  strlen(text) +
-			  strlen(HTTP_ERROR_LINE_1) +
-			  strlen(HTTP_ERROR_LINE_2) +
-			  strlen(HTTP_ERROR_LINE_3) +
-			  strlen(HTTP_ERROR_LINE_4) -
-			  HTTP_ERROR_VARS_LEN;
-
-    send_headers(f, status, title, extra, "text/html", len);
-    fprintf(f, HTTP_ERROR_LINE_1, status, title);
-    fprintf(f, HTTP_ERROR_LINE_2, status, title);
-    fprintf(f, HTTP_ERROR_LINE_3, text);
-    fprintf(f, HTTP_ERROR_LINE_4);
+static int http_room(http_worker_t *w) {
+	return HTTP_BUFF_SIZE - w->out_len - (w->chunked ? HTTP_CHUNK_TAIL : 0);
 }
 
-void send_file(FILE *f, char *path, struct stat *statbuf) {
-	//printf("HTTP: send file [%s]\r\n", path);
-    int n, buflen;
-    char *data; //[HTPP_BUFF_SIZE];
-
-	FILE *file = fopen(path, "r");
-
-    if (!file) {
-        send_error(f, 403, "Forbidden", NULL, "Access denied.");
-    } else {
-        int length = S_ISREG(statbuf->st_mode) ? statbuf->st_size : -1;
-        send_headers(f, 200, "OK", NULL, get_mime_type(path), length);
-
-        buflen = 8192;
-        if (length < 8192) buflen = length;
-        data = (char *)malloc(8192);
-        if (data) {
-        	while ((n = fread(data, 1, buflen, file)) > 0) fwrite(data, 1, n, f);
-    		free(data);
-        }
-        else {
-            send_error(f, 403, "Error", NULL, "File read.");
-        }
-        fclose(file);
-    }
+static void http_flush(http_worker_t *w, int last) {
+	char head[16];
+	int len;
+
+	if (w->chunked) {
+		len = w->out_len - w->chunk - HTTP_CHUNK_HEAD;
+		if (len > 0) {
+			snprintf(head, sizeof(head), "%04x\r\n", len);
+			memcpy(w->out + w->chunk, head, HTTP_CHUNK_HEAD);
+			memcpy(w->out + w->out_len, "\r\n", 2);
+			w->out_len += 2;
+		} else {
+			w->out_len = w->chunk;
+		}
+
+		if (last) {
+			memcpy(w->out + w->out_len, "0\r\n\r\n", 5);
+			w->out_len += 5;
+		}
+	}
+
+	http_send(w, w->out, w->out_len);
+
+	w->out_len = 0;
+	w->chunk = 0;
+
+	if (w->chunked) {
+		if (last) {
+			w->chunked = 0;
+		} else {
+			w->out_len = HTTP_CHUNK_HEAD;
+		}
+	}
 }
 
+static void http_write(http_worker_t *w, const char *data, int len) {
+	int n;
 
-static void chunk(FILE *f, const char *fmt, ...) {
-	char *buffer;
-	va_list args;
+	while (len > 0) {
+		if ((n = http_room(w)) == 0) {
+			http_flush(w, 0);
+			n = http_room(w);
+		}
 
-	buffer = (char *)malloc(2048);
-	if (buffer) {
-		*buffer = '\0';
+		if (n > len) n = len;
 
-		va_start(args, fmt);
+		memcpy(w->out + w->out_len, data, n);
+		w->out_len += n;
+		data += n;
+		len -= n;
+	}
+}
+
+static void http_printf(http_worker_t *w, const char *fmt, ...) {
+	va_list args;
+	int n, room;
 
-		vsnprintf(buffer, 2048, fmt, args);
+	room = http_room(w);
 
-		//printf("CHUNK: [%s]\r\n", buffer);
-		fprintf(f, "%x\r\n", strlen(buffer));
-		fprintf(f, "%s\r\n", buffer);
+	va_start(args, fmt);
+	n = vsnprintf(w->out + w->out_len, room + 1, fmt, args);
+	va_end(args);
 
+	if (n > room) {
+		// Don't fit, send the buffer and try again. Output is truncated if
+		// it's longer than the whole buffer.
+		http_flush(w, 0);
+		room = http_room(w);
+
+		va_start(args, fmt);
+		n = vsnprintf(w->out + w->out_len, room + 1, fmt, args);
 		va_end(args);
 
-		free(buffer);
+		if (n > room) n = room;
+	}
+
+	if (n > 0) {
+		w->out_len += n;
 	}
 }
 
-int process(FILE *f) {
-    char buf[HTPP_BUFF_SIZE];
-    char *method;
-    char *httppath;
-    char *path;
-    char *protocol;
-    struct stat statbuf;
-    char pathbuf[HTPP_BUFF_SIZE];
-    //int len;
+/*
+ * Responses
+ */
 
-    if (!fgets(buf, sizeof (buf), f)) return -1;
+static void send_headers(http_worker_t *w, int status, char *title, char *extra, char *mime, int length) {
+	http_printf(w, "%s %d %s\r\n", PROTOCOL, status, title);
+	http_printf(w, "Server: %s\r\n", SERVER);
+	if (extra) http_printf(w, "%s\r\n", extra);
+	if (mime) http_printf(w, "Content-Type: %s\r\n", mime);
 
-    method = strtok(buf, " ");
-    httppath = strtok(NULL, " ");
-    protocol = strtok(NULL, "\r");
+	if (length >= 0) {
+		http_printf(w, "Content-Length: %d\r\n", length);
+	} else {
+		http_printf(w, "Transfer-Encoding: chunked\r\n");
+	}
 
-    if (!method || !httppath || !protocol) {
-    	syslog(LOG_DEBUG, "HTTP: Error\r");
-    	return -1;
-    }
+	if (w->keep_alive) {
+		http_printf(w, "Connection: keep-alive\r\n");
+		http_printf(w, "Keep-Alive: timeout=%d, max=%d\r\n", HTTP_KEEP_ALIVE, HTTP_MAX_REQUESTS - w->requests);
+	} else {
+		http_printf(w, "Connection: close\r\n");
+	}
 
-    path = mount_resolve_to_logical(httppath);
+	http_printf(w, "Cache-Control: no-cache, no-store, must-revalidate\r\n");
+	http_printf(w, "\r\n");
 
-    syslog(LOG_DEBUG, "http: %s %s %s\r", method, path, protocol);
+	if (length < 0) {
+		// Body starts after the headers, in the same buffer
+		w->chunked = 1;
+		w->chunk = w->out_len;
+		w->out_len += HTTP_CHUNK_HEAD;
+	}
+}
 
-    fseek(f, 0, SEEK_CUR); // Force change of stream direction
+#define HTTP_ERROR_BODY \
+	"<HTML><HEAD><TITLE>%d %s</TITLE></HEAD>\r\n" \
+	"<BODY><H4>%d %s</H4>\r\n" \
+	"%s\r\n" \
+	"</BODY></HTML>\r\n"
 
-    if (strcasecmp(method, "GET") != 0) {
-        send_error(f, 501, "Not supported", NULL, "Method is not supported.");
-        return -1;
-    }
+static void send_error(http_worker_t *w, int status, char *title, char *extra, char *text) {
+	int len = snprintf(NULL, 0, HTTP_ERROR_BODY, status, title, status, title, text);
 
-    DIR *dir;
-	struct dirent *de;
-	dir = opendir(path);
-	if (!dir) {
-		if (stat(path, &statbuf) == 0) {
-			send_file(f, path, &statbuf);
+	send_headers(w, status, title, extra, "text/html", len);
+	http_printf(w, HTTP_ERROR_BODY, status, title, status, title, text);
+	http_flush(w, 1);
+}
+
+static void send_file(http_worker_t *w, char *path, struct stat *statbuf) {
+	int fd, n, length, sent;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		send_error(w, 403, "Forbidden", NULL, "Access denied.");
+		return;
+	}
+
+	length = statbuf->st_size;
+	send_headers(w, 200, "OK", NULL, get_mime_type(path), length);
+
+	// Read the file directly into the output buffer, after the headers for the
+	// first block
+	sent = 0;
+	while (!w->error && (sent < length)) {
+		n = read(fd, w->out + w->out_len, http_room(w));
+		if (n <= 0) {
+			break;
 		}
-		send_error(f, 404, "Not Found", NULL, "File not found.");
-		syslog(LOG_DEBUG, "http: %s Not found\r", path);
-		return -1;
+
+		w->out_len += n;
+		sent += n;
+
+		http_flush(w, 0);
 	}
-	snprintf(pathbuf, sizeof (pathbuf), "%s/index.html", path);
-	if (stat(pathbuf, &statbuf) >= 0) {
-		closedir(dir);
-		send_file(f, pathbuf, &statbuf);
-		return 0;
+
+	http_flush(w, 1);
+	close(fd);
+
+	if (sent != length) {
+		// The client can't find where the next response begins
+		syslog(LOG_DEBUG, "http: %s read error\r", path);
+		w->error = 1;
 	}
+}
 
-	send_headers(f, 200, "OK", NULL, "text/html", -1);
-	chunk(f, "<!DOCTYPE html><HTML><HEAD><TITLE>Index of %s</TITLE></HEAD><BODY background=\"/sd/www/bg1.png\">", path);
-	chunk(f, "<H4>Index of %s<hr></H4>", path);
+static void send_dir(http_worker_t *w, char *path, DIR *dir) {
+	struct dirent *de;
+	struct stat statbuf;
+	struct tm tm_info;
+	char pathbuf[PATH_MAX + 1];
+	char tbuffer[80];
+	int statok;
 
-	//chunk(f, "<TABLE>");
-	chunk(f, "<TABLE style=\"border-collapse:collapse;\" cellpadding=\"4\" bordercolor=\"888888\" background=\"/sd/www/bg3.jpg\" border=\"1\">");
-	chunk(f, "<TR>");
-	chunk(f, "<TH style=\"width: 250;text-align: left;\" background=\"/sd/www/bg4.jpg\">Name</TH>");
-	chunk(f, "<TH style=\"width: 100px;text-align: right;\" background=\"/sd/www/bg4.jpg\">Size</TH>");
-	chunk(f, "<TH style=\"width: 200px;text-align: right;\" background=\"/sd/www/bg4.jpg\">Time</TH>");
-	chunk(f, "</TR>");
+	send_headers(w, 200, "OK", NULL, "text/html", -1);
+	http_printf(w, "<!DOCTYPE html><HTML><HEAD><TITLE>Index of %s</TITLE></HEAD><BODY background=\"/sd/www/bg1.png\">", path);
+	http_printf(w, "<H4>Index of %s<hr></H4>", path);
 
-	chunk(f, "<TR>");
-	chunk(f, "<TD><A HREF=\"..\">..</A></TD><TD></TD> <TD> </TD>");
-	chunk(f, "</TR>");
+	http_printf(w, "<TABLE style=\"border-collapse:collapse;\" cellpadding=\"4\" bordercolor=\"888888\" background=\"/sd/www/bg3.jpg\" border=\"1\">");
+	http_printf(w, "<TR>");
+	http_printf(w, "<TH style=\"width: 250;text-align: left;\" background=\"/sd/www/bg4.jpg\">Name</TH>");
+	http_printf(w, "<TH style=\"width: 100px;text-align: right;\" background=\"/sd/www/bg4.jpg\">Size</TH>");
+	http_printf(w, "<TH style=\"width: 200px;text-align: right;\" background=\"/sd/www/bg4.jpg\">Time</TH>");
+	http_printf(w, "</TR>");
 
-	char tbuffer[80];
-	struct tm *tm_info;
-	int statok = -1;
+	http_printf(w, "<TR>");
+	http_printf(w, "<TD><A HREF=\"..\">..</A></TD><TD></TD> <TD> </TD>");
+	http_printf(w, "</TR>");
 
-	while ((de = readdir(dir)) != NULL) {
-		strcpy(pathbuf, path);
-		if (strcmp(path, "/") != 0) strcat(pathbuf,"/");
-		strcat(pathbuf, de->d_name);
-		tbuffer[0] = '\0';
-		//printf("HTTP: dir [%s] [%s]\r\n", path, pathbuf);
+	while (!w->error && ((de = readdir(dir)) != NULL)) {
+		strlcpy(pathbuf, path, sizeof(pathbuf));
+		if (strcmp(path, "/") != 0) strlcat(pathbuf, "/", sizeof(pathbuf));
+		strlcat(pathbuf, de->d_name, sizeof(pathbuf));
 
 		statok = stat(pathbuf, &statbuf);
-		if ( statok == 0) {
-			tm_info = localtime(&statbuf.st_mtime);
-			strftime(tbuffer, 80, "%d/%m/%Y %R", tm_info);
+		if (statok == 0) {
+			localtime_r(&statbuf.st_mtime, &tm_info);
+			strftime(tbuffer, sizeof(tbuffer), "%d/%m/%Y %R", &tm_info);
+		} else {
+			strcpy(tbuffer, "  ");
 		}
-		else sprintf(tbuffer, "  ");
 
-		chunk(f, "<TR>");
+		http_printf(w, "<TR>");
 
 		// File name
-		chunk(f, "<TD>");
-		chunk(f, "<A HREF=\"%s%s\">", de->d_name, (de->d_type != DT_REG) ? "/" : "");
-		chunk(f, "%s%s", de->d_name, (de->d_type != DT_REG) ? "/</A>" : "</A> ");
-		chunk(f, "</TD>");
+		http_printf(w, "<TD><A HREF=\"%s%s\">%s%s</TD>",
+				de->d_name, (de->d_type != DT_REG) ? "/" : "",
+				de->d_name, (de->d_type != DT_REG) ? "/</A>" : "</A> ");
+
 		// File size
-		chunk(f, "<TD style=\"text-align: right;\">");
+		http_printf(w, "<TD style=\"text-align: right;\">");
 		if (de->d_type == DT_REG) {
-			if ( statok == 0) chunk(f, "%d", (int)statbuf.st_size);
-			else chunk(f, "?");
-		}
-		else {
-			chunk(f, "DIR");
+			if (statok == 0) http_printf(w, "%d", (int)statbuf.st_size);
+			else http_printf(w, "?");
+		} else {
+			http_printf(w, "DIR");
 		}
-		chunk(f, "</TD>");
+		http_printf(w, "</TD>");
+
 		// File time
-		chunk(f, "<TD style=\"text-align: right;\">");
-		chunk(f, "%s", tbuffer);
-		chunk(f, "</TD>");
+		http_printf(w, "<TD style=\"text-align: right;\">%s</TD>", tbuffer);
 
-		chunk(f, "</TR>");
+		http_printf(w, "</TR>");
 	}
+
+	http_printf(w, "</TABLE>");
+	http_printf(w, "</BODY></HTML>");
+
+	http_flush(w, 1);
+}
+
+/*
+ * Requests
+ */
+
+// Reads a request header in the worker's request buffer, and returns its
+// length, 0 if the connection is closed, or -1 if the header is too large.
+// Bytes past the header (pipelined requests) are left in the buffer.
+static int read_request(http_worker_t *w) {
+	char *end;
+	int n;
+
+	for(;;) {
+		w->req[w->req_len] = '\0';
+		if ((end = strstr(w->req, "\r\n\r\n"))) {
+			return end - w->req + 4;
+		}
+
+		if (w->req_len == HTTP_REQ_SIZE) {
+			return -1;
+		}
+
+		n = recv(w->socket, w->req + w->req_len, HTTP_REQ_SIZE - w->req_len, 0);
+		if (n <= 0) {
+			return 0;
+		}
+
+		w->req_len += n;
+	}
+}
+
+static void process(http_worker_t *w, int len) {
+	char *method;
+	char *httppath;
+	char *protocol;
+	char *line;
+	char *last;
+	char *path;
+	struct stat statbuf;
+	DIR *dir;
+
+	// Terminate the request header, after the last CRLF
+	w->req[len - 1] = '\0';
+
+	method = strtok_r(w->req, " ", &last);
+	httppath = strtok_r(NULL, " ", &last);
+	protocol = strtok_r(NULL, "\r", &last);
+
+	if (!method || !httppath || !protocol) {
+		syslog(LOG_DEBUG, "http: bad request\r");
+		w->keep_alive = 0;
+		send_error(w, 400, "Bad Request", NULL, "Bad request.");
+		return;
+	}
+
+	// HTTP/1.1 connections are persistent, unless the client says otherwise
+	w->keep_alive = (strcmp(protocol, "HTTP/1.1") == 0);
+
+	while ((line = strtok_r(NULL, "\r\n", &last))) {
+		if (strncasecmp(line, "Connection:", 11) == 0) {
+			line += 11;
+			while (*line == ' ') line++;
+
+			if (strncasecmp(line, "close", 5) == 0) {
+				w->keep_alive = 0;
+			} else if (strncasecmp(line, "keep-alive", 10) == 0) {
+				w->keep_alive = 1;
+			}
+		} else if (strncasecmp(line, "Content-Length:", 15) == 0) {
+			// Request bodies are not read
+			if (atoi(line + 15) > 0) {
+				w->keep_alive = 0;
+			}
+		}
+	}
+
+	// Close the connection after this response if there are connections
+	// waiting for a worker, or if the server is stopping
+	if ((HTTP_KEEP_ALIVE == 0) || (w->requests + 1 >= HTTP_MAX_REQUESTS) ||
+		!running || (uxQueueMessagesWaiting(queue) > 0)) {
+		w->keep_alive = 0;
+	}
+
+	w->requests++;
+
+	if (strcasecmp(method, "GET") != 0) {
+		w->keep_alive = 0;
+		send_error(w, 501, "Not supported", NULL, "Method is not supported.");
+		return;
+	}
+
+	// Query string is not used
+	if ((line = strchr(httppath, '?'))) {
+		*line = '\0';
+	}
+
+	path = mount_resolve_to_logical(httppath);
+	if (!path) {
+		send_error(w, 500, "Internal Server Error", NULL, "Not enough memory.");
+		return;
+	}
+
+	strlcpy(w->path, path, sizeof(w->path));
+	free(path);
+	path = w->path;
+
+	syslog(LOG_DEBUG, "http: %s %s %s\r", method, path, protocol);
+
+	dir = opendir(path);
+	if (!dir) {
+		if ((stat(path, &statbuf) == 0) && S_ISREG(statbuf.st_mode)) {
+			send_file(w, path, &statbuf);
+		} else {
+			syslog(LOG_DEBUG, "http: %s Not found\r", path);
+			send_error(w, 404, "Not Found", NULL, "File not found.");
+		}
+		return;
+	}
+
+	// Serve the index file if there is one, or the directory listing
+	len = strlen(path);
+	strlcat(w->path, (strcmp(path, "/") != 0) ? "/index.html" : "index.html", sizeof(w->path));
+	if ((stat(w->path, &statbuf) == 0) && S_ISREG(statbuf.st_mode)) {
+		closedir(dir);
+		send_file(w, w->path, &statbuf);
+		return;
+	}
+
+	w->path[len] = '\0';
+	send_dir(w, path, dir);
 	closedir(dir);
+}
 
+static void serve(http_worker_t *w, int client) {
+	struct linger so_linger;
+	struct timeval tout;
+	int flag = 1;
+	int len;
+
+	// We waiting for send all data before close socket's stream
+	so_linger.l_onoff  = 1;
+	so_linger.l_linger = 10;
+	setsockopt(client, SOL_SOCKET, SO_LINGER, &so_linger, sizeof(so_linger));
+
+	// Responses are sent in full buffers, don't wait for more data
+	setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+
+	// Set a timeout for send / receive
+	tout.tv_sec = HTTP_REQ_TIMEOUT;
+	tout.tv_usec = 0;
+
+	setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &tout, sizeof(tout));
+	setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &tout, sizeof(tout));
+
+	w->socket = client;
+	w->requests = 0;
+	w->keep_alive = 0;
+	w->chunked = 0;
+	w->chunk = 0;
+	w->error = 0;
+	w->req_len = 0;
+	w->out_len = 0;
+
+	for(;;) {
+		len = read_request(w);
+		if (len == 0) {
+			break;
+		}
 
-	chunk(f, "</TABLE>");
+		if (len < 0) {
+			w->keep_alive = 0;
+			send_error(w, 431, "Request Header Fields Too Large", NULL, "Request is too large.");
+			break;
+		}
 
-	chunk(f, "</BODY></HTML>", SERVER);
+		process(w, len);
+		if (w->error || !w->keep_alive) {
+			break;
+		}
+
+		// Keep the next request, if it's already received
+		w->req_len -= len;
+		memmove(w->req, w->req + len, w->req_len);
+
+		if (w->requests == 1) {
+			// Wait for the next request for the keep-alive timeout
+			tout.tv_sec = HTTP_KEEP_ALIVE;
+			setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &tout, sizeof(tout));
+		}
+	}
 
-	fprintf(f, "0\r\n\r\n");
-    return 0;
+	close(client);
 }
 
-static void *http_thread(void *arg) {
-    struct sockaddr_in sin;
-	int server;
+static void *http_worker(void *arg) {
+	http_worker_t *w = (http_worker_t *)arg;
+	int client;
 
-	server = socket(AF_INET, SOCK_STREAM, 0);
+	for(;;) {
+		if (xQueueReceive(queue, &client, portMAX_DELAY) != pdTRUE) {
+			continue;
+		}
 
+		if (client < 0) {
+			// Server is stopped
+			break;
+		}
 
-    sin.sin_family      = AF_INET;
-    sin.sin_addr.s_addr = INADDR_ANY;
-    sin.sin_port        = htons(PORT);
-    bind(server, (struct sockaddr *) &sin, sizeof (sin));
+		serve(w, client);
+	}
 
-    listen(server, 5);
-    syslog(LOG_INFO, "http: server listening on port %d\n", PORT);
+	free(w);
 
-    while (1) {
-    	int client;
+	pthread_exit(NULL);
+}
 
-    	// Wait for a request ...
-        if ((client = accept(server, NULL, NULL)) != -1) {
-        	// We waiting for send all data before close socket's stream
-        	struct linger so_linger;
+// Stops the first n workers, after the queued connections are served
+static void stop_workers(int n) {
+	int client = -1;
+	int i;
 
-        	so_linger.l_onoff  = 1;
-        	so_linger.l_linger = 10;
+	for(i = 0;i < n;i++) {
+		xQueueSend(queue, &client, portMAX_DELAY);
+	}
 
-            setsockopt(client, SOL_SOCKET, SO_LINGER, &so_linger, sizeof(so_linger));
+	for(i = 0;i < n;i++) {
+		pthread_join(workers[i], NULL);
+	}
+}
 
-            // Set a timeout for send / receive
-            struct timeval tout;
+static void *http_thread(void *arg) {
+	struct timeval tout;
+	int client;
 
-            tout.tv_sec = 10;
-            tout.tv_usec = 0;
+	// Wake up from accept to check if server is stopped
+	tout.tv_sec = 1;
+	tout.tv_usec = 0;
+	setsockopt(server, SOL_SOCKET, SO_RCVTIMEO, &tout, sizeof(tout));
 
-            setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &tout, sizeof(tout));
-            setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &tout, sizeof(tout));
+	syslog(LOG_INFO, "http: server listening on port %d\n", PORT);
 
-            // Create the socket stream
-            FILE *stream = fdopen(client, "a+");
-            process(stream);
-            fclose(stream);
-        }
-    }
+	while (running) {
+		// Wait for a request ...
+		if ((client = accept(server, NULL, NULL)) < 0) {
+			continue;
+		}
 
-    close(server);
+		// ... and for a free worker
+		while (xQueueSend(queue, &client, 1000 / portTICK_PERIOD_MS) != pdTRUE) {
+			if (!running) {
+				close(client);
+				break;
+			}
+		}
+	}
 
-    pthread_exit(NULL);
+	close(server);
+	server = -1;
+
+	stop_workers(HTTP_WORKERS);
+
+	pthread_exit(NULL);
 }
 
-void http_start() {
+/*
+ * Starts the server. Returns 0 if it's listening (or it was running), or -1
+ * if the port can't be listened or the threads can't be started, with errno set.
+ */
+int http_start() {
+	struct sockaddr_in sin;
 	pthread_attr_t attr;
 	struct sched_param sched;
-	pthread_t thread;
-	int res;
+	http_worker_t *w;
+	int res, flag = 1;
+	int i;
+
+	if (running) {
+		return 0;
+	}
+
+	// Listen in the caller, so errors are returned to it
+	server = socket(AF_INET, SOCK_STREAM, 0);
+	if (server < 0) {
+		syslog(LOG_ERR, "http: cannot create socket\n");
+		return -1;
+	}
+
+	setsockopt(server, SOL_SOCKET, SO_REUSEADDR, &flag, sizeof(flag));
+
+	sin.sin_family      = AF_INET;
+	sin.sin_addr.s_addr = INADDR_ANY;
+	sin.sin_port        = htons(PORT);
+
+	if ((bind(server, (struct sockaddr *) &sin, sizeof (sin)) < 0) || (listen(server, 5) < 0)) {
+		res = errno;
+		syslog(LOG_ERR, "http: cannot listen on port %d\n", PORT);
+		close(server);
+		server = -1;
+		errno = res;
+		return -1;
+	}
+
+	queue = xQueueCreate(HTTP_WORKERS, sizeof(int));
+	if (!queue) {
+		syslog(LOG_ERR, "http: cannot create queue\n");
+		close(server);
+		server = -1;
+		errno = ENOMEM;
+		return -1;
+	}
+
+	running = 1;
 
 	// Init thread attributes
 	pthread_attr_init(&attr);
 
 	// Set stack size
-    pthread_attr_setstacksize(&attr, CONFIG_LUA_RTOS_LUA_STACK_SIZE);
+	pthread_attr_setstacksize(&attr, HTTP_WORKER_STACK_SIZE);
+
+	// Set priority
+	sched.sched_priority = CONFIG_LUA_RTOS_LUA_TASK_PRIORITY;
+	pthread_attr_setschedparam(&attr, &sched);
+
+	// Set CPU
+	cpu_set_t cpu_set = CONFIG_LUA_RTOS_LUA_TASK_CPU;
+	pthread_attr_setaffinity_np(&attr, sizeof(cpu_set_t), &cpu_set);
+
+	// Create workers, each one with its own buffers
+	for(i = 0;i < HTTP_WORKERS;i++) {
+		w = (http_worker_t *)malloc(sizeof(http_worker_t));
+		if (!w) {
+			res = ENOMEM;
+			break;
+		}
 
-    // Set priority
-    sched.sched_priority = CONFIG_LUA_RTOS_LUA_TASK_PRIORITY;
-    pthread_attr_setschedparam(&attr, &sched);
+		res = pthread_create(&workers[i], &attr, http_worker, w);
+		if (res) {
+			free(w);
+			break;
+		}
+	}
 
-    // Set CPU
-    cpu_set_t cpu_set = CONFIG_LUA_RTOS_LUA_TASK_CPU;
-    pthread_attr_setaffinity_np(&attr, sizeof(cpu_set_t), &cpu_set);
+	// Create thread, that only accepts the connections
+	if (!res) {
+		pthread_attr_setstacksize(&attr, HTTP_THREAD_STACK_SIZE);
 
-    // Create thread
-    res = pthread_create(&thread, &attr, http_thread, NULL);
-    if (res) {
-		panic("Cannot start http_thread");
+		res = pthread_create(&thread, &attr, http_thread, NULL);
 	}
+
+	if (res) {
+		// Stop the workers already started, that free their buffers
+		syslog(LOG_ERR, "http: cannot start threads\n");
+		stop_workers(i);
+
+		vQueueDelete(queue);
+		queue = NULL;
+		running = 0;
+
+		close(server);
+		server = -1;
+		errno = res;
+		return -1;
+	}
+
+	return 0;
 }
 
 void http_stop() {
+	if (!running) {
+		return;
+	}
+
+	// The thread stops the workers
+	running = 0;
+	pthread_join(thread, NULL);
 
+	vQueueDelete(queue);
+	queue = NULL;
 }
 
 #endif
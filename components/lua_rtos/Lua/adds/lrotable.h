@@ -73,6 +73,23 @@ typedef struct
   const TValue value;
 } luaR_entry;
 
+/*
+ * Perfect hash index for the string keys of a read only table, emitted at build
+ * time by Lua/tools/gen_rotable_index.py (see luaR_hash in lrotable.c).
+ *
+ * The key hash selects a bucket, the bucket displacement selects a slot, and the
+ * slot holds the entry position + 1 (0 if slot is empty).
+ */
+typedef struct
+{
+  uint32_t sign;        /* signature of the table keys */
+  uint16_t entries;     /* number of entries in the table */
+  uint16_t size_mask;   /* number of slots - 1 (power of 2) */
+  uint16_t bucket_mask; /* number of buckets - 1 (power of 2) */
+  const uint8_t *disp;  /* displacement for each bucket */
+  const uint8_t *slots; /* entry position + 1 for each slot */
+} luaR_hindex;
+
 const TValue* luaR_findglobal(const char *key);
 int luaR_findfunction(lua_State *L, const luaR_entry *ptable);
 const TValue* luaR_findentry(const void *pentry, const char *strkey, luaR_numkey numkey, unsigned *ppos);
@@ -86,6 +103,7 @@ void luaR_next(lua_State *L, void *data, TValue *key, TValue *val);
 int luaH_next_ro (lua_State *L, void *t, StkId key);
 
 int luaR_index(lua_State *L, const void *funcs, const void *consts);
+void luaR_hindex_init();
 int luaR_error(lua_State *L);
 LUALIB_API int luaL_newmetarotable (lua_State *L, const char* tname, void *p);
 
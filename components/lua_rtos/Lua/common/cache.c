@@ -34,6 +34,7 @@
 #include "cache.h"
 
 #include "esp_attr.h"
+#include "lauxlib.h"
 
 #include <stddef.h>
 #include <stdlib.h>
@@ -41,122 +42,159 @@
 
 static rotable_cache_t cache;
 
-void rotable_cache_dump() {
-	struct rotable_cache_entry *entry = cache.first;
-	int i = 0;
+static inline uint32_t rotable_cache_set(const luaR_entry *rotable, const char *strkey) {
+	uint32_t h = (((uint32_t)(uintptr_t)rotable >> 2) ^ ((uint32_t)(uintptr_t)strkey)) * 0x9e3779b1;
 
-	while (entry) {
-		printf("[%d]: used %d ", i, entry->used);
+	return (h ^ (h >> 16)) & (ROTABLE_CACHE_SETS - 1);
+}
+
+void rotable_cache_stats(uint32_t *hit, uint32_t *miss) {
+	int i;
+
+	*hit = 0;
+	*miss = 0;
+
+	for(i = 0;i < portNUM_PROCESSORS;i++) {
+		*hit += cache.hit[i];
+		*miss += cache.miss[i];
+	}
+}
+
+int rotable_cache_dump(lua_State *L) {
+	struct rotable_cache_entry *entry;
+	uint32_t hit, miss;
+	int i;
+
+	if (!cache.entries) {
+		return 0;
+	}
+
+	for(i = 0;i < ROTABLE_CACHE_LENGTH;i++) {
+		entry = &cache.entries[i];
 
-		if (entry->rotable) {
-			if (entry->entry->key.len) {
-				printf("%s\r\n", entry->entry->key.id.strkey);
-			}
+		printf("[%d]: ", i);
+
+		if (entry->entry) {
+			printf("%s\r\n", entry->entry->key.id.strkey);
 		} else {
-			printf("emppty\r\n");
+			printf("empty\r\n");
 		}
-
-		entry = entry->next;
-		i++;
 	}
 
 	printf("\r\n");
 
-	printf("hit: %d, miss: %d\r\n", cache.hit, cache.miss);
+	rotable_cache_stats(&hit, &miss);
+	printf("hit: %u, miss: %u\r\n", hit, miss);
 
 	printf("\r\n\r\n");
+
+	return 0;
 }
 
 int rotable_cache_init() {
-	struct rotable_cache_entry *entries;
-	int i;
+	if (cache.entries) {
+		return 0;
+	}
 
 	// Allocate space for cache entries
-	entries = (struct rotable_cache_entry *)calloc(ROTABLE_CACHE_LENGTH, sizeof(struct rotable_cache_entry));
-	if (!entries) {
+	cache.entries = (struct rotable_cache_entry *)calloc(ROTABLE_CACHE_LENGTH, sizeof(struct rotable_cache_entry));
+	if (!cache.entries) {
+		return 1;
+	}
+
+	cache.mru = (uint8_t *)calloc(ROTABLE_CACHE_SETS, sizeof(uint8_t));
+	if (!cache.mru) {
+		free(cache.entries);
+		cache.entries = NULL;
+
 		return 1;
 	}
 
-	cache.first = entries;
+	return 0;
+}
+
+const IRAM_ATTR luaR_entry *rotable_cache_get(const luaR_entry *rotable, const char *strkey) {
+	struct rotable_cache_entry *entry;
+	const luaR_entry *cached;
+	uint32_t set, seq;
+	int way;
 
-	// Initialize linked list
-	entries->previous = NULL;
+	if (!cache.entries) {
+		return NULL;
+	}
 
-	for(i = 0;i < ROTABLE_CACHE_LENGTH;i++) {
-		entries->next = (entries + 1);
+	set = rotable_cache_set(rotable, strkey);
+	entry = &cache.entries[set * ROTABLE_CACHE_WAYS];
 
-		if (i > 0) {
-			entries->previous = (entries - 1);
+	for(way = 0;way < ROTABLE_CACHE_WAYS;way++, entry++) {
+		seq = entry->seq;
+		if (seq & 1) {
+			// Entry is being updated
+			continue;
 		}
-		entries++;
-	}
 
-	entries--;
+		__sync_synchronize();
 
-	entries->next = NULL;
+		cached = entry->entry;
+		if ((entry->rotable != rotable) || (entry->strkey != strkey)) {
+			continue;
+		}
 
-	cache.last = entries;
+		__sync_synchronize();
 
-	return 0;
-}
+		if (entry->seq != seq) {
+			continue;
+		}
 
-const IRAM_ATTR TValue *rotable_cache_get(const luaR_entry *rotable, const char *strkey) {
-	struct rotable_cache_entry *entry = cache.first;
-
-	// rotable strkey is cached?
-	while (entry) {
-		if ((entry->rotable == rotable) && (!strcmp(entry->entry->key.id.strkey, strkey))) {
-			// hit
-			cache.hit++;
-			entry->used++;
-
-			// Promote this entry to the head
-			if (entry != cache.first) {
-				if (entry != cache.last) {
-					entry->previous->next = entry->next;
-					entry->next->previous = entry->previous;
-					cache.first->previous = entry;
-					entry->next = cache.first;
-					cache.first = entry;
-				} else {
-					cache.last->previous->next = NULL;
-					cache.last = cache.last->previous;
-					entry->next = cache.first;
-					entry->previous = NULL;
-					cache.first->previous = entry;
-					cache.first = entry;
-				}
-			}
-
-			return &entry->entry->value;
-			break;
+		// The key address can be reused by other string after a garbage
+		// collection, so check that cached entry has the key
+		if (strcmp(cached->key.id.strkey, strkey)) {
+			continue;
 		}
 
-		entry = entry->next;
+		// hit
+		__sync_fetch_and_add(&cache.hit[xPortGetCoreID()], 1);
+		cache.mru[set] = way;
+
+		return cached;
 	}
 
 	// miss
-	cache.miss++;
+	__sync_fetch_and_add(&cache.miss[xPortGetCoreID()], 1);
 
 	return NULL;
 }
 
-void IRAM_ATTR rotable_cache_put(const luaR_entry *rotable, const luaR_entry *entry) {
-	struct rotable_cache_entry *first  = cache.last;
-	struct rotable_cache_entry *second = cache.first;
-	struct rotable_cache_entry *last   = cache.last->previous;
+void IRAM_ATTR rotable_cache_put(const luaR_entry *rotable, const char *strkey, const luaR_entry *entry) {
+	struct rotable_cache_entry *victim;
+	uint32_t set, seq;
+	int way;
+
+	if (!cache.entries) {
+		return;
+	}
+
+	// Replace the least recently used way
+	set = rotable_cache_set(rotable, strkey);
+	way = (cache.mru[set] + 1) % ROTABLE_CACHE_WAYS;
+	victim = &cache.entries[set * ROTABLE_CACHE_WAYS + way];
+
+	// Take the entry. If other writer has it, or it's taken between the
+	// read and the swap, give up: this is only a cache.
+	seq = victim->seq;
+	if ((seq & 1) || !__sync_bool_compare_and_swap(&victim->seq, seq, seq + 1)) {
+		return;
+	}
+
+	victim->rotable = rotable;
+	victim->strkey = strkey;
+	victim->entry = entry;
 
-	first->next      = second;
-	first->previous  = NULL;
-	second->previous = first;
-	last->next       = NULL;
+	__sync_synchronize();
 
-	first->rotable = (luaR_entry *)rotable;
-	first->entry = (luaR_entry *)entry;
+	victim->seq = seq + 2;
 
-	cache.first = first;
-	cache.first->used = 1;
-	cache.last = last;
+	cache.mru[set] = way;
 }
 
 /*
@@ -33,33 +33,53 @@
 
 #include "lrotable.h"
 
+#include <freertos/FreeRTOS.h>
+
 #ifndef ROTABLE_CACHE_H
 #define ROTABLE_CACHE_H
 
-#define ROTABLE_CACHE_LENGTH 8
+/*
+ * The cache is 2-way set associative, and it's indexed by the rotable
+ * address and the key address. Keys passed by the Lua VM are interned
+ * strings, so the same key has always the same address.
+ */
+#define ROTABLE_CACHE_LENGTH CONFIG_LUA_RTOS_LUA_ROTABLE_CACHE_SIZE
+#define ROTABLE_CACHE_WAYS   2
+#define ROTABLE_CACHE_SETS   (ROTABLE_CACHE_LENGTH / ROTABLE_CACHE_WAYS)
 
-struct rotable_cache_entry {
-	struct rotable_cache_entry *previous; // Previous entry
-	struct rotable_cache_entry *next;     // Next entry
+#if (ROTABLE_CACHE_SETS & (ROTABLE_CACHE_SETS - 1)) || (ROTABLE_CACHE_SETS == 0)
+#error "CONFIG_LUA_RTOS_LUA_ROTABLE_CACHE_SIZE must be a power of 2, and at least 2"
+#endif
 
-	luaR_entry *rotable; // cached rotable
-	luaR_entry *entry;   // cached entry
+/*
+ * A cache entry. Readers don't take any lock: seq is odd while a writer is
+ * updating the entry, and changes after each update, so a reader that
+ * reads the same even seq before and after reading the entry got a
+ * consistent copy of it.
+ */
+struct rotable_cache_entry {
+	volatile uint32_t seq;
 
-	uint32_t used;
+	const luaR_entry *rotable; // cached rotable
+	const char *strkey;        // key, as passed to rotable_cache_get
+	const luaR_entry *entry;   // cached entry
 };
 
 typedef struct {
-	uint32_t miss; // Number of cache misses
-	uint32_t hit;  // Number of cache hits
+	// Counters are per core, so the cores don't contend for them. They're updated
+	// atomically, as a task can be preempted or moved to the other core meanwhile
+	uint32_t miss[portNUM_PROCESSORS]; // Number of cache misses
+	uint32_t hit[portNUM_PROCESSORS];  // Number of cache hits
 
-	struct rotable_cache_entry *first; // First entry
-	struct rotable_cache_entry *last;  // Last entry
+	struct rotable_cache_entry *entries;
+	uint8_t *mru; // Most recently used way of each set
 } rotable_cache_t;
 
-void rotable_cache_dump();
+int rotable_cache_dump(lua_State *L);
 int rotable_cache_init();
-const TValue *rotable_cache_get(const luaR_entry *rotable, const char *strkey);
-void rotable_cache_put(const luaR_entry *rotable, const luaR_entry *entry);
+const luaR_entry *rotable_cache_get(const luaR_entry *rotable, const char *strkey);
+void rotable_cache_put(const luaR_entry *rotable, const char *strkey, const luaR_entry *entry);
+void rotable_cache_stats(uint32_t *hit, uint32_t *miss);
 
 #endif
 
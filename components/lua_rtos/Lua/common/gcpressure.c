@@ -0,0 +1,202 @@
+/*
+ * Lua RTOS, tuning of the Lua garbage collector under memory pressure
+ *
+ * Copyright (C) 2015 - 2017
+ * IBEROXARXA SERVICIOS INTEGRALES, S.L. & CSS IBÉRICA, S.L.
+ *
+ * Author: Jaume Olivé (jolive@iberoxarxa.com / jolive@whitecatboard.org)
+ *
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software
+ * and its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that the copyright notice and this
+ * permission notice and warranty disclaimer appear in supporting
+ * documentation, and that the name of the author not be used in
+ * advertising or publicity pertaining to distribution of the
+ * software without specific, written prior permission.
+ *
+ * The author disclaim all warranties with regard to this
+ * software, including all implied warranties of merchantability
+ * and fitness.  In no event shall the author be liable for any
+ * special, indirect or consequential damages or any damages
+ * whatsoever resulting from loss of use, data or profits, whether
+ * in an action of contract, negligence or other tortious action,
+ * arising out of or in connection with the use or performance of
+ * this software.
+ */
+
+#include "luartos.h"
+
+#include "lua.h"
+#include "lgc.h"
+#include "lstate.h"
+
+#include "gcpressure.h"
+
+#include <freertos/FreeRTOS.h>
+
+#include <stdint.h>
+#include <sys/time.h>
+
+#define LOW_WATERMARK  (CONFIG_LUA_RTOS_LUA_GC_LOW_WATERMARK * 1024)
+#define HIGH_WATERMARK (CONFIG_LUA_RTOS_LUA_GC_HIGH_WATERMARK * 1024)
+
+// Most aggressive tuning, at the low watermark
+#define MIN_PAUSE      100
+#define STEPMUL_FACTOR 4
+
+// Pressure, from 0 at the high watermark to PRESSURE_MAX at the low one
+#define PRESSURE_MAX   256
+
+static portMUX_TYPE gc_pressure_mux = portMUX_INITIALIZER_UNLOCKED;
+
+static gc_pressure_stats_t stats = {.min_free = SIZE_MAX};
+static int enabled = 1;
+
+static uint64_t now_us() {
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+
+    return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+static size_t free_heap() {
+    size_t free = xPortGetFreeHeapSize();
+
+    // The minimum doesn't need to be exact
+    if (free < stats.min_free) {
+        stats.min_free = free;
+    }
+
+    return free;
+}
+
+// Free heap needed to end a cycle at the most aggressive step multiplier
+static size_t low_watermark(size_t cycle) {
+    return LOW_WATERMARK + cycle / STEPMUL_FACTOR;
+}
+
+static size_t high_watermark(size_t cycle) {
+    return HIGH_WATERMARK + cycle;
+}
+
+static int pressure(size_t free, size_t cycle) {
+    size_t low = low_watermark(cycle), high = high_watermark(cycle);
+
+    if (free >= high) return 0;
+    if (free <= low) return PRESSURE_MAX;
+
+    return ((uint64_t)(high - free) * PRESSURE_MAX) / (high - low);
+}
+
+int gc_pressure_pause(int pause, size_t cycle) {
+    int p;
+
+    if (!enabled || (pause <= MIN_PAUSE)) {
+        return pause;
+    }
+
+    if ((p = pressure(free_heap(), cycle))) {
+        __sync_add_and_fetch(&stats.tuned, 1);
+        pause -= ((pause - MIN_PAUSE) * p) / PRESSURE_MAX;
+    }
+
+    return pause;
+}
+
+int gc_pressure_stepmul(int stepmul, size_t cycle) {
+    int p;
+
+    if (!enabled) {
+        return stepmul;
+    }
+
+    if ((p = pressure(free_heap(), cycle))) {
+        __sync_add_and_fetch(&stats.tuned, 1);
+        stepmul += (stepmul * (STEPMUL_FACTOR - 1) * p) / PRESSURE_MAX;
+    }
+
+    return stepmul;
+}
+
+size_t gc_pressure_threshold(size_t total, size_t threshold, size_t cycle) {
+    size_t free, low, room;
+
+    if (!enabled) {
+        return threshold;
+    }
+
+    // The state can grow until the free heap is at the low watermark
+    free = free_heap();
+    low = low_watermark(cycle);
+    room = (free > low)?free - low:0;
+
+    if ((threshold > total) && (threshold - total > room)) {
+        __sync_add_and_fetch(&stats.early, 1);
+        threshold = total + room;
+    }
+
+    return threshold;
+}
+
+void gc_pressure_emergency(lua_State *L) {
+    uint64_t t0;
+    uint32_t t;
+
+    t0 = now_us();
+    luaC_fullgc(L, 1);
+    t = now_us() - t0;
+
+    portENTER_CRITICAL(&gc_pressure_mux);
+    stats.emergencies++;
+    stats.emergency_us += t;
+    if (t > stats.emergency_max_us) {
+        stats.emergency_max_us = t;
+    }
+    portEXIT_CRITICAL(&gc_pressure_mux);
+}
+
+int gc_pressure_collect(lua_State *L) {
+    global_State *g;
+
+    // Tasks that are not Lua threads (drivers, network, the thread pool workers)
+    // don't have a state, and can't collect the state of a running Lua thread
+    if (!L) {
+        __sync_add_and_fetch(&stats.skipped, 1);
+        return 0;
+    }
+
+    g = G(L);
+
+    // Lua collects when its allocator fails, and the state can't be collected
+    // while it's built, or during an emergency collection
+    if (g->gcalloc || !g->version || (g->gckind == KGC_EMERGENCY)) {
+        return 0;
+    }
+
+    gc_pressure_emergency(L);
+
+    return 1;
+}
+
+void gc_pressure_failed() {
+    __sync_add_and_fetch(&stats.failed, 1);
+}
+
+void gc_pressure_enable(int enable) {
+    enabled = enable;
+}
+
+void gc_pressure_get_stats(gc_pressure_stats_t *s) {
+    portENTER_CRITICAL(&gc_pressure_mux);
+    *s = stats;
+    portEXIT_CRITICAL(&gc_pressure_mux);
+
+    // The collector didn't run yet
+    if (s->min_free == SIZE_MAX) {
+        s->min_free = xPortGetFreeHeapSize();
+    }
+}
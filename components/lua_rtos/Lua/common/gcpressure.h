@@ -0,0 +1,95 @@
+/*
+ * Lua RTOS, tuning of the Lua garbage collector under memory pressure
+ *
+ * Copyright (C) 2015 - 2017
+ * IBEROXARXA SERVICIOS INTEGRALES, S.L. & CSS IBÉRICA, S.L.
+ *
+ * Author: Jaume Olivé (jolive@iberoxarxa.com / jolive@whitecatboard.org)
+ *
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software
+ * and its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that the copyright notice and this
+ * permission notice and warranty disclaimer appear in supporting
+ * documentation, and that the name of the author not be used in
+ * advertising or publicity pertaining to distribution of the
+ * software without specific, written prior permission.
+ *
+ * The author disclaim all warranties with regard to this
+ * software, including all implied warranties of merchantability
+ * and fitness.  In no event shall the author be liable for any
+ * special, indirect or consequential damages or any damages
+ * whatsoever resulting from loss of use, data or profits, whether
+ * in an action of contract, negligence or other tortious action,
+ * arising out of or in connection with the use or performance of
+ * this software.
+ */
+
+/*
+ * The Lua collector starts a new cycle when the memory used by a state reaches
+ * gcpause % of the memory in use after the previous one, and each step does
+ * gcstepmul % of the work of the memory allocated since the last step. These
+ * defaults don't know about the heap: a state can use the last free bytes
+ * before a cycle starts, and then a C allocation fails.
+ *
+ * A cycle runs while Lua allocates the memory in use after the previous one,
+ * by 200 / gcstepmul (the cycle bytes), so the watermarks of free heap are over
+ * the memory that the cycle needs:
+ *
+ * - low: CONFIG_LUA_RTOS_LUA_GC_LOW_WATERMARK, and the cycle bytes at 4 times
+ *   the step multiplier. A cycle starts before the free heap drops below it.
+ * - high: CONFIG_LUA_RTOS_LUA_GC_HIGH_WATERMARK, and the cycle bytes.
+ *
+ * Between them, the collector is tuned from the defaults of the state to the
+ * most aggressive ones, a pause of 100 % (start a cycle as soon as the previous
+ * one ends) and 4 times the step multiplier, as the free heap drops.
+ *
+ * If an allocation fails anyway, one emergency full collection is done, and
+ * only in a task that runs a Lua state, with the Lua state of the task. The
+ * number of emergency collections and their time are accounted.
+ */
+
+#ifndef GCPRESSURE_H
+#define GCPRESSURE_H
+
+#include "luartos.h"
+
+#include "lua.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct {
+    uint32_t emergencies;       // emergency collections
+    uint64_t emergency_us;      // time of the emergency collections
+    uint32_t emergency_max_us;
+    uint32_t failed;            // allocations that failed after an emergency collection
+    uint32_t skipped;           // failed allocations of tasks without a Lua state
+    uint32_t early;             // cycles started early, by the low watermark
+    uint32_t tuned;             // steps and cycles tuned under the high watermark
+    size_t min_free;            // minimum free heap seen by the collector
+} gc_pressure_stats_t;
+
+// Pause and step multiplier of a state, for the free heap
+int gc_pressure_pause(int pause, size_t cycle);
+int gc_pressure_stepmul(int stepmul, size_t cycle);
+
+// Memory in use when the next cycle of a state that uses total bytes starts
+size_t gc_pressure_threshold(size_t total, size_t threshold, size_t cycle);
+
+// Emergency collection of the Lua allocator, when it can't allocate a block
+void gc_pressure_emergency(lua_State *L);
+
+// Emergency collection for an allocation of the task that runs L, that can
+// be NULL. Returns 1 if the allocation can be tried again.
+int gc_pressure_collect(lua_State *L);
+
+// Accounts an allocation that failed after an emergency collection
+void gc_pressure_failed();
+
+void gc_pressure_enable(int enable);
+void gc_pressure_get_stats(gc_pressure_stats_t *stats);
+
+#endif
@@ -0,0 +1,462 @@
+/*
+ * Lua RTOS, size class allocator for the Lua heap
+ *
+ * Copyright (C) 2015 - 2017
+ * IBEROXARXA SERVICIOS INTEGRALES, S.L. & CSS IBÉRICA, S.L.
+ *
+ * Author: Jaume Olivé (jolive@iberoxarxa.com / jolive@whitecatboard.org)
+ *
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software
+ * and its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that the copyright notice and this
+ * permission notice and warranty disclaimer appear in supporting
+ * documentation, and that the name of the author not be used in
+ * advertising or publicity pertaining to distribution of the
+ * software without specific, written prior permission.
+ *
+ * The author disclaim all warranties with regard to this
+ * software, including all implied warranties of merchantability
+ * and fitness.  In no event shall the author be liable for any
+ * special, indirect or consequential damages or any damages
+ * whatsoever resulting from loss of use, data or profits, whether
+ * in an action of contract, negligence or other tortious action,
+ * arising out of or in connection with the use or performance of
+ * this software.
+ */
+
+#include "luartos.h"
+
+#if CONFIG_LUA_RTOS_LUA_USE_POOL_ALLOC
+
+#include "lalloc.h"
+
+#include <freertos/FreeRTOS.h>
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if CONFIG_LUA_RTOS_LUA_POOL_ALLOC_PSRAM
+#include "esp_heap_caps.h"
+#include "soc/soc.h"
+
+#define IS_PSRAM(p) (((intptr_t)(p) >= SOC_EXTRAM_DATA_LOW) && ((intptr_t)(p) < SOC_EXTRAM_DATA_HIGH))
+#else
+#define IS_PSRAM(p) 0
+#endif
+
+#define SLAB_SHIFT 10           // log2(LALLOC_SLAB_SIZE)
+
+// Buckets of the slab hash table, one for each slab of a 256 Kbytes heap. The
+// host build, that runs larger heaps, sets a larger one.
+#ifndef LALLOC_SLAB_HASH
+#define LALLOC_SLAB_HASH 256
+#endif
+
+#define SLAB_HASH LALLOC_SLAB_HASH
+
+#if (1 << SLAB_SHIFT) != LALLOC_SLAB_SIZE
+#error "SLAB_SHIFT must be log2(LALLOC_SLAB_SIZE)"
+#endif
+
+// Size class of a small block, and the size of its blocks
+#define CLASS(size)      (((size) - 1) >> 3)
+#define BLOCK_SIZE(cls)  (((cls) + 1) << 3)
+
+typedef struct slab {
+    struct slab *next;          // in the list of slabs of the class with free blocks
+    struct slab *prev;
+    struct slab *hnext;         // in the hash bucket
+    void *free;                 // free blocks, linked by their first word
+    uint16_t used;              // blocks in use
+    uint8_t cls;
+    uint8_t listed;             // is in the list of the class
+} slab_t;
+
+// Blocks of a slab are after the header
+#define SLAB_HEADER ((sizeof(slab_t) + 7) & ~7)
+#define SLAB_BLOCKS(cls) ((LALLOC_SLAB_SIZE - SLAB_HEADER) / BLOCK_SIZE(cls))
+
+typedef struct {
+    // Slabs with free blocks. Empty slabs are at the tail, so blocks are
+    // allocated from the slabs in use first, and empty slabs can be freed
+    slab_t *head;
+    slab_t *tail;
+    uint32_t empty;             // slabs without blocks in use
+    uint32_t slabs;
+    uint32_t used;
+    uint32_t requested;
+} lalloc_class_t;
+
+static portMUX_TYPE lalloc_mux = portMUX_INITIALIZER_UNLOCKED;
+
+static lalloc_class_t classes[LALLOC_CLASSES];
+
+// Slabs are hashed by the address where they start, a block is in a slab that
+// starts in its page or in the previous one
+static slab_t *slab_hash[SLAB_HASH];
+
+// Counters of the large blocks, and totals (classes are in classes)
+static lalloc_stats_t stats;
+
+#define SLAB_BUCKET(addr) (&slab_hash[((uintptr_t)(addr) >> SLAB_SHIFT) & (SLAB_HASH - 1)])
+
+static inline void footprint_add(size_t bytes) {
+    stats.footprint += bytes;
+    if (stats.footprint > stats.peak) {
+        stats.peak = stats.footprint;
+    }
+}
+
+/*
+ * Slabs. Must be called in the critical section, but slab_new.
+ */
+static void slab_list(lalloc_class_t *cls, slab_t *slab, int tail) {
+    if (tail) {
+        slab->prev = cls->tail;
+        slab->next = NULL;
+    } else {
+        slab->prev = NULL;
+        slab->next = cls->head;
+    }
+
+    if (slab->prev) slab->prev->next = slab; else cls->head = slab;
+    if (slab->next) slab->next->prev = slab; else cls->tail = slab;
+
+    slab->listed = 1;
+}
+
+static void slab_unlist(lalloc_class_t *cls, slab_t *slab) {
+    if (slab->prev) slab->prev->next = slab->next; else cls->head = slab->next;
+    if (slab->next) slab->next->prev = slab->prev; else cls->tail = slab->prev;
+
+    slab->listed = 0;
+}
+
+static slab_t *slab_find(void *ptr) {
+    uintptr_t addr = (uintptr_t)ptr;
+    slab_t *slab;
+    int page;
+
+    for(page = 0;page < 2;page++) {
+        for(slab = *SLAB_BUCKET(addr - page * LALLOC_SLAB_SIZE);slab;slab = slab->hnext) {
+            if ((addr >= (uintptr_t)slab) && (addr < (uintptr_t)slab + LALLOC_SLAB_SIZE)) {
+                return slab;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+// Allocates a slab, out of the critical section, as the heap can run the garbage collector
+static slab_t *slab_new(int cls) {
+    slab_t *slab = (slab_t *)malloc(LALLOC_SLAB_SIZE);
+    uint8_t *block;
+    int i;
+
+    if (!slab) {
+        return NULL;
+    }
+
+    slab->free = NULL;
+    slab->used = 0;
+    slab->cls = cls;
+
+    // Blocks are linked from the last one, so they are allocated in address order
+    block = (uint8_t *)slab + SLAB_HEADER + (SLAB_BLOCKS(cls) - 1) * BLOCK_SIZE(cls);
+    for(i = 0;i < SLAB_BLOCKS(cls);i++) {
+        *(void **)block = slab->free;
+        slab->free = block;
+        block -= BLOCK_SIZE(cls);
+    }
+
+    return slab;
+}
+
+static void slab_add(slab_t *slab) {
+    lalloc_class_t *cls = &classes[slab->cls];
+    slab_t **bucket = SLAB_BUCKET(slab);
+
+    slab->hnext = *bucket;
+    *bucket = slab;
+
+    slab_list(cls, slab, 0);
+
+    cls->slabs++;
+    cls->empty++;
+
+    stats.heap_calls++;
+    footprint_add(LALLOC_HEAP_BLOCK(LALLOC_SLAB_SIZE));
+}
+
+// Removes an empty slab, that is freed by the caller out of the critical section
+static void slab_remove(slab_t *slab) {
+    lalloc_class_t *cls = &classes[slab->cls];
+    slab_t **bucket = SLAB_BUCKET(slab);
+
+    while (*bucket != slab) {
+        bucket = &(*bucket)->hnext;
+    }
+    *bucket = slab->hnext;
+
+    if (slab->listed) {
+        slab_unlist(cls, slab);
+    }
+
+    cls->slabs--;
+
+    stats.heap_calls++;
+    stats.footprint -= LALLOC_HEAP_BLOCK(LALLOC_SLAB_SIZE);
+}
+
+/*
+ * Small blocks
+ */
+
+// Small blocks can be in the heap, if there was no memory for a new slab
+static int small_owned(void *ptr) {
+    slab_t *slab;
+
+    portENTER_CRITICAL(&lalloc_mux);
+    slab = slab_find(ptr);
+    portEXIT_CRITICAL(&lalloc_mux);
+
+    return slab != NULL;
+}
+
+// Keeps a block that stays in its class. Returns 0 if it's not in a slab.
+static int small_resize(void *ptr, size_t osize, size_t nsize) {
+    slab_t *slab;
+
+    portENTER_CRITICAL(&lalloc_mux);
+
+    slab = slab_find(ptr);
+    if (slab) {
+        classes[slab->cls].requested += nsize - osize;
+    }
+
+    portEXIT_CRITICAL(&lalloc_mux);
+
+    return slab != NULL;
+}
+
+static void *small_alloc(size_t size) {
+    lalloc_class_t *cls = &classes[CLASS(size)];
+    slab_t *slab;
+    void *block;
+
+    portENTER_CRITICAL(&lalloc_mux);
+
+    slab = cls->head;
+    if (!slab) {
+        portEXIT_CRITICAL(&lalloc_mux);
+
+        slab = slab_new(CLASS(size));
+        if (!slab) {
+            return NULL;
+        }
+
+        portENTER_CRITICAL(&lalloc_mux);
+        slab_add(slab);
+    }
+
+    block = slab->free;
+    slab->free = *(void **)block;
+
+    if (slab->used++ == 0) {
+        cls->empty--;
+    }
+
+    if (!slab->free) {
+        slab_unlist(cls, slab);
+    }
+
+    cls->used++;
+    cls->requested += size;
+
+    portEXIT_CRITICAL(&lalloc_mux);
+
+    return block;
+}
+
+// Frees a block. Returns 0 if it's not in a slab.
+static int small_free(void *ptr, size_t size) {
+    slab_t *slab, *release = NULL;
+    lalloc_class_t *cls;
+
+    portENTER_CRITICAL(&lalloc_mux);
+
+    slab = slab_find(ptr);
+    if (!slab) {
+        portEXIT_CRITICAL(&lalloc_mux);
+        return 0;
+    }
+
+    cls = &classes[slab->cls];
+
+    *(void **)ptr = slab->free;
+    slab->free = ptr;
+
+    cls->used--;
+    cls->requested -= size;
+
+    if (--slab->used == 0) {
+        // One empty slab is kept by class, so a block that is allocated and freed
+        // again and again doesn't allocate and free a slab each time
+        if (cls->empty) {
+            slab_remove(slab);
+            release = slab;
+        } else {
+            cls->empty++;
+
+            if (slab->listed) {
+                slab_unlist(cls, slab);
+            }
+            slab_list(cls, slab, 1);
+        }
+    } else if (!slab->listed) {
+        slab_list(cls, slab, 0);
+    }
+
+    portEXIT_CRITICAL(&lalloc_mux);
+
+    if (release) {
+        free(release);
+    }
+
+    return 1;
+}
+
+/*
+ * Large blocks
+ */
+
+// Accounts a heap block of osize bytes (0 if none) that is now nptr, of nsize bytes
+static void heap_account(size_t osize, int opsram, void *nptr, size_t nsize) {
+    portENTER_CRITICAL(&lalloc_mux);
+
+    stats.heap_calls++;
+
+    if (osize) {
+        stats.large--;
+        stats.large_bytes -= osize;
+        stats.footprint -= LALLOC_HEAP_BLOCK(osize);
+        if (opsram) stats.psram_bytes -= osize;
+    }
+
+    if (nptr) {
+        stats.large++;
+        stats.large_bytes += nsize;
+        footprint_add(LALLOC_HEAP_BLOCK(nsize));
+        if (IS_PSRAM(nptr)) stats.psram_bytes += nsize;
+    }
+
+    portEXIT_CRITICAL(&lalloc_mux);
+}
+
+static void *heap_realloc(void *ptr, size_t osize, size_t nsize) {
+    int opsram = ptr && IS_PSRAM(ptr);
+    void *nptr = NULL;
+
+#if CONFIG_LUA_RTOS_LUA_POOL_ALLOC_PSRAM
+    if (nsize >= CONFIG_LUA_RTOS_LUA_POOL_ALLOC_PSRAM_MIN) {
+        nptr = heap_caps_realloc(ptr, nsize, MALLOC_CAP_SPIRAM);
+    }
+#endif
+
+    if (!nptr) {
+        nptr = realloc(ptr, nsize);
+    }
+
+    // If realloc fails the block is still allocated
+    if (nptr) {
+        heap_account(osize, opsram, nptr, nsize);
+    }
+
+    return nptr;
+}
+
+static void heap_free(void *ptr, size_t size) {
+    heap_account(size, IS_PSRAM(ptr), NULL, 0);
+    free(ptr);
+}
+
+void *lalloc(void *ud, void *ptr, size_t osize, size_t nsize) {
+    void *nptr;
+    int small;
+
+    (void)ud;
+
+    // osize is the type of the object if ptr is NULL
+    if (!ptr) osize = 0;
+
+    small = ptr && (osize <= LALLOC_MAX_SMALL);
+
+    if (nsize == 0) {
+        if (ptr && !(small && small_free(ptr, osize))) {
+            heap_free(ptr, osize);
+        }
+
+        return NULL;
+    }
+
+    // A small block that stays in its class is not moved
+    if (small && (nsize <= LALLOC_MAX_SMALL) && (CLASS(nsize) == CLASS(osize)) && small_resize(ptr, osize, nsize)) {
+        return ptr;
+    }
+
+    nptr = (nsize <= LALLOC_MAX_SMALL)?small_alloc(nsize):NULL;
+    if (!nptr) {
+        if (ptr && !(small && small_owned(ptr))) {
+            return heap_realloc(ptr, osize, nsize);
+        }
+
+        nptr = heap_realloc(NULL, 0, nsize);
+        if (!nptr) {
+            return NULL;
+        }
+    }
+
+    if (ptr) {
+        memcpy(nptr, ptr, (osize < nsize)?osize:nsize);
+
+        if (!(small && small_free(ptr, osize))) {
+            heap_free(ptr, osize);
+        }
+    }
+
+    return nptr;
+}
+
+void lalloc_get_stats(lalloc_stats_t *s) {
+    lalloc_class_t *cls;
+    int i;
+
+    portENTER_CRITICAL(&lalloc_mux);
+
+    *s = stats;
+
+    for(i = 0;i < LALLOC_CLASSES;i++) {
+        cls = &classes[i];
+
+        s->classes[i].size = BLOCK_SIZE(i);
+        s->classes[i].slabs = cls->slabs;
+        s->classes[i].used = cls->used;
+        s->classes[i].free = cls->slabs * SLAB_BLOCKS(i) - cls->used;
+        s->classes[i].requested = cls->requested;
+    }
+
+    portEXIT_CRITICAL(&lalloc_mux);
+}
+
+void lalloc_reset_peak() {
+    portENTER_CRITICAL(&lalloc_mux);
+    stats.peak = stats.footprint;
+    portEXIT_CRITICAL(&lalloc_mux);
+}
+
+#endif
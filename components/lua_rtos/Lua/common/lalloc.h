@@ -0,0 +1,93 @@
+/*
+ * Lua RTOS, size class allocator for the Lua heap
+ *
+ * Copyright (C) 2015 - 2017
+ * IBEROXARXA SERVICIOS INTEGRALES, S.L. & CSS IBÉRICA, S.L.
+ *
+ * Author: Jaume Olivé (jolive@iberoxarxa.com / jolive@whitecatboard.org)
+ *
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software
+ * and its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that the copyright notice and this
+ * permission notice and warranty disclaimer appear in supporting
+ * documentation, and that the name of the author not be used in
+ * advertising or publicity pertaining to distribution of the
+ * software without specific, written prior permission.
+ *
+ * The author disclaim all warranties with regard to this
+ * software, including all implied warranties of merchantability
+ * and fitness.  In no event shall the author be liable for any
+ * special, indirect or consequential damages or any damages
+ * whatsoever resulting from loss of use, data or profits, whether
+ * in an action of contract, negligence or other tortious action,
+ * arising out of or in connection with the use or performance of
+ * this software.
+ */
+
+/*
+ * Lua allocates a lot of small objects (strings, tables, closures, upvalues,
+ * call infos), that fragment the heap when they are allocated with realloc, up
+ * to the point that a large block can't be allocated while there is still a lot
+ * of memory free.
+ *
+ * lalloc is the lua_Alloc function of the Lua states. Blocks up to
+ * LALLOC_MAX_SMALL bytes are allocated from slabs of LALLOC_SLAB_SIZE bytes,
+ * with one size class each 8 bytes. A slab has blocks of a single class, and is
+ * returned to the heap when all its blocks are free, if the class has another
+ * free slab. Small blocks don't have a header, Lua passes the size of the block
+ * when it's reallocated or freed.
+ *
+ * Larger blocks, and small blocks when a new slab can't be allocated, are
+ * allocated with realloc. With CONFIG_LUA_RTOS_LUA_POOL_ALLOC_PSRAM, blocks of
+ * CONFIG_LUA_RTOS_LUA_POOL_ALLOC_PSRAM_MIN bytes or more are allocated in the
+ * PSRAM first.
+ *
+ * The allocator is shared by all the Lua states (the main one, and the isolated
+ * states of thread.spawn and thread.submit).
+ */
+
+#ifndef LALLOC_H
+#define LALLOC_H
+
+#include "luartos.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define LALLOC_CLASSES   8
+#define LALLOC_MAX_SMALL (LALLOC_CLASSES * 8)
+#define LALLOC_SLAB_SIZE 1024
+
+// Bytes used by the heap for each block, to account the footprint
+#define LALLOC_HEAP_OVERHEAD 8
+
+// Heap used by a block of size bytes
+#define LALLOC_HEAP_BLOCK(size) ((((size) + 3) & ~3) + LALLOC_HEAP_OVERHEAD)
+
+typedef struct {
+    uint32_t size;          // block size
+    uint32_t slabs;
+    uint32_t used;          // blocks in use
+    uint32_t free;          // free blocks in the slabs
+    uint32_t requested;     // bytes requested for the blocks in use
+} lalloc_class_stats_t;
+
+typedef struct {
+    lalloc_class_stats_t classes[LALLOC_CLASSES];
+    uint32_t large;         // blocks allocated with realloc
+    size_t large_bytes;
+    size_t psram_bytes;     // of large_bytes, in the PSRAM
+    size_t footprint;       // heap used by the slabs and the large blocks
+    size_t peak;            // maximum footprint since the last lalloc_reset_peak
+    uint32_t heap_calls;    // calls to realloc and free
+} lalloc_stats_t;
+
+void *lalloc(void *ud, void *ptr, size_t osize, size_t nsize);
+
+void lalloc_get_stats(lalloc_stats_t *stats);
+void lalloc_reset_peak();
+
+#endif
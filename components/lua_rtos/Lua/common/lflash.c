@@ -0,0 +1,610 @@
+/*
+ * Lua RTOS, precompiled Lua modules run from flash
+ *
+ * Copyright (C) 2015 - 2017
+ * IBEROXARXA SERVICIOS INTEGRALES, S.L. & CSS IBÉRICA, S.L.
+ *
+ * Author: Jaume Olivé (jolive@iberoxarxa.com / jolive@whitecatboard.org)
+ *
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software
+ * and its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that the copyright notice and this
+ * permission notice and warranty disclaimer appear in supporting
+ * documentation, and that the name of the author not be used in
+ * advertising or publicity pertaining to distribution of the
+ * software without specific, written prior permission.
+ *
+ * The author disclaim all warranties with regard to this
+ * software, including all implied warranties of merchantability
+ * and fitness.  In no event shall the author be liable for any
+ * special, indirect or consequential damages or any damages
+ * whatsoever resulting from loss of use, data or profits, whether
+ * in an action of contract, negligence or other tortious action,
+ * arising out of or in connection with the use or performance of
+ * this software.
+ */
+
+#include "luartos.h"
+
+#if CONFIG_LUA_RTOS_LUA_USE_FLASH_MODULES
+
+#include "lua.h"
+#include "lauxlib.h"
+#include "lapi.h"
+#include "lfunc.h"
+#include "lgc.h"
+#include "lobject.h"
+#include "lstate.h"
+#include "lstring.h"
+#include "ltable.h"
+#include "lundump.h"
+
+#include "lflash.h"
+#include "lromstr.h"
+
+#include <esp_spi_flash.h>
+
+#include <stdint.h>
+#include <string.h>
+
+#include <sys/syslog.h>
+
+#define FLASH_BASE    CONFIG_LUA_RTOS_LUA_FLASH_BASE_ADDR
+#define FLASH_SIZE    CONFIG_LUA_RTOS_LUA_FLASH_SIZE
+#define SECTOR_SIZE   SPI_FLASH_SEC_SIZE
+#define SLOT_SIZE     ((FLASH_SIZE / 2) & ~(SECTOR_SIZE - 1))
+
+#define LFLASH_MAGIC  0x4c464c53
+
+// Images are only valid for the Lua core that built them
+#define LFLASH_FORMAT ((LUAC_VERSION << 24) | (sizeof(TString) << 16) | \
+                       (sizeof(Proto) << 8) | sizeof(TValue))
+
+// Objects are aligned as the allocator aligns them
+#define LFLASH_ALIGN(n) (((n) + sizeof(L_Umaxalign) - 1) & ~(sizeof(L_Umaxalign) - 1))
+
+typedef struct {
+    TString *name;
+    Proto *proto;           // main chunk
+} lflash_module_t;
+
+typedef struct {
+    uint32_t magic;         // written last, when the image is complete
+    uint32_t format;
+    uint32_t seq;           // build number, the newer image is used
+    uint32_t size;          // bytes used, from the header
+    const void *base;       // where the slot was mapped
+    const void *rom;        // ROM strings the image refers to
+    unsigned int seed;      // of the string hashes
+    uint32_t nmodules;
+    uint32_t nprotos;
+    uint32_t nstrings;
+    uint32_t strmask;       // size of the string table - 1
+    TString *const *strt;   // short strings, by hash, with linear probing
+    const lflash_module_t *modules;
+} lflash_header_t;
+
+typedef struct {
+    lua_State *L;
+    uint32_t addr;          // flash address of the slot
+    uint8_t *map;           // where the slot is mapped
+    uint32_t pos;           // next byte, from the start of the slot
+    uint32_t sector;        // start of the sector in buf
+    uint8_t *buf;
+    int objects;            // index of the table of the objects written
+    int strip;
+    uint32_t nprotos;
+    uint32_t nstrings;
+} builder_t;
+
+static const uint8_t *map = NULL;
+static spi_flash_mmap_handle_t map_handle;
+static const lflash_header_t *image = NULL;
+
+static const lflash_header_t *slot_header(int slot) {
+    return (const lflash_header_t *)(map + slot * SLOT_SIZE);
+}
+
+void lflash_init() {
+    const lflash_header_t *header;
+    int slot;
+
+    if (!map) {
+        if (spi_flash_mmap(FLASH_BASE, FLASH_SIZE, SPI_FLASH_MMAP_DATA, (const void **)&map, &map_handle) != ESP_OK) {
+            syslog(LOG_ERR, "lua flash, can't map the flash region");
+            map = NULL;
+            return;
+        }
+    }
+
+    image = NULL;
+
+    for(slot = 0;slot < 2;slot++) {
+        header = slot_header(slot);
+        if (header->magic != LFLASH_MAGIC) continue;
+
+        if ((header->format != LFLASH_FORMAT) || (header->base != (const void *)header) || (header->size > SLOT_SIZE) ||
+            (header->rom != lromstr_base()) || (header->seed != lromstr_seed(header->seed))) {
+            syslog(LOG_WARNING, "lua flash, image %d was built by other firmware, ignored", slot);
+            continue;
+        }
+
+        if (!image || (header->seq > image->seq)) {
+            image = header;
+        }
+    }
+}
+
+int lflash_isflash(const void *p) {
+    return map && ((const uint8_t *)p >= map) && ((const uint8_t *)p < map + FLASH_SIZE);
+}
+
+TString *lflash_getstr(const char *str, size_t l, unsigned int h) {
+    const lflash_header_t *img = image;
+    TString *ts;
+    uint32_t i;
+
+    if (!img) return NULL;
+
+    for(i = h & img->strmask;(ts = img->strt[i]);i = (i + 1) & img->strmask) {
+        if ((ts->hash == h) && (ts->shrlen == l) && (memcmp(str, getstr(ts), l) == 0)) {
+            return ts;
+        }
+    }
+
+    return NULL;
+}
+
+unsigned int lflash_seed(unsigned int seed) {
+    return image?image->seed:seed;
+}
+
+static const lflash_module_t *find_module(const char *name) {
+    const lflash_module_t *module;
+    size_t len = strlen(name);
+    uint32_t i;
+
+    if (!image) return NULL;
+
+    for(i = 0;i < image->nmodules;i++) {
+        module = &image->modules[i];
+        if ((tsslen(module->name) == len) && (memcmp(getstr(module->name), name, len) == 0)) {
+            return module;
+        }
+    }
+
+    return NULL;
+}
+
+// As lua_load, with the prototype in flash
+int lflash_load(lua_State *L, const char *name) {
+    const lflash_module_t *module = find_module(name);
+    LClosure *cl;
+
+    if (!module) return 0;
+
+    lua_lock(L);
+    cl = luaF_newLclosure(L, module->proto->sizeupvalues);
+    cl->p = module->proto;
+    setclLvalue(L, L->top, cl);
+    api_incr_top(L);
+    luaF_initupvals(L, cl);
+
+    if (cl->nupvalues >= 1) {
+        Table *reg = hvalue(&G(L)->l_registry);
+        const TValue *gt = luaH_getint(reg, LUA_RIDX_GLOBALS);
+
+        setobj(L, cl->upvals[0]->v, gt);
+        luaC_upvalbarrier(L, cl->upvals[0]);
+    }
+    lua_unlock(L);
+
+    return 1;
+}
+
+void lflash_modules(lua_State *L) {
+    const lflash_module_t *module;
+    uint32_t i;
+
+    lua_createtable(L, image?image->nmodules:0, 0);
+    if (!image) return;
+
+    for(i = 0;i < image->nmodules;i++) {
+        module = &image->modules[i];
+        lua_pushlstring(L, getstr(module->name), tsslen(module->name));
+        lua_rawseti(L, -2, i + 1);
+    }
+}
+
+void lflash_get_stats(lflash_stats_t *stats) {
+    memset(stats, 0, sizeof(lflash_stats_t));
+
+    stats->slot = image?(((const uint8_t *)image - map) / SLOT_SIZE):-1;
+    stats->slot_size = SLOT_SIZE;
+
+    if (image) {
+        stats->modules = image->nmodules;
+        stats->protos = image->nprotos;
+        stats->strings = image->nstrings;
+        stats->size = image->size;
+    }
+}
+
+/*
+ * Image builder
+ *
+ * The objects are written in order, each one after the objects it points to,
+ * so their address is known. The sector being written is kept in a buffer,
+ * and it's erased and written when it's full.
+ */
+
+static void b_flush(builder_t *B) {
+    uint32_t addr = B->addr + B->sector;
+
+    if ((spi_flash_erase_sector(addr / SECTOR_SIZE) != ESP_OK) ||
+        (spi_flash_write(addr, B->buf, SECTOR_SIZE) != ESP_OK)) {
+        luaL_error(B->L, "can't write the flash at 0x%x", addr);
+    }
+
+    B->sector += SECTOR_SIZE;
+    memset(B->buf, 0xff, SECTOR_SIZE);
+}
+
+static void b_check(builder_t *B, uint32_t pos) {
+    if (pos > SLOT_SIZE) {
+        luaL_error(B->L, "the modules don't fit in the flash image (%d bytes)", SLOT_SIZE);
+    }
+}
+
+static void b_put(builder_t *B, const void *data, size_t size) {
+    const uint8_t *p = (const uint8_t *)data;
+    size_t n;
+
+    b_check(B, B->pos + size);
+
+    while (size > 0) {
+        n = B->sector + SECTOR_SIZE - B->pos;
+        if (n > size) n = size;
+
+        memcpy(B->buf + (B->pos - B->sector), p, n);
+
+        B->pos += n;
+        p += n;
+        size -= n;
+
+        if (B->pos == B->sector + SECTOR_SIZE) {
+            b_flush(B);
+        }
+    }
+}
+
+// Aligns the next object, and returns where it's mapped
+static void *b_begin(builder_t *B) {
+    uint32_t pos = LFLASH_ALIGN(B->pos);
+
+    b_check(B, pos);
+
+    // The sector size is a multiple of the alignment
+    B->pos = pos;
+    if (B->pos == B->sector + SECTOR_SIZE) {
+        b_flush(B);
+    }
+
+    return B->map + B->pos;
+}
+
+static void *b_array(builder_t *B, const void *data, size_t size) {
+    void *p;
+
+    if (size == 0) return NULL;
+
+    p = b_begin(B);
+    b_put(B, data, size);
+
+    return p;
+}
+
+// Address of the object with the key at the top of the stack, or NULL
+static void *b_lookup(builder_t *B) {
+    void *p;
+
+    lua_rawget(B->L, B->objects);
+    p = lua_touserdata(B->L, -1);
+    lua_pop(B->L, 1);
+
+    return p;
+}
+
+// Equal strings have one instance in the image, long ones too
+static TString *b_string(builder_t *B, TString *ts) {
+    lua_State *L = B->L;
+    TString *fts;
+    UTString h;
+
+    if (!ts) return NULL;
+
+    // ROM strings are used in place
+    if (lromstr_isrom(ts)) return ts;
+
+    lua_pushlstring(L, getstr(ts), tsslen(ts));
+    if ((fts = (TString *)b_lookup(B))) {
+        return fts;
+    }
+
+    if (ts->tt == LUA_TLNGSTR) {
+        luaS_hashlongstr(ts);
+    }
+
+    memset(&h, 0, sizeof(h));
+    h.tsv = *ts;
+    h.tsv.next = NULL;
+    h.tsv.marked = bitmask(BLACKBIT);
+    if (ts->tt == LUA_TSHRSTR) {
+        h.tsv.u.hnext = NULL;
+    }
+
+    fts = (TString *)b_begin(B);
+    b_put(B, &h, sizeof(h));
+    b_put(B, getstr(ts), tsslen(ts) + 1);
+    B->nstrings++;
+
+    lua_pushlstring(L, getstr(ts), tsslen(ts));
+    lua_pushlightuserdata(L, fts);
+    lua_rawset(L, B->objects);
+
+    return fts;
+}
+
+static Proto *b_proto(builder_t *B, Proto *f) {
+    lua_State *L = B->L;
+    int sizelineinfo = B->strip?0:f->sizelineinfo;
+    int sizelocvars = B->strip?0:f->sizelocvars;
+    Upvaldesc uv;
+    LocVar lv;
+    Proto p, *fp;
+    TValue k;
+    int i;
+
+    // Strings and nested functions first
+    b_string(B, f->source);
+
+    for(i = 0;i < f->sizek;i++) {
+        if (ttisstring(&f->k[i])) b_string(B, tsvalue(&f->k[i]));
+    }
+
+    for(i = 0;i < sizelocvars;i++) {
+        b_string(B, f->locvars[i].varname);
+    }
+
+    for(i = 0;(i < f->sizeupvalues) && !B->strip;i++) {
+        b_string(B, f->upvalues[i].name);
+    }
+
+    for(i = 0;i < f->sizep;i++) {
+        fp = b_proto(B, f->p[i]);
+
+        lua_pushlightuserdata(L, f->p[i]);
+        lua_pushlightuserdata(L, fp);
+        lua_rawset(L, B->objects);
+    }
+
+    p = *f;
+
+    p.k = f->sizek?(TValue *)b_begin(B):NULL;
+    for(i = 0;i < f->sizek;i++) {
+        k = f->k[i];
+        if (ttisstring(&k)) {
+            val_(&k).gc = obj2gco(b_string(B, tsvalue(&k)));
+        }
+
+        b_put(B, &k, sizeof(TValue));
+    }
+
+    p.code = (Instruction *)b_array(B, f->code, f->sizecode * sizeof(Instruction));
+
+    p.p = f->sizep?(Proto **)b_begin(B):NULL;
+    for(i = 0;i < f->sizep;i++) {
+        lua_pushlightuserdata(L, f->p[i]);
+        fp = (Proto *)b_lookup(B);
+
+        b_put(B, &fp, sizeof(Proto *));
+    }
+
+    p.sizelineinfo = sizelineinfo;
+    p.lineinfo = (int *)b_array(B, f->lineinfo, sizelineinfo * sizeof(int));
+
+    p.sizelocvars = sizelocvars;
+    p.locvars = sizelocvars?(LocVar *)b_begin(B):NULL;
+    for(i = 0;i < sizelocvars;i++) {
+        lv = f->locvars[i];
+        lv.varname = b_string(B, lv.varname);
+
+        b_put(B, &lv, sizeof(LocVar));
+    }
+
+    p.upvalues = f->sizeupvalues?(Upvaldesc *)b_begin(B):NULL;
+    for(i = 0;i < f->sizeupvalues;i++) {
+        uv = f->upvalues[i];
+        uv.name = B->strip?NULL:b_string(B, uv.name);
+
+        b_put(B, &uv, sizeof(Upvaldesc));
+    }
+
+    // Black, so the collector doesn't mark it, and doesn't set its cache
+    p.next = NULL;
+    p.marked = bitmask(BLACKBIT);
+    p.source = b_string(B, f->source);
+    p.cache = NULL;
+    p.gclist = NULL;
+
+    fp = (Proto *)b_begin(B);
+    b_put(B, &p, sizeof(Proto));
+    B->nprotos++;
+
+    return fp;
+}
+
+// Pushes the name of the module of the table entry at the top of the stack
+static void module_name(lua_State *L) {
+    const char *file, *base, *ext;
+
+    if (lua_type(L, -2) == LUA_TSTRING) {
+        lua_pushvalue(L, -2);
+        return;
+    }
+
+    file = lua_tostring(L, -1);
+    base = strrchr(file, '/');
+    base = base?base + 1:file;
+    ext = strrchr(base, '.');
+
+    lua_pushlstring(L, base, ext?(size_t)(ext - base):strlen(base));
+}
+
+size_t lflash_build(lua_State *L, int idx, int strip) {
+    const lflash_header_t *header;
+    lflash_module_t module;
+    lflash_header_t h;
+    TString **strt;
+    uint32_t i, n, size;
+    int slot, mods;
+    builder_t B;
+    size_t len;
+    const char *s;
+
+    luaL_checktype(L, idx, LUA_TTABLE);
+    idx = lua_absindex(L, idx);
+
+    if (!map) {
+        luaL_error(L, "the lua flash region is not mapped");
+    }
+
+    memset(&h, 0, sizeof(h));
+
+    // The slot not in use, with a build number over the ones of both slots
+    slot = (image == slot_header(0))?1:0;
+
+    for(i = 0;i < 2;i++) {
+        header = slot_header(i);
+        if ((header->magic == LFLASH_MAGIC) && (header->seq >= h.seq)) {
+            h.seq = header->seq + 1;
+        }
+    }
+
+    memset(&B, 0, sizeof(B));
+    B.L = L;
+    B.addr = FLASH_BASE + slot * SLOT_SIZE;
+    B.map = (uint8_t *)map + slot * SLOT_SIZE;
+    B.pos = LFLASH_ALIGN(sizeof(lflash_header_t));
+    B.strip = strip;
+
+    luaL_checkstack(L, 8, NULL);
+
+    B.buf = (uint8_t *)lua_newuserdata(L, SECTOR_SIZE);
+    memset(B.buf, 0xff, SECTOR_SIZE);
+
+    lua_newtable(L);
+    B.objects = lua_gettop(L);
+
+    // Name and main chunk of each module
+    lua_newtable(L);
+    mods = lua_gettop(L);
+
+    // The slot is not valid until the header is written
+    if (spi_flash_erase_sector(B.addr / SECTOR_SIZE) != ESP_OK) {
+        luaL_error(L, "can't write the flash at 0x%x", B.addr);
+    }
+
+    n = 0;
+    lua_pushnil(L);
+    while (lua_next(L, idx)) {
+        if (!lua_isstring(L, -1)) {
+            luaL_error(L, "module files must be strings");
+        }
+
+        module_name(L);
+
+        if (luaL_loadfile(L, lua_tostring(L, -2)) != LUA_OK) {
+            lua_error(L);
+        }
+
+        lua_pushlightuserdata(L, b_proto(&B, clLvalue(L->top - 1)->p));
+        lua_rawseti(L, mods, n * 2 + 2);
+        lua_pop(L, 1);
+
+        lua_rawseti(L, mods, n * 2 + 1);
+        lua_pop(L, 1);
+        n++;
+    }
+
+    // Modules
+    for(i = 0;i < n;i++) {
+        lua_rawgeti(L, mods, i * 2 + 1);
+        b_string(&B, tsvalue(L->top - 1));
+        lua_pop(L, 1);
+    }
+
+    h.modules = n?(const lflash_module_t *)b_begin(&B):NULL;
+    for(i = 0;i < n;i++) {
+        lua_rawgeti(L, mods, i * 2 + 1);
+        module.name = b_string(&B, tsvalue(L->top - 1));
+        lua_rawgeti(L, mods, i * 2 + 2);
+        module.proto = (Proto *)lua_touserdata(L, -1);
+        lua_pop(L, 2);
+
+        b_put(&B, &module, sizeof(module));
+    }
+
+    // Short strings, with a load under 2/3
+    n = 0;
+    lua_pushnil(L);
+    while (lua_next(L, B.objects)) {
+        if ((lua_type(L, -2) == LUA_TSTRING) && (lua_rawlen(L, -2) <= LUAI_MAXSHORTLEN)) n++;
+        lua_pop(L, 1);
+    }
+
+    for(size = 1;size < n + n / 2;size <<= 1);
+
+    strt = (TString **)lua_newuserdata(L, size * sizeof(TString *));
+    memset(strt, 0, size * sizeof(TString *));
+
+    lua_pushnil(L);
+    while (lua_next(L, B.objects)) {
+        if ((lua_type(L, -2) == LUA_TSTRING) && (lua_rawlen(L, -2) <= LUAI_MAXSHORTLEN)) {
+            s = lua_tolstring(L, -2, &len);
+            for(i = luaS_hash(s, len, G(L)->seed) & (size - 1);strt[i];i = (i + 1) & (size - 1));
+            strt[i] = (TString *)lua_touserdata(L, -1);
+        }
+        lua_pop(L, 1);
+    }
+
+    h.strt = (TString *const *)b_array(&B, strt, size * sizeof(TString *));
+    h.strmask = size - 1;
+
+    h.size = B.pos;
+    if (B.pos > B.sector) {
+        b_flush(&B);
+    }
+
+    h.format = LFLASH_FORMAT;
+    h.base = B.map;
+    h.rom = lromstr_base();
+    h.seed = G(L)->seed;
+    h.nmodules = lua_rawlen(L, mods) / 2;
+    h.nprotos = B.nprotos;
+    h.nstrings = B.nstrings;
+    h.magic = LFLASH_MAGIC;
+
+    if (spi_flash_write(B.addr, &h, sizeof(h)) != ESP_OK) {
+        luaL_error(L, "can't write the flash at 0x%x", B.addr);
+    }
+
+    lua_pop(L, 4);
+
+    return h.size;
+}
+
+#endif
@@ -0,0 +1,107 @@
+/*
+ * Lua RTOS, precompiled Lua modules run from flash
+ *
+ * Copyright (C) 2015 - 2017
+ * IBEROXARXA SERVICIOS INTEGRALES, S.L. & CSS IBÉRICA, S.L.
+ *
+ * Author: Jaume Olivé (jolive@iberoxarxa.com / jolive@whitecatboard.org)
+ *
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software
+ * and its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that the copyright notice and this
+ * permission notice and warranty disclaimer appear in supporting
+ * documentation, and that the name of the author not be used in
+ * advertising or publicity pertaining to distribution of the
+ * software without specific, written prior permission.
+ *
+ * The author disclaim all warranties with regard to this
+ * software, including all implied warranties of merchantability
+ * and fitness.  In no event shall the author be liable for any
+ * special, indirect or consequential damages or any damages
+ * whatsoever resulting from loss of use, data or profits, whether
+ * in an action of contract, negligence or other tortious action,
+ * arising out of or in connection with the use or performance of
+ * this software.
+ */
+
+/*
+ * Loading a precompiled module copies each function prototype, with its code,
+ * constants, debug information and strings, to the heap. A flash image has the
+ * prototypes of a set of Lua modules laid out as Lua uses them in RAM, and the
+ * modules are required from the memory mapped flash, without copying them, as
+ * the readonly tables are used from .rodata.
+ *
+ * The flash region (CONFIG_LUA_RTOS_LUA_FLASH_BASE_ADDR) has 2 slots of half of
+ * its size, each one with an image. os.flashlua compiles a set of modules into
+ * the slot that is not in use, and the newer image is used after the next boot.
+ * An image has pointers to the address where its slot was mapped when it was
+ * built, so an image built by a firmware that maps the region at other address
+ * is ignored.
+ *
+ * The objects in flash are black, and the collector never marks, traverses or
+ * frees them. Short strings must have one instance, so a new short string is
+ * looked up in the image before it's created, and the Lua states use the seed
+ * of the image for the hashes of the strings. Strings in ROM (see lromstr.h)
+ * are not copied to the image, that points to them, so an image built with
+ * other ROM strings is ignored.
+ */
+
+#ifndef LFLASH_H
+#define LFLASH_H
+
+#include "luartos.h"
+
+#include "lua.h"
+#include "lobject.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if CONFIG_LUA_RTOS_LUA_USE_FLASH_MODULES
+
+typedef struct {
+    int slot;               // slot of the image in use, -1 if none
+    uint32_t modules;
+    uint32_t protos;
+    uint32_t strings;
+    uint32_t size;          // bytes used by the image
+    uint32_t slot_size;
+} lflash_stats_t;
+
+// Maps the flash region, and selects the newer valid image, at boot
+void lflash_init();
+
+// Is p in the flash region?
+int lflash_isflash(const void *p);
+
+// Short string of the image, or NULL
+TString *lflash_getstr(const char *str, size_t l, unsigned int h);
+
+// Seed of the hashes of a new Lua state
+unsigned int lflash_seed(unsigned int seed);
+
+// Pushes a function that runs the main chunk of the module name, and returns
+// 1, or returns 0 if the image doesn't have the module
+int lflash_load(lua_State *L, const char *name);
+
+// Compiles the modules of the table at idx (name = file, or files named by
+// their base name) into the free slot, and returns the bytes used
+size_t lflash_build(lua_State *L, int idx, int strip);
+
+// Pushes the names of the modules of the image in use
+void lflash_modules(lua_State *L);
+
+void lflash_get_stats(lflash_stats_t *stats);
+
+#else
+
+#define lflash_isflash(p) 0
+#define lflash_getstr(str, l, h) NULL
+#define lflash_seed(seed) (seed)
+
+#endif
+
+#endif
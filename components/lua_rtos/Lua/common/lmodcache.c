@@ -0,0 +1,387 @@
+/*
+ * Lua RTOS, Lua module index and bytecode cache
+ *
+ * Copyright (C) 2015 - 2017
+ * IBEROXARXA SERVICIOS INTEGRALES, S.L. & CSS IBÉRICA, S.L.
+ *
+ * Author: Jaume Olivé (jolive@iberoxarxa.com / jolive@whitecatboard.org)
+ *
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software
+ * and its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that the copyright notice and this
+ * permission notice and warranty disclaimer appear in supporting
+ * documentation, and that the name of the author not be used in
+ * advertising or publicity pertaining to distribution of the
+ * software without specific, written prior permission.
+ *
+ * The author disclaim all warranties with regard to this
+ * software, including all implied warranties of merchantability
+ * and fitness.  In no event shall the author be liable for any
+ * special, indirect or consequential damages or any damages
+ * whatsoever resulting from loss of use, data or profits, whether
+ * in an action of contract, negligence or other tortious action,
+ * arising out of or in connection with the use or performance of
+ * this software.
+ */
+
+#include "luartos.h"
+
+#if CONFIG_LUA_RTOS_LUA_USE_MODULE_CACHE
+
+#include "lua.h"
+#include "lauxlib.h"
+
+#include "lmodcache.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <sys/stat.h>
+
+// Registry key of the module index of the Lua state
+static const int INDEX = 0;
+
+static lmodcache_stats_t stats;
+
+typedef struct {
+    FILE *f;
+    char buff[BUFSIZ];
+} reader_t;
+
+static const char *reader(lua_State *L, void *ud, size_t *size) {
+    reader_t *r = (reader_t *)ud;
+
+    *size = fread(r->buff, 1, sizeof(r->buff), r->f);
+
+    return (*size > 0)?r->buff:NULL;
+}
+
+static int writer(lua_State *L, const void *p, size_t size, void *ud) {
+    return (fwrite(p, size, 1, (FILE *)ud) != 1) && (size != 0);
+}
+
+/*
+ * The index file has the package.path in the first line, and a line for each
+ * module, with its name and file separated by a tab.
+ */
+static void read_index(lua_State *L) {
+    const char *s, *end, *eol, *tab;
+    luaL_Buffer b;
+    size_t len, n;
+    FILE *fp;
+
+    lua_newtable(L);
+
+    fp = fopen(LMODCACHE_INDEX, "r");
+    if (!fp) return;
+
+    luaL_buffinit(L, &b);
+    do {
+        n = fread(luaL_prepbuffer(&b), 1, LUAL_BUFFERSIZE, fp);
+        luaL_addsize(&b, n);
+    } while (n == LUAL_BUFFERSIZE);
+    fclose(fp);
+    luaL_pushresult(&b);
+
+    s = lua_tolstring(L, -1, &len);
+    end = s + len;
+
+    for(n = 0;s < end;n++, s = eol + 1) {
+        eol = memchr(s, '\n', end - s);
+        if (!eol) break;
+
+        if (n == 0) {
+            lua_pushlstring(L, s, eol - s);
+            lua_rawseti(L, -3, 1);
+            continue;
+        }
+
+        tab = memchr(s, '\t', eol - s);
+        if (!tab) continue;
+
+        lua_pushlstring(L, s, tab - s);
+        lua_pushlstring(L, tab + 1, eol - tab - 1);
+        lua_rawset(L, -4);
+    }
+
+    lua_pop(L, 1);
+}
+
+static void write_index(lua_State *L, int idx) {
+    FILE *fp;
+
+    fp = fopen(LMODCACHE_INDEX, "w");
+    if (!fp) return;
+
+    lua_rawgeti(L, idx, 1);
+    fprintf(fp, "%s\n", lua_tostring(L, -1));
+    lua_pop(L, 1);
+
+    lua_pushnil(L);
+    while (lua_next(L, idx)) {
+        if (lua_type(L, -2) == LUA_TSTRING) {
+            fprintf(fp, "%s\t%s\n", lua_tostring(L, -2), lua_tostring(L, -1));
+        }
+        lua_pop(L, 1);
+    }
+
+    if (fclose(fp) != 0) {
+        remove(LMODCACHE_INDEX);
+    }
+}
+
+// Pushes the module index of path, read from the index file the first time
+static void push_index(lua_State *L, const char *path) {
+    const char *ipath;
+
+    if (lua_rawgetp(L, LUA_REGISTRYINDEX, &INDEX) != LUA_TTABLE) {
+        lua_pop(L, 1);
+        read_index(L);
+        lua_pushvalue(L, -1);
+        lua_rawsetp(L, LUA_REGISTRYINDEX, &INDEX);
+    }
+
+    lua_rawgeti(L, -1, 1);
+    ipath = lua_tostring(L, -1);
+
+    if (!ipath || (strcmp(ipath, path) != 0)) {
+        // Built for other path, start a new one
+        lua_pop(L, 2);
+        lua_newtable(L);
+        lua_pushstring(L, path);
+        lua_rawseti(L, -2, 1);
+        lua_pushvalue(L, -1);
+        lua_rawsetp(L, LUA_REGISTRYINDEX, &INDEX);
+    } else {
+        lua_pop(L, 1);
+    }
+}
+
+// Templates relative to the current directory are looked up each time
+static int relative(const char *filename) {
+    return (*filename != LUA_DIRSEP[0]);
+}
+
+static int readable(const char *filename) {
+    FILE *f = fopen(filename, "r");
+
+    if (f == NULL) return 0;
+    fclose(f);
+
+    return 1;
+}
+
+const char *lmodcache_lookup(lua_State *L, const char *name, const char *path) {
+    const char *ifile, *filename, *end;
+
+    push_index(L, path);
+
+    if (lua_getfield(L, -1, name) != LUA_TSTRING) {
+        lua_pop(L, 2);
+        stats.index_misses++;
+        return NULL;
+    }
+
+    ifile = lua_tostring(L, -1);
+    name = luaL_gsub(L, name, ".", LUA_DIRSEP);
+
+    /*
+     * The templates before the one of the indexed file that are relative to the
+     * current directory are looked up, as they are not indexed.
+     */
+    for(;*path;path = end) {
+        while (*path == *LUA_PATH_SEP) path++;
+
+        end = strchr(path, *LUA_PATH_SEP);
+        if (!end) end = path + strlen(path);
+        if (end == path) continue;
+
+        lua_pushlstring(L, path, end - path);
+        filename = luaL_gsub(L, lua_tostring(L, -1), LUA_PATH_MARK, name);
+        lua_remove(L, -2);
+
+        if (relative(filename) && readable(filename)) {
+            lua_replace(L, -4);
+            lua_pop(L, 2);
+            stats.index_misses++;
+
+            return lua_tostring(L, -1);
+        }
+
+        if (strcmp(filename, ifile) == 0) {
+            lua_pop(L, 2);
+            lua_remove(L, -2);
+            stats.index_hits++;
+
+            return lua_tostring(L, -1);
+        }
+
+        lua_pop(L, 1);
+    }
+
+    // The indexed file is not from path
+    lua_pop(L, 3);
+    stats.index_misses++;
+
+    return NULL;
+}
+
+void lmodcache_index(lua_State *L, const char *name, const char *path, const char *filename) {
+    const char *ifile;
+
+    if (filename && relative(filename)) {
+        filename = NULL;
+    }
+
+    push_index(L, path);
+
+    lua_getfield(L, -1, name);
+    ifile = lua_tostring(L, -1);
+
+    if ((ifile == NULL) != (filename == NULL) || (ifile && (strcmp(ifile, filename) != 0))) {
+        if (filename) {
+            lua_pushstring(L, filename);
+        } else {
+            lua_pushnil(L);
+        }
+        lua_setfield(L, -3, name);
+
+        write_index(L, lua_absindex(L, -2));
+    }
+
+    lua_pop(L, 2);
+}
+
+/*
+ * CRC-32 of the source, as the modification time and size don't tell a changed
+ * source: without a clock set (by NTP), the times of the files restart at each
+ * boot.
+ */
+static int source_crc(const char *filename, uint32_t *crc) {
+    uint8_t buff[256];
+    size_t n, i;
+    int bit;
+    FILE *fp;
+
+    fp = fopen(filename, "rb");
+    if (!fp) return -1;
+
+    *crc = 0xffffffff;
+    while ((n = fread(buff, 1, sizeof(buff), fp)) > 0) {
+        for(i = 0;i < n;i++) {
+            *crc ^= buff[i];
+            for(bit = 0;bit < 8;bit++) {
+                *crc = (*crc >> 1) ^ (0xedb88320 & -(*crc & 1));
+            }
+        }
+    }
+
+    *crc = ~*crc;
+
+    if (ferror(fp)) {
+        fclose(fp);
+        return -1;
+    }
+
+    fclose(fp);
+
+    return 0;
+}
+
+// Loads the .luac of filename, if it has the stamp of the source
+static int load_cache(lua_State *L, const char *cache, const char *stamp, const char *chunkname) {
+    char line[48];
+    reader_t r;
+    int status;
+
+    r.f = fopen(cache, "rb");
+    if (!r.f) return 0;
+
+    if (!fgets(line, sizeof(line), r.f) || (strcmp(line, stamp) != 0)) {
+        fclose(r.f);
+        return 0;
+    }
+
+    status = lua_load(L, reader, &r, chunkname, "b");
+    fclose(r.f);
+
+    if (status != LUA_OK) {
+        // Not a valid chunk, compile the source again
+        lua_pop(L, 1);
+        return 0;
+    }
+
+    return 1;
+}
+
+static void write_cache(lua_State *L, const char *cache, const char *stamp) {
+    int error;
+    FILE *fp;
+
+    fp = fopen(cache, "wb");
+    if (!fp) return;
+
+    fputs(stamp, fp);
+
+    error = lua_dump(L, writer, fp, 0) || ferror(fp);
+    if ((fclose(fp) != 0) || error) {
+        remove(cache);
+    }
+}
+
+int lmodcache_loadfile(lua_State *L, const char *filename) {
+    const char *cache;
+    char stamp[48];
+    struct stat st;
+    uint32_t crc;
+    size_t len;
+    int status;
+
+    if (stat(filename, &st) != 0) {
+        lua_pushfstring(L, "cannot open %s", filename);
+        return LMODCACHE_NOFILE;
+    }
+
+    len = strlen(filename);
+    if ((len < 5) || (strcmp(filename + len - 4, ".lua") != 0)) {
+        return luaL_loadfile(L, filename);
+    }
+
+    if (source_crc(filename, &crc) != 0) {
+        return luaL_loadfile(L, filename);
+    }
+
+    snprintf(stamp, sizeof(stamp), "#%ld %ld %08x\n", (long)st.st_mtime, (long)st.st_size, (unsigned int)crc);
+
+    cache = lua_pushfstring(L, "%sc", filename);
+    lua_pushfstring(L, "@%s", filename);
+
+    if (load_cache(L, cache, stamp, lua_tostring(L, -1))) {
+        lua_replace(L, -3);
+        lua_pop(L, 1);
+        stats.cache_hits++;
+        return LUA_OK;
+    }
+
+    lua_pop(L, 1);
+
+    status = luaL_loadfile(L, filename);
+    if (status == LUA_OK) {
+        write_cache(L, cache, stamp);
+        stats.compiles++;
+    }
+
+    lua_remove(L, -2);
+
+    return status;
+}
+
+void lmodcache_get_stats(lmodcache_stats_t *out) {
+    *out = stats;
+}
+
+#endif
@@ -0,0 +1,95 @@
+/*
+ * Lua RTOS, Lua module index and bytecode cache
+ *
+ * Copyright (C) 2015 - 2017
+ * IBEROXARXA SERVICIOS INTEGRALES, S.L. & CSS IBÉRICA, S.L.
+ *
+ * Author: Jaume Olivé (jolive@iberoxarxa.com / jolive@whitecatboard.org)
+ *
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software
+ * and its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that the copyright notice and this
+ * permission notice and warranty disclaimer appear in supporting
+ * documentation, and that the name of the author not be used in
+ * advertising or publicity pertaining to distribution of the
+ * software without specific, written prior permission.
+ *
+ * The author disclaim all warranties with regard to this
+ * software, including all implied warranties of merchantability
+ * and fitness.  In no event shall the author be liable for any
+ * special, indirect or consequential damages or any damages
+ * whatsoever resulting from loss of use, data or profits, whether
+ * in an action of contract, negligence or other tortious action,
+ * arising out of or in connection with the use or performance of
+ * this software.
+ */
+
+
+/*
+ * require looks for a Lua module trying to open a file for each template of
+ * package.path, and then parses the source. On SPIFFS each open of a file that
+ * doesn't exist looks up the name in all the flash pages, so a module found in
+ * the last template costs a page scan for each template before it.
+ *
+ * The module index keeps the file where each module was found, in
+ * LMODCACHE_INDEX, so after a reboot the module is opened directly. The index
+ * is only used with the package.path it was built for, and an entry is looked
+ * up again if its file doesn't exist anymore.
+ *
+ * This changes the precedence of the templates of package.path: a file added
+ * in an absolute template before the one of an indexed module is not found,
+ * until the index is removed. The templates relative to the current directory
+ * (as "./?.lua") are not indexed, and are looked up each time before the
+ * template of the indexed module, so a module placed in them overrides it.
+ *
+ * The bytecode cache compiles each module to a .luac file next to its source
+ * (as os.compile does), with a first line that has the modification time, size
+ * and CRC-32 of the source. The .luac is loaded instead of the source while they
+ * don't change.
+ */
+
+#ifndef LMODCACHE_H
+#define LMODCACHE_H
+
+#include "luartos.h"
+
+#include "lua.h"
+
+#include <stdint.h>
+
+#if CONFIG_LUA_RTOS_LUA_USE_MODULE_CACHE
+
+// Persistent module index
+#define LMODCACHE_INDEX "/.modules"
+
+// Returned by lmodcache_loadfile when the source doesn't exist
+#define LMODCACHE_NOFILE -1
+
+typedef struct {
+    uint32_t index_hits;    // modules found in the index
+    uint32_t index_misses;  // modules looked up in package.path
+    uint32_t cache_hits;    // modules loaded from their .luac
+    uint32_t compiles;      // modules loaded from their source
+} lmodcache_stats_t;
+
+// File of the module in the index, for path, pushed, or NULL if it's not indexed.
+// A file in a relative template before the indexed one is returned instead.
+const char *lmodcache_lookup(lua_State *L, const char *name, const char *path);
+
+// Puts the module in the index, or removes it if filename is NULL, and writes
+// the index if it changes
+void lmodcache_index(lua_State *L, const char *name, const char *path, const char *filename);
+
+// Loads a Lua source file as luaL_loadfile, from its .luac if it's up to date,
+// or compiling it and writing the .luac. Returns LMODCACHE_NOFILE, with an
+// error message, if the file doesn't exist
+int lmodcache_loadfile(lua_State *L, const char *filename);
+
+void lmodcache_get_stats(lmodcache_stats_t *stats);
+
+#endif
+
+#endif
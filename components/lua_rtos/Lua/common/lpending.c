@@ -0,0 +1,80 @@
+/*
+ * Lua RTOS, work of other tasks pending for a Lua thread
+ *
+ * Copyright (C) 2015 - 2017
+ * IBEROXARXA SERVICIOS INTEGRALES, S.L. & CSS IBÉRICA, S.L.
+ *
+ * Author: Jaume Olivé (jolive@iberoxarxa.com / jolive@whitecatboard.org)
+ *
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software
+ * and its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that the copyright notice and this
+ * permission notice and warranty disclaimer appear in supporting
+ * documentation, and that the name of the author not be used in
+ * advertising or publicity pertaining to distribution of the
+ * software without specific, written prior permission.
+ *
+ * The author disclaim all warranties with regard to this
+ * software, including all implied warranties of merchantability
+ * and fitness.  In no event shall the author be liable for any
+ * special, indirect or consequential damages or any damages
+ * whatsoever resulting from loss of use, data or profits, whether
+ * in an action of contract, negligence or other tortious action,
+ * arising out of or in connection with the use or performance of
+ * this software.
+ */
+
+#include "lua.h"
+#include "lstate.h"
+
+#include "lpending.h"
+
+static lpending_handler_t handlers[LPENDING_MAX];
+
+void lpending_register(int work, lpending_handler_t handler) {
+    handlers[work] = handler;
+}
+
+static void arm(lua_State *L, int bits) {
+    // The bits are set before the mask, so the VM doesn't miss them when it
+    // clears the mask and takes the bits
+    __sync_fetch_and_or(&L->pending, bits);
+    __sync_fetch_and_or(&L->hookmask, LUA_MASKPENDING);
+}
+
+void lpending_set(lua_State *L, int work) {
+    arm(L, 1 << work);
+}
+
+void lpending_run(lua_State *L) {
+    int bits, left = 0, work;
+
+    __sync_fetch_and_and(&L->hookmask, ~LUA_MASKPENDING);
+    bits = __sync_fetch_and_and(&L->pending, 0);
+
+    for(work = 0;bits && (work < LPENDING_MAX);work++) {
+        if (!(bits & (1 << work))) continue;
+        bits &= ~(1 << work);
+
+        if (handlers[work] && handlers[work](L)) {
+            left |= (1 << work);
+        }
+    }
+
+    if (left) {
+        arm(L, left);
+    }
+}
+
+void lpending_defer(lua_State *L) {
+    __sync_fetch_and_and(&L->hookmask, ~LUA_MASKPENDING);
+}
+
+void lpending_rearm(lua_State *L) {
+    if (__sync_fetch_and_add(&L->pending, 0)) {
+        __sync_fetch_and_or(&L->hookmask, LUA_MASKPENDING);
+    }
+}
@@ -0,0 +1,71 @@
+/*
+ * Lua RTOS, work of other tasks pending for a Lua thread
+ *
+ * Copyright (C) 2015 - 2017
+ * IBEROXARXA SERVICIOS INTEGRALES, S.L. & CSS IBÉRICA, S.L.
+ *
+ * Author: Jaume Olivé (jolive@iberoxarxa.com / jolive@whitecatboard.org)
+ *
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software
+ * and its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that the copyright notice and this
+ * permission notice and warranty disclaimer appear in supporting
+ * documentation, and that the name of the author not be used in
+ * advertising or publicity pertaining to distribution of the
+ * software without specific, written prior permission.
+ *
+ * The author disclaim all warranties with regard to this
+ * software, including all implied warranties of merchantability
+ * and fitness.  In no event shall the author be liable for any
+ * special, indirect or consequential damages or any damages
+ * whatsoever resulting from loss of use, data or profits, whether
+ * in an action of contract, negligence or other tortious action,
+ * arising out of or in connection with the use or performance of
+ * this software.
+ */
+
+/*
+ * Other tasks (the profiler, the MQTT client, the event task) have work that
+ * must run in a Lua thread, as a lua_State can't be used by two tasks. They set
+ * the bit of the work in the pending work of the thread's state, and the Lua VM
+ * runs the handlers of the bits set before its next instruction, or at the
+ * return of the C function that the thread is running.
+ *
+ * The handlers run as a hook does, without other hooks, so they don't replace
+ * the hooks set with debug.sethook or lua_sethook (for example, the one set to
+ * stop the interpreter), and these ones don't starve the pending work. Work set
+ * while a hook or a handler runs is run when it returns. A handler that leaves
+ * work pending returns 1, and it's run again at the next instruction.
+ */
+
+#ifndef LPENDING_H
+#define LPENDING_H
+
+#include "lua.h"
+
+// Work pending for a Lua thread
+#define LPENDING_PROFILER 0
+#define LPENDING_MQTT     1
+#define LPENDING_EVENT    2
+
+#define LPENDING_MAX      8
+
+// Runs the work in L, returns 1 if work is left pending
+typedef int (*lpending_handler_t)(lua_State *L);
+
+void lpending_register(int work, lpending_handler_t handler);
+
+// Sets work pending for L, from any task
+void lpending_set(lua_State *L, int work);
+
+// Runs the work pending for L, called by the Lua VM as a hook
+void lpending_run(lua_State *L);
+
+// Called by the Lua VM inside hooks, the work is run when the hook returns
+void lpending_defer(lua_State *L);
+void lpending_rearm(lua_State *L);
+
+#endif
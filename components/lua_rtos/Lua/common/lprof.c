@@ -0,0 +1,411 @@
+/*
+ * Lua RTOS, sampling profiler of the Lua threads
+ *
+ * Copyright (C) 2015 - 2017
+ * IBEROXARXA SERVICIOS INTEGRALES, S.L. & CSS IBÉRICA, S.L.
+ *
+ * Author: Jaume Olivé (jolive@iberoxarxa.com / jolive@whitecatboard.org)
+ *
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software
+ * and its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that the copyright notice and this
+ * permission notice and warranty disclaimer appear in supporting
+ * documentation, and that the name of the author not be used in
+ * advertising or publicity pertaining to distribution of the
+ * software without specific, written prior permission.
+ *
+ * The author disclaim all warranties with regard to this
+ * software, including all implied warranties of merchantability
+ * and fitness.  In no event shall the author be liable for any
+ * special, indirect or consequential damages or any damages
+ * whatsoever resulting from loss of use, data or profits, whether
+ * in an action of contract, negligence or other tortious action,
+ * arising out of or in connection with the use or performance of
+ * this software.
+ */
+
+#include "luartos.h"
+
+#if CONFIG_LUA_RTOS_LUA_USE_PROFILER
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "lua.h"
+
+#include "lpending.h"
+#include "lprof.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/mutex.h>
+
+#define LPROF_STACKS CONFIG_LUA_RTOS_LUA_PROFILER_STACKS
+#define LPROF_FRAMES CONFIG_LUA_RTOS_LUA_PROFILER_STACKS
+
+typedef struct lprof_thread {
+    lua_State *L;
+    char name[16];
+    uint32_t weight;            // periods since the sample was requested, 0 if none
+    struct lprof_thread *next;
+} lprof_thread_t;
+
+typedef struct {
+    uint32_t hash;
+    char label[LPROF_LABEL];    // empty if the entry is free
+} lprof_frame_t;
+
+typedef struct {
+    uint32_t hash;
+    uint32_t count;             // 0 if the entry is free
+    uint16_t depth;
+    uint16_t frames[LPROF_DEPTH];   // from the root
+} lprof_stack_t;
+
+// The attached threads, the tables and the stats, guarded by prof_mtx
+static struct mtx prof_mtx;
+static volatile int prof_mtx_state = 0;    // 0 not initialized, 1 initializing, 2 initialized
+
+static lprof_thread_t *threads = NULL;
+static lprof_frame_t *frames = NULL;
+static lprof_stack_t *stacks = NULL;
+static lprof_stats_t stats;
+
+static volatile int task_running = 0;
+static TickType_t period;
+
+static void prof_lock() {
+    if (__sync_bool_compare_and_swap(&prof_mtx_state, 0, 1)) {
+        mtx_init(&prof_mtx, NULL, NULL, 0);
+        prof_mtx_state = 2;
+    }
+
+    while (prof_mtx_state != 2) {
+        vTaskDelay(1);
+    }
+
+    mtx_lock(&prof_mtx);
+}
+
+static void prof_unlock() {
+    mtx_unlock(&prof_mtx);
+}
+
+static uint32_t hash(uint32_t h, const void *data, size_t len) {
+    const uint8_t *p = (const uint8_t *)data;
+
+    // FNV-1a
+    while (len--) {
+        h = (h ^ *p++) * 16777619;
+    }
+
+    return h;
+}
+
+/*
+ * Sampling
+ */
+static void frame_label(lua_Debug *ar, int top, char *label) {
+    char where[LUA_IDSIZE + 24];
+    const char *name = ar->name;
+    size_t len, room;
+    char *c;
+    int n;
+
+    if (!name) {
+        name = (*ar->what == 'm')?"main chunk":"?";
+    }
+
+    if (*ar->what == 'C') {
+        snprintf(label, LPROF_LABEL, "%.32s [C]", name);
+        return;
+    }
+
+    if (top) {
+        snprintf(where, sizeof(where), "%s:%d:%d", ar->short_src, ar->linedefined, ar->currentline);
+    } else {
+        snprintf(where, sizeof(where), "%s:%d", ar->short_src, ar->linedefined);
+    }
+
+    // If it doesn't fit, the end of the source is kept, with the lines
+    n = snprintf(label, LPROF_LABEL, "%.16s@", name);
+    room = LPROF_LABEL - 1 - n;
+    len = strlen(where);
+    strcpy(label + n, where + ((len > room)?len - room:0));
+
+    // ; separates the frames
+    for(c = label;*c;c++) {
+        if (*c == ';') *c = ':';
+    }
+}
+
+// Id of the frame with label, added if it's new, or -1 if the table is full
+static int frame_id(const char *label) {
+    uint32_t h = hash(2166136261U, label, strlen(label));
+    uint32_t i, n;
+
+    for(n = 0, i = h % LPROF_FRAMES;n < LPROF_FRAMES;n++, i = (i + 1) % LPROF_FRAMES) {
+        if (!frames[i].label[0]) {
+            frames[i].hash = h;
+            strcpy(frames[i].label, label);
+            stats.frames++;
+            return i;
+        }
+
+        if ((frames[i].hash == h) && (strcmp(frames[i].label, label) == 0)) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+// Counts weight samples of the stack, returns 0 if it's new and the table is full
+static int stack_count(const uint16_t *ids, int depth, uint32_t weight) {
+    uint32_t h = hash(2166136261U, ids, depth * sizeof(uint16_t));
+    lprof_stack_t *stack;
+    uint32_t i, n;
+
+    for(n = 0, i = h % LPROF_STACKS;n < LPROF_STACKS;n++, i = (i + 1) % LPROF_STACKS) {
+        stack = &stacks[i];
+
+        if (!stack->count) {
+            stack->hash = h;
+            stack->depth = depth;
+            memcpy(stack->frames, ids, depth * sizeof(uint16_t));
+            stack->count = weight;
+            stats.stacks++;
+            return 1;
+        }
+
+        if ((stack->hash == h) && (stack->depth == depth) && (memcmp(stack->frames, ids, depth * sizeof(uint16_t)) == 0)) {
+            stack->count += weight;
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+// Pending work of the thread, that takes the sample
+static int sample(lua_State *L) {
+    char labels[LPROF_DEPTH][LPROF_LABEL];
+    uint16_t ids[LPROF_DEPTH];
+    lprof_thread_t *thread;
+    int level, depth, top, i, id;
+    uint32_t weight;
+    lua_Debug d;
+
+    // Labels from the top of the stack, the last one is the thread
+    top = 1;
+    for(level = 0, depth = 0;(depth < LPROF_DEPTH - 2) && lua_getstack(L, level, &d);level++) {
+        lua_getinfo(L, "Sln", &d);
+        frame_label(&d, top && (*d.what != 'C'), labels[depth++]);
+        if (*d.what != 'C') top = 0;
+    }
+
+    if (lua_getstack(L, level, &d)) {
+        strcpy(labels[depth++], "...");
+    }
+
+    prof_lock();
+
+    for(thread = threads;thread && (thread->L != L);thread = thread->next);
+
+    if (!stats.running || !thread || !thread->weight) {
+        prof_unlock();
+        return 0;
+    }
+
+    // The periods that the thread didn't run Lua code are in this sample
+    weight = thread->weight;
+    thread->weight = 0;
+
+    strcpy(labels[depth++], thread->name);
+
+    for(i = 0;i < depth;i++) {
+        id = frame_id(labels[depth - 1 - i]);
+        if (id < 0) break;
+
+        ids[i] = id;
+    }
+
+    if ((i == depth) && stack_count(ids, depth, weight)) {
+        stats.samples += weight;
+    } else {
+        stats.dropped += weight;
+    }
+
+    prof_unlock();
+
+    return 0;
+}
+
+static void prof_task(void *arg) {
+    lprof_thread_t *thread;
+
+    while (task_running) {
+        vTaskDelay(period);
+
+        prof_lock();
+
+        if (stats.running) {
+            for(thread = threads;thread;thread = thread->next) {
+                // At the next instruction, or at the return of the C function
+                if (thread->weight++ == 0) {
+                    lpending_set(thread->L, LPENDING_PROFILER);
+                }
+            }
+        }
+
+        prof_unlock();
+    }
+
+    task_running = -1;
+    vTaskDelete(NULL);
+}
+
+/*
+ * API
+ */
+void lprof_attach(lua_State *L, const char *name) {
+    lprof_thread_t *thread;
+
+    prof_lock();
+
+    for(thread = threads;thread && (thread->L != L);thread = thread->next);
+
+    if (!thread) {
+        thread = (lprof_thread_t *)calloc(1, sizeof(lprof_thread_t));
+        if (thread) {
+            thread->L = L;
+            strncpy(thread->name, name, sizeof(thread->name) - 1);
+            thread->next = threads;
+            threads = thread;
+        }
+    }
+
+    prof_unlock();
+}
+
+void lprof_detach(lua_State *L) {
+    lprof_thread_t *thread, **link;
+
+    prof_lock();
+
+    for(link = &threads;(thread = *link);link = &thread->next) {
+        if (thread->L == L) {
+            *link = thread->next;
+            free(thread);
+            break;
+        }
+    }
+
+    prof_unlock();
+}
+
+int lprof_start(uint32_t rate) {
+    lprof_thread_t *thread;
+
+    lprof_stop();
+
+    lpending_register(LPENDING_PROFILER, sample);
+
+    prof_lock();
+
+    if (!frames) frames = (lprof_frame_t *)malloc(LPROF_FRAMES * sizeof(lprof_frame_t));
+    if (!stacks) stacks = (lprof_stack_t *)malloc(LPROF_STACKS * sizeof(lprof_stack_t));
+
+    if (!frames || !stacks) {
+        free(frames);
+        free(stacks);
+        frames = NULL;
+        stacks = NULL;
+        prof_unlock();
+        return 0;
+    }
+
+    memset(frames, 0, LPROF_FRAMES * sizeof(lprof_frame_t));
+    memset(stacks, 0, LPROF_STACKS * sizeof(lprof_stack_t));
+    memset(&stats, 0, sizeof(stats));
+
+    for(thread = threads;thread;thread = thread->next) {
+        thread->weight = 0;
+    }
+
+    // The sampling period is a number of ticks
+    period = configTICK_RATE_HZ / (rate?rate:1);
+    if (period == 0) period = 1;
+
+    stats.rate = configTICK_RATE_HZ / period;
+    stats.running = 1;
+
+    prof_unlock();
+
+    task_running = 1;
+    if (xTaskCreatePinnedToCore(prof_task, "lprof", LPROF_STACK_SIZE, NULL,
+                                LPROF_TASK_PRIORITY, NULL, tskNO_AFFINITY) != pdPASS) {
+        task_running = 0;
+
+        prof_lock();
+        stats.running = 0;
+        prof_unlock();
+
+        return 0;
+    }
+
+    return 1;
+}
+
+void lprof_stop() {
+    prof_lock();
+    stats.running = 0;
+    prof_unlock();
+
+    if (task_running == 1) {
+        task_running = 0;
+
+        while (task_running == 0) {
+            vTaskDelay(1);
+        }
+    }
+
+    task_running = 0;
+}
+
+int lprof_dump(FILE *fp) {
+    lprof_stack_t *stack;
+    int i, j, n = 0;
+
+    prof_lock();
+
+    for(i = 0;stacks && (i < LPROF_STACKS);i++) {
+        stack = &stacks[i];
+        if (!stack->count) continue;
+
+        for(j = 0;j < stack->depth;j++) {
+            fprintf(fp, "%s%s", j?";":"", frames[stack->frames[j]].label);
+        }
+
+        fprintf(fp, " %u\n", stack->count);
+        n++;
+    }
+
+    prof_unlock();
+
+    return n;
+}
+
+void lprof_get_stats(lprof_stats_t *out) {
+    prof_lock();
+    *out = stats;
+    prof_unlock();
+}
+
+#endif
@@ -0,0 +1,94 @@
+/*
+ * Lua RTOS, sampling profiler of the Lua threads
+ *
+ * Copyright (C) 2015 - 2017
+ * IBEROXARXA SERVICIOS INTEGRALES, S.L. & CSS IBÉRICA, S.L.
+ *
+ * Author: Jaume Olivé (jolive@iberoxarxa.com / jolive@whitecatboard.org)
+ *
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software
+ * and its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that the copyright notice and this
+ * permission notice and warranty disclaimer appear in supporting
+ * documentation, and that the name of the author not be used in
+ * advertising or publicity pertaining to distribution of the
+ * software without specific, written prior permission.
+ *
+ * The author disclaim all warranties with regard to this
+ * software, including all implied warranties of merchantability
+ * and fitness.  In no event shall the author be liable for any
+ * special, indirect or consequential damages or any damages
+ * whatsoever resulting from loss of use, data or profits, whether
+ * in an action of contract, negligence or other tortious action,
+ * arising out of or in connection with the use or performance of
+ * this software.
+ */
+
+/*
+ * The profiler task wakes up at the sampling rate, and sets a sample as work
+ * pending for each attached Lua thread (see lpending.h), that runs at the next
+ * instruction, or at the return of the C function that the thread is running,
+ * and records the stack of the thread. The cost of a sample is the walk of one
+ * stack. The periods that pass until the thread takes the sample are counted
+ * in it, so the time that a thread waits in a C function is in the samples of
+ * the function.
+ *
+ * The stacks are counted in a fixed size hash table, of
+ * CONFIG_LUA_RTOS_LUA_PROFILER_STACKS stacks of up to LPROF_DEPTH frames, that
+ * are labeled "function@source:line defined", with the current line after the
+ * top Lua function, or "function [C]". When it's full, new stacks are dropped.
+ * The root frame of each stack is the name of the thread.
+ *
+ * The stacks are written in the collapsed stack format of the flame graph
+ * tools ("main;f@/app.lua:1;g@/app.lua:5:7 42").
+ */
+
+#ifndef LPROF_H
+#define LPROF_H
+
+#include "luartos.h"
+
+#include "lua.h"
+
+#include <stdint.h>
+#include <stdio.h>
+
+#if CONFIG_LUA_RTOS_LUA_USE_PROFILER
+
+// Frames of a stack, the ones of the root side are replaced by "..."
+#define LPROF_DEPTH 16
+
+// Length of a frame label
+#define LPROF_LABEL 48
+
+typedef struct {
+    int running;
+    uint32_t rate;          // samples per second
+    uint32_t samples;       // samples taken, counting the periods of each one
+    uint32_t dropped;       // samples of new stacks when the table was full
+    uint32_t stacks;        // different stacks
+    uint32_t frames;        // different frames
+} lprof_stats_t;
+
+// A Lua thread, that is sampled while the profiler runs
+void lprof_attach(lua_State *L, const char *name);
+void lprof_detach(lua_State *L);
+
+// Starts sampling at rate samples per second, clearing the previous samples.
+// Returns 0 if the profiler can't be started.
+int lprof_start(uint32_t rate);
+
+// Stops sampling, the samples are kept until the next start
+void lprof_stop();
+
+// Writes the stacks in the collapsed stack format, and returns their number
+int lprof_dump(FILE *fp);
+
+void lprof_get_stats(lprof_stats_t *stats);
+
+#endif
+
+#endif
@@ -0,0 +1,91 @@
+/*
+ * Lua RTOS, Lua strings in ROM
+ *
+ * Copyright (C) 2015 - 2017
+ * IBEROXARXA SERVICIOS INTEGRALES, S.L. & CSS IBÉRICA, S.L.
+ *
+ * Author: Jaume Olivé (jolive@iberoxarxa.com / jolive@whitecatboard.org)
+ *
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software
+ * and its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that the copyright notice and this
+ * permission notice and warranty disclaimer appear in supporting
+ * documentation, and that the name of the author not be used in
+ * advertising or publicity pertaining to distribution of the
+ * software without specific, written prior permission.
+ *
+ * The author disclaim all warranties with regard to this
+ * software, including all implied warranties of merchantability
+ * and fitness.  In no event shall the author be liable for any
+ * special, indirect or consequential damages or any damages
+ * whatsoever resulting from loss of use, data or profits, whether
+ * in an action of contract, negligence or other tortious action,
+ * arising out of or in connection with the use or performance of
+ * this software.
+ */
+
+#include "luartos.h"
+
+#if CONFIG_LUA_RTOS_LUA_USE_ROM_STRINGS
+
+#include "lua.h"
+#include "lgc.h"
+#include "lobject.h"
+#include "lstring.h"
+
+#include "lromstr.h"
+
+#include <stdint.h>
+#include <string.h>
+
+// A Lua string of len chars, as luaS_newlstr lays it out
+#define LROMSTR_TYPE(len) struct { UTString ts; char s[(len) + 1]; }
+
+#define LROMSTR_INIT(hash, extra, len, str) \
+    {{.tsv = {NULL, LUA_TSHRSTR, bitmask(BLACKBIT), extra, len, hash, {0}}}, str}
+
+#define LROMSTR_SLOT(s) ((TString *)&lromstr_rom.s.ts.tsv)
+
+// Generated at build time by Lua/tools/gen_rom_strings.py
+#include "rom_strings.h"
+
+// Approximate, as it's not updated atomically by the Lua threads
+static uint32_t hits = 0;
+
+int lromstr_isrom(const void *p) {
+    return ((const uint8_t *)p >= (const uint8_t *)&lromstr_rom) &&
+           ((const uint8_t *)p < (const uint8_t *)&lromstr_rom + sizeof(lromstr_rom));
+}
+
+TString *lromstr_getstr(const char *str, size_t l, unsigned int h) {
+    TString *ts;
+    uint32_t i;
+
+    for(i = h & LUA_ROM_STRINGS_MASK;(ts = lromstr_strt[i]);i = (i + 1) & LUA_ROM_STRINGS_MASK) {
+        if ((ts->hash == h) && (ts->shrlen == l) && (memcmp(str, getstr(ts), l) == 0)) {
+            hits++;
+            return ts;
+        }
+    }
+
+    return NULL;
+}
+
+unsigned int lromstr_seed(unsigned int seed) {
+    return LUA_ROM_STRINGS_SEED;
+}
+
+const void *lromstr_base() {
+    return &lromstr_rom;
+}
+
+void lromstr_get_stats(lromstr_stats_t *stats) {
+    stats->strings = LUA_ROM_STRINGS;
+    stats->size = sizeof(lromstr_rom) + sizeof(lromstr_strt);
+    stats->hits = hits;
+}
+
+#endif
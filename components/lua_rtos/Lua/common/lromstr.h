@@ -0,0 +1,84 @@
+/*
+ * Lua RTOS, Lua strings in ROM
+ *
+ * Copyright (C) 2015 - 2017
+ * IBEROXARXA SERVICIOS INTEGRALES, S.L. & CSS IBÉRICA, S.L.
+ *
+ * Author: Jaume Olivé (jolive@iberoxarxa.com / jolive@whitecatboard.org)
+ *
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software
+ * and its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that the copyright notice and this
+ * permission notice and warranty disclaimer appear in supporting
+ * documentation, and that the name of the author not be used in
+ * advertising or publicity pertaining to distribution of the
+ * software without specific, written prior permission.
+ *
+ * The author disclaim all warranties with regard to this
+ * software, including all implied warranties of merchantability
+ * and fitness.  In no event shall the author be liable for any
+ * special, indirect or consequential damages or any damages
+ * whatsoever resulting from loss of use, data or profits, whether
+ * in an action of contract, negligence or other tortious action,
+ * arising out of or in connection with the use or performance of
+ * this software.
+ */
+
+/*
+ * The short strings known at build time (the keys of the readonly tables, the
+ * names of the modules, the reserved words, the metamethod names, and the
+ * string literals that the Lua core and modules push or look up) are Lua
+ * strings in .rodata, with their hash, generated by Lua/tools/gen_rom_strings.py,
+ * as the readonly tables are. A new short string is looked up in them before
+ * it's created, so they don't take heap, nor entries in the string table.
+ *
+ * ROM strings are black, and the collector never marks or frees them. Their
+ * hashes are computed with a fixed seed, so the Lua states use it instead of
+ * a random one, and the hashes of the strings are the same after each boot.
+ */
+
+#ifndef LROMSTR_H
+#define LROMSTR_H
+
+#include "luartos.h"
+
+#include "lobject.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if CONFIG_LUA_RTOS_LUA_USE_ROM_STRINGS
+
+typedef struct {
+    uint32_t strings;
+    uint32_t size;          // bytes in .rodata, with the hash table
+    uint32_t hits;          // strings looked up, and found
+} lromstr_stats_t;
+
+// Is p a ROM string?
+int lromstr_isrom(const void *p);
+
+// ROM string, or NULL
+TString *lromstr_getstr(const char *str, size_t l, unsigned int h);
+
+// Seed of the hashes of a new Lua state
+unsigned int lromstr_seed(unsigned int seed);
+
+// Address of the ROM strings, that a flash image refers to
+const void *lromstr_base();
+
+void lromstr_get_stats(lromstr_stats_t *stats);
+
+#else
+
+#define lromstr_isrom(p) 0
+#define lromstr_getstr(str, l, h) NULL
+#define lromstr_seed(seed) (seed)
+#define lromstr_base() NULL
+
+#endif
+
+#endif
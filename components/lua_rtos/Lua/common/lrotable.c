@@ -15,6 +15,7 @@
 #include "lstring.h"
 #include "lua.h"
 #include <string.h>
+#include <stdlib.h>
 
 /* Externally defined read-only table array */
 extern const luaR_entry lua_rotable[];
@@ -22,19 +23,296 @@ extern const luaR_entry lua_rotable[];
 static const TValue *luaR_auxfind(const luaR_entry *pentry, const char *strkey,
 		luaR_numkey numkey, unsigned *ppos);
 
+#if CONFIG_LUA_RTOS_LUA_USE_ROTABLE_INDEX
+
+// Generated at build time by Lua/tools/gen_rotable_index.py
+#include "rotable_index.h"
+
+// Max depth for search maps from lua_rotable
+#define LUA_ROTABLE_INDEX_DEPTH 4
+
+// A map and its index
+typedef struct {
+	const luaR_entry *map;
+	const luaR_hindex *index;
+} luaR_hindex_map;
+
+// Indexed maps, by map address (open addressing)
+static luaR_hindex_map *hmaps = NULL;
+static uint16_t hmaps_mask = 0;
+static uint16_t hmaps_count = 0;
+
+// lua_rotable position + 1, by module name hash (open addressing)
+static uint8_t *hglobal = NULL;
+static uint16_t hglobal_mask = 0;
+static uint16_t hglobal_entries = 0;
+
+/*
+ * FNV-1a hash of a key. This function, and luaR_slot, must be kept in sync
+ * with Lua/tools/gen_rotable_index.py.
+ */
+static inline uint32_t luaR_hash(const char *k, int *len) {
+	const char *c = k;
+	uint32_t h = 0x811c9dc5;
+
+	while (*c) {
+		h = (h ^ (uint8_t)*c++) * 0x01000193;
+	}
+
+	*len = c - k;
+
+	return h;
+}
+
+static inline uint32_t luaR_hash_len(uint32_t h, const char *k, int len) {
+	while (len--) {
+		h = (h ^ (uint8_t)*k++) * 0x01000193;
+	}
+
+	return h;
+}
+
+static inline uint32_t luaR_slot(uint32_t h, uint8_t d, uint16_t mask) {
+	uint32_t x = (h ^ (d * 0x9e3779b1)) * 0x85ebca6b;
+
+	x ^= x >> 13;
+
+	return x & mask;
+}
+
+static inline uint32_t luaR_ptr_hash(const void *p) {
+	uint32_t x = ((uint32_t)(uintptr_t)p >> 2) * 0x9e3779b1;
+
+	return x ^ (x >> 16);
+}
+
+static inline int luaR_key_eq(const luaR_entry *entry, const char *k, int len) {
+	return (
+		(entry->key.type == LUA_TSTRING) && (entry->key.len == len) &&
+		(!memcmp(entry->key.id.strkey, k, len))
+	);
+}
+
+/*
+ * Get the index of a map, or NULL if map is not indexed.
+ */
+static inline const luaR_hindex *luaR_hindex_get(const luaR_entry *map) {
+	uint32_t i;
+
+	if (!hmaps) {
+		return NULL;
+	}
+
+	i = luaR_ptr_hash(map) & hmaps_mask;
+	while (hmaps[i].map) {
+		if (hmaps[i].map == map) {
+			return hmaps[i].index;
+		}
+
+		i = (i + 1) & hmaps_mask;
+	}
+
+	return NULL;
+}
+
+/*
+ * Find a string key in an indexed map, and return its position, or -1
+ * if key is not in the map.
+ */
+static inline int luaR_hindex_find(const luaR_hindex *index, const luaR_entry *map, const char *k) {
+	int len;
+	uint32_t h = luaR_hash(k, &len);
+	uint8_t pos = index->slots[luaR_slot(h, index->disp[h & index->bucket_mask], index->size_mask)];
+
+	if (pos && luaR_key_eq(&map[pos - 1], k, len)) {
+		return pos - 1;
+	}
+
+	return -1;
+}
+
+/*
+ * Find a module name in lua_rotable, and return its position, or -1
+ * if module is not in lua_rotable.
+ */
+static inline int luaR_hglobal_find(const char *k) {
+	int len;
+	uint32_t i = luaR_hash(k, &len) & hglobal_mask;
+
+	while (hglobal[i]) {
+		if (luaR_key_eq(&lua_rotable[hglobal[i] - 1], k, len)) {
+			return hglobal[i] - 1;
+		}
+
+		i = (i + 1) & hglobal_mask;
+	}
+
+	return -1;
+}
+
+/*
+ * Compute the signature of a map, the same that gen_rotable_index.py
+ * computes from the source code.
+ */
+static uint32_t luaR_hindex_sign(const luaR_entry *map, int *entries) {
+	const luaR_entry *entry;
+	uint32_t h;
+	char z = 0;
+
+	*entries = luaH_getn_ro((void *)map);
+
+	h = 0x811c9dc5 ^ *entries;
+	for(entry = map;entry->key.id.strkey;entry++) {
+		if (entry->key.type == LUA_TSTRING) {
+			h = luaR_hash_len(h, entry->key.id.strkey, entry->key.len);
+			h = luaR_hash_len(h, &z, 1);
+		}
+	}
+
+	return h;
+}
+
+/*
+ * Find the generated index for a map, and check that it's valid for the map.
+ */
+static const luaR_hindex *luaR_hindex_lookup(const luaR_entry *map) {
+	const luaR_hindex *index = NULL;
+	const luaR_entry *entry;
+	int entries, pos;
+	int l = 0, r = LUA_ROTABLE_INDEX_MAPS - 1, m;
+
+	uint32_t sign = luaR_hindex_sign(map, &entries);
+
+	while (l <= r) {
+		m = (l + r) / 2;
+		if (luaR_hindex_maps[m].sign == sign) {
+			index = &luaR_hindex_maps[m];
+			break;
+		} else if (luaR_hindex_maps[m].sign < sign) {
+			l = m + 1;
+		} else {
+			r = m - 1;
+		}
+	}
+
+	if (!index || (index->entries != entries)) {
+		return NULL;
+	}
+
+	// Each key must be found at its position, or at the position of
+	// a previous entry with the same key, as in a linear search
+	for(entry = map, pos = 0;entry->key.id.strkey;entry++, pos++) {
+		if (entry->key.type != LUA_TSTRING) {
+			continue;
+		}
+
+		uint32_t h = luaR_hash_len(0x811c9dc5, entry->key.id.strkey, entry->key.len);
+		uint8_t slot = index->slots[luaR_slot(h, index->disp[h & index->bucket_mask], index->size_mask)];
+
+		if (!slot || (slot - 1 > pos) || !luaR_key_eq(&map[slot - 1], entry->key.id.strkey, entry->key.len)) {
+			return NULL;
+		}
+	}
+
+	return index;
+}
+
+/*
+ * Add a map, and the maps referenced by it, to the indexed maps.
+ */
+static void luaR_hindex_add(const luaR_entry *map, int depth) {
+	const luaR_hindex *index;
+	const luaR_entry *entry;
+	uint32_t i;
+
+	if (!map || (depth > LUA_ROTABLE_INDEX_DEPTH) || luaR_hindex_get(map)) {
+		return;
+	}
+
+	// Keep at least one free slot, to end the searches
+	if ((hmaps_count < hmaps_mask) && (index = luaR_hindex_lookup(map))) {
+		i = luaR_ptr_hash(map) & hmaps_mask;
+		while (hmaps[i].map) {
+			i = (i + 1) & hmaps_mask;
+		}
+
+		hmaps[i].map = map;
+		hmaps[i].index = index;
+		hmaps_count++;
+	}
+
+	for(entry = map;entry->key.id.strkey;entry++) {
+		if (ttisrotable(&entry->value)) {
+			luaR_hindex_add((const luaR_entry *)rvalue(&entry->value), depth + 1);
+		}
+	}
+}
+
+/*
+ * Build the indexes used by luaR_findglobal / luaR_findentry. Must be called
+ * once, before any Lua thread is started. If an index can't be build the
+ * linear search is used.
+ */
+void luaR_hindex_init() {
+	const luaR_entry *entry;
+	int size, len, modules;
+	uint32_t i;
+
+	if (hmaps || hglobal) {
+		return;
+	}
+
+	// lua_rotable index
+	modules = luaH_getn_ro((void *)lua_rotable);
+	for(size = 1;size < modules * 2;size <<= 1);
+
+	if ((modules < 255) && (hglobal = calloc(size, sizeof(uint8_t)))) {
+		hglobal_mask = size - 1;
+		hglobal_entries = modules;
+
+		for(entry = lua_rotable;entry->key.id.strkey;entry++) {
+			if (luaR_hglobal_find(entry->key.id.strkey) >= 0) {
+				// Duplicated, linear search gets the first one
+				continue;
+			}
+
+			i = luaR_hash(entry->key.id.strkey, &len) & hglobal_mask;
+			while (hglobal[i]) {
+				i = (i + 1) & hglobal_mask;
+			}
+
+			hglobal[i] = (entry - lua_rotable) + 1;
+		}
+	}
+
+	// Maps index
+	for(size = 1;size < LUA_ROTABLE_INDEX_MAPS * 2;size <<= 1);
+
+	if ((hmaps = calloc(size, sizeof(luaR_hindex_map)))) {
+		hmaps_mask = size - 1;
+
+		for(entry = lua_rotable;entry->key.id.strkey;entry++) {
+			if (ttisrotable(&entry->value)) {
+				luaR_hindex_add((const luaR_entry *)rvalue(&entry->value), 0);
+			}
+		}
+	}
+}
+#endif
+
 /*
  * Only for debug purposes.
  */
 void luaR_dump(luaR_entry *entry) {
-	printf("lua_rotable %x\r\n",(unsigned int)entry);
+	printf("lua_rotable %p\r\n", (void *) entry);
 
 	while (entry->key.id.strkey) {
 		if (entry->key.len >= 0) {
-			printf("  [%s] --> %x\r\n", entry->key.id.strkey,
-					(unsigned int) rvalue(&entry->value));
+			printf("  [%s] --> %p\r\n", entry->key.id.strkey,
+					(void *) rvalue(&entry->value));
 		} else {
-			printf("  [%d] --> %x\r\n", entry->key.id.numkey,
-					(unsigned int) rvalue(&entry->value));
+			printf("  [%d] --> %p\r\n", entry->key.id.numkey,
+					(void *) rvalue(&entry->value));
 		}
 		entry++;
 	}
@@ -66,11 +344,32 @@ static const IRAM_ATTR TValue *luaR_auxfind(const luaR_entry *pentry, const char
 	int i = 0;
 
 	if (k) {
+		#if CONFIG_LUA_RTOS_LUA_USE_ROTABLE_INDEX
+		const luaR_hindex *index = luaR_hindex_get(pentry);
+		if (index) {
+			i = luaR_hindex_find(index, pentry, k);
+			if (i < 0) {
+				if (ppos)
+					*ppos = index->entries;
+
+				return res;
+			}
+
+			if (ppos)
+				*ppos = i;
+
+			return &pentry[i].value;
+		}
+		#endif
+
 		// Try to get from cache
 		#if CONFIG_LUA_RTOS_LUA_USE_ROTABLE_CACHE
-		res = rotable_cache_get(pentry, k);
-		if (res) {
-			return res;
+		const luaR_entry *cached = rotable_cache_get(pentry, k);
+		if (cached) {
+			if (ppos)
+				*ppos = cached - pentry;
+
+			return &cached->value;
 		}
 		#endif
 
@@ -80,7 +379,7 @@ static const IRAM_ATTR TValue *luaR_auxfind(const luaR_entry *pentry, const char
 			if ((entry->key.type == LUA_TSTRING) && (entry->key.len == kl) && (!strncmp(entry->key.id.strkey, k, kl))) {
 				#if CONFIG_LUA_RTOS_LUA_USE_ROTABLE_CACHE
 				// Put in cache
-				rotable_cache_put(pentry, entry);
+				rotable_cache_put(pentry, k, entry);
 				#endif
 
 				res = &entry->value;
@@ -117,13 +416,19 @@ static const IRAM_ATTR TValue *luaR_auxfind(const luaR_entry *pentry, const char
  *
  */
 const IRAM_ATTR TValue *luaR_findglobal(const char *name) {
-	const TValue *res;
+	#if CONFIG_LUA_RTOS_LUA_USE_ROTABLE_INDEX
+	if (hglobal) {
+		int pos = luaR_hglobal_find(name);
+
+		return (pos < 0)?NULL:&lua_rotable[pos].value;
+	}
+	#endif
 
 	// Try to get from cache
 	#if CONFIG_LUA_RTOS_LUA_USE_ROTABLE_CACHE
-	res = rotable_cache_get(lua_rotable, name);
+	const luaR_entry *res = rotable_cache_get(lua_rotable, name);
 	if (res) {
-		return res;
+		return &res->value;
 	}
 	#endif
 
@@ -134,7 +439,7 @@ const IRAM_ATTR TValue *luaR_findglobal(const char *name) {
 		if ((entry->key.len == len) && (!strncmp(entry->key.id.strkey, name, len))) {
 			#if CONFIG_LUA_RTOS_LUA_USE_ROTABLE_CACHE
 			// Put in cache
-			rotable_cache_put(lua_rotable, entry);
+			rotable_cache_put(lua_rotable, name, entry);
 			#endif
 
 			return &entry->value;
@@ -165,6 +470,17 @@ const TValue *luaR_findentry(const void *pentry, const char *strkey,
 	if (pentry) {
 		return luaR_auxfind((const luaR_entry *) pentry, strkey, numkey, ppos);
 	} else {
+		#if CONFIG_LUA_RTOS_LUA_USE_ROTABLE_INDEX
+		if (strkey && hglobal) {
+			int pos = luaR_hglobal_find(strkey);
+
+			if (ppos)
+				*ppos = (pos < 0)?hglobal_entries:pos;
+
+			return (pos < 0)?luaO_nilobject:&lua_rotable[pos].value;
+		}
+		#endif
+
 		return luaR_auxfind(lua_rotable, strkey, numkey, ppos);
 	}
 }
@@ -270,7 +586,8 @@ int luaR_index(lua_State *L, const void *funcs, const void *consts) {
 		}
 	}
 
-	return (int) luaO_nilobject;
+	// Nothing pushed, as luaR_findfunction
+	return 0;
 }
 
 LUALIB_API int luaL_newmetarotable (lua_State *L, const char* tname, void *p) {
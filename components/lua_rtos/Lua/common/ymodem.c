@@ -140,7 +140,7 @@ static void send_CRC16 ( void ) {
 //--------------------------------------------------------------------------
 static int32_t Receive_Packet (uint8_t *data, int *length, uint32_t timeout)
 {
-  int count, packet_size, i;
+  int count, packet_size;
   unsigned char ch;
   *length = 0;
   
@@ -181,11 +181,8 @@ static int32_t Receive_Packet (uint8_t *data, int *length, uint32_t timeout)
   uint8_t *dptr = data+1;
   count = packet_size + PACKET_OVERHEAD-1;
 
-  for (i=0; i<count; i++) {
-	  if (Receive_Byte(&ch, timeout) < 0) {
-		  return -1;
-	  }
-	  *dptr++ = (uint8_t)ch;;
+  if (uart_read_block(CONSOLE_UART, (char *)dptr, count, timeout) != count) {
+	  return -1;
   }
 
   if (data[PACKET_SEQNO_INDEX] != ((data[PACKET_SEQNO_COMP_INDEX] ^ 0xff) & 0xff)) {
@@ -32,143 +32,1040 @@
 #if CONFIG_LUA_RTOS_LUA_USE_EVENT
 
 #include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
 #include "freertos/queue.h"
 
+#include "esp_attr.h"
+
 #include "lua.h"
 #include "lualib.h"
 #include "lauxlib.h"
 #include "auxmods.h"
-#include "error.h"
 #include "event.h"
+#include "lpending.h"
 #include "modules.h"
+#include "thread_isolate.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/mutex.h>
+#include <sys/syslog.h>
+
+// States of the event task
+#define EVENTS_STOPPED  0
+#define EVENTS_STARTING 1
+#define EVENTS_STARTED  2
+
+#define EVENT_SINK_MT "event.sink"
 
-// This variables are defined at linker time
 extern LUA_REG_TYPE event_error_map[];
 
-static int levent_create( lua_State* L ) {
-	// Create user data
-    event_userdata *udata = (event_userdata *)lua_newuserdata(L, sizeof(event_userdata));
-    if (!udata) {
-    	// TO DO: exception
+typedef struct {
+    uint32_t broadcasts;
+    uint32_t queued;        // calls queued to the listeners
+    uint32_t dispatched;    // calls run
+    uint32_t dropped;       // calls not queued, because the queue of the listener's thread was full
+    uint32_t errors;        // calls that raised an error
+} event_stats_t;
+
+struct event_listener;
+
+struct event {
+    int refs;               // userdata in all the states, listeners, timers, C users and deferred posts
+    char *name;             // NULL if the event is anonymous
+    int ids;                // last listener id
+    int nlisteners;
+    struct event_listener *listeners;
+    event_stats_t stats;
+    uint32_t isr_dropped;   // posts from interrupt handlers not deferred, the event task queue was full
+    struct event *next;     // next of all the events
+};
+
+// A Lua thread that has listeners, and the calls queued to it
+typedef struct {
+    lua_State *L;
+    QueueHandle_t queue;    // of event_call_t
+    int dispatching;        // 1 while a listener is running
+    struct event_listener *released; // listeners to free in L
+} event_sink_t;
+
+typedef struct event_listener {
+    event_t *event;
+    event_sink_t *sink;     // thread that runs the listener
+    int func;               // reference of the function in the registry of the sink
+    int id;
+    int once;               // removed when its first call is queued
+    int refs;               // the event's list, and the queued calls
+    struct event_listener *next; // next listener of the event, or released listener
+} event_listener_t;
+
+// The arguments of a broadcast, shared by the calls queued to each listener
+typedef struct {
+    int refs;               // queued calls, and the broadcaster or timer
+    thread_msg_t *msg;      // table with the arguments, and its count in n, or NULL
+    int value;              // the argument, if msg is NULL
+    int nvalues;            // 0 if there is no argument, if msg is NULL
+} event_args_t;
+
+typedef struct {
+    event_listener_t *listener;
+    event_args_t *args;
+} event_call_t;
+
+typedef struct event_timer {
+    int refs;               // userdata, and the timer list
+    int stopped;
+    event_t *event;
+    event_args_t *args;
+    TickType_t due;
+    TickType_t period;      // 0 if the timer fires once
+    struct event_timer *next;
+} event_timer_t;
+
+// A post deferred to the event task, with NULL event to wake up the task
+typedef struct {
+    event_t *event;
+    int value;
+} event_post_t;
+
+// All the events, and the timers, guarded by events_mtx
+static event_t *events = NULL;
+static event_timer_t *timers = NULL;
+static struct mtx events_mtx;
+
+static QueueHandle_t deferred = NULL;
+static int events_state = EVENTS_STOPPED;
+
+static void event_task(void *arg);
+
+/*
+ * Events, listeners and arguments. Called with events_mtx locked.
+ */
+static void event_release(event_t *event) {
+    event_t **link;
+
+    if (__sync_sub_and_fetch(&event->refs, 1) > 0) {
+        return;
+    }
+
+    for(link = &events;*link;link = &(*link)->next) {
+        if (*link == event) {
+            *link = event->next;
+            break;
+        }
+    }
+
+    free(event->name);
+    free(event);
+}
 
-    	return 0;
+static void args_release(event_args_t *args) {
+    if (--args->refs > 0) {
+        return;
     }
 
-    // Init mutex
-    mtx_init(&udata->mtx, NULL, NULL, 0);
+    thread_isolate_free(args->msg);
+    free(args);
+}
+
+// The function of the listener is unreferenced in the listener's thread
+static void listener_release(event_listener_t *listener) {
+    if (--listener->refs > 0) {
+        return;
+    }
+
+    listener->next = listener->sink->released;
+    listener->sink->released = listener;
+}
+
+// Unlinks a listener from its event, the listener is at *link
+static void listener_unlink(event_listener_t **link) {
+    event_listener_t *listener = *link;
+
+    *link = listener->next;
+    listener->event->nlisteners--;
+
+    listener_release(listener);
+}
 
-    // Create listener list
-    list_init(&udata->listener_list, 1);
+/*
+ * Queues a call to each listener of the event, without waiting, and returns
+ * the number of calls queued.
+ */
+static int broadcast(event_t *event, event_args_t *args) {
+    event_listener_t *listener, **link;
+    event_call_t call;
+    int queued = 0;
 
-    luaL_getmetatable(L, "event.ins");
+    event->stats.broadcasts++;
+
+    link = &event->listeners;
+    while ((listener = *link)) {
+        call.listener = listener;
+        call.args = args;
+
+        listener->refs++;
+        args->refs++;
+
+        if (xQueueSend(listener->sink->queue, &call, 0) != pdTRUE) {
+            listener->refs--;
+            args->refs--;
+
+            event->stats.dropped++;
+            link = &listener->next;
+            continue;
+        }
+
+        event->stats.queued++;
+        queued++;
+
+        // The call is run when the thread runs Lua code, or dispatches
+        lpending_set(listener->sink->L, LPENDING_EVENT);
+
+        if (listener->once) {
+            listener_unlink(link);
+        } else {
+            link = &listener->next;
+        }
+    }
+
+    return queued;
+}
+
+/*
+ * The event task, that runs the timers, and the broadcasts deferred from
+ * interrupt handlers.
+ */
+
+// Broadcasts the timers that are due, and returns the ticks to the next one
+static TickType_t timers_run() {
+    TickType_t now = xTaskGetTickCount();
+    TickType_t wait = portMAX_DELAY;
+    event_timer_t *timer, **link;
+
+    link = &timers;
+    while ((timer = *link)) {
+        if (!timer->stopped && ((int32_t)(timer->due - now) <= 0)) {
+            broadcast(timer->event, timer->args);
+
+            if (timer->period) {
+                timer->due += timer->period;
+
+                // Don't catch up the periods lost while the task was not running
+                if ((int32_t)(timer->due - now) <= 0) {
+                    timer->due = now + timer->period;
+                }
+            } else {
+                timer->stopped = 1;
+            }
+        }
+
+        if (timer->stopped) {
+            *link = timer->next;
+
+            if (--timer->refs == 0) {
+                args_release(timer->args);
+                event_release(timer->event);
+                free(timer);
+            }
+
+            continue;
+        }
+
+        if (timer->due - now < wait) {
+            wait = timer->due - now;
+        }
+
+        link = &timer->next;
+    }
+
+    return wait;
+}
+
+static void event_task(void *arg) {
+    event_post_t post;
+    TickType_t wait;
+
+    for(;;) {
+        mtx_lock(&events_mtx);
+        wait = timers_run();
+        mtx_unlock(&events_mtx);
+
+        if ((xQueueReceive(deferred, &post, wait) == pdTRUE) && post.event) {
+            event_post(post.event, post.value);
+
+            mtx_lock(&events_mtx);
+            event_release(post.event);
+            mtx_unlock(&events_mtx);
+        }
+    }
+}
+
+static void events_wakeup() {
+    event_post_t post = {NULL, 0};
+
+    // If the queue is full the task is already awake
+    xQueueSend(deferred, &post, 0);
+}
+
+// Creates the event task the first time an event is created
+static int events_start() {
+    if (__sync_bool_compare_and_swap(&events_state, EVENTS_STOPPED, EVENTS_STARTING)) {
+        int state = EVENTS_STOPPED;
+
+        mtx_init(&events_mtx, NULL, NULL, 0);
+
+        deferred = xQueueCreate(EVENT_DEFERRED_SIZE, sizeof(event_post_t));
+        if (deferred) {
+            if (xTaskCreatePinnedToCore(event_task, "event", EVENT_STACK_SIZE, NULL,
+                                        EVENT_TASK_PRIORITY, NULL, tskNO_AFFINITY) == pdPASS) {
+                state = EVENTS_STARTED;
+            } else {
+                vQueueDelete(deferred);
+                deferred = NULL;
+            }
+        }
+
+        if (state == EVENTS_STOPPED) {
+            mtx_destroy(&events_mtx);
+        }
+
+        // If the task can't be created, try again on the next create
+        __sync_bool_compare_and_swap(&events_state, EVENTS_STARTING, state);
+    }
+
+    // Other thread can be creating the task
+    while (__sync_fetch_and_add(&events_state, 0) == EVENTS_STARTING) {
+        vTaskDelay(1);
+    }
+
+    return (events_state == EVENTS_STARTED);
+}
+
+/*
+ * C API
+ */
+event_t *event_create(const char *name) {
+    event_t *event;
+
+    if (!events_start()) {
+        return NULL;
+    }
+
+    mtx_lock(&events_mtx);
+
+    if (name) {
+        for(event = events;event;event = event->next) {
+            if (event->name && (strcmp(event->name, name) == 0)) {
+                __sync_add_and_fetch(&event->refs, 1);
+                mtx_unlock(&events_mtx);
+
+                return event;
+            }
+        }
+    }
+
+    event = (event_t *)calloc(1, sizeof(event_t));
+    if (event && name) {
+        event->name = strdup(name);
+        if (!event->name) {
+            free(event);
+            event = NULL;
+        }
+    }
+
+    if (event) {
+        event->refs = 1;
+        event->next = events;
+        events = event;
+    }
+
+    mtx_unlock(&events_mtx);
+
+    return event;
+}
+
+void event_unref(event_t *event) {
+    mtx_lock(&events_mtx);
+    event_release(event);
+    mtx_unlock(&events_mtx);
+}
+
+int event_post(event_t *event, int value) {
+    event_args_t *args;
+    int queued = 0;
+
+    args = (event_args_t *)calloc(1, sizeof(event_args_t));
+
+    mtx_lock(&events_mtx);
+
+    if (args) {
+        args->refs = 1;
+        args->value = value;
+        args->nvalues = 1;
+
+        queued = broadcast(event, args);
+        args_release(args);
+    } else {
+        event->stats.broadcasts++;
+        event->stats.dropped += event->nlisteners;
+    }
+
+    mtx_unlock(&events_mtx);
+
+    return queued;
+}
+
+int IRAM_ATTR event_post_isr(event_t *event, int value) {
+    BaseType_t woken = pdFALSE;
+    event_post_t post;
+
+    // The caller has a reference, this one is released by the event task
+    __sync_add_and_fetch(&event->refs, 1);
+
+    post.event = event;
+    post.value = value;
+
+    if (xQueueSendFromISR(deferred, &post, &woken) != pdTRUE) {
+        __sync_sub_and_fetch(&event->refs, 1);
+        __sync_add_and_fetch(&event->isr_dropped, 1);
+
+        return 0;
+    }
+
+    if (woken) {
+        portYIELD_FROM_ISR();
+    }
+
+    return 1;
+}
+
+/*
+ * Sinks. Each Lua thread with listeners has a sink, in a table of the registry
+ * with weak keys, by thread. The sink is closed when its thread is collected,
+ * or when the state is closed.
+ */
+static char sinks_key;
+
+// Pushes the table of the sinks
+static void sinks_push(lua_State *L) {
+    if (lua_rawgetp(L, LUA_REGISTRYINDEX, &sinks_key) == LUA_TTABLE) {
+        return;
+    }
+    lua_pop(L, 1);
+
+    lua_newtable(L);
+
+    lua_createtable(L, 0, 1);
+    lua_pushliteral(L, "k");
+    lua_setfield(L, -2, "__mode");
+    lua_setmetatable(L, -2);
+
+    lua_pushvalue(L, -1);
+    lua_rawsetp(L, LUA_REGISTRYINDEX, &sinks_key);
+}
+
+static event_sink_t *sink_get(lua_State *L, int create) {
+    event_sink_t **ud, *sink = NULL;
+
+    sinks_push(L);
+
+    lua_pushthread(L);
+    if (lua_rawget(L, -2) == LUA_TUSERDATA) {
+        sink = *(event_sink_t **)lua_touserdata(L, -1);
+    }
+    lua_pop(L, 1);
+
+    if (sink || !create) {
+        lua_pop(L, 1);
+        return sink;
+    }
+
+    ud = (event_sink_t **)lua_newuserdata(L, sizeof(event_sink_t *));
+    *ud = NULL;
+
+    luaL_getmetatable(L, EVENT_SINK_MT);
     lua_setmetatable(L, -2);
 
+    // The key is weak, and the thread is kept by the sink until the sink is
+    // closed, so other tasks don't post work to a thread that is freed
+    lua_pushthread(L);
+    lua_setuservalue(L, -2);
+
+    sink = (event_sink_t *)calloc(1, sizeof(event_sink_t));
+    if (!sink) {
+        luaL_error(L, "not enough memory");
+    }
+
+    sink->queue = xQueueCreate(EVENT_QUEUE_SIZE, sizeof(event_call_t));
+    if (!sink->queue) {
+        free(sink);
+        luaL_error(L, "not enough memory");
+    }
+
+    sink->L = L;
+    *ud = sink;
+
+    lua_pushthread(L);
+    lua_insert(L, -2);
+    lua_rawset(L, -3);
+    lua_pop(L, 1);
+
+    return sink;
+}
+
+// Takes the listeners of the sink that are not used. Called with events_mtx locked.
+static event_listener_t *sink_released(event_sink_t *sink) {
+    event_listener_t *listener, *released = sink->released;
+
+    sink->released = NULL;
+
+    for(listener = released;listener;listener = listener->next) {
+        event_release(listener->event);
+    }
+
+    return released;
+}
+
+// Frees the listeners taken from a sink, in its thread
+static void listeners_free(lua_State *L, event_listener_t *listener) {
+    event_listener_t *next;
+
+    while (listener) {
+        next = listener->next;
+
+        luaL_unref(L, LUA_REGISTRYINDEX, listener->func);
+        free(listener);
+
+        listener = next;
+    }
+}
+
+static void sink_collect(lua_State *L, event_sink_t *sink) {
+    event_listener_t *released;
+
+    mtx_lock(&events_mtx);
+    released = sink_released(sink);
+    mtx_unlock(&events_mtx);
+
+    listeners_free(L, released);
+}
+
+// Runs a call in the listener's thread
+static int call_listener(lua_State *L) {
+    event_call_t *call = (event_call_t *)lua_touserdata(L, 1);
+    event_args_t *args = call->args;
+    int i, n;
+
+    lua_rawgeti(L, LUA_REGISTRYINDEX, call->listener->func);
+
+    if (args->msg) {
+        thread_isolate_push(L, args->msg);
+
+        lua_getfield(L, -1, "n");
+        n = lua_tointeger(L, -1);
+        lua_pop(L, 1);
+
+        luaL_checkstack(L, n, "too many arguments");
+        for(i = 1;i <= n;i++) {
+            lua_rawgeti(L, 3, i);
+        }
+
+        lua_remove(L, 3);
+    } else {
+        n = args->nvalues;
+        if (n) lua_pushinteger(L, args->value);
+    }
+
+    lua_call(L, n, 0);
+
+    return 0;
+}
+
+static void dispatch_call(lua_State *L, event_sink_t *sink, event_call_t *call) {
+    event_t *event = call->listener->event;
+    event_listener_t *released;
+    int status;
+
+    sink->dispatching = 1;
+
+    lua_pushcfunction(L, call_listener);
+    lua_pushlightuserdata(L, call);
+
+    status = lua_pcall(L, 1, 0, 0);
+    if (status != LUA_OK) {
+        syslog(LOG_ERR, "event: listener error: %s", lua_tostring(L, -1));
+        lua_pop(L, 1);
+    }
+
+    sink->dispatching = 0;
+
+    mtx_lock(&events_mtx);
+
+    event->stats.dispatched++;
+    if (status != LUA_OK) event->stats.errors++;
+
+    listener_release(call->listener);
+    args_release(call->args);
+
+    released = sink_released(sink);
+
+    mtx_unlock(&events_mtx);
+
+    listeners_free(L, released);
+}
+
+// Runs the calls queued to the thread, waiting ticks for the first one
+static int dispatch(lua_State *L, event_sink_t *sink, TickType_t ticks) {
+    event_call_t call;
+    int n = 0;
+
+    // Listeners may call event.dispatch
+    if (sink->dispatching) {
+        return 0;
+    }
+
+    while (xQueueReceive(sink->queue, &call, n?0:ticks) == pdTRUE) {
+        dispatch_call(L, sink, &call);
+        n++;
+    }
+
+    return n;
+}
+
+static int event_pending(lua_State *L) {
+    event_sink_t *sink;
+
+    sink = sink_get(L, 0);
+    if (sink) {
+        dispatch(L, sink, 0);
+    }
+
+    return 0;
+}
+
+// Called when the thread is collected or the state is closed, the listeners of
+// the thread are removed
+static int sink_gc(lua_State *L) {
+    event_sink_t **ud = (event_sink_t **)luaL_checkudata(L, 1, EVENT_SINK_MT);
+    event_sink_t *sink = *ud;
+    event_listener_t *listener, *released, **link;
+    event_call_t call;
+    event_t *event;
+
+    if (!sink) {
+        return 0;
+    }
+
+    *ud = NULL;
+
+    mtx_lock(&events_mtx);
+
+    for(event = events;event;event = event->next) {
+        link = &event->listeners;
+        while ((listener = *link)) {
+            if (listener->sink == sink) {
+                listener_unlink(link);
+            } else {
+                link = &listener->next;
+            }
+        }
+    }
+
+    while (xQueueReceive(sink->queue, &call, 0) == pdTRUE) {
+        listener_release(call.listener);
+        args_release(call.args);
+    }
+
+    released = sink_released(sink);
+
+    mtx_unlock(&events_mtx);
+
+    // The functions are unreferenced, as the state can go on without the thread
+    listeners_free(L, released);
+
+    vQueueDelete(sink->queue);
+    free(sink);
+
+    return 0;
+}
+
+/*
+ * Lua API
+ */
+static event_t *event_check(lua_State *L) {
+    event_t **ud = (event_t **)luaL_checkudata(L, 1, EVENT_MT);
+
+    luaL_argcheck(L, *ud, 1, "event expected");
+
+    return *ud;
+}
+
+static TickType_t event_ticks(lua_Integer ms) {
+    return (ms < 0)?portMAX_DELAY:ms / portTICK_PERIOD_MS;
+}
+
+// Packs the arguments from idx, as a table with its count in n
+static event_args_t *event_args(lua_State *L, int idx) {
+    int i, n = lua_gettop(L) - idx + 1;
+    event_args_t *args;
+    const char *err;
+
+    if (n < 0) n = 0;
+
+    lua_createtable(L, n, 1);
+    for(i = 1;i <= n;i++) {
+        lua_pushvalue(L, idx + i - 1);
+        lua_rawseti(L, -2, i);
+    }
+
+    lua_pushinteger(L, n);
+    lua_setfield(L, -2, "n");
+
+    args = (event_args_t *)calloc(1, sizeof(event_args_t));
+    if (!args) {
+        luaL_error(L, "not enough memory");
+    }
+
+    args->refs = 1;
+
+    err = thread_isolate_put(L, -1, &args->msg);
+    if (err) {
+        free(args);
+        luaL_error(L, "%s", err);
+    }
+
+    lua_pop(L, 1);
+
+    return args;
+}
+
+// event.create([name])
+static int levent_create(lua_State *L) {
+    const char *name = luaL_optstring(L, 1, NULL);
+    event_t **ud;
+
+    // The userdata is set before the event is created, so it's released if anything fails
+    ud = (event_t **)lua_newuserdata(L, sizeof(event_t *));
+    *ud = NULL;
+
+    luaL_getmetatable(L, EVENT_MT);
+    lua_setmetatable(L, -2);
+
+    *ud = event_create(name);
+    if (!*ud) {
+        return luaL_error(L, "can't create the event");
+    }
+
     return 1;
 }
 
-static int levent_addlistener( lua_State* L ) {
-    event_userdata *udata = NULL;
-    int *func;
-    int id;
-    int ret;
+// event.dispatch([timeout ms]), runs the calls queued to the thread
+static int levent_dispatch(lua_State *L) {
+    TickType_t ticks = event_ticks(luaL_optinteger(L, 1, 0));
+    event_sink_t *sink = sink_get(L, 1);
+
+    lua_pushinteger(L, dispatch(L, sink, ticks));
+    return 1;
+}
+
+// event.loop(), runs the calls queued to the thread forever
+static int levent_loop(lua_State *L) {
+    event_sink_t *sink = sink_get(L, 1);
+
+    for(;;) {
+        dispatch(L, sink, portMAX_DELAY);
+    }
 
-    // Get user data
-    udata = (event_userdata *)luaL_checkudata(L, 1, "event.ins");
-    luaL_argcheck(L, udata, 1, "event expected");
+    return 0;
+}
+
+// e:addlistener(f [, once])
+static int levent_addlistener(lua_State *L) {
+    event_t *event = event_check(L);
+    event_listener_t *listener, **link;
+    event_sink_t *sink;
+    int once, id;
 
-    // Check for function reference
     luaL_checktype(L, 2, LUA_TFUNCTION);
+    once = lua_toboolean(L, 3);
+
+    sink = sink_get(L, 1);
+    sink_collect(L, sink);
 
-    // Allocate space for function reference
-    func = (int *)calloc(1,sizeof(int));
-    if (!func) {
-    	// TO DO: exception
-    	return 0;
+    listener = (event_listener_t *)calloc(1, sizeof(event_listener_t));
+    if (!listener) {
+        return luaL_error(L, "not enough memory");
     }
 
-    *func = luaL_ref(L, LUA_REGISTRYINDEX);
+    lua_pushvalue(L, 2);
+    listener->func = luaL_ref(L, LUA_REGISTRYINDEX);
+    listener->event = event;
+    listener->sink = sink;
+    listener->once = once;
+    listener->refs = 1;
 
-    // Add function reference into the listener list
-    mtx_lock(&udata->mtx);
+    __sync_add_and_fetch(&event->refs, 1);
 
-    ret = list_add(&udata->listener_list, func, &id);
-    if (ret) {
-    	// TO DO: exception
-    	mtx_unlock(&udata->mtx);
-    	return 0;
-    }
+    mtx_lock(&events_mtx);
 
-    mtx_unlock(&udata->mtx);
+    id = listener->id = ++event->ids;
 
-    lua_pushinteger(L, id);
+    // Listeners are called in the order they are added
+    for(link = &event->listeners;*link;link = &(*link)->next);
+    *link = listener;
+
+    event->nlisteners++;
 
+    mtx_unlock(&events_mtx);
+
+    lua_pushinteger(L, id);
     return 1;
 }
 
-static int levent_broadcast( lua_State* L ) {
-    event_userdata *udata = NULL;
-	int idx = 1;
-	int *func;
-	int status;
+// e:once(f)
+static int levent_once(lua_State *L) {
+    lua_settop(L, 2);
+    lua_pushboolean(L, 1);
+
+    return levent_addlistener(L);
+}
 
-    // Get user data
-	udata = (event_userdata *)luaL_checkudata(L, 1, "event.ins");
-    luaL_argcheck(L, udata, 1, "event expected");
+// e:removelistener(id)
+static int levent_removelistener(lua_State *L) {
+    event_t *event = event_check(L);
+    int id = luaL_checkinteger(L, 2);
+    event_listener_t **link;
+    event_sink_t *sink;
+    int found = 0;
 
-    // Call to all listeners
-    mtx_lock(&udata->mtx);
+    mtx_lock(&events_mtx);
 
-    while (idx >= 1) {
-    	// Get listener
-        if (list_get(&udata->listener_list, idx, (void **)&func)) {
-        	break;
+    for(link = &event->listeners;*link;link = &(*link)->next) {
+        if ((*link)->id == id) {
+            listener_unlink(link);
+            found = 1;
+            break;
         }
+    }
 
-        // There is a listener
+    mtx_unlock(&events_mtx);
 
-        // Call to listener function
-        lua_rawgeti(L, LUA_REGISTRYINDEX, *func);
-        if ((status = lua_pcall(L, 0, 0, 0)) != LUA_OK) {
-        	// Error in call
-        }
+    sink = sink_get(L, 0);
+    if (sink) {
+        sink_collect(L, sink);
+    }
+
+    lua_pushboolean(L, found);
+    return 1;
+}
+
+// e:broadcast(...), returns the number of listeners that the call is queued to
+static int levent_broadcast(lua_State *L) {
+    event_t *event = event_check(L);
+    event_args_t *args = NULL;
+    int queued;
+
+    // Don't pack the arguments if nobody listens
+    if (__sync_fetch_and_add(&event->nlisteners, 0)) {
+        args = event_args(L, 2);
+    }
+
+    mtx_lock(&events_mtx);
+
+    if (args) {
+        queued = broadcast(event, args);
+        args_release(args);
+    } else {
+        event->stats.broadcasts++;
+        queued = 0;
+    }
+
+    mtx_unlock(&events_mtx);
+
+    lua_pushinteger(L, queued);
+    return 1;
+}
+
+// Timers
+static int levent_timer(lua_State *L, int periodic) {
+    event_t *event = event_check(L);
+    lua_Integer ms = luaL_checkinteger(L, 2);
+    event_timer_t **ud, *timer;
+    event_args_t *args;
+    TickType_t ticks;
+
+    luaL_argcheck(L, ms > 0, 2, "invalid time");
+
+    ticks = event_ticks(ms);
+    if (ticks == 0) ticks = 1;
+
+    ud = (event_timer_t **)lua_newuserdata(L, sizeof(event_timer_t *));
+    *ud = NULL;
+
+    luaL_getmetatable(L, EVENT_TIMER_MT);
+    lua_setmetatable(L, -2);
+
+    // The arguments are after the userdata
+    lua_insert(L, 3);
+    args = event_args(L, 4);
+    lua_settop(L, 3);
+
+    timer = (event_timer_t *)calloc(1, sizeof(event_timer_t));
+    if (!timer) {
+        args_release(args);
+        return luaL_error(L, "not enough memory");
+    }
+
+    timer->refs = 2;
+    timer->event = event;
+    timer->args = args;
+    timer->period = periodic?ticks:0;
+
+    __sync_add_and_fetch(&event->refs, 1);
+
+    *ud = timer;
 
-        // Next listener
-        idx = list_next(&udata->listener_list, idx);
+    mtx_lock(&events_mtx);
+
+    timer->due = xTaskGetTickCount() + ticks;
+    timer->next = timers;
+    timers = timer;
+
+    mtx_unlock(&events_mtx);
+
+    events_wakeup();
+
+    return 1;
+}
+
+// e:after(ms, ...), broadcasts the event once, after ms
+static int levent_after(lua_State *L) {
+    return levent_timer(L, 0);
+}
+
+// e:every(ms, ...), broadcasts the event each ms, until the timer is stopped
+static int levent_every(lua_State *L) {
+    return levent_timer(L, 1);
+}
+
+static int levent_stats(lua_State *L) {
+    event_t *event = event_check(L);
+    event_stats_t stats;
+    int nlisteners;
+
+    mtx_lock(&events_mtx);
+    stats = event->stats;
+    nlisteners = event->nlisteners;
+    mtx_unlock(&events_mtx);
+
+    stats.dropped += __sync_fetch_and_add(&event->isr_dropped, 0);
+
+    lua_createtable(L, 0, 6);
+
+    lua_pushinteger(L, stats.broadcasts); lua_setfield(L, -2, "broadcasts");
+    lua_pushinteger(L, stats.queued); lua_setfield(L, -2, "queued");
+    lua_pushinteger(L, stats.dispatched); lua_setfield(L, -2, "dispatched");
+    lua_pushinteger(L, stats.dropped); lua_setfield(L, -2, "dropped");
+    lua_pushinteger(L, stats.errors); lua_setfield(L, -2, "errors");
+    lua_pushinteger(L, nlisteners); lua_setfield(L, -2, "listeners");
+
+    return 1;
+}
+
+static int levent_ins_gc(lua_State *L) {
+    event_t **ud = (event_t **)luaL_checkudata(L, 1, EVENT_MT);
+
+    if (*ud) {
+        event_unref(*ud);
+        *ud = NULL;
     }
 
-    mtx_unlock(&udata->mtx);
+    return 0;
+}
+
+// timer:stop()
+static int levent_timer_stop(lua_State *L) {
+    event_timer_t **ud = (event_timer_t **)luaL_checkudata(L, 1, EVENT_TIMER_MT);
+
+    if (*ud) {
+        mtx_lock(&events_mtx);
+        (*ud)->stopped = 1;
+        mtx_unlock(&events_mtx);
+
+        events_wakeup();
+    }
 
     return 0;
 }
 
-// Destructor
-static int levent_ins_gc (lua_State *L) {
-    event_userdata *udata = NULL;
+// The timer keeps running if it's not stopped
+static int levent_timer_gc(lua_State *L) {
+    event_timer_t **ud = (event_timer_t **)luaL_checkudata(L, 1, EVENT_TIMER_MT);
+    event_timer_t *timer = *ud;
 
-    udata = (event_userdata *)luaL_checkudata(L, 1, "event.ins");
-	if (udata) {
-	}
+    if (timer) {
+        *ud = NULL;
 
-	return 0;
+        mtx_lock(&events_mtx);
+        if (--timer->refs == 0) {
+            args_release(timer->args);
+            event_release(timer->event);
+            free(timer);
+        }
+        mtx_unlock(&events_mtx);
+    }
+
+    return 0;
 }
 
 static const LUA_REG_TYPE levent_map[] = {
-    { LSTRKEY( "create"  ),			LFUNCVAL( levent_create ) },
-	{ LSTRKEY( "error"   ), 		LROVAL( event_error_map )},
+    { LSTRKEY( "create"   ),		LFUNCVAL( levent_create   ) },
+    { LSTRKEY( "dispatch" ),		LFUNCVAL( levent_dispatch ) },
+    { LSTRKEY( "loop"     ),		LFUNCVAL( levent_loop     ) },
+    { LSTRKEY( "error"    ),		LROVAL  ( event_error_map ) },
     { LNILKEY, LNILVAL }
 };
 
 static const LUA_REG_TYPE levent_ins_map[] = {
-	{ LSTRKEY( "addlistener" ),		LFUNCVAL( levent_addlistener    ) },
-  	{ LSTRKEY( "broadcast"   ),		LFUNCVAL( levent_broadcast 	    ) },
-	{ LSTRKEY( "__metatable" ),    	LROVAL  ( levent_ins_map ) },
-	{ LSTRKEY( "__index"     ),   	LROVAL  ( levent_ins_map ) },
-	{ LSTRKEY( "__gc"        ),   	LROVAL  ( levent_ins_gc ) },
+	{ LSTRKEY( "addlistener"    ),	LFUNCVAL( levent_addlistener    ) },
+	{ LSTRKEY( "once"           ),	LFUNCVAL( levent_once           ) },
+	{ LSTRKEY( "removelistener" ),	LFUNCVAL( levent_removelistener ) },
+  	{ LSTRKEY( "broadcast"      ),	LFUNCVAL( levent_broadcast      ) },
+	{ LSTRKEY( "after"          ),	LFUNCVAL( levent_after          ) },
+	{ LSTRKEY( "every"          ),	LFUNCVAL( levent_every          ) },
+	{ LSTRKEY( "stats"          ),	LFUNCVAL( levent_stats          ) },
+	{ LSTRKEY( "__metatable"    ),	LROVAL  ( levent_ins_map ) },
+	{ LSTRKEY( "__index"        ),	LROVAL  ( levent_ins_map ) },
+	{ LSTRKEY( "__gc"           ),	LFUNCVAL( levent_ins_gc ) },
+    { LNILKEY, LNILVAL }
+};
+
+static const LUA_REG_TYPE levent_timer_map[] = {
+	{ LSTRKEY( "stop"        ),		LFUNCVAL( levent_timer_stop ) },
+	{ LSTRKEY( "__metatable" ),		LROVAL  ( levent_timer_map  ) },
+	{ LSTRKEY( "__index"     ),		LROVAL  ( levent_timer_map  ) },
+	{ LSTRKEY( "__gc"        ),		LFUNCVAL( levent_timer_gc   ) },
+    { LNILKEY, LNILVAL }
+};
+
+static const LUA_REG_TYPE levent_sink_map[] = {
+	{ LSTRKEY( "__gc"        ),		LFUNCVAL( sink_gc ) },
     { LNILKEY, LNILVAL }
 };
 
 LUALIB_API int luaopen_event( lua_State *L ) {
-    luaL_newmetarotable(L,"event.ins", (void*)levent_ins_map);
+    // luaopen_event is called again for each isolated thread state
+    luaL_newmetarotable(L, EVENT_MT, (void *)levent_ins_map);
+    luaL_newmetarotable(L, EVENT_TIMER_MT, (void *)levent_timer_map);
+    luaL_newmetarotable(L, EVENT_SINK_MT, (void *)levent_sink_map);
+    lua_pop(L, 3);
+
+    lpending_register(LPENDING_EVENT, event_pending);
+
     return 0;
 }
 
@@ -176,24 +1073,26 @@ MODULE_REGISTER_MAPPED(EVENT, event, levent_map, luaopen_event);
 
 #endif
 
-
 /*
 
-e = event.create()
+-- The control loop doesn't wait for the logger, that runs in other thread
+e = event.create("state")
 
-e:addlistener(function()
-  print("hi from 1")
-end)
+thread.spawn(function()
+  local e = event.create("state")
 
-e:addlistener(function()
-  print("hi from 2")
-end)
+  e:addlistener(function(state, value)
+    print("state " .. state .. " = " .. value)
+  end)
 
-thread.start(function()
-  while true do
-	  e:broadcast(false)
-	  print("hi from master")
-  end
+  event.loop()
 end)
 
+t = e:every(1000, "tick", 0)
+
+while true do
+  e:broadcast("temperature", read_temperature())
+  thread.sleepms(100)
+end
+
  */
@@ -27,18 +27,45 @@
  * this software.
  */
 
+/*
+ * Events are broadcast without waiting for their listeners. Each listener is
+ * called in the Lua thread that added it: a broadcast queues the call to that
+ * thread, that runs it as work pending for the thread (see lpending.h) the next
+ * time it runs Lua code, or when it waits with event.dispatch / event.loop. The arguments of
+ * the broadcast are copied once, as a channel message (see thread_isolate.h),
+ * and unpacked in each listener's thread.
+ *
+ * Events created with a name are shared by all the Lua states, so an isolated
+ * thread (thread.spawn) can listen to the events broadcast by other thread, and
+ * drivers can post events from C, also from an interrupt handler.
+ */
+
 #ifndef LEVENT_H
 #define	LEVENT_H
 
-#include <sys/mutex.h>
-#include <sys/list.h>
+#include "lua.h"
 
-#define EVENT_QUEUE_SIZE 4
+// Metatable names
+#define EVENT_MT       "event.ins"
+#define EVENT_TIMER_MT "event.timer"
 
-typedef struct {
-	struct mtx mtx;
-	struct list listener_list;
-} event_userdata;
+typedef struct event event_t;
 
-#endif	/* LEVENT_H */
+/*
+ * Returns the event with the given name, creating it if needed, or a new
+ * anonymous event if name is NULL, with a reference for the caller. Returns
+ * NULL if there is not enough memory.
+ */
+event_t *event_create(const char *name);
+void event_unref(event_t *event);
 
+/*
+ * Broadcasts the event, with an integer argument, without waiting. Returns the
+ * number of listeners that the call is queued to. event_post_isr can be called
+ * from an interrupt handler: the broadcast is deferred to the event task, and it
+ * returns 1 if it's queued, or 0 if the queue of the event task is full.
+ */
+int event_post(event_t *event, int value);
+int event_post_isr(event_t *event, int value);
+
+#endif	/* LEVENT_H */
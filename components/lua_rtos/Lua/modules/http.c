@@ -32,9 +32,17 @@
 #include "lua.h"
 #include "lauxlib.h"
 
+#include <errno.h>
+#include <string.h>
+
+extern int http_start();
+extern void http_stop();
+
 static int lhttp_start(lua_State* L) {
-    http_start();
-    
+    if (http_start() < 0) {
+        return luaL_error(L, "can't start the http server on port %d (%s)", CONFIG_LUA_RTOS_HTTP_SERVER_PORT, strerror(errno));
+    }
+
     return 0;
 }
 
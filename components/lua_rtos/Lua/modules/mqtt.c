@@ -39,8 +39,10 @@
 
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "freertos/queue.h"
 
 #include <errno.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include <mqtt/MQTTClient.h>
@@ -48,6 +50,10 @@
 
 #include <sys/mutex.h>
 #include <sys/delay.h>
+#include <sys/syslog.h>
+
+#include "mqtt_trie.h"
+#include "lpending.h"
 
 void MQTTClient_init();
 
@@ -68,14 +74,58 @@ DRIVER_REGISTER_ERROR(MQTT, mqtt, CannotSubscribeToTopic, "can't subscribe to to
 DRIVER_REGISTER_ERROR(MQTT, mqtt, CannotPublishToTopic, "can't publish to topic", LUA_MQTT_ERR_CANT_PUBLISH);
 DRIVER_REGISTER_ERROR(MQTT, mqtt, CannotDisconnect, "can't disconnect", LUA_MQTT_ERR_CANT_DISCONNECT);
 
+// Default number of messages queued for each subscribing thread
+#define MQTT_QUEUE_SIZE   16
+
+// Maximum number of subscriptions that a message can match
+#define MQTT_MAX_MATCHES  16
+
+// What to do with a message when the queue of the subscribing thread is full
+#define MQTT_DROP_NEW     0   // drop the message
+#define MQTT_DROP_OLD     1   // drop the oldest queued message
+#define MQTT_BLOCK        2   // wait until the thread dispatches a message
+
 static int client_inited = 0;
 
 typedef struct {
-    char *topic;
-    int callback;
-    void *next;
+    uint32_t received;      // messages received
+    uint32_t unmatched;     // messages that match no subscription
+    uint32_t queued;        // callbacks queued
+    uint32_t dispatched;    // callbacks called
+    uint32_t dropped;       // callbacks dropped, because the queue was full or the
+                            // message matched more than MQTT_MAX_MATCHES subscriptions
+    uint32_t errors;        // callbacks that raised an error
+    uint32_t max_depth;     // maximum number of callbacks in a queue
+} mqtt_stats;
+
+/*
+ * Messages are not passed to Lua in the MQTT client thread, as a lua_State can't be
+ * used by two threads. They are queued to the thread that subscribed the topic, and
+ * dispatched as work pending for its lua_State (see lpending.h), when the thread runs
+ * Lua code. A thread that waits for messages dispatches them with client:dispatch.
+ */
+typedef struct mqtt_sink {
+    lua_State *L;           // subscribing thread
+    int thread_ref;         // reference to the thread, so its state is not collected
+    QueueHandle_t queue;    // queued callbacks
+    mqtt_stats *stats;
+    int dispatching;        // 1 while a callback is running
+    int closed;             // 1 if the client was collected while dispatching
+    struct mqtt_sink *next; // next sink of the client
+    struct mqtt_sink *all;  // next sink of all the clients
+} mqtt_sink;
+
+typedef struct {
+    int callback;           // Lua function reference
+    mqtt_sink *sink;        // where the callback is dispatched
 } mqtt_subs_callback;
 
+typedef struct {
+    int callback;
+    int len;
+    char *payload;
+} mqtt_queued;
+
 typedef struct {
     lua_State *L;
     struct mtx callback_mtx;
@@ -83,13 +133,138 @@ typedef struct {
     MQTTClient_connectOptions conn_opts;
     MQTTClient client;
     
-    mqtt_subs_callback *callbacks;
+    mqtt_trie callbacks;    // subscriptions, by topic filter
+    mqtt_sink *sinks;       // subscribing threads
+
+    int queue_size;
+    int policy;
+    mqtt_stats stats;
 
     int secure;
 } mqtt_userdata;
 
-static int add_subs_callback(mqtt_userdata *mqtt, const char *topic, int call) {
+// All the sinks, searched by dispatch
+static mqtt_sink *sinks = NULL;
+static struct mtx sinks_mtx;
+static int sinks_mtx_init = 0;
+
+static void free_sink(mqtt_sink *sink) {
+    mqtt_queued msg;
+
+    while (xQueueReceive(sink->queue, &msg, 0) == pdTRUE) {
+        free(msg.payload);
+    }
+
+    vQueueDelete(sink->queue);
+    free(sink);
+}
+
+// Runs a callback taken from the sink, that is marked as dispatching
+static void run_callback(lua_State *L, mqtt_sink *sink, mqtt_queued *msg) {
+    int status;
+
+    lua_rawgeti(L, LUA_REGISTRYINDEX, msg->callback);
+    lua_pushinteger(L, msg->len);
+    lua_pushlstring(L, msg->payload, msg->len);
+    free(msg->payload);
+
+    status = lua_pcall(L, 2, 0, 0);
+    if (status != LUA_OK) {
+        syslog(LOG_ERR, "mqtt: callback error: %s", lua_tostring(L, -1));
+        lua_pop(L, 1);
+    }
+
+    // The client can be collected while the callback runs
+    mtx_lock(&sinks_mtx);
+    if (sink->closed) {
+        free_sink(sink);
+    } else {
+        sink->dispatching = 0;
+        sink->stats->dispatched++;
+        if (status != LUA_OK) sink->stats->errors++;
+    }
+    mtx_unlock(&sinks_mtx);
+}
+
+// Dispatches the callbacks queued for L, in L, and returns their number
+static int dispatch(lua_State *L) {
+    mqtt_sink *sink;
+    mqtt_queued msg;
+    int found, n = 0;
+
+    do {
+        found = 0;
+
+        mtx_lock(&sinks_mtx);
+        for(sink = sinks;sink;sink = sink->all) {
+            if ((sink->L == L) && !sink->dispatching && (xQueueReceive(sink->queue, &msg, 0) == pdTRUE)) {
+                found = 1;
+                break;
+            }
+        }
+
+        // A callback may be running in L, that dispatches again
+        if (found) sink->dispatching = 1;
+        mtx_unlock(&sinks_mtx);
+
+        if (!found) break;
+
+        run_callback(L, sink, &msg);
+        n++;
+    } while (1);
+
+    return n;
+}
+
+static int mqtt_pending(lua_State *L) {
+    dispatch(L);
+
+    return 0;
+}
+
+// Returns the sink of the mqtt client for L, creating it if needed
+static mqtt_sink *get_sink(lua_State *L, mqtt_userdata *mqtt) {
+    mqtt_sink *sink;
+
+    for(sink = mqtt->sinks;sink;sink = sink->next) {
+        if (sink->L == L) return sink;
+    }
+
+    sink = (mqtt_sink *)calloc(1, sizeof(mqtt_sink));
+    if (!sink) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    sink->queue = xQueueCreate(mqtt->queue_size, sizeof(mqtt_queued));
+    if (!sink->queue) {
+        free(sink);
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    sink->L = L;
+    sink->stats = &mqtt->stats;
+
+    lua_pushthread(L);
+    sink->thread_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+
+    mtx_lock(&mqtt->callback_mtx);
+    sink->next = mqtt->sinks;
+    mqtt->sinks = sink;
+    mtx_unlock(&mqtt->callback_mtx);
+
+    mtx_lock(&sinks_mtx);
+    sink->all = sinks;
+    sinks = sink;
+    mtx_unlock(&sinks_mtx);
+
+    return sink;
+}
+
+static int add_subs_callback(lua_State *L, mqtt_userdata *mqtt, const char *topic, int call) {
     mqtt_subs_callback *callback;
+    int res;
     
     // Create and populate callback structure
     callback = (mqtt_subs_callback *)malloc(sizeof(mqtt_subs_callback));
@@ -98,48 +273,106 @@ static int add_subs_callback(mqtt_userdata *mqtt, const char *topic, int call) {
         return -1;
     }
     
-    callback->topic = (char *)malloc(strlen(topic) + 1);
-    if (!callback->topic) {
-        errno = ENOMEM;
+    callback->callback = call;
+    callback->sink = get_sink(L, mqtt);
+    if (!callback->sink) {
         free(callback);
         return -1;
     }
     
-    strcpy(callback->topic, topic);
-    
-    callback->callback = call;
-    
     mtx_lock(&mqtt->callback_mtx);
-    callback->next = mqtt->callbacks;
-    mqtt->callbacks = callback;
+    res = mqtt_trie_add(&mqtt->callbacks, topic, callback);
     mtx_unlock(&mqtt->callback_mtx);
+
+    if (res < 0) {
+        free(callback);
+        return -1;
+    }
     
     return 0;
 }
 
+typedef struct {
+    mqtt_subs_callback *callbacks[MQTT_MAX_MATCHES];
+    int count;
+    int overflow;           // matches over MQTT_MAX_MATCHES, that are not called
+} mqtt_matches;
+
+static void match_callback(void *arg, void *sub) {
+    mqtt_matches *matches = (mqtt_matches *)arg;
+
+    if (matches->count < MQTT_MAX_MATCHES) {
+        matches->callbacks[matches->count++] = (mqtt_subs_callback *)sub;
+    } else {
+        matches->overflow++;
+    }
+}
+
+static void queue_callback(mqtt_userdata *mqtt, mqtt_subs_callback *callback, MQTTClient_message *m) {
+    mqtt_sink *sink = callback->sink;
+    mqtt_queued msg, old;
+    uint32_t depth;
+
+    msg.callback = callback->callback;
+    msg.len = m->payloadlen;
+    msg.payload = (char *)malloc(m->payloadlen + 1);
+    if (!msg.payload) {
+        mqtt->stats.dropped++;
+        return;
+    }
+    memcpy(msg.payload, m->payload, m->payloadlen);
+
+    if (mqtt->policy == MQTT_BLOCK) {
+        xQueueSend(sink->queue, &msg, portMAX_DELAY);
+    } else {
+        while (xQueueSend(sink->queue, &msg, 0) != pdTRUE) {
+            if ((mqtt->policy == MQTT_DROP_OLD) && (xQueueReceive(sink->queue, &old, 0) == pdTRUE)) {
+                free(old.payload);
+                mqtt->stats.dropped++;
+                continue;
+            }
+
+            free(msg.payload);
+            mqtt->stats.dropped++;
+            return;
+        }
+    }
+
+    mqtt->stats.queued++;
+
+    depth = uxQueueMessagesWaiting(sink->queue);
+    if (depth > mqtt->stats.max_depth) {
+        mqtt->stats.max_depth = depth;
+    }
+
+    // The callback is dispatched when the thread runs Lua code
+    lpending_set(sink->L, LPENDING_MQTT);
+}
+
 static int messageArrived(void *context, char * topicName, int topicLen, MQTTClient_message* m) {
     mqtt_userdata *mqtt = (mqtt_userdata *)context;
-    mqtt_subs_callback *callback;
-    int call = 0;
+    mqtt_matches matches;
+    int i;
     
+    mqtt->stats.received++;
+    matches.count = 0;
+    matches.overflow = 0;
+
+    // Callbacks are queued outside the lock, as MQTT_BLOCK can wait for a thread
+    // that is subscribing
     mtx_lock(&mqtt->callback_mtx);
+    mqtt_trie_match(&mqtt->callbacks, topicName, topicLen, match_callback, &matches);
+    mtx_unlock(&mqtt->callback_mtx);
 
-    callback = mqtt->callbacks;
-    while (callback) {
-        if (strcmp(callback->topic, topicName) == 0) {
-            call = callback->callback;
-            if (call != LUA_NOREF) {
-                lua_rawgeti(mqtt->L, LUA_REGISTRYINDEX, call);
-                lua_pushinteger(mqtt->L, m->payloadlen);
-                lua_pushlstring(mqtt->L, m->payload, m->payloadlen);
-                lua_call(mqtt->L, 2, 0);
-            }
-        }
-        
-        callback = callback->next;
+    if (matches.count == 0) {
+        mqtt->stats.unmatched++;
     }
 
-    mtx_unlock(&mqtt->callback_mtx);
+    mqtt->stats.dropped += matches.overflow;
+
+    for(i = 0;i < matches.count;i++) {
+        queue_callback(mqtt, matches.callbacks[i], m);
+    }
     
     MQTTClient_freeMessage(&m);
     MQTTClient_free(topicName);
@@ -147,7 +380,7 @@ static int messageArrived(void *context, char * topicName, int topicLen, MQTTCli
     return 1;
 }
 
-// Lua: result = setup( id, clock )
+// Lua: client = mqtt.client( id, host, port, secure [, queue size [, policy]] )
 static int lmqtt_client( lua_State* L ){
     int rc = 0;
     const char *host;
@@ -155,6 +388,7 @@ static int lmqtt_client( lua_State* L ){
     int port;
     int secure;
     size_t lenClientId, lenHost;
+    int queue_size, policy;
     mqtt_userdata *mqtt;
     char url[100];
         
@@ -164,11 +398,20 @@ static int lmqtt_client( lua_State* L ){
 
     luaL_checktype(L, 4, LUA_TBOOLEAN);
     secure = lua_toboolean( L, 4 );
+
+    queue_size = luaL_optinteger( L, 5, MQTT_QUEUE_SIZE );
+    policy = luaL_optinteger( L, 6, MQTT_DROP_OLD );
+    luaL_argcheck(L, queue_size > 0, 5, "invalid queue size");
+    luaL_argcheck(L, (policy >= MQTT_DROP_NEW) && (policy <= MQTT_BLOCK), 6, "invalid policy");
     
     // Allocate mqtt structure and initialize
     mqtt = (mqtt_userdata *)lua_newuserdata(L, sizeof(mqtt_userdata));
+    memset(mqtt, 0, sizeof(mqtt_userdata));
     mqtt->L = L;
-    mqtt->callbacks = NULL;
+    mqtt_trie_init(&mqtt->callbacks);
+    mqtt->sinks = NULL;
+    mqtt->queue_size = queue_size;
+    mqtt->policy = policy;
     mqtt->secure = secure;
     mtx_init(&mqtt->callback_mtx, NULL, NULL, 0);
     
@@ -259,7 +502,11 @@ static int lmqtt_subscribe( lua_State* L ) {
     // Copy function reference
     callback = luaL_ref(L, LUA_REGISTRYINDEX);
 
-    add_subs_callback(mqtt, topic, callback);        
+    // The callback is dispatched in this thread
+    if (add_subs_callback(L, mqtt, topic, callback) < 0) {
+        luaL_unref(L, LUA_REGISTRYINDEX, callback);
+    	return luaL_exception_extended(L, LUA_MQTT_ERR_CANT_SUBSCRIBE, strerror(errno));
+    }
     
     rc = MQTTClient_subscribe(mqtt->client, topic, qos);
     if (rc == 0) {
@@ -311,31 +558,141 @@ static int lmqtt_disconnect( lua_State* L ) {
     }
 }
 
+// Lua: n = client:dispatch([timeout ms])
+// Runs the callbacks queued to the thread, waiting timeout ms (0 by default, forever
+// if < 0) for a message of the client, and returns the number of callbacks run
+static int lmqtt_dispatch( lua_State* L ) {
+    mqtt_userdata *mqtt = NULL;
+    lua_Integer ms;
+    TickType_t ticks;
+    mqtt_sink *sink;
+    mqtt_queued msg;
+    int found = 0, n;
+
+    mqtt = (mqtt_userdata *)luaL_checkudata(L, 1, "mqtt.cli");
+    luaL_argcheck(L, mqtt, 1, "mqtt expected");
+
+    ms = luaL_optinteger( L, 2, 0 );
+    ticks = (ms < 0)?portMAX_DELAY:ms / portTICK_PERIOD_MS;
+
+    sink = get_sink(L, mqtt);
+    if (!sink) {
+        return luaL_error(L, "%s", strerror(errno));
+    }
+
+    // Called from a callback of the client
+    mtx_lock(&sinks_mtx);
+    found = !sink->dispatching;
+    if (found) sink->dispatching = 1;
+    mtx_unlock(&sinks_mtx);
+
+    if (!found) {
+        lua_pushinteger(L, 0);
+        return 1;
+    }
+
+    // The client is not collected while its argument is in the stack
+    if (xQueueReceive(sink->queue, &msg, ticks) == pdTRUE) {
+        run_callback(L, sink, &msg);
+        n = 1;
+    } else {
+        mtx_lock(&sinks_mtx);
+        sink->dispatching = 0;
+        mtx_unlock(&sinks_mtx);
+        n = 0;
+    }
+
+    lua_pushinteger(L, n + dispatch(L));
+    return 1;
+}
+
+// Lua: stats = client:stats()
+static int lmqtt_stats( lua_State* L ) {
+    mqtt_userdata *mqtt = NULL;
+    mqtt_sink *sink;
+    uint32_t depth = 0;
+
+    mqtt = (mqtt_userdata *)luaL_checkudata(L, 1, "mqtt.cli");
+    luaL_argcheck(L, mqtt, 1, "mqtt expected");
+
+    // Callbacks waiting to be dispatched
+    mtx_lock(&mqtt->callback_mtx);
+    for(sink = mqtt->sinks;sink;sink = sink->next) {
+        depth += uxQueueMessagesWaiting(sink->queue);
+    }
+    mtx_unlock(&mqtt->callback_mtx);
+
+    lua_createtable(L, 0, 9);
+
+    lua_pushinteger(L, mqtt->stats.received);
+    lua_setfield(L, -2, "received");
+    lua_pushinteger(L, mqtt->stats.unmatched);
+    lua_setfield(L, -2, "unmatched");
+    lua_pushinteger(L, mqtt->stats.queued);
+    lua_setfield(L, -2, "queued");
+    lua_pushinteger(L, mqtt->stats.dispatched);
+    lua_setfield(L, -2, "dispatched");
+    lua_pushinteger(L, mqtt->stats.dropped);
+    lua_setfield(L, -2, "dropped");
+    lua_pushinteger(L, mqtt->stats.errors);
+    lua_setfield(L, -2, "errors");
+    lua_pushinteger(L, depth);
+    lua_setfield(L, -2, "depth");
+    lua_pushinteger(L, mqtt->stats.max_depth);
+    lua_setfield(L, -2, "max_depth");
+    lua_pushinteger(L, mqtt->callbacks.subs);
+    lua_setfield(L, -2, "subscriptions");
+
+    return 1;
+}
+
+static void destroy_callback(void *arg, void *sub) {
+    mqtt_subs_callback *callback = (mqtt_subs_callback *)sub;
+
+    luaL_unref((lua_State *)arg, LUA_REGISTRYINDEX, callback->callback);
+    free(callback);
+}
+
 // Destructor
 static int lmqtt_client_gc (lua_State *L) {
     mqtt_userdata *mqtt = NULL;
-    mqtt_subs_callback *callback;
-    mqtt_subs_callback *nextcallback;
+    mqtt_sink *sink, *nextsink, **link;
     
     mqtt = (mqtt_userdata *)luaL_testudata(L, 1, "mqtt.cli");
     if (mqtt) {        
+        // Disconnect and destroy client, no more messages arrive
+        MQTTClient_disconnect(mqtt->client, 0);
+        MQTTClient_destroy(&mqtt->client);        
+
         // Destroy callbacks
         mtx_lock(&mqtt->callback_mtx);
+        mqtt_trie_destroy(&mqtt->callbacks, destroy_callback, L);
+        mtx_unlock(&mqtt->callback_mtx);
 
-        callback = mqtt->callbacks;
-        while (callback) {
-            luaL_unref(L, LUA_REGISTRYINDEX, callback->callback);
-            nextcallback = callback->next;
-        
-            free(callback);
-            callback = nextcallback;
-        }
+        // Destroy sinks, with their queued callbacks
+        for(sink = mqtt->sinks;sink;sink = nextsink) {
+            nextsink = sink->next;
 
-        mtx_unlock(&mqtt->callback_mtx);
+            luaL_unref(L, LUA_REGISTRYINDEX, sink->thread_ref);
 
-        // Disconnect and destroy client
-        MQTTClient_disconnect(mqtt->client, 0);
-        MQTTClient_destroy(&mqtt->client);        
+            mtx_lock(&sinks_mtx);
+            for(link = &sinks;*link;link = &(*link)->all) {
+                if (*link == sink) {
+                    *link = sink->all;
+                    break;
+                }
+            }
+
+            if (sink->dispatching) {
+                // Freed by dispatch when the callback ends
+                sink->closed = 1;
+            } else {
+                free_sink(sink);
+            }
+            mtx_unlock(&sinks_mtx);
+        }
+
+        mqtt->sinks = NULL;
         
         mtx_destroy(&mqtt->callback_mtx);
     }
@@ -350,6 +707,11 @@ static const LUA_REG_TYPE lmqtt_map[] = {
   { LSTRKEY("QOS1"), LINTVAL(1) },
   { LSTRKEY("QOS2"), LINTVAL(2) },
 
+  // Queue full policies
+  { LSTRKEY("DROP_NEW"), LINTVAL(MQTT_DROP_NEW) },
+  { LSTRKEY("DROP_OLD"), LINTVAL(MQTT_DROP_OLD) },
+  { LSTRKEY("BLOCK"),    LINTVAL(MQTT_BLOCK) },
+
   // Error definitions
   {LSTRKEY("error"),  LROVAL( mqtt_error_map )},
   { LNILKEY, LNILVAL }
@@ -360,13 +722,23 @@ static const LUA_REG_TYPE lmqtt_client_map[] = {
   { LSTRKEY( "disconnect"  ),	 LFUNCVAL( lmqtt_disconnect ) },
   { LSTRKEY( "subscribe"   ),	 LFUNCVAL( lmqtt_subscribe  ) },
   { LSTRKEY( "publish"     ),	 LFUNCVAL( lmqtt_publish    ) },
+  { LSTRKEY( "dispatch"    ),	 LFUNCVAL( lmqtt_dispatch   ) },
+  { LSTRKEY( "stats"       ),	 LFUNCVAL( lmqtt_stats      ) },
   { LSTRKEY( "__metatable" ),	 LROVAL  ( lmqtt_client_map ) },
   { LSTRKEY( "__index"     ),    LROVAL  ( lmqtt_client_map ) },
-  { LSTRKEY( "__gc"        ),    LROVAL  ( lmqtt_client_gc  ) },
+  { LSTRKEY( "__gc"        ),    LFUNCVAL( lmqtt_client_gc  ) },
   { LNILKEY, LNILVAL }
 };
 
 LUALIB_API int luaopen_mqtt( lua_State *L ) {
+    // luaopen_mqtt is called again for each isolated thread state
+    if (!sinks_mtx_init) {
+        mtx_init(&sinks_mtx, NULL, NULL, 0);
+        sinks_mtx_init = 1;
+    }
+
+    lpending_register(LPENDING_MQTT, mqtt_pending);
+
     luaL_newmetarotable(L,"mqtt.cli", (void *)lmqtt_client_map);
     return 0;
 }
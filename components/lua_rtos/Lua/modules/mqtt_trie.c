@@ -0,0 +1,223 @@
+/*
+ * Lua RTOS, MQTT topic trie
+ *
+ * Copyright (C) 2015 - 2017
+ * IBEROXARXA SERVICIOS INTEGRALES, S.L. & CSS IBÉRICA, S.L.
+ *
+ * Author: Jaume Olivé (jolive@iberoxarxa.com / jolive@whitecatboard.org)
+ *
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software
+ * and its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that the copyright notice and this
+ * permission notice and warranty disclaimer appear in supporting
+ * documentation, and that the name of the author not be used in
+ * advertising or publicity pertaining to distribution of the
+ * software without specific, written prior permission.
+ *
+ * The author disclaim all warranties with regard to this
+ * software, including all implied warranties of merchantability
+ * and fitness.  In no event shall the author be liable for any
+ * special, indirect or consequential damages or any damages
+ * whatsoever resulting from loss of use, data or profits, whether
+ * in an action of contract, negligence or other tortious action,
+ * arising out of or in connection with the use or performance of
+ * this software.
+ */
+
+#include "sdkconfig.h"
+
+#if CONFIG_LUA_RTOS_LUA_USE_MQTT
+
+#include "mqtt_trie.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+static mqtt_trie_node *node_new(const char *level, int len) {
+    mqtt_trie_node *node;
+
+    node = (mqtt_trie_node *)calloc(1, sizeof(mqtt_trie_node) + len + 1);
+    if (!node) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    memcpy(node->level, level, len);
+    node->level[len] = '\0';
+
+    return node;
+}
+
+static void node_free(mqtt_trie_node *node, mqtt_trie_match_f destroy, void *arg) {
+    mqtt_trie_node *child, *next;
+    int i;
+
+    if (!node) return;
+
+    for(child = node->child;child;child = next) {
+        next = child->next;
+        node_free(child, destroy, arg);
+    }
+
+    node_free(node->plus, destroy, arg);
+    node_free(node->hash, destroy, arg);
+
+    if (destroy) {
+        for(i = 0;i < node->nsubs;i++) {
+            destroy(arg, node->subs[i]);
+        }
+    }
+
+    free(node->subs);
+    free(node);
+}
+
+// Returns the child of node for the level of len bytes, creating it if create is 1
+static mqtt_trie_node *node_child(mqtt_trie_node *node, const char *level, int len, int create) {
+    mqtt_trie_node **link;
+
+    if ((len == 1) && (*level == '+')) {
+        link = &node->plus;
+    } else if ((len == 1) && (*level == '#')) {
+        link = &node->hash;
+    } else {
+        for(link = &node->child;*link;link = &(*link)->next) {
+            if ((strncmp((*link)->level, level, len) == 0) && ((*link)->level[len] == '\0')) {
+                return *link;
+            }
+        }
+    }
+
+    if (!*link && create) {
+        *link = node_new(level, len);
+    }
+
+    return *link;
+}
+
+// A filter is valid if wildcards are a whole level, and '#' is the last level
+static int filter_valid(const char *filter) {
+    const char *c;
+
+    if (!*filter) return 0;
+
+    for(c = filter;*c;c++) {
+        if ((*c == '+') || (*c == '#')) {
+            if ((c != filter) && (c[-1] != '/')) return 0;
+            if ((*c == '+') && c[1] && (c[1] != '/')) return 0;
+            if ((*c == '#') && c[1]) return 0;
+        }
+    }
+
+    return 1;
+}
+
+static int emit(mqtt_trie_node *node, mqtt_trie_match_f match, void *arg) {
+    int i;
+
+    for(i = 0;i < node->nsubs;i++) {
+        match(arg, node->subs[i]);
+    }
+
+    return node->nsubs;
+}
+
+/*
+ * Matches the topic levels from level to end against the children of node. level
+ * is NULL when all the topic levels are matched. first is 1 for the first level.
+ */
+static int match_level(mqtt_trie_node *node, const char *level, const char *end, int first, mqtt_trie_match_f match, void *arg) {
+    mqtt_trie_node *child;
+    const char *next;
+    int wildcards;
+    int count = 0;
+    int len;
+
+    // Topics that start with $ are not matched by wildcards in the first level
+    wildcards = !(first && level && (level < end) && (*level == '$'));
+
+    // '#' matches the parent level too
+    if (node->hash && wildcards) count += emit(node->hash, match, arg);
+
+    if (!level) return count + emit(node, match, arg);
+
+    next = memchr(level, '/', end - level);
+    len = (next?next:end) - level;
+    if (next) next++;
+
+    for(child = node->child;child;child = child->next) {
+        if ((strncmp(child->level, level, len) == 0) && (child->level[len] == '\0')) {
+            count += match_level(child, next, end, 0, match, arg);
+            break;
+        }
+    }
+
+    if (node->plus && wildcards) count += match_level(node->plus, next, end, 0, match, arg);
+
+    return count;
+}
+
+void mqtt_trie_init(mqtt_trie *trie) {
+    trie->root = NULL;
+    trie->subs = 0;
+}
+
+int mqtt_trie_add(mqtt_trie *trie, const char *filter, void *sub) {
+    mqtt_trie_node *node;
+    const char *level, *next;
+    void **subs;
+
+    if (!filter_valid(filter)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (!trie->root) {
+        trie->root = node_new("", 0);
+        if (!trie->root) return -1;
+    }
+
+    node = trie->root;
+    level = filter;
+    do {
+        next = strchr(level, '/');
+
+        node = node_child(node, level, next?next - level:strlen(level), 1);
+        if (!node) return -1;
+
+        level = next + 1;
+    } while (next);
+
+    subs = (void **)realloc(node->subs, (node->nsubs + 1) * sizeof(void *));
+    if (!subs) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    subs[node->nsubs++] = sub;
+    node->subs = subs;
+    trie->subs++;
+
+    return 0;
+}
+
+int mqtt_trie_match(mqtt_trie *trie, const char *topic, int len, mqtt_trie_match_f match, void *arg) {
+    if (!trie->root) return 0;
+
+    if (len == 0) len = strlen(topic);
+
+    return match_level(trie->root, topic, topic + len, 1, match, arg);
+}
+
+void mqtt_trie_destroy(mqtt_trie *trie, mqtt_trie_match_f destroy, void *arg) {
+    node_free(trie->root, destroy, arg);
+
+    trie->root = NULL;
+    trie->subs = 0;
+}
+
+#endif
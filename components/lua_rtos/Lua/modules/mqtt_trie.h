@@ -0,0 +1,83 @@
+/*
+ * Lua RTOS, MQTT topic trie
+ *
+ * Copyright (C) 2015 - 2017
+ * IBEROXARXA SERVICIOS INTEGRALES, S.L. & CSS IBÉRICA, S.L.
+ *
+ * Author: Jaume Olivé (jolive@iberoxarxa.com / jolive@whitecatboard.org)
+ *
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software
+ * and its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that the copyright notice and this
+ * permission notice and warranty disclaimer appear in supporting
+ * documentation, and that the name of the author not be used in
+ * advertising or publicity pertaining to distribution of the
+ * software without specific, written prior permission.
+ *
+ * The author disclaim all warranties with regard to this
+ * software, including all implied warranties of merchantability
+ * and fitness.  In no event shall the author be liable for any
+ * special, indirect or consequential damages or any damages
+ * whatsoever resulting from loss of use, data or profits, whether
+ * in an action of contract, negligence or other tortious action,
+ * arising out of or in connection with the use or performance of
+ * this software.
+ */
+
+/*
+ * Subscriptions are stored in a trie with a node for each topic level, so a
+ * topic is matched in as many steps as levels it has. The single level (+) and
+ * multi level (#) wildcards are children of their parent level node.
+ *
+ * As in the MQTT specification, "a/#" also matches "a", and topics that start
+ * with '$' are not matched by a wildcard in the first level.
+ *
+ * This part doesn't use Lua or the MQTT client, so it can be built on the host
+ * (see tools/host/bench/bench_mqtt.c).
+ */
+
+#ifndef MQTT_TRIE_H
+#define MQTT_TRIE_H
+
+#include <stdint.h>
+
+typedef struct mqtt_trie_node {
+    struct mqtt_trie_node *child;   // first child level
+    struct mqtt_trie_node *next;    // next sibling level
+    struct mqtt_trie_node *plus;    // '+' child level
+    struct mqtt_trie_node *hash;    // '#' child level
+    void **subs;                    // subscriptions that end in this level
+    uint16_t nsubs;
+    char level[];                   // level name
+} mqtt_trie_node;
+
+typedef struct {
+    mqtt_trie_node *root;
+    uint32_t subs;                  // number of subscriptions
+} mqtt_trie;
+
+// Called for each subscription that matches a topic
+typedef void (*mqtt_trie_match_f)(void *arg, void *sub);
+
+void mqtt_trie_init(mqtt_trie *trie);
+
+/*
+ * Adds the sub subscription to the filter topic filter.
+ * Returns 0 on success, -1 on error, with errno set to EINVAL if filter is not a
+ * valid topic filter, or to ENOMEM.
+ */
+int mqtt_trie_add(mqtt_trie *trie, const char *filter, void *sub);
+
+/*
+ * Calls match for each subscription that matches topic, that has len bytes,
+ * or is NUL terminated if len is 0. Returns the number of subscriptions matched.
+ */
+int mqtt_trie_match(mqtt_trie *trie, const char *topic, int len, mqtt_trie_match_f match, void *arg);
+
+// Removes all the subscriptions, calling destroy for each one if not NULL
+void mqtt_trie_destroy(mqtt_trie *trie, mqtt_trie_match_f destroy, void *arg);
+
+#endif
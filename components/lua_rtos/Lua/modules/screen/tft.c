@@ -14,6 +14,7 @@
 #include "freertos/task.h"
 #include "esp_system.h"
 #include "screen/tftspi.h"
+#include "screen/tftfb.h"
 #include "time.h"
 #include "tjpgd.h"
 #include <math.h>
@@ -1796,6 +1797,9 @@ static void TFT_setRotation(uint8_t m) {
 	  else send = 0;
   }
 
+  // Framebuffer coordinates are not valid any more
+  if (tft_fb) tft_fb_deinit();
+
   if (send) {
 	  tft_cmd(TFT_MADCTL);
 	  tft_data(&madctl, 1);
@@ -2706,6 +2710,70 @@ static int tft_resetclipwin( lua_State* L )
 	return 0;
 }
 
+// Enable/disable drawing to RAM framebuffer
+// tft.framebuffer(on [, x, y, w, h])
+//==========================================
+static int tft_framebuffer( lua_State* L )
+{
+	_check(L);
+
+	int on = lua_toboolean( L, 1 );
+	int x1 = 0;
+	int y1 = 0;
+	int x2 = _width-1;
+	int y2 = _height-1;
+
+	if (!on) {
+		// Display must show the last changes
+		TFT_flush();
+		tft_fb_deinit();
+		return 0;
+	}
+
+	if (lua_gettop(L) > 1) {
+		if (checkParam(5, L)) return 0;
+		x1 = luaL_checkinteger( L, 2 );
+		y1 = luaL_checkinteger( L, 3 );
+		x2 = x1 + luaL_checkinteger( L, 4 ) - 1;
+		y2 = y1 + luaL_checkinteger( L, 5 ) - 1;
+
+		if (x1 < 0) x1 = 0;
+		if (y1 < 0) y1 = 0;
+		if (x2 >= _width) x2 = _width-1;
+		if (y2 >= _height) y2 = _height-1;
+		if ((x1 > x2) || (y1 > y2)) {
+			return luaL_error( L, "wrong coordinates" );
+		}
+	}
+
+	TFT_flush();
+
+	// Framebuffer starts with background color, shown at first flush
+	if (tft_fb_init(x1, y1, x2, y2, _bg) < 0) {
+		return luaL_error( L, "not enough memory" );
+	}
+	tft_fb_dirty(x1, y1, x2, y2);
+
+	return 0;
+}
+
+// Send framebuffer changes to the display
+// Returns the number of windows sent
+//=====================================
+static int tft_flush( lua_State* L )
+{
+	_check(L);
+
+	int n = TFT_flush();
+	if (n < 0) {
+		return luaL_error( L, "Error sending framebuffer" );
+	}
+
+	lua_pushinteger(L, n);
+
+	return 1;
+}
+
 //=====================================
 static int tft_HSBtoRGB( lua_State* L )
 {
@@ -3438,6 +3506,8 @@ static const LUA_REG_TYPE tft_map[] = {
 	{ LSTRKEY( "setcal" ),			LFUNCVAL( tft_set_cal )},
 	{ LSTRKEY( "setspeed" ),		LFUNCVAL( tft_set_speed )},
 	{ LSTRKEY( "config" ),			LFUNCVAL( tft_config )},
+	{ LSTRKEY( "framebuffer" ),		LFUNCVAL( tft_framebuffer )},
+	{ LSTRKEY( "flush" ),			LFUNCVAL( tft_flush )},
 #if LUA_USE_ROTABLE
 	// Constant definitions
 	  { LSTRKEY( "PORTRAIT" ),       LNUMVAL( PORTRAIT ) },
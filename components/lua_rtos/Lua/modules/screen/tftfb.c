@@ -0,0 +1,280 @@
+/* Lua-RTOS-ESP32 TFT module
+ * RAM framebuffer
+ * Author: LoBo (loboris@gmail.com, loboris.github)
+ *
+ * Module supporting SPI TFT displays based on ILI9341 & ST7735 controllers
+*/
+
+#include "sdkconfig.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#if CONFIG_SPIRAM_SUPPORT
+#include "esp_heap_caps.h"
+#endif
+
+#include "tftfb.h"
+
+#if CONFIG_LUA_RTOS_LUA_USE_TFT
+
+tft_fb_t *tft_fb = NULL;
+
+#define fb_color(color) ((uint16_t)(((color) >> 8) | ((color) << 8)))
+
+//-------------------------------------------------------------
+static inline uint32_t rect_area(const tft_rect_t *r) {
+	return (uint32_t)(r->x2 - r->x1 + 1) * (uint32_t)(r->y2 - r->y1 + 1);
+}
+
+//------------------------------------------------------------------------------------------
+static inline void rect_union(tft_rect_t *u, const tft_rect_t *a, const tft_rect_t *b) {
+	u->x1 = (a->x1 < b->x1)?a->x1:b->x1;
+	u->y1 = (a->y1 < b->y1)?a->y1:b->y1;
+	u->x2 = (a->x2 > b->x2)?a->x2:b->x2;
+	u->y2 = (a->y2 > b->y2)?a->y2:b->y2;
+}
+
+// Clip the (x1,y1),(x2,y2) window to the framebuffer area, returns 0 if they don't intersect
+//-----------------------------------------------------------------------------
+static int clip(tft_rect_t *r, int x1, int y1, int x2, int y2) {
+	const tft_rect_t *a = &tft_fb->area;
+
+	if ((x1 > a->x2) || (x2 < a->x1) || (y1 > a->y2) || (y2 < a->y1)) return 0;
+
+	r->x1 = (x1 < a->x1)?a->x1:x1;
+	r->y1 = (y1 < a->y1)?a->y1:y1;
+	r->x2 = (x2 > a->x2)?a->x2:x2;
+	r->y2 = (y2 > a->y2)?a->y2:y2;
+
+	return 1;
+}
+
+//----------------------------------------------------
+static inline uint16_t *fb_ptr(int x, int y) {
+	return tft_fb->buf + (y - tft_fb->area.y1) * tft_fb->width + (x - tft_fb->area.x1);
+}
+
+//==============================================================
+int tft_fb_init(int x1, int y1, int x2, int y2, uint16_t color) {
+	uint32_t size;
+	tft_fb_t *fb;
+
+	tft_fb_deinit();
+
+	if ((x2 < x1) || (y2 < y1)) return -1;
+
+	fb = calloc(1, sizeof(tft_fb_t));
+	if (!fb) return -1;
+
+	size = (x2 - x1 + 1) * (y2 - y1 + 1) * sizeof(uint16_t);
+
+	// A full screen framebuffer doesn't fit well in internal RAM, use PSRAM if present
+	#if CONFIG_SPIRAM_SUPPORT
+	fb->buf = heap_caps_malloc(size, MALLOC_CAP_SPIRAM);
+	if (!fb->buf)
+	#endif
+	fb->buf = malloc(size);
+
+	if (!fb->buf) {
+		free(fb);
+		return -1;
+	}
+
+	fb->area.x1 = x1;
+	fb->area.y1 = y1;
+	fb->area.x2 = x2;
+	fb->area.y2 = y2;
+	fb->width = x2 - x1 + 1;
+	fb->height = y2 - y1 + 1;
+
+	tft_fb = fb;
+
+	tft_fb_fill(x1, y1, x2, y2, color, 0);
+
+	return 0;
+}
+
+//=======================
+void tft_fb_deinit(void) {
+	if (!tft_fb) return;
+
+	free(tft_fb->buf);
+	free(tft_fb);
+	tft_fb = NULL;
+}
+
+//====================================================
+int tft_fb_contains(int x1, int y1, int x2, int y2) {
+	const tft_rect_t *a = &tft_fb->area;
+
+	if ((x1 > a->x2) || (x2 < a->x1) || (y1 > a->y2) || (y2 < a->y1)) return TFT_FB_NONE;
+	if ((x1 >= a->x1) && (x2 <= a->x2) && (y1 >= a->y1) && (y2 <= a->y2)) return TFT_FB_ALL;
+
+	return TFT_FB_PART;
+}
+
+// Merge dirty rectangle n with the others while it's worth it
+//------------------------------------
+static void merge_dirty(int n) {
+	tft_rect_t u;
+	int i;
+
+again:
+	for(i = 0;i < tft_fb->ndirty;i++) {
+		if (i == n) continue;
+
+		rect_union(&u, &tft_fb->dirty[i], &tft_fb->dirty[n]);
+		if (rect_area(&u) <= rect_area(&tft_fb->dirty[i]) + rect_area(&tft_fb->dirty[n]) + TFT_FB_MERGE_SLACK) {
+			tft_fb->dirty[i] = u;
+
+			// Remove n, i is the merged rectangle
+			tft_fb->ndirty--;
+			if (n != tft_fb->ndirty) {
+				tft_fb->dirty[n] = tft_fb->dirty[tft_fb->ndirty];
+				if (i == tft_fb->ndirty) i = n;
+			}
+			n = i;
+
+			goto again;
+		}
+	}
+}
+
+//=================================================
+void tft_fb_dirty(int x1, int y1, int x2, int y2) {
+	tft_rect_t r, u;
+	uint32_t grow, best_grow = 0xffffffff;
+	int i, best = 0;
+
+	if (!clip(&r, x1, y1, x2, y2)) return;
+
+	if (tft_fb->ndirty < TFT_FB_MAX_DIRTY) {
+		tft_fb->dirty[tft_fb->ndirty++] = r;
+		merge_dirty(tft_fb->ndirty - 1);
+		return;
+	}
+
+	// No room, merge with the rectangle that grows less
+	for(i = 0;i < tft_fb->ndirty;i++) {
+		rect_union(&u, &tft_fb->dirty[i], &r);
+		grow = rect_area(&u) - rect_area(&tft_fb->dirty[i]);
+		if (grow < best_grow) {
+			best_grow = grow;
+			best = i;
+		}
+	}
+
+	rect_union(&tft_fb->dirty[best], &tft_fb->dirty[best], &r);
+	merge_dirty(best);
+}
+
+//=============================================
+void tft_fb_pixel(int x, int y, uint16_t color) {
+	*fb_ptr(x, y) = fb_color(color);
+	tft_fb_dirty(x, y, x, y);
+}
+
+//====================================
+uint16_t tft_fb_read_pixel(int x, int y) {
+	uint16_t color = *fb_ptr(x, y);
+
+	return fb_color(color);
+}
+
+//=====================================================================================
+void tft_fb_fill(int x1, int y1, int x2, int y2, uint16_t color, int dirty) {
+	tft_rect_t r;
+	uint16_t *p;
+	int x, y, w;
+
+	if (!clip(&r, x1, y1, x2, y2)) return;
+
+	color = fb_color(color);
+	w = r.x2 - r.x1 + 1;
+
+	for(y = r.y1;y <= r.y2;y++) {
+		p = fb_ptr(r.x1, y);
+		for(x = 0;x < w;x++) {
+			*p++ = color;
+		}
+	}
+
+	if (dirty) tft_fb_dirty(r.x1, r.y1, r.x2, r.y2);
+}
+
+//============================================================================================
+void tft_fb_write(int x1, int y1, int x2, int y2, uint32_t len, const uint16_t *buf, int dirty) {
+	uint32_t w = x2 - x1 + 1;
+	uint32_t h = y2 - y1 + 1;
+	int rows, last_x2;
+	tft_rect_t r;
+	int y, n;
+
+	if (len > w * h) len = w * h;
+	if (len == 0) return;
+
+	// Rows of the window that have data, the last one can be partial
+	rows = (len + w - 1) / w;
+	last_x2 = x1 + (int)(len - (rows - 1) * w) - 1;
+
+	if (!clip(&r, x1, y1, x2, y1 + rows - 1)) return;
+
+	for(y = r.y1;y <= r.y2;y++) {
+		n = r.x2 - r.x1 + 1;
+		if (y == y1 + rows - 1) {
+			// Partial last row
+			if (last_x2 < r.x1) break;
+			if (last_x2 - r.x1 + 1 < n) n = last_x2 - r.x1 + 1;
+		}
+
+		memcpy(fb_ptr(r.x1, y), buf + (y - y1) * w + (r.x1 - x1), n * sizeof(uint16_t));
+	}
+
+	if (dirty) tft_fb_dirty(r.x1, r.y1, r.x2, r.y2);
+}
+
+//===================================================================================
+void tft_fb_read(int x1, int y1, int x2, int y2, uint32_t len, uint16_t *buf) {
+	uint32_t w = x2 - x1 + 1;
+	uint32_t n;
+	int y;
+
+	for(y = y1;(y <= y2) && (len > 0);y++) {
+		n = (len > w)?w:len;
+		memcpy(buf, fb_ptr(x1, y), n * sizeof(uint16_t));
+		buf += n;
+		len -= n;
+	}
+}
+
+//-------------------------------------------------------------------
+static int dirty_cmp(const void *a, const void *b) {
+	const tft_rect_t *ra = (const tft_rect_t *)a;
+	const tft_rect_t *rb = (const tft_rect_t *)b;
+
+	if (ra->y1 != rb->y1) return ra->y1 - rb->y1;
+	return ra->x1 - rb->x1;
+}
+
+//=========================================
+int tft_fb_flush(tft_fb_send_t send) {
+	tft_rect_t *r;
+	int i, n;
+
+	if (!tft_fb || !tft_fb->ndirty) return 0;
+
+	qsort(tft_fb->dirty, tft_fb->ndirty, sizeof(tft_rect_t), dirty_cmp);
+
+	for(i = 0;i < tft_fb->ndirty;i++) {
+		r = &tft_fb->dirty[i];
+		send(r->x1, r->y1, r->x2, r->y2, fb_ptr(r->x1, r->y1), tft_fb->width);
+	}
+
+	n = tft_fb->ndirty;
+	tft_fb->ndirty = 0;
+
+	return n;
+}
+
+#endif
@@ -0,0 +1,99 @@
+/* Lua-RTOS-ESP32 TFT module
+ * RAM framebuffer
+ * Author: LoBo (loboris@gmail.com, loboris.github)
+ *
+ * Drawing functions render into a RAM copy of the whole screen, or of a part
+ * of it, instead of sending each pixel or line to the display. Changed areas
+ * are tracked as dirty rectangles, and sent to the display by tft_fb_flush,
+ * merged into as few address windows as possible.
+ *
+ * Pixels are stored in display order (most significant byte first), so dirty
+ * rectangles are sent without conversion.
+ *
+ * This part doesn't access the display, so it can be built on the host (see
+ * tools/host/bench/bench_tft.c).
+*/
+
+#ifndef _TFTFB_H_
+#define _TFTFB_H_
+
+#include <stdint.h>
+
+// Maximum number of dirty rectangles, more are merged with the nearest one
+#define TFT_FB_MAX_DIRTY	8
+
+// Two rectangles are merged if the union has at most this number of pixels
+// more than both rectangles, about the cost of an address window setup
+#define TFT_FB_MERGE_SLACK	64
+
+typedef struct {
+	int16_t x1;
+	int16_t y1;
+	int16_t x2;
+	int16_t y2;
+} tft_rect_t;
+
+typedef struct {
+	uint16_t *buf;							// pixels, in display order
+	tft_rect_t area;						// screen area in the framebuffer
+	uint16_t width;							// area width
+	uint16_t height;						// area height
+	uint8_t ndirty;							// number of dirty rectangles
+	tft_rect_t dirty[TFT_FB_MAX_DIRTY];		// dirty rectangles
+} tft_fb_t;
+
+// Framebuffer, NULL if not enabled
+extern tft_fb_t *tft_fb;
+
+// Sends the w x h pixels of buf, with stride pixels per row, to the (x1,y1),(x2,y2) window
+typedef void (*tft_fb_send_t)(int x1, int y1, int x2, int y2, uint16_t *buf, int stride);
+
+// Intersection of the framebuffer area and a window
+#define TFT_FB_NONE		0
+#define TFT_FB_PART		1
+#define TFT_FB_ALL		2
+
+/*
+ * Enables the framebuffer for the (x1,y1),(x2,y2) screen area, filled with color.
+ * Returns 0 on success, -1 if there is not enough memory.
+ */
+int tft_fb_init(int x1, int y1, int x2, int y2, uint16_t color);
+
+// Disables the framebuffer, pending changes are lost
+void tft_fb_deinit(void);
+
+// Returns TFT_FB_NONE, TFT_FB_PART or TFT_FB_ALL for the (x1,y1),(x2,y2) window
+int tft_fb_contains(int x1, int y1, int x2, int y2);
+
+// Adds the (x1,y1),(x2,y2) window to the dirty rectangles
+void tft_fb_dirty(int x1, int y1, int x2, int y2);
+
+// Draws a pixel, that must be in the framebuffer area
+void tft_fb_pixel(int x, int y, uint16_t color);
+
+// Reads a pixel, that must be in the framebuffer area
+uint16_t tft_fb_read_pixel(int x, int y);
+
+/*
+ * Fills the part of the (x1,y1),(x2,y2) window that is in the framebuffer area with
+ * color. The changed area is added to the dirty rectangles if dirty is 1.
+ */
+void tft_fb_fill(int x1, int y1, int x2, int y2, uint16_t color, int dirty);
+
+/*
+ * Writes len pixels of buf, in display order, to the (x1,y1),(x2,y2) window, row by
+ * row, as the display does. Only pixels in the framebuffer area are written. The
+ * changed area is added to the dirty rectangles if dirty is 1.
+ */
+void tft_fb_write(int x1, int y1, int x2, int y2, uint32_t len, const uint16_t *buf, int dirty);
+
+// Reads len pixels of the (x1,y1),(x2,y2) window, that must be in the framebuffer area, to buf
+void tft_fb_read(int x1, int y1, int x2, int y2, uint32_t len, uint16_t *buf);
+
+/*
+ * Sends the dirty rectangles with send, from top to bottom, as the display is
+ * refreshed. Returns the number of windows sent.
+ */
+int tft_fb_flush(tft_fb_send_t send);
+
+#endif
@@ -8,6 +8,7 @@
 
 #include "freertos/FreeRTOS.h"
 #include "screen/tftspi.h"
+#include "screen/tftfb.h"
 #include "freertos/task.h"
 #include "stdio.h"
 #include <sys/driver.h>
@@ -83,6 +84,11 @@ void tft_data(const uint8_t *data, int len)
 //---------------------------------------------------------------
 void drawPixel(int16_t x, int16_t y, uint16_t color, uint8_t sel)
 {
+	if (tft_fb && (tft_fb_contains(x, y, x, y) == TFT_FB_ALL)) {
+		tft_fb_pixel(x, y, color);
+		return;
+	}
+
 	if (sel) {
 		if (spi_device_select(disp_spi, 0)) return;
 	}
@@ -101,6 +107,17 @@ void drawPixel(int16_t x, int16_t y, uint16_t color, uint8_t sel)
 void TFT_pushColorRep(int x1, int y1, int x2, int y2, uint16_t color, uint32_t len)
 {
 	uint16_t ccolor = color;
+
+	if (tft_fb) {
+		int in_fb = tft_fb_contains(x1, y1, x2, y2);
+		if (in_fb == TFT_FB_ALL) {
+			tft_fb_fill(x1, y1, x2, y2, color, 1);
+			return;
+		}
+		// Partially in the framebuffer, keep it up to date and send all to the display
+		if (in_fb == TFT_FB_PART) tft_fb_fill(x1, y1, x2, y2, color, 0);
+	}
+
 	if (spi_device_select(disp_spi, 0)) return;
 	//vTaskSuspendAll ();
 
@@ -108,6 +125,8 @@ void TFT_pushColorRep(int x1, int y1, int x2, int y2, uint16_t color, uint32_t l
 	disp_spi_transfer_addrwin(disp_spi, x1, x2, y1, y2);
 
 	// ** Send repeated pixel color **
+	// The display is deselected at return, so there is nothing to overlap with the
+	// end of the transfer (the DMA pipeline fills a buffer while the other one is sent)
 	disp_spi_transfer_color_rep(disp_spi, (uint8_t *)&ccolor, len, 1);
 
 	spi_device_deselect(disp_spi);
@@ -118,6 +137,16 @@ void TFT_pushColorRep(int x1, int y1, int x2, int y2, uint16_t color, uint32_t l
 //-------------------------------------------------------------------------
 void send_data(int x1, int y1, int x2, int y2, uint32_t len, uint16_t *buf)
 {
+	if (tft_fb) {
+		int in_fb = tft_fb_contains(x1, y1, x2, y2);
+		if (in_fb == TFT_FB_ALL) {
+			tft_fb_write(x1, y1, x2, y2, len, buf, 1);
+			return;
+		}
+		// Partially in the framebuffer, keep it up to date and send all to the display
+		if (in_fb == TFT_FB_PART) tft_fb_write(x1, y1, x2, y2, len, buf, 0);
+	}
+
 	if (spi_device_select(disp_spi, 0)) return;
 	//vTaskSuspendAll ();
 
@@ -137,6 +166,12 @@ uint16_t readPixel(int16_t x, int16_t y)
 {
 	uint8_t inbuf[4] = {0};
 
+	if (tft_fb) {
+		if (tft_fb_contains(x, y, x, y) == TFT_FB_ALL) return tft_fb_read_pixel(x, y);
+		// The display must have the framebuffer changes
+		TFT_flush();
+	}
+
 	if (spi_device_select(disp_spi, 0)) return 0;
 	//taskDISABLE_INTERRUPTS();
 
@@ -161,6 +196,15 @@ int read_data(int x1, int y1, int x2, int y2, int len, uint8_t *buf)
 {
 	memset(buf, 0, len*2);
 
+	if (tft_fb) {
+		if (tft_fb_contains(x1, y1, x2, y2) == TFT_FB_ALL) {
+			tft_fb_read(x1, y1, x2, y2, len, (uint16_t *)buf);
+			return 0;
+		}
+		// The display must have the framebuffer changes
+		TFT_flush();
+	}
+
 	uint8_t *rbuf = malloc((len*3)+1);
     if (!rbuf) return -1;
 
@@ -192,6 +236,36 @@ int read_data(int x1, int y1, int x2, int y2, int len, uint8_t *buf)
     return 0;
 }
 
+// Send framebuffer window to the display, called by tft_fb_flush
+//------------------------------------------------------------------------------------
+static void fb_send(int x1, int y1, int x2, int y2, uint16_t *buf, int stride)
+{
+	// ** Send address window **
+	disp_spi_transfer_addrwin(disp_spi, x1, x2, y1, y2);
+
+	// ** Send pixels, next window is prepared while they are on the wire **
+	disp_spi_transfer_rect_async(disp_spi, (uint8_t *)buf, x2-x1+1, y2-y1+1, stride);
+}
+
+// Send framebuffer changes to the display
+// Returns the number of windows sent, or -1 on error
+//------------------
+int TFT_flush(void)
+{
+	int n;
+
+	if (!tft_fb || !tft_fb->ndirty) return 0;
+
+	if (spi_device_select(disp_spi, 0)) return -1;
+
+	n = tft_fb_flush(fb_send);
+
+	// Waits for the last window
+	spi_device_deselect(disp_spi);
+
+	return n;
+}
+
 //-----------------------------------
 uint16_t touch_get_data(uint8_t type)
 {
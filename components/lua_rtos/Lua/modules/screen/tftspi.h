@@ -242,6 +242,7 @@ void drawPixel(int16_t x, int16_t y, uint16_t color, uint8_t sel);
 void TFT_pushColorRep(int x1, int y1, int x2, int y2, uint16_t data, uint32_t len);
 int read_data(int x1, int y1, int x2, int y2, int len, uint8_t *buf);
 uint16_t readPixel(int16_t x, int16_t y);
+int TFT_flush(void);
 //void fill_tftline(uint16_t color, uint16_t len);
 
 uint16_t touch_get_data(uint8_t type);
@@ -578,8 +578,9 @@ static int lsensor_ins_gc (lua_State *L) {
     sensor_userdata *udata = NULL;
 
     udata = (sensor_userdata *)luaL_checkudata(L, 1, "sensor.ins");
-	if (udata) {
-		free(udata->instance);
+	if (udata && udata->instance) {
+		sensor_unsetup(udata->instance);
+		udata->instance = NULL;
 	}
 
 	return 0;
@@ -602,7 +603,7 @@ static const LUA_REG_TYPE lsensor_ins_map[] = {
   	{ LSTRKEY( "get"         ),	LFUNCVAL( lsensor_get 	    ) },
     { LSTRKEY( "__metatable" ),	LROVAL  ( lsensor_ins_map   ) },
 	{ LSTRKEY( "__index"     ), LROVAL  ( lsensor_ins_map   ) },
-	{ LSTRKEY( "__gc"        ), LROVAL  ( lsensor_ins_gc    ) },
+	{ LSTRKEY( "__gc"        ), LFUNCVAL( lsensor_ins_gc    ) },
     { LNILKEY, LNILVAL }
 };
 
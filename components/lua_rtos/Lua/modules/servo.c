@@ -39,6 +39,8 @@
 #include "servo.h"
 #include "modules.h"
 
+#include <stdlib.h>
+
 #include <drivers/servo.h>
 
 // This variables are defined at linker time
@@ -87,8 +89,10 @@ static int lservo_ins_gc (lua_State *L) {
     servo_userdata *udata = NULL;
 
     udata = (servo_userdata *)luaL_checkudata(L, 1, "servo.ins");
-	if (udata) {
-		free(udata->instance);
+	if (udata && udata->instance) {
+		driver_error_t *error = servo_unsetup(udata->instance);
+		if (error) free(error);
+		udata->instance = NULL;
 	}
 
 	return 0;
@@ -104,7 +108,7 @@ static const LUA_REG_TYPE lservo_ins_map[] = {
     { LSTRKEY( "write"        ),	LFUNCVAL( lservo_write   ) },
 	{ LSTRKEY( "__metatable"  ),    LROVAL  ( lservo_ins_map ) },
 	{ LSTRKEY( "__index"      ),   	LROVAL  ( lservo_ins_map ) },
-	{ LSTRKEY( "__gc"         ),   	LROVAL  ( lservo_ins_gc ) },
+	{ LSTRKEY( "__gc"         ),   	LFUNCVAL( lservo_ins_gc ) },
     { LNILKEY, LNILVAL }
 };
 
@@ -893,16 +893,14 @@ static int lspi_gettransres(lua_State* L)
 static int lspi_ins_gc (lua_State *L) {
     espi_userdata *udata = NULL;
 
-    printf("lspi_ins_gc\r\n");
     udata = (espi_userdata *)luaL_checkudata(L, 1, "spi.ins");
-	if (udata) {
-		spi_device_deselect(udata->spi);
+	if (udata && udata->spi) {
+		// The userdata memory belongs to Lua, and a finalizer can't raise
+		// an error, so only the device is released here
+		if (udata->selected) spi_device_deselect(udata->spi);
 		driver_error_t *error = espi_deinit(udata->bus, &udata->spi);
-		if (error) {
-			if (error->exception == ESPI_ERR_CANT_DEINIT_DEVICE) return luaL_driver_error(L, error);
-			free(error);
-		}
-		free(udata);
+		if (error) free(error);
+		udata->spi = NULL;
 	}
 
 	return 0;
@@ -935,7 +933,7 @@ static const LUA_REG_TYPE lspi_ins_map[] = {
     { LSTRKEY( "queued"      ),	 LFUNCVAL( lspi_queued      ) },
     { LSTRKEY( "__metatable" ),	 LROVAL  ( lspi_ins_map     ) },
 	{ LSTRKEY( "__index"     ),  LROVAL  ( lspi_ins_map     ) },
-	{ LSTRKEY( "__gc"        ),  LROVAL  ( lspi_ins_gc      ) },
+	{ LSTRKEY( "__gc"        ),  LFUNCVAL( lspi_ins_gc      ) },
     { LNILKEY, LNILVAL }
 };
 
@@ -38,8 +38,14 @@
 #include "lmem.h"
 #include "ldo.h"
 #include "thread.h"
+#include "thread_isolate.h"
+#include "thread_pool.h"
 #include "error.h"
 
+#if CONFIG_LUA_RTOS_LUA_USE_PROFILER
+#include "lprof.h"
+#endif
+
 #include <unistd.h>
 #include <stdlib.h>
 #include <string.h>
@@ -49,6 +55,8 @@
 
 #include <pthread.h>
 
+#include <freertos/adds.h>
+
 #include <drivers/uart.h>
 #include <sys/console.h>
 
@@ -76,6 +84,7 @@ DRIVER_REGISTER_ERROR(THREAD, thread, CannotMonitorAsTable, "you can't monitor t
 
 // List of threads
 static struct list lthread_list;
+static int lthread_list_init = 0;
 
 void thread_terminated(void *args) {
     struct lthread *thread;
@@ -83,9 +92,17 @@ void thread_terminated(void *args) {
     int *thid = (void *)args;
     int res = list_get(&lthread_list, *thid, (void **)&thread);
     if (!res) {  
-        luaL_unref(thread->PL, LUA_REGISTRYINDEX, thread->function_ref);
-        luaL_unref(thread->PL, LUA_REGISTRYINDEX, thread->thread_ref);
-            
+#if CONFIG_LUA_RTOS_LUA_USE_PROFILER
+        lprof_detach(thread->L);
+#endif
+
+        if (thread->isolated) {
+            thread_isolate_close(thread->L);
+        } else {
+            luaL_unref(thread->PL, LUA_REGISTRYINDEX, thread->function_ref);
+            luaL_unref(thread->PL, LUA_REGISTRYINDEX, thread->thread_ref);
+        }
+
         list_remove(&lthread_list, *thid, 1);
     }
 
@@ -98,8 +115,23 @@ void *thread_start_task(void *arg) {
     struct lthread *thread;
     int *thid;
     thread = (struct lthread *)arg;
+
+    // Set Lua context into TCB. Only Lua threads have one, other pthreads (as the
+    // http server workers) don't, so they never run the Lua garbage collector.
+    uxSetLuaState(thread->L);
     
     luaL_checktype(thread->L, 1, LUA_TFUNCTION);
+
+    if (thread->isolated) {
+        thread_isolate_started(thread->L);
+    }
+
+#if CONFIG_LUA_RTOS_LUA_USE_PROFILER
+    char name[16];
+
+    snprintf(name, sizeof(name), "thread %d", thread->thid);
+    lprof_attach(thread->L, name);
+#endif
     
     thid = malloc(sizeof(int));
     *thid = thread->thid;
@@ -213,8 +245,16 @@ static int thread_stop_pthreads(lua_State *L, int thid) {
             _pthread_stop(thread->thread);            
             _pthread_free(thread->thread);
 
-            luaL_unref(L, LUA_REGISTRYINDEX, thread->function_ref);
-            luaL_unref(L, LUA_REGISTRYINDEX, thread->thread_ref);
+#if CONFIG_LUA_RTOS_LUA_USE_PROFILER
+            lprof_detach(thread->L);
+#endif
+
+            if (thread->isolated) {
+                thread_isolate_close(thread->L);
+            } else {
+                luaL_unref(L, LUA_REGISTRYINDEX, thread->function_ref);
+                luaL_unref(L, LUA_REGISTRYINDEX, thread->thread_ref);
+            }
 
             list_remove(&lthread_list, idx, 1);
         }
@@ -368,10 +408,11 @@ monitor_loop:
     return table;
 }
 
-static int new_thread(lua_State* L, int run) {
+static int new_thread(lua_State* L, int run, int isolated) {
     struct lthread *thread;
     pthread_attr_t attr;
 	struct sched_param sched;
+    lua_State *IL = NULL;
     int res, idx;
     pthread_t id;
     int retries;
@@ -400,28 +441,46 @@ static int new_thread(lua_State* L, int run) {
         lua_remove(L, -1);
     }
 
+    if (isolated) {
+        // Create a new Lua state, and move the function to it. This can raise an error,
+        // so it's done before the lthread info is allocated.
+        IL = thread_isolate_new(L, 1, CONFIG_LUA_RTOS_LUA_THREAD_HEAP_SIZE * 1024);
+    } else {
+        // Check for argument is a function
+        luaL_checktype(L, 1, LUA_TFUNCTION);
+    }
+
     // Allocate space for lthread info
     thread = (struct lthread *)malloc(sizeof(struct lthread));
     if (!thread) {
+        if (IL) thread_isolate_cancel(IL);
     	return luaL_exception(L, LUA_THREAD_ERR_NOT_ENOUGH_MEMORY);
     }
     
-    // Check for argument is a function, and store it's reference
-    luaL_checktype(L, 1, LUA_TFUNCTION);
-    thread->function_ref = luaL_ref(L, LUA_REGISTRYINDEX);
-    
-    // Create a new state, move function to it and store thread reference
     thread->PL = L;
-    thread->L = lua_newthread(L);
-    thread->thread_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+    thread->isolated = isolated;
     thread->status = LTHREAD_STATUS_SUSPENDED;
-    
-    lua_rawgeti(L, LUA_REGISTRYINDEX, thread->function_ref);                
-    lua_xmove(L, thread->L, 1);
+
+    if (isolated) {
+        thread->L = IL;
+        thread->function_ref = LUA_NOREF;
+        thread->thread_ref = LUA_NOREF;
+    } else {
+        // Store function reference
+        thread->function_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+
+        // Create a new state, move function to it and store thread reference
+        thread->L = lua_newthread(L);
+        thread->thread_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+
+        lua_rawgeti(L, LUA_REGISTRYINDEX, thread->function_ref);
+        lua_xmove(L, thread->L, 1);
+    }
 
     // Add lthread to list
     res = list_add(&lthread_list, thread, &idx);
     if (res) {
+        if (IL) thread_isolate_cancel(IL);
         free(thread);
     	return luaL_exception(L, LUA_THREAD_ERR_NOT_ENOUGH_MEMORY);
     }
@@ -463,7 +522,9 @@ retry:
         }
         
         list_remove(&lthread_list, idx, 1);
-        
+
+        if (IL) thread_isolate_cancel(IL);
+
         return luaL_exception_extended(L, LUA_THREAD_ERR_CANNOT_START, strerror(errno));
     }
 
@@ -480,14 +541,19 @@ retry:
 
 // Create a new thread and run it
 static int thread_start(lua_State* L) {
-    return new_thread(L, 1);
+    return new_thread(L, 1, 0);
 }    
 
 // Create a new thread in suspended mode
 static int thread_create(lua_State* L) {
-    return new_thread(L, 0);
+    return new_thread(L, 0, 0);
 }    
 
+// Create a new thread in its own Lua state and run it
+static int thread_spawn(lua_State* L) {
+    return new_thread(L, 1, 1);
+}
+
 static int thread_sleep(lua_State* L) {
     int seconds;
     
@@ -565,6 +631,11 @@ static const LUA_REG_TYPE thread[] = {
     { LSTRKEY( "status"  ),			LFUNCVAL( thread_status  ) },
     { LSTRKEY( "create"  ),			LFUNCVAL( thread_create  ) },
     { LSTRKEY( "start"   ),			LFUNCVAL( thread_start   ) },
+    { LSTRKEY( "spawn"   ),			LFUNCVAL( thread_spawn   ) },
+    { LSTRKEY( "channel" ),			LFUNCVAL( thread_isolate_channel ) },
+    { LSTRKEY( "buffer"  ),			LFUNCVAL( thread_isolate_buffer  ) },
+    { LSTRKEY( "submit"  ),			LFUNCVAL( thread_pool_submit     ) },
+    { LSTRKEY( "poolstats" ),		LFUNCVAL( thread_pool_stats      ) },
     { LSTRKEY( "suspend" ),			LFUNCVAL( thread_suspend ) },
     { LSTRKEY( "resume"  ),			LFUNCVAL( thread_resume  ) },
     { LSTRKEY( "stop"    ),			LFUNCVAL( thread_stop    ) },
@@ -581,8 +652,15 @@ static const LUA_REG_TYPE thread[] = {
 };
 
 int luaopen_thread(lua_State* L) {
-	list_init(&lthread_list, 1);
-	
+	// luaopen_thread is called again for each isolated state
+	if (!lthread_list_init) {
+		list_init(&lthread_list, 1);
+		lthread_list_init = 1;
+	}
+
+	thread_isolate_open(L);
+	thread_pool_open(L);
+
 #if !LUA_USE_ROTABLE
     luaL_newlib(L, thread);
     return 1;
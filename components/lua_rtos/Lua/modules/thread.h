@@ -41,6 +41,7 @@ struct lthread {
     int thread_ref;
     int status;
     int thid;
+    int isolated; // 1 if L is an isolated state (see thread_isolate.h)
     pthread_t thread;
 };
 
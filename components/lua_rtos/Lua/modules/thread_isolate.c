@@ -0,0 +1,1127 @@
+/*
+ * Lua RTOS, isolated Lua states for threads, and channels between them
+ *
+ * Copyright (C) 2015 - 2017
+ * IBEROXARXA SERVICIOS INTEGRALES, S.L. & CSS IBÉRICA, S.L.
+ *
+ * Author: Jaume Olivé (jolive@iberoxarxa.com / jolive@whitecatboard.org)
+ *
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software
+ * and its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that the copyright notice and this
+ * permission notice and warranty disclaimer appear in supporting
+ * documentation, and that the name of the author not be used in
+ * advertising or publicity pertaining to distribution of the
+ * software without specific, written prior permission.
+ *
+ * The author disclaim all warranties with regard to this
+ * software, including all implied warranties of merchantability
+ * and fitness.  In no event shall the author be liable for any
+ * special, indirect or consequential damages or any damages
+ * whatsoever resulting from loss of use, data or profits, whether
+ * in an action of contract, negligence or other tortious action,
+ * arising out of or in connection with the use or performance of
+ * this software.
+ */
+
+#include "luartos.h"
+
+#if CONFIG_LUA_RTOS_LUA_USE_THREAD
+
+#include "lua.h"
+#include "lauxlib.h"
+#include "lualib.h"
+#include "lrotable.h"
+#include "modules.h"
+#include "thread_isolate.h"
+
+#if CONFIG_LUA_RTOS_LUA_USE_POOL_ALLOC
+#include "lalloc.h"
+#endif
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Message value types
+#define MSG_NIL     0
+#define MSG_FALSE   1
+#define MSG_TRUE    2
+#define MSG_INTEGER 3
+#define MSG_NUMBER  4
+#define MSG_STRING  5
+#define MSG_TABLE   6
+#define MSG_END     7   // end of a table
+#define MSG_BUFFER  8
+#define MSG_CHANNEL 9
+#define MSG_ENV     10  // the globals of the state, for the _ENV upvalue
+
+// Maximum nesting of tables in a message
+#define MSG_MAX_DEPTH 32
+
+typedef struct {
+    int refs;               // userdata in all the states, and messages, that use the channel
+    int self;               // references of the messages queued in the channel itself
+    QueueHandle_t queue;    // of thread_msg_t *
+} thread_chan_t;
+
+typedef struct {
+    uint8_t *data;          // NULL if the buffer was moved
+    size_t len;
+} thread_buf_t;
+
+// A buffer or channel in a message
+typedef struct {
+    uint8_t type;
+    void *ptr;              // buffer data, or channel, NULL when the receiver takes it
+    size_t len;             // buffer len
+    thread_buf_t *buf;      // sender's buffer, only used by the sender
+    thread_buf_t *taken;    // receiver's buffer, when the receiver takes it
+} thread_obj_t;
+
+struct thread_msg {
+    thread_obj_t *objs;
+    uint16_t nobjs;
+    uint16_t sizeobjs;
+    size_t len;             // bytes in data
+    size_t size;            // bytes allocated for data
+    uint8_t data[];
+};
+
+struct thread_job {
+    thread_msg_t *code;     // dumped function, or source
+    thread_msg_t *upvalues;
+    int source;
+};
+
+// The message holder, a userdata that frees the message if the receiver fails
+typedef struct {
+    thread_msg_t *msg;
+} thread_msg_ud_t;
+
+typedef struct {
+    thread_msg_t *msg;
+    size_t pos;
+    int copy;               // 1 if the message is kept, and its objects are copied
+} msg_reader_t;
+
+typedef struct {
+    size_t used;
+    size_t peak;
+    size_t limit;
+    thread_job_t *job;      // job loaded by thread_isolate_new, until the thread is started
+} thread_heap_t;
+
+static void chan_unref(thread_chan_t *chan);
+
+/*
+ * Messages
+ */
+static int msg_put(thread_msg_t **msg, const void *p, size_t len) {
+    thread_msg_t *tmp;
+    size_t size;
+
+    if (!*msg || ((*msg)->len + len > (*msg)->size)) {
+        size = *msg?(*msg)->size * 2:64;
+        while (size < (*msg?(*msg)->len:0) + len) size *= 2;
+
+        tmp = (thread_msg_t *)realloc(*msg, sizeof(thread_msg_t) + size);
+        if (!tmp) return -1;
+
+        if (!*msg) {
+            memset(tmp, 0, sizeof(thread_msg_t));
+        }
+
+        tmp->size = size;
+        *msg = tmp;
+    }
+
+    if (len) {
+        memcpy((*msg)->data + (*msg)->len, p, len);
+        (*msg)->len += len;
+    }
+
+    return 0;
+}
+
+static int msg_put_type(thread_msg_t **msg, uint8_t type) {
+    return msg_put(msg, &type, 1);
+}
+
+static int msg_put_obj(thread_msg_t **msg, uint8_t type, void *ptr, size_t len, thread_buf_t *buf) {
+    thread_obj_t *objs;
+    uint16_t i;
+
+    if (msg_put_type(msg, type)) return -1;
+
+    i = (*msg)->nobjs;
+    if (i == (*msg)->sizeobjs) {
+        objs = (thread_obj_t *)realloc((*msg)->objs, sizeof(thread_obj_t) * (i + 4));
+        if (!objs) return -1;
+
+        (*msg)->objs = objs;
+        (*msg)->sizeobjs = i + 4;
+    }
+
+    (*msg)->objs[i].type = type;
+    (*msg)->objs[i].ptr = ptr;
+    (*msg)->objs[i].len = len;
+    (*msg)->objs[i].buf = buf;
+    (*msg)->objs[i].taken = NULL;
+    (*msg)->nobjs++;
+
+    return msg_put(msg, &i, sizeof(i));
+}
+
+// Frees a message, and the buffers and channel references that the receiver didn't take
+static void msg_free(thread_msg_t *msg) {
+    int i;
+
+    if (!msg) return;
+
+    for(i = 0;i < msg->nobjs;i++) {
+        if (!msg->objs[i].ptr) continue;
+
+        if (msg->objs[i].type == MSG_BUFFER) {
+            free(msg->objs[i].ptr);
+        } else {
+            chan_unref((thread_chan_t *)msg->objs[i].ptr);
+        }
+    }
+
+    free(msg->objs);
+    free(msg);
+}
+
+// Frees a message that was not delivered, the buffers and channels are still of the sender
+static void msg_discard(thread_msg_t *msg) {
+    if (!msg) return;
+
+    msg->nobjs = 0;
+    msg_free(msg);
+}
+
+/*
+ * Appends the value at index idx of L to msg. Returns NULL on success, or
+ * the error message.
+ */
+static const char *msg_encode(lua_State *L, int idx, thread_msg_t **msg, int depth) {
+    thread_chan_t **chan;
+    thread_buf_t *buf;
+    const char *err;
+    lua_Integer i;
+    lua_Number n;
+    const char *s;
+    size_t len, pos;
+    uint32_t counts[2];
+    int o;
+
+    switch (lua_type(L, idx)) {
+        case LUA_TNIL:
+            if (msg_put_type(msg, MSG_NIL)) return "not enough memory";
+            return NULL;
+
+        case LUA_TBOOLEAN:
+            if (msg_put_type(msg, lua_toboolean(L, idx)?MSG_TRUE:MSG_FALSE)) return "not enough memory";
+            return NULL;
+
+        case LUA_TNUMBER:
+            if (lua_isinteger(L, idx)) {
+                i = lua_tointeger(L, idx);
+                if (msg_put_type(msg, MSG_INTEGER) || msg_put(msg, &i, sizeof(i))) return "not enough memory";
+            } else {
+                n = lua_tonumber(L, idx);
+                if (msg_put_type(msg, MSG_NUMBER) || msg_put(msg, &n, sizeof(n))) return "not enough memory";
+            }
+            return NULL;
+
+        case LUA_TSTRING:
+            s = lua_tolstring(L, idx, &len);
+            if (msg_put_type(msg, MSG_STRING) || msg_put(msg, &len, sizeof(len)) || msg_put(msg, s, len)) {
+                return "not enough memory";
+            }
+            return NULL;
+
+        case LUA_TTABLE:
+            if (depth >= MSG_MAX_DEPTH) return "table nested too deep, or with cycles";
+            if (!lua_checkstack(L, 3)) return "stack overflow";
+
+            // Array and hash part sizes, set at the end
+            counts[0] = counts[1] = 0;
+            if (msg_put_type(msg, MSG_TABLE)) return "not enough memory";
+            pos = (*msg)->len;
+            if (msg_put(msg, counts, sizeof(counts))) return "not enough memory";
+
+            lua_pushnil(L);
+            while (lua_next(L, idx)) {
+                if (lua_isinteger(L, -2) && (lua_tointeger(L, -2) > 0) && (lua_tointeger(L, -2) <= lua_rawlen(L, idx))) {
+                    counts[0]++;
+                } else {
+                    counts[1]++;
+                }
+
+                if ((err = msg_encode(L, lua_absindex(L, -2), msg, depth + 1)) ||
+                    (err = msg_encode(L, lua_absindex(L, -1), msg, depth + 1))) {
+                    lua_pop(L, 2);
+                    return err;
+                }
+
+                lua_pop(L, 1);
+            }
+
+            memcpy((*msg)->data + pos, counts, sizeof(counts));
+            if (msg_put_type(msg, MSG_END)) return "not enough memory";
+            return NULL;
+
+        case LUA_TUSERDATA:
+            if ((buf = (thread_buf_t *)luaL_testudata(L, idx, THREAD_BUFFER_MT))) {
+                for(o = 0;*msg && (o < (*msg)->nobjs);o++) {
+                    if ((*msg)->objs[o].buf == buf) return "buffer can't be sent twice in a message";
+                }
+
+                if (msg_put_obj(msg, MSG_BUFFER, buf->data, buf->len, buf)) return "not enough memory";
+                return NULL;
+            }
+
+            if ((chan = (thread_chan_t **)luaL_testudata(L, idx, THREAD_CHANNEL_MT))) {
+                if (msg_put_obj(msg, MSG_CHANNEL, *chan, 0, NULL)) return "not enough memory";
+                return NULL;
+            }
+
+            return "userdata can't be sent";
+
+        case LUA_TFUNCTION:
+            return "functions can't be sent";
+
+        default:
+            return "value can't be sent";
+    }
+}
+
+// The message will be delivered, add the references to its channels
+static void msg_ref_channels(thread_msg_t *msg) {
+    int i;
+
+    for(i = 0;i < msg->nobjs;i++) {
+        if (msg->objs[i].type == MSG_CHANNEL) {
+            __sync_add_and_fetch(&((thread_chan_t *)msg->objs[i].ptr)->refs, 1);
+        }
+    }
+}
+
+static void msg_unref_channels(thread_msg_t *msg) {
+    int i;
+
+    for(i = 0;i < msg->nobjs;i++) {
+        if (msg->objs[i].type == MSG_CHANNEL) {
+            __sync_sub_and_fetch(&((thread_chan_t *)msg->objs[i].ptr)->refs, 1);
+        }
+    }
+}
+
+/*
+ * The buffers of the message are moved to it, and the sender's buffers are left empty.
+ * This is done before the message is queued, as the receiver can free the message as
+ * soon as it's queued.
+ */
+static void msg_take_buffers(thread_msg_t *msg) {
+    int i;
+
+    for(i = 0;i < msg->nobjs;i++) {
+        if (msg->objs[i].type == MSG_BUFFER) {
+            msg->objs[i].buf->data = NULL;
+            msg->objs[i].buf->len = 0;
+        }
+    }
+}
+
+/*
+ * The message was not delivered, give the buffers back to the sender, also the ones
+ * that the receiver took, if it didn't run.
+ */
+static void msg_return_buffers(thread_msg_t *msg) {
+    thread_obj_t *obj;
+    int i;
+
+    for(i = 0;i < msg->nobjs;i++) {
+        obj = &msg->objs[i];
+        if (obj->type != MSG_BUFFER) continue;
+
+        if (!obj->ptr && obj->taken) {
+            obj->ptr = obj->taken->data;
+            obj->taken->data = NULL;
+            obj->taken->len = 0;
+        }
+
+        obj->buf->data = (uint8_t *)obj->ptr;
+        obj->buf->len = obj->ptr?obj->len:0;
+        obj->ptr = NULL;
+    }
+}
+
+// References to chan of a message, that don't keep chan open while the message is queued in it
+static int msg_self_refs(thread_msg_t *msg, thread_chan_t *chan) {
+    int i, refs = 0;
+
+    for(i = 0;i < msg->nobjs;i++) {
+        if ((msg->objs[i].type == MSG_CHANNEL) && (msg->objs[i].ptr == chan)) refs++;
+    }
+
+    return refs;
+}
+
+static void msg_get(lua_State *L, msg_reader_t *r, void *p, size_t len) {
+    if (r->pos + len > r->msg->len) {
+        luaL_error(L, "corrupted message");
+    }
+
+    memcpy(p, r->msg->data + r->pos, len);
+    r->pos += len;
+}
+
+static void push_channel(lua_State *L, thread_chan_t *chan);
+static void push_buffer(lua_State *L, uint8_t *data, size_t len);
+
+// Pushes a copy of a buffer, or the channel with a new reference, leaving the message as is
+static void msg_copy_obj(lua_State *L, thread_obj_t *obj) {
+    thread_buf_t *buf;
+
+    if (obj->type == MSG_CHANNEL) {
+        __sync_add_and_fetch(&((thread_chan_t *)obj->ptr)->refs, 1);
+        push_channel(L, (thread_chan_t *)obj->ptr);
+        return;
+    }
+
+    push_buffer(L, NULL, 0);
+    buf = (thread_buf_t *)lua_touserdata(L, -1);
+
+    if (obj->len) {
+        buf->data = (uint8_t *)malloc(obj->len);
+        if (!buf->data) {
+            luaL_error(L, "not enough memory");
+        }
+
+        memcpy(buf->data, obj->ptr, obj->len);
+        buf->len = obj->len;
+    }
+}
+
+// Pushes the next value of a message
+static int msg_decode(lua_State *L, msg_reader_t *r) {
+    thread_obj_t *obj;
+    uint32_t counts[2];
+    lua_Integer i;
+    lua_Number n;
+    uint16_t o;
+    uint8_t type;
+    size_t len;
+
+    luaL_checkstack(L, 3, "message too nested");
+
+    msg_get(L, r, &type, 1);
+    switch (type) {
+        case MSG_NIL:   lua_pushnil(L); break;
+        case MSG_FALSE: lua_pushboolean(L, 0); break;
+        case MSG_TRUE:  lua_pushboolean(L, 1); break;
+        case MSG_ENV:   lua_pushglobaltable(L); break;
+
+        case MSG_INTEGER:
+            msg_get(L, r, &i, sizeof(i));
+            lua_pushinteger(L, i);
+            break;
+
+        case MSG_NUMBER:
+            msg_get(L, r, &n, sizeof(n));
+            lua_pushnumber(L, n);
+            break;
+
+        case MSG_STRING:
+            msg_get(L, r, &len, sizeof(len));
+            if (r->pos + len > r->msg->len) luaL_error(L, "corrupted message");
+
+            lua_pushlstring(L, (const char *)r->msg->data + r->pos, len);
+            r->pos += len;
+            break;
+
+        case MSG_TABLE:
+            msg_get(L, r, counts, sizeof(counts));
+            lua_createtable(L, counts[0], counts[1]);
+
+            while (msg_decode(L, r) != MSG_END) {
+                msg_decode(L, r);
+                lua_rawset(L, -3);
+            }
+            break;
+
+        case MSG_END:
+            break;
+
+        case MSG_BUFFER:
+        case MSG_CHANNEL:
+            msg_get(L, r, &o, sizeof(o));
+            if (o >= r->msg->nobjs) luaL_error(L, "corrupted message");
+
+            obj = &r->msg->objs[o];
+            if (r->copy) {
+                msg_copy_obj(L, obj);
+                break;
+            }
+
+            if (type == MSG_BUFFER) {
+                push_buffer(L, (uint8_t *)obj->ptr, obj->len);
+                obj->taken = (thread_buf_t *)lua_touserdata(L, -1);
+            } else {
+                push_channel(L, (thread_chan_t *)obj->ptr);
+            }
+
+            // Now the value is of the receiver
+            obj->ptr = NULL;
+            break;
+
+        default:
+            luaL_error(L, "corrupted message");
+    }
+
+    return type;
+}
+
+static int msg_gc(lua_State *L) {
+    thread_msg_ud_t *ud = (thread_msg_ud_t *)luaL_checkudata(L, 1, THREAD_MESSAGE_MT);
+
+    msg_free(ud->msg);
+    ud->msg = NULL;
+
+    return 0;
+}
+
+/*
+ * Channels
+ */
+static void chan_unref(thread_chan_t *chan) {
+    thread_msg_t *msg;
+    int i;
+
+    /*
+     * The messages queued in the channel can only be received from it, so their
+     * references to it don't keep it open, or a channel sent over itself is never
+     * freed.
+     */
+    if (__sync_sub_and_fetch(&chan->refs, 1) > chan->self) {
+        return;
+    }
+
+    // Nobody can send or receive, free the pending messages
+    while (xQueueReceive(chan->queue, &msg, 0) == pdTRUE) {
+        for(i = 0;i < msg->nobjs;i++) {
+            if ((msg->objs[i].type == MSG_CHANNEL) && (msg->objs[i].ptr == chan)) {
+                msg->objs[i].ptr = NULL;
+            }
+        }
+
+        msg_free(msg);
+    }
+
+    vQueueDelete(chan->queue);
+    free(chan);
+}
+
+// The reference to chan is taken by the new userdata
+static void push_channel(lua_State *L, thread_chan_t *chan) {
+    thread_chan_t **ud;
+
+    ud = (thread_chan_t **)lua_newuserdata(L, sizeof(thread_chan_t *));
+    *ud = chan;
+
+    luaL_getmetatable(L, THREAD_CHANNEL_MT);
+    lua_setmetatable(L, -2);
+}
+
+static TickType_t chan_ticks(lua_State *L, int idx) {
+    lua_Integer ms = luaL_optinteger(L, idx, -1);
+
+    if (ms < 0) return portMAX_DELAY;
+
+    return ms / portTICK_PERIOD_MS;
+}
+
+int thread_isolate_channel(lua_State *L) {
+    int capacity = luaL_optinteger(L, 1, CONFIG_LUA_RTOS_LUA_THREAD_CHANNEL_SIZE);
+    thread_chan_t **ud;
+
+    luaL_argcheck(L, capacity > 0, 1, "invalid capacity");
+
+    // The userdata is set before the channel is created, so the channel is freed if anything fails
+    ud = (thread_chan_t **)lua_newuserdata(L, sizeof(thread_chan_t *));
+    *ud = NULL;
+
+    luaL_getmetatable(L, THREAD_CHANNEL_MT);
+    lua_setmetatable(L, -2);
+
+    *ud = (thread_chan_t *)calloc(1, sizeof(thread_chan_t));
+    if (!*ud) {
+        return luaL_error(L, "not enough memory");
+    }
+
+    (*ud)->refs = 1;
+    (*ud)->queue = xQueueCreate(capacity, sizeof(thread_msg_t *));
+    if (!(*ud)->queue) {
+        free(*ud);
+        *ud = NULL;
+
+        return luaL_error(L, "not enough memory");
+    }
+
+    return 1;
+}
+
+static thread_chan_t *chan_check(lua_State *L) {
+    thread_chan_t **ud = (thread_chan_t **)luaL_checkudata(L, 1, THREAD_CHANNEL_MT);
+
+    return *ud;
+}
+
+// ch:send(value [, timeout ms]), returns false if the channel is full after timeout
+static int chan_send(lua_State *L) {
+    thread_chan_t *chan = chan_check(L);
+    TickType_t ticks = chan_ticks(L, 3);
+    thread_msg_t *msg = NULL;
+    const char *err;
+    int self;
+
+    luaL_argcheck(L, !lua_isnoneornil(L, 2), 2, "nil can't be sent");
+
+    err = msg_encode(L, 2, &msg, 0);
+    if (err) {
+        msg_discard(msg);
+        return luaL_error(L, "%s", err);
+    }
+
+    msg_ref_channels(msg);
+    msg_take_buffers(msg);
+
+    // Counted before the message is queued, as the receiver can free it as soon as it's queued
+    self = msg_self_refs(msg, chan);
+    __sync_add_and_fetch(&chan->self, self);
+
+    if (xQueueSend(chan->queue, &msg, ticks) != pdTRUE) {
+        __sync_sub_and_fetch(&chan->self, self);
+        msg_unref_channels(msg);
+        msg_return_buffers(msg);
+        msg_discard(msg);
+
+        lua_pushboolean(L, 0);
+        return 1;
+    }
+
+    lua_pushboolean(L, 1);
+    return 1;
+}
+
+// Pushes a message holder, the message is freed if the value can't be decoded
+static thread_msg_ud_t *msg_holder(lua_State *L) {
+    thread_msg_ud_t *ud;
+
+    ud = (thread_msg_ud_t *)lua_newuserdata(L, sizeof(thread_msg_ud_t));
+    ud->msg = NULL;
+
+    luaL_getmetatable(L, THREAD_MESSAGE_MT);
+    lua_setmetatable(L, -2);
+
+    return ud;
+}
+
+// Decodes the message of a holder, and frees it
+static void msg_unpack(lua_State *L, thread_msg_ud_t *ud) {
+    msg_reader_t r;
+
+    r.msg = ud->msg;
+    r.pos = 0;
+    r.copy = 0;
+    msg_decode(L, &r);
+
+    msg_free(ud->msg);
+    ud->msg = NULL;
+}
+
+const char *thread_isolate_put(lua_State *L, int idx, thread_msg_t **msg) {
+    const char *err;
+
+    *msg = NULL;
+
+    err = msg_encode(L, lua_absindex(L, idx), msg, 0);
+    if (err) {
+        msg_discard(*msg);
+        *msg = NULL;
+
+        return err;
+    }
+
+    msg_ref_channels(*msg);
+    msg_take_buffers(*msg);
+
+    return NULL;
+}
+
+void thread_isolate_get(lua_State *L, thread_msg_t **msg) {
+    thread_msg_ud_t *ud = msg_holder(L);
+
+    ud->msg = *msg;
+    *msg = NULL;
+
+    msg_unpack(L, ud);
+}
+
+void thread_isolate_push(lua_State *L, const thread_msg_t *msg) {
+    msg_reader_t r;
+
+    r.msg = (thread_msg_t *)msg;
+    r.pos = 0;
+    r.copy = 1;
+    msg_decode(L, &r);
+}
+
+void thread_isolate_free(thread_msg_t *msg) {
+    msg_free(msg);
+}
+
+// ch:receive([timeout ms]), returns nil if the channel is empty after timeout
+static int chan_receive(lua_State *L) {
+    thread_chan_t *chan = chan_check(L);
+    TickType_t ticks = chan_ticks(L, 2);
+    thread_msg_ud_t *ud = msg_holder(L);
+
+    if (xQueueReceive(chan->queue, &ud->msg, ticks) != pdTRUE) {
+        ud->msg = NULL;
+        return 0;
+    }
+
+    __sync_sub_and_fetch(&chan->self, msg_self_refs(ud->msg, chan));
+    msg_unpack(L, ud);
+
+    return 1;
+}
+
+static int chan_len(lua_State *L) {
+    thread_chan_t *chan = chan_check(L);
+
+    lua_pushinteger(L, uxQueueMessagesWaiting(chan->queue));
+    return 1;
+}
+
+static int chan_gc(lua_State *L) {
+    thread_chan_t **ud = (thread_chan_t **)luaL_checkudata(L, 1, THREAD_CHANNEL_MT);
+
+    if (*ud) {
+        chan_unref(*ud);
+        *ud = NULL;
+    }
+
+    return 0;
+}
+
+/*
+ * Buffers
+ */
+static void push_buffer(lua_State *L, uint8_t *data, size_t len) {
+    thread_buf_t *buf;
+
+    buf = (thread_buf_t *)lua_newuserdata(L, sizeof(thread_buf_t));
+    buf->data = data;
+    buf->len = len;
+
+    luaL_getmetatable(L, THREAD_BUFFER_MT);
+    lua_setmetatable(L, -2);
+}
+
+int thread_isolate_buffer(lua_State *L) {
+    const char *s = NULL;
+    thread_buf_t *buf;
+    size_t len;
+
+    if (lua_type(L, 1) == LUA_TSTRING) {
+        s = lua_tolstring(L, 1, &len);
+    } else {
+        lua_Integer size = luaL_checkinteger(L, 1);
+
+        luaL_argcheck(L, size >= 0, 1, "invalid size");
+        len = size;
+    }
+
+    push_buffer(L, NULL, 0);
+    buf = (thread_buf_t *)lua_touserdata(L, -1);
+
+    if (len) {
+        buf->data = (uint8_t *)(s?malloc(len):calloc(1, len));
+        if (!buf->data) {
+            return luaL_error(L, "not enough memory");
+        }
+
+        if (s) memcpy(buf->data, s, len);
+        buf->len = len;
+    }
+
+    return 1;
+}
+
+// Converts a relative string position as string.sub does
+static size_t buf_pos(lua_Integer pos, size_t len) {
+    if (pos >= 0) return (size_t)pos;
+    else if (0u - (size_t)pos > len) return 0;
+    else return len + (size_t)pos + 1;
+}
+
+// buf:get([i [, j]]), as string.sub
+static int buf_get(lua_State *L) {
+    thread_buf_t *buf = (thread_buf_t *)luaL_checkudata(L, 1, THREAD_BUFFER_MT);
+    size_t start = buf_pos(luaL_optinteger(L, 2, 1), buf->len);
+    size_t end = buf_pos(luaL_optinteger(L, 3, -1), buf->len);
+
+    if (start < 1) start = 1;
+    if (end > buf->len) end = buf->len;
+
+    if (start <= end) {
+        lua_pushlstring(L, (const char *)buf->data + start - 1, end - start + 1);
+    } else {
+        lua_pushliteral(L, "");
+    }
+
+    return 1;
+}
+
+// buf:set(i, string), writes string at position i
+static int buf_set(lua_State *L) {
+    thread_buf_t *buf = (thread_buf_t *)luaL_checkudata(L, 1, THREAD_BUFFER_MT);
+    lua_Integer pos = luaL_checkinteger(L, 2);
+    size_t len;
+    const char *s = luaL_checklstring(L, 3, &len);
+
+    luaL_argcheck(L, (pos >= 1) && ((size_t)pos - 1 + len <= buf->len), 2, "out of range");
+
+    memcpy(buf->data + pos - 1, s, len);
+
+    return 0;
+}
+
+static int buf_len(lua_State *L) {
+    thread_buf_t *buf = (thread_buf_t *)luaL_checkudata(L, 1, THREAD_BUFFER_MT);
+
+    lua_pushinteger(L, buf->len);
+    return 1;
+}
+
+static int buf_gc(lua_State *L) {
+    thread_buf_t *buf = (thread_buf_t *)luaL_checkudata(L, 1, THREAD_BUFFER_MT);
+
+    free(buf->data);
+    buf->data = NULL;
+    buf->len = 0;
+
+    return 0;
+}
+
+/*
+ * Isolated states
+ */
+static void *isolate_alloc(void *ud, void *ptr, size_t osize, size_t nsize) {
+    thread_heap_t *heap = (thread_heap_t *)ud;
+    void *p;
+
+    if (!ptr) osize = 0;
+
+    if (nsize == 0) {
+#if CONFIG_LUA_RTOS_LUA_USE_POOL_ALLOC
+        lalloc(NULL, ptr, osize, 0);
+#else
+        free(ptr);
+#endif
+        heap->used -= osize;
+        return NULL;
+    }
+
+    // When the limit is reached Lua does a full collection, and tries again
+    if (heap->limit && (heap->used - osize + nsize > heap->limit)) {
+        return NULL;
+    }
+
+#if CONFIG_LUA_RTOS_LUA_USE_POOL_ALLOC
+    p = lalloc(NULL, ptr, osize, nsize);
+#else
+    p = realloc(ptr, nsize);
+#endif
+    if (p) {
+        heap->used = heap->used - osize + nsize;
+        if (heap->used > heap->peak) heap->peak = heap->used;
+    }
+
+    return p;
+}
+
+static int isolate_panic(lua_State *L) {
+    lua_writestringerror("PANIC: unprotected error in call to Lua API (%s)\n", lua_tostring(L, -1));
+    return 0;
+}
+
+static int isolate_writer(lua_State *L, const void *p, size_t len, void *ud) {
+    return msg_put((thread_msg_t **)ud, p, len);
+}
+
+static int isolate_openlibs(lua_State *L) {
+    luaL_openlibs(L);
+    return 0;
+}
+
+// Loads the function of a job, and its upvalues
+static int isolate_load(lua_State *L) {
+    thread_job_t *job = (thread_job_t *)lua_touserdata(L, 1);
+    msg_reader_t r;
+    int i;
+
+    if (luaL_loadbufferx(L, (const char *)job->code->data, job->code->len, "=thread", job->source?"t":"b") != LUA_OK) {
+        return lua_error(L);
+    }
+
+    r.msg = job->upvalues;
+    r.pos = 0;
+    r.copy = 0;
+    for(i = 1;r.pos < job->upvalues->len;i++) {
+        msg_decode(L, &r);
+        lua_setupvalue(L, -2, i);
+    }
+
+    return 1;
+}
+
+static void isolate_limit(lua_State *IL, size_t limit) {
+    thread_heap_t *heap;
+
+    lua_getallocf(IL, (void **)&heap);
+    heap->limit = limit;
+}
+
+lua_State *thread_isolate_state(size_t limit) {
+    thread_heap_t *heap;
+    lua_State *IL;
+
+    heap = (thread_heap_t *)calloc(1, sizeof(thread_heap_t));
+    if (!heap) {
+        return NULL;
+    }
+
+    IL = lua_newstate(isolate_alloc, heap);
+    if (!IL) {
+        free(heap);
+        return NULL;
+    }
+
+    lua_atpanic(IL, isolate_panic);
+
+    // The heap limit applies when the libraries are open
+    lua_pushcfunction(IL, isolate_openlibs);
+    if (lua_pcall(IL, 0, 0, 0) != LUA_OK) {
+        thread_isolate_close(IL);
+        return NULL;
+    }
+
+    isolate_limit(IL, limit);
+
+    return IL;
+}
+
+thread_job_t *thread_isolate_pack(lua_State *L, int idx) {
+    thread_msg_t *code = NULL, *upvalues = NULL;
+    const char *name = NULL, *err = NULL, *s;
+    thread_job_t *job;
+    size_t len;
+    int i, source;
+
+    idx = lua_absindex(L, idx);
+    source = (lua_type(L, idx) == LUA_TSTRING);
+
+    if (!source && (lua_type(L, idx) != LUA_TFUNCTION || lua_iscfunction(L, idx))) {
+        luaL_argerror(L, idx, "Lua function or string expected");
+    }
+
+    // Upvalues, _ENV is set to the globals of the new state
+    if (msg_put(&upvalues, NULL, 0)) err = "not enough memory";
+
+    if (!source) {
+        for(i = 1;!err && (name = lua_getupvalue(L, idx, i));i++) {
+            if (strcmp(name, "_ENV") == 0) {
+                if (msg_put_type(&upvalues, MSG_ENV)) err = "not enough memory";
+            } else {
+                err = msg_encode(L, lua_gettop(L), &upvalues, 0);
+            }
+
+            lua_pop(L, 1);
+        }
+    }
+
+    // Code, dumped from the function
+    if (!err) {
+        if (source) {
+            s = lua_tolstring(L, idx, &len);
+            if (msg_put(&code, s, len)) err = "not enough memory";
+        } else {
+            lua_pushvalue(L, idx);
+            if (lua_dump(L, isolate_writer, &code, 0) || !code) err = "not enough memory";
+            lua_pop(L, 1);
+        }
+    }
+
+    job = err?NULL:(thread_job_t *)calloc(1, sizeof(thread_job_t));
+    if (!job) {
+        msg_discard(code);
+        msg_discard(upvalues);
+        if (name) {
+            luaL_error(L, "upvalue '%s': %s", name, err);
+        }
+
+        luaL_error(L, "%s", err?err:"not enough memory");
+    }
+
+    job->code = code;
+    job->upvalues = upvalues;
+    job->source = source;
+
+    // The upvalues are moved to the job
+    msg_ref_channels(upvalues);
+    msg_take_buffers(upvalues);
+
+    return job;
+}
+
+static int isolate_pload(lua_State *IL, thread_job_t *job) {
+    lua_pushcfunction(IL, isolate_load);
+    lua_pushlightuserdata(IL, job);
+
+    return lua_pcall(IL, 1, 1, 0);
+}
+
+int thread_isolate_load(lua_State *IL, thread_job_t *job) {
+    int status = isolate_pload(IL, job);
+
+    thread_isolate_free_job(job);
+
+    return status;
+}
+
+void thread_isolate_free_job(thread_job_t *job) {
+    if (!job) return;
+
+    msg_free(job->code);
+    msg_free(job->upvalues);
+    free(job);
+}
+
+void thread_isolate_return_job(thread_job_t *job) {
+    if (!job) return;
+
+    msg_return_buffers(job->upvalues);
+    thread_isolate_free_job(job);
+}
+
+lua_State *thread_isolate_new(lua_State *L, int idx, size_t limit) {
+    thread_job_t *job = thread_isolate_pack(L, idx);
+    thread_heap_t *heap;
+    lua_State *IL;
+
+    IL = thread_isolate_state(0);
+    if (!IL) {
+        thread_isolate_return_job(job);
+        luaL_error(L, "not enough memory");
+    }
+
+    // The job is kept, so the buffers can be given back if the thread can't be started
+    lua_getallocf(IL, (void **)&heap);
+    heap->job = job;
+
+    if (isolate_pload(IL, job) != LUA_OK) {
+        lua_pushstring(L, lua_tostring(IL, -1));
+        thread_isolate_cancel(IL);
+
+        lua_error(L);
+    }
+
+    isolate_limit(IL, limit);
+
+    return IL;
+}
+
+void thread_isolate_started(lua_State *IL) {
+    thread_heap_t *heap;
+
+    lua_getallocf(IL, (void **)&heap);
+    thread_isolate_free_job(heap->job);
+    heap->job = NULL;
+}
+
+void thread_isolate_cancel(lua_State *IL) {
+    thread_heap_t *heap;
+
+    lua_getallocf(IL, (void **)&heap);
+    if (heap->job) {
+        msg_return_buffers(heap->job->upvalues);
+    }
+
+    thread_isolate_close(IL);
+}
+
+void thread_isolate_close(lua_State *IL) {
+    thread_heap_t *heap;
+
+    lua_getallocf(IL, (void **)&heap);
+    lua_close(IL);
+
+    thread_isolate_free_job(heap->job);
+    free(heap);
+}
+
+void thread_isolate_heap(lua_State *IL, size_t *used, size_t *peak) {
+    thread_heap_t *heap;
+
+    lua_getallocf(IL, (void **)&heap);
+
+    *used = heap->used;
+    *peak = heap->peak;
+}
+
+static const LUA_REG_TYPE thread_chan_map[] = {
+    { LSTRKEY( "send"        ),	 LFUNCVAL( chan_send       ) },
+    { LSTRKEY( "receive"     ),	 LFUNCVAL( chan_receive    ) },
+    { LSTRKEY( "__metatable" ),	 LROVAL  ( thread_chan_map ) },
+    { LSTRKEY( "__index"     ),	 LROVAL  ( thread_chan_map ) },
+    { LSTRKEY( "__len"       ),	 LFUNCVAL( chan_len        ) },
+    { LSTRKEY( "__gc"        ),	 LFUNCVAL( chan_gc         ) },
+    { LNILKEY, LNILVAL }
+};
+
+static const LUA_REG_TYPE thread_buf_map[] = {
+    { LSTRKEY( "get"         ),	 LFUNCVAL( buf_get         ) },
+    { LSTRKEY( "set"         ),	 LFUNCVAL( buf_set         ) },
+    { LSTRKEY( "__metatable" ),	 LROVAL  ( thread_buf_map  ) },
+    { LSTRKEY( "__index"     ),	 LROVAL  ( thread_buf_map  ) },
+    { LSTRKEY( "__len"       ),	 LFUNCVAL( buf_len         ) },
+    { LSTRKEY( "__gc"        ),	 LFUNCVAL( buf_gc          ) },
+    { LNILKEY, LNILVAL }
+};
+
+static const LUA_REG_TYPE thread_msg_map[] = {
+    { LSTRKEY( "__gc"        ),	 LFUNCVAL( msg_gc          ) },
+    { LNILKEY, LNILVAL }
+};
+
+void thread_isolate_open(lua_State *L) {
+    luaL_newmetarotable(L, THREAD_CHANNEL_MT, (void *)thread_chan_map);
+    luaL_newmetarotable(L, THREAD_BUFFER_MT, (void *)thread_buf_map);
+    luaL_newmetarotable(L, THREAD_MESSAGE_MT, (void *)thread_msg_map);
+    lua_pop(L, 3);
+}
+
+#endif
@@ -0,0 +1,152 @@
+/*
+ * Lua RTOS, isolated Lua states for threads, and channels between them
+ *
+ * Copyright (C) 2015 - 2017
+ * IBEROXARXA SERVICIOS INTEGRALES, S.L. & CSS IBÉRICA, S.L.
+ *
+ * Author: Jaume Olivé (jolive@iberoxarxa.com / jolive@whitecatboard.org)
+ *
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software
+ * and its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that the copyright notice and this
+ * permission notice and warranty disclaimer appear in supporting
+ * documentation, and that the name of the author not be used in
+ * advertising or publicity pertaining to distribution of the
+ * software without specific, written prior permission.
+ *
+ * The author disclaim all warranties with regard to this
+ * software, including all implied warranties of merchantability
+ * and fitness.  In no event shall the author be liable for any
+ * special, indirect or consequential damages or any damages
+ * whatsoever resulting from loss of use, data or profits, whether
+ * in an action of contract, negligence or other tortious action,
+ * arising out of or in connection with the use or performance of
+ * this software.
+ */
+
+/*
+ * A thread started with thread.spawn runs in its own Lua state, with its own
+ * heap and garbage collector, so it can run in parallel with the other threads
+ * without sharing any Lua object. The function of the thread is copied to the
+ * new state with its upvalues, that must be values that can be sent to a
+ * channel, and the Lua RTOS modules are shared by all the states.
+ *
+ * Threads communicate with channels (thread.channel), a queue of messages that
+ * any state can send to and receive from:
+ *
+ * - nil can't be sent, booleans, numbers and strings are copied.
+ * - tables are serialized once, when they are sent, into a single block, that
+ *   is unpacked by the receiver. They can't have cycles.
+ * - buffers (thread.buffer) are binary blocks that are moved without copying:
+ *   the receiver gets the block, and the sender's buffer is left empty.
+ * - channels are shared by the sender and the receiver. A channel can be sent
+ *   over itself, but channels sent over each other are never freed.
+ *
+ * Strings are owned and interned by each Lua state, so they are copied once
+ * into the message, and again into the receiver's state. Data that is moved
+ * between threads as is should be put in buffers.
+ *
+ * This part doesn't use the Lua RTOS pthread extensions, so it can be built on
+ * the host (see tools/host/port/thread.c).
+ */
+
+#ifndef THREAD_ISOLATE_H
+#define THREAD_ISOLATE_H
+
+#include "lua.h"
+
+#include <stddef.h>
+
+// Metatable names
+#define THREAD_CHANNEL_MT "thread.chan"
+#define THREAD_BUFFER_MT  "thread.buf"
+#define THREAD_MESSAGE_MT "thread.msg"
+
+// A value moved out of a Lua state, as the messages of the channels
+typedef struct thread_msg thread_msg_t;
+
+// A function, with its upvalues, moved out of a Lua state
+typedef struct thread_job thread_job_t;
+
+/*
+ * Registers the metatables of channels and buffers in L. Called from
+ * luaopen_thread, so it's done in each state.
+ */
+void thread_isolate_open(lua_State *L);
+
+/*
+ * Creates a new Lua state, with a heap of limit bytes at most (0 for no limit),
+ * and moves to it the function (or Lua source string) at index idx of L, with
+ * its upvalues. The function is left on the top of the new state.
+ *
+ * Raises an error in L if the function can't be moved, and the buffers are given
+ * back to L.
+ */
+lua_State *thread_isolate_new(lua_State *L, int idx, size_t limit);
+
+/*
+ * The buffers moved by thread_isolate_new can be given back to L until the thread
+ * that runs the new state is started. thread_isolate_started is called by the
+ * thread, when it starts, and thread_isolate_cancel closes the state, and gives
+ * the buffers back, if the thread can't be created. The function must still be
+ * on the stack of L.
+ */
+void thread_isolate_started(lua_State *IL);
+void thread_isolate_cancel(lua_State *IL);
+
+/*
+ * Creates a new Lua state, with the libraries open, and a heap of limit bytes
+ * at most (0 for no limit). Returns NULL if there is not enough memory.
+ */
+lua_State *thread_isolate_state(size_t limit);
+
+/*
+ * Moves the function (or Lua source string) at index idx of L, with its upvalues,
+ * to a job, that can be loaded in other state. Raises an error in L if the function
+ * can't be moved.
+ */
+thread_job_t *thread_isolate_pack(lua_State *L, int idx);
+
+/*
+ * Loads a job in IL, and frees it. Returns LUA_OK and pushes the function, or
+ * returns the error code and pushes the error message.
+ */
+int thread_isolate_load(lua_State *IL, thread_job_t *job);
+void thread_isolate_free_job(thread_job_t *job);
+
+// Frees a job that was not loaded, and gives its buffers back to L, as thread_isolate_cancel
+void thread_isolate_return_job(thread_job_t *job);
+
+/*
+ * Moves the value at index idx of L to a message, as ch:send does. Returns NULL,
+ * or the error message if the value can't be sent.
+ */
+const char *thread_isolate_put(lua_State *L, int idx, thread_msg_t **msg);
+
+/*
+ * Pushes the value of a message, that is taken (*msg is set to NULL) and freed, as
+ * ch:receive does. If *msg is not NULL on an error, it's still of the caller.
+ */
+void thread_isolate_get(lua_State *L, thread_msg_t **msg);
+void thread_isolate_free(thread_msg_t *msg);
+
+/*
+ * Pushes the value of a message, that is kept, so it can be pushed again, to
+ * other states. Buffers are copied, and channels are shared.
+ */
+void thread_isolate_push(lua_State *L, const thread_msg_t *msg);
+
+// Closes a state created by thread_isolate_new or thread_isolate_state
+void thread_isolate_close(lua_State *IL);
+
+// Bytes in use, and the peak, of the heap of an isolated state
+void thread_isolate_heap(lua_State *IL, size_t *used, size_t *peak);
+
+// thread.channel([capacity]), thread.buffer(size | string)
+int thread_isolate_channel(lua_State *L);
+int thread_isolate_buffer(lua_State *L);
+
+#endif
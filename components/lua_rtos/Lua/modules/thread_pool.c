@@ -0,0 +1,496 @@
+/*
+ * Lua RTOS, pool of worker tasks for Lua functions
+ *
+ * Copyright (C) 2015 - 2017
+ * IBEROXARXA SERVICIOS INTEGRALES, S.L. & CSS IBÉRICA, S.L.
+ *
+ * Author: Jaume Olivé (jolive@iberoxarxa.com / jolive@whitecatboard.org)
+ *
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software
+ * and its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that the copyright notice and this
+ * permission notice and warranty disclaimer appear in supporting
+ * documentation, and that the name of the author not be used in
+ * advertising or publicity pertaining to distribution of the
+ * software without specific, written prior permission.
+ *
+ * The author disclaim all warranties with regard to this
+ * software, including all implied warranties of merchantability
+ * and fitness.  In no event shall the author be liable for any
+ * special, indirect or consequential damages or any damages
+ * whatsoever resulting from loss of use, data or profits, whether
+ * in an action of contract, negligence or other tortious action,
+ * arising out of or in connection with the use or performance of
+ * this software.
+ */
+
+#include "luartos.h"
+
+#if CONFIG_LUA_RTOS_LUA_USE_THREAD
+
+#include "lua.h"
+#include "lauxlib.h"
+#include "lrotable.h"
+#include "modules.h"
+#include "thread_isolate.h"
+#include "thread_pool.h"
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/queue.h>
+#include <freertos/semphr.h>
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Pool states
+#define POOL_STOPPED  0
+#define POOL_STARTING 1
+#define POOL_STARTED  2
+
+// Future states
+#define FUTURE_PENDING 0
+#define FUTURE_DONE    1
+#define FUTURE_FAILED  2
+
+typedef struct {
+    int refs;                   // the future userdata, and the job
+    int state;
+    SemaphoreHandle_t done;     // given when the job ends
+    thread_msg_t *result;       // value returned by the job, or its error
+} pool_future_t;
+
+typedef struct {
+    thread_job_t *code;
+    pool_future_t *future;
+} pool_job_t;
+
+typedef struct {
+    QueueHandle_t queue;        // of pool_job_t *
+    int workers;
+    int busy;                   // workers running a job
+    uint32_t peak;              // maximum of jobs queued
+    uint32_t submitted;
+    uint32_t completed;
+    uint32_t failed;
+} pool_core_t;
+
+static pool_core_t pool[portNUM_PROCESSORS];
+static int pool_state = POOL_STOPPED;
+
+// Registry key of the modules loaded when the state of a worker is created
+static char loaded_key;
+
+/*
+ * Futures
+ */
+static void future_unref(pool_future_t *future) {
+    if (__sync_sub_and_fetch(&future->refs, 1) > 0) {
+        return;
+    }
+
+    thread_isolate_free(future->result);
+    vSemaphoreDelete(future->done);
+    free(future);
+}
+
+static pool_future_t *future_check(lua_State *L) {
+    pool_future_t **ud = (pool_future_t **)luaL_checkudata(L, 1, THREAD_FUTURE_MT);
+
+    return *ud;
+}
+
+// future:join([timeout ms])
+static int future_join(lua_State *L) {
+    pool_future_t *future = future_check(L);
+    lua_Integer ms = luaL_optinteger(L, 2, -1);
+    TickType_t ticks = (ms < 0)?portMAX_DELAY:ms / portTICK_PERIOD_MS;
+
+    if (__sync_fetch_and_add(&future->state, 0) == FUTURE_PENDING) {
+        if (xSemaphoreTake(future->done, ticks) != pdTRUE) {
+            return 0;
+        }
+    }
+
+    // The result is moved to the state the first time, and kept in the userdata
+    if (future->result) {
+        thread_isolate_get(L, &future->result);
+        lua_pushvalue(L, -1);
+        lua_setuservalue(L, 1);
+    } else {
+        lua_getuservalue(L, 1);
+    }
+
+    if (future->state == FUTURE_FAILED) {
+        if (lua_isnil(L, -1)) {
+            lua_pushliteral(L, "job failed");
+        }
+
+        return lua_error(L);
+    }
+
+    return 1;
+}
+
+// future:done()
+static int future_done(lua_State *L) {
+    pool_future_t *future = future_check(L);
+
+    lua_pushboolean(L, __sync_fetch_and_add(&future->state, 0) != FUTURE_PENDING);
+    return 1;
+}
+
+static int future_gc(lua_State *L) {
+    pool_future_t **ud = (pool_future_t **)luaL_checkudata(L, 1, THREAD_FUTURE_MT);
+
+    if (*ud) {
+        future_unref(*ud);
+        *ud = NULL;
+    }
+
+    return 0;
+}
+
+/*
+ * Workers
+ */
+
+// Keeps the names of the modules loaded when the worker's state is created
+static int pool_init(lua_State *L) {
+    luaL_getsubtable(L, LUA_REGISTRYINDEX, LUA_LOADED_TABLE);
+    lua_newtable(L);
+
+    lua_pushnil(L);
+    while (lua_next(L, -3)) {
+        lua_pop(L, 1);
+        lua_pushvalue(L, -1);
+        lua_pushboolean(L, 1);
+        lua_rawset(L, -4);
+    }
+
+    lua_rawsetp(L, LUA_REGISTRYINDEX, &loaded_key);
+
+    return 0;
+}
+
+// Unloads the modules loaded by a job, so the next one loads them again
+static int pool_unload(lua_State *L) {
+    luaL_getsubtable(L, LUA_REGISTRYINDEX, LUA_LOADED_TABLE);
+    lua_rawgetp(L, LUA_REGISTRYINDEX, &loaded_key);
+
+    lua_pushnil(L);
+    while (lua_next(L, -3)) {
+        lua_pop(L, 1);
+        lua_pushvalue(L, -1);
+        if (lua_rawget(L, -3) == LUA_TNIL) {
+            // Setting an existing field to nil doesn't break the traversal
+            lua_pushvalue(L, -2);
+            lua_pushnil(L);
+            lua_rawset(L, -6);
+        }
+        lua_pop(L, 1);
+    }
+
+    return 0;
+}
+
+/*
+ * Sets a new globals table as the _ENV of the function on the top of L, that
+ * reads the globals of the state that are not set in it.
+ */
+static void pool_env(lua_State *L) {
+    const char *name;
+    int i;
+
+    lua_createtable(L, 0, 1);
+    lua_pushvalue(L, -1);
+    lua_setfield(L, -2, "_G");
+
+    lua_createtable(L, 0, 1);
+    lua_pushglobaltable(L);
+    lua_setfield(L, -2, "__index");
+    lua_setmetatable(L, -2);
+
+    for(i = 1;(name = lua_getupvalue(L, -2, i));i++) {
+        lua_pop(L, 1);
+
+        if (strcmp(name, "_ENV") == 0) {
+            lua_pushvalue(L, -1);
+            lua_setupvalue(L, -3, i);
+            break;
+        }
+    }
+
+    lua_pop(L, 1);
+}
+
+// Runs a job in the worker's state, and moves its result to the future
+static int pool_run(lua_State *L) {
+    pool_job_t *job = (pool_job_t *)lua_touserdata(L, 1);
+    thread_job_t *code = job->code;
+    const char *err;
+
+    // The code is freed when it's loaded
+    job->code = NULL;
+
+    if (thread_isolate_load(L, code) != LUA_OK) {
+        return lua_error(L);
+    }
+
+    pool_env(L);
+    lua_call(L, 0, 1);
+
+    err = thread_isolate_put(L, -1, &job->future->result);
+    if (err) {
+        return luaL_error(L, "result: %s", err);
+    }
+
+    return 0;
+}
+
+static void pool_worker(void *arg) {
+    pool_core_t *core = (pool_core_t *)arg;
+    pool_future_t *future;
+    lua_State *L = NULL;
+    pool_job_t *job;
+    int state;
+
+    for(;;) {
+        xQueueReceive(core->queue, &job, portMAX_DELAY);
+        __sync_add_and_fetch(&core->busy, 1);
+
+        future = job->future;
+        state = FUTURE_FAILED;
+
+        // The state is created again if it could not be created for the previous job
+        if (!L) {
+            L = thread_isolate_state(CONFIG_LUA_RTOS_LUA_THREAD_HEAP_SIZE * 1024);
+
+            if (L) {
+                lua_pushcfunction(L, pool_init);
+                if (lua_pcall(L, 0, 0, 0) != LUA_OK) {
+                    thread_isolate_close(L);
+                    L = NULL;
+                }
+            }
+        }
+
+        if (L) {
+            lua_pushcfunction(L, pool_run);
+            lua_pushlightuserdata(L, job);
+
+            if (lua_pcall(L, 1, 0, 0) == LUA_OK) {
+                state = FUTURE_DONE;
+            } else {
+                // The error is the result, if it can be moved
+                thread_isolate_put(L, -1, &future->result);
+            }
+
+            lua_settop(L, 0);
+
+            lua_pushcfunction(L, pool_unload);
+            lua_pcall(L, 0, 0, 0);
+            lua_settop(L, 0);
+        }
+
+        thread_isolate_free_job(job->code);
+        free(job);
+
+        if (state == FUTURE_DONE) {
+            __sync_add_and_fetch(&core->completed, 1);
+        } else {
+            __sync_add_and_fetch(&core->failed, 1);
+        }
+
+        __sync_sub_and_fetch(&core->busy, 1);
+
+        // The result is set before the state
+        __sync_bool_compare_and_swap(&future->state, FUTURE_PENDING, state);
+        xSemaphoreGive(future->done);
+        future_unref(future);
+    }
+}
+
+// Creates the workers of each core, the first time a job is submitted
+static int pool_start() {
+    int core, i, workers = 0;
+
+    if (__sync_bool_compare_and_swap(&pool_state, POOL_STOPPED, POOL_STARTING)) {
+        for(core = 0;core < portNUM_PROCESSORS;core++) {
+            if (!pool[core].queue) {
+                pool[core].queue = xQueueCreate(CONFIG_LUA_RTOS_LUA_THREAD_POOL_QUEUE, sizeof(pool_job_t *));
+                if (!pool[core].queue) continue;
+            }
+
+            for(i = pool[core].workers;i < CONFIG_LUA_RTOS_LUA_THREAD_POOL_WORKERS;i++) {
+                if (xTaskCreatePinnedToCore(pool_worker, "lua pool", CONFIG_LUA_RTOS_LUA_THREAD_STACK_SIZE,
+                                            &pool[core], CONFIG_LUA_RTOS_LUA_THREAD_PRIORITY, NULL, core) != pdPASS) {
+                    break;
+                }
+
+                pool[core].workers++;
+            }
+
+            workers += pool[core].workers;
+        }
+
+        // If no worker can be created, try again on the next submit
+        __sync_bool_compare_and_swap(&pool_state, POOL_STARTING, workers?POOL_STARTED:POOL_STOPPED);
+    }
+
+    // Other thread can be creating the workers
+    while (__sync_fetch_and_add(&pool_state, 0) == POOL_STARTING) {
+        vTaskDelay(1);
+    }
+
+    workers = 0;
+    for(core = 0;core < portNUM_PROCESSORS;core++) {
+        workers += pool[core].workers;
+    }
+
+    return workers;
+}
+
+// The core with workers that has less jobs queued or running, by worker
+static int pool_core() {
+    int core, best = -1;
+    uint32_t load, best_load = 0;
+
+    for(core = 0;core < portNUM_PROCESSORS;core++) {
+        if (!pool[core].workers) continue;
+
+        load = ((uxQueueMessagesWaiting(pool[core].queue) + pool[core].busy) << 8) / pool[core].workers;
+        if ((best < 0) || (load < best_load)) {
+            best = core;
+            best_load = load;
+        }
+    }
+
+    return best;
+}
+
+int thread_pool_submit(lua_State *L) {
+    pool_future_t **ud;
+    thread_job_t *code;
+    pool_job_t *job;
+    uint32_t queued;
+    lua_Integer ms;
+    TickType_t ticks;
+    int core;
+
+    if (!lua_isnoneornil(L, 2)) {
+        core = luaL_checkinteger(L, 2);
+        luaL_argcheck(L, (core >= 0) && (core < portNUM_PROCESSORS), 2, "invalid core");
+    } else {
+        core = -1;
+    }
+
+    ms = luaL_optinteger(L, 3, CONFIG_LUA_RTOS_LUA_THREAD_POOL_TIMEOUT);
+    ticks = (ms < 0)?portMAX_DELAY:ms / portTICK_PERIOD_MS;
+
+    if (!pool_start()) {
+        return luaL_error(L, "can't start the thread pool");
+    }
+
+    if (core < 0) {
+        core = pool_core();
+    } else {
+        luaL_argcheck(L, pool[core].workers > 0, 2, "core without workers");
+    }
+
+    // The future is set before the job is created, so it's freed if anything fails
+    ud = (pool_future_t **)lua_newuserdata(L, sizeof(pool_future_t *));
+    *ud = NULL;
+
+    luaL_getmetatable(L, THREAD_FUTURE_MT);
+    lua_setmetatable(L, -2);
+
+    *ud = (pool_future_t *)calloc(1, sizeof(pool_future_t));
+    if (!*ud) {
+        return luaL_error(L, "not enough memory");
+    }
+
+    (*ud)->refs = 1;
+    (*ud)->done = xSemaphoreCreateBinary();
+    if (!(*ud)->done) {
+        free(*ud);
+        *ud = NULL;
+
+        return luaL_error(L, "not enough memory");
+    }
+
+    // The function is moved out of the state, and given back if the job can't be queued
+    code = thread_isolate_pack(L, 1);
+
+    job = (pool_job_t *)calloc(1, sizeof(pool_job_t));
+    if (!job) {
+        thread_isolate_return_job(code);
+        return luaL_error(L, "not enough memory");
+    }
+
+    job->code = code;
+    job->future = *ud;
+
+    // The reference of the job is added before it's queued, as the worker can end it as soon as it's queued
+    __sync_add_and_fetch(&(*ud)->refs, 1);
+
+    if (xQueueSend(pool[core].queue, &job, ticks) != pdTRUE) {
+        __sync_sub_and_fetch(&(*ud)->refs, 1);
+        thread_isolate_return_job(job->code);
+        free(job);
+
+        return luaL_error(L, "thread pool is full");
+    }
+
+    __sync_add_and_fetch(&pool[core].submitted, 1);
+
+    queued = uxQueueMessagesWaiting(pool[core].queue);
+    if (queued > pool[core].peak) {
+        pool[core].peak = queued;
+    }
+
+    return 1;
+}
+
+int thread_pool_stats(lua_State *L) {
+    int core;
+
+    lua_createtable(L, portNUM_PROCESSORS, 0);
+
+    for(core = 0;core < portNUM_PROCESSORS;core++) {
+        lua_createtable(L, 0, 7);
+
+        lua_pushinteger(L, pool[core].workers); lua_setfield(L, -2, "workers");
+        lua_pushinteger(L, pool[core].queue?uxQueueMessagesWaiting(pool[core].queue):0); lua_setfield(L, -2, "queued");
+        lua_pushinteger(L, pool[core].peak); lua_setfield(L, -2, "peak");
+        lua_pushinteger(L, pool[core].busy); lua_setfield(L, -2, "busy");
+        lua_pushinteger(L, pool[core].submitted); lua_setfield(L, -2, "submitted");
+        lua_pushinteger(L, pool[core].completed); lua_setfield(L, -2, "completed");
+        lua_pushinteger(L, pool[core].failed); lua_setfield(L, -2, "failed");
+
+        // Cores are numbered from 0, as in thread.submit
+        lua_rawseti(L, -2, core);
+    }
+
+    return 1;
+}
+
+static const LUA_REG_TYPE thread_future_map[] = {
+    { LSTRKEY( "join"        ),	 LFUNCVAL( future_join       ) },
+    { LSTRKEY( "done"        ),	 LFUNCVAL( future_done       ) },
+    { LSTRKEY( "__metatable" ),	 LROVAL  ( thread_future_map ) },
+    { LSTRKEY( "__index"     ),	 LROVAL  ( thread_future_map ) },
+    { LSTRKEY( "__gc"        ),	 LFUNCVAL( future_gc         ) },
+    { LNILKEY, LNILVAL }
+};
+
+void thread_pool_open(lua_State *L) {
+    luaL_newmetarotable(L, THREAD_FUTURE_MT, (void *)thread_future_map);
+    lua_pop(L, 1);
+}
+
+#endif
@@ -0,0 +1,81 @@
+/*
+ * Lua RTOS, pool of worker tasks for Lua functions
+ *
+ * Copyright (C) 2015 - 2017
+ * IBEROXARXA SERVICIOS INTEGRALES, S.L. & CSS IBÉRICA, S.L.
+ *
+ * Author: Jaume Olivé (jolive@iberoxarxa.com / jolive@whitecatboard.org)
+ *
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software
+ * and its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that the copyright notice and this
+ * permission notice and warranty disclaimer appear in supporting
+ * documentation, and that the name of the author not be used in
+ * advertising or publicity pertaining to distribution of the
+ * software without specific, written prior permission.
+ *
+ * The author disclaim all warranties with regard to this
+ * software, including all implied warranties of merchantability
+ * and fitness.  In no event shall the author be liable for any
+ * special, indirect or consequential damages or any damages
+ * whatsoever resulting from loss of use, data or profits, whether
+ * in an action of contract, negligence or other tortious action,
+ * arising out of or in connection with the use or performance of
+ * this software.
+ */
+
+/*
+ * thread.submit(f [, core [, timeout ms]]) runs f in a worker task of a fixed
+ * pool, instead of creating a task for it. The pool is created the first time a
+ * function is submitted, with CONFIG_LUA_RTOS_LUA_THREAD_POOL_WORKERS workers
+ * pinned to each core. Each worker has its own Lua state, that is kept between
+ * the jobs, so f is moved to the worker as a thread.spawn function (see
+ * thread_isolate.h).
+ *
+ * Each job runs with its own globals table, that reads the globals of the
+ * state that are not set by the job, and the modules that the job loads with
+ * require are unloaded when it ends, so the globals of a job are not seen by
+ * the next one. The tables of the libraries are shared by the jobs.
+ *
+ * The workers are FreeRTOS tasks, not Lua RTOS threads (pthreads), so a job
+ * can't use the functions that act on the current thread, or that need it to
+ * be a pthread (as the pthread mutexes, keys and cleanup handlers).
+ *
+ * Each core has a queue of jobs. A job is queued to the given core, or to the
+ * core with less jobs queued or running. If the queue is full, thread.submit
+ * waits for timeout ms (CONFIG_LUA_RTOS_LUA_THREAD_POOL_TIMEOUT by default, -1
+ * waits forever), and then raises an error, and the buffers of f are given
+ * back.
+ *
+ * thread.submit returns a future:
+ *
+ * - future:join([timeout ms]) waits for the job, and returns the value returned
+ *   by f, or raises the error of f. Returns nothing if the job is not done after
+ *   timeout.
+ * - future:done() returns true if the job is done.
+ *
+ * thread.poolstats() returns, for each core, the workers, the jobs queued now
+ * and its peak, the busy workers, and the jobs submitted, completed and failed.
+ *
+ * This part doesn't use the Lua RTOS pthread extensions, so it can be built on
+ * the host (see tools/host/port/thread.c).
+ */
+
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include "lua.h"
+
+#define THREAD_FUTURE_MT "thread.future"
+
+// Registers the metatable of the futures in L. Called from luaopen_thread.
+void thread_pool_open(lua_State *L);
+
+// thread.submit(f [, core [, timeout ms]]), thread.poolstats()
+int thread_pool_submit(lua_State *L);
+int thread_pool_stats(lua_State *L);
+
+#endif
@@ -152,8 +152,8 @@ static int luart_write( lua_State* L ) {
 
 static int luart_read( lua_State* L ) {
     int id = luaL_checkinteger(L, 1);
-    const char  *format = luaL_checkstring(L, 2);
-    int timeout, crlf, res, c;
+    const char  *format;
+    int timeout, crlf, res, c, len;
     
     // Some integrity checks
     if (!uart_exists(id)) {
@@ -164,6 +164,32 @@ static int luart_read( lua_State* L ) {
         return luaL_error(L, "UART%d is not setup", id);
     }
     
+    // Read a block of bytes
+    if (lua_type(L, 2) == LUA_TNUMBER) {
+        len = luaL_checkinteger(L, 2);
+        luaL_argcheck(L, len > 0, 2, "must be greater than 0");
+
+        timeout = luaL_optinteger(L, 3, 0xffffffff);
+
+        if (timeout == 0xffffffff) {
+            timeout = portMAX_DELAY;
+        }
+
+        luaL_Buffer b;
+        char *buff = luaL_buffinitsize(L, &b, len);
+
+        res = uart_read_block(id, buff, len, timeout);
+        if (res) {
+            luaL_pushresultsize(&b, res);
+        } else {
+            lua_pushnil(L);
+        }
+
+        return 1;
+    }
+
+    format = luaL_checkstring(L, 2);
+
     // Read ...
     if (strcmp("*l", format) == 0) {
         luaL_checktype(L, 3, LUA_TBOOLEAN);
@@ -226,6 +252,43 @@ static int luart_consume( lua_State* L ) {
     return 0;
 }
 
+static int luart_threshold( lua_State* L ) {
+    int id = luaL_checkinteger(L, 1);
+    int bytes = luaL_checkinteger(L, 2);
+
+    // Some integrity checks
+    if (!uart_exists(id)) {
+        return luaL_error(L, "UART%d does not exist", id);
+    }
+
+    luaL_argcheck(L, bytes > 0, 2, "must be greater than 0");
+
+    uart_set_rx_threshold(id, bytes);
+
+    return 0;
+}
+
+static int luart_stats( lua_State* L ) {
+    int id = luaL_checkinteger(L, 1);
+    uart_stats_t stats;
+    uint32_t buffered;
+
+    // Some integrity checks
+    if (!uart_exists(id)) {
+        return luaL_error(L, "UART%d does not exist", id);
+    }
+
+    uart_get_stats(id, &stats, &buffered);
+
+    lua_pushinteger(L, stats.rx);
+    lua_pushinteger(L, stats.overruns);
+    lua_pushinteger(L, stats.fifo_overflows);
+    lua_pushinteger(L, stats.frame_errors);
+    lua_pushinteger(L, buffered);
+
+    return 5;
+}
+
 static int luart_lock( lua_State* L ) {
     int id = luaL_checkinteger(L, 1);
 
@@ -268,6 +331,8 @@ static const LUA_REG_TYPE uart_map[] = {
     { LSTRKEY( "write"    ),	 LFUNCVAL( luart_write ) },
     { LSTRKEY( "read"     ),	 LFUNCVAL( luart_read ) },
     { LSTRKEY( "consume"  ),	 LFUNCVAL( luart_consume ) },
+    { LSTRKEY( "threshold"),	 LFUNCVAL( luart_threshold ) },
+    { LSTRKEY( "stats"    ),	 LFUNCVAL( luart_stats ) },
     { LSTRKEY( "lock"     ),	 LFUNCVAL( luart_lock ) },
     { LSTRKEY( "unlock"   ),	 LFUNCVAL( luart_unlock ) },
 #if LUA_USE_ROTABLE
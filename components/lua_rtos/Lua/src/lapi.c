@@ -911,6 +911,13 @@ LUA_API int lua_setmetatable (lua_State *L, int objindex) {
         luaC_objbarrier(L, uvalue(obj), mt);
         luaC_checkfinalizer(L, gcvalue(obj), mt);
       }
+#if LUA_USE_ROTABLE
+      else if (mt) {
+        /* Lua RTOS: a rotable is not collectable, but can have a __gc, that
+           must be a LFUNCVAL, and can't raise errors or free the userdata */
+        luaC_checkfinalizer(L, gcvalue(obj), mt);
+      }
+#endif
       break;
     }
     default: {
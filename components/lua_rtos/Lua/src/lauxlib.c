@@ -30,6 +30,10 @@
 #include "lrotable.h"
 #endif
 
+#if CONFIG_LUA_RTOS_LUA_USE_POOL_ALLOC
+#include "lalloc.h"
+#endif
+
 /*
 ** {======================================================
 ** Traceback
@@ -1018,6 +1022,9 @@ LUALIB_API const char *luaL_gsub (lua_State *L, const char *s, const char *p,
 
 
 static void *l_alloc (void *ud, void *ptr, size_t osize, size_t nsize) {
+#if CONFIG_LUA_RTOS_LUA_USE_POOL_ALLOC
+  return lalloc(ud, ptr, osize, nsize);  /* slabs for small blocks */
+#else
   (void)ud; (void)osize;  /* not used */
   if (nsize == 0) {
     free(ptr);
@@ -1025,6 +1032,7 @@ static void *l_alloc (void *ud, void *ptr, size_t osize, size_t nsize) {
   }
   else
     return realloc(ptr, nsize);
+#endif
 }
 
 
@@ -29,6 +29,8 @@
 #include "ltm.h"
 #include "lvm.h"
 
+#include "lpending.h"
+
 
 
 #define noLuaClosure(f)		((f) == NULL || (f)->c.tt == LUA_TCCL)
@@ -89,6 +91,7 @@ LUA_API void lua_sethook (lua_State *L, lua_Hook func, int mask, int count) {
   L->basehookcount = count;
   resethookcount(L);
   L->hookmask = cast_byte(mask);
+  lpending_rearm(L);  /* Lua RTOS: keep the pending work */
 }
 
 
@@ -98,7 +101,7 @@ LUA_API lua_Hook lua_gethook (lua_State *L) {
 
 
 LUA_API int lua_gethookmask (lua_State *L) {
-  return L->hookmask;
+  return L->hookmask & ~LUA_MASKPENDING;
 }
 
 
@@ -665,7 +668,13 @@ l_noret luaG_runerror (lua_State *L, const char *fmt, ...) {
 void luaG_traceexec (lua_State *L) {
   CallInfo *ci = L->ci;
   lu_byte mask = L->hookmask;
-  int counthook = (--L->hookcount == 0 && (mask & LUA_MASKCOUNT));
+  int counthook;
+  if (mask & LUA_MASKPENDING) {  /* Lua RTOS: work of other tasks */
+    luaD_pending(L);
+    if (!(mask & (LUA_MASKLINE | LUA_MASKCOUNT)))
+      return;
+  }
+  counthook = (--L->hookcount == 0 && (mask & LUA_MASKCOUNT));
   if (counthook)
     resethookcount(L);  /* reset count */
   else if (!(mask & LUA_MASKLINE))
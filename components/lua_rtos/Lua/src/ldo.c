@@ -33,6 +33,8 @@
 #include "lvm.h"
 #include "lzio.h"
 
+#include "lpending.h"
+
 
 
 #define errorstatus(s)	((s) > LUA_YIELD)
@@ -273,10 +275,41 @@ void luaD_hook (lua_State *L, int event, int line) {
     ci->top = restorestack(L, ci_top);
     L->top = restorestack(L, top);
     ci->callstatus &= ~CIST_HOOKED;
+    lpending_rearm(L);  /* Lua RTOS: work set while the hook ran */
   }
 }
 
 
+/*
+** Lua RTOS: runs the work that other tasks left pending for the thread
+** (see lpending.h), as a hook is called. Inside a hook, it's run when
+** the hook returns.
+*/
+void luaD_pending (lua_State *L) {
+  if (L->allowhook) {
+    CallInfo *ci = L->ci;
+    ptrdiff_t top = savestack(L, L->top);
+    ptrdiff_t ci_top = savestack(L, ci->top);
+    luaD_checkstack(L, LUA_MINSTACK);  /* ensure minimum stack size */
+    ci->top = L->top + LUA_MINSTACK;
+    lua_assert(ci->top <= L->stack_last);
+    L->allowhook = 0;  /* cannot call hooks inside the work */
+    ci->callstatus |= CIST_HOOKED;
+    lua_unlock(L);
+    lpending_run(L);
+    lua_lock(L);
+    lua_assert(!L->allowhook);
+    L->allowhook = 1;
+    ci->top = restorestack(L, ci_top);
+    L->top = restorestack(L, top);
+    ci->callstatus &= ~CIST_HOOKED;
+    lpending_rearm(L);  /* work set while it ran */
+  }
+  else
+    lpending_defer(L);
+}
+
+
 static void callhook (lua_State *L, CallInfo *ci) {
   int hook = LUA_HOOKCALL;
   ci->u.l.savedpc++;  /* hooks assume 'pc' is already incremented */
@@ -384,6 +417,12 @@ int luaD_poscall (lua_State *L, CallInfo *ci, StkId firstResult, int nres) {
     }
     L->oldpc = ci->previous->u.l.savedpc;  /* 'oldpc' for caller function */
   }
+  if ((L->hookmask & LUA_MASKPENDING) && !isLua(ci)) {
+    /* Lua RTOS: work set while a C function ran, before its frame is removed */
+    ptrdiff_t fr = savestack(L, firstResult);
+    luaD_pending(L);
+    firstResult = restorestack(L, fr);
+  }
   res = ci->func;  /* res == final position of 1st result */
   L->ci = ci->previous;  /* back to caller */
   /* move results to proper place */
@@ -25,6 +25,14 @@
 #include "ltable.h"
 #include "ltm.h"
 
+#include "gcpressure.h"
+#include "lflash.h"
+#include "lromstr.h"
+
+#if LUA_USE_ROTABLE
+#include "lrotable.h"
+#endif
+
 
 /*
 ** internal state for collector while inside the atomic phase. The
@@ -59,6 +67,13 @@
 #define PAUSEADJ		100
 
 
+/*
+** bytes allocated by Lua while a cycle runs, with the step multiplier
+** of the state (for the tuning of Lua RTOS, see gcpressure.h)
+*/
+#define cyclebytes(g)	(((g)->GCestimate / (g)->gcstepmul) * STEPMULADJ)
+
+
 /*
 ** 'makewhite' erases all color bits then sets only the current white
 ** bit
@@ -73,7 +88,12 @@
 
 #define valiswhite(x)   (iscollectable(x) && iswhite(gcvalue(x)))
 
-#define checkdeadkey(n)	lua_assert(!ttisdeadkey(gkey(n)) || ttisnil(gval(n)))
+#define checkdeadkey(n)	lua_assert(!keyisdead(n) || ttisnil(gval(n)))
+
+
+/* collectable object of a value, or of the key of a node, or NULL */
+#define gcvalueN(o)	(iscollectable(o) ? gcvalue(o) : NULL)
+#define gckeyN(n)	(keyiscollectable(n) ? gckey(n) : NULL)
 
 
 #define checkconsistency(obj)  \
@@ -83,6 +103,9 @@
 #define markvalue(g,o) { checkconsistency(o); \
   if (valiswhite(o)) reallymarkobject(g,gcvalue(o)); }
 
+#define markkey(g,n)	{ if (keyiscollectable(n) && iswhite(gckey(n))) \
+  reallymarkobject(g,gckey(n)); }
+
 #define markobject(g,t)	{ if (iswhite(t)) reallymarkobject(g, obj2gco(t)); }
 
 /*
@@ -91,6 +114,19 @@
 */
 #define markobjectN(g,t)	{ if (t) markobject(g,t); }
 
+/*
+** metatables of tables and userdata can be rotables, that are not
+** collectable, and don't have the flags cache of the tag methods
+*/
+#if !LUA_USE_ROTABLE
+#define markmetatable(g,mt)	markobjectN(g,mt)
+#define metatm(g,mt,e)	gfasttm(g,mt,e)
+#else
+#define markmetatable(g,mt)	{ if (!luaR_isrotable(mt)) markobjectN(g,mt); }
+#define metatm(g,mt,e)	(((mt) && luaR_isrotable(mt)) ? \
+	luaT_gettm(mt, e, (g)->tmname[e]) : gfasttm(g,mt,e))
+#endif
+
 static void reallymarkobject (global_State *g, GCObject *o);
 
 
@@ -124,8 +160,8 @@ static void reallymarkobject (global_State *g, GCObject *o);
 */
 static void removeentry (Node *n) {
   lua_assert(ttisnil(gval(n)));
-  if (valiswhite(gkey(n)))
-    setdeadvalue(wgkey(n));  /* unused and unmarked key; remove it */
+  if (keyiscollectable(n) && iswhite(gckey(n)))
+    setdeadkey(n);  /* unused and unmarked key; remove it */
 }
 
 
@@ -136,13 +172,13 @@ static void removeentry (Node *n) {
 ** other objects: if really collected, cannot keep them; for objects
 ** being finalized, keep them in keys, but not in values
 */
-static int iscleared (global_State *g, const TValue *o) {
-  if (!iscollectable(o)) return 0;
-  else if (ttisstring(o)) {
-    markobject(g, tsvalue(o));  /* strings are 'values', so are never weak */
+static int iscleared (global_State *g, GCObject *o) {
+  if (o == NULL) return 0;  /* non-collectable value */
+  else if (novariant(o->tt) == LUA_TSTRING) {
+    markobject(g, o);  /* strings are 'values', so are never weak */
     return 0;
   }
-  else return iswhite(gcvalue(o));
+  else return iswhite(o);
 }
 
 
@@ -193,6 +229,8 @@ void luaC_upvalbarrier_ (lua_State *L, UpVal *uv) {
 
 void luaC_fix (lua_State *L, GCObject *o) {
   global_State *g = G(L);
+  if (lflash_isflash(o) || lromstr_isrom(o))  /* objects in flash or ROM are never collected */
+    return;
   lua_assert(g->allgc == o);  /* object must be 1st in 'allgc' list! */
   white2gray(o);  /* they will be gray forever */
   g->allgc = o->next;  /* remove object from 'allgc' list */
@@ -248,7 +286,7 @@ static void reallymarkobject (global_State *g, GCObject *o) {
     }
     case LUA_TUSERDATA: {
       TValue uvalue;
-      markobjectN(g, gco2u(o)->metatable);  /* mark its metatable */
+      markmetatable(g, gco2u(o)->metatable);  /* mark its metatable */
       gray2black(o);
       g->GCmemtrav += sizeudata(gco2u(o));
       getuservalue(g->mainthread, gco2u(o), &uvalue);
@@ -289,7 +327,13 @@ static void reallymarkobject (global_State *g, GCObject *o) {
 static void markmt (global_State *g) {
   int i;
   for (i=0; i < LUA_NUMTAGS; i++)
+#if !LUA_USE_ROTABLE
     markobjectN(g, g->mt[i]);
+#else
+    /* the string metatable is a rotable, that is not collectable */
+    if (!luaR_isrotable(g->mt[i]))
+      markobjectN(g, g->mt[i]);
+#endif
 }
 
 
@@ -368,9 +412,9 @@ static void traverseweakvalue (global_State *g, Table *h) {
     if (ttisnil(gval(n)))  /* entry is empty? */
       removeentry(n);  /* remove it */
     else {
-      lua_assert(!ttisnil(gkey(n)));
-      markvalue(g, gkey(n));  /* mark key */
-      if (!hasclears && iscleared(g, gval(n)))  /* is there a white value? */
+      lua_assert(!keyisnil(n));
+      markkey(g, n);  /* mark key */
+      if (!hasclears && iscleared(g, gcvalueN(gval(n))))  /* is there a white value? */
         hasclears = 1;  /* table will have to be cleared */
     }
   }
@@ -409,7 +453,7 @@ static int traverseephemeron (global_State *g, Table *h) {
     checkdeadkey(n);
     if (ttisnil(gval(n)))  /* entry is empty? */
       removeentry(n);  /* remove it */
-    else if (iscleared(g, gkey(n))) {  /* key is not marked (yet)? */
+    else if (iscleared(g, gckeyN(n))) {  /* key is not marked (yet)? */
       hasclears = 1;  /* table must be cleared */
       if (valiswhite(gval(n)))  /* value not marked yet? */
         hasww = 1;  /* white-white entry */
@@ -440,8 +484,8 @@ static void traversestrongtable (global_State *g, Table *h) {
     if (ttisnil(gval(n)))  /* entry is empty? */
       removeentry(n);  /* remove it */
     else {
-      lua_assert(!ttisnil(gkey(n)));
-      markvalue(g, gkey(n));  /* mark key */
+      lua_assert(!keyisnil(n));
+      markkey(g, n);  /* mark key */
       markvalue(g, gval(n));  /* mark value */
     }
   }
@@ -450,8 +494,8 @@ static void traversestrongtable (global_State *g, Table *h) {
 
 static lu_mem traversetable (global_State *g, Table *h) {
   const char *weakkey, *weakvalue;
-  const TValue *mode = gfasttm(g, h->metatable, TM_MODE);
-  markobjectN(g, h->metatable);
+  const TValue *mode = metatm(g, h->metatable, TM_MODE);
+  markmetatable(g, h->metatable);
   if (mode && ttisstring(mode) &&  /* is there a weak mode? */
       ((weakkey = strchr(svalue(mode), 'k')),
        (weakvalue = strchr(svalue(mode), 'v')),
@@ -641,7 +685,7 @@ static void clearkeys (global_State *g, GCObject *l, GCObject *f) {
     Table *h = gco2t(l);
     Node *n, *limit = gnodelast(h);
     for (n = gnode(h, 0); n < limit; n++) {
-      if (!ttisnil(gval(n)) && (iscleared(g, gkey(n)))) {
+      if (!ttisnil(gval(n)) && (iscleared(g, gckeyN(n)))) {
         setnilvalue(gval(n));  /* remove value ... */
         removeentry(n);  /* and remove entry from table */
       }
@@ -661,11 +705,11 @@ static void clearvalues (global_State *g, GCObject *l, GCObject *f) {
     unsigned int i;
     for (i = 0; i < h->sizearray; i++) {
       TValue *o = &h->array[i];
-      if (iscleared(g, o))  /* value was collected? */
+      if (iscleared(g, gcvalueN(o)))  /* value was collected? */
         setnilvalue(o);  /* remove value */
     }
     for (n = gnode(h, 0); n < limit; n++) {
-      if (!ttisnil(gval(n)) && iscleared(g, gval(n))) {
+      if (!ttisnil(gval(n)) && iscleared(g, gcvalueN(gval(n)))) {
         setnilvalue(gval(n));  /* remove value ... */
         removeentry(n);  /* and remove entry from table */
       }
@@ -901,7 +945,7 @@ static void separatetobefnz (global_State *g, int all) {
 void luaC_checkfinalizer (lua_State *L, GCObject *o, Table *mt) {
   global_State *g = G(L);
   if (tofinalize(o) ||                 /* obj. is already marked... */
-      gfasttm(g, mt, TM_GC) == NULL)   /* or has no finalizer? */
+      metatm(g, mt, TM_GC) == NULL)   /* or has no finalizer? */
     return;  /* nothing to be done */
   else {  /* move 'o' to 'finobj' list */
     GCObject **p;
@@ -939,10 +983,12 @@ void luaC_checkfinalizer (lua_State *L, GCObject *o, Table *mt) {
 static void setpause (global_State *g) {
   l_mem threshold, debt;
   l_mem estimate = g->GCestimate / PAUSEADJ;  /* adjust 'estimate' */
+  int pause = gc_pressure_pause(g->gcpause, cyclebytes(g));  /* tuned by the free heap */
   lua_assert(estimate > 0);
-  threshold = (g->gcpause < MAX_LMEM / estimate)  /* overflow? */
-            ? estimate * g->gcpause  /* no overflow */
+  threshold = (pause < MAX_LMEM / estimate)  /* overflow? */
+            ? estimate * pause  /* no overflow */
             : MAX_LMEM;  /* overflow; truncate to maximum */
+  threshold = gc_pressure_threshold(gettotalbytes(g), threshold, cyclebytes(g));
   debt = gettotalbytes(g) - threshold;
   luaE_setdebt(g, debt);
 }
@@ -1111,9 +1157,8 @@ void luaC_runtilstate (lua_State *L, int statesmask) {
 ** get GC debt and convert it from Kb to 'work units' (avoid zero debt
 ** and overflows)
 */
-static l_mem getdebt (global_State *g) {
+static l_mem getdebt (global_State *g, int stepmul) {
   l_mem debt = g->GCdebt;
-  int stepmul = g->gcstepmul;
   if (debt <= 0) return 0;  /* minimal debt */
   else {
     debt = (debt / STEPMULADJ) + 1;
@@ -1127,7 +1172,8 @@ static l_mem getdebt (global_State *g) {
 */
 void luaC_step (lua_State *L) {
   global_State *g = G(L);
-  l_mem debt = getdebt(g);  /* GC deficit (be paid now) */
+  int stepmul = gc_pressure_stepmul(g->gcstepmul, cyclebytes(g));  /* tuned by the free heap */
+  l_mem debt = getdebt(g, stepmul);  /* GC deficit (be paid now) */
   if (!g->gcrunning) {  /* not running? */
     luaE_setdebt(g, -GCSTEPSIZE * 10);  /* avoid being called too often */
     return;
@@ -1139,7 +1185,7 @@ void luaC_step (lua_State *L) {
   if (g->gcstate == GCSpause)
     setpause(g);  /* pause until next cycle */
   else {
-    debt = (debt / g->gcstepmul) * STEPMULADJ;  /* convert 'work units' to Kb */
+    debt = (debt / stepmul) * STEPMULADJ;  /* convert 'work units' to Kb */
     luaE_setdebt(g, debt);
     runafewfinalizers(L);
   }
@@ -740,6 +740,10 @@ static const LUA_REG_TYPE flib[] = {
   { LSTRKEY( "close" 	  ),			LFUNCVAL( io_close 	 ) },
   { LSTRKEY( "flush" 	  ),			LFUNCVAL( f_flush 	 ) },
   { LSTRKEY( "lines" 	  ),			LFUNCVAL( f_lines 	 ) },
+#if USE_SPIFFS
+  { LSTRKEY( "map" 	      ),			LFUNCVAL( f_map 	 ) },
+  { LSTRKEY( "unmap" 	  ),			LFUNCVAL( f_unmap 	 ) },
+#endif
   { LSTRKEY( "read" 	  ),			LFUNCVAL( f_read 	 ) },
   { LSTRKEY( "seek" 	  ),			LFUNCVAL( f_seek 	 ) },
   { LSTRKEY( "setvbuf" 	  ),			LFUNCVAL( f_setvbuf  ) },
@@ -27,6 +27,9 @@
 #include "ltable.h"
 #include "lzio.h"
 
+#include "lflash.h"
+#include "lromstr.h"
+
 
 
 #define next(ls) (ls->current = zgetc(ls->z))
@@ -74,7 +77,9 @@ void luaX_init (lua_State *L) {
   for (i=0; i<NUM_RESERVED; i++) {
     TString *ts = luaS_new(L, luaX_tokens[i]);
     luaC_fix(L, obj2gco(ts));  /* reserved words are never collected */
-    ts->extra = cast_byte(i+1);  /* reserved word */
+    if (!lflash_isflash(ts) && !lromstr_isrom(ts))  /* flash and ROM have them marked */
+      ts->extra = cast_byte(i+1);  /* reserved word */
+    lua_assert(ts->extra == i+1);
   }
 }
 
@@ -137,7 +142,7 @@ TString *luaX_newstring (LexState *ls, const char *str, size_t l) {
     luaC_checkGC(L);
   }
   else {  /* string already present */
-    ts = tsvalue(keyfromval(o));  /* re-use value previously stored */
+    ts = keystrval(nodefromval(o));  /* re-use value previously stored */
   }
   L->top--;  /* remove string from stack */
   return ts;
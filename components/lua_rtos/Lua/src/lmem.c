@@ -21,6 +21,8 @@
 #include "lobject.h"
 #include "lstate.h"
 
+#include "gcpressure.h"
+
 
 
 /*
@@ -83,15 +85,21 @@ void *luaM_realloc_ (lua_State *L, void *block, size_t osize, size_t nsize) {
   if (nsize > realosize && g->gcrunning)
     luaC_fullgc(L, 1);  /* force a GC whenever possible */
 #endif
+  g->gcalloc = 1;  /* a failure is handled here, not by the malloc wrappers */
   newblock = (*g->frealloc)(g->ud, block, osize, nsize);
+  g->gcalloc = 0;
   if (newblock == NULL && nsize > 0) {
     lua_assert(nsize > realosize);  /* cannot fail when shrinking a block */
     if (g->version) {  /* is state fully built? */
-      luaC_fullgc(L, 1);  /* try to free some memory... */
+      gc_pressure_emergency(L);  /* try to free some memory... */
+      g->gcalloc = 1;
       newblock = (*g->frealloc)(g->ud, block, osize, nsize);  /* try again */
+      g->gcalloc = 0;
     }
-    if (newblock == NULL)
+    if (newblock == NULL) {
+      gc_pressure_failed();
       luaD_throw(L, LUA_ERRMEM);
+    }
   }
   lua_assert((nsize == 0) == (newblock == NULL));
   g->GCdebt = (g->GCdebt + nsize) - realosize;
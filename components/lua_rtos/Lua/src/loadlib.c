@@ -27,6 +27,14 @@
 #include "lrotable.h"
 #endif
 
+#if CONFIG_LUA_RTOS_LUA_USE_FLASH_MODULES
+#include "lflash.h"
+#endif
+
+#if CONFIG_LUA_RTOS_LUA_USE_MODULE_CACHE
+#include "lmodcache.h"
+#endif
+
 /*
 ** LUA_IGMARK is a mark to ignore all before it when building the
 ** luaopen_ function name.
@@ -495,6 +503,27 @@ static int checkload (lua_State *L, int stat, const char *filename) {
 }
 
 
+#if CONFIG_LUA_RTOS_LUA_USE_MODULE_CACHE
+static int searcher_Lua (lua_State *L) {
+  const char *filename, *path;
+  const char *name = luaL_checkstring(L, 1);
+  lua_getfield(L, lua_upvalueindex(1), "path");
+  path = lua_tostring(L, -1);
+  if (path == NULL)
+    luaL_error(L, "'package.%s' must be a string", "path");
+  filename = lmodcache_lookup(L, name, path);
+  if (filename != NULL) {  /* indexed? */
+    int stat = lmodcache_loadfile(L, filename);
+    if (stat != LMODCACHE_NOFILE)
+      return checkload(L, (stat == LUA_OK), filename);
+    lua_pop(L, 2);  /* file is gone, look it up again */
+  }
+  filename = findfile(L, name, "path", LUA_LSUBSEP);
+  lmodcache_index(L, name, path, filename);
+  if (filename == NULL) return 1;  /* module not found in this path */
+  return checkload(L, (lmodcache_loadfile(L, filename) == LUA_OK), filename);
+}
+#else
 static int searcher_Lua (lua_State *L) {
   const char *filename;
   const char *name = luaL_checkstring(L, 1);
@@ -502,6 +531,7 @@ static int searcher_Lua (lua_State *L) {
   if (filename == NULL) return 1;  /* module not found in this path */
   return checkload(L, (luaL_loadfile(L, filename) == LUA_OK), filename);
 }
+#endif
 
 
 /*
@@ -569,6 +599,19 @@ static int searcher_preload (lua_State *L) {
 }
 
 
+#if CONFIG_LUA_RTOS_LUA_USE_FLASH_MODULES
+static int searcher_flash (lua_State *L) {
+  const char *name = luaL_checkstring(L, 1);
+  if (!lflash_load(L, name)) {  /* not in the flash image? */
+    lua_pushfstring(L, "\n\tno module '%s' in the flash image", name);
+    return 1;
+  }
+  lua_pushliteral(L, ":flash:");  /* will be 2nd argument to module */
+  return 2;
+}
+#endif
+
+
 static void findloader (lua_State *L, const char *name) {
   int i;
   luaL_Buffer msg;  /* to build error message */
@@ -745,7 +788,11 @@ static const luaL_Reg ll_funcs[] = {
 
 static void createsearcherstable (lua_State *L) {
   static const lua_CFunction searchers[] =
-    {searcher_preload, searcher_Lua, searcher_C, searcher_Croot, NULL};
+    {searcher_preload,
+#if CONFIG_LUA_RTOS_LUA_USE_FLASH_MODULES
+     searcher_flash,  /* before the files, that can have the same modules */
+#endif
+     searcher_Lua, searcher_C, searcher_Croot, NULL};
   int i;
   /* create 'searchers' table */
   lua_createtable(L, sizeof(searchers)/sizeof(searchers[0]) - 1, 0);
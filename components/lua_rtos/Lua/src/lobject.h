@@ -107,7 +107,25 @@ typedef union Value {
 } Value;
 
 
+/*
+** Lua RTOS: with LUA_USE_COMPACT_NODES, the tag of a value is a byte, so the
+** key of a table node fits in the padding of its value and after the link
+** to the next node, as in Lua 5.4 (see 'Node')
+*/
+#if !defined(LUA_USE_COMPACT_NODES)
+#if CONFIG_LUA_RTOS_LUA_USE_COMPACT_NODES
+#define LUA_USE_COMPACT_NODES	1
+#else
+#define LUA_USE_COMPACT_NODES	0
+#endif
+#endif
+
+
+#if LUA_USE_COMPACT_NODES
+#define TValuefields	Value value_; lu_byte tt_
+#else
 #define TValuefields	Value value_; int tt_
+#endif
 
 
 typedef struct lua_TValue {
@@ -256,9 +274,20 @@ typedef struct lua_TValue {
 
 
 
+/*
+** Lua RTOS: with compact nodes, the padding of the value of a node holds its
+** key, so values are copied field by field
+*/
+#if LUA_USE_COMPACT_NODES
+#define setobj(L,obj1,obj2) \
+	{ TValue *io1=(obj1); const TValue *io2=(obj2); \
+	  io1->value_ = io2->value_; io1->tt_ = io2->tt_; \
+	  (void)L; checkliveness(L,io1); }
+#else
 #define setobj(L,obj1,obj2) \
 	{ TValue *io1=(obj1); *io1 = *(obj2); \
 	  (void)L; checkliveness(L,io1); }
+#endif
 
 
 /*
@@ -279,7 +308,12 @@ typedef struct lua_TValue {
 #define setsvalue2n	setsvalue
 
 /* to table (define it as an expression to be used in macros) */
+#if LUA_USE_COMPACT_NODES
+#define setobj2t(L,o1,o2)  ((void)L, (o1)->value_=(o2)->value_, \
+	(o1)->tt_=(o2)->tt_, checkliveness(L,(o1)))
+#else
 #define setobj2t(L,o1,o2)  ((void)L, *(o1)=*(o2), checkliveness(L,(o1)))
+#endif
 
 
 
@@ -472,6 +506,28 @@ typedef union Closure {
 ** Tables
 */
 
+#if LUA_USE_COMPACT_NODES
+
+/*
+** The key of a node is not a 'TValue': its tag and value are after the tag
+** of the value of the node and the link. A node takes 16 bytes, instead of
+** 20, with 32-bit values, and 24 instead of 32 with 64-bit pointers.
+*/
+typedef union Node {
+  struct NodeKey {
+    TValuefields;  /* fields for value */
+    lu_byte key_tt;  /* key type */
+    int next;  /* for chaining (offset for next node) */
+    Value key_val;  /* key value */
+  } u;
+  TValue i_val;  /* direct access to node's value as a proper 'TValue' */
+} Node;
+
+#define keytt(node)		((node)->u.key_tt)
+#define keyval(node)		((node)->u.key_val)
+
+#else
+
 typedef union TKey {
   struct {
     TValuefields;
@@ -481,18 +537,43 @@ typedef union TKey {
 } TKey;
 
 
-/* copy a value into a key without messing up field 'next' */
-#define setnodekey(L,key,obj) \
-	{ TKey *k_=(key); const TValue *io_=(obj); \
-	  k_->nk.value_ = io_->value_; k_->nk.tt_ = io_->tt_; \
-	  (void)L; checkliveness(L,io_); }
-
-
 typedef struct Node {
   TValue i_val;
   TKey i_key;
 } Node;
 
+#define keytt(node)		((node)->i_key.nk.tt_)
+#define keyval(node)		((node)->i_key.nk.value_)
+
+#endif
+
+
+/* copy a value into the key of a node without messing up field 'next' */
+#define setnodekey(L,node,obj) \
+	{ Node *n_=(node); const TValue *io_=(obj); \
+	  keyval(n_) = io_->value_; keytt(n_) = io_->tt_; \
+	  (void)L; checkliveness(L,io_); }
+
+
+/* copy the key of a node into a value */
+#define getnodekey(L,obj,node) \
+	{ TValue *io_=(obj); const Node *n_=(node); \
+	  io_->value_ = keyval(n_); io_->tt_ = keytt(n_); \
+	  (void)L; checkliveness(L,io_); }
+
+
+#define keyisnil(node)		(keytt(node) == LUA_TNIL)
+#define keyisinteger(node)	(keytt(node) == LUA_TNUMINT)
+#define keyival(node)		(keyval(node).i)
+#define keyisshrstr(node)	(keytt(node) == ctb(LUA_TSHRSTR))
+#define keystrval(node)		(gco2ts(keyval(node).gc))
+#define keyisdead(node)		(keytt(node) == LUA_TDEADKEY)
+#define keyiscollectable(node)	(keytt(node) & BIT_ISCOLLECTABLE)
+#define gckey(node)		(keyval(node).gc)
+
+#define setnilkey(node)		(keytt(node) = LUA_TNIL)
+#define setdeadkey(node)	(keytt(node) = LUA_TDEADKEY)
+
 
 typedef struct Table {
   CommonHeader;
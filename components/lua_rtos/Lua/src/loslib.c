@@ -446,8 +446,15 @@ static const LUA_REG_TYPE syslib[] =
   { LSTRKEY( "exists" ),  	 LFUNCVAL( os_exists ) },
   { LSTRKEY( "mountfat" ),   LFUNCVAL( os_mountfat ) },
   { LSTRKEY( "unmountfat" ), LFUNCVAL( os_unmountfat ) },
+  { LSTRKEY( "sync" ),       LFUNCVAL( os_sync ) },
   { LSTRKEY( "sleepcalib" ), LFUNCVAL( os_set_sleep_calib ) },
   { LSTRKEY( "compile" ),    LFUNCVAL( os_compile ) },
+#if CONFIG_LUA_RTOS_LUA_USE_FLASH_MODULES
+  { LSTRKEY( "flashlua" ),   LFUNCVAL( os_flashlua ) },
+#endif
+#if CONFIG_LUA_RTOS_LUA_USE_PROFILER
+  { LSTRKEY( "profile" ),    LFUNCVAL( os_profile ) },
+#endif
 
 #if (LUA_USE_EDITOR == 1)
   { LSTRKEY( "edit" ),       LFUNCVAL( os_edit ) },
@@ -27,6 +27,9 @@
 #include "ltable.h"
 #include "ltm.h"
 
+#include "lflash.h"
+#include "lromstr.h"
+
 
 #if !defined(LUAI_GCPAUSE)
 #define LUAI_GCPAUSE	200  /* 200% */
@@ -229,6 +232,7 @@ static void preinit_thread (lua_State *L, global_State *g) {
   L->nCcalls = 0;
   L->hook = NULL;
   L->hookmask = 0;
+  L->pending = 0;
   L->basehookcount = 0;
   L->allowhook = 1;
   resethookcount(L);
@@ -268,7 +272,7 @@ LUA_API lua_State *lua_newthread (lua_State *L) {
   setthvalue(L, L->top, L1);
   api_incr_top(L);
   preinit_thread(L1, g);
-  L1->hookmask = L->hookmask;
+  L1->hookmask = L->hookmask & ~LUA_MASKPENDING;
   L1->basehookcount = L->basehookcount;
   L1->hook = L->hook;
   resethookcount(L1);
@@ -308,8 +312,9 @@ LUA_API lua_State *lua_newstate (lua_Alloc f, void *ud) {
   g->frealloc = f;
   g->ud = ud;
   g->mainthread = L;
-  g->seed = makeseed(L);
+  g->seed = lflash_seed(lromstr_seed(makeseed(L)));  /* the one of ROM or flash */
   g->gcrunning = 0;  /* no GC while building state */
+  g->gcalloc = 0;
   g->GCestimate = 0;
   g->strt.size = g->strt.nuse = 0;
   g->strt.hash = NULL;
@@ -43,6 +43,13 @@ struct lua_longjmp;  /* defined in ldo.c */
 #endif
 
 
+/*
+** Lua RTOS: bit of 'hookmask' set while other tasks have work pending for
+** the thread, in 'pending' (see lpending.h). It's not a hook.
+*/
+#define LUA_MASKPENDING	(1 << 7)
+
+
 /* extra stack space to handle TM calls and some other extras */
 #define EXTRA_STACK   5
 
@@ -130,6 +137,7 @@ typedef struct global_State {
   lu_byte gcstate;  /* state of garbage collector */
   lu_byte gckind;  /* kind of GC running */
   lu_byte gcrunning;  /* true if GC is running */
+  lu_byte gcalloc;  /* true while 'frealloc' is called by luaM_realloc_ */
   GCObject *allgc;  /* list of all collectable objects */
   GCObject **sweepgc;  /* current position of sweep in list */
   GCObject *finobj;  /* list of collectable objects with finalizers */
@@ -181,6 +189,7 @@ struct lua_State {
   unsigned short nCcalls;  /* number of nested C calls */
   l_signalT hookmask;
   lu_byte allowhook;
+  l_signalT pending;  /* Lua RTOS: bits of the work pending */
 };
 
 
@@ -21,6 +21,9 @@
 #include "lstate.h"
 #include "lstring.h"
 
+#include "lflash.h"
+#include "lromstr.h"
+
 
 #define MEMERRMSG       "not enough memory"
 
@@ -179,6 +182,12 @@ static TString *internshrstr (lua_State *L, const char *str, size_t l) {
       return ts;
     }
   }
+  ts = lromstr_getstr(str, l, h);  /* strings in ROM */
+  if (ts != NULL)
+    return ts;
+  ts = lflash_getstr(str, l, h);  /* short strings of the flash image */
+  if (ts != NULL)
+    return ts;
   if (g->strt.nuse >= g->strt.size && g->strt.size <= MAX_INT/2) {
     luaS_resize(L, g->strt.size * 2);
     list = &g->strt.hash[lmod(h, g->strt.size)];  /* recompute with new size */
@@ -12,17 +12,13 @@
 
 #define gnode(t,i)	(&(t)->node[i])
 #define gval(n)		(&(n)->i_val)
-#define gnext(n)	((n)->i_key.nk.next)
-
 
-/* 'const' to avoid wrong writings that can mess up field 'next' */
-#define gkey(n)		cast(const TValue*, (&(n)->i_key.tvk))
-
-/*
-** writable version of 'gkey'; allows updates to individual fields,
-** but not to the whole (which has incompatible type)
-*/
-#define wgkey(n)		(&(n)->i_key.nk)
+/* the key of a node is read and written with the macros of lobject.h */
+#if LUA_USE_COMPACT_NODES
+#define gnext(n)	((n)->u.next)
+#else
+#define gnext(n)	((n)->i_key.nk.next)
+#endif
 
 #define invalidateTMcache(t)	((t)->flags = 0)
 
@@ -35,9 +31,9 @@
 #define allocsizenode(t)	(isdummy(t) ? 0 : sizenode(t))
 
 
-/* returns the key, given the value of a table entry */
-#define keyfromval(v) \
-  (gkey(cast(Node *, cast(char *, (v)) - offsetof(Node, i_val))))
+/* returns the node, given the value of a table entry */
+#define nodefromval(v) \
+  (cast(Node *, cast(char *, (v)) - offsetof(Node, i_val)))
 
 
 LUAI_FUNC const TValue *luaH_getint (Table *t, lua_Integer key);
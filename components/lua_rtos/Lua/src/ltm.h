@@ -50,6 +50,11 @@ typedef enum {
 
 #define fasttm(l,et,e)	gfasttm(G(l), et, e)
 
+#if LUA_USE_ROTABLE
+/* rotables have no flags, the absence of tag methods is not cached */
+#define rofasttm(l,et,e) ((et) == NULL ? NULL : luaT_gettm(et, e, G(l)->tmname[e]))
+#endif
+
 #define ttypename(x)	luaT_typenames_[(x) + 1]
 
 LUAI_DDEC const char *const luaT_typenames_[LUA_TOTALTAGS];
@@ -35,6 +35,10 @@
 #include "llex.h"
 #endif
 
+#if LUA_USE_JUMPTABLE
+#include "esp_attr.h"
+#endif
+
 
 /* limit for table tag-method chains (to avoid loops) */
 #define MAXTAGLOOP	2000
@@ -213,7 +217,7 @@ void luaV_finishget (lua_State *L, const TValue *t, TValue *key, StkId val,
     }
     else {  /* 't' is a table */
       lua_assert(ttisnil(slot));
-      tm = fasttm(L, ttistable(t)?hvalue(t)->metatable:(Table*)luaL_rometatable(rvalue(t)), TM_INDEX);  /* table's metamethod */
+      tm = ttistable(t)?fasttm(L, hvalue(t)->metatable, TM_INDEX):rofasttm(L, (Table*)luaL_rometatable(rvalue(t)), TM_INDEX);  /* table's metamethod */
       if (tm == NULL) {  /* no metamethod? */
        setnilvalue(val);  /* result is nil */
         return;
@@ -289,7 +293,7 @@ void luaV_finishset (lua_State *L, const TValue *t, TValue *key,
     if (slot != NULL) {  /* is 't' a table? */
       Table *h = (ttistable(t)?hvalue(t):(Table *)rvalue(t));  /* save 't' table */
       lua_assert(ttisnil(slot));  /* old value must be nil */
-      tm = fasttm(L, ttistable(t)?h->metatable:(Table*)luaL_rometatable(rvalue(t)), TM_NEWINDEX);  /* get metamethod */
+      tm = ttistable(t)?fasttm(L, h->metatable, TM_NEWINDEX):rofasttm(L, (Table*)luaL_rometatable(rvalue(t)), TM_NEWINDEX);  /* get metamethod */
       if (tm == NULL) {  /* no metamethod? */
     	//if ((checktype(key, LUA_TSTRING)) && luaR_findglobal(svalue(key))) {
     	//	luaG_runerror(L, "attempt to index a rotable value (global '%s')", svalue(key));
@@ -850,10 +854,42 @@ void luaV_finishOp (lua_State *L) {
            luai_threadyield(L); }
 
 
+/*
+** Lua RTOS: opcode profile. The cycles from an instruction to the next one
+** are accounted to the opcode of the first one.
+*/
+#if LUA_USE_OPPROF
+
+#include <xtensa/hal.h>
+
+#define luai_cycles()	xthal_get_ccount()
+
+#define opprof(i)	{ uint32_t now_ = luai_cycles(); \
+  if (pop < NUM_OPCODES) luaV_opprofile[pop].cycles += now_ - pcycles; \
+  pop = GET_OPCODE(i); luaV_opprofile[pop].count++; pcycles = now_; }
+
+#define opprofend()	{ \
+  if (pop < NUM_OPCODES) luaV_opprofile[pop].cycles += luai_cycles() - pcycles; }
+
+LUAI_DDEF luaV_OpProfile luaV_opprofile[NUM_OPCODES];
+
+void luaV_resetprofile (void) {
+  memset(luaV_opprofile, 0, sizeof(luaV_opprofile));
+}
+
+#else
+
+#define opprof(i)	((void)0)
+#define opprofend()	((void)0)
+
+#endif
+
+
 /* fetch an instruction and prepare its execution */
 #define vmfetch()	{ \
   i = *(ci->u.l.savedpc++); \
-  if (L->hookmask & (LUA_MASKLINE | LUA_MASKCOUNT)) \
+  opprof(i); \
+  if (L->hookmask & (LUA_MASKLINE | LUA_MASKCOUNT | LUA_MASKPENDING)) \
     Protect(luaG_traceexec(L)); \
   ra = RA(i); /* WARNING: any stack reallocation invalidates 'ra' */ \
   lua_assert(base == ci->u.l.base); \
@@ -886,6 +922,13 @@ void luaV_execute (lua_State *L) {
   LClosure *cl;
   TValue *k;
   StkId base;
+#if LUA_USE_OPPROF
+  int pop = NUM_OPCODES;  /* opcode of the previous instruction */
+  uint32_t pcycles = 0;
+#endif
+#if LUA_USE_JUMPTABLE
+#include "ljumptab.h"
+#endif
   ci->callstatus |= CIST_FRESH;  /* fresh invocation of 'luaV_execute" */
  newframe:  /* reentry point when frame changes (call/return) */
   lua_assert(ci == L->ci);
@@ -1275,8 +1318,10 @@ void luaV_execute (lua_State *L) {
         int b = GETARG_B(i);
         if (cl->p->sizep > 0) luaF_close(L, base);
         b = luaD_poscall(L, ci, ra, (b != 0 ? b - 1 : cast_int(L->top - ra)));
-        if (ci->callstatus & CIST_FRESH)  /* local 'ci' still from callee */
+        if (ci->callstatus & CIST_FRESH) {  /* local 'ci' still from callee */
+          opprofend();
           return;  /* external invocation: return */
+        }
         else {  /* invocation via reentry: continue execution */
           ci = L->ci;
           if (b) L->top = ci->top;
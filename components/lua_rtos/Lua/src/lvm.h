@@ -37,6 +37,48 @@
 #endif
 
 
+/*
+** Lua RTOS: the opcodes are dispatched with threaded code (see ljumptab.h)
+** when CONFIG_LUA_RTOS_LUA_USE_JUMPTABLE is enabled, if the compiler has
+** labels as values
+*/
+#if !defined(LUA_USE_JUMPTABLE)
+#if CONFIG_LUA_RTOS_LUA_USE_JUMPTABLE && defined(__GNUC__)
+#define LUA_USE_JUMPTABLE	1
+#else
+#define LUA_USE_JUMPTABLE	0
+#endif
+#endif
+
+
+/*
+** Lua RTOS: with LUA_USE_OPPROF, 'luaV_execute' counts the instructions run
+** of each opcode, and the cycles from each instruction to the next one, that
+** include the calls made by the instruction (os.stats("vm")). The counters
+** are shared by all the Lua threads.
+*/
+#if !defined(LUA_USE_OPPROF)
+#if CONFIG_LUA_RTOS_LUA_OPCODE_PROFILE
+#define LUA_USE_OPPROF		1
+#else
+#define LUA_USE_OPPROF		0
+#endif
+#endif
+
+#if LUA_USE_OPPROF
+#include <stdint.h>
+
+#include "lopcodes.h"
+
+typedef struct luaV_OpProfile {
+  uint32_t count;  /* instructions run */
+  uint64_t cycles;
+} luaV_OpProfile;
+
+LUAI_DDEC luaV_OpProfile luaV_opprofile[NUM_OPCODES];
+#endif
+
+
 #define tonumber(o,n) \
 	(ttisfloat(o) ? (*(n) = fltvalue(o), 1) : luaV_tonumber_(o,n))
 
@@ -128,4 +170,8 @@ LUAI_FUNC lua_Integer luaV_mod (lua_State *L, lua_Integer x, lua_Integer y);
 LUAI_FUNC lua_Integer luaV_shiftl (lua_Integer x, lua_Integer y);
 LUAI_FUNC void luaV_objlen (lua_State *L, StkId ra, const TValue *rb);
 
+#if LUA_USE_OPPROF
+LUAI_FUNC void luaV_resetprofile (void);
+#endif
+
 #endif
@@ -0,0 +1,199 @@
+#!/usr/bin/env python
+#
+# Lua RTOS, ROM strings generator
+#
+# Copyright (C) 2015 - 2017 LoBo
+#
+# Author: LoBo (loboris@gmail.com / https://github.com/loboris)
+#
+# Reads the preprocessed sources of the Lua core and modules (gcc -E output)
+# from the files passed as arguments, or from stdin, and writes to stdout a C
+# header with the short strings known at build time, as Lua strings (TString)
+# with their hash, and a hash table to find them. The strings are:
+#
+# * the string keys of every luaR_entry array (LUA_REG_TYPE maps), and the
+#   names of the modules (lua_rotable)
+# * the reserved words (luaX_tokens) and the metamethod names (luaT_eventname)
+# * the string literals given to luaS_new, luaS_newliteral, lua_pushstring,
+#   lua_pushliteral, lua_getglobal, lua_setglobal, lua_getfield, lua_setfield,
+#   luaL_getmetafield and luaL_newmetatable
+#
+# The hashes are computed with a fixed seed, the hash of all the strings, that
+# the Lua states use instead of a random one (see Lua/common/lromstr.h).
+#
+# This file must be kept in sync with luaS_hash in lstring.c, and with the
+# reserved words of llex.c (extra is the token number).
+#
+
+from __future__ import print_function
+
+import re
+import sys
+
+from gen_rotable_index import MAP_RE, MAX_ENTRIES, c_string, fnv1a, \
+    map_entries, parse_map, pow2, skip_literal
+
+MASK32 = 0xffffffff
+LUAI_MAXSHORTLEN = 40   # llimits.h
+LUAI_HASHLIMIT = 5      # lstring.c
+
+LITERALS_RE = r'((?:"(?:[^"\\]|\\.)*"\s*)+)'
+ARRAY_RE = r'\b%s\s*\[\s*\]\s*=\s*\{'
+NAME_RE = re.compile(r'^[A-Za-z_]\w*$')
+
+# Functions with a string literal argument, and its position
+CALLS = {
+    'luaS_new': 1,
+    'luaS_newlstr': 1,      # luaS_newliteral
+    'lua_pushstring': 1,    # lua_pushliteral
+    'lua_getglobal': 1,
+    'lua_setglobal': 1,
+    'lua_getfield': 2,
+    'lua_setfield': 2,
+    'luaL_getmetafield': 2,
+    'luaL_newmetatable': 1,
+}
+CALL_RE = re.compile(r'\b(%s)\s*\(' % '|'.join(CALLS))
+LITERAL_ARG_RE = re.compile(r'^\(*\s*' + LITERALS_RE + r'\)*$')
+
+
+def lua_hash(s, seed):
+    """luaS_hash"""
+    l = len(s)
+    h = (seed ^ l) & MASK32
+    step = (l >> LUAI_HASHLIMIT) + 1
+    while l >= step:
+        h ^= ((h << 5) + (h >> 2) + s[l - 1]) & MASK32
+        l -= step
+    return h
+
+
+def call_args(src, start):
+    """Split the arguments of the call that starts after the '(' at start."""
+    args = []
+    depth = 1
+    i = begin = start
+    while depth:
+        c = src[i]
+        if c in '"\'':
+            i = skip_literal(src, i)
+            continue
+        if c == '(':
+            depth += 1
+        elif c == ')':
+            depth -= 1
+        elif c == ',' and depth == 1:
+            args.append(src[begin:i].strip())
+            begin = i + 1
+        i += 1
+    args.append(src[begin:i - 1].strip())
+    return args
+
+
+def array_literals(src, name):
+    """The string literals of the initializer of the array name."""
+    m = re.search(ARRAY_RE % name, src)
+    if not m:
+        return None
+    return [c_string(e) for e in re.findall(r'"(?:[^"\\]|\\.)*"', src[m.end():src.index('}', m.end())])]
+
+
+def c_literal(s):
+    out = ''
+    for c in s:
+        if c in (34, 92, 63):   # " \ ?
+            out += '\\' + chr(c)
+        elif 32 <= c < 127:
+            out += chr(c)
+        else:
+            out += '\\%03o' % c
+    return '"' + out + '"'
+
+
+def main(argv):
+    if len(argv) > 1:
+        src = ''
+        for name in argv[1:]:
+            with open(name) as f:
+                src += f.read()
+    else:
+        src = sys.stdin.read()
+
+    strings = set()
+    extra = {}
+
+    tokens = array_literals(src, 'luaX_tokens')
+    events = array_literals(src, 'luaT_eventname')
+    if tokens is None or events is None:
+        print('gen_rom_strings.py: llex.c and ltm.c are not in the sources', file=sys.stderr)
+        return 1
+
+    # Reserved words are the tokens before the first symbol
+    for i, t in enumerate(tokens):
+        if not NAME_RE.match(bytes(bytearray(t)).decode('latin-1')):
+            break
+        extra[tuple(t)] = i + 1
+
+    for s in tokens[:len(extra)] + events:
+        strings.add(tuple(s))
+
+    for m in MAP_RE.finditer(src):
+        keys = parse_map(map_entries(src, m.end()))
+        if len(keys) <= MAX_ENTRIES:
+            strings.update(tuple(k) for k in keys if k is not None)
+
+    for m in CALL_RE.finditer(src):
+        args = call_args(src, m.end())
+        pos = CALLS[m.group(1)]
+        if len(args) <= pos:
+            continue
+        lit = LITERAL_ARG_RE.match(args[pos])
+        if not lit:
+            continue
+        if m.group(1) == 'luaS_newlstr' and 'sizeof' not in args[pos + 1]:
+            continue
+        strings.add(tuple(c_string(lit.group(1))))
+
+    strings = sorted(s for s in strings if len(s) <= LUAI_MAXSHORTLEN)
+
+    seed = 0x811c9dc5
+    for s in strings:
+        seed = fnv1a(list(s) + [0], seed)
+
+    # Load under 1/2, as most of the strings looked up are not in ROM
+    size = pow2(len(strings) * 2)
+    slots = [None] * size
+    for n, s in enumerate(strings):
+        i = lua_hash(s, seed) & (size - 1)
+        while slots[i] is not None:
+            i = (i + 1) & (size - 1)
+        slots[i] = n
+
+    print('/* Generated by gen_rom_strings.py, do not edit */')
+    print('')
+    print('#define LUA_ROM_STRINGS %d' % len(strings))
+    print('#define LUA_ROM_STRINGS_SEED 0x%08xU' % seed)
+    print('#define LUA_ROM_STRINGS_MASK %d' % (size - 1))
+    print('')
+
+    print('static const struct {')
+    for n, s in enumerate(strings):
+        print('\tLROMSTR_TYPE(%d) s%d;' % (len(s), n))
+    print('} lromstr_rom = {')
+    for n, s in enumerate(strings):
+        print('\tLROMSTR_INIT(0x%08xU, %d, %d, %s),' %
+              (lua_hash(s, seed), extra.get(s, 0), len(s), c_literal(s)))
+    print('};')
+    print('')
+
+    print('static TString *const lromstr_strt[] = {')
+    for i in range(0, size, 8):
+        print('\t' + ' '.join('LROMSTR_SLOT(s%d),' % n if n is not None else 'NULL,'
+                              for n in slots[i:i + 8]))
+    print('};')
+
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv))
@@ -0,0 +1,235 @@
+#!/usr/bin/env python
+#
+# Lua RTOS, rotable perfect hash index generator
+#
+# Copyright (C) 2015 - 2017 LoBo
+#
+# Author: LoBo (loboris@gmail.com / https://github.com/loboris)
+#
+# Reads the preprocessed sources of the Lua modules (gcc -E output) from the
+# files passed as arguments, or from stdin, finds every luaR_entry array
+# (LUA_REG_TYPE maps) and writes to stdout a C header with a perfect hash
+# index for the string keys of each one of them.
+#
+# The indexes are not bound to the maps by symbol (maps are static) but by
+# signature: the number of entries, and the hash of all string keys. At run
+# time luaR_hindex_init computes the signature of each reachable map, finds
+# its index, and checks it before use. Any mismatch simply falls back to the
+# linear search.
+#
+# This file must be kept in sync with luaR_hash / luaR_slot in lrotable.c.
+#
+
+from __future__ import print_function
+
+import re
+import sys
+
+MAX_ENTRIES = 254   # slots hold entry position + 1 in an uint8_t
+MAX_DISP = 256      # displacements are stored in an uint8_t
+MASK32 = 0xffffffff
+
+MAP_RE = re.compile(r'\bluaR_entry\s+(\w+)\s*\[\s*\]\s*=\s*\{')
+STRKEY_RE = re.compile(r'\.strkey\s*=\s*((?:"(?:[^"\\]|\\.)*"\s*)+)')
+STRPART_RE = re.compile(r'"((?:[^"\\]|\\.)*)"')
+NUMKEY_RE = re.compile(r'\.numkey\s*=')
+
+ESCAPES = {'n': 10, 't': 9, 'r': 13, '0': 0, '\\': 92, '"': 34, "'": 39,
+           'a': 7, 'b': 8, 'f': 12, 'v': 11, '?': 63}
+
+
+def fnv1a(data, h=0x811c9dc5):
+    for c in data:
+        h = ((h ^ c) * 0x01000193) & MASK32
+    return h
+
+
+def slot(h, d, mask):
+    x = ((h ^ ((d * 0x9e3779b1) & MASK32)) * 0x85ebca6b) & MASK32
+    x ^= x >> 13
+    return x & mask
+
+
+def c_string(literal):
+    """Decode the (concatenated) C string literal into a list of bytes."""
+    out = []
+    for part in STRPART_RE.findall(literal):
+        i = 0
+        while i < len(part):
+            c = part[i]
+            if c != '\\':
+                out.extend(bytearray(c.encode('utf-8')))
+                i += 1
+                continue
+            e = part[i + 1]
+            if e == 'x':
+                m = re.match(r'[0-9a-fA-F]+', part[i + 2:])
+                out.append(int(m.group(0), 16) & 0xff)
+                i += 2 + len(m.group(0))
+            elif e in '01234567':
+                m = re.match(r'[0-7]{1,3}', part[i + 1:])
+                out.append(int(m.group(0), 8) & 0xff)
+                i += 1 + len(m.group(0))
+            else:
+                out.append(ESCAPES[e])
+                i += 2
+    return out
+
+
+def skip_literal(src, i):
+    """Return the position after the string / char literal that starts at i."""
+    q = src[i]
+    i += 1
+    while src[i] != q:
+        i += 2 if src[i] == '\\' else 1
+    return i + 1
+
+
+def map_entries(src, start):
+    """Split the initializer that starts after the '{' at start in entries."""
+    entries = []
+    depth = 1
+    i = start
+    begin = None
+    while depth:
+        c = src[i]
+        if c in '"\'':
+            i = skip_literal(src, i)
+            continue
+        if c == '{':
+            if depth == 1:
+                begin = i
+            depth += 1
+        elif c == '}':
+            depth -= 1
+            if depth == 1:
+                entries.append(src[begin:i + 1])
+        i += 1
+    return entries
+
+
+def parse_map(entries):
+    """Return the list of keys of a map (None for non string keys)."""
+    keys = []
+    for entry in entries:
+        m = STRKEY_RE.search(entry)
+        if m:
+            keys.append(c_string(m.group(1)))
+        elif NUMKEY_RE.search(entry):
+            keys.append(None)
+        else:
+            # LNILKEY, end of map
+            break
+    return keys
+
+
+def signature(keys):
+    h = fnv1a(bytearray(), 0x811c9dc5 ^ len(keys))
+    for k in keys:
+        if k is not None:
+            h = fnv1a(k + [0], h)
+    return h
+
+
+def pow2(n):
+    p = 1
+    while p < n:
+        p <<= 1
+    return p
+
+
+def build_index(keys):
+    """Hash and displace: returns (size_mask, bucket_mask, disp, slots)."""
+    hashed = []
+    seen = set()
+    for pos, k in enumerate(keys):
+        if k is None or tuple(k) in seen:
+            # Duplicated keys resolve to the first one, as linear search does
+            continue
+        seen.add(tuple(k))
+        hashed.append((fnv1a(k), pos))
+
+    size = pow2(max(len(hashed), 1))
+    if len(hashed) * 4 > size * 3:
+        size <<= 1
+
+    while True:
+        buckets = pow2(max(len(hashed) // 2, 1))
+        groups = [[] for _ in range(buckets)]
+        for h, pos in hashed:
+            groups[h & (buckets - 1)].append((h, pos))
+
+        slots = [0] * size
+        disp = [0] * buckets
+        ok = True
+        for b in sorted(range(buckets), key=lambda b: -len(groups[b])):
+            if not groups[b]:
+                break
+            for d in range(MAX_DISP):
+                taken = [slot(h, d, size - 1) for h, _ in groups[b]]
+                if len(set(taken)) == len(taken) and \
+                        all(not slots[s] for s in taken):
+                    break
+            else:
+                ok = False
+                break
+            disp[b] = d
+            for s, (_, pos) in zip(taken, groups[b]):
+                slots[s] = pos + 1
+        if ok:
+            return size - 1, buckets - 1, disp, slots
+        size <<= 1
+
+
+def c_array(values):
+    lines = []
+    for i in range(0, len(values), 16):
+        lines.append('\t' + ', '.join(str(v) for v in values[i:i + 16]) + ',')
+    return '\n'.join(lines)
+
+
+def main(argv):
+    if len(argv) > 1:
+        src = ''
+        for name in argv[1:]:
+            with open(name) as f:
+                src += f.read()
+    else:
+        src = sys.stdin.read()
+
+    maps = {}
+    for m in MAP_RE.finditer(src):
+        keys = parse_map(map_entries(src, m.end()))
+        if len(keys) > MAX_ENTRIES or not any(k is not None for k in keys):
+            continue
+        sign = signature(keys)
+        if sign not in maps:
+            maps[sign] = (m.group(1), keys)
+
+    print('/* Generated by gen_rotable_index.py, do not edit */')
+    print('')
+    print('#define LUA_ROTABLE_INDEX_MAPS %d' % len(maps))
+    print('')
+
+    indexes = []
+    for n, sign in enumerate(sorted(maps)):
+        name, keys = maps[sign]
+        size_mask, bucket_mask, disp, slots = build_index(keys)
+        print('// %s' % name)
+        print('static const uint8_t luaR_hindex_disp_%d[] = {\n%s\n};' % (n, c_array(disp)))
+        print('static const uint8_t luaR_hindex_slots_%d[] = {\n%s\n};' % (n, c_array(slots)))
+        print('')
+        indexes.append('\t{0x%08xU, %d, %d, %d, luaR_hindex_disp_%d, luaR_hindex_slots_%d},' %
+                       (sign, len(keys), size_mask, bucket_mask, n, n))
+
+    # Sorted by signature, for a binary search
+    print('static const luaR_hindex luaR_hindex_maps[] = {')
+    print('\n'.join(indexes))
+    print('\t{0, 0, 0, 0, NULL, NULL}')
+    print('};')
+
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv))
@@ -10,4 +10,54 @@ COMPONENT_SRCDIRS := . luartos_build.h freertos vfs editor sys unix syscalls mat
 COMPONENT_ADD_INCLUDEDIRS := . ./../spiffs include/freertos Lua/adds Lua/common Lua/modules Lua/platform Lua/src \
 							   lmic ./../ vfs
 							   
-COMPONENT_PRIV_INCLUDEDIRS := 
\ No newline at end of file
+COMPONENT_PRIV_INCLUDEDIRS := 
+
+PYTHON ?= python
+
+#
+# Preprocessed sources of the Lua core and modules, read by the generators of
+# Lua/tools. lrotable.c and lromstr.c have no maps, and include their output.
+#
+LUA_SOURCES_I := $(BUILD_DIR_BASE)/lua_rtos/lua_sources.i
+LUA_SOURCES := $(filter-out %/lrotable.c %/lromstr.c,$(wildcard $(addprefix $(COMPONENT_PATH)/,Lua/src/*.c Lua/common/*.c Lua/modules/*.c Lua/modules/screen/*.c)))
+
+$(LUA_SOURCES_I): $(LUA_SOURCES) $(SDKCONFIG_MAKEFILE)
+	$(summary) CPP $(notdir $@)
+	rm -f $@
+	for src in $(LUA_SOURCES); do \
+		$(CC) -E $(CFLAGS) $(filter-out -MMD -MP,$(CPPFLAGS)) $(addprefix -I ,$(COMPONENT_INCLUDES)) $(addprefix -I ,$(COMPONENT_EXTRA_INCLUDES)) $$src >> $@ || exit 1; \
+	done
+
+COMPONENT_EXTRA_CLEAN := lua_sources.i
+
+ifdef CONFIG_LUA_RTOS_LUA_USE_ROTABLE_INDEX
+#
+# Perfect hash indexes for the Lua readonly tables (see Lua/tools/gen_rotable_index.py)
+#
+ROTABLE_INDEX := $(BUILD_DIR_BASE)/lua_rtos/rotable_index.h
+
+$(ROTABLE_INDEX): $(LUA_SOURCES_I) $(COMPONENT_PATH)/Lua/tools/gen_rotable_index.py
+	$(summary) ROTABLE_INDEX $(notdir $@)
+	$(PYTHON) $(COMPONENT_PATH)/Lua/tools/gen_rotable_index.py $< > $@
+
+Lua/common/lrotable.o: $(ROTABLE_INDEX)
+Lua/common/lrotable.o: CFLAGS += -I$(BUILD_DIR_BASE)/lua_rtos
+
+COMPONENT_EXTRA_CLEAN += rotable_index.h
+endif
+
+ifdef CONFIG_LUA_RTOS_LUA_USE_ROM_STRINGS
+#
+# Lua strings in ROM (see Lua/tools/gen_rom_strings.py)
+#
+ROM_STRINGS := $(BUILD_DIR_BASE)/lua_rtos/rom_strings.h
+
+$(ROM_STRINGS): $(LUA_SOURCES_I) $(COMPONENT_PATH)/Lua/tools/gen_rom_strings.py $(COMPONENT_PATH)/Lua/tools/gen_rotable_index.py
+	$(summary) ROM_STRINGS $(notdir $@)
+	$(PYTHON) $(COMPONENT_PATH)/Lua/tools/gen_rom_strings.py $< > $@
+
+Lua/common/lromstr.o: $(ROM_STRINGS)
+Lua/common/lromstr.o: CFLAGS += -I$(BUILD_DIR_BASE)/lua_rtos
+
+COMPONENT_EXTRA_CLEAN += rom_strings.h
+endif
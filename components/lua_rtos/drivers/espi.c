@@ -57,6 +57,7 @@ Direct transfer to SPI device is possible which can coexist with queued data tra
 
 
 #include "drivers/espi.h"
+#include "drivers/espi_disp.h"
 #include <string.h>
 #include <stdio.h>
 #include "soc/gpio_sig_map.h"
@@ -90,6 +91,7 @@ typedef struct spi_device_t spi_device_t;
 #define NO_CS 3					// Number of CS pins per SPI host
 #define NO_DEV 6				// Number of spi devices per SPI host
 #define SPI_SEMAPHORE_WAIT 2000 // Time in ms to wait for semaphore
+#define DISP_DMA_YIELD_SIZE 4096 // Display DMA transfers with at least this bytes wait for the interrupt
 
 // Driver message errors
 DRIVER_REGISTER_ERROR(ESPI, espi, CannotSetup, "can't setup",  ESPI_ERR_CANT_INIT);
@@ -110,6 +112,9 @@ typedef struct {
     bool no_gpio_matrix;
 	QueueHandle_t spi_bus_mutex;
 	spi_bus_config_t cur_bus_config;
+	disp_dma_t *disp;                // display pixel pipeline, allocated on first use
+	SemaphoreHandle_t disp_done;     // given by the interrupt at the end of a display DMA transfer
+	volatile uint8_t disp_intr;      // 1 if the interrupt is enabled for a display DMA transfer
 } spi_host_t;
 
 struct spi_device_t {
@@ -395,6 +400,10 @@ static esp_err_t spi_bus_free(spi_host_device_t host, int dofree)
     periph_module_disable(io_signal[host].module);
     if (dofree) {
 		vSemaphoreDelete(spihost[host]->spi_bus_mutex);
+		if (spihost[host]->disp) {
+			vSemaphoreDelete(spihost[host]->disp_done);
+			free(spihost[host]->disp);
+		}
 		free(spihost[host]);
 		spihost[host]=NULL;
     }
@@ -604,6 +613,15 @@ static void IRAM_ATTR spi_intr(void *arg)
     //Ignore all but the trans_done int.
     if (!host->hw->slave.trans_done) return;
 
+    //End of a display DMA transfer, trans_done is left set, as when idle.
+    if (host->disp_intr) {
+        host->disp_intr=0;
+        esp_intr_disable(host->intr);
+        xSemaphoreGiveFromISR(host->disp_done, &do_yield);
+        if (do_yield) portYIELD_FROM_ISR();
+        return;
+    }
+
     if (host->cur_trans) {
         //Okay, transaction is done. 
         if ((host->cur_trans->rx_buffer || (host->cur_trans->flags & SPI_TRANS_USE_RXDATA)) && host->cur_trans->rxlength<=THRESH_DMA_TRANS) {
@@ -997,6 +1015,9 @@ esp_err_t spi_device_deselect(spi_device_handle_t handle)
 		if (host->device[i] == handle) break;
 	}
 	SPI_CHECK(i != NO_DEV, "invalid dev handle", ESP_ERR_INVALID_ARG);
+
+	// Display transfers can be in progress
+	disp_spi_transfer_wait(handle);
 	
 	if (host->device[host->cur_device] == handle) {
 		if ((handle->cfg.spics_io_num < 0) && (handle->cfg.spics_ext_io_num > 0)) {
@@ -1206,6 +1227,8 @@ void IRAM_ATTR spi_transfer_data(spi_device_handle_t handle, uint8_t *data, uint
 	uint32_t rdcount = rdlen;
 	uint32_t rd_read = 0;
 
+	disp_spi_transfer_wait(handle);
+
 	host->hw->user.usr_mosi_highpart = 0;
 	if ((data != NULL) && (wrlen > 0)) host->hw->user.usr_mosi = 1;
 	else host->hw->user.usr_mosi = 0;
@@ -1373,7 +1396,7 @@ static void IRAM_ATTR disp_spi_transfer_start(spi_device_handle_t handle, int bi
 //----------------------------------------------------------------------------
 void IRAM_ATTR disp_spi_transfer_cmd(spi_device_handle_t handle, int8_t cmd) {
 	// Wait for SPI bus ready
-	while (handle->host->hw->cmd.usr);
+	disp_spi_transfer_wait(handle);
     // Set DC to 0 (command mode);
     gpio_set_level(handle->cfg.spidc_io_num, 0);
 
@@ -1390,7 +1413,7 @@ void IRAM_ATTR disp_spi_transfer_addrwin(spi_device_handle_t handle, uint16_t x1
 	uint32_t wd;
 
 	// Wait for SPI bus ready
-	while (handle->host->hw->cmd.usr);
+	disp_spi_transfer_wait(handle);
 	disp_spi_transfer_cmd(handle, TFT_CASET);
 
 	wd = (uint32_t)(x1>>8);
@@ -1433,7 +1456,7 @@ void IRAM_ATTR disp_spi_transfer_pixel(spi_device_handle_t handle, uint16_t colo
 	uint32_t wd;
 
 	// Wait for SPI bus ready
-	while (handle->host->hw->cmd.usr);
+	disp_spi_transfer_wait(handle);
 	disp_spi_transfer_cmd(handle, TFT_RAMWR);
 
 	//wd = (uint32_t)color;
@@ -1459,11 +1482,9 @@ void IRAM_ATTR disp_spi_set_pixel(spi_device_handle_t handle, uint16_t x, uint16
 	disp_spi_transfer_pixel(handle, color);
 }
 
-// If rep==true  repeat sending color data to display 'len' times
-// If rep==false send 'len' color data from color buffer to display
-// address window must be already set
-//---------------------------------------------------------------------------------------------------------------
-void IRAM_ATTR disp_spi_transfer_color_rep(spi_device_handle_t handle, uint8_t *color, uint32_t len, uint8_t rep)
+// Send color data with the SPI data buffer, 64 bytes per transfer (see disp_spi_transfer_color_async)
+//-------------------------------------------------------------------------------------------------------------------------
+static void IRAM_ATTR disp_spi_transfer_color_pio(spi_device_handle_t handle, uint8_t *color, uint32_t len, uint8_t rep)
 {
 	spi_host_t *host=(spi_host_t*)handle->host;
 	uint8_t idx;
@@ -1475,12 +1496,6 @@ void IRAM_ATTR disp_spi_transfer_color_rep(spi_device_handle_t handle, uint8_t *
 	idx = 0;
 	count = 0;
 
-	// Wait for SPI bus ready
-	while (host->hw->cmd.usr);
-	disp_spi_transfer_cmd(handle, TFT_RAMWR);
-    // Set DC to 1 (data mode);
-	gpio_set_level(handle->cfg.spidc_io_num, 1);
-
 	while (count < len) {
 		if (rep) {
 			// get color data
@@ -1530,3 +1545,155 @@ void IRAM_ATTR disp_spi_transfer_color_rep(spi_device_handle_t handle, uint8_t *
 	// Wait for SPI bus ready
 	while (handle->host->hw->cmd.usr);
 }
+
+// Allocates the display pixel pipeline of a host, returns NULL if there is not enough memory
+//--------------------------------------------------
+static disp_dma_t *disp_spi_dma(spi_host_t *host) {
+	disp_dma_t *dma;
+
+	if (host->disp) return host->disp;
+
+	// Descriptors and buffers must be in DMA capable memory
+	dma = pvPortMallocCaps(DISP_DMA_SIZE, MALLOC_CAP_DMA);
+	if (!dma) return NULL;
+
+	host->disp_done = xSemaphoreCreateBinary();
+	if (!host->disp_done) {
+		free(dma);
+		return NULL;
+	}
+
+	disp_dma_init(dma, host);
+	host->disp = dma;
+
+	return dma;
+}
+
+// Start a display DMA transfer, called by the pixel pipeline (see espi_disp.h)
+//----------------------------------------------------------------------------------------
+void IRAM_ATTR espi_disp_dma_start(disp_dma_t *dma, lldesc_t *desc, uint32_t bits) {
+	spi_host_t *host=(spi_host_t*)dma->dev;
+
+	//Reset DMA
+	host->hw->dma_conf.val |= SPI_OUT_RST|SPI_AHBM_RST|SPI_AHBM_FIFO_RST;
+	host->hw->dma_out_link.start=0;
+	host->hw->dma_in_link.start=0;
+	host->hw->dma_conf.val &= ~(SPI_OUT_RST|SPI_AHBM_RST|SPI_AHBM_FIFO_RST);
+
+	host->hw->user.usr_mosi_highpart=0;
+	host->hw->dma_out_link.addr=(int)desc & 0xFFFFF;
+	host->hw->dma_out_link.start=1;
+	host->hw->mosi_dlen.usr_mosi_dbitlen=bits-1;
+	host->hw->miso_dlen.usr_miso_dbitlen=0;
+	host->hw->user.usr_mosi=1;
+	host->hw->user.usr_miso=0;
+
+	if (bits >= DISP_DMA_YIELD_SIZE * 8) {
+		// Long transfer, the CPU is released until the interrupt
+		xSemaphoreTake(host->disp_done, 0);
+		host->hw->slave.trans_done=0;
+		host->disp_intr=1;
+		esp_intr_enable(host->intr);
+	}
+
+	// Start transfer
+	host->hw->cmd.usr=1;
+}
+
+// Wait for the end of a display DMA transfer, called by the pixel pipeline (see espi_disp.h)
+//-------------------------------------------------------
+void IRAM_ATTR espi_disp_dma_wait(disp_dma_t *dma) {
+	spi_host_t *host=(spi_host_t*)dma->dev;
+
+	if (host->disp_intr) {
+		if (!xSemaphoreTake(host->disp_done, SPI_SEMAPHORE_WAIT)) {
+			esp_intr_disable(host->intr);
+			host->disp_intr=0;
+		}
+	}
+
+	// Wait for SPI bus ready
+	while (host->hw->cmd.usr);
+
+	// Next transfers use the SPI data buffer
+	host->hw->dma_conf.val |= SPI_OUT_RST|SPI_AHBM_RST|SPI_AHBM_FIFO_RST;
+	host->hw->dma_out_link.start=0;
+	host->hw->dma_conf.val &= ~(SPI_OUT_RST|SPI_AHBM_RST|SPI_AHBM_FIFO_RST);
+}
+
+// Wait for the end of the display transfer in progress, if any
+//-----------------------------------------------------------------
+void IRAM_ATTR disp_spi_transfer_wait(spi_device_handle_t handle) {
+	spi_host_t *host=(spi_host_t*)handle->host;
+
+	if (host->disp) disp_dma_wait(host->disp);
+
+	// Wait for SPI bus ready
+	while (host->hw->cmd.usr);
+}
+
+// If rep==true  repeat sending color data to display 'len' times
+// If rep==false send 'len' color data from color buffer to display
+// address window must be already set
+// Returns when the last block of data is on the wire, use disp_spi_transfer_wait
+// to wait for the end of the transfer. The color buffer can be reused at return.
+//-----------------------------------------------------------------------------------------------------------------
+void IRAM_ATTR disp_spi_transfer_color_async(spi_device_handle_t handle, uint8_t *color, uint32_t len, uint8_t rep)
+{
+	spi_host_t *host=(spi_host_t*)handle->host;
+	disp_dma_t *dma;
+
+	// Wait for SPI bus ready
+	disp_spi_transfer_wait(handle);
+	disp_spi_transfer_cmd(handle, TFT_RAMWR);
+    // Set DC to 1 (data mode);
+	gpio_set_level(handle->cfg.spidc_io_num, 1);
+
+	// Short transfers are not worth a DMA setup
+	if (((len << 1) >= DISP_DMA_MIN_BYTES) && (dma = disp_spi_dma(host))) {
+		disp_dma_transfer(dma, color, len, rep);
+	} else {
+		disp_spi_transfer_color_pio(handle, color, len, rep);
+	}
+}
+
+// Send the w x h color data from color buffer, that has stride pixels per row, to display
+// address window must be already set
+// Returns as disp_spi_transfer_color_async
+//-----------------------------------------------------------------------------------------------------------------------------------
+void IRAM_ATTR disp_spi_transfer_rect_async(spi_device_handle_t handle, uint8_t *color, uint32_t w, uint32_t h, uint32_t stride)
+{
+	spi_host_t *host=(spi_host_t*)handle->host;
+	disp_dma_t *dma;
+
+	if ((w == stride) || (h == 1)) {
+		disp_spi_transfer_color_async(handle, color, w * h, 0);
+		return;
+	}
+
+	// Wait for SPI bus ready
+	disp_spi_transfer_wait(handle);
+	disp_spi_transfer_cmd(handle, TFT_RAMWR);
+    // Set DC to 1 (data mode);
+	gpio_set_level(handle->cfg.spidc_io_num, 1);
+
+	if (((w * h << 1) >= DISP_DMA_MIN_BYTES) && (dma = disp_spi_dma(host))) {
+		disp_dma_transfer_rect(dma, color, w, h, stride);
+	} else {
+		while (h > 0) {
+			disp_spi_transfer_color_pio(handle, color, w, 0);
+			color += stride << 1;
+			h--;
+		}
+	}
+}
+
+// If rep==true  repeat sending color data to display 'len' times
+// If rep==false send 'len' color data from color buffer to display
+// address window must be already set
+//---------------------------------------------------------------------------------------------------------------
+void IRAM_ATTR disp_spi_transfer_color_rep(spi_device_handle_t handle, uint8_t *color, uint32_t len, uint8_t rep)
+{
+	disp_spi_transfer_color_async(handle, color, len, rep);
+	disp_spi_transfer_wait(handle);
+}
@@ -316,6 +316,9 @@ void disp_spi_transfer_addrwin(spi_device_handle_t handle, uint16_t x1, uint16_t
 void disp_spi_set_pixel(spi_device_handle_t handle, uint16_t x, uint16_t y, uint16_t color);
 void disp_spi_transfer_pixel(spi_device_handle_t handle, uint16_t color);
 void disp_spi_transfer_color_rep(spi_device_handle_t handle, uint8_t *color, uint32_t len, uint8_t rep);
+void disp_spi_transfer_color_async(spi_device_handle_t handle, uint8_t *color, uint32_t len, uint8_t rep);
+void disp_spi_transfer_rect_async(spi_device_handle_t handle, uint8_t *color, uint32_t w, uint32_t h, uint32_t stride);
+void disp_spi_transfer_wait(spi_device_handle_t handle);
 
 
 #ifdef __cplusplus
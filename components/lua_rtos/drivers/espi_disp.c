@@ -0,0 +1,179 @@
+/*
+ * Lua RTOS, ESPI display pixel pipeline
+ *
+ * Copyright (C) 2015 - 2017
+ *
+ * Author: LoBo (loboris@gmail.com, https://github.com/loboris )
+ *
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software
+ * and its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that the copyright notice and this
+ * permission notice and warranty disclaimer appear in supporting
+ * documentation, and that the name of the author not be used in
+ * advertising or publicity pertaining to distribution of the
+ * software without specific, written prior permission.
+ *
+ * The author disclaim all warranties with regard to this
+ * software, including all implied warranties of merchantability
+ * and fitness.  In no spi shall the author be liable for any
+ * special, indirect or consequential damages or any damages
+ * whatsoever resulting from loss of use, data or profits, whether
+ * in an action of contract, negligence or other tortious action,
+ * arising out of or in connection with the use or performance of
+ * this software.
+ */
+
+#include "espi_disp.h"
+
+#include <string.h>
+
+void disp_dma_init(disp_dma_t *dma, void *dev) {
+	uint8_t *mem = (uint8_t *)(dma + 1);
+
+	memset(dma, 0, sizeof(disp_dma_t));
+
+	dma->dev = dev;
+	dma->buf[0] = mem;
+	dma->buf[1] = mem + DISP_DMA_BUF_SIZE;
+	dma->rep = mem + 2 * DISP_DMA_BUF_SIZE;
+
+	// The repeated color buffer is sent in loop, until the transfer length is reached
+	disp_dma_build(&dma->rep_desc, dma->rep, DISP_DMA_REP_SIZE, 1);
+}
+
+void disp_dma_pack(uint8_t *dst, const uint8_t *color, uint32_t count, uint8_t rep) {
+	uint32_t i;
+
+	if (!rep) {
+		memcpy(dst, color, count << 1);
+		return;
+	}
+
+	// Most significant byte goes first
+	for(i = 0;i < count;i++) {
+		*dst++ = color[1];
+		*dst++ = color[0];
+	}
+}
+
+int disp_dma_build(lldesc_t *desc, uint8_t *buf, uint32_t len, int loop) {
+	uint32_t size;
+	int n = 0;
+
+	while (len > 0) {
+		size = (len > DISP_DMA_DESC_MAX)?DISP_DMA_DESC_MAX:len;
+
+		desc[n].size = (size + 3) & ~3;
+		desc[n].length = size;
+		desc[n].offset = 0;
+		desc[n].sosf = 0;
+		desc[n].eof = 0;
+		desc[n].owner = 1;
+		desc[n].buf = buf;
+		desc[n].qe.stqe_next = NULL;
+
+		if (n > 0) {
+			desc[n - 1].qe.stqe_next = &desc[n];
+		}
+
+		buf += size;
+		len -= size;
+		n++;
+	}
+
+	if (n > 0) {
+		if (loop) {
+			desc[n - 1].qe.stqe_next = &desc[0];
+		} else {
+			desc[n - 1].eof = 1;
+		}
+	}
+
+	return n;
+}
+
+void disp_dma_wait(disp_dma_t *dma) {
+	if (dma->busy) {
+		espi_disp_dma_wait(dma);
+		dma->busy = 0;
+	}
+}
+
+static void disp_dma_start(disp_dma_t *dma, lldesc_t *desc, uint32_t pixels) {
+	disp_dma_wait(dma);
+
+	espi_disp_dma_start(dma, desc, pixels << 4);
+	dma->busy = 1;
+}
+
+void disp_dma_transfer(disp_dma_t *dma, const uint8_t *color, uint32_t len, uint8_t rep) {
+	uint16_t rep_color;
+	uint32_t count;
+
+	if (rep) {
+		rep_color = (uint16_t)color[0] | ((uint16_t)color[1] << 8);
+
+		if (!dma->rep_valid || (dma->rep_color != rep_color)) {
+			// The repeated color buffer can be on the wire
+			disp_dma_wait(dma);
+
+			disp_dma_pack(dma->rep, color, DISP_DMA_REP_SIZE >> 1, 1);
+			dma->rep_color = rep_color;
+			dma->rep_valid = 1;
+		}
+
+		while (len > 0) {
+			count = (len > DISP_DMA_MAX_PIXELS)?DISP_DMA_MAX_PIXELS:len;
+			disp_dma_start(dma, &dma->rep_desc, count);
+			len -= count;
+		}
+
+		return;
+	}
+
+	disp_dma_transfer_rect(dma, color, len, 1, len);
+}
+
+void disp_dma_transfer_rect(disp_dma_t *dma, const uint8_t *color, uint32_t w, uint32_t h, uint32_t stride) {
+	uint32_t x = 0;
+	uint32_t count;
+	uint32_t n;
+	uint8_t *buf;
+
+	if (w == 0) return;
+
+	/*
+	 * Pixels are copied to the ping-pong buffers, that are in DMA capable memory,
+	 * and it's not required for the caller buffer. While a buffer is on the wire
+	 * the other one is filled. A buffer can have many rows, or a part of a row.
+	 */
+	while (h > 0) {
+		buf = dma->buf[dma->next];
+		count = 0;
+
+		while ((h > 0) && (count < (DISP_DMA_BUF_SIZE >> 1))) {
+			n = w - x;
+			if (n > (DISP_DMA_BUF_SIZE >> 1) - count) {
+				n = (DISP_DMA_BUF_SIZE >> 1) - count;
+			}
+
+			disp_dma_pack(buf + (count << 1), color + (x << 1), n, 0);
+			count += n;
+			x += n;
+
+			if (x == w) {
+				x = 0;
+				color += stride << 1;
+				h--;
+			}
+		}
+
+		disp_dma_build(dma->desc[dma->next], buf, count << 1, 0);
+		disp_dma_start(dma, dma->desc[dma->next], count);
+
+		dma->next ^= 1;
+	}
+}
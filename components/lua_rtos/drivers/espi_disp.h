@@ -0,0 +1,124 @@
+/*
+ * Lua RTOS, ESPI display pixel pipeline
+ *
+ * Copyright (C) 2015 - 2017
+ *
+ * Author: LoBo (loboris@gmail.com, https://github.com/loboris )
+ *
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software
+ * and its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that the copyright notice and this
+ * permission notice and warranty disclaimer appear in supporting
+ * documentation, and that the name of the author not be used in
+ * advertising or publicity pertaining to distribution of the
+ * software without specific, written prior permission.
+ *
+ * The author disclaim all warranties with regard to this
+ * software, including all implied warranties of merchantability
+ * and fitness.  In no spi shall the author be liable for any
+ * special, indirect or consequential damages or any damages
+ * whatsoever resulting from loss of use, data or profits, whether
+ * in an action of contract, negligence or other tortious action,
+ * arising out of or in connection with the use or performance of
+ * this software.
+ */
+
+/*
+ * Pixels are sent to the display with DMA through two ping-pong buffers, so the
+ * CPU packs the next block of pixels while the previous one is on the wire.
+ * Repeated color fills use a small buffer filled with the color, and a looped
+ * descriptor, so a whole fill is a single transfer.
+ *
+ * This part doesn't access the hardware. Transfers are started and waited with
+ * espi_disp_dma_start / espi_disp_dma_wait, that are provided by espi.c, or by
+ * a mock SPI peripheral in the host build (see tools/host/bench/bench_disp.c).
+ */
+
+#ifndef _ESPI_DISP_H_
+#define _ESPI_DISP_H_
+
+#include <stdint.h>
+
+#include "rom/lldesc.h"
+
+// Size of each ping-pong buffer, in bytes
+#define DISP_DMA_BUF_SIZE  1024
+
+// Size of the repeated color buffer, in bytes
+#define DISP_DMA_REP_SIZE  128
+
+// Maximum number of bytes of a DMA descriptor (word aligned)
+#define DISP_DMA_DESC_MAX  4092
+
+// Number of descriptors needed for a ping-pong buffer
+#define DISP_DMA_DESCS     ((DISP_DMA_BUF_SIZE + DISP_DMA_DESC_MAX - 1) / DISP_DMA_DESC_MAX)
+
+// Maximum number of pixels of a transfer (the SPI data length has 24 bits)
+#define DISP_DMA_MAX_PIXELS (1 << 20)
+
+// Transfers with less bytes are not worth a DMA setup
+#define DISP_DMA_MIN_BYTES 64
+
+typedef struct {
+	void *dev;                                   // device, for espi_disp_dma_start / espi_disp_dma_wait
+	uint8_t *buf[2];                             // ping-pong buffers
+	uint8_t *rep;                                // repeated color buffer
+	lldesc_t desc[2][DISP_DMA_DESCS];            // ping-pong buffers descriptors
+	lldesc_t rep_desc;                           // repeated color descriptor, looped
+	uint16_t rep_color;                          // color in rep buffer
+	uint8_t rep_valid;                           // 1 if rep buffer has rep_color
+	uint8_t next;                                // next ping-pong buffer to use
+	uint8_t busy;                                // 1 if there is a transfer in progress
+} disp_dma_t;
+
+// Bytes to allocate for a disp_dma_t, that has its buffers after it
+#define DISP_DMA_SIZE (sizeof(disp_dma_t) + 2 * DISP_DMA_BUF_SIZE + DISP_DMA_REP_SIZE)
+
+/*
+ * Starts the transfer of bits bits from the descriptors chain desc. The previous
+ * transfer is done.
+ */
+void espi_disp_dma_start(disp_dma_t *dma, lldesc_t *desc, uint32_t bits);
+
+// Waits for the end of the transfer in progress
+void espi_disp_dma_wait(disp_dma_t *dma);
+
+/*
+ * Initializes dma, allocated with DISP_DMA_SIZE bytes of DMA capable memory, for
+ * the device dev.
+ */
+void disp_dma_init(disp_dma_t *dma, void *dev);
+
+/*
+ * Packs count pixels in dst, in wire order. If rep is 1 color points to an
+ * uint16_t color that is repeated, otherwise to count pixels that are already
+ * in wire order.
+ */
+void disp_dma_pack(uint8_t *dst, const uint8_t *color, uint32_t count, uint8_t rep);
+
+/*
+ * Builds a descriptors chain for the len bytes of buf in desc, that must have
+ * room for them. If loop is 1, the last descriptor points to the first one.
+ * Returns the number of descriptors used.
+ */
+int disp_dma_build(lldesc_t *desc, uint8_t *buf, uint32_t len, int loop);
+
+/*
+ * Sends len pixels (see disp_dma_pack). Returns when the last block is on the
+ * wire, use disp_dma_wait to wait for the end of the transfer.
+ */
+void disp_dma_transfer(disp_dma_t *dma, const uint8_t *color, uint32_t len, uint8_t rep);
+
+/*
+ * Sends the w x h pixels of color, that has stride pixels per row, in wire order,
+ * as a single block of pixels (see disp_dma_transfer).
+ */
+void disp_dma_transfer_rect(disp_dma_t *dma, const uint8_t *color, uint32_t w, uint32_t h, uint32_t stride);
+
+// Waits for the end of the transfer in progress, if any
+void disp_dma_wait(disp_dma_t *dma);
+
+#endif
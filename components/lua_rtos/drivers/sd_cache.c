@@ -0,0 +1,416 @@
+/*
+ * Lua RTOS, SD card sector cache
+ *
+ * Copyright (C) 2015 - 2017
+ *
+ * Author: LoBo (loboris@gmail.com, https://github.com/loboris )
+ *
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software
+ * and its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that the copyright notice and this
+ * permission notice and warranty disclaimer appear in supporting
+ * documentation, and that the name of the author not be used in
+ * advertising or publicity pertaining to distribution of the
+ * software without specific, written prior permission.
+ *
+ * The author disclaim all warranties with regard to this
+ * software, including all implied warranties of merchantability
+ * and fitness.  In no event shall the author be liable for any
+ * special, indirect or consequential damages or any damages
+ * whatsoever resulting from loss of use, data or profits, whether
+ * in an action of contract, negligence or other tortious action,
+ * arising out of or in connection with the use or performance of
+ * this software.
+ */
+
+#include "sdkconfig.h"
+
+#if CONFIG_LUA_RTOS_USE_FAT
+
+#include "sd_cache.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define entry_data(c, e) ((c)->data + (uint32_t)((e) - (c)->entry) * SD_CACHE_SECTOR_SIZE)
+
+//---------------------------------------------
+static inline uint64_t now_us(sd_cache_t *c) {
+	return c->ops->now?c->ops->now():0;
+}
+
+//---------------------------------------------------------------------------
+static void account(uint64_t t0, sd_cache_t *c, uint64_t *total, uint32_t *max) {
+	uint64_t t;
+
+	if (!c->ops->now) return;
+
+	t = c->ops->now() - t0;
+	*total += t;
+	if (t > *max) *max = (uint32_t)t;
+}
+
+//----------------------------------------------------------------------------------------
+static int card_read(sd_cache_t *c, uint32_t sector, uint8_t *buf, uint32_t count) {
+	c->stats.card_reads++;
+	c->stats.card_read_sectors += count;
+
+	return c->ops->read(c->dev, sector, buf, count);
+}
+
+//-----------------------------------------------------------------------------------------------
+static int card_write(sd_cache_t *c, uint32_t sector, const uint8_t *buf, uint32_t count) {
+	c->stats.card_writes++;
+	c->stats.card_write_sectors += count;
+
+	return c->ops->write(c->dev, sector, buf, count);
+}
+
+// The cache is small (a few tens of sectors), a linear search is as fast as a hash
+//------------------------------------------------------------------------
+static sd_cache_entry_t *lookup(sd_cache_t *c, uint32_t sector) {
+	sd_cache_entry_t *e;
+
+	for(e = c->entry;e < c->entry + c->size;e++) {
+		if (e->used && (e->sector == sector)) return e;
+	}
+
+	return NULL;
+}
+
+//------------------------------------------------------
+static void touch(sd_cache_t *c, sd_cache_entry_t *e) {
+	sd_cache_entry_t *o;
+
+	if (++c->stamp == 0) {
+		// Stamps wrapped around, the order of the entries is lost, but not the cache
+		for(o = c->entry;o < c->entry + c->size;o++) {
+			if (o->used) o->used = 1;
+		}
+		c->stamp = 2;
+	}
+
+	e->used = c->stamp;
+}
+
+/*
+ * Writes the dirty sectors that follow e (and the ones that precede it if back
+ * is 1), up to SD_CACHE_BURST sectors, with a single command.
+ */
+//---------------------------------------------------------------------
+static int write_run(sd_cache_t *c, sd_cache_entry_t *e, int back) {
+	sd_cache_entry_t *run[SD_CACHE_BURST];
+	sd_cache_entry_t *o;
+	uint32_t first = e->sector;
+	uint32_t n, i;
+
+	if (back) {
+		while ((first > 0) && (e->sector - first + 1 < SD_CACHE_BURST)) {
+			o = lookup(c, first - 1);
+			if (!o || !o->dirty) break;
+			first--;
+		}
+	}
+
+	for(n = 0;n < SD_CACHE_BURST;n++) {
+		o = lookup(c, first + n);
+		if (!o || !o->dirty) break;
+
+		run[n] = o;
+		memcpy(c->burst + n * SD_CACHE_SECTOR_SIZE, entry_data(c, o), SD_CACHE_SECTOR_SIZE);
+	}
+
+	if (card_write(c, first, c->burst, n) < 0) return -1;
+
+	for(i = 0;i < n;i++) {
+		run[i]->dirty = 0;
+	}
+	c->ndirty -= n;
+
+	return 0;
+}
+
+/*
+ * Returns a free entry for sector, evicting the least recently used one if
+ * needed. Returns NULL if the evicted sector can't be written to the card.
+ */
+//--------------------------------------------------------------------------
+static sd_cache_entry_t *alloc(sd_cache_t *c, uint32_t sector) {
+	sd_cache_entry_t *e, *lru = NULL;
+
+	for(e = c->entry;e < c->entry + c->size;e++) {
+		if (!e->used) {
+			lru = e;
+			break;
+		}
+		if (!lru || (e->used < lru->used)) lru = e;
+	}
+
+	if (lru->used && lru->dirty) {
+		// Write it along with its dirty neighbours, that would be evicted soon
+		if (write_run(c, lru, 1) < 0) return NULL;
+	}
+
+	lru->sector = sector;
+	lru->dirty = 0;
+	lru->ahead = 0;
+	touch(c, lru);
+
+	return lru;
+}
+
+//==========================================================================================================
+sd_cache_t *sd_cache_create(const sd_cache_ops_t *ops, void *dev, uint32_t nsectors, uint32_t size) {
+	sd_cache_t *c;
+
+	if (size < SD_CACHE_MIN_SIZE) size = SD_CACHE_MIN_SIZE;
+
+	c = calloc(1, sizeof(sd_cache_t));
+	if (!c) return NULL;
+
+	c->entry = calloc(size, sizeof(sd_cache_entry_t));
+	c->data = malloc(size * SD_CACHE_SECTOR_SIZE);
+	c->burst = malloc(SD_CACHE_BURST * SD_CACHE_SECTOR_SIZE);
+	if (!c->entry || !c->data || !c->burst) {
+		free(c->entry);
+		free(c->data);
+		free(c->burst);
+		free(c);
+		return NULL;
+	}
+
+	c->ops = ops;
+	c->dev = dev;
+	c->nsectors = nsectors;
+	c->size = size;
+
+	mtx_init(&c->mtx, NULL, NULL, 0);
+
+	return c;
+}
+
+//=====================================
+int sd_cache_destroy(sd_cache_t *c) {
+	int res;
+
+	res = sd_cache_sync(c);
+
+	mtx_destroy(&c->mtx);
+
+	free(c->entry);
+	free(c->data);
+	free(c->burst);
+	free(c);
+
+	return res;
+}
+
+// Reads count missing sectors from sector, and the next ahead sectors, to the cache and buf
+//------------------------------------------------------------------------------------------------------
+static int read_miss(sd_cache_t *c, uint32_t sector, uint8_t *buf, uint32_t count, uint32_t ahead) {
+	sd_cache_entry_t *run[SD_CACHE_BURST];
+	uint32_t i, n;
+
+	// Stop before a sector that is already cached, it can be dirty
+	for(n = count;n < count + ahead;n++) {
+		if (lookup(c, sector + n)) break;
+	}
+
+	// Entries are allocated first, evicting a dirty sector uses the burst buffer
+	for(i = 0;i < n;i++) {
+		run[i] = alloc(c, sector + i);
+		if (!run[i]) goto fail;
+	}
+
+	if (card_read(c, sector, c->burst, n) < 0) goto fail;
+
+	for(i = 0;i < n;i++) {
+		memcpy(entry_data(c, run[i]), c->burst + i * SD_CACHE_SECTOR_SIZE, SD_CACHE_SECTOR_SIZE);
+		run[i]->ahead = (i >= count);
+	}
+
+	memcpy(buf, c->burst, count * SD_CACHE_SECTOR_SIZE);
+
+	c->stats.read_misses += count;
+	c->stats.readahead += n - count;
+
+	return 0;
+
+fail:
+	while (i > 0) {
+		run[--i]->used = 0;
+	}
+
+	return -1;
+}
+
+//====================================================================================
+int sd_cache_read(sd_cache_t *c, uint32_t sector, uint8_t *buf, uint32_t count) {
+	sd_cache_entry_t *e;
+	uint64_t t0;
+	uint32_t i, n, ahead;
+	int seq;
+	int res = 0;
+
+	mtx_lock(&c->mtx);
+
+	t0 = now_us(c);
+	c->stats.reads++;
+
+	seq = (sector == c->next);
+
+	if (count >= SD_CACHE_BURST) {
+		// Large transfer, directly to buf, then the sectors that are newer in the cache
+		c->stats.bypass += count;
+
+		res = card_read(c, sector, buf, count);
+		if (res == 0) {
+			for(e = c->entry;e < c->entry + c->size;e++) {
+				if (e->used && e->dirty && (e->sector >= sector) && (e->sector - sector < count)) {
+					memcpy(buf + (e->sector - sector) * SD_CACHE_SECTOR_SIZE, entry_data(c, e), SD_CACHE_SECTOR_SIZE);
+				}
+			}
+		}
+	} else {
+		for(i = 0;(i < count) && (res == 0);i += n) {
+			e = lookup(c, sector + i);
+			if (e) {
+				memcpy(buf + i * SD_CACHE_SECTOR_SIZE, entry_data(c, e), SD_CACHE_SECTOR_SIZE);
+				touch(c, e);
+				if (e->ahead) {
+					e->ahead = 0;
+					c->stats.readahead_hits++;
+				}
+				c->stats.read_hits++;
+				n = 1;
+				continue;
+			}
+
+			// Run of missing sectors
+			for(n = 1;(i + n < count) && !lookup(c, sector + i + n);n++);
+
+			// Sequential reads, read ahead the sectors that follow the request
+			ahead = 0;
+			if (seq && (i + n == count)) {
+				ahead = SD_CACHE_BURST - n;
+				if (ahead > SD_CACHE_READAHEAD) ahead = SD_CACHE_READAHEAD;
+				if (sector + count + ahead > c->nsectors) {
+					ahead = (sector + count < c->nsectors)?c->nsectors - sector - count:0;
+				}
+			}
+
+			res = read_miss(c, sector + i, buf + i * SD_CACHE_SECTOR_SIZE, n, ahead);
+		}
+	}
+
+	c->next = sector + count;
+
+	account(t0, c, &c->stats.read_us, &c->stats.read_max_us);
+
+	mtx_unlock(&c->mtx);
+
+	return res;
+}
+
+//===========================================================================================
+int sd_cache_write(sd_cache_t *c, uint32_t sector, const uint8_t *buf, uint32_t count) {
+	sd_cache_entry_t *e;
+	uint64_t t0;
+	uint32_t i;
+	int res = 0;
+
+	mtx_lock(&c->mtx);
+
+	t0 = now_us(c);
+	c->stats.writes++;
+
+	if (count >= SD_CACHE_BURST) {
+		// Large transfer, directly from buf, cached copies are updated
+		c->stats.bypass += count;
+
+		res = card_write(c, sector, buf, count);
+		if (res == 0) {
+			for(e = c->entry;e < c->entry + c->size;e++) {
+				if (e->used && (e->sector >= sector) && (e->sector - sector < count)) {
+					memcpy(entry_data(c, e), buf + (e->sector - sector) * SD_CACHE_SECTOR_SIZE, SD_CACHE_SECTOR_SIZE);
+					if (e->dirty) {
+						e->dirty = 0;
+						c->ndirty--;
+					}
+				}
+			}
+		}
+	} else {
+		for(i = 0;i < count;i++) {
+			e = lookup(c, sector + i);
+			if (e) {
+				touch(c, e);
+				c->stats.write_hits++;
+			} else {
+				e = alloc(c, sector + i);
+				if (!e) {
+					res = -1;
+					break;
+				}
+				c->stats.write_misses++;
+			}
+
+			memcpy(entry_data(c, e), buf + i * SD_CACHE_SECTOR_SIZE, SD_CACHE_SECTOR_SIZE);
+			e->ahead = 0;
+			if (!e->dirty) {
+				e->dirty = 1;
+				c->ndirty++;
+			}
+		}
+	}
+
+	account(t0, c, &c->stats.write_us, &c->stats.write_max_us);
+
+	mtx_unlock(&c->mtx);
+
+	return res;
+}
+
+//==================================
+int sd_cache_sync(sd_cache_t *c) {
+	sd_cache_entry_t *e, *first;
+	int res = 0;
+
+	mtx_lock(&c->mtx);
+
+	c->stats.syncs++;
+
+	while (c->ndirty > 0) {
+		// Lowest dirty sector, its run has no dirty sectors before it
+		first = NULL;
+		for(e = c->entry;e < c->entry + c->size;e++) {
+			if (e->used && e->dirty && (!first || (e->sector < first->sector))) first = e;
+		}
+
+		res = write_run(c, first, 0);
+		if (res < 0) break;
+	}
+
+	mtx_unlock(&c->mtx);
+
+	return res;
+}
+
+//===============================================================
+void sd_cache_get_stats(sd_cache_t *c, sd_cache_stats_t *stats) {
+	mtx_lock(&c->mtx);
+	*stats = c->stats;
+	mtx_unlock(&c->mtx);
+}
+
+//=========================================
+void sd_cache_reset_stats(sd_cache_t *c) {
+	mtx_lock(&c->mtx);
+	memset(&c->stats, 0, sizeof(sd_cache_stats_t));
+	mtx_unlock(&c->mtx);
+}
+
+#endif
@@ -0,0 +1,136 @@
+/*
+ * Lua RTOS, SD card sector cache
+ *
+ * Copyright (C) 2015 - 2017
+ *
+ * Author: LoBo (loboris@gmail.com, https://github.com/loboris )
+ *
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software
+ * and its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that the copyright notice and this
+ * permission notice and warranty disclaimer appear in supporting
+ * documentation, and that the name of the author not be used in
+ * advertising or publicity pertaining to distribution of the
+ * software without specific, written prior permission.
+ *
+ * The author disclaim all warranties with regard to this
+ * software, including all implied warranties of merchantability
+ * and fitness.  In no event shall the author be liable for any
+ * special, indirect or consequential damages or any damages
+ * whatsoever resulting from loss of use, data or profits, whether
+ * in an action of contract, negligence or other tortious action,
+ * arising out of or in connection with the use or performance of
+ * this software.
+ */
+
+/*
+ * A write-back LRU cache of card sectors, between FATFS and the card driver.
+ *
+ * FATFS reads the FAT and directory sectors again on each file operation, they
+ * are served from RAM. Writes stay in the cache until the sector is evicted or
+ * the cache is synced (FATFS syncs on f_sync / f_close), and adjacent dirty
+ * sectors are written with a single multiple block write command. When reads
+ * are sequential, the sectors that follow the requested ones are read in the
+ * same command. Transfers of SD_CACHE_BURST sectors or more bypass the cache.
+ *
+ * This part doesn't access the hardware, sectors are read and written with the
+ * functions of a sd_cache_ops_t, provided by vfs/fat.c over the SDMMC driver,
+ * or by a file-backed card image in the host build (see
+ * tools/host/bench/bench_sdcache.c).
+ */
+
+#ifndef _SD_CACHE_H_
+#define _SD_CACHE_H_
+
+#include <stdint.h>
+
+#include <sys/mutex.h>
+
+#define SD_CACHE_SECTOR_SIZE 512
+
+// Maximum number of sectors of a command sent by the cache
+#define SD_CACHE_BURST       8
+
+// Maximum number of sectors read ahead on a sequential read
+#define SD_CACHE_READAHEAD   4
+
+// Minimum number of cached sectors
+#define SD_CACHE_MIN_SIZE    (2 * SD_CACHE_BURST)
+
+typedef struct {
+	// Read / write count sectors, from sector. Returns 0 on success, -1 on error.
+	int (*read)(void *dev, uint32_t sector, uint8_t *buf, uint32_t count);
+	int (*write)(void *dev, uint32_t sector, const uint8_t *buf, uint32_t count);
+
+	// Current time in microseconds, for the latency counters, can be NULL
+	uint64_t (*now)(void);
+} sd_cache_ops_t;
+
+typedef struct {
+	uint32_t reads;             // read requests
+	uint32_t writes;            // write requests
+	uint32_t syncs;             // sync requests
+	uint32_t read_hits;         // sectors read from the cache
+	uint32_t read_misses;       // sectors read from the card
+	uint32_t write_hits;        // sectors written to a cached sector
+	uint32_t write_misses;      // sectors written to a new cache entry
+	uint32_t bypass;            // sectors of requests that bypassed the cache
+	uint32_t readahead;         // sectors read ahead
+	uint32_t readahead_hits;    // sectors read ahead, then read
+	uint32_t card_reads;        // read commands sent to the card
+	uint32_t card_writes;       // write commands sent to the card
+	uint32_t card_read_sectors; // sectors read from the card
+	uint32_t card_write_sectors;// sectors written to the card
+	uint64_t read_us;           // total time of read requests
+	uint64_t write_us;          // total time of write requests
+	uint32_t read_max_us;       // maximum time of a read request
+	uint32_t write_max_us;      // maximum time of a write request
+} sd_cache_stats_t;
+
+typedef struct {
+	uint32_t sector;            // sector number
+	uint32_t used;              // LRU stamp, 0 if the entry is free
+	uint8_t dirty;              // 1 if the sector must be written to the card
+	uint8_t ahead;              // 1 if read ahead and not requested yet
+} sd_cache_entry_t;
+
+typedef struct {
+	const sd_cache_ops_t *ops;
+	void *dev;                  // device, for the ops functions
+	uint32_t nsectors;          // card size, sectors are not read ahead past it
+	uint32_t size;              // number of entries
+	uint32_t ndirty;            // number of dirty entries
+	uint32_t stamp;             // last LRU stamp
+	uint32_t next;              // sector that follows the last read, to detect sequential reads
+	struct mtx mtx;
+	sd_cache_entry_t *entry;    // entries
+	uint8_t *data;              // sectors of the entries
+	uint8_t *burst;             // SD_CACHE_BURST sectors, for the commands sent by the cache
+	sd_cache_stats_t stats;
+} sd_cache_t;
+
+/*
+ * Creates a cache of size sectors for a card of nsectors sectors. Returns NULL
+ * if there is not enough memory.
+ */
+sd_cache_t *sd_cache_create(const sd_cache_ops_t *ops, void *dev, uint32_t nsectors, uint32_t size);
+
+// Writes the dirty sectors, and frees the cache. Returns 0 on success, -1 on error.
+int sd_cache_destroy(sd_cache_t *cache);
+
+// Reads count sectors, from sector. Returns 0 on success, -1 on error.
+int sd_cache_read(sd_cache_t *cache, uint32_t sector, uint8_t *buf, uint32_t count);
+
+// Writes count sectors, from sector. Returns 0 on success, -1 on error.
+int sd_cache_write(sd_cache_t *cache, uint32_t sector, const uint8_t *buf, uint32_t count);
+
+// Writes the dirty sectors to the card, in ascending order. Returns 0 on success, -1 on error.
+int sd_cache_sync(sd_cache_t *cache);
+
+void sd_cache_get_stats(sd_cache_t *cache, sd_cache_stats_t *stats);
+void sd_cache_reset_stats(sd_cache_t *cache);
+
+#endif
@@ -246,6 +246,13 @@ driver_error_t *sensor_setup(const sensor_t *sensor, sensor_setup_t *setup, sens
 	return NULL;
 }
 
+driver_error_t *sensor_unsetup(sensor_instance_t *unit) {
+	// Remove instance from sensor_list, and free it
+	list_remove(&sensor_list, unit->unit, 1);
+
+	return NULL;
+}
+
 driver_error_t *sensor_acquire(sensor_instance_t *unit) {
 	driver_error_t *error = NULL;
 	sensor_value_t *value = NULL;
@@ -117,6 +117,16 @@ driver_error_t *servo_write(servo_instance_t *instance, double value) {
 	return NULL;
 }
 
+driver_error_t *servo_unsetup(servo_instance_t *instance) {
+	driver_error_t *error;
+
+	// Stop PWM generation, and free instance
+	error = pwm_stop(0, instance->pwm_channel);
+	free(instance);
+
+	return error;
+}
+
 DRIVER_REGISTER(SERVO,servo,NULL,NULL,NULL);
 
 #endif
@@ -53,7 +53,7 @@
 
 #include "luartos.h"
 #include "freertos/FreeRTOS.h"
-#include "freertos/queue.h"
+#include "freertos/semphr.h"
 #include "freertos/timers.h"
 #include "freertos/xtensa_api.h"
 
@@ -68,6 +68,7 @@
 #include "driver/gpio.h"
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <stdarg.h>
 #include <signal.h>
@@ -76,6 +77,7 @@
 #include <sys/driver.h>
 #include <sys/syslog.h>
 #include <sys/delay.h>
+#include <sys/mutex.h>
 
 #include <pthread/pthread.h>
 #include <drivers/uart.h>
@@ -98,24 +100,53 @@ static const char *names[] = {
 	"uart2",
 };
 
-// UART array
+/*
+ * RX FIFO full threshold, in bytes. The FIFO is drained in bulk by the
+ * interrupt handler, so it's set high enough to have few interrupts at high
+ * baud rates, leaving room in the FIFO for the interrupt latency.
+ */
+#define UART_RX_FIFO_THRESHOLD 64
+
+// RX timeout, in symbols, for detect that the line is idle
+#define UART_RX_IDLE_TIMEOUT 2
+
+/*
+ * UART array
+ *
+ * Received bytes are stored in a ring buffer, with a single producer (the
+ * interrupt handler, that only writes head) and a single consumer (the
+ * readers, serialized by rx_mtx, that only write tail). head and tail are
+ * free running, and the ring size is a power of 2. The interrupt handler
+ * drains the FIFO holding the spinlock, so the buffer is not replaced while it
+ * runs on the other core.
+ */
 struct uart {
-    uint8_t          flags;
-    QueueHandle_t    q;         // RX queue
-    uint16_t         qs;        // Queue size
-    uint32_t         brg;       // Baud rate
-    pthread_mutex_t  mtx;		// Mutex
+    uint8_t            flags;
+    uint8_t           *rx;        // RX ring buffer
+    uint32_t           rxs;       // RX ring buffer size
+    volatile uint32_t  head;      // Next position to write, by ISR
+    volatile uint32_t  tail;      // Next position to read, by readers
+    uint32_t           threshold; // Buffered bytes that wake readers
+    SemaphoreHandle_t  rx_sem;    // Given by ISR to wake readers
+    struct mtx         rx_mtx;    // Readers mutex
+    uart_stats_t       stats;     // RX statistics
+    uint32_t           brg;       // Baud rate
+    pthread_mutex_t    mtx;		  // Mutex
+    portMUX_TYPE       spinlock;  // Held by ISR while it uses the RX buffer
 };
 
 static struct uart uart[NUART] = {
     {
-        0, NULL, 0, 115200, PTHREAD_MUTEX_INITIALIZER
+        .threshold = 1, .brg = 115200, .mtx = PTHREAD_MUTEX_INITIALIZER,
+        .spinlock = portMUX_INITIALIZER_UNLOCKED
     },
     {
-        0, NULL, 0, 115200, PTHREAD_MUTEX_INITIALIZER
+        .threshold = 1, .brg = 115200, .mtx = PTHREAD_MUTEX_INITIALIZER,
+        .spinlock = portMUX_INITIALIZER_UNLOCKED
     },
     {
-        0, NULL, 0, 115200, PTHREAD_MUTEX_INITIALIZER
+        .threshold = 1, .brg = 115200, .mtx = PTHREAD_MUTEX_INITIALIZER,
+        .spinlock = portMUX_INITIALIZER_UNLOCKED
     },
 };
 
@@ -262,11 +293,71 @@ void IRAM_ATTR process_signal(void *pvParameter1, uint32_t signal) {
 	_pthread_queue_signal(signal);
 }
 
+/*
+ * Moves all the bytes in the RX FIFO to the RX ring buffer. The new head is
+ * published once, when all bytes are stored. Bytes that don't fit in the
+ * buffer are counted as overruns. Returns the number of buffered bytes.
+ */
+static uint32_t IRAM_ATTR uart_rx_drain(int unit, BaseType_t *xHigherPriorityTaskWoken) {
+	struct uart *u = &uart[unit];
+	uint32_t head = u->head;
+	uint32_t tail = u->tail;
+	uint32_t mask = u->rxs - 1;
+	uint32_t cnt;
+	uint8_t byte, status;
+	int signal;
+
+	while ((cnt = (READ_PERI_REG(UART_STATUS_REG(unit)) >> UART_RXFIFO_CNT_S) & UART_RXFIFO_CNT)) {
+		while (cnt--) {
+			byte = READ_PERI_REG(UART_FIFO_REG(unit)) & 0xFF;
+			if (!queue_byte(unit, byte, &status, &signal)) {
+				if (signal) {
+					 xTimerPendFunctionCallFromISR(process_signal,
+					                               NULL,
+					                               (uint32_t)signal,
+					                               xHigherPriorityTaskWoken);
+				}
+
+				if (status) {
+					 xTimerPendFunctionCallFromISR(report_status,
+					                               NULL,
+					                               (uint32_t)status,
+					                               xHigherPriorityTaskWoken);
+				}
+
+				continue;
+			}
+
+			if (head - tail == u->rxs) {
+				// Buffer is full, readers may have consumed something meanwhile
+				tail = u->tail;
+				if (head - tail == u->rxs) {
+					u->stats.overruns++;
+					continue;
+				}
+			}
+
+			u->rx[head & mask] = byte;
+			head++;
+		}
+	}
+
+	if (head != u->head) {
+		u->stats.rx += head - u->head;
+
+		// Bytes must be in the buffer before readers can see the new head
+		__sync_synchronize();
+		u->head = head;
+	}
+
+	return head - tail;
+}
+
 void IRAM_ATTR uart_rx_intr_handler(void *para) {
     BaseType_t xHigherPriorityTaskWoken = pdFALSE;
     uint32_t uart_intr_status = 0;
-	uint8_t byte, status;
-	int signal = 0;
+    uint32_t rx_mask = UART_RXFIFO_FULL_INT_ST | UART_RXFIFO_TOUT_INT_ST | UART_RXFIFO_OVF_INT_ST;
+    uint32_t avail;
 	int unit = 0;
 
 	for(;unit < NUART;unit++) {
@@ -275,56 +366,26 @@ void IRAM_ATTR uart_rx_intr_handler(void *para) {
 		uart_intr_status = READ_PERI_REG(UART_INT_ST_REG(unit)) ;
 
 	    while (uart_intr_status != 0x0) {
-	        if (UART_FRM_ERR_INT_ST == (uart_intr_status & UART_FRM_ERR_INT_ST)) {
-	            WRITE_PERI_REG(UART_INT_CLR_REG(unit), UART_FRM_ERR_INT_CLR);
-	        } else if (UART_RXFIFO_FULL_INT_ST == (uart_intr_status & UART_RXFIFO_FULL_INT_ST)) {
-	            WRITE_PERI_REG(UART_INT_CLR_REG(unit), UART_RXFIFO_FULL_INT_CLR);
-
-	            while ((READ_PERI_REG(UART_STATUS_REG(unit)) >> UART_RXFIFO_CNT_S)&UART_RXFIFO_CNT) {
-					byte = READ_PERI_REG(UART_FIFO_REG(unit)) & 0xFF;
-					if (queue_byte(unit, byte, &status, &signal)) {
-			            // Put byte to UART queue
-			            xQueueSendFromISR(uart[unit].q, &byte, &xHigherPriorityTaskWoken);
-					} else {
-						if (signal) {
-							 xTimerPendFunctionCallFromISR(process_signal,
-							                               NULL,
-							                               (uint32_t)signal,
-							                               &xHigherPriorityTaskWoken);
-						}
-
-						if (status) {
-							 xTimerPendFunctionCallFromISR(report_status,
-							                               NULL,
-							                               (uint32_t)status,
-							                               &xHigherPriorityTaskWoken);
-						}
-					}
-	            }
-	        } else if (UART_RXFIFO_TOUT_INT_ST == (uart_intr_status & UART_RXFIFO_TOUT_INT_ST)) {
-	            WRITE_PERI_REG(UART_INT_CLR_REG(unit), UART_RXFIFO_TOUT_INT_CLR);
-
-	            while ((READ_PERI_REG(UART_STATUS_REG(unit)) >> UART_RXFIFO_CNT_S)&UART_RXFIFO_CNT) {
-					byte = READ_PERI_REG(UART_FIFO_REG(unit)) & 0xFF;
-					if (queue_byte(unit, byte, &status, &signal)) {
-			            // Put byte to UART queue
-			            xQueueSendFromISR(uart[unit].q, &byte, &xHigherPriorityTaskWoken);
-					} else {
-						if (signal) {
-							 xTimerPendFunctionCallFromISR(process_signal,
-							                               NULL,
-							                               (uint32_t)signal,
-							                               &xHigherPriorityTaskWoken);
-						}
-
-						if (status) {
-							 xTimerPendFunctionCallFromISR(report_status,
-							                               NULL,
-							                               (uint32_t)status,
-							                               &xHigherPriorityTaskWoken);
-						}
-					}
-	            }
+	        if (uart_intr_status & UART_FRM_ERR_INT_ST) {
+	            uart[unit].stats.frame_errors++;
+	        }
+
+	        if (uart_intr_status & UART_RXFIFO_OVF_INT_ST) {
+	            uart[unit].stats.fifo_overflows++;
+	        }
+
+	        WRITE_PERI_REG(UART_INT_CLR_REG(unit), uart_intr_status);
+
+	        if (uart_intr_status & rx_mask) {
+	        	portENTER_CRITICAL_ISR(&uart[unit].spinlock);
+	        	avail = uart_rx_drain(unit, &xHigherPriorityTaskWoken);
+	        	portEXIT_CRITICAL_ISR(&uart[unit].spinlock);
+
+	        	// Wake readers on threshold, when buffer is full, or when line is idle
+	        	if (avail && ((avail >= uart[unit].threshold) || (avail == uart[unit].rxs) ||
+	        		(uart_intr_status & UART_RXFIFO_TOUT_INT_ST))) {
+	        		xSemaphoreGiveFromISR(uart[unit].rx_sem, &xHigherPriorityTaskWoken);
+	        	}
 	        }
 
 	        uart_intr_status = READ_PERI_REG(UART_INT_ST_REG(unit)) ;
@@ -361,6 +422,53 @@ driver_error_t *uart_lock_resources(int unit, void *resources) {
     return NULL;
 }
 
+/*
+ * Allocates a RX buffer for at least size bytes. If the unit has a buffer,
+ * it's replaced, and the bytes in it are lost.
+ */
+static driver_error_t *uart_rx_alloc(int8_t unit, uint32_t size) {
+	struct uart *u = &uart[unit];
+	uint32_t rxs = 1;
+	uint8_t *rx, *old;
+
+	while (rxs < size) {
+		rxs <<= 1;
+	}
+
+	rx = malloc(rxs);
+	if (!rx) {
+		return driver_setup_error(UART_DRIVER, UART_ERR_CANT_INIT, "not enough memory");
+	}
+
+	if (!u->rx_sem) {
+		u->rx_sem = xSemaphoreCreateBinary();
+		if (!u->rx_sem) {
+			free(rx);
+			return driver_setup_error(UART_DRIVER, UART_ERR_CANT_INIT, "not enough memory");
+		}
+
+		mtx_init(&u->rx_mtx, NULL, NULL, 0);
+	}
+
+	// Replace the buffer without readers, and while the ISR doesn't use it, as
+	// it can run on the other core
+	mtx_lock(&u->rx_mtx);
+	portENTER_CRITICAL(&u->spinlock);
+
+	old = u->rx;
+	u->rx = rx;
+	u->rxs = rxs;
+	u->head = 0;
+	u->tail = 0;
+
+	portEXIT_CRITICAL(&u->spinlock);
+	mtx_unlock(&u->rx_mtx);
+
+	free(old);
+
+	return NULL;
+}
+
 // Init UART. Interrupts are not enabled.
 driver_error_t *uart_init(int8_t unit, uint32_t brg, uint8_t databits, uint8_t parity, uint8_t stop_bits, uint32_t qs) {
 	// Sanity checks
@@ -409,17 +517,11 @@ driver_error_t *uart_init(int8_t unit, uint32_t brg, uint8_t databits, uint8_t p
 
 	// There are not errors, continue with init ...
 
-    // If requestes queue size is greater than current size, delete queue and create
-	// a new one
-    if (qs > uart[unit].qs) {
-		if (uart[unit].q) {
-			vQueueDelete(uart[unit].q);
-		}
-
-		uart[unit].q  = xQueueCreate(qs, sizeof(uint8_t));
-		if (!uart[unit].q) {
-    		return driver_setup_error(UART_DRIVER, UART_ERR_CANT_INIT, "not enough memory");
-		}
+    // If requested buffer size is greater than current size, allocate a new one
+    if (qs > uart[unit].rxs) {
+    	if ((error = uart_rx_alloc(unit, qs))) {
+    		return error;
+    	}
 	}
 
     // Init mutex, if needed
@@ -436,7 +538,6 @@ driver_error_t *uart_init(int8_t unit, uint32_t brg, uint8_t databits, uint8_t p
 	uart_comm_param_config(unit, brg, esp_databits, esp_parity, esp_stop_bits);
 
     uart[unit].brg = brg; 
-    uart[unit].qs  = qs; 
 
     uart[unit].flags |= UART_FLAG_INIT;
 
@@ -460,7 +561,7 @@ driver_error_t *uart_setup_interrupts(int8_t unit) {
     }
 
     uint32_t reg_val = 0;
-	uint32_t mask = UART_RXFIFO_TOUT_INT_ENA | UART_FRM_ERR_INT_ENA | UART_RXFIFO_FULL_INT_ENA;
+	uint32_t mask = UART_RXFIFO_TOUT_INT_ENA | UART_FRM_ERR_INT_ENA | UART_RXFIFO_FULL_INT_ENA | UART_RXFIFO_OVF_INT_ENA;
 		
 	ESP_INTR_DISABLE(ETS_UART_INUM);
 
@@ -468,10 +569,10 @@ driver_error_t *uart_setup_interrupts(int8_t unit) {
     reg_val = READ_PERI_REG(UART_CONF1_REG(unit)) & ~((UART_RX_FLOW_THRHD << UART_RX_FLOW_THRHD_S) | UART_RX_FLOW_EN) ;
 
     reg_val |= ((mask & UART_RXFIFO_TOUT_INT_ENA) ?
-                (((2 & UART_RX_TOUT_THRHD) << UART_RX_TOUT_THRHD_S) | UART_RX_TOUT_EN) : 0);
+                (((UART_RX_IDLE_TIMEOUT & UART_RX_TOUT_THRHD) << UART_RX_TOUT_THRHD_S) | UART_RX_TOUT_EN) : 0);
 
     reg_val |= ((mask & UART_RXFIFO_FULL_INT_ENA) ?
-                ((10 & UART_RXFIFO_FULL_THRHD) << UART_RXFIFO_FULL_THRHD_S) : 0);
+                ((UART_RX_FIFO_THRESHOLD & UART_RXFIFO_FULL_THRHD) << UART_RXFIFO_FULL_THRHD_S) : 0);
 
     reg_val |= ((mask & UART_TXFIFO_EMPTY_INT_ENA) ?
                 ((20 & UART_TXFIFO_EMPTY_THRHD) << UART_TXFIFO_EMPTY_THRHD_S) : 0);
@@ -506,25 +607,131 @@ void IRAM_ATTR uart_writes(int8_t unit, char *s) {
    }
 }
 
-// Reads a byte from uart
-uint8_t IRAM_ATTR uart_read(int8_t unit, char *c, uint32_t timeout) {
+// Copies up to len buffered bytes to buff, and returns the number of bytes copied
+static int IRAM_ATTR uart_rx_pop(struct uart *u, char *buff, int len) {
+	uint32_t head = u->head;
+	uint32_t tail = u->tail;
+	uint32_t pos, n, first;
+
+	// Don't read the buffer before the head
+	__sync_synchronize();
+
+	n = head - tail;
+	if (n > len) {
+		n = len;
+	}
+
+	if (n) {
+		pos = tail & (u->rxs - 1);
+		first = u->rxs - pos;
+		if (first > n) {
+			first = n;
+		}
+
+		memcpy(buff, u->rx + pos, first);
+		memcpy(buff + first, u->rx, n - first);
+
+		// Bytes must be copied before the ISR can reuse their space
+		__sync_synchronize();
+		u->tail = tail + n;
+	}
+
+	return n;
+}
+
+/*
+ * Reads len bytes from the UART into buff, waiting for them at most timeout
+ * milliseconds (portMAX_DELAY waits forever). Returns the number of bytes
+ * read, that is less than len on timeout.
+ */
+int IRAM_ATTR uart_read_block(int8_t unit, char *buff, int len, uint32_t timeout) {
+	struct uart *u = &uart[unit];
+	TickType_t ticks, start, elapsed, wait;
+	int got = 0;
+
+	if (!u->rx || (len <= 0)) {
+		return 0;
+	}
+
     if (timeout != portMAX_DELAY) {
-        timeout = timeout / portTICK_PERIOD_MS;
-    }
-	
-    if (xQueueReceive(uart[unit].q, c, (TickType_t)(timeout)) == pdTRUE) {
-        return 1;
+        ticks = timeout / portTICK_PERIOD_MS;
     } else {
-        return 0;
+    	ticks = portMAX_DELAY;
     }
+
+    start = xTaskGetTickCount();
+
+	for(;;) {
+		mtx_lock(&u->rx_mtx);
+		got += uart_rx_pop(u, buff + got, len - got);
+
+		if ((got == len) && (u->head != u->tail)) {
+			// There are bytes left, wake other readers
+			xSemaphoreGive(u->rx_sem);
+		}
+		mtx_unlock(&u->rx_mtx);
+
+		if (got == len) {
+			break;
+		}
+
+		if (ticks == portMAX_DELAY) {
+			wait = portMAX_DELAY;
+		} else {
+			elapsed = xTaskGetTickCount() - start;
+			if (elapsed >= ticks) {
+				break;
+			}
+
+			wait = ticks - elapsed;
+		}
+
+		xSemaphoreTake(u->rx_sem, wait);
+	}
+
+	return got;
+}
+
+// Reads a byte from uart
+uint8_t IRAM_ATTR uart_read(int8_t unit, char *c, uint32_t timeout) {
+	return (uart_read_block(unit, c, 1, timeout) == 1);
 }
 
 // Consume all received bytes, and do not nothing with them
 void uart_consume(int8_t unit) {
-    char tmp;
-    
-    while(uart_read(unit,&tmp,1));
-} 
+	struct uart *u = &uart[unit];
+
+	if (!u->rx) {
+		return;
+	}
+
+	mtx_lock(&u->rx_mtx);
+	u->tail = u->head;
+	xSemaphoreTake(u->rx_sem, 0);
+	mtx_unlock(&u->rx_mtx);
+}
+
+/*
+ * Sets the number of buffered bytes that wake up a blocked reader. Readers
+ * are also woken when the line is idle, or when the buffer is full. A value
+ * of 1 wakes readers for each received burst.
+ */
+void uart_set_rx_threshold(int8_t unit, uint32_t bytes) {
+	if (bytes < 1) {
+		bytes = 1;
+	}
+
+	uart[unit].threshold = bytes;
+}
+
+// Gets the RX statistics, and the number of bytes waiting in the RX buffer
+void uart_get_stats(int8_t unit, uart_stats_t *stats, uint32_t *buffered) {
+	*stats = uart[unit].stats;
+
+	if (buffered) {
+		*buffered = uart[unit].head - uart[unit].tail;
+	}
+}
 
 // Reads a string from the UART, ended by the CR + LF character
 uint8_t uart_reads(int8_t unit, char *buff, uint8_t crlf, uint32_t timeout) {
@@ -653,11 +860,6 @@ const char *uart_name(int8_t unit) {
     return names[unit - 1];
 }
 
-// Gets the UART queue
-QueueHandle_t *uart_get_queue(int8_t unit) {
-    return  uart[unit].q;
-}
-
 int uart_get_br(int unit) {
 //    int divisor;
 //    unit--;
@@ -55,7 +55,6 @@
 #define __UART_H__
 
 #include "freertos/FreeRTOS.h"
-#include "freertos/queue.h"
 
 #include "rom/uart.h"
 #include "rom/ets_sys.h"
@@ -72,6 +71,14 @@ typedef struct {
 	uint8_t tx;
 } uart_resources_t;
 
+// RX statistics
+typedef struct {
+	uint32_t rx;             // Received bytes, stored in the RX buffer
+	uint32_t overruns;       // Received bytes lost, because the RX buffer was full
+	uint32_t fifo_overflows; // RX FIFO overflows, bytes lost by the hardware
+	uint32_t frame_errors;   // Frame errors
+} uart_stats_t;
+
 // Number of UART units
 #define NUART 3
 
@@ -91,6 +98,9 @@ driver_error_t *uart_setup_interrupts(int8_t unit);
 void     uart_write(int8_t unit, char byte);
 void     uart_writes(int8_t unit, char *s);
 uint8_t uart_read(int8_t unit, char *c, uint32_t timeout);
+int      uart_read_block(int8_t unit, char *buff, int len, uint32_t timeout);
+void     uart_set_rx_threshold(int8_t unit, uint32_t bytes);
+void     uart_get_stats(int8_t unit, uart_stats_t *stats, uint32_t *buffered);
 uint8_t  uart_reads(int8_t unit, char *buff, uint8_t crlf, uint32_t timeout);
 uint8_t  uart_wait_response(int8_t unit, char *command, uint8_t echo, char *ret, uint8_t substring, uint32_t timeout, int nargs, ...);
 uint8_t  uart_send_command(int8_t unit, char *command, uint8_t echo, uint8_t crlf, char *ret, uint8_t substring, uint32_t timeout, int nargs, ...);
@@ -99,7 +109,6 @@ const char  *uart_name(int8_t unit);
 int      uart_get_br(int unit);
 int      uart_is_setup(int unit);
 void     uart_stop(int unit);
-QueueHandle_t *uart_get_queue(int8_t unit);
 void uart_pins(int8_t unit, uint8_t *rx, uint8_t *tx);
 driver_error_t *uart_lock_resources(int unit, void *resources);
 
@@ -143,6 +143,50 @@
 #define SPIFFS_SIZE 524288
 #endif
 
+#if CONFIG_LUA_RTOS_SPIFFS_NOATIME
+#define SPIFFS_ATIME 0
+#else
+#define SPIFFS_ATIME 1
+#endif
+
+#ifdef CONFIG_LUA_RTOS_SPIFFS_META_FLUSH_TIME
+#define SPIFFS_META_FLUSH_TIME CONFIG_LUA_RTOS_SPIFFS_META_FLUSH_TIME
+#else
+#define SPIFFS_META_FLUSH_TIME 60
+#endif
+
+#ifdef CONFIG_LUA_RTOS_SPIFFS_GC_FREE_BLOCKS
+#define SPIFFS_GC_FREE_BLOCKS CONFIG_LUA_RTOS_SPIFFS_GC_FREE_BLOCKS
+#else
+#define SPIFFS_GC_FREE_BLOCKS 8
+#endif
+
+#ifdef CONFIG_LUA_RTOS_SPIFFS_GC_IDLE_TIME
+#define SPIFFS_GC_IDLE_TIME CONFIG_LUA_RTOS_SPIFFS_GC_IDLE_TIME
+#else
+#define SPIFFS_GC_IDLE_TIME 500
+#endif
+
+#define SPIFFS_GC_TASK_PRIORITY 1
+#define SPIFFS_GC_STACK_SIZE 2048
+
+// Event module
+
+#ifdef CONFIG_LUA_RTOS_LUA_EVENT_QUEUE_SIZE
+#define EVENT_QUEUE_SIZE CONFIG_LUA_RTOS_LUA_EVENT_QUEUE_SIZE
+#else
+#define EVENT_QUEUE_SIZE 16
+#endif
+
+#define EVENT_DEFERRED_SIZE 32
+#define EVENT_TASK_PRIORITY (LUA_TASK_PRIORITY + 1)
+#define EVENT_STACK_SIZE 2048
+
+// Lua profiler, that must preempt the Lua threads
+
+#define LPROF_TASK_PRIORITY (LUA_TASK_PRIORITY + 1)
+#define LPROF_STACK_SIZE 2048
+
 // LoRa WAN
 
 #define US_PER_OSTICK   20
@@ -193,6 +237,12 @@
 #define SD_MAXFILES 5
 #endif
 
+#if CONFIG_LUA_RTOS_SD_CACHE_SECTORS
+#define SD_CACHE_SECTORS CONFIG_LUA_RTOS_SD_CACHE_SECTORS
+#else
+#define SD_CACHE_SECTORS 0
+#endif
+
 #else
 #define USE_FAT 0
 #define USE_SD 0
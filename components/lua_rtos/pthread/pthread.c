@@ -469,13 +469,6 @@ void pthreadTask(void *taskArgs) {
     // Set thread id
     uxSetThreadId(args->id);
 
-#if CONFIG_LUA_RTOS_LUA_USE_THREAD
-	if (args->args) {
-		// Set Lua context into TCB
-		uxSetLuaState(((struct lthread *)args->args)->L);
-	}
-#endif
-		
 	// Lua RTOS specific TCB parts are set, parent thread can continue
     mtx_unlock(&thread->init_mtx);
     
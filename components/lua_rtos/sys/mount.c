@@ -298,8 +298,9 @@ char *mount_normalize_path(const char *path) {
         if (is_dot_dot) {
             last = cpath + 1;
 
-            while (*--cpath != '/');
-            while (*--cpath != '/');
+            // ".." in the root directory is the root directory
+            while ((cpath > rpath) && (*--cpath != '/'));
+            while ((cpath > rpath) && (*--cpath != '/'));
 
             tpath = ++cpath;
             while (*last) {
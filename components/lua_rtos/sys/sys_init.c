@@ -53,6 +53,10 @@
 #include <drivers/cpu.h>
 #include <drivers/uart.h>
 
+#if CONFIG_LUA_RTOS_LUA_USE_FLASH_MODULES
+#include <Lua/common/lflash.h>
+#endif
+
 extern void _pthread_init();
 extern void _signal_init();
 extern void _mtx_init();
@@ -129,6 +133,11 @@ void _sys_init() {
     _driver_init();
     _pthread_init();
 
+	#if CONFIG_LUA_RTOS_LUA_USE_FLASH_MODULES
+    // Map the precompiled Lua modules, before any Lua state is created
+    lflash_init();
+	#endif
+
     status_set(STATUS_SYSCALLS_INITED);
 
     _signal_init();
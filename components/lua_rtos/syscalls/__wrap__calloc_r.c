@@ -12,7 +12,7 @@
 
 #include <sys/mount.h>
 
-#include <Lua/src/lgc.h>
+#include <Lua/common/gcpressure.h>
 
 extern int __real__calloc_r(struct _reent *r, size_t nmemb, size_t size);
 
@@ -20,11 +20,12 @@ int IRAM_ATTR __wrap__calloc_r(struct _reent *r, size_t nmemb, size_t size) {
 	int res;
 
 	if (!(res = __real__calloc_r(r, nmemb,size))) {
-		luaC_fullgc(pvGetLuaState(), 1);
-		vTaskDelay(1 / portTICK_PERIOD_MS);
-		luaC_fullgc(pvGetLuaState(), 1);
-		vTaskDelay(1 / portTICK_PERIOD_MS);
-		res = __real__calloc_r(r, nmemb, size);
+		// One emergency collection, only in Lua threads, with their Lua state
+		if (gc_pressure_collect(pvGetLuaState())) {
+			if (!(res = __real__calloc_r(r, nmemb, size))) {
+				gc_pressure_failed();
+			}
+		}
 	}
 
 	return res;
@@ -12,19 +12,21 @@
 
 #include <sys/mount.h>
 
-#include <Lua/src/lgc.h>
+#include <Lua/common/gcpressure.h>
 
 extern int __real__realloc_r(struct _reent *r, void *ptr, size_t size);
 
 int IRAM_ATTR __wrap__realloc_r(struct _reent *r, void *ptr, size_t size) {
 	int res;
 
-	if (!(res = __real__realloc_r(r, ptr,size))) {
-		luaC_fullgc(pvGetLuaState(), 1);
-		vTaskDelay(1 / portTICK_PERIOD_MS);
-		luaC_fullgc(pvGetLuaState(), 1);
-		vTaskDelay(1 / portTICK_PERIOD_MS);
-		res = __real__realloc_r(r, ptr, size);
+	// realloc of 0 bytes frees the block
+	if (!(res = __real__realloc_r(r, ptr,size)) && size) {
+		// One emergency collection, only in Lua threads, with their Lua state
+		if (gc_pressure_collect(pvGetLuaState())) {
+			if (!(res = __real__realloc_r(r, ptr, size))) {
+				gc_pressure_failed();
+			}
+		}
 	}
 
 	return res;
@@ -38,6 +38,7 @@
 
 #include <sys/mount.h>
 #include <sys/fcntl.h>
+#include <sys/stat.h>
 
 char currdir[PATH_MAX + 1] = "";
 
@@ -41,6 +41,13 @@
 #include "driver/sdmmc_defs.h"
 #include "sdmmc_cmd.h"
 
+#if USE_FAT && SD_CACHE_SECTORS
+#include <sys/time.h>
+#include "diskio.h"
+#endif
+
+#include "fat.h"
+
 #if USE_FAT
 
 extern const char *__progname;
@@ -98,8 +105,142 @@ static void sdcard_print_info(const sdmmc_card_t* card)
     printf("  SCR: sd_spec=%d, bus_width=%d\r\n", card->scr.sd_spec, card->scr.bus_width);
 }
 
+#if SD_CACHE_SECTORS
+
+// Sector cache, between FATFS and the SDMMC driver
+static sd_cache_t *sd_cache = NULL;
+static sdmmc_card_t *sd_card = NULL;
+static BYTE sd_pdrv = 0xFF;
+
+//-------------------------------------------------------------------------------------
+static int sdcache_card_read(void *dev, uint32_t sector, uint8_t *buf, uint32_t count)
+{
+	// Multiple sectors are read with a single READ_MULTIPLE_BLOCK command
+	return (sdmmc_read_sectors((sdmmc_card_t *)dev, buf, sector, count) == ESP_OK)?0:-1;
+}
+
+//--------------------------------------------------------------------------------------------
+static int sdcache_card_write(void *dev, uint32_t sector, const uint8_t *buf, uint32_t count)
+{
+	// Multiple sectors are written with a single WRITE_MULTIPLE_BLOCK command
+	return (sdmmc_write_sectors((sdmmc_card_t *)dev, buf, sector, count) == ESP_OK)?0:-1;
+}
+
+//-----------------------------
+static uint64_t sdcache_now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (uint64_t)tv.tv_sec * 1000000ULL + tv.tv_usec;
+}
+
+static const sd_cache_ops_t sdcache_ops = {
+	.read = sdcache_card_read,
+	.write = sdcache_card_write,
+	.now = sdcache_now,
+};
+
+//--------------------------------------------
+static DSTATUS ff_sdcache_initialize(BYTE pdrv)
+{
+	return 0;
+}
+
+//----------------------------------------
+static DSTATUS ff_sdcache_status(BYTE pdrv)
+{
+	return 0;
+}
+
+//-----------------------------------------------------------------------------
+static DRESULT ff_sdcache_read(BYTE pdrv, BYTE* buff, DWORD sector, UINT count)
+{
+	return (sd_cache_read(sd_cache, sector, buff, count) == 0)?RES_OK:RES_ERROR;
+}
+
+//-------------------------------------------------------------------------------------
+static DRESULT ff_sdcache_write(BYTE pdrv, const BYTE* buff, DWORD sector, UINT count)
+{
+	return (sd_cache_write(sd_cache, sector, buff, count) == 0)?RES_OK:RES_ERROR;
+}
+
+//-----------------------------------------------------------------
+static DRESULT ff_sdcache_ioctl(BYTE pdrv, BYTE cmd, void* buff)
+{
+	switch(cmd) {
+		case CTRL_SYNC:
+			// FATFS syncs on f_sync and f_close, dirty sectors are written
+			return (sd_cache_sync(sd_cache) == 0)?RES_OK:RES_ERROR;
+		case GET_SECTOR_COUNT:
+			*((uint32_t*) buff) = sd_card->csd.capacity;
+			return RES_OK;
+		case GET_SECTOR_SIZE:
+			*((uint16_t*) buff) = sd_card->csd.sector_size;
+			return RES_OK;
+	}
+	return RES_ERROR;
+}
+
+static const ff_diskio_impl_t sdcache_impl = {
+	.init = &ff_sdcache_initialize,
+	.status = &ff_sdcache_status,
+	.read = &ff_sdcache_read,
+	.write = &ff_sdcache_write,
+	.ioctl = &ff_sdcache_ioctl
+};
+
+// Puts the sector cache between FATFS and the SDMMC driver registered by esp_vfs_fat_sdmmc_mount
+//---------------------------------------------
+static void sdcache_attach(sdmmc_card_t* card)
+{
+	if ((sd_pdrv == 0xFF) || (card->csd.sector_size != SD_CACHE_SECTOR_SIZE)) return;
+
+	sd_cache = sd_cache_create(&sdcache_ops, card, card->csd.capacity, SD_CACHE_SECTORS);
+	if (!sd_cache) {
+		printf("Not enough memory for the SD Card sector cache\r\n");
+		return;
+	}
+
+	sd_card = card;
+	ff_diskio_register(sd_pdrv, &sdcache_impl);
+}
+
+// Writes the dirty sectors, before unmount
+//-----------------------
+static void sdcache_sync()
+{
+	if (sd_cache && (sd_cache_sync(sd_cache) < 0)) {
+		printf("SD Card sector cache sync failed\r\n");
+	}
+}
+
+// Frees the cache, after unmount
+//-------------------------
+static void sdcache_detach()
+{
+	if (!sd_cache) return;
+
+	sd_cache_destroy(sd_cache);
+	sd_cache = NULL;
+	sd_card = NULL;
+}
+
 #endif
 
+#endif
+
+//---------------------------------------------
+int fat_cache_stats(sd_cache_stats_t *stats) {
+	#if USE_FAT && SD_CACHE_SECTORS
+	if (sd_cache) {
+		sd_cache_get_stats(sd_cache, stats);
+		return 1;
+	}
+	#endif
+	return 0;
+}
+
 
 //------------------
 void mount_fatfs() {
@@ -138,6 +279,11 @@ void mount_fatfs() {
 	esp_log_level_set("*", ESP_LOG_NONE);
     printf("Mounting SD Card: ");
 
+	#if SD_CACHE_SECTORS
+    // esp_vfs_fat_sdmmc_mount uses the first free drive
+    if (ff_diskio_get_drive(&sd_pdrv) != ESP_OK) sd_pdrv = 0xFF;
+	#endif
+
 	esp_err_t ret = esp_vfs_fat_sdmmc_mount("/fat", &host, &slot_config, &mount_config, &card);
     if (ret != ESP_OK) {
         if (ret == ESP_FAIL) {
@@ -150,6 +296,9 @@ void mount_fatfs() {
 		// Card has been initialized, print its properties
     	printf("OK\r\n");
 		sdcard_print_info(card);
+		#if SD_CACHE_SECTORS
+		sdcache_attach(card);
+		#endif
         mount_set_mounted("fat", 1);
         // Lock resources used by CDCard
         driver_error_t *error = sdcard_lock_resources(1, NULL);
@@ -176,7 +325,13 @@ void mount_fatfs() {
 void unmount_fatfs() {
 #if USE_FAT
     if (mount_is_mounted("fat")) {
+		#if SD_CACHE_SECTORS
+    	sdcache_sync();
+		#endif
     	esp_err_t ret = esp_vfs_fat_sdmmc_unmount();
+		#if SD_CACHE_SECTORS
+    	sdcache_detach();
+		#endif
         if (ret != ESP_OK) {
            	printf("FAT fs was not mounted\r\n");
         }
@@ -26,5 +26,10 @@
  * this software.
  */
 
+#include "drivers/sd_cache.h"
+
 void mount_fatfs();
 void unmount_fatfs();
+
+// Gets the SD Card sector cache counters. Returns 0 if the cache is not used.
+int fat_cache_stats(sd_cache_stats_t *stats);
@@ -32,6 +32,7 @@
 #if USE_SPIFFS
 
 #include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
 
 #include <string.h>
 #include <stdio.h>
@@ -49,9 +50,13 @@
 #include <sys/syslog.h>
 #include <sys/mount.h>
 #include <sys/list.h>
+#include <sys/mutex.h>
 #include <sys/fcntl.h>
 #include <sys/dirent.h>
 
+#include "spiffs_dir.h"
+#include "vfs.h"
+
 static int IRAM_ATTR vfs_spiffs_open(const char *path, int flags, int mode);
 static size_t IRAM_ATTR vfs_spiffs_write(int fd, const void *data, size_t size);
 static ssize_t IRAM_ATTR vfs_spiffs_read(int fd, void * dst, size_t size);
@@ -59,34 +64,112 @@ static int IRAM_ATTR vfs_spiffs_fstat(int fd, struct stat * st);
 static int IRAM_ATTR vfs_spiffs_close(int fd);
 static off_t IRAM_ATTR vfs_spiffs_lseek(int fd, off_t size, int mode);
 
+// Number of access times kept in RAM (see atime_set)
+#define SPIFFS_ATIME_ENTRIES 16
+
+// st_dev of the files in this file system (see vfs_spiffs_map)
+#define SPIFFS_DEV 0x5350
+
+// The esp-idf vfs puts the file descriptor returned by open in the lower CONFIG_MAX_FD_BITS
+// bits of the file descriptor returned to the application
+#ifdef CONFIG_MAX_FD_BITS
+#define SPIFFS_FD_MASK ((1 << CONFIG_MAX_FD_BITS) - 1)
+#else
+#define SPIFFS_FD_MASK ((1 << 12) - 1)
+#endif
+
 typedef struct {
 	DIR dir;
-	spiffs_DIR spiffs_dir;
+	char *list;     // directory entries, as returned by spiffs_dir_list
+	char *list_ent; // next entry to read in list
 	char path[MAXNAMLEN + 1];
 	struct dirent ent;
 	uint8_t read_mount;
 } vfs_spiffs_dir_t;
 
+typedef struct {
+	time_t mtime;
+	time_t ctime;
+	time_t atime;
+	uint8_t spare[SPIFFS_OBJ_META_LEN - (sizeof(time_t)*3)];
+} spiffs_metadata_t;
+
 typedef struct {
 	spiffs_file spiffs_file;
-	char path[MAXNAMLEN + 1];
+	char path[MAXNAMLEN + 1];   // SPIFFS object name
 	uint8_t is_dir;
+	uint8_t written;            // meta must be written on close
+	spiffs_metadata_t meta;
+	spiffs_ix_map ix_map;       // index map, if ix_buf is not NULL (see vfs_spiffs_map)
+	spiffs_page_ix *ix_buf;
 } vfs_spiffs_file_t;
 
+// An access time not written to flash yet
 typedef struct {
-	time_t mtime;
-	time_t ctime;
+	char path[MAXNAMLEN + 1];   // SPIFFS object name, empty if the entry is free
 	time_t atime;
-	uint8_t spare[SPIFFS_OBJ_META_LEN - (sizeof(time_t)*3)];
-} spiffs_metadata_t;
+} spiffs_atime_t;
 
 static spiffs fs;
 static struct list files;
 
+// Serializes the spiffs api calls (see SPIFFS_LOCK in spiffs_config.h)
+static struct mtx fs_mtx;
+
+static spiffs_atime_t atimes[SPIFFS_ATIME_ENTRIES];
+static time_t atimes_oldest; // when the oldest access time was kept, 0 if none
+static struct mtx atimes_mtx;
+
 static u8_t *my_spiffs_work_buf;
 static u8_t *my_spiffs_fds;
 static u8_t *my_spiffs_cache;
 
+// Background garbage collection (see spiffs_gc_task)
+static TaskHandle_t gc_task = NULL;
+static uint8_t gc_enabled = 1;
+static TickType_t gc_last_use;      // when the file system was used by other task
+static TickType_t gc_lock_ticks;    // when the lock was taken
+static u32_t gc_lock_runs;          // fs.stats_gc_runs when the lock was taken
+static u32_t gc_nothing_deleted;    // fs.stats_p_deleted when a step found nothing to do
+static vfs_spiffs_gc_stats_t gc_stats;
+
+static void atime_flush_old();
+
+/*
+ * The spiffs api calls are serialized with fs_mtx. The calls made by other tasks than
+ * the gc task are timed, to know when the file system is idle, and to count the calls
+ * that had to wait for a garbage collection.
+ *
+ */
+void IRAM_ATTR vfs_spiffs_lock() {
+	mtx_lock(&fs_mtx);
+
+	if (xTaskGetCurrentTaskHandle() != gc_task) {
+		gc_lock_ticks = xTaskGetTickCount();
+		gc_lock_runs = fs.stats_gc_runs;
+	}
+}
+
+void IRAM_ATTR vfs_spiffs_unlock() {
+	TickType_t now;
+	uint32_t ms;
+
+	if (xTaskGetCurrentTaskHandle() != gc_task) {
+		now = xTaskGetTickCount();
+
+		if (fs.stats_gc_runs != gc_lock_runs) {
+			ms = (now - gc_lock_ticks) * portTICK_PERIOD_MS;
+
+			gc_stats.stalls++;
+			gc_stats.stall_ms += ms;
+			if (ms > gc_stats.stall_max_ms) gc_stats.stall_max_ms = ms;
+		}
+
+		gc_last_use = now;
+	}
+
+	mtx_unlock(&fs_mtx);
+}
 
 void spiffs_fs_stat(uint32_t *total, uint32_t *used) {
 	if (SPIFFS_info(&fs, total, used) != SPIFFS_OK) {
@@ -101,31 +184,7 @@ void spiffs_fs_stat(uint32_t *total, uint32_t *used) {
  *
  */
 static int is_dir(const char *path) {
-    spiffs_DIR d;
-    char npath[PATH_MAX + 1];
-    int res = 0;
-
-    struct spiffs_dirent e;
-
-    // Add /. to path
-    strlcpy(npath, path, PATH_MAX);
-    if (strcmp(path,"/") != 0) {
-        strlcat(npath,"/.", PATH_MAX);
-    } else {
-    	strlcat(npath,".", PATH_MAX);
-    }
-
-    SPIFFS_opendir(&fs, "/", &d);
-    while (SPIFFS_readdir(&d, &e)) {
-        if (strncmp(npath, (const char *)e.name, strlen(npath)) == 0) {
-            res = 1;
-            break;
-        }
-    }
-
-    SPIFFS_closedir(&d);
-
-    return res;
+	return spiffs_dir_is_dir(path);
 }
 
 /*
@@ -154,6 +213,222 @@ static int spiffs_result(int res) {
     }
 }
 
+/*
+ * Build the directory index, scanning all the objects in the file system.
+ * This is done only once, when the file system is mounted.
+ *
+ */
+static int build_dir_index() {
+    spiffs_DIR d;
+    struct spiffs_dirent e;
+    int res = 0;
+
+    spiffs_dir_init();
+
+    if (!SPIFFS_opendir(&fs, "/", &d)) {
+    	return spiffs_result(fs.err_code);
+    }
+
+    while (SPIFFS_readdir(&d, &e)) {
+    	if ((res = spiffs_dir_add((const char *)e.name))) {
+    		break;
+    	}
+    }
+
+    SPIFFS_closedir(&d);
+
+    return res;
+}
+
+/*
+ * SPIFFS erases blocks in a garbage collection, when a write needs free pages and less
+ * than 4 blocks are free. The write then waits until the pages in use of a block are
+ * moved, and the block is erased.
+ *
+ * This task does the garbage collection when the file system is not used for
+ * SPIFFS_GC_IDLE_TIME milliseconds, one block at a time, to keep SPIFFS_GC_FREE_BLOCKS
+ * free blocks. Blocks with only deleted pages, that are only erased, are erased even if
+ * there are enough free blocks. It also writes the access times kept in RAM, when the
+ * oldest one was kept SPIFFS_META_FLUSH_TIME seconds ago, so they are not lost if no file
+ * is closed. The task runs if SPIFFS_ATIME is enabled even if SPIFFS_GC_FREE_BLOCKS is 0,
+ * and then only writes the access times.
+ *
+ */
+static int gc_pending() {
+	u32_t block_pages = SPIFFS_PAGES_PER_BLOCK(&fs) - SPIFFS_OBJ_LOOKUP_PAGES(&fs);
+
+	if (!SPIFFS_GC_FREE_BLOCKS || !gc_enabled || !fs.stats_p_deleted || (fs.stats_p_deleted == gc_nothing_deleted)) {
+		return 0;
+	}
+
+	if ((xTaskGetTickCount() - gc_last_use) * portTICK_PERIOD_MS < SPIFFS_GC_IDLE_TIME) {
+		return 0;
+	}
+
+	return (fs.free_blocks < SPIFFS_GC_FREE_BLOCKS) || (fs.stats_p_deleted >= block_pages);
+}
+
+static void spiffs_gc_task(void *arg) {
+	TickType_t t0;
+	u32_t deleted;
+	int res;
+
+	for(;;) {
+		vTaskDelay(SPIFFS_GC_IDLE_TIME / portTICK_PERIOD_MS);
+
+		atime_flush_old();
+
+		// Each step takes the file system lock, so a call waits for one step at most
+		while (gc_pending()) {
+			deleted = fs.stats_p_deleted;
+
+			t0 = xTaskGetTickCount();
+			res = SPIFFS_gc_step(&fs, fs.free_blocks < SPIFFS_GC_FREE_BLOCKS);
+
+			gc_stats.gc_ms += (xTaskGetTickCount() - t0) * portTICK_PERIOD_MS;
+
+			// Stop if nothing was reclaimed, until some pages are deleted
+			if ((res < 0) || (fs.stats_p_deleted >= deleted)) {
+				gc_nothing_deleted = fs.stats_p_deleted;
+				if (res == SPIFFS_OK) gc_stats.gc_steps++;
+				break;
+			}
+
+			gc_stats.gc_steps++;
+			gc_nothing_deleted = 0;
+
+			vTaskDelay(1);
+		}
+	}
+}
+
+void vfs_spiffs_gc_stats(vfs_spiffs_gc_stats_t *stats) {
+	memcpy(stats, &gc_stats, sizeof(vfs_spiffs_gc_stats_t));
+
+	stats->free_blocks = fs.free_blocks;
+	stats->deleted_pages = fs.stats_p_deleted;
+}
+
+void vfs_spiffs_gc_enable(int enable) {
+	gc_enabled = enable;
+}
+
+/*
+ * Access times are not written to flash each time a file is opened, as this costs a
+ * page rewrite. They are kept in atimes, and written all together by vfs_spiffs_sync,
+ * when atimes is full, or SPIFFS_META_FLUSH_TIME seconds after the oldest one was kept,
+ * on a close or by the garbage collector task (see spiffs_gc_task).
+ * The times of a written file are written with it, when it's closed.
+ *
+ * An access time is only updated if it's older than SPIFFS_META_FLUSH_TIME, so a file
+ * opened many times gets a single update each SPIFFS_META_FLUSH_TIME seconds.
+ *
+ */
+void vfs_spiffs_sync() {
+	spiffs_atime_t entry;
+	spiffs_stat stat;
+	spiffs_metadata_t meta;
+	int i;
+
+	mtx_lock(&atimes_mtx);
+	atimes_oldest = 0;
+	mtx_unlock(&atimes_mtx);
+
+	for(i = 0;i < SPIFFS_ATIME_ENTRIES;i++) {
+		// Take the entry, the spiffs api is not called with atimes locked
+		mtx_lock(&atimes_mtx);
+		entry = atimes[i];
+		atimes[i].path[0] = '\0';
+		mtx_unlock(&atimes_mtx);
+
+		if (!entry.path[0]) continue;
+
+		if (SPIFFS_stat(&fs, entry.path, &stat) == SPIFFS_OK) {
+			memcpy(&meta, stat.meta, sizeof(spiffs_metadata_t));
+			meta.atime = entry.atime;
+			SPIFFS_update_meta(&fs, entry.path, &meta);
+		}
+	}
+}
+
+static void atime_set(const char *path, time_t atime) {
+	int i, slot = -1;
+
+	mtx_lock(&atimes_mtx);
+
+	for(i = 0;i < SPIFFS_ATIME_ENTRIES;i++) {
+		if (strcmp(atimes[i].path, path) == 0) {
+			slot = i;
+			break;
+		}
+
+		if ((slot < 0) && !atimes[i].path[0]) slot = i;
+	}
+
+	if (slot >= 0) {
+		if (!atimes[slot].path[0]) {
+			strlcpy(atimes[slot].path, path, sizeof(atimes[slot].path));
+			if (!atimes_oldest) atimes_oldest = atime;
+		}
+
+		atimes[slot].atime = atime;
+	}
+
+	mtx_unlock(&atimes_mtx);
+
+	if (slot < 0) {
+		// Full, write all and keep this one
+		vfs_spiffs_sync();
+		atime_set(path, atime);
+	}
+}
+
+// Gets the access time of path kept in atimes. Returns 1 if there is one, 0 if not.
+static int atime_get(const char *path, time_t *atime) {
+	int i, found = 0;
+
+	mtx_lock(&atimes_mtx);
+
+	for(i = 0;i < SPIFFS_ATIME_ENTRIES;i++) {
+		if (atimes[i].path[0] && (strcmp(atimes[i].path, path) == 0)) {
+			*atime = atimes[i].atime;
+			found = 1;
+			break;
+		}
+	}
+
+	mtx_unlock(&atimes_mtx);
+
+	return found;
+}
+
+static void atime_remove(const char *path) {
+	int i;
+
+	mtx_lock(&atimes_mtx);
+
+	for(i = 0;i < SPIFFS_ATIME_ENTRIES;i++) {
+		if (atimes[i].path[0] && (strcmp(atimes[i].path, path) == 0)) {
+			atimes[i].path[0] = '\0';
+			break;
+		}
+	}
+
+	mtx_unlock(&atimes_mtx);
+}
+
+// Writes the access times if the oldest one was kept SPIFFS_META_FLUSH_TIME seconds ago
+static void atime_flush_old() {
+	time_t now = time(NULL);
+	int flush;
+
+	mtx_lock(&atimes_mtx);
+	flush = atimes_oldest && ((now - atimes_oldest >= SPIFFS_META_FLUSH_TIME) || (now < atimes_oldest));
+	mtx_unlock(&atimes_mtx);
+
+	if (flush) vfs_spiffs_sync();
+}
+
 static int IRAM_ATTR vfs_spiffs_getstat(spiffs_file fd, spiffs_stat *st, spiffs_metadata_t *metadata) {
     int res = SPIFFS_fstat(&fs, fd, st);
     if (res == SPIFFS_OK) {
@@ -163,10 +438,15 @@ static int IRAM_ATTR vfs_spiffs_getstat(spiffs_file fd, spiffs_stat *st, spiffs_
     return res;
 }
 
-static int IRAM_ATTR vfs_spiffs_open(const char *path, int flags, int mode) {
+/*
+ * Opens a file. If access is 1 the access time of the file is updated, if 0 the file
+ * is opened to get its status.
+ *
+ */
+static int IRAM_ATTR spiffs_open(const char *path, int flags, int mode, int access) {
 	int fd, result = 0, exists = 0;
 	spiffs_stat stat;
-	spiffs_metadata_t meta;
+	time_t now;
 
 	// Allocate new file
 	vfs_spiffs_file_t *file = calloc(1, sizeof(vfs_spiffs_file_t));
@@ -183,8 +463,12 @@ static int IRAM_ATTR vfs_spiffs_open(const char *path, int flags, int mode) {
     	return -1;
     }
 
-    // Check if file exists
-    if (SPIFFS_stat(&fs, path, &stat) == SPIFFS_OK) exists = 1;
+    // Check if file exists. If file is not created, it must exist to be opened.
+    if (flags & O_CREAT) {
+        if (SPIFFS_stat(&fs, path, &stat) == SPIFFS_OK) exists = 1;
+    } else {
+    	exists = 1;
+    }
 
     // Make a copy of path
 	strlcpy(file->path, path, MAXNAMLEN);
@@ -228,12 +512,16 @@ static int IRAM_ATTR vfs_spiffs_open(const char *path, int flags, int mode) {
             result = spiffs_result(fs.err_code);
         }
 
+        strlcpy(file->path, npath, MAXNAMLEN);
     	file->is_dir = 1;
     } else {
         // Open SPIFFS file
         file->spiffs_file = SPIFFS_open(&fs, path, spiffs_mode, 0);
         if (file->spiffs_file < 0) {
             result = spiffs_result(fs.err_code);
+        } else if (!exists) {
+        	// File is created, add it to the directory index
+        	spiffs_dir_add(path);
         }
     }
 
@@ -243,18 +531,39 @@ static int IRAM_ATTR vfs_spiffs_open(const char *path, int flags, int mode) {
     	return -1;
     }
 
-    res = vfs_spiffs_getstat(file->spiffs_file, &stat, &meta);
+    res = vfs_spiffs_getstat(file->spiffs_file, &stat, &file->meta);
 	if (res == SPIFFS_OK) {
-		// update file's time information
-		meta.atime = time(NULL); // Get the system time to access time
-		if (!exists) meta.ctime = meta.atime;
-		if (spiffs_mode != SPIFFS_RDONLY) meta.mtime = meta.atime;
-		SPIFFS_fupdate_meta(&fs, file->spiffs_file, &meta);
+		now = time(NULL); // Get the system time to access time
+
+		// Access time not written yet
+		atime_get(file->path, &file->meta.atime);
+
+		// update file's time information, that is written on close
+		if (!exists) {
+			file->meta.ctime = now;
+			file->meta.mtime = now;
+			file->meta.atime = now;
+			file->written = 1;
+		} else if (spiffs_mode & SPIFFS_TRUNC) {
+			file->meta.mtime = now;
+			file->written = 1;
+		}
+
+		// As access times are written with a delay, they are only updated if they are
+		// older than the delay
+		if (access && SPIFFS_ATIME && ((now - file->meta.atime >= SPIFFS_META_FLUSH_TIME) || (now < file->meta.atime))) {
+			file->meta.atime = now;
+			if (!file->written) atime_set(file->path, now);
+		}
 	}
 
     return fd;
 }
 
+static int IRAM_ATTR vfs_spiffs_open(const char *path, int flags, int mode) {
+	return spiffs_open(path, flags, mode, 1);
+}
+
 static size_t IRAM_ATTR vfs_spiffs_write(int fd, const void *data, size_t size) {
 	vfs_spiffs_file_t *file;
 	int res;
@@ -272,7 +581,17 @@ static size_t IRAM_ATTR vfs_spiffs_write(int fd, const void *data, size_t size)
 
     // Write SPIFFS file
 	res = SPIFFS_write(&fs, file->spiffs_file, (void *)data, size);
+
+	// SPIFFS updates the index map when the pages of the file are moved, as in a garbage
+	// collection. It's cleared on writes too, so the pages are looked up again when read.
+	if (file->ix_buf) {
+		memset(file->ix_buf, 0, (file->ix_map.end_spix - file->ix_map.start_spix + 1) * sizeof(spiffs_page_ix));
+	}
+
 	if (res >= 0) {
+		file->meta.mtime = time(NULL);
+		file->written = 1;
+
 		return res;
 	} else {
 		res = spiffs_result(fs.err_code);
@@ -322,7 +641,6 @@ static int IRAM_ATTR vfs_spiffs_fstat(int fd, struct stat * st) {
 	vfs_spiffs_file_t *file;
     spiffs_stat stat;
 	int res;
-	spiffs_metadata_t meta;
 
     res = list_get(&files, fd, (void **)&file);
     if (res) {
@@ -332,14 +650,15 @@ static int IRAM_ATTR vfs_spiffs_fstat(int fd, struct stat * st) {
 
     // Set block size for this file system
     st->st_blksize = SPIFFS_LOG_PAGE_SIZE;
+    st->st_dev = SPIFFS_DEV;
 
     // Get file/directory statistics
-    res = vfs_spiffs_getstat(file->spiffs_file, &stat, &meta);
+    res = SPIFFS_fstat(&fs, file->spiffs_file, &stat);
     if (res == SPIFFS_OK) {
-        // Set file's time information from metadata
-        st->st_mtime = meta.mtime;
-        st->st_ctime = meta.ctime;
-        st->st_atime = meta.atime;
+        // Set file's time information, that can be not written yet
+        st->st_mtime = file->meta.mtime;
+        st->st_ctime = file->meta.ctime;
+        st->st_atime = file->meta.atime;
 
     	st->st_size = stat.size;
 
@@ -370,6 +689,12 @@ static int IRAM_ATTR vfs_spiffs_close(int fd) {
 		return -1;
     }
 
+	// Write the times of a written file, with the access time kept for it
+	if (file->written) {
+		SPIFFS_fupdate_meta(&fs, file->spiffs_file, &file->meta);
+		atime_remove(file->path);
+	}
+
 	res = SPIFFS_close(&fs, file->spiffs_file);
 	if (res) {
 		res = spiffs_result(fs.err_code);
@@ -380,8 +705,13 @@ static int IRAM_ATTR vfs_spiffs_close(int fd) {
 		return -1;
 	}
 
+	// SPIFFS_close unmaps the file
+	free(file->ix_buf);
+
 	list_remove(&files, fd, 1);
 
+	atime_flush_old();
+
 	return 0;
 }
 
@@ -418,10 +748,120 @@ static off_t IRAM_ATTR vfs_spiffs_lseek(int fd, off_t size, int mode) {
     return res;
 }
 
+/*
+ * Returns the file of a file descriptor returned by open, or NULL, with errno set, if
+ * it isn't a file of this file system.
+ *
+ */
+static vfs_spiffs_file_t *spiffs_file_fd(int fd) {
+	vfs_spiffs_file_t *file;
+	struct stat st;
+
+	memset(&st, 0, sizeof(st));
+	if ((fstat(fd, &st) < 0) || (st.st_dev != SPIFFS_DEV) || !S_ISREG(st.st_mode)) {
+		errno = EBADF;
+		return NULL;
+	}
+
+    if (list_get(&files, fd & SPIFFS_FD_MASK, (void **)&file)) {
+		errno = EBADF;
+		return NULL;
+    }
+
+    return file;
+}
+
+// Removes the index map of the file opened with fd (see vfs_spiffs_map)
+int vfs_spiffs_unmap(int fd) {
+	vfs_spiffs_file_t *file;
+
+	file = spiffs_file_fd(fd);
+	if (!file) {
+		return -1;
+	}
+
+	if (!file->ix_buf) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	SPIFFS_ix_unmap(&fs, file->spiffs_file);
+
+	free(file->ix_buf);
+	file->ix_buf = NULL;
+
+	return 0;
+}
+
+/*
+ * Maps len bytes of the file opened with fd, from offset, to an index in RAM, or up
+ * to the end of the file if len is 0. The index has the flash page of each data page,
+ * and is populated as the file is read, so a seek in the mapped range doesn't need to
+ * search the file's index pages, that are more to search the further is the offset.
+ *
+ * The index takes 2 bytes for each page of the mapped range, and is kept until the
+ * file is unmapped or closed.
+ *
+ */
+int vfs_spiffs_map(int fd, off_t offset, size_t len) {
+	vfs_spiffs_file_t *file;
+	spiffs_stat stat;
+	int entries;
+	int res;
+
+	file = spiffs_file_fd(fd);
+	if (!file) {
+		return -1;
+	}
+
+	if (offset < 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (file->ix_buf) {
+		vfs_spiffs_unmap(fd);
+	}
+
+	if (len == 0) {
+		if (SPIFFS_fstat(&fs, file->spiffs_file, &stat) != SPIFFS_OK) {
+			errno = spiffs_result(fs.err_code);
+			return -1;
+		}
+
+		if (offset >= stat.size) {
+			errno = EINVAL;
+			return -1;
+		}
+
+		len = stat.size - offset;
+	}
+
+	// Data pages from the one of offset to the one of offset + len, included
+	entries = (offset + len) / SPIFFS_DATA_PAGE_SIZE(&fs) - offset / SPIFFS_DATA_PAGE_SIZE(&fs) + 1;
+
+	file->ix_buf = calloc(entries, sizeof(spiffs_page_ix));
+	if (!file->ix_buf) {
+		errno = ENOMEM;
+		return -1;
+	}
+
+	res = SPIFFS_ix_map_lazy(&fs, file->spiffs_file, &file->ix_map, offset, len, file->ix_buf);
+	if (res < 0) {
+		free(file->ix_buf);
+		file->ix_buf = NULL;
+
+		errno = spiffs_result(fs.err_code);
+		return -1;
+	}
+
+	return 0;
+}
+
 static int IRAM_ATTR vfs_spiffs_stat(const char * path, struct stat * st) {
 	int fd;
 	int res;
-	fd = vfs_spiffs_open(path, 0, 0);
+	fd = spiffs_open(path, 0, 0, 0);
 	res = vfs_spiffs_fstat(fd, st);
 	vfs_spiffs_close(fd);
 
@@ -435,18 +875,7 @@ static int IRAM_ATTR vfs_spiffs_unlink(const char *path) {
 
     if (is_dir(path)) {
         // Check if  directory is empty
-    	int nument = 0;
-        DIR *dir = opendir(path);
-        if (dir) {
-            struct dirent *ent;
-			// Read directory entries
-			while ((ent = readdir(dir)) != NULL) {
-				nument++;
-			}
-        }
-        closedir(dir);
-
-        if (nument > 0) {
+        if (spiffs_dir_entries(path) > 0) {
         	// Directory not empty, cannot remove
         	errno = ENOTEMPTY;
         	return -1;
@@ -474,6 +903,10 @@ static int IRAM_ATTR vfs_spiffs_unlink(const char *path) {
 
 	SPIFFS_close(&fs, FP);
 
+	// Remove from the directory index
+	spiffs_dir_remove(npath);
+	atime_remove(npath);
+
 	return 0;
 }
 
@@ -483,6 +916,17 @@ static int IRAM_ATTR vfs_spiffs_rename(const char *src, const char *dst) {
     	return -1;
     }
 
+    // Update the directory index
+    spiffs_dir_remove(src);
+    spiffs_dir_add(dst);
+
+    // Keep the access time not written yet
+    time_t atime;
+    if (atime_get(src, &atime)) {
+    	atime_remove(src);
+    	atime_set(dst, atime);
+    }
+
     return 0;
 }
 
@@ -518,28 +962,26 @@ static DIR* vfs_spiffs_opendir(const char* name) {
 		return NULL;
 	}
 
-	if (!SPIFFS_opendir(&fs, name, &dir->spiffs_dir)) {
+	// Get the directory entries from the directory index
+	dir->list = spiffs_dir_list(name);
+	if (!dir->list) {
         free(dir);
-        errno = spiffs_result(fs.err_code);
+        errno = ENOMEM;
         return NULL;
     }
 
+	dir->list_ent = dir->list;
+
 	strlcpy(dir->path, name, MAXNAMLEN);
 
 	return (DIR *)dir;
 }
 
 static struct dirent* vfs_spiffs_readdir(DIR* pdir) {
-    int res = 0, len = 0, entries = 0;
 	vfs_spiffs_dir_t* dir = (vfs_spiffs_dir_t*) pdir;
 
-	struct spiffs_dirent e;
-    struct spiffs_dirent *pe = &e;
-
     struct dirent *ent = &dir->ent;
 
-    char *fn;
-
     // Clear current dirent
     memset(ent,0,sizeof(struct dirent));
 
@@ -561,104 +1003,35 @@ static struct dirent* vfs_spiffs_readdir(DIR* pdir) {
     	dir->read_mount = 1;
     }
 
-    // Search for next entry
-    for(;;) {
-        // Read directory
-        pe = SPIFFS_readdir(&dir->spiffs_dir, pe);
-        if (!pe) {
-            res = spiffs_result(fs.err_code);
-            errno = res;
-            break;
-        }
-
-        // Break condition
-        if (pe->name[0] == 0) break;
-
-        // Get name and length
-        fn = (char *)pe->name;
-        len = strlen(fn);
+    // Get next entry
+    if (*dir->list_ent == SPIFFS_DIR_TYPE_END) {
+    	return NULL;
+    }
 
-        // Get entry type and size
+    if (*dir->list_ent == SPIFFS_DIR_TYPE_DIR) {
+        ent->d_type = DT_DIR;
+    } else {
         ent->d_type = DT_REG;
+    }
 
-        if (len >= 2) {
-            if (fn[len - 1] == '.') {
-                if (fn[len - 2] == '/') {
-                    ent->d_type = DT_DIR;
-
-                    fn[len - 2] = '\0';
-
-                    len = strlen(fn);
-
-                    // Skip root dir
-                    if (len == 0) {
-                        continue;
-                    }
-                }
-            }
-        }
-
-        // Skip entries not belonged to path
-        if (strncmp(fn, dir->path, strlen(dir->path)) != 0) {
-            continue;
-        }
-
-        if (strlen(dir->path) > 1) {
-            if (*(fn + strlen(dir->path)) != '/') {
-                continue;
-            }
-        }
-
-        // Skip root directory
-        fn = fn + strlen(dir->path);
-        len = strlen(fn);
-        if (len == 0) {
-            continue;
-        }
-
-        // Skip initial /
-        if (len > 1) {
-            if (*fn == '/') {
-                fn = fn + 1;
-                len--;
-            }
-        }
-
-        // Skip subdirectories
-        if (strchr(fn,'/')) {
-            continue;
-        }
-
-        //ent->d_fsize = pe->size;
-
-        strlcpy(ent->d_name, fn, MAXNAMLEN);
+    dir->list_ent++;
 
-        entries++;
+    strlcpy(ent->d_name, dir->list_ent, MAXNAMLEN);
 
-        break;
-    }
+    dir->list_ent += strlen(dir->list_ent) + 1;
 
-    if (entries > 0) {
-    	return ent;
-    } else {
-    	return NULL;
-    }
+    return ent;
 }
 
 static int IRAM_ATTR vfs_piffs_closedir(DIR* pdir) {
 	vfs_spiffs_dir_t* dir = (vfs_spiffs_dir_t*) pdir;
-	int res;
 
 	if (!pdir) {
 		errno = EBADF;
 		return -1;
 	}
 
-	if ((res = SPIFFS_closedir(&dir->spiffs_dir)) < 0) {
-		errno = spiffs_result(fs.err_code);;
-		return -1;
-	}
-
+	free(dir->list);
 	free(dir);
 
     return 0;
@@ -693,6 +1066,9 @@ static int IRAM_ATTR vfs_spiffs_mkdir(const char *path, mode_t mode) {
 	meta.mtime = meta.atime;
 	SPIFFS_update_meta(&fs, npath, &meta);
 
+	// Add to the directory index
+	spiffs_dir_add(npath);
+
     return 0;
 }
 
@@ -718,6 +1094,9 @@ void vfs_spiffs_register() {
 	
     ESP_ERROR_CHECK(esp_vfs_register("/spiffs", &vfs, NULL));
 
+    mtx_init(&fs_mtx, NULL, NULL, 0);
+    mtx_init(&atimes_mtx, NULL, NULL, 0);
+
     // Mount spiffs file system
     spiffs_config cfg;
     int unit = 0;
@@ -801,11 +1180,23 @@ void vfs_spiffs_register() {
 		return;
     }
 
-    mount_set_mounted("spiffs", 1);
-
     list_init(&files, 0);
 
+    // Build the directory index
+    if ((res = build_dir_index())) {
+		syslog(LOG_ERR, "spiffs%d error building directory index (%d)", unit, res);
+    }
+
+    mount_set_mounted("spiffs", 1);
+
     syslog(LOG_INFO, "spiffs%d mounted", unit);
+
+#if (SPIFFS_GC_FREE_BLOCKS > 0) || SPIFFS_ATIME
+    if (xTaskCreatePinnedToCore(spiffs_gc_task, "spiffsgc", SPIFFS_GC_STACK_SIZE, NULL,
+                                SPIFFS_GC_TASK_PRIORITY, &gc_task, tskNO_AFFINITY) != pdPASS) {
+		syslog(LOG_ERR, "spiffs%d can't start the garbage collector task", unit);
+    }
+#endif
 }
 
 #endif
@@ -0,0 +1,482 @@
+/*
+ * Lua RTOS, spiffs directory index
+ *
+ * Copyright (C) 2015 - 2017 LoBo
+ *
+ * Author: LoBo (loboris@gmail.com / https://github.com/loboris)
+ *
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software
+ * and its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that the copyright notice and this
+ * permission notice and warranty disclaimer appear in supporting
+ * documentation, and that the name of the author not be used in
+ * advertising or publicity pertaining to distribution of the
+ * software without specific, written prior permission.
+ *
+ * The author disclaim all warranties with regard to this
+ * software, including all implied warranties of merchantability
+ * and fitness.  In no event shall the author be liable for any
+ * special, indirect or consequential damages or any damages
+ * whatsoever resulting from loss of use, data or profits, whether
+ * in an action of contract, negligence or other tortious action,
+ * arising out of or in connection with the use or performance of
+ * this software.
+ */
+
+#include "luartos.h"
+
+#if USE_SPIFFS
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/mutex.h>
+
+#include "spiffs_dir.h"
+
+// A directory entry
+struct spiffs_dir_ent {
+	struct spiffs_dir_ent *next;
+	uint8_t type;
+	char name[];
+};
+
+// A directory, with its entries
+struct spiffs_dir_node {
+	struct spiffs_dir_node *next;
+	struct spiffs_dir_ent *ents;
+	uint32_t hash;
+	uint16_t entries;
+	uint16_t len;
+	uint8_t exists; // 1 if the "path/." object exists
+	char path[];
+};
+
+static struct mtx dir_mtx;
+static struct spiffs_dir_node *buckets[SPIFFS_DIR_BUCKETS];
+
+static uint32_t dir_hash(const char *path, int len) {
+	uint32_t h = 2166136261u;
+
+	while (len--) {
+		h ^= (uint8_t)*path++;
+		h *= 16777619u;
+	}
+
+	return h;
+}
+
+// Get the length of path, without the trailing /, if any
+static int dir_len(const char *path) {
+	int len = strlen(path);
+
+	while ((len > 1) && (path[len - 1] == '/')) {
+		len--;
+	}
+
+	if (len == 0) {
+		// Empty path is the root directory
+		return -1;
+	}
+
+	return len;
+}
+
+static struct spiffs_dir_node *dir_find(const char *path, int len, uint32_t hash) {
+	struct spiffs_dir_node *node = buckets[hash & (SPIFFS_DIR_BUCKETS - 1)];
+
+	while (node) {
+		if ((node->hash == hash) && (node->len == len) && (memcmp(node->path, path, len) == 0)) {
+			return node;
+		}
+
+		node = node->next;
+	}
+
+	return NULL;
+}
+
+static struct spiffs_dir_node *dir_get(const char *path, int len) {
+	struct spiffs_dir_node *node;
+	uint32_t hash;
+
+	if (len < 0) {
+		path = "/";
+		len = 1;
+	}
+
+	hash = dir_hash(path, len);
+
+	if ((node = dir_find(path, len, hash))) {
+		return node;
+	}
+
+	node = calloc(1, sizeof(struct spiffs_dir_node) + len + 1);
+	if (!node) {
+		return NULL;
+	}
+
+	memcpy(node->path, path, len);
+	node->len = len;
+	node->hash = hash;
+	node->next = buckets[hash & (SPIFFS_DIR_BUCKETS - 1)];
+
+	buckets[hash & (SPIFFS_DIR_BUCKETS - 1)] = node;
+
+	return node;
+}
+
+// Release a directory node if it's not needed anymore
+static void dir_release(struct spiffs_dir_node *node) {
+	struct spiffs_dir_node **cnode;
+
+	if (node->exists || node->ents) {
+		return;
+	}
+
+	cnode = &buckets[node->hash & (SPIFFS_DIR_BUCKETS - 1)];
+	while (*cnode) {
+		if (*cnode == node) {
+			*cnode = node->next;
+			free(node);
+			return;
+		}
+
+		cnode = &(*cnode)->next;
+	}
+}
+
+/*
+ * Split a SPIFFS object name into the directory that contains it and the entry name,
+ * and get the entry type. For a directory object ("path/."), the object is the
+ * directory itself.
+ *
+ * Returns 0 if the object has no parent (it's the root directory object), -1 if
+ * name is not a valid object name, or 1 if not.
+ *
+ */
+static int dir_split(const char *name, const char **dir, int *dlen, const char **ent, int *elen, uint8_t *type) {
+	const char *end;
+	const char *c;
+	int len = strlen(name);
+
+	*type = SPIFFS_DIR_TYPE_REG;
+
+	if ((len >= 2) && (name[len - 1] == '.') && (name[len - 2] == '/')) {
+		*type = SPIFFS_DIR_TYPE_DIR;
+		len -= 2;
+	}
+
+	if (len == 0) {
+		return 0;
+	}
+
+	end = name + len;
+	for(c = end - 1;(c > name) && (*c != '/');c--);
+
+	if (*c == '/') {
+		*ent = c + 1;
+		*dlen = c - name;
+	} else {
+		*ent = c;
+		*dlen = 0;
+	}
+
+	*elen = end - *ent;
+	*dir = name;
+
+	if (*dlen == 0) {
+		// Directory is the root directory
+		*dlen = -1;
+	}
+
+	return (*elen > 0)?1:-1;
+}
+
+int spiffs_dir_init() {
+	mtx_init(&dir_mtx, NULL, NULL, 0);
+
+	memset(buckets, 0, sizeof(buckets));
+
+	return 0;
+}
+
+void spiffs_dir_destroy() {
+	struct spiffs_dir_node *node, *nnode;
+	struct spiffs_dir_ent *ent, *nent;
+	int i;
+
+	mtx_lock(&dir_mtx);
+
+	for(i = 0;i < SPIFFS_DIR_BUCKETS;i++) {
+		node = buckets[i];
+		while (node) {
+			ent = node->ents;
+			while (ent) {
+				nent = ent->next;
+				free(ent);
+				ent = nent;
+			}
+
+			nnode = node->next;
+			free(node);
+			node = nnode;
+		}
+
+		buckets[i] = NULL;
+	}
+
+	mtx_unlock(&dir_mtx);
+}
+
+/*
+ * Add an object to the index. Name is the SPIFFS object name, so a directory
+ * is added with its "path/." name.
+ *
+ */
+int spiffs_dir_add(const char *name) {
+	struct spiffs_dir_node *node;
+	struct spiffs_dir_ent *ent, **cent;
+	const char *dir, *ename;
+	int dlen, elen, res;
+	uint8_t type;
+
+	res = dir_split(name, &dir, &dlen, &ename, &elen, &type);
+	if (res < 0) {
+		return EINVAL;
+	}
+
+	mtx_lock(&dir_mtx);
+
+	if (res == 0) {
+		// Root directory object
+		if ((node = dir_get("/", 1))) {
+			node->exists = 1;
+		}
+
+		mtx_unlock(&dir_mtx);
+
+		return node?0:ENOMEM;
+	}
+
+	if (type == SPIFFS_DIR_TYPE_DIR) {
+		// Mark the directory as existent
+		node = dir_get(name, ename - name + elen);
+		if (!node) {
+			mtx_unlock(&dir_mtx);
+			return ENOMEM;
+		}
+
+		node->exists = 1;
+	}
+
+	// Add entry to its parent directory
+	node = dir_get(dir, dlen);
+	if (!node) {
+		mtx_unlock(&dir_mtx);
+		return ENOMEM;
+	}
+
+	cent = &node->ents;
+	while (*cent) {
+		if ((strncmp((*cent)->name, ename, elen) == 0) && ((*cent)->name[elen] == '\0')) {
+			// Entry already exists
+			(*cent)->type = type;
+
+			mtx_unlock(&dir_mtx);
+			return 0;
+		}
+
+		cent = &(*cent)->next;
+	}
+
+	ent = malloc(sizeof(struct spiffs_dir_ent) + elen + 1);
+	if (!ent) {
+		dir_release(node);
+		mtx_unlock(&dir_mtx);
+		return ENOMEM;
+	}
+
+	memcpy(ent->name, ename, elen);
+	ent->name[elen] = '\0';
+	ent->type = type;
+	ent->next = NULL;
+
+	// Add entry at the end, so entries are listed in creation order
+	*cent = ent;
+	node->entries++;
+
+	mtx_unlock(&dir_mtx);
+
+	return 0;
+}
+
+/*
+ * Remove an object from the index. Name is the SPIFFS object name, so a directory
+ * is removed with its "path/." name.
+ *
+ */
+void spiffs_dir_remove(const char *name) {
+	struct spiffs_dir_node *node;
+	struct spiffs_dir_ent *ent, **cent;
+	const char *dir, *ename;
+	int dlen, elen, len, res;
+	uint8_t type;
+
+	res = dir_split(name, &dir, &dlen, &ename, &elen, &type);
+	if (res < 0) {
+		return;
+	}
+
+	mtx_lock(&dir_mtx);
+
+	if (res == 0) {
+		if ((node = dir_find("/", 1, dir_hash("/", 1)))) {
+			node->exists = 0;
+			dir_release(node);
+		}
+
+		mtx_unlock(&dir_mtx);
+		return;
+	}
+
+	if (type == SPIFFS_DIR_TYPE_DIR) {
+		// Mark the directory as non existent
+		len = ename - name + elen;
+		if ((node = dir_find(name, len, dir_hash(name, len)))) {
+			node->exists = 0;
+			dir_release(node);
+		}
+	}
+
+	if (dlen < 0) {
+		dir = "/";
+		dlen = 1;
+	}
+
+	node = dir_find(dir, dlen, dir_hash(dir, dlen));
+	if (!node) {
+		mtx_unlock(&dir_mtx);
+		return;
+	}
+
+	cent = &node->ents;
+	while (*cent) {
+		ent = *cent;
+		if ((ent->type == type) && (strncmp(ent->name, ename, elen) == 0) && (ent->name[elen] == '\0')) {
+			*cent = ent->next;
+			node->entries--;
+			free(ent);
+			break;
+		}
+
+		cent = &ent->next;
+	}
+
+	dir_release(node);
+
+	mtx_unlock(&dir_mtx);
+}
+
+// Test if path is a directory. Returns 1 if it's a directory, 0 if not.
+int spiffs_dir_is_dir(const char *path) {
+	struct spiffs_dir_node *node;
+	int len = dir_len(path);
+	int res;
+
+	if (len < 0) {
+		path = "/";
+		len = 1;
+	}
+
+	mtx_lock(&dir_mtx);
+	node = dir_find(path, len, dir_hash(path, len));
+	res = (node && node->exists);
+	mtx_unlock(&dir_mtx);
+
+	return res;
+}
+
+// Get the number of entries of a directory
+int spiffs_dir_entries(const char *path) {
+	struct spiffs_dir_node *node;
+	int len = dir_len(path);
+	int res = 0;
+
+	if (len < 0) {
+		path = "/";
+		len = 1;
+	}
+
+	mtx_lock(&dir_mtx);
+	node = dir_find(path, len, dir_hash(path, len));
+	if (node) {
+		res = node->entries;
+	}
+	mtx_unlock(&dir_mtx);
+
+	return res;
+}
+
+/*
+ * Get a snapshot of the entries of a directory, so that it can be read
+ * without holding the index lock, while other threads modify the directory.
+ *
+ * The snapshot is a sequence of entries with the format:
+ *
+ *   [type (1 byte)][name (null terminated string)]
+ *
+ * ended with a SPIFFS_DIR_TYPE_END byte. Caller must free it.
+ *
+ */
+char *spiffs_dir_list(const char *path) {
+	struct spiffs_dir_node *node;
+	struct spiffs_dir_ent *ent;
+	int len = dir_len(path);
+	int size = 1;
+	char *list, *c;
+
+	if (len < 0) {
+		path = "/";
+		len = 1;
+	}
+
+	mtx_lock(&dir_mtx);
+
+	node = dir_find(path, len, dir_hash(path, len));
+	if (node) {
+		for(ent = node->ents;ent;ent = ent->next) {
+			size += strlen(ent->name) + 2;
+		}
+	}
+
+	list = malloc(size);
+	if (!list) {
+		mtx_unlock(&dir_mtx);
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	c = list;
+	if (node) {
+		for(ent = node->ents;ent;ent = ent->next) {
+			*c++ = ent->type;
+			len = strlen(ent->name) + 1;
+			memcpy(c, ent->name, len);
+			c += len;
+		}
+	}
+
+	*c = SPIFFS_DIR_TYPE_END;
+
+	mtx_unlock(&dir_mtx);
+
+	return list;
+}
+
+#endif
@@ -0,0 +1,62 @@
+/*
+ * Lua RTOS, spiffs directory index
+ *
+ * Copyright (C) 2015 - 2017 LoBo
+ *
+ * Author: LoBo (loboris@gmail.com / https://github.com/loboris)
+ *
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software
+ * and its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that the copyright notice and this
+ * permission notice and warranty disclaimer appear in supporting
+ * documentation, and that the name of the author not be used in
+ * advertising or publicity pertaining to distribution of the
+ * software without specific, written prior permission.
+ *
+ * The author disclaim all warranties with regard to this
+ * software, including all implied warranties of merchantability
+ * and fitness.  In no event shall the author be liable for any
+ * special, indirect or consequential damages or any damages
+ * whatsoever resulting from loss of use, data or profits, whether
+ * in an action of contract, negligence or other tortious action,
+ * arising out of or in connection with the use or performance of
+ * this software.
+ */
+
+#ifndef _SPIFFS_DIR_H
+#define	_SPIFFS_DIR_H
+
+/*
+ * SPIFFS has a flat namespace, directories are emulated with a "path/." object,
+ * and files inside a directory are objects whose name starts with "path/". Find if
+ * a path is a directory, or list a directory, requires to scan all the objects in
+ * the file system.
+ *
+ * This module keeps an in-RAM index of the directory tree, built when the file system
+ * is mounted, and updated by the vfs operations that create, remove or rename objects,
+ * so that the cost of these operations is proportional to the directory's own size.
+ *
+ */
+
+// Entry types returned by spiffs_dir_list
+#define SPIFFS_DIR_TYPE_END 0
+#define SPIFFS_DIR_TYPE_REG 1
+#define SPIFFS_DIR_TYPE_DIR 2
+
+// Number of hash buckets used for the directory table (must be a power of 2)
+#ifndef SPIFFS_DIR_BUCKETS
+#define SPIFFS_DIR_BUCKETS 32
+#endif
+
+int   spiffs_dir_init();
+void  spiffs_dir_destroy();
+int   spiffs_dir_add(const char *name);
+void  spiffs_dir_remove(const char *name);
+int   spiffs_dir_is_dir(const char *path);
+int   spiffs_dir_entries(const char *path);
+char *spiffs_dir_list(const char *path);
+
+#endif	/* _SPIFFS_DIR_H */
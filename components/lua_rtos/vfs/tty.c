@@ -90,19 +90,7 @@ static size_t IRAM_ATTR vfs_tty_write(int fd, const void *data, size_t size) {
 }
 
 static ssize_t IRAM_ATTR vfs_tty_read(int fd, void * dst, size_t size) {
-	ssize_t remain = (ssize_t)size;
-	int unit = fd;
-
-	while (remain) {
-        if (uart_read(unit, (char *)dst, portMAX_DELAY)) {
-			remain--;
-			dst++;
-        } else {
-            break;
-        } 
-    }	
-	
-	return size - remain;
+	return uart_read_block(fd, (char *)dst, size, portMAX_DELAY);
 }
 
 static int IRAM_ATTR vfs_tty_fstat(int fd, struct stat * st) {
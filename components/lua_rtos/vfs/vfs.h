@@ -27,7 +27,26 @@
  * this software.
  */
 
+#include <stdint.h>
+#include <sys/types.h>
+
+// Counters of the SPIFFS background garbage collector (see spiffs_gc_task in spiffs.c)
+typedef struct {
+	uint32_t gc_steps;      // blocks erased by the garbage collector task
+	uint32_t gc_ms;         // time spent by the garbage collector task
+	uint32_t stalls;        // calls that had to wait for a garbage collection
+	uint32_t stall_ms;      // time spent by those calls
+	uint32_t stall_max_ms;
+	uint32_t free_blocks;
+	uint32_t deleted_pages;
+} vfs_spiffs_gc_stats_t;
+
 void vfs_fat_register();
 void vfs_net_register();
 void vfs_spiffs_register();
+void vfs_spiffs_sync();
+int vfs_spiffs_map(int fd, off_t offset, size_t len);
+int vfs_spiffs_unmap(int fd);
+void vfs_spiffs_gc_stats(vfs_spiffs_gc_stats_t *stats);
+void vfs_spiffs_gc_enable(int enable);
 void vfs_tty_register();
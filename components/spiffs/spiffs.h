@@ -671,6 +671,22 @@ s32_t SPIFFS_gc_quick(spiffs *fs, u16_t max_free_pages);
  */
 s32_t SPIFFS_gc(spiffs *fs, u32_t size);
 
+/**
+ * Does a bounded amount of garbage collecting: erases one block where all pages
+ * are deleted, or if there is none and clean is set, moves the used pages of the
+ * best candidate block and erases it.
+ * Meant to be called periodically when the file system is idle, so writes find
+ * erased blocks and don't have to wait for a garbage collection.
+ *
+ * Will set err_no to SPIFFS_OK if a block was erased,
+ * SPIFFS_ERR_NO_DELETED_BLOCKS if there was no block to erase,
+ * or other error.
+ *
+ * @param fs            the file system struct
+ * @param clean         if set, a block with used pages can be cleaned
+ */
+s32_t SPIFFS_gc_step(spiffs *fs, u8_t clean);
+
 /**
  * Check if EOF reached.
  * @param fs            the file system struct
@@ -733,6 +749,21 @@ s32_t SPIFFS_set_file_callback_func(spiffs *fs, spiffs_file_callback cb_func);
 s32_t SPIFFS_ix_map(spiffs *fs, spiffs_file fh, spiffs_ix_map *map,
     u32_t offset, u32_t len, spiffs_page_ix *map_buf);
 
+/**
+ * As SPIFFS_ix_map, but the map is not populated when the file is mapped.
+ * Instead, each map entry is populated when the data page it refers to is
+ * read, so the object index pages are only searched once for each page.
+ * This avoids scanning the whole mapped range for pages that may never be read.
+ * @param fs      the file system struct
+ * @param fh      the file handle of the file to map
+ * @param map     a spiffs_ix_map struct, describing the index map
+ * @param offset  absolute file offset where to start the index map
+ * @param len     length of the mapping in actual file bytes
+ * @param map_buf the array buffer for the look up data
+ */
+s32_t SPIFFS_ix_map_lazy(spiffs *fs, spiffs_file fh, spiffs_ix_map *map,
+    u32_t offset, u32_t len, spiffs_page_ix *map_buf);
+
 /**
  * Unmaps the index lookup from this filehandle. All future readings will
  * proceed as normal, requiring reading of the first level indices from
@@ -80,9 +80,10 @@ typedef unsigned char u8_t;
 #define SPIFFS_GC_MAX_RUNS              3
 #endif
 
-// Enable/disable statistics on gc. Debug/test purpose only.
+// Enable/disable statistics on gc. Lua RTOS counts the gc runs to report the
+// writes that had to wait for a gc (see vfs_spiffs_unlock).
 #ifndef SPIFFS_GC_STATS
-#define SPIFFS_GC_STATS                 0
+#define SPIFFS_GC_STATS                 1
 #endif
 
 // Garbage collecting examines all pages in a block which and sums up
@@ -157,13 +158,18 @@ typedef unsigned char u8_t;
 // SPIFFS_LOCK and SPIFFS_UNLOCK protects spiffs from reentrancy on api level
 // These should be defined on a multithreaded system
 
+// Lua RTOS calls spiffs from many threads (Lua threads, http server workers),
+// see vfs_spiffs_lock in vfs/spiffs.c
+void vfs_spiffs_lock();
+void vfs_spiffs_unlock();
+
 // define this to enter a mutex if you're running on a multithreaded system
 #ifndef SPIFFS_LOCK
-#define SPIFFS_LOCK(fs)
+#define SPIFFS_LOCK(fs) vfs_spiffs_lock()
 #endif
 // define this to exit a mutex if you're running on a multithreaded system
 #ifndef SPIFFS_UNLOCK
-#define SPIFFS_UNLOCK(fs)
+#define SPIFFS_UNLOCK(fs) vfs_spiffs_unlock()
 #endif
 
 // Enable if only one spiffs instance with constant configuration will exist
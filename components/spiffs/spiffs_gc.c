@@ -104,6 +104,53 @@ s32_t spiffs_gc_quick(
   return res;
 }
 
+// Does a bounded amount of garbage collecting: erases a block where all entries are
+// deleted, or if there is none and clean is set, cleanses and erases the best
+// candidate block. Returns SPIFFS_ERR_NO_DELETED_BLOCKS if nothing was done.
+// It's meant to be called when the file system is idle, so it's not counted in
+// stats_gc_runs, that counts the gcs done when pages are needed.
+s32_t spiffs_gc_step(
+    spiffs *fs, u8_t clean) {
+  s32_t res;
+#if SPIFFS_GC_STATS
+  u32_t gc_runs = fs->stats_gc_runs;
+#endif
+
+  res = spiffs_gc_quick(fs, 0);
+  if (res == SPIFFS_ERR_NO_DELETED_BLOCKS && clean) {
+    spiffs_block_ix *cands;
+    spiffs_block_ix cand;
+    int count;
+
+    res = spiffs_gc_find_candidate(fs, &cands, &count, 0);
+    if (res == SPIFFS_OK && count == 0) {
+      res = SPIFFS_ERR_NO_DELETED_BLOCKS;
+    }
+
+    if (res == SPIFFS_OK) {
+      cand = cands[0];
+      SPIFFS_GC_DBG("gc_step: cleaning block %i\n", cand);
+      fs->cleaning = 1;
+      res = spiffs_gc_clean(fs, cand);
+      fs->cleaning = 0;
+
+      if (res == SPIFFS_OK) {
+        res = spiffs_gc_erase_page_stats(fs, cand);
+      }
+
+      if (res == SPIFFS_OK) {
+        res = spiffs_gc_erase_block(fs, cand);
+      }
+    }
+  }
+
+#if SPIFFS_GC_STATS
+  fs->stats_gc_runs = gc_runs;
+#endif
+
+  return res;
+}
+
 // Checks if garbage collecting is necessary. If so a candidate block is found,
 // cleansed and erased
 s32_t spiffs_gc_check(
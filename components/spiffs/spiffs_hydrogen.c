@@ -596,6 +596,13 @@ s32_t SPIFFS_lseek(spiffs *fs, spiffs_file fh, s32_t offs, int whence) {
 
   spiffs_span_ix data_spix = offs / SPIFFS_DATA_PAGE_SIZE(fs);
   spiffs_span_ix objix_spix = SPIFFS_OBJ_IX_ENTRY_SPAN_IX(fs, data_spix);
+#if SPIFFS_IX_MAP
+  // no need to find the object index page if the data page is in the index map
+  if (fd->ix_map && data_spix >= fd->ix_map->start_spix && data_spix <= fd->ix_map->end_spix
+      && fd->ix_map->map_buf[data_spix - fd->ix_map->start_spix]) {
+    objix_spix = fd->cursor_objix_spix;
+  }
+#endif
   if (fd->cursor_objix_spix != objix_spix) {
     spiffs_page_ix pix;
     res = spiffs_obj_lu_find_id_and_span(
@@ -1135,6 +1142,24 @@ s32_t SPIFFS_gc(spiffs *fs, u32_t size) {
 #endif // SPIFFS_READ_ONLY
 }
 
+s32_t SPIFFS_gc_step(spiffs *fs, u8_t clean) {
+#if SPIFFS_READ_ONLY
+  (void)fs; (void)clean;
+  return SPIFFS_ERR_RO_NOT_IMPL;
+#else
+  s32_t res;
+  SPIFFS_API_CHECK_CFG(fs);
+  SPIFFS_API_CHECK_MOUNT(fs);
+  SPIFFS_LOCK(fs);
+
+  res = spiffs_gc_step(fs, clean);
+
+  SPIFFS_API_CHECK_RES_UNLOCK(fs, res);
+  SPIFFS_UNLOCK(fs);
+  return 0;
+#endif // SPIFFS_READ_ONLY
+}
+
 s32_t SPIFFS_eof(spiffs *fs, spiffs_file fh) {
   s32_t res;
   SPIFFS_API_CHECK_CFG(fs);
@@ -1190,8 +1215,8 @@ s32_t SPIFFS_set_file_callback_func(spiffs *fs, spiffs_file_callback cb_func) {
 
 #if SPIFFS_IX_MAP
 
-s32_t SPIFFS_ix_map(spiffs *fs,  spiffs_file fh, spiffs_ix_map *map,
-    u32_t offset, u32_t len, spiffs_page_ix *map_buf) {
+static s32_t spiffs_ix_map_set(spiffs *fs,  spiffs_file fh, spiffs_ix_map *map,
+    u32_t offset, u32_t len, spiffs_page_ix *map_buf, u8_t populate) {
   s32_t res;
   SPIFFS_API_CHECK_CFG(fs);
   SPIFFS_API_CHECK_MOUNT(fs);
@@ -1215,14 +1240,26 @@ s32_t SPIFFS_ix_map(spiffs *fs,  spiffs_file fh, spiffs_ix_map *map,
   memset(map_buf, 0, sizeof(spiffs_page_ix) * (map->end_spix - map->start_spix + 1));
   fd->ix_map = map;
 
-  // scan for pixes
-  res = spiffs_populate_ix_map(fs, fd, 0, map->end_spix - map->start_spix + 1);
-  SPIFFS_API_CHECK_RES_UNLOCK(fs, res);
+  if (populate) {
+    // scan for pixes
+    res = spiffs_populate_ix_map(fs, fd, 0, map->end_spix - map->start_spix + 1);
+    SPIFFS_API_CHECK_RES_UNLOCK(fs, res);
+  }
 
   SPIFFS_UNLOCK(fs);
   return res;
 }
 
+s32_t SPIFFS_ix_map(spiffs *fs,  spiffs_file fh, spiffs_ix_map *map,
+    u32_t offset, u32_t len, spiffs_page_ix *map_buf) {
+  return spiffs_ix_map_set(fs, fh, map, offset, len, map_buf, 1);
+}
+
+s32_t SPIFFS_ix_map_lazy(spiffs *fs,  spiffs_file fh, spiffs_ix_map *map,
+    u32_t offset, u32_t len, spiffs_page_ix *map_buf) {
+  return spiffs_ix_map_set(fs, fh, map, offset, len, map_buf, 0);
+}
+
 s32_t SPIFFS_ix_unmap(spiffs *fs,  spiffs_file fh) {
   s32_t res;
   SPIFFS_API_CHECK_CFG(fs);
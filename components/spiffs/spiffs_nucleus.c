@@ -2002,6 +2002,12 @@ s32_t spiffs_object_read(
     }
     res = spiffs_page_data_check(fs, fd, data_pix, data_spix);
     SPIFFS_CHECK_RES(res);
+#if SPIFFS_IX_MAP
+    // populate index map entries as they are looked up
+    if (fd->ix_map && data_spix >= fd->ix_map->start_spix && data_spix <= fd->ix_map->end_spix) {
+      fd->ix_map->map_buf[data_spix - fd->ix_map->start_spix] = data_pix;
+    }
+#endif
     res = _spiffs_rd(
         fs, SPIFFS_OP_T_OBJ_DA | SPIFFS_OP_C_READ,
         fd->file_nbr,
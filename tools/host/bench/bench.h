@@ -0,0 +1,31 @@
+/*
+ * Lua RTOS, benchmark helpers for the Linux host build
+ *
+ */
+
+#ifndef _HOST_BENCH_H
+#define _HOST_BENCH_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+static inline uint64_t bench_now_ns() {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Print a result line, in a format easy to parse by scripts:
+//
+// name, iterations, total time (ms), time per iteration (us)
+static inline void bench_report(const char *name, uint32_t iterations, uint64_t ns) {
+	printf("%-32s %8u %10.2f ms %10.3f us/op\n",
+		name, iterations, (double)ns / 1000000.0,
+		iterations?((double)ns / 1000.0) / iterations:0.0
+	);
+}
+
+#endif
@@ -0,0 +1,339 @@
+/*
+ * Lua RTOS, display pixel pipeline benchmark for the Linux host build
+ *
+ * Runs drivers/espi_disp.c over a mock SPI peripheral, that provides
+ * espi_disp_dma_start / espi_disp_dma_wait as espi.c does on the target.
+ *
+ * The mock walks the descriptors chain when the transfer is waited, so if the
+ * pipeline writes a buffer that is on the wire, the bytes sent are wrong. The
+ * wire is modeled with a clock: a transfer starts when the previous one ends,
+ * and takes bits / clock seconds, during which the CPU is free.
+ *
+ * Before the benchmark, the bytes sent for repeated color fills, for pixel
+ * buffers of several lengths, and for framebuffer windows are checked against
+ * the expected ones. Then fills
+ * and buffer pushes are timed with the pipeline, and with the SPI data buffer
+ * (64 bytes per transfer, the CPU waits for each one), as done before.
+ *
+ * Usage: bench_disp [clock MHz] [iterations]
+ *
+ */
+
+#include "bench.h"
+
+#include "drivers/espi_disp.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+	lldesc_t *desc;     // descriptors chain of the transfer in progress
+	uint32_t bits;      // bits of the transfer in progress
+	uint64_t wire_end;  // time when the wire is free, in ns
+	uint8_t *wire;      // bytes sent
+	uint32_t sent;      // number of bytes sent
+	uint32_t max;       // size of wire
+	uint32_t transfers; // number of transfers
+	uint32_t errors;    // number of descriptors chain errors
+} mock_spi_t;
+
+static double clock_mhz = 40.0;
+
+static uint64_t wire_ns(uint32_t bits) {
+	return (uint64_t)((double)bits * 1000.0 / clock_mhz);
+}
+
+static void wire_busy(mock_spi_t *spi, uint32_t bits) {
+	uint64_t now = bench_now_ns();
+
+	if (spi->wire_end < now) spi->wire_end = now;
+	spi->wire_end += wire_ns(bits);
+}
+
+static void wire_wait(mock_spi_t *spi) {
+	while (bench_now_ns() < spi->wire_end);
+}
+
+static void wire_put(mock_spi_t *spi, const uint8_t *data, uint32_t len) {
+	if (!spi->wire) return;
+
+	if (spi->sent + len > spi->max) {
+		spi->errors++;
+		return;
+	}
+
+	memcpy(spi->wire + spi->sent, data, len);
+	spi->sent += len;
+}
+
+void espi_disp_dma_start(disp_dma_t *dma, lldesc_t *desc, uint32_t bits) {
+	mock_spi_t *spi = (mock_spi_t *)dma->dev;
+
+	spi->desc = desc;
+	spi->bits = bits;
+	spi->transfers++;
+
+	wire_busy(spi, bits);
+}
+
+void espi_disp_dma_wait(disp_dma_t *dma) {
+	mock_spi_t *spi = (mock_spi_t *)dma->dev;
+	uint32_t len = spi->bits >> 3;
+	lldesc_t *desc = spi->desc;
+	uint32_t size;
+
+	wire_wait(spi);
+
+	// The DMA follows the chain until the SPI data length is reached
+	while (len > 0) {
+		if (!desc || !desc->owner || (desc->length == 0) || (desc->length > desc->size)) {
+			spi->errors++;
+			break;
+		}
+
+		size = (desc->length < len)?desc->length:len;
+		wire_put(spi, (const uint8_t *)desc->buf, size);
+		len -= size;
+
+		if ((len > 0) && desc->eof) {
+			spi->errors++;
+			break;
+		}
+
+		desc = desc->qe.stqe_next;
+	}
+
+	spi->desc = NULL;
+	spi->bits = 0;
+}
+
+// As disp_spi_transfer_color_pio in espi.c, 64 bytes per transfer
+static void pio_transfer(mock_spi_t *spi, const uint8_t *color, uint32_t len, uint8_t rep) {
+	uint8_t data_buf[64];
+	uint32_t count;
+
+	while (len > 0) {
+		count = (len > 32)?32:len;
+
+		disp_dma_pack(data_buf, color, count, rep);
+		wire_busy(spi, count << 4);
+		wire_wait(spi);
+		wire_put(spi, data_buf, count << 1);
+
+		if (!rep) color += count << 1;
+		len -= count;
+	}
+}
+
+static disp_dma_t *dma_new(mock_spi_t *spi) {
+	disp_dma_t *dma;
+
+	dma = malloc(DISP_DMA_SIZE);
+	if (!dma) {
+		printf("out of memory\n");
+		exit(1);
+	}
+
+	disp_dma_init(dma, spi);
+
+	return dma;
+}
+
+static int check_transfer(mock_spi_t *spi, disp_dma_t *dma, const uint8_t *color, uint32_t len, uint8_t rep) {
+	uint32_t i;
+
+	spi->sent = 0;
+	spi->errors = 0;
+	spi->wire_end = 0;
+
+	disp_dma_transfer(dma, color, len, rep);
+	disp_dma_wait(dma);
+
+	if (spi->errors || (spi->sent != (len << 1))) {
+		printf("FAIL: %s of %u pixels, %u bytes sent, %u errors\n",
+			rep?"fill":"push", len, spi->sent, spi->errors);
+		return 1;
+	}
+
+	for(i = 0;i < len;i++) {
+		if (rep) {
+			if ((spi->wire[i << 1] != color[1]) || (spi->wire[(i << 1) + 1] != color[0])) break;
+		} else {
+			if (memcmp(spi->wire + (i << 1), color + (i << 1), 2)) break;
+		}
+	}
+
+	if (i < len) {
+		printf("FAIL: %s of %u pixels, wrong pixel %u\n", rep?"fill":"push", len, i);
+		return 1;
+	}
+
+	return 0;
+}
+
+static int check_rect(mock_spi_t *spi, disp_dma_t *dma, const uint8_t *color, uint32_t w, uint32_t h, uint32_t stride) {
+	uint32_t y;
+
+	spi->sent = 0;
+	spi->errors = 0;
+	spi->wire_end = 0;
+
+	disp_dma_transfer_rect(dma, color, w, h, stride);
+	disp_dma_wait(dma);
+
+	if (spi->errors || (spi->sent != ((w * h) << 1))) {
+		printf("FAIL: rect %ux%u, %u bytes sent, %u errors\n", w, h, spi->sent, spi->errors);
+		return 1;
+	}
+
+	for(y = 0;y < h;y++) {
+		if (memcmp(spi->wire + ((y * w) << 1), color + ((y * stride) << 1), w << 1)) {
+			printf("FAIL: rect %ux%u, wrong row %u\n", w, h, y);
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+static int check(void) {
+	static const uint32_t lens[] = {
+		1, 2, 31, 32, 33, 63, 64, 65, DISP_DMA_REP_SIZE >> 1, (DISP_DMA_REP_SIZE >> 1) + 1,
+		DISP_DMA_BUF_SIZE >> 1, (DISP_DMA_BUF_SIZE >> 1) + 1, DISP_DMA_BUF_SIZE, 3 * DISP_DMA_BUF_SIZE + 7,
+		320 * 240
+	};
+	static const uint16_t colors[] = {0x0000, 0xf800, 0x07e0, 0x001f, 0x1234};
+	mock_spi_t spi;
+	disp_dma_t *dma;
+	uint8_t *buf;
+	uint32_t max = 320 * 240 * 2;
+	uint32_t i, j;
+	lldesc_t desc[4];
+	int fails = 0;
+	int n;
+
+	memset(&spi, 0, sizeof(spi));
+	spi.wire = malloc(max);
+	spi.max = max;
+	buf = malloc(max);
+	if (!spi.wire || !buf) {
+		printf("out of memory\n");
+		exit(1);
+	}
+
+	for(i = 0;i < max;i++) {
+		buf[i] = (uint8_t)(i * 7 + (i >> 8));
+	}
+
+	// Descriptors chain
+	n = disp_dma_build(desc, buf, 2 * DISP_DMA_DESC_MAX + 6, 0);
+	if ((n != 3) || (desc[0].length != DISP_DMA_DESC_MAX) || (desc[2].length != 6) ||
+		(desc[2].size != 8) || !desc[2].eof || desc[1].eof || desc[2].qe.stqe_next ||
+		(desc[0].qe.stqe_next != &desc[1])) {
+		printf("FAIL: descriptors chain\n");
+		fails++;
+	}
+
+	n = disp_dma_build(desc, buf, DISP_DMA_REP_SIZE, 1);
+	if ((n != 1) || desc[0].eof || (desc[0].qe.stqe_next != &desc[0])) {
+		printf("FAIL: looped descriptor\n");
+		fails++;
+	}
+
+	dma = dma_new(&spi);
+
+	// Same color several times, and a color change, use the repeated color buffer
+	for(i = 0;i < sizeof(colors) / sizeof(colors[0]);i++) {
+		for(j = 0;j < sizeof(lens) / sizeof(lens[0]);j++) {
+			fails += check_transfer(&spi, dma, (const uint8_t *)&colors[i], lens[j], 1);
+		}
+	}
+
+	// Pushes, with fills in between, with unaligned buffers
+	for(j = 0;j < sizeof(lens) / sizeof(lens[0]);j++) {
+		if (lens[j] * 2 + 1 > max) continue;
+
+		fails += check_transfer(&spi, dma, buf + (j & 1), lens[j], 0);
+		fails += check_transfer(&spi, dma, (const uint8_t *)&colors[j % 5], lens[j], 1);
+	}
+
+	// Framebuffer windows, rows of a buffer with stride pixels per row
+	fails += check_rect(&spi, dma, buf, 1, 1, 320);
+	fails += check_rect(&spi, dma, buf + 2, 7, 13, 320);
+	fails += check_rect(&spi, dma, buf + 64, 100, 60, 320);
+	fails += check_rect(&spi, dma, buf, 319, 200, 320);
+	fails += check_rect(&spi, dma, buf, DISP_DMA_BUF_SIZE >> 1, 3, 320);
+	fails += check_rect(&spi, dma, buf, DISP_DMA_BUF_SIZE, 2, DISP_DMA_BUF_SIZE + 1);
+
+	free(dma);
+	free(buf);
+	free(spi.wire);
+
+	printf("check: %s\n\n", fails?"FAIL":"OK");
+
+	return fails;
+}
+
+static void bench(const char *name, uint32_t iterations, uint32_t len, uint8_t rep, int use_dma) {
+	static uint16_t pixels[320 * 240];
+	mock_spi_t spi;
+	disp_dma_t *dma;
+	uint16_t color;
+	uint64_t t0, t1;
+	char tmp[64];
+	uint32_t i;
+
+	memset(&spi, 0, sizeof(spi));
+	dma = dma_new(&spi);
+
+	for(i = 0;i < len;i++) {
+		pixels[i] = (uint16_t)(i * 37);
+	}
+
+	t0 = bench_now_ns();
+	for(i = 0;i < iterations;i++) {
+		// A new color for each fill, as graphics primitives do
+		color = (uint16_t)(i * 1234);
+
+		if (use_dma) {
+			disp_dma_transfer(dma, rep?(const uint8_t *)&color:(const uint8_t *)pixels, len, rep);
+			disp_dma_wait(dma);
+		} else {
+			pio_transfer(&spi, rep?(const uint8_t *)&color:(const uint8_t *)pixels, len, rep);
+		}
+	}
+	t1 = bench_now_ns();
+
+	snprintf(tmp, sizeof(tmp), "%s %s", use_dma?"dma":"pio", name);
+	bench_report(tmp, iterations, t1 - t0);
+
+	if (use_dma) {
+		printf("%-32s %8u transfers, wire time %10.3f us/op\n", "", spi.transfers / iterations,
+			(double)wire_ns(len << 4) / 1000.0);
+	}
+
+	free(dma);
+}
+
+int main(int argc, char *argv[]) {
+	uint32_t iterations = 200;
+
+	if (argc > 1) clock_mhz = atof(argv[1]);
+	if (argc > 2) iterations = atoi(argv[2]);
+	if (clock_mhz <= 0) clock_mhz = 40.0;
+
+	printf("SPI clock %.1f MHz\n\n", clock_mhz);
+
+	if (check()) return 1;
+
+	bench("fill 320x240", iterations / 10 + 1, 320 * 240, 1, 0);
+	bench("fill 320x240", iterations / 10 + 1, 320 * 240, 1, 1);
+	bench("fill 16x16", iterations * 20, 16 * 16, 1, 0);
+	bench("fill 16x16", iterations * 20, 16 * 16, 1, 1);
+	bench("push 8x8 (jpeg block)", iterations * 50, 8 * 8, 0, 0);
+	bench("push 8x8 (jpeg block)", iterations * 50, 8 * 8, 0, 1);
+	bench("push 320x16", iterations * 2, 320 * 16, 0, 0);
+	bench("push 320x16", iterations * 2, 320 * 16, 0, 1);
+
+	return 0;
+}
@@ -0,0 +1,485 @@
+/*
+ * Lua RTOS, http server benchmark
+ *
+ * Starts the http server over a SPIFFS file system (RAM backed flash emulator)
+ * populated with a set of web assets, and loads it through loopback sockets with
+ * a number of concurrent clients, first with persistent connections, and then
+ * with a new connection per request. Every response is checked.
+ *
+ * usage: bench_http [clients] [requests per client]
+ *
+ */
+
+#include "luartos.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/stat.h>
+
+#include "lwip/sockets.h"
+
+#include "vfs.h"
+
+#include "flash_emu.h"
+#include "bench.h"
+
+extern int http_start();
+extern void http_stop();
+
+#define ASSETS     16
+#define CLIENT_BUF 65536
+
+// Asset sizes, from a small stylesheet to an image
+static const int asset_size[ASSETS] = {
+	180, 512, 900, 1024, 1500, 2047, 2048, 3000,
+	4096, 5000, 7300, 8192, 12000, 16384, 24000, 32768
+};
+
+typedef struct {
+	int keep_alive;
+	int requests;
+	unsigned int seed;
+	int connections;
+	int errors;
+	uint64_t ns;
+} client_t;
+
+typedef struct {
+	int s;
+	int len;
+	char buf[CLIENT_BUF + 1];
+} conn_t;
+
+static char asset_byte(int asset, int pos) {
+	return 'a' + (asset + pos) % 26;
+}
+
+static void asset_path(char *path, int asset) {
+	if (asset < 0) {
+		strcpy(path, "/www/index.html");
+	} else {
+		sprintf(path, "/www/asset%d.%s", asset, (asset & 1) ? "css" : "png");
+	}
+}
+
+static void populate() {
+	char path[PATH_MAX];
+	char block[256];
+	int i, j, n, fd;
+
+	if (mkdir("/www", 0) < 0) {
+		fprintf(stderr, "mkdir /www: %s\n", strerror(errno));
+		exit(1);
+	}
+
+	for(i = -1;i < ASSETS;i++) {
+		asset_path(path, i);
+
+		fd = open(path, O_CREAT | O_WRONLY, 0);
+		if (fd < 0) {
+			fprintf(stderr, "open %s: %s\n", path, strerror(errno));
+			exit(1);
+		}
+
+		if (i < 0) {
+			write(fd, "<html>index</html>", 18);
+		} else {
+			for(j = 0;j < asset_size[i];j += n) {
+				n = asset_size[i] - j;
+				if (n > sizeof(block)) n = sizeof(block);
+
+				for(int k = 0;k < n;k++) {
+					block[k] = asset_byte(i, j + k);
+				}
+
+				write(fd, block, n);
+			}
+		}
+
+		close(fd);
+	}
+}
+
+static int client_connect() {
+	struct sockaddr_in sin;
+	int s, flag = 1;
+
+	s = socket(AF_INET, SOCK_STREAM, 0);
+	if (s < 0) {
+		return -1;
+	}
+
+	sin.sin_family      = AF_INET;
+	sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	sin.sin_port        = htons(CONFIG_LUA_RTOS_HTTP_SERVER_PORT);
+
+	if (connect(s, (struct sockaddr *)&sin, sizeof(sin)) < 0) {
+		close(s);
+		return -1;
+	}
+
+	setsockopt(s, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+
+	return s;
+}
+
+// Receive more data, returns 0 if connection is closed
+static int conn_fill(conn_t *c) {
+	int n;
+
+	if (c->len >= CLIENT_BUF) {
+		return 0;
+	}
+
+	n = recv(c->s, c->buf + c->len, CLIENT_BUF - c->len, 0);
+	if (n <= 0) {
+		return 0;
+	}
+
+	c->len += n;
+	c->buf[c->len] = '\0';
+
+	return 1;
+}
+
+// Remove the first len bytes, that are processed
+static void conn_consume(conn_t *c, int len) {
+	c->len -= len;
+	memmove(c->buf, c->buf + len, c->len);
+	c->buf[c->len] = '\0';
+}
+
+/*
+ * Reads a response, and copies its body to body. Returns the status code, or
+ * -1 on error. In closed returns if the server closes the connection.
+ */
+static int conn_response(conn_t *c, char *body, int *body_len, int *closed) {
+	char *end, *line, *last;
+	int status, length = 0, chunked = 0;
+	int pos, size;
+
+	while (!(end = strstr(c->buf, "\r\n\r\n"))) {
+		if (!conn_fill(c)) return -1;
+	}
+
+	*end = '\0';
+
+	if (sscanf(c->buf, "HTTP/1.1 %d", &status) != 1) {
+		return -1;
+	}
+
+	*closed = 0;
+	strtok_r(c->buf, "\r\n", &last);
+	while ((line = strtok_r(NULL, "\r\n", &last))) {
+		if (strncasecmp(line, "Content-Length:", 15) == 0) {
+			length = atoi(line + 15);
+		} else if (strncasecmp(line, "Transfer-Encoding: chunked", 26) == 0) {
+			chunked = 1;
+		} else if (strncasecmp(line, "Connection: close", 17) == 0) {
+			*closed = 1;
+		}
+	}
+
+	conn_consume(c, end - c->buf + 4);
+
+	// Body
+	*body_len = 0;
+
+	if (!chunked) {
+		while (c->len < length) {
+			if (!conn_fill(c)) return -1;
+		}
+
+		memcpy(body, c->buf, length);
+		*body_len = length;
+		conn_consume(c, length);
+
+		return status;
+	}
+
+	for(;;) {
+		while (!(end = strstr(c->buf, "\r\n"))) {
+			if (!conn_fill(c)) return -1;
+		}
+
+		size = strtol(c->buf, NULL, 16);
+		pos = end - c->buf + 2;
+
+		while (c->len < pos + size + 2) {
+			if (!conn_fill(c)) return -1;
+		}
+
+		memcpy(body + *body_len, c->buf + pos, size);
+		*body_len += size;
+		conn_consume(c, pos + size + 2);
+
+		if (size == 0) {
+			return status;
+		}
+	}
+}
+
+// Does a request, and checks the response
+static int client_get(client_t *client, conn_t *c, char *body, int asset) {
+	char req[128];
+	char path[PATH_MAX];
+	int status, len, closed, i;
+
+	if (c->s < 0) {
+		if ((c->s = client_connect()) < 0) {
+			return -1;
+		}
+
+		c->len = 0;
+		client->connections++;
+	}
+
+	asset_path(path, asset);
+	len = snprintf(req, sizeof(req), "GET %s HTTP/1.1\r\nHost: localhost\r\n%s\r\n",
+			path, client->keep_alive ? "" : "Connection: close\r\n");
+
+	if (send(c->s, req, len, 0) != len) {
+		return -1;
+	}
+
+	status = conn_response(c, body, &len, &closed);
+
+	if (closed || !client->keep_alive) {
+		close(c->s);
+		c->s = -1;
+	}
+
+	if (status != 200) {
+		return -1;
+	}
+
+	if (asset < 0) {
+		return strncmp(body, "<html>index</html>", 18) ? -1 : 0;
+	}
+
+	if (len != asset_size[asset]) {
+		return -1;
+	}
+
+	for(i = 0;i < len;i++) {
+		if (body[i] != asset_byte(asset, i)) {
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static void *client_thread(void *arg) {
+	client_t *client = (client_t *)arg;
+	conn_t *c;
+	char *body;
+	uint64_t t0;
+	int i;
+
+	c = calloc(1, sizeof(conn_t));
+	body = malloc(CLIENT_BUF);
+
+	c->s = -1;
+
+	t0 = bench_now_ns();
+
+	for(i = 0;i < client->requests;i++) {
+		client->seed = client->seed * 1103515245 + 12345;
+
+		if (client_get(client, c, body, ((client->seed >> 16) % (ASSETS + 1)) - 1) < 0) {
+			client->errors++;
+			if (c->s >= 0) {
+				close(c->s);
+				c->s = -1;
+			}
+		}
+	}
+
+	client->ns = bench_now_ns() - t0;
+
+	if (c->s >= 0) {
+		close(c->s);
+	}
+
+	free(c);
+	free(body);
+
+	return NULL;
+}
+
+static void bench(const char *name, int clients, int requests, int keep_alive) {
+	pthread_t threads[clients];
+	client_t client[clients];
+	int connections = 0, errors = 0, i;
+	uint64_t t0, ns, latency = 0;
+	char label[64];
+
+	t0 = bench_now_ns();
+
+	for(i = 0;i < clients;i++) {
+		memset(&client[i], 0, sizeof(client_t));
+		client[i].keep_alive = keep_alive;
+		client[i].requests = requests;
+		client[i].seed = i + 1;
+
+		pthread_create(&threads[i], NULL, client_thread, &client[i]);
+	}
+
+	for(i = 0;i < clients;i++) {
+		pthread_join(threads[i], NULL);
+		connections += client[i].connections;
+		errors += client[i].errors;
+		latency += client[i].ns;
+	}
+
+	ns = bench_now_ns() - t0;
+
+	snprintf(label, sizeof(label), "%s, %d clients", name, clients);
+	bench_report(label, clients * requests, latency);
+	printf("%-32s %8.0f req/s, %d connections, %d errors\n", "",
+		(double)clients * requests * 1000000000.0 / ns, connections, errors);
+
+	if (errors) {
+		exit(1);
+	}
+}
+
+// Checks the responses that are not a file
+static void check() {
+	const char *req;
+	conn_t *c;
+	char *body;
+	int status, len, closed;
+
+	c = calloc(1, sizeof(conn_t));
+	body = malloc(CLIENT_BUF);
+
+	c->s = client_connect();
+
+	// Directory listing, chunked, followed by a pipelined request
+	req = "GET /?a=1 HTTP/1.1\r\n\r\nGET /www/nofile HTTP/1.1\r\n\r\n";
+	send(c->s, req, strlen(req), 0);
+
+	status = conn_response(c, body, &len, &closed);
+	body[len] = '\0';
+	if ((status != 200) || closed || !strstr(body, "www/") || !strstr(body, "</HTML>")) {
+		fprintf(stderr, "check: bad directory listing (%d)\n", status);
+		exit(1);
+	}
+
+	status = conn_response(c, body, &len, &closed);
+	if ((status != 404) || closed) {
+		fprintf(stderr, "check: expected 404 (%d)\n", status);
+		exit(1);
+	}
+
+	// Not supported method closes the connection
+	req = "POST / HTTP/1.1\r\n\r\n";
+	send(c->s, req, strlen(req), 0);
+
+	status = conn_response(c, body, &len, &closed);
+	if ((status != 501) || !closed || conn_fill(c)) {
+		fprintf(stderr, "check: expected 501 and close (%d)\n", status);
+		exit(1);
+	}
+
+	close(c->s);
+	free(c);
+	free(body);
+}
+
+// Checks that a start on a port in use fails, and that the server can be
+// started again when the port is free
+static void check_restart() {
+	struct sockaddr_in sin;
+	int s, flag = 1;
+
+	s = socket(AF_INET, SOCK_STREAM, 0);
+	setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &flag, sizeof(flag));
+
+	sin.sin_family      = AF_INET;
+	sin.sin_addr.s_addr = INADDR_ANY;
+	sin.sin_port        = htons(CONFIG_LUA_RTOS_HTTP_SERVER_PORT);
+
+	if ((bind(s, (struct sockaddr *)&sin, sizeof(sin)) < 0) || (listen(s, 1) < 0)) {
+		fprintf(stderr, "check: can't listen on port %d\n", CONFIG_LUA_RTOS_HTTP_SERVER_PORT);
+		exit(1);
+	}
+
+	if (http_start() == 0) {
+		fprintf(stderr, "check: server started on a port in use\n");
+		exit(1);
+	}
+
+	http_stop();
+	close(s);
+
+	if (http_start() < 0) {
+		fprintf(stderr, "check: server not started after a failed start\n");
+		exit(1);
+	}
+
+	http_stop();
+}
+
+int main(int argc, char *argv[]) {
+	int clients = CONFIG_LUA_RTOS_HTTP_SERVER_WORKERS;
+	int requests = 2000;
+	int i, s;
+
+	if (argc > 1) clients = atoi(argv[1]);
+	if (argc > 2) requests = atoi(argv[2]);
+
+	// Clients closing the connection must not kill the server
+	signal(SIGPIPE, SIG_IGN);
+
+	if (flash_emu_init(SPIFFS_BASE_ADDR, SPIFFS_SIZE, NULL) < 0) {
+		fprintf(stderr, "can't create flash emulator\n");
+		return 1;
+	}
+
+	vfs_spiffs_register();
+	populate();
+
+	if (http_start() < 0) {
+		fprintf(stderr, "can't start the server\n");
+		return 1;
+	}
+
+	// Wait for the server
+	for(i = 0;(s = client_connect()) < 0;i++) {
+		if (i == 100) {
+			fprintf(stderr, "server is not listening on port %d\n", CONFIG_LUA_RTOS_HTTP_SERVER_PORT);
+			return 1;
+		}
+
+		usleep(10000);
+	}
+	close(s);
+
+	check();
+
+	printf("%d workers, %d bytes buffers\n", CONFIG_LUA_RTOS_HTTP_SERVER_WORKERS, CONFIG_LUA_RTOS_HTTP_SERVER_BUFFER_SIZE);
+
+	bench("keep-alive", clients, requests, 1);
+	bench("close", clients, requests, 0);
+	bench("keep-alive", clients * 3, requests / 3, 1);
+	bench("close", clients * 3, requests / 3, 0);
+
+	http_stop();
+
+	check_restart();
+
+	printf("all checks passed\n");
+
+	return 0;
+}
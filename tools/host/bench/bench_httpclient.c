@@ -0,0 +1,548 @@
+/*
+ * Lua RTOS, http client benchmark for the Linux host build
+ *
+ * Runs components/http/httpclient.c against a test server in a thread, over
+ * loopback. Before the benchmark, bodies with a content length, with chunked
+ * transfer encoding, gzip compressed, until the connection is closed and after
+ * a redirect are received and checked, as well as the reuse of kept alive
+ * connections, and the compatibility of http_request_w_body.
+ *
+ * Then bodies are received with a kept alive connection and with a new
+ * connection per request, and a large gzip compressed body is received with
+ * http_request_stream and with http_request_w_body. The peak heap used by the
+ * client is reported.
+ *
+ * Usage: bench_httpclient [requests] [large body KB]
+ *
+ */
+
+#include "bench.h"
+
+#include "httpclient.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "lwip/sockets.h"
+
+#include <zlib/zlib.h>
+
+#define MAX_BODY (4 * 1024 * 1024)
+
+// Body bytes, as sent by the server
+static char *pattern;
+
+static int server_sock;
+static int server_port;
+static volatile int accepts;
+static volatile int posts;
+
+/*
+ * Client heap accounting. The client objects are linked with malloc, calloc,
+ * realloc and free wrapped, and the blocks allocated by the thread that tracks
+ * are accounted.
+ */
+typedef struct {
+	size_t size;
+	size_t tracked;
+} block_t;
+
+static __thread int tracking;
+static size_t heap_used, heap_peak;
+
+void *__real_malloc(size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void __real_free(void *ptr);
+
+static void heap_account(block_t *b, size_t size) {
+	b->size = size;
+	b->tracked = tracking;
+
+	if (tracking) {
+		heap_used += size;
+		if (heap_used > heap_peak) heap_peak = heap_used;
+	}
+}
+
+void *__wrap_malloc(size_t size) {
+	block_t *b = __real_malloc(sizeof(block_t) + size);
+
+	if (!b) return NULL;
+	heap_account(b, size);
+
+	return b + 1;
+}
+
+void *__wrap_calloc(size_t n, size_t size) {
+	void *ptr = __wrap_malloc(n * size);
+
+	if (ptr) memset(ptr, 0, n * size);
+
+	return ptr;
+}
+
+void __wrap_free(void *ptr) {
+	block_t *b;
+
+	if (!ptr) return;
+
+	b = (block_t *)ptr - 1;
+	if (b->tracked) heap_used -= b->size;
+
+	__real_free(b);
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+	block_t *b;
+
+	if (!ptr) return __wrap_malloc(size);
+
+	b = (block_t *)ptr - 1;
+	if (b->tracked) heap_used -= b->size;
+
+	b = __real_realloc(b, sizeof(block_t) + size);
+	if (!b) return NULL;
+	heap_account(b, size);
+
+	return b + 1;
+}
+
+static void heap_track(int on) {
+	tracking = on;
+	if (on) heap_peak = heap_used;
+}
+
+// Test server
+static int send_all(int s, const void *data, int len) {
+	while (len > 0) {
+		int n = send(s, data, len, MSG_NOSIGNAL);
+		if (n <= 0) return -1;
+		data = (const char *)data + n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+static int send_chunked(int s, const char *data, int len) {
+	char line[32];
+	unsigned int seed = len;
+	int n;
+
+	while (len > 0) {
+		n = 1 + rand_r(&seed) % 3000;
+		if (n > len) n = len;
+
+		// Some chunks with an extension
+		sprintf(line, "%x%s\r\n", n, (n & 1)?";ext=1":"");
+		if (send_all(s, line, strlen(line)) || send_all(s, data, n) || send_all(s, "\r\n", 2)) return -1;
+
+		data += n;
+		len -= n;
+	}
+
+	return send_all(s, "0\r\nX-Trailer: 1\r\n\r\n", 19);
+}
+
+// Returns the gzip compressed first len bytes of the pattern
+static char *gzip(int len, int *zlen) {
+	z_stream zs;
+	char *out;
+	int size = len + len / 100 + 1024;
+
+	out = malloc(size);
+	memset(&zs, 0, sizeof(zs));
+	deflateInit2(&zs, 6, Z_DEFLATED, 16 + MAX_WBITS, 8, Z_DEFAULT_STRATEGY);
+
+	zs.next_in = (Bytef *)pattern;
+	zs.avail_in = len;
+	zs.next_out = (Bytef *)out;
+	zs.avail_out = size;
+	deflate(&zs, Z_FINISH);
+
+	*zlen = size - zs.avail_out;
+	deflateEnd(&zs);
+
+	return out;
+}
+
+/*
+ * Serves the requests of a connection. Paths are /<kind>/<length>, with kind:
+ *
+ * len        body with a content length
+ * chunked    chunked body
+ * gzip       gzip body with a content length
+ * gzipchunk  chunked gzip body
+ * close      HTTP/1.0 body, ended by closing the connection
+ * drop       body with a content length, then the connection is closed
+ * redirect   redirect to /len/<length>
+ * notmod     304 Not Modified, without location
+ * stale      body with a content length, then the connection is closed when
+ *            the next request is received, without a response
+ */
+static void serve(int s) {
+	char req[1024], method[8], kind[32], head[256];
+	char *body;
+	int len, n, blen, zlen;
+	int stale = 0;
+
+	for(;;) {
+		// Read a request
+		len = 0;
+		for(;;) {
+			req[len] = '\0';
+			if (strstr(req, "\r\n\r\n")) break;
+			if (len == sizeof(req) - 1) return;
+
+			n = recv(s, req + len, sizeof(req) - 1 - len, 0);
+			if (n <= 0) return;
+			len += n;
+		}
+
+		if (sscanf(req, "%7[A-Z] /%31[a-z]/%d", method, kind, &blen) != 3) {
+			kind[0] = '\0';
+			blen = 0;
+		}
+		if (blen > MAX_BODY) blen = MAX_BODY;
+
+		if (!strcmp(method, "POST")) __sync_fetch_and_add(&posts, 1);
+		if (stale) return;
+
+		if (!strcmp(kind, "len") || !strcmp(kind, "drop") || !strcmp(kind, "stale")) {
+			sprintf(head, "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\nContent-Length: %d\r\n\r\n", blen);
+			if (send_all(s, head, strlen(head)) || send_all(s, pattern, blen)) return;
+			if (!strcmp(kind, "drop")) return;
+			stale = !strcmp(kind, "stale");
+		} else if (!strcmp(kind, "chunked")) {
+			sprintf(head, "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\nTransfer-Encoding: chunked\r\n\r\n");
+			if (send_all(s, head, strlen(head)) || send_chunked(s, pattern, blen)) return;
+		} else if (!strcmp(kind, "gzip") || !strcmp(kind, "gzipchunk")) {
+			body = gzip(blen, &zlen);
+			if (!strcmp(kind, "gzip")) {
+				sprintf(head, "HTTP/1.1 200 OK\r\nContent-Encoding: gzip\r\nContent-Length: %d\r\n\r\n", zlen);
+				n = send_all(s, head, strlen(head)) || send_all(s, body, zlen);
+			} else {
+				sprintf(head, "HTTP/1.1 200 OK\r\nContent-Encoding: gzip\r\nTransfer-Encoding: gzip, chunked\r\n\r\n");
+				n = send_all(s, head, strlen(head)) || send_chunked(s, body, zlen);
+			}
+			free(body);
+			if (n) return;
+		} else if (!strcmp(kind, "close")) {
+			sprintf(head, "HTTP/1.0 200 OK\r\nContent-Type: text/plain\r\n\r\n");
+			send_all(s, head, strlen(head));
+			send_all(s, pattern, blen);
+			return;
+		} else if (!strcmp(kind, "redirect")) {
+			sprintf(head, "HTTP/1.1 302 Found\r\nLocation: /len/%d\r\nContent-Length: 5\r\n\r\nmoved", blen);
+			if (send_all(s, head, strlen(head))) return;
+		} else if (!strcmp(kind, "notmod")) {
+			sprintf(head, "HTTP/1.1 304 Not Modified\r\n\r\n");
+			if (send_all(s, head, strlen(head))) return;
+		} else {
+			sprintf(head, "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n\r\n");
+			if (send_all(s, head, strlen(head))) return;
+		}
+	}
+}
+
+static void *conn_thread(void *arg) {
+	int s = (int)(intptr_t)arg;
+
+	serve(s);
+	close(s);
+
+	return NULL;
+}
+
+static void *server_thread(void *arg) {
+	pthread_t thread;
+	int s, flag = 1;
+
+	for(;;) {
+		s = accept(server_sock, NULL, NULL);
+		if (s < 0) continue;
+
+		setsockopt(s, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+
+		__sync_fetch_and_add(&accepts, 1);
+
+		pthread_create(&thread, NULL, conn_thread, (void *)(intptr_t)s);
+		pthread_detach(thread);
+	}
+
+	return NULL;
+}
+
+static void server_start() {
+	struct sockaddr_in sin;
+	socklen_t len = sizeof(sin);
+	pthread_t thread;
+	int i;
+
+	pattern = malloc(MAX_BODY);
+	for(i = 0;i < MAX_BODY;i += 32) {
+		char line[40];
+
+		sprintf(line, "line %08d of the body .....\n", i / 32);
+		memcpy(pattern + i, line, 32);
+	}
+
+	server_sock = socket(AF_INET, SOCK_STREAM, 0);
+
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family      = AF_INET;
+	sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	sin.sin_port        = 0;
+
+	if ((bind(server_sock, (struct sockaddr *)&sin, sizeof(sin)) < 0) || (listen(server_sock, 8) < 0)) {
+		perror("server");
+		exit(1);
+	}
+
+	getsockname(server_sock, (struct sockaddr *)&sin, &len);
+	server_port = ntohs(sin.sin_port);
+
+	pthread_create(&thread, NULL, server_thread, NULL);
+}
+
+// Client sink, that checks the body against the pattern
+typedef struct {
+	int len;
+	int max_chunk;
+	int ok;
+	int stop_at;
+} body_t;
+
+static int check_sink(void *arg, const char *data, size_t len) {
+	body_t *b = (body_t *)arg;
+
+	if ((b->len + len > MAX_BODY) || memcmp(data, pattern + b->len, len)) b->ok = 0;
+	if (len > b->max_chunk) b->max_chunk = len;
+	b->len += len;
+
+	return (b->stop_at && (b->len >= b->stop_at));
+}
+
+static http_ret_t get(const char *kind, int len, body_t *b) {
+	http_header_t *header;
+	http_ret_t ret;
+	char url[64];
+
+	sprintf(url, "http://127.0.0.1:%d/%s/%d", server_port, kind, len);
+
+	memset(b, 0, sizeof(body_t));
+	b->ok = 1;
+
+	ret = http_request_stream(url, HTTP_REQ_GET, NULL, NULL, &header, check_sink, b);
+	http_header_free(header);
+
+	return ret;
+}
+
+static int check(void) {
+	static const char *kinds[] = {"len", "chunked", "gzip", "gzipchunk", "close", "redirect", "drop", NULL};
+	static const int lens[] = {0, 1, 2047, 2048, 2049, 100000, -1};
+	http_response_t *resp;
+	const char **kind;
+	const int *len;
+	char url[64];
+	http_ret_t ret;
+	body_t b;
+	int fails = 0;
+	int i, n;
+
+	for(kind = kinds;*kind;kind++) {
+		for(len = lens;*len >= 0;len++) {
+			ret = get(*kind, *len, &b);
+			if ((ret != HTTP_SUCCESS) || !b.ok || (b.len != *len) || (b.max_chunk > 2048)) {
+				printf("FAIL: /%s/%d, status %d, %d bytes\n", *kind, *len, ret, b.len);
+				fails++;
+			}
+		}
+	}
+
+	// A kept alive connection is reused
+	http_close_connections();
+	n = accepts;
+	for(i = 0;i < 20;i++) {
+		if ((get((i & 1)?"chunked":"gzip", 5000, &b) != HTTP_SUCCESS) || !b.ok) fails++;
+	}
+	if (accepts != n + 1) {
+		printf("FAIL: %d connections for 20 requests\n", accepts - n);
+		fails++;
+	}
+
+	// A connection closed by the server is not reused
+	http_close_connections();
+	n = accepts;
+	get("close", 100, &b);
+	get("drop", 100, &b);
+	usleep(10000);
+	if ((get("len", 100, &b) != HTTP_SUCCESS) || !b.ok || (accepts != n + 3)) {
+		printf("FAIL: request after a closed connection, %d connections\n", accepts - n);
+		fails++;
+	}
+
+	// A request on a connection that the server closes after it's checked is retried, if
+	// it's idempotent
+	http_close_connections();
+	n = accepts;
+	get("stale", 100, &b);
+	if ((get("len", 100, &b) != HTTP_SUCCESS) || !b.ok || (accepts != n + 2)) {
+		printf("FAIL: GET not retried on a stale connection, %d connections\n", accepts - n);
+		fails++;
+	}
+
+	http_close_connections();
+	n = posts;
+	get("stale", 100, &b);
+	sprintf(url, "http://127.0.0.1:%d/len/100", server_port);
+	{
+		http_header_t *header;
+
+		memset(&b, 0, sizeof(b));
+		b.ok = 1;
+		ret = http_request_stream(url, HTTP_REQ_POST, "Content-Length: 1\r\n\r\n", "x", &header, check_sink, &b);
+		if ((ret == HTTP_SUCCESS) || (posts != n + 1)) {
+			printf("FAIL: POST retried on a stale connection, status %d, %d posts\n", ret, posts - n);
+			fails++;
+		}
+		http_header_free(header);
+	}
+
+	// A 3xx without location is the response
+	{
+		http_header_t *header;
+
+		sprintf(url, "http://127.0.0.1:%d/notmod/0", server_port);
+		memset(&b, 0, sizeof(b));
+		ret = http_request_stream(url, HTTP_REQ_GET, NULL, NULL, &header, check_sink, &b);
+		if ((ret != HTTP_SUCCESS) || (header == NULL) || (header->status_code != 304) || b.len) {
+			printf("FAIL: 304 without location, status %d\n", ret);
+			fails++;
+		}
+		http_header_free(header);
+	}
+
+	// The sink stops the request
+	memset(&b, 0, sizeof(b));
+	sprintf(url, "http://127.0.0.1:%d/gzip/100000", server_port);
+	{
+		http_header_t *header;
+
+		b.ok = 1;
+		b.stop_at = 10000;
+		ret = http_request_stream(url, HTTP_REQ_GET, NULL, NULL, &header, check_sink, &b);
+		if ((ret != HTTP_ERR_SINK) || (header == NULL) || (header->status_code != 200) || (b.len >= 100000)) {
+			printf("FAIL: sink abort, status %d\n", ret);
+			fails++;
+		}
+		http_header_free(header);
+	}
+
+	// http_request_w_body
+	sprintf(url, "http://127.0.0.1:%d/gzipchunk/70000", server_port);
+	resp = http_request(url, HTTP_REQ_GET, NULL);
+	if ((resp->status != HTTP_SUCCESS) || (resp->length != 70000) || memcmp(resp->contents, pattern, 70000) ||
+		resp->contents[70000] || strcmp(resp->p_header->status_text, "OK")) {
+		printf("FAIL: http_request, status %d\n", resp->status);
+		fails++;
+	}
+	http_response_free(resp);
+
+	sprintf(url, "http://127.0.0.1:%d/len/0", server_port);
+	resp = http_request(url, HTTP_REQ_GET, NULL);
+	if ((resp->status != HTTP_EMPTY_BODY) || resp->contents || (resp->p_header->status_code != 200)) {
+		printf("FAIL: http_request, empty body, status %d\n", resp->status);
+		fails++;
+	}
+	http_response_free(resp);
+
+	sprintf(url, "http://127.0.0.1:%d/", server_port);
+	resp = http_request(url, HTTP_REQ_GET, NULL);
+	if ((resp->status != HTTP_EMPTY_BODY) || (resp->p_header->status_code != 404)) {
+		printf("FAIL: http_request, not found, status %d\n", resp->status);
+		fails++;
+	}
+	http_response_free(resp);
+
+	printf("check: %s\n\n", fails?"FAIL":"OK");
+
+	return fails;
+}
+
+static void bench_get(const char *name, const char *kind, int len, uint32_t requests, int reuse) {
+	uint64_t t0, t1;
+	uint32_t i;
+	body_t b;
+	int n = accepts;
+
+	t0 = bench_now_ns();
+	for(i = 0;i < requests;i++) {
+		if (!reuse) http_close_connections();
+		if ((get(kind, len, &b) != HTTP_SUCCESS) || !b.ok || (b.len != len)) {
+			printf("FAIL: %s\n", name);
+			exit(1);
+		}
+	}
+	t1 = bench_now_ns();
+
+	bench_report(name, requests, t1 - t0);
+	printf("%-32s %8d connections\n", "", accepts - n);
+}
+
+int main(int argc, char *argv[]) {
+	uint32_t requests = 500;
+	int large = 1024;
+	http_response_t *resp;
+	uint64_t t0, t1;
+	char url[64];
+	body_t b;
+
+	if (argc > 1) requests = atoi(argv[1]);
+	if (argc > 2) large = atoi(argv[2]);
+	if (large * 1024 > MAX_BODY) large = MAX_BODY / 1024;
+
+	server_start();
+
+	if (check()) return 1;
+
+	bench_get("16 KB, kept alive", "len", 16384, requests, 1);
+	bench_get("16 KB, new connections", "len", 16384, requests, 0);
+	bench_get("16 KB chunked gzip, kept alive", "gzipchunk", 16384, requests, 1);
+
+	printf("\n%d KB gzip body\n\n", large);
+
+	heap_track(1);
+	t0 = bench_now_ns();
+	if ((get("gzip", large * 1024, &b) != HTTP_SUCCESS) || !b.ok) {
+		printf("FAIL: stream\n");
+		return 1;
+	}
+	t1 = bench_now_ns();
+	heap_track(0);
+	bench_report("http_request_stream", 1, t1 - t0);
+	printf("%-32s %8zu bytes peak heap\n", "", heap_peak);
+
+	sprintf(url, "http://127.0.0.1:%d/gzip/%d", server_port, large * 1024);
+
+	heap_track(1);
+	t0 = bench_now_ns();
+	resp = http_request(url, HTTP_REQ_GET, NULL);
+	t1 = bench_now_ns();
+	if ((resp->status != HTTP_SUCCESS) || (resp->length != large * 1024)) {
+		printf("FAIL: http_request\n");
+		return 1;
+	}
+	http_response_free(resp);
+	heap_track(0);
+	bench_report("http_request_w_body", 1, t1 - t0);
+	printf("%-32s %8zu bytes peak heap\n", "", heap_peak);
+
+	http_close_connections();
+
+	return 0;
+}
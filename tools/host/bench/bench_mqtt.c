@@ -0,0 +1,251 @@
+/*
+ * Lua RTOS, MQTT topic matching benchmark for the Linux host build
+ *
+ * Runs Lua/modules/mqtt_trie.c. Before the benchmark, topics are matched
+ * against filters with and without wildcards, and the result is checked
+ * against the MQTT specification rules.
+ *
+ * Then topics are matched against a set of subscriptions with the trie, and
+ * with the list of subscriptions walked with strcmp, as done before (that
+ * doesn't match wildcards).
+ *
+ * Usage: bench_mqtt [subscriptions] [iterations]
+ *
+ */
+
+#include "bench.h"
+
+#include "mqtt_trie.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+	const char *filter;
+	const char *topic;
+	int match;
+} check_t;
+
+static const check_t checks[] = {
+	{"a/b/c",     "a/b/c",     1},
+	{"a/b/c",     "a/b",       0},
+	{"a/b",       "a/b/c",     0},
+	{"a/b/c",     "a/b/d",     0},
+	{"a/+/c",     "a/b/c",     1},
+	{"a/+/c",     "a/b/d",     0},
+	{"a/+/c",     "a//c",      1},
+	{"a/+",       "a/b",       1},
+	{"a/+",       "a/b/c",     0},
+	{"a/+",       "a",         0},
+	{"+/+",       "/b",        1},
+	{"+",         "a",         1},
+	{"+",         "/a",        0},
+	{"a/#",       "a",         1},
+	{"a/#",       "a/b",       1},
+	{"a/#",       "a/b/c",     1},
+	{"a/#",       "ab/c",      0},
+	{"#",         "a/b/c",     1},
+	{"#",         "/",         1},
+	{"+/b/#",     "a/b",       1},
+	{"+/b/#",     "a/b/c/d",   1},
+	{"+/b/#",     "a/c/d",     0},
+	{"#",         "$SYS/x",    0},
+	{"+/x",       "$SYS/x",    0},
+	{"$SYS/#",    "$SYS/x",    1},
+	{"$SYS/+",    "$SYS/x",    1},
+	{"sport/tennis/+", "sport/tennis/player1", 1},
+	{"sport/tennis/+", "sport/tennis/player1/ranking", 0},
+	{NULL, NULL, 0}
+};
+
+static const char *invalid[] = {"", "a#", "a/b#", "a/#/b", "a+", "a/+b", "a/b+/c", "#/a", NULL};
+
+// A subscription, as the one of mqtt.c
+typedef struct sub {
+	char *topic;
+	int id;
+	struct sub *next;
+} sub_t;
+
+// Reference matcher, level by level
+static int ref_match(const char *filter, const char *topic) {
+	if ((*topic == '$') && ((*filter == '+') || (*filter == '#'))) return 0;
+
+	for(;;) {
+		const char *fe = strchr(filter, '/');
+		const char *te = strchr(topic, '/');
+		int fl = fe?fe - filter:strlen(filter);
+		int tl = te?te - topic:strlen(topic);
+
+		if ((fl == 1) && (*filter == '#')) return 1;
+		if (!((fl == 1) && (*filter == '+')) && ((fl != tl) || strncmp(filter, topic, fl))) return 0;
+
+		if (!te) {
+			// Topic ends, the filter can go on with "/#"
+			return !fe || !strcmp(fe, "/#");
+		}
+		if (!fe) return 0;
+
+		filter = fe + 1;
+		topic = te + 1;
+	}
+}
+
+static void count_match(void *arg, void *sub) {
+	(*(int *)arg)++;
+}
+
+static void sum_match(void *arg, void *sub) {
+	*(int *)arg += ((sub_t *)sub)->id;
+}
+
+static int check(void) {
+	const check_t *c;
+	const char **f;
+	mqtt_trie trie;
+	int fails = 0;
+	int n, count;
+
+	for(c = checks;c->filter;c++) {
+		mqtt_trie_init(&trie);
+		mqtt_trie_add(&trie, c->filter, (void *)c);
+
+		count = 0;
+		n = mqtt_trie_match(&trie, c->topic, 0, count_match, &count);
+		if ((n != c->match) || (count != c->match)) {
+			printf("FAIL: filter %s, topic %s, %d matches\n", c->filter, c->topic, n);
+			fails++;
+		}
+
+		mqtt_trie_destroy(&trie, NULL, NULL);
+	}
+
+	// All the filters together, against the reference matcher
+	mqtt_trie_init(&trie);
+	for(c = checks;c->filter;c++) {
+		mqtt_trie_add(&trie, c->filter, (void *)c);
+	}
+
+	for(c = checks;c->filter;c++) {
+		const check_t *o;
+		char topic[64];
+		int expected = 0;
+
+		for(o = checks;o->filter;o++) {
+			expected += ref_match(o->filter, c->topic);
+		}
+
+		// A topic with len, that is not NUL terminated
+		n = strlen(c->topic);
+		memcpy(topic, c->topic, n);
+		topic[n] = '/';
+
+		count = 0;
+		mqtt_trie_match(&trie, topic, n, count_match, &count);
+		if (count != expected) {
+			printf("FAIL: topic %s, %d matches, %d expected\n", c->topic, count, expected);
+			fails++;
+		}
+	}
+
+	mqtt_trie_destroy(&trie, NULL, NULL);
+
+	for(f = invalid;*f;f++) {
+		mqtt_trie_init(&trie);
+		errno = 0;
+		if ((mqtt_trie_add(&trie, *f, NULL) == 0) || (errno != EINVAL)) {
+			printf("FAIL: invalid filter %s accepted\n", *f);
+			fails++;
+		}
+		mqtt_trie_destroy(&trie, NULL, NULL);
+	}
+
+	printf("check: %s\n\n", fails?"FAIL":"OK");
+
+	return fails;
+}
+
+static void topic_name(char *buf, int i) {
+	sprintf(buf, "home/floor%d/room%d/sensor%d/value", i % 3, (i / 3) % 8, i / 24);
+}
+
+int main(int argc, char *argv[]) {
+	uint32_t nsubs = 48;
+	uint32_t iterations = 200000;
+	sub_t *subs, *list = NULL, *s;
+	mqtt_trie trie;
+	char topic[64];
+	uint64_t t0, t1;
+	uint32_t i;
+	int sum_list = 0, sum_trie = 0;
+
+	if (argc > 1) nsubs = atoi(argv[1]);
+	if (argc > 2) iterations = atoi(argv[2]);
+	if (nsubs < 1) nsubs = 1;
+
+	if (check()) return 1;
+
+	subs = calloc(nsubs, sizeof(sub_t));
+	if (!subs) {
+		printf("out of memory\n");
+		return 1;
+	}
+
+	mqtt_trie_init(&trie);
+	for(i = 0;i < nsubs;i++) {
+		topic_name(topic, i);
+		subs[i].topic = strdup(topic);
+		subs[i].id = i + 1;
+		subs[i].next = list;
+		list = &subs[i];
+
+		mqtt_trie_add(&trie, topic, &subs[i]);
+	}
+
+	printf("%u subscriptions\n\n", nsubs);
+
+	t0 = bench_now_ns();
+	for(i = 0;i < iterations;i++) {
+		topic_name(topic, i % nsubs);
+		for(s = list;s;s = s->next) {
+			if (strcmp(s->topic, topic) == 0) sum_list += s->id;
+		}
+	}
+	t1 = bench_now_ns();
+	bench_report("list match", iterations, t1 - t0);
+
+	t0 = bench_now_ns();
+	for(i = 0;i < iterations;i++) {
+		topic_name(topic, i % nsubs);
+		mqtt_trie_match(&trie, topic, 0, sum_match, &sum_trie);
+	}
+	t1 = bench_now_ns();
+	bench_report("trie match", iterations, t1 - t0);
+
+	if (sum_list != sum_trie) {
+		printf("FAIL: trie and list matches differ\n");
+		return 1;
+	}
+
+	// With wildcard subscriptions, that the list doesn't match
+	mqtt_trie_add(&trie, "home/+/room1/#", &subs[0]);
+	mqtt_trie_add(&trie, "home/floor2/+/+/value", &subs[0]);
+	mqtt_trie_add(&trie, "#", &subs[0]);
+
+	t0 = bench_now_ns();
+	for(i = 0;i < iterations;i++) {
+		topic_name(topic, i % nsubs);
+		mqtt_trie_match(&trie, topic, 0, sum_match, &sum_trie);
+	}
+	t1 = bench_now_ns();
+	bench_report("trie match, wildcards", iterations, t1 - t0);
+
+	mqtt_trie_destroy(&trie, NULL, NULL);
+	for(i = 0;i < nsubs;i++) {
+		free(subs[i].topic);
+	}
+	free(subs);
+
+	return 0;
+}
@@ -0,0 +1,331 @@
+/*
+ * Lua RTOS, rotable lookup benchmark for the Linux host build
+ *
+ * Measures luaR_findglobal / luaR_findentry, as called by ltable.c and
+ * loadlib.c, over a set of maps with the same keys than the Lua RTOS
+ * modules. The same source is linked three times:
+ *
+ * bench_rotable_linear: linear search
+ * bench_rotable_cache:  linear search + rotable cache (cache.c)
+ * bench_rotable_index:  perfect hash indexes (gen_rotable_index.py)
+ *
+ * Before the benchmark, lookups are checked against a linear search from a
+ * single task, with keys that share the same address (as luaR_next does),
+ * and from one task on each core at the same time.
+ *
+ * Usage: bench_rotable [iterations]
+ *
+ */
+
+#include "bench.h"
+
+#include "lua.h"
+#include "lauxlib.h"
+#include "lrotable.h"
+#include "cache.h"
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/semphr.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#define TFT_KEYS \
+	X(init) X(clear) X(on) X(off) X(setfont) X(compilefont) X(getscreensize) X(getfontsize) \
+	X(getfontheight) X(gettype) X(setrot) X(setorient) X(setcolor) X(settransp) X(setfixed) \
+	X(setwrap) X(setangleoffset) X(setclipwin) X(resetclipwin) X(invert) X(putpixel) X(getpixel) \
+	X(getline) X(line) X(linebyangle) X(rect) X(roundrect) X(circle) X(ellipse) X(arc) X(poly) \
+	X(star) X(triangle) X(write) X(stringpos) X(image) X(jpgimage) X(bmpimage) X(hsb2rgb) \
+	X(setbrightness) X(gettouch) X(getrawtouch) X(setcal) X(setspeed) X(config) X(PORTRAIT) \
+	X(PORTRAIT_FLIP) X(LANDSCAPE) X(LANDSCAPE_FLIP) X(CENTER) X(RIGHT) X(BOTTOM) X(LASTX) X(LASTY) \
+	X(BLACK) X(NAVY) X(DARKGREEN) X(DARKCYAN) X(MAROON) X(PURPLE) X(OLIVE) X(LIGHTGREY) \
+	X(DARKGREY) X(BLUE) X(GREEN) X(CYAN) X(RED) X(MAGENTA) X(YELLOW) X(WHITE) X(ORANGE) \
+	X(GREENYELLOW) X(PINK) X(FONT_DEFAULT) X(FONT_DEJAVU18) X(FONT_DEJAVU24) X(FONT_UBUNTU16) \
+	X(FONT_COMIC24) X(FONT_TOONEY32) X(FONT_MINYA24) X(FONT_7SEG) X(ST7735) X(ST7735B) X(ST7735G) \
+	X(ILI9341)
+
+#define PIO_KEYS \
+	X(pin) X(port) X(decode) X(INPUT) X(OUTPUT) X(PULLUP) X(PULLDOWN) X(NOPULL) \
+	X(GPIO0) X(GPIO1) X(GPIO2) X(GPIO3) X(GPIO4) X(GPIO5) X(GPIO12) X(GPIO13) X(GPIO14) \
+	X(GPIO15) X(GPIO16) X(GPIO17) X(GPIO18) X(GPIO19) X(GPIO21) X(GPIO22) X(GPIO23) \
+	X(GPIO25) X(GPIO26) X(GPIO27) X(GPIO32) X(GPIO33) X(GPIO34) X(GPIO35) X(GPIO36) X(GPIO39)
+
+#define PIN_KEYS \
+	X(setdir) X(output) X(input) X(setpull) X(setval) X(sethigh) X(setlow) X(getval) X(num)
+
+#define MATH_KEYS \
+	X(abs) X(ceil) X(exp) X(floor) X(fmod) X(log) X(max) X(min) X(modf) X(sqrt) X(ult) \
+	X(acos) X(asin) X(atan) X(cos) X(sin) X(tan) X(tointeger) X(type) X(random) X(randomseed) \
+	X(pi) X(huge) X(maxinteger) X(mininteger)
+
+#define MODULES \
+	X(pwm) X(thread) X(i2c) X(adc) X(led) X(servo) X(uart) X(cam) X(event) X(spi) X(sensor) \
+	X(stepper) X(mqtt) X(nvs) X(net) X(tmr) X(pack) X(neopixel) X(lora) X(coroutine) X(debug) \
+	X(utf8) X(os) X(table) X(string)
+
+#define X(k) {LSTRKEY(#k), LINTVAL(__LINE__)},
+
+static const LUA_REG_TYPE tft_map[] = {
+	TFT_KEYS
+	{LNILKEY, LNILVAL}
+};
+
+static const LUA_REG_TYPE pio_pin_map[] = {
+	PIN_KEYS
+	{LNILKEY, LNILVAL}
+};
+
+static const LUA_REG_TYPE pio_map[] = {
+	PIO_KEYS
+	{LSTRKEY("pin"), LROVAL(pio_pin_map)},
+	{LNILKEY, LNILVAL}
+};
+
+static const LUA_REG_TYPE math_map[] = {
+	MATH_KEYS
+	{LNILKEY, LNILVAL}
+};
+
+static const LUA_REG_TYPE empty_map[] = {
+	{LNILKEY, LNILVAL}
+};
+
+#undef X
+#define X(k) {LSTRKEY(#k), LROVAL(empty_map)},
+
+// Same layout as the lua_rotable array built by the linker (see ld/lua_rtos.ld)
+const luaR_entry lua_rotable[] = {
+	MODULES
+	{LSTRKEY("tft"), LROVAL(tft_map)},
+	{LSTRKEY("pio"), LROVAL(pio_map)},
+	{LSTRKEY("math"), LROVAL(math_map)},
+	{LNILKEY, LNILVAL}
+};
+
+const luaL_Reg lua_libs1[] = {
+	{NULL, NULL}
+};
+
+#undef X
+#define X(k) #k,
+
+static const char *tft_keys[] = {TFT_KEYS NULL};
+static const char *pio_keys[] = {PIO_KEYS NULL};
+static const char *math_keys[] = {MATH_KEYS NULL};
+static const char *modules[] = {MODULES "tft", "pio", "math", NULL};
+static const char *misses[] = {
+	"circles", "GPIO31", "floor2", "xyz", "ILI9342", "__index", "__metatable", "tointeger_", NULL
+};
+
+#undef X
+
+// Reference linear search
+static int find_pos(const luaR_entry *map, const char *k) {
+	int pos;
+
+	for(pos = 0;map[pos].key.id.strkey;pos++) {
+		if ((map[pos].key.type == LUA_TSTRING) && !strcmp(map[pos].key.id.strkey, k)) {
+			return pos;
+		}
+	}
+
+	return -1;
+}
+
+static int check_map(const char *name, const luaR_entry *map, const char **keys) {
+	const TValue *res;
+	unsigned pos;
+	int i, ref;
+
+	for(i = 0;keys[i];i++) {
+		ref = find_pos(map, keys[i]);
+		pos = 0xffff;
+
+		// NULL is lua_rotable, as in ltable.c
+		res = luaR_findentry((map == lua_rotable)?NULL:map, keys[i], 0, &pos);
+		if ((res != &map[ref].value) || (pos != ref)) {
+			printf("check failed: %s.%s found at %d, expected %d\n", name, keys[i], (int)pos, ref);
+			return 0;
+		}
+	}
+
+	for(i = 0;misses[i];i++) {
+		if (luaR_findentry((map == lua_rotable)?NULL:map, misses[i], 0, NULL) != luaO_nilobject) {
+			printf("check failed: %s.%s found\n", name, misses[i]);
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+// Keys stored in the same buffer, so that they have the same address
+static int check_buffer(const char *name, const luaR_entry *map, const char **keys) {
+	char buffer[LUA_MAX_ROTABLE_NAME + 1];
+	int i, j;
+
+	for(j = 0;j < 4;j++) {
+		for(i = 0;keys[i];i++) {
+			strcpy(buffer, keys[i]);
+			if (luaR_findentry(map, buffer, 0, NULL) != &map[find_pos(map, keys[i])].value) {
+				printf("check failed: %s.%s (buffer)\n", name, keys[i]);
+				return 0;
+			}
+		}
+	}
+
+	return 1;
+}
+
+#define CHECK_TASK_LOOKUPS 200000
+
+static SemaphoreHandle_t check_done;
+static volatile int check_errors = 0;
+
+static void check_task(void *arg) {
+	static const luaR_entry *maps[] = {tft_map, pio_map, math_map};
+	static const char **keys[] = {tft_keys, pio_keys, math_keys};
+	static const int nkeys[] = {
+		sizeof(tft_keys) / sizeof(char *) - 1,
+		sizeof(pio_keys) / sizeof(char *) - 1,
+		sizeof(math_keys) / sizeof(char *) - 1
+	};
+	uint32_t seed = (uint32_t)(uintptr_t)arg;
+	int i, m, k;
+
+	for(i = 0;i < CHECK_TASK_LOOKUPS;i++) {
+		seed = seed * 1103515245 + 12345;
+		m = (seed >> 16) % 3;
+		k = (seed >> 8) % nkeys[m];
+
+		if (luaR_findentry(maps[m], keys[m][k], 0, NULL) != &maps[m][find_pos(maps[m], keys[m][k])].value) {
+			check_errors++;
+		}
+	}
+
+	xSemaphoreGive(check_done);
+	vTaskDelete(NULL);
+}
+
+static int check_tasks() {
+	int core;
+
+	check_done = xSemaphoreCreateCounting(portNUM_PROCESSORS, 0);
+
+	for(core = 0;core < portNUM_PROCESSORS;core++) {
+		xTaskCreatePinnedToCore(check_task, "check", 4096, (void *)(uintptr_t)(core + 1), 1, NULL, core);
+	}
+
+	for(core = 0;core < portNUM_PROCESSORS;core++) {
+		xSemaphoreTake(check_done, portMAX_DELAY);
+	}
+
+	vSemaphoreDelete(check_done);
+
+	if (check_errors) {
+		printf("check failed: %d wrong lookups from tasks\n", check_errors);
+		return 0;
+	}
+
+	return 1;
+}
+
+static int check() {
+	int i;
+
+	for(i = 0;modules[i];i++) {
+		if (luaR_findglobal(modules[i]) != &lua_rotable[find_pos(lua_rotable, modules[i])].value) {
+			printf("check failed: module %s\n", modules[i]);
+			return 0;
+		}
+	}
+
+	if (luaR_findglobal("nomodule")) {
+		printf("check failed: module nomodule found\n");
+		return 0;
+	}
+
+	return (
+		check_map("tft", tft_map, tft_keys) && check_map("pio", pio_map, pio_keys) &&
+		check_map("pio.pin", pio_pin_map, (const char *[]){"setdir", "getval", "num", NULL}) &&
+		check_map("math", math_map, math_keys) && check_map("_G", lua_rotable, modules) &&
+		check_buffer("tft", tft_map, tft_keys) && check_buffer("math", math_map, math_keys) &&
+		check_tasks()
+	);
+}
+
+static volatile const TValue *sink;
+
+static void bench_map(const char *name, const luaR_entry *map, const char **keys, uint32_t iterations) {
+	uint64_t start;
+	uint32_t i, n = 0;
+	int j;
+
+	start = bench_now_ns();
+	for(i = 0;i < iterations;i++) {
+		for(j = 0;keys[j];j++, n++) {
+			sink = luaR_findentry(map, keys[j], 0, NULL);
+		}
+	}
+	bench_report(name, n, bench_now_ns() - start);
+}
+
+static void bench_hot(const char *name, const luaR_entry *map, const char *key, uint32_t iterations) {
+	uint64_t start;
+	uint32_t i;
+
+	start = bench_now_ns();
+	for(i = 0;i < iterations;i++) {
+		sink = luaR_findentry(map, key, 0, NULL);
+	}
+	bench_report(name, iterations, bench_now_ns() - start);
+}
+
+static void bench_global(uint32_t iterations) {
+	uint64_t start;
+	uint32_t i, n = 0;
+	int j;
+
+	start = bench_now_ns();
+	for(i = 0;i < iterations;i++) {
+		for(j = 0;modules[j];j++, n++) {
+			sink = luaR_findglobal(modules[j]);
+		}
+	}
+	bench_report("findglobal (all modules)", n, bench_now_ns() - start);
+}
+
+int main(int argc, char **argv) {
+	uint32_t iterations = (argc > 1)?atoi(argv[1]):20000;
+
+	#if CONFIG_LUA_RTOS_LUA_USE_ROTABLE_CACHE
+	rotable_cache_init();
+	#endif
+
+	#if CONFIG_LUA_RTOS_LUA_USE_ROTABLE_INDEX
+	luaR_hindex_init();
+	#endif
+
+	if (!check()) {
+		return 1;
+	}
+
+	bench_global(iterations);
+	bench_map("tft (all keys)", tft_map, tft_keys, iterations);
+	bench_map("pio (all keys)", pio_map, pio_keys, iterations);
+	bench_map("math (all keys)", math_map, math_keys, iterations);
+	bench_map("misses", tft_map, misses, iterations);
+	bench_hot("tft.circle (hot key)", tft_map, "circle", iterations * 10);
+	bench_hot("pio.GPIO16 (hot key)", pio_map, "GPIO16", iterations * 10);
+	bench_hot("math.floor (hot key)", math_map, "floor", iterations * 10);
+
+	#if CONFIG_LUA_RTOS_LUA_USE_ROTABLE_CACHE
+	uint32_t hit, miss;
+
+	rotable_cache_stats(&hit, &miss);
+	printf("\ncache: %u entries, %u hits, %u misses\n", ROTABLE_CACHE_LENGTH, hit, miss);
+	#endif
+
+	return 0;
+}
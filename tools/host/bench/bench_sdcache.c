@@ -0,0 +1,403 @@
+/*
+ * Lua RTOS, SD card sector cache benchmark for the Linux host build
+ *
+ * Runs drivers/sd_cache.c over a file-backed SD card image (port/sd_image.c,
+ * build/sdcard.img).
+ *
+ * Before the benchmark, the cache is checked: LRU eviction, readahead of
+ * sequential reads, merging of adjacent dirty sectors into a single write
+ * command, and random reads, writes and syncs against a copy of the card in
+ * RAM, with a small cache so that dirty sectors are evicted.
+ *
+ * Then a FATFS like workload (directory and FAT sectors read on each file
+ * operation, files read a sector at a time, appends followed by a sync, as
+ * f_close does) is run directly on the card and through the cache. Card
+ * commands and modeled card time are reported, and the cache hit rate and
+ * latencies.
+ *
+ * Usage: bench_sdcache [cache sectors] [iterations]
+ *
+ */
+
+#include "bench.h"
+#include "sd_image.h"
+
+#include "drivers/sd_cache.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define IMAGE          "build/sdcard.img"
+#define IMAGE_SECTORS  32768
+
+#define SECT           SD_CACHE_SECTOR_SIZE
+
+// Volume layout of the workload
+#define FAT_START      32
+#define FAT_SECTORS    256
+#define DIR_START      (FAT_START + FAT_SECTORS)
+#define DIR_SECTORS    32
+#define DATA_START     (DIR_START + DIR_SECTORS)
+#define CLUSTER        8
+
+typedef struct {
+	int (*read)(uint32_t sector, uint8_t *buf, uint32_t count);
+	int (*write)(uint32_t sector, const uint8_t *buf, uint32_t count);
+	int (*sync)(void);
+} io_t;
+
+static sd_cache_t *cache;
+
+static int direct_read(uint32_t sector, uint8_t *buf, uint32_t count) {
+	return sd_image_read(NULL, sector, buf, count);
+}
+
+static int direct_write(uint32_t sector, const uint8_t *buf, uint32_t count) {
+	return sd_image_write(NULL, sector, buf, count);
+}
+
+static int direct_sync(void) {
+	return 0;
+}
+
+static int cached_read(uint32_t sector, uint8_t *buf, uint32_t count) {
+	return sd_cache_read(cache, sector, buf, count);
+}
+
+static int cached_write(uint32_t sector, const uint8_t *buf, uint32_t count) {
+	return sd_cache_write(cache, sector, buf, count);
+}
+
+static int cached_sync(void) {
+	return sd_cache_sync(cache);
+}
+
+static const io_t direct_io = {direct_read, direct_write, direct_sync};
+static const io_t cached_io = {cached_read, cached_write, cached_sync};
+
+static sd_cache_t *cache_new(uint32_t size) {
+	sd_cache_t *c;
+
+	c = sd_cache_create(&sd_image_ops, NULL, IMAGE_SECTORS, size);
+	if (!c) {
+		printf("out of memory\n");
+		exit(1);
+	}
+
+	return c;
+}
+
+static void fill(uint8_t *buf, uint32_t sector, uint32_t count, uint32_t seed) {
+	uint32_t i;
+
+	for(i = 0;i < count * SECT;i++) {
+		buf[i] = (uint8_t)((sector + i / SECT) * 31 + (i % SECT) * 7 + seed);
+	}
+}
+
+static uint32_t rnd_state = 12345;
+
+static uint32_t rnd(uint32_t n) {
+	rnd_state = rnd_state * 1103515245 + 12345;
+
+	return (rnd_state >> 8) % n;
+}
+
+// Least recently used sectors are evicted first
+static int check_lru(void) {
+	sd_cache_stats_t stats;
+	uint8_t buf[SECT];
+	int i;
+
+	cache = cache_new(SD_CACHE_MIN_SIZE);
+
+	// In reverse order, they are not sequential reads
+	for(i = SD_CACHE_MIN_SIZE - 1;i >= 0;i--) {
+		cached_read(i * 2, buf, 1);
+	}
+
+	cached_read(1000, buf, 1);  // evicts the first one read
+	cached_read(0, buf, 1);     // hit
+	cached_read((SD_CACHE_MIN_SIZE - 1) * 2, buf, 1);
+
+	sd_cache_get_stats(cache, &stats);
+	sd_cache_destroy(cache);
+
+	if ((stats.read_hits != 1) || (stats.read_misses != SD_CACHE_MIN_SIZE + 2) || stats.readahead) {
+		printf("FAIL: lru, %u hits, %u misses, %u read ahead\n", stats.read_hits, stats.read_misses, stats.readahead);
+		return 1;
+	}
+
+	return 0;
+}
+
+// Sequential reads of a sector read ahead the next ones
+static int check_readahead(void) {
+	sd_cache_stats_t stats;
+	uint8_t buf[SECT], ref[SECT];
+	uint32_t i;
+	int fails = 0;
+
+	cache = cache_new(SD_CACHE_MIN_SIZE);
+
+	for(i = 0;i < 30;i++) {
+		cached_read(2000 + i, buf, 1);
+		sd_image_read(NULL, 2000 + i, ref, 1);
+		if (memcmp(buf, ref, SECT)) {
+			printf("FAIL: readahead, wrong sector %u\n", 2000 + i);
+			fails++;
+			break;
+		}
+	}
+
+	// Last sectors of the card
+	cached_read(IMAGE_SECTORS - 2, buf, 1);
+	cached_read(IMAGE_SECTORS - 1, buf, 1);
+	cached_read(IMAGE_SECTORS - 1, buf, 1);
+
+	sd_cache_get_stats(cache, &stats);
+	sd_cache_destroy(cache);
+
+	/*
+	 * The first read is not sequential, then 1 + 4 sectors per command (the last
+	 * sector read ahead is not read). No readahead past the end of the card.
+	 */
+	if ((stats.card_reads != 7 + 2) || (stats.readahead != 24) || (stats.readahead_hits != 23) ||
+		(stats.read_hits != 23 + 1)) {
+		printf("FAIL: readahead, %u commands, %u read ahead hits, %u hits\n",
+			stats.card_reads, stats.readahead_hits, stats.read_hits);
+		fails++;
+	}
+
+	return fails;
+}
+
+// Adjacent dirty sectors are written with a single command, at sync or when evicted
+static int check_merge(void) {
+	sd_cache_stats_t stats;
+	uint8_t buf[SECT * SD_CACHE_BURST], ref[SECT * SD_CACHE_BURST];
+	uint32_t i;
+	int fails = 0;
+
+	cache = cache_new(SD_CACHE_MIN_SIZE);
+
+	// Written in reverse order, and a sector written twice
+	fill(ref, 3000, 6, 1);
+	for(i = 0;i < 6;i++) {
+		cached_write(3005 - i, ref + (5 - i) * SECT, 1);
+	}
+	cached_write(3002, ref + 2 * SECT, 1);
+	cached_write(3010, ref, 1);
+
+	sd_cache_get_stats(cache, &stats);
+	if (stats.card_writes) {
+		printf("FAIL: merge, %u writes before sync\n", stats.card_writes);
+		fails++;
+	}
+
+	sd_cache_sync(cache);
+	sd_cache_get_stats(cache, &stats);
+	if ((stats.card_writes != 2) || (stats.card_write_sectors != 7)) {
+		printf("FAIL: merge, %u writes of %u sectors at sync\n", stats.card_writes, stats.card_write_sectors);
+		fails++;
+	}
+
+	sd_image_read(NULL, 3000, buf, 6);
+	if (memcmp(buf, ref, 6 * SECT)) {
+		printf("FAIL: merge, wrong data\n");
+		fails++;
+	}
+
+	// Evicted, with its dirty neighbours
+	sd_cache_reset_stats(cache);
+	fill(ref, 4000, 4, 2);
+	for(i = 0;i < 4;i++) {
+		cached_write(4000 + i, ref + i * SECT, 1);
+	}
+	for(i = 0;i < SD_CACHE_MIN_SIZE;i++) {
+		cached_read(5000 + i * 2, buf, 1);
+	}
+
+	sd_cache_get_stats(cache, &stats);
+	if ((stats.card_writes != 1) || (stats.card_write_sectors != 4)) {
+		printf("FAIL: merge, %u writes of %u sectors at eviction\n", stats.card_writes, stats.card_write_sectors);
+		fails++;
+	}
+
+	sd_cache_destroy(cache);
+
+	return fails;
+}
+
+// Random reads, writes and syncs, against a copy of the card area in RAM
+static int check_random(uint32_t size) {
+	const uint32_t first = 6000, area = 256;
+	uint8_t *shadow, *buf;
+	uint32_t i, sector, count, next = 0;
+	int fails = 0;
+
+	shadow = malloc(area * SECT);
+	buf = malloc(area * SECT);
+	if (!shadow || !buf) {
+		printf("out of memory\n");
+		exit(1);
+	}
+
+	fill(shadow, first, area, 3);
+	sd_image_write(NULL, first, shadow, area);
+
+	cache = cache_new(size);
+
+	for(i = 0;(i < 20000) && !fails;i++) {
+		count = 1 + rnd((rnd(4) == 0)?2 * SD_CACHE_BURST:3);
+		sector = rnd(area - count + 1);
+
+		switch (rnd(8)) {
+			case 0: case 1: case 2:
+				fill(buf, first + sector, count, i);
+				if (cached_write(first + sector, buf, count) < 0) fails++;
+				memcpy(shadow + sector * SECT, buf, count * SECT);
+				break;
+
+			case 3:
+				if (cached_sync() < 0) fails++;
+				break;
+
+			default:
+				// Some of them sequential
+				if (rnd(2) && (next + count <= area)) sector = next;
+				next = sector + count;
+
+				if (cached_read(first + sector, buf, count) < 0) fails++;
+				if (memcmp(buf, shadow + sector * SECT, count * SECT)) {
+					printf("FAIL: random, operation %u, wrong data read at %u\n", i, first + sector);
+					fails++;
+				}
+				break;
+		}
+	}
+
+	if (sd_cache_destroy(cache) < 0) fails++;
+
+	sd_image_read(NULL, first, buf, area);
+	if (memcmp(buf, shadow, area * SECT)) {
+		printf("FAIL: random, card differs after sync\n");
+		fails++;
+	}
+
+	free(shadow);
+	free(buf);
+
+	return fails;
+}
+
+static int check(void) {
+	int fails = 0;
+
+	fails += check_lru();
+	fails += check_readahead();
+	fails += check_merge();
+	fails += check_random(SD_CACHE_MIN_SIZE);
+	fails += check_random(64);
+
+	printf("check: %s\n\n", fails?"FAIL":"OK");
+
+	return fails;
+}
+
+/*
+ * A file operation, as FATFS does it: the directory entry and the FAT sector of
+ * the first cluster are read, then a 4 clusters file is read a sector at a time
+ * (the FAT is read at each cluster), and 2 sectors are appended to another file,
+ * updating the FAT and directory entry, followed by a sync.
+ */
+static int file_op(const io_t *io, uint32_t i) {
+	uint8_t buf[SECT];
+	uint32_t file = i % 16;
+	uint32_t data = DATA_START + file * 4 * CLUSTER;
+	uint32_t c, s;
+	int res = 0;
+
+	res |= io->read(DIR_START + file / 16, buf, 1);
+	res |= io->read(FAT_START + file / 4, buf, 1);
+
+	for(c = 0;c < 4;c++) {
+		res |= io->read(FAT_START + (data / CLUSTER + c) / 128, buf, 1);
+		for(s = 0;s < CLUSTER;s++) {
+			res |= io->read(data + c * CLUSTER + s, buf, 1);
+		}
+	}
+
+	// Append to the log file
+	data = DATA_START + 64 * 4 * CLUSTER + (i * 2) % (IMAGE_SECTORS - DATA_START - 64 * 4 * CLUSTER);
+	fill(buf, data, 1, i);
+	res |= io->write(data, buf, 1);
+	res |= io->write(data + 1, buf, 1);
+	res |= io->write(FAT_START + 200, buf, 1);
+	res |= io->write(DIR_START + 1, buf, 1);
+	res |= io->sync();
+
+	return res;
+}
+
+static void bench(const char *name, const io_t *io, uint32_t size, uint32_t iterations) {
+	sd_image_stats_t card;
+	sd_cache_stats_t stats;
+	uint64_t t0, t1;
+	char tmp[64];
+	uint32_t i;
+
+	if (io == &cached_io) cache = cache_new(size);
+
+	sd_image_reset_stats();
+
+	t0 = bench_now_ns();
+	for(i = 0;i < iterations;i++) {
+		if (file_op(io, i) < 0) {
+			printf("FAIL: %s, i/o error\n", name);
+			break;
+		}
+	}
+	t1 = bench_now_ns();
+
+	sd_image_get_stats(&card);
+
+	snprintf(tmp, sizeof(tmp), "%s (cpu)", name);
+	bench_report(tmp, iterations, t1 - t0);
+	snprintf(tmp, sizeof(tmp), "%s (card)", name);
+	bench_report(tmp, iterations, card.busy_us * 1000);
+	printf("%-32s %8u reads   %8u writes   %8llu sectors\n", "",
+		card.reads, card.writes, (unsigned long long)(card.read_sectors + card.write_sectors));
+
+	if (io == &cached_io) {
+		sd_cache_get_stats(cache, &stats);
+		printf("%-32s %7.1f%% hits %8u read ahead hits  %5.1f / %5.1f us read / write\n", "",
+			100.0 * stats.read_hits / (stats.read_hits + stats.read_misses), stats.readahead_hits,
+			(double)stats.read_us / stats.reads, (double)stats.write_us / stats.writes);
+		sd_cache_destroy(cache);
+	}
+}
+
+int main(int argc, char *argv[]) {
+	uint32_t size = 32;
+	uint32_t iterations = 2000;
+
+	if (argc > 1) size = atoi(argv[1]);
+	if (argc > 2) iterations = atoi(argv[2]);
+
+	if (sd_image_init(IMAGE, IMAGE_SECTORS) < 0) {
+		printf("can't create %s\n", IMAGE);
+		return 1;
+	}
+
+	if (check()) return 1;
+
+	printf("cache %u sectors\n\n", (size < SD_CACHE_MIN_SIZE)?SD_CACHE_MIN_SIZE:size);
+
+	bench("direct file op", &direct_io, 0, iterations);
+	bench("cached file op", &cached_io, size, iterations);
+
+	sd_image_deinit();
+
+	return 0;
+}
@@ -0,0 +1,489 @@
+/*
+ * Lua RTOS, spiffs vfs benchmark
+ *
+ * Measures the latency of the open / stat / readdir vfs operations over a RAM
+ * backed flash emulator, for a file system populated with a configurable number
+ * of files, spread over a configurable number of directories.
+ *
+ * Then counts the flash writes of opening files for reading, that update the
+ * file access time kept in RAM, and of writing the access times to flash.
+ *
+ * At last, measures seeks and reads at increasing offsets of a large file,
+ * without and with the file mapped with vfs_spiffs_map. This part uses the
+ * file system calls, that are routed to the vfs by port/syscalls.c.
+ *
+ * usage: bench_spiffs [files] [directories] [iterations]
+ *
+ */
+
+#include "luartos.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+
+#include "esp_vfs.h"
+#include "vfs.h"
+
+#include "flash_emu.h"
+#include "bench.h"
+
+static const esp_vfs_t *vfs;
+
+static void populate(int files, int dirs) {
+	char path[PATH_MAX];
+	int i, fd;
+
+	for(i = 0;i < dirs;i++) {
+		snprintf(path, sizeof(path), "/dir%d", i);
+		if (vfs->mkdir(path, 0) < 0) {
+			fprintf(stderr, "mkdir %s: %s\n", path, strerror(errno));
+			exit(1);
+		}
+	}
+
+	for(i = 0;i < files;i++) {
+		if (dirs) {
+			snprintf(path, sizeof(path), "/dir%d/file%d.lua", i % dirs, i);
+		} else {
+			snprintf(path, sizeof(path), "/file%d.lua", i);
+		}
+
+		fd = vfs->open(path, O_CREAT | O_WRONLY, 0);
+		if (fd < 0) {
+			fprintf(stderr, "open %s: %s\n", path, strerror(errno));
+			exit(1);
+		}
+
+		vfs->write(fd, path, strlen(path));
+		vfs->close(fd);
+	}
+}
+
+static int count_entries(const char *path) {
+	struct dirent *ent;
+	int entries = 0;
+	DIR *dir;
+
+	dir = vfs->opendir(path);
+	if (!dir) {
+		return -1;
+	}
+
+	while ((ent = vfs->readdir(dir))) {
+		entries++;
+	}
+
+	vfs->closedir(dir);
+
+	return entries;
+}
+
+// Check that the directory listings match the populated file system
+static void check(int files, int dirs) {
+	int entries;
+
+	entries = count_entries("/");
+	if (entries != (dirs?dirs:files)) {
+		fprintf(stderr, "check: / has %d entries, expected %d\n", entries, dirs?dirs:files);
+		exit(1);
+	}
+
+	if (dirs) {
+		entries = count_entries("/dir0");
+		if (entries != (files + dirs - 1) / dirs) {
+			fprintf(stderr, "check: /dir0 has %d entries, expected %d\n", entries, (files + dirs - 1) / dirs);
+			exit(1);
+		}
+	}
+
+	// Directory listings must follow creation, rename and removal of files
+	entries = count_entries("/");
+
+	vfs->close(vfs->open("/check.tmp", O_CREAT | O_WRONLY, 0));
+	vfs->rename("/check.tmp", "/check2.tmp");
+	if (count_entries("/") != entries + 1) {
+		fprintf(stderr, "check: rename not reflected in /\n");
+		exit(1);
+	}
+
+	vfs->unlink("/check2.tmp");
+	if (count_entries("/") != entries) {
+		fprintf(stderr, "check: unlink not reflected in /\n");
+		exit(1);
+	}
+}
+
+static void bench_open(int files, int dirs, int iterations) {
+	char path[PATH_MAX];
+	uint64_t t0, t;
+	int i, fd;
+
+	t = 0;
+	for(i = 0;i < iterations;i++) {
+		if (dirs) {
+			snprintf(path, sizeof(path), "/dir%d/file%d.lua", i % dirs, i % files);
+		} else {
+			snprintf(path, sizeof(path), "/file%d.lua", i % files);
+		}
+
+		t0 = bench_now_ns();
+		fd = vfs->open(path, O_RDONLY, 0);
+		vfs->close(fd);
+		t += bench_now_ns() - t0;
+
+		if (fd < 0) {
+			fprintf(stderr, "open %s: %s\n", path, strerror(errno));
+			exit(1);
+		}
+	}
+
+	bench_report("open/close (existing)", iterations, t);
+
+	// This is what require does for each package.path template that don't match
+	t = 0;
+	for(i = 0;i < iterations;i++) {
+		snprintf(path, sizeof(path), "/lib/share/lua/mod%d.lua", i);
+
+		t0 = bench_now_ns();
+		fd = vfs->open(path, O_RDONLY, 0);
+		t += bench_now_ns() - t0;
+
+		if (fd >= 0) {
+			vfs->close(fd);
+		}
+	}
+
+	bench_report("open (missing)", iterations, t);
+}
+
+static void bench_stat(int dirs, int iterations) {
+	char path[PATH_MAX];
+	struct stat st;
+	uint64_t t0, t;
+	int i;
+
+	if (!dirs) return;
+
+	t = 0;
+	for(i = 0;i < iterations;i++) {
+		snprintf(path, sizeof(path), "/dir%d", i % dirs);
+
+		t0 = bench_now_ns();
+		vfs->stat(path, &st);
+		t += bench_now_ns() - t0;
+	}
+
+	bench_report("stat (directory)", iterations, t);
+}
+
+static void bench_readdir(int dirs, int iterations) {
+	char path[PATH_MAX];
+	struct dirent *ent;
+	uint64_t t0, t;
+	int i, entries = 0;
+	DIR *dir;
+
+	t = 0;
+	for(i = 0;i < iterations;i++) {
+		t0 = bench_now_ns();
+		dir = vfs->opendir("/");
+		if (dir) {
+			while ((ent = vfs->readdir(dir))) {
+				entries++;
+			}
+			vfs->closedir(dir);
+		}
+		t += bench_now_ns() - t0;
+	}
+
+	bench_report("readdir (root)", iterations, t);
+
+	if (!dirs) return;
+
+	t = 0;
+	for(i = 0;i < iterations;i++) {
+		snprintf(path, sizeof(path), "/dir%d", i % dirs);
+
+		t0 = bench_now_ns();
+		dir = vfs->opendir(path);
+		if (dir) {
+			while ((ent = vfs->readdir(dir))) {
+				entries++;
+			}
+			vfs->closedir(dir);
+		}
+		t += bench_now_ns() - t0;
+	}
+
+	bench_report("readdir (subdirectory)", iterations, t);
+}
+
+static void file_path(char *path, int i, int dirs) {
+	if (dirs) {
+		snprintf(path, PATH_MAX, "/dir%d/file%d.lua", i % dirs, i);
+	} else {
+		snprintf(path, PATH_MAX, "/file%d.lua", i);
+	}
+}
+
+static uint32_t flash_writes() {
+	flash_emu_stats_t stats;
+
+	flash_emu_get_stats(&stats);
+	flash_emu_reset_stats();
+
+	return stats.writes;
+}
+
+// Flash writes of read only opens, with the access times kept in RAM
+static void bench_atime(int files, int dirs) {
+	char path[PATH_MAX];
+	uint32_t writes, sync_writes;
+	struct stat st;
+	time_t t0;
+	int i, fd, n;
+
+	n = (files < 20)?files:20;
+
+	vfs_spiffs_sync();
+
+	// Access times are updated if they are older than SPIFFS_META_FLUSH_TIME
+	sleep(SPIFFS_META_FLUSH_TIME);
+	t0 = time(NULL);
+
+	flash_writes();
+	for(i = 0;i < 1000;i++) {
+		file_path(path, i % n, dirs);
+		fd = vfs->open(path, O_RDONLY, 0);
+		if (fd < 0) {
+			fprintf(stderr, "open %s: %s\n", path, strerror(errno));
+			exit(1);
+		}
+		vfs->close(fd);
+	}
+	writes = flash_writes();
+
+	// The access times are seen before, and after they are written
+	file_path(path, 0, dirs);
+	if ((vfs->stat(path, &st) < 0) || (st.st_atime < t0) || flash_writes()) {
+		fprintf(stderr, "check: access time of %s not updated, or updated by stat\n", path);
+		exit(1);
+	}
+
+	vfs_spiffs_sync();
+	sync_writes = flash_writes();
+
+	if ((vfs->stat(path, &st) < 0) || (st.st_atime < t0) || !sync_writes) {
+		fprintf(stderr, "check: access time of %s not written\n", path);
+		exit(1);
+	}
+
+	// An idle file system writes them from the garbage collector task
+	sleep(SPIFFS_META_FLUSH_TIME);
+	fd = vfs->open(path, O_RDONLY, 0);
+	vfs->close(fd);
+	flash_writes();
+
+	sleep(SPIFFS_META_FLUSH_TIME + 1);
+	if (!flash_writes()) {
+		fprintf(stderr, "check: access time of %s not written by an idle file system\n", path);
+		exit(1);
+	}
+
+	vfs_spiffs_sync();
+	if (flash_writes()) {
+		fprintf(stderr, "check: access times left after an idle file system\n");
+		exit(1);
+	}
+
+	// The times of a written file are written on close
+	fd = vfs->open("/check.tmp", O_CREAT | O_WRONLY, 0);
+	vfs->write(fd, "x", 1);
+	vfs->close(fd);
+	if ((vfs->stat("/check.tmp", &st) < 0) || (st.st_mtime < t0) || (st.st_ctime < t0)) {
+		fprintf(stderr, "check: times of a written file not written\n");
+		exit(1);
+	}
+	vfs->unlink("/check.tmp");
+
+	printf("\n1000 opens of %d files: %u flash writes, %u when the access times are written\n", n, writes, sync_writes);
+}
+
+#define MAP_FILE_SIZE (320 * 1024)
+#define MAP_READ_SIZE 64
+#define MAP_BANDS     5
+
+// Contents of the map benchmark file, each 4 bytes word is its offset
+static void map_fill(uint8_t *buf, uint32_t offset, int len) {
+	int i;
+
+	for(i = 0;i < len;i++) {
+		buf[i] = ((offset + i) & ~3) >> (((offset + i) & 3) * 8);
+	}
+}
+
+/*
+ * Seeks and reads iterations times in the 4 Kb from offset, checking the data read.
+ * Each read is done after a read at the beginning of the file, as when reading records
+ * listed in a header.
+ */
+static uint64_t map_reads(int fd, uint32_t offset, int iterations, uint32_t *reads) {
+	uint8_t buf[MAP_READ_SIZE], expected[MAP_READ_SIZE];
+	flash_emu_stats_t stats;
+	uint32_t pos;
+	uint64_t t0, t;
+	int i;
+
+	flash_emu_reset_stats();
+
+	t = 0;
+	for(i = 0;i < iterations;i++) {
+		pos = ((i & 1)?offset:0) + (i * 1237) % (4096 - MAP_READ_SIZE);
+
+		t0 = bench_now_ns();
+		if ((lseek(fd, pos, SEEK_SET) != pos) || (read(fd, buf, sizeof(buf)) != sizeof(buf))) {
+			fprintf(stderr, "check: read at %u: %s\n", pos, strerror(errno));
+			exit(1);
+		}
+		t += bench_now_ns() - t0;
+
+		map_fill(expected, pos, sizeof(expected));
+		if (memcmp(buf, expected, sizeof(buf)) != 0) {
+			fprintf(stderr, "check: bad data read at %u\n", pos);
+			exit(1);
+		}
+	}
+
+	flash_emu_get_stats(&stats);
+	*reads = stats.reads;
+
+	return t;
+}
+
+// Seek and read time at increasing offsets of a file, without and with an index map
+static void bench_map(int iterations) {
+	uint8_t buf[1024];
+	uint32_t offset, reads, map_reads_;
+	uint64_t t, map_t;
+	int i, fd;
+
+	fd = open("/map.dat", O_CREAT | O_TRUNC | O_RDWR, 0);
+	if (fd < 0) {
+		fprintf(stderr, "open /map.dat: %s\n", strerror(errno));
+		exit(1);
+	}
+
+	for(offset = 0;offset < MAP_FILE_SIZE;offset += sizeof(buf)) {
+		map_fill(buf, offset, sizeof(buf));
+		if (write(fd, buf, sizeof(buf)) != sizeof(buf)) {
+			fprintf(stderr, "write /map.dat: %s\n", strerror(errno));
+			exit(1);
+		}
+	}
+
+	close(fd);
+
+	printf("\nseek and read of %d bytes, %d Kb file, %d iterations\n\n", MAP_READ_SIZE, MAP_FILE_SIZE / 1024, iterations);
+	printf("%-12s %18s %18s\n", "offset", "no map", "map");
+
+	fd = open("/map.dat", O_RDWR, 0);
+	for(i = 0;i < MAP_BANDS;i++) {
+		offset = (MAP_FILE_SIZE - 4096) / (MAP_BANDS - 1) * i;
+
+		t = map_reads(fd, offset, iterations, &reads);
+
+		if (vfs_spiffs_map(fd, 0, 0) < 0) {
+			fprintf(stderr, "map /map.dat: %s\n", strerror(errno));
+			exit(1);
+		}
+
+		// The map is populated as the file is read
+		map_reads(fd, offset, iterations, &map_reads_);
+		map_t = map_reads(fd, offset, iterations, &map_reads_);
+
+		vfs_spiffs_unmap(fd);
+
+		printf("%8u Kb %8.2f us %4u rd %8.2f us %4u rd\n", offset / 1024,
+			(double)t / 1000.0 / iterations, reads,
+			(double)map_t / 1000.0 / iterations, map_reads_
+		);
+	}
+
+	// The map follows writes
+	vfs_spiffs_map(fd, 0, 0);
+	map_reads(fd, MAP_FILE_SIZE - 4096, iterations, &reads);
+
+	lseek(fd, MAP_FILE_SIZE - 4096, SEEK_SET);
+	memset(buf, 0, sizeof(buf));
+	write(fd, buf, sizeof(buf));
+	lseek(fd, MAP_FILE_SIZE - 4096, SEEK_SET);
+	write(fd, buf, sizeof(buf));
+	map_fill(buf, MAP_FILE_SIZE - 4096, sizeof(buf));
+	lseek(fd, MAP_FILE_SIZE - 4096, SEEK_SET);
+	write(fd, buf, sizeof(buf));
+
+	map_reads(fd, MAP_FILE_SIZE - 4096, iterations, &reads);
+
+	if ((vfs_spiffs_map(fd, 0, 0) < 0) || (vfs_spiffs_unmap(fd) < 0) || (vfs_spiffs_unmap(fd) == 0)) {
+		fprintf(stderr, "check: map / unmap\n");
+		exit(1);
+	}
+
+	close(fd);
+	unlink("/map.dat");
+}
+
+int main(int argc, char *argv[]) {
+	flash_emu_stats_t stats;
+	int files = 300;
+	int dirs = 10;
+	int iterations = 200;
+
+	if (argc > 1) files = atoi(argv[1]);
+	if (argc > 2) dirs = atoi(argv[2]);
+	if (argc > 3) iterations = atoi(argv[3]);
+
+	if (flash_emu_init(SPIFFS_BASE_ADDR, SPIFFS_SIZE, NULL) < 0) {
+		fprintf(stderr, "can't create flash emulator\n");
+		return 1;
+	}
+
+	vfs_spiffs_register();
+
+	vfs = esp_vfs_host_get("/spiffs");
+	if (!vfs) {
+		fprintf(stderr, "spiffs not registered\n");
+		return 1;
+	}
+
+	printf("spiffs vfs benchmark: %d files, %d directories, %d iterations\n\n", files, dirs, iterations);
+
+	populate(files, dirs);
+	check(files, dirs);
+
+	flash_emu_reset_stats();
+
+	bench_open(files, dirs, iterations);
+	bench_stat(dirs, iterations);
+	bench_readdir(dirs, iterations);
+
+	flash_emu_get_stats(&stats);
+
+	printf("\nflash: %u reads (%llu bytes), %u writes (%llu bytes), %u erases\n",
+		stats.reads, (unsigned long long)stats.read_bytes,
+		stats.writes, (unsigned long long)stats.write_bytes,
+		stats.erases
+	);
+
+	bench_atime(files, dirs);
+	bench_map(iterations);
+
+	flash_emu_deinit();
+
+	return 0;
+}
@@ -0,0 +1,258 @@
+/*
+ * Lua RTOS, spiffs background garbage collection benchmark
+ *
+ * Logs lines to files in bursts, with idle time between the bursts, as a
+ * program that logs sensor readings does. When a log file is full it's closed,
+ * and the oldest one is checked and removed. A large file that is never written
+ * again keeps the file system mostly full, so that the logs need garbage
+ * collections.
+ *
+ * A sector erase is made to take ERASE_US, and the log is run without and with
+ * the garbage collector task. For each run the write latency, and the writes
+ * that had to wait for a garbage collection (stalls) are reported.
+ *
+ * usage: bench_spiffs_gc [bursts] [idle ms]
+ *
+ */
+
+#include "luartos.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "esp_vfs.h"
+#include "vfs.h"
+
+#include "flash_emu.h"
+#include "bench.h"
+
+#define ERASE_US       5000    // time of a sector erase
+#define BALLAST_SIZE   (600 * 1024)
+#define LOG_SIZE       (32 * 1024)
+#define LOG_FILES      4
+#define LINE_SIZE      100
+#define BURST_LINES    64
+
+static const esp_vfs_t *vfs;
+static int fails = 0;
+
+typedef struct {
+	uint32_t writes;
+	uint64_t write_ns;
+	uint64_t write_max_ns;
+	int first;              // first log file kept
+	int last;               // log file being written
+	int fd;
+	int lines;              // lines of the log file being written
+} run_t;
+
+static void line(char *buf, int file, int n) {
+	memset(buf, 'a' + (file + n) % 26, LINE_SIZE);
+	snprintf(buf, LINE_SIZE, "%06d:%06d", file, n);
+	buf[13] = ' ';
+	buf[LINE_SIZE - 1] = '\n';
+}
+
+static void log_path(char *path, int file) {
+	sprintf(path, "/log%d.txt", file);
+}
+
+static int log_open(int file) {
+	char path[32];
+	int fd;
+
+	log_path(path, file);
+
+	fd = vfs->open(path, O_CREAT | O_TRUNC | O_WRONLY, 0);
+	if (fd < 0) {
+		fprintf(stderr, "open %s: %s\n", path, strerror(errno));
+		exit(1);
+	}
+
+	return fd;
+}
+
+// Check the lines of a log file, and remove it
+static void log_check(int file, int lines) {
+	char buf[LINE_SIZE], expected[LINE_SIZE];
+	char path[32];
+	int fd, n;
+
+	log_path(path, file);
+
+	fd = vfs->open(path, O_RDONLY, 0);
+	if (fd < 0) {
+		printf("FAIL: open %s: %s\n", path, strerror(errno));
+		fails++;
+		return;
+	}
+
+	for(n = 0;n < lines;n++) {
+		line(expected, file, n);
+		if ((vfs->read(fd, buf, LINE_SIZE) != LINE_SIZE) || memcmp(buf, expected, LINE_SIZE)) {
+			printf("FAIL: %s, line %d\n", path, n);
+			fails++;
+			break;
+		}
+	}
+
+	vfs->close(fd);
+	vfs->unlink(path);
+}
+
+static void log_burst(run_t *run) {
+	char buf[LINE_SIZE];
+	uint64_t t0, ns;
+	int i, res;
+
+	for(i = 0;i < BURST_LINES;i++) {
+		line(buf, run->last, run->lines);
+
+		t0 = bench_now_ns();
+		res = vfs->write(run->fd, buf, LINE_SIZE);
+		ns = bench_now_ns() - t0;
+
+		if (res != LINE_SIZE) {
+			fprintf(stderr, "write: %s\n", strerror(errno));
+			exit(1);
+		}
+
+		run->writes++;
+		run->write_ns += ns;
+		if (ns > run->write_max_ns) run->write_max_ns = ns;
+
+		if (++run->lines * LINE_SIZE >= LOG_SIZE) {
+			vfs->close(run->fd);
+
+			if (run->last - run->first + 1 >= LOG_FILES) {
+				log_check(run->first++, LOG_SIZE / LINE_SIZE);
+			}
+
+			run->fd = log_open(++run->last);
+			run->lines = 0;
+		}
+	}
+}
+
+static void ballast() {
+	char buf[1024];
+	int fd, i;
+
+	memset(buf, 'b', sizeof(buf));
+
+	fd = vfs->open("/ballast.dat", O_CREAT | O_WRONLY, 0);
+	if (fd < 0) {
+		fprintf(stderr, "open /ballast.dat: %s\n", strerror(errno));
+		exit(1);
+	}
+
+	for(i = 0;i < BALLAST_SIZE / sizeof(buf);i++) {
+		if (vfs->write(fd, buf, sizeof(buf)) != sizeof(buf)) {
+			fprintf(stderr, "write /ballast.dat: %s\n", strerror(errno));
+			exit(1);
+		}
+	}
+
+	vfs->close(fd);
+}
+
+static void ballast_check() {
+	char buf[1024], expected[1024];
+	int fd, i;
+
+	memset(expected, 'b', sizeof(expected));
+
+	fd = vfs->open("/ballast.dat", O_RDONLY, 0);
+	for(i = 0;i < BALLAST_SIZE / sizeof(buf);i++) {
+		if ((vfs->read(fd, buf, sizeof(buf)) != sizeof(buf)) || memcmp(buf, expected, sizeof(buf))) {
+			printf("FAIL: /ballast.dat, block %d\n", i);
+			fails++;
+			break;
+		}
+	}
+	vfs->close(fd);
+}
+
+static void log_run(const char *name, int gc, int bursts, int idle_ms) {
+	vfs_spiffs_gc_stats_t s0, s1;
+	flash_emu_stats_t flash;
+	uint64_t t0, ns;
+	run_t run;
+	int i;
+
+	memset(&run, 0, sizeof(run));
+	run.fd = log_open(0);
+
+	vfs_spiffs_gc_enable(gc);
+	vfs_spiffs_gc_stats(&s0);
+	flash_emu_reset_stats();
+
+	t0 = bench_now_ns();
+	for(i = 0;i < bursts;i++) {
+		log_burst(&run);
+		usleep(idle_ms * 1000);
+	}
+	ns = bench_now_ns() - t0;
+
+	vfs_spiffs_gc_stats(&s1);
+	flash_emu_get_stats(&flash);
+
+	vfs->close(run.fd);
+	for(i = run.first;i <= run.last;i++) {
+		log_check(i, (i == run.last)?run.lines:LOG_SIZE / LINE_SIZE);
+	}
+
+	printf("%s\n", name);
+	bench_report("  log (burst + idle)", bursts, ns);
+	bench_report("  write", run.writes, run.write_ns);
+	printf("  write max %.2f ms, %u stalls (%u ms), %u erases\n",
+		(double)run.write_max_ns / 1000000.0,
+		s1.stalls - s0.stalls, s1.stall_ms - s0.stall_ms,
+		flash.erases
+	);
+	printf("  gc task: %u steps (%u ms), %u free blocks\n\n",
+		s1.gc_steps - s0.gc_steps, s1.gc_ms - s0.gc_ms, s1.free_blocks
+	);
+}
+
+int main(int argc, char *argv[]) {
+	int bursts = 30;
+	int idle_ms = 200;
+
+	if (argc > 1) bursts = atoi(argv[1]);
+	if (argc > 2) idle_ms = atoi(argv[2]);
+
+	if (flash_emu_init(SPIFFS_BASE_ADDR, SPIFFS_SIZE, NULL) < 0) {
+		fprintf(stderr, "can't create flash emulator\n");
+		return 1;
+	}
+
+	vfs_spiffs_register();
+
+	vfs = esp_vfs_host_get("/spiffs");
+	if (!vfs) {
+		fprintf(stderr, "spiffs not registered\n");
+		return 1;
+	}
+
+	printf("spiffs gc benchmark: %d bursts of %d lines, %d ms idle, %d us erase, gc task after %d ms idle\n\n",
+		bursts, BURST_LINES, idle_ms, ERASE_US, SPIFFS_GC_IDLE_TIME);
+
+	ballast();
+	flash_emu_set_erase_time(ERASE_US);
+
+	log_run("without gc task", 0, bursts, idle_ms);
+	log_run("with gc task", 1, bursts, idle_ms);
+
+	ballast_check();
+
+	printf("check: %s\n", fails?"FAIL":"OK");
+
+	flash_emu_deinit();
+
+	return fails?1:0;
+}
@@ -0,0 +1,366 @@
+/*
+ * Lua RTOS, tft framebuffer renderer test for the Linux host build
+ *
+ * Draws a set of scenes with the tft module drawing functions, over the SPI
+ * display emulator (port/espi_panel.c):
+ *
+ * - directly to the display, as without framebuffer
+ * - to a full screen framebuffer, sent with TFT_flush
+ * - to a framebuffer for a part of the screen, sent with TFT_flush
+ *
+ * The three display images must be the same, and match the golden image of
+ * the scene (bench_tft_golden.h, FNV-1a hash of the display memory). The
+ * number of address windows and SPI transfers used in each mode is reported.
+ *
+ * The drawing functions are static, so tft.c is included here.
+ *
+ * Usage: bench_tft [-g] [-w]
+ *
+ * -g: print the golden images hashes, in bench_tft_golden.h format
+ * -w: write the images to build/tft_<scene>.ppm
+ *
+ */
+
+#include "bench.h"
+#include "espi_panel.h"
+
+#include "screen/tft.c"
+
+#include "bench_tft_golden.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Empty Lua RTOS module tables, Lua is not used
+const luaR_entry lua_rotable[] = {
+	{LNILKEY, LNILVAL}
+};
+
+const luaL_Reg lua_libs1[] = {
+	{NULL, NULL}
+};
+
+typedef struct {
+	const char *name;
+	void (*draw)(void);
+} scene_t;
+
+//-------------------------------
+static void scene_shapes(void) {
+	TFT_fillScreen(TFT_NAVY);
+	TFT_drawRect(10, 10, 100, 60, TFT_WHITE);
+	TFT_fillRect(20, 20, 80, 40, TFT_RED);
+	TFT_drawRoundRect(120, 10, 90, 60, 12, TFT_YELLOW);
+	TFT_fillRoundRect(130, 20, 70, 40, 8, TFT_DARKGREEN);
+	TFT_drawCircle(260, 50, 40, TFT_CYAN);
+	TFT_fillCircle(260, 50, 25, TFT_MAGENTA);
+	TFT_drawLine(0, 239, 319, 80, TFT_GREEN);
+	TFT_drawLine(0, 80, 319, 239, TFT_ORANGE);
+	TFT_drawLine(160, 80, 160, 239, TFT_PINK);
+	TFT_fillTriangle(20, 230, 60, 100, 100, 200, TFT_PURPLE);
+	TFT_drawTriangle(20, 230, 60, 100, 100, 200, TFT_WHITE);
+	TFT_draw_ellipse(200, 160, 50, 30, TFT_GREENYELLOW, 15);
+	TFT_draw_filled_ellipse(200, 160, 30, 15, TFT_OLIVE, 15);
+	drawPolygon(280, 190, 6, 35, TFT_LIGHTGREY, 1, 10);
+	drawStar(280, 190, 30, TFT_BLACK, 0, 2.0);
+}
+
+//-----------------------------
+static void scene_text(void) {
+	TFT_fillScreen(TFT_BLACK);
+
+	_fg = TFT_WHITE;
+	_bg = TFT_BLACK;
+	_transparent = 0;
+	TFT_setFont(DEFAULT_FONT, NULL);
+	TFT_print("Lua RTOS framebuffer", 4, 4);
+
+	_fg = TFT_YELLOW;
+	_transparent = 1;
+	TFT_setFont(DEJAVU18_FONT, NULL);
+	TFT_print("DejaVu 18", CENTER, 30);
+
+	_fg = TFT_CYAN;
+	TFT_setFont(COMIC24_FONT, NULL);
+	TFT_print("Comic 24", 10, 60);
+
+	_fg = TFT_GREEN;
+	_bg = TFT_DARKGREY;
+	_transparent = 0;
+	TFT_setFont(UBUNTU16_FONT, NULL);
+	rotation = 30;
+	TFT_OFFSET = 0;
+	TFT_print("rotated", 150, 110);
+	rotation = 0;
+
+	_fg = TFT_RED;
+	_bg = TFT_BLACK;
+	TFT_setFont(FONT_7SEG, NULL);
+	TFT_print("12:45", 10, 150);
+
+	TFT_setFont(DEFAULT_FONT, NULL);
+	_fg = TFT_GREEN;
+	_transparent = 0;
+}
+
+// A gauge with a needle and a value, drawn as an application refreshes it
+//------------------------------
+static void scene_gauge(void) {
+	char tmp[16];
+	int i, v;
+
+	TFT_fillScreen(TFT_BLACK);
+	TFT_setFont(DEJAVU24_FONT, NULL);
+
+	for(i = 0;i < 10;i++) {
+		v = i * 11;
+
+		// Dial
+		TFT_fillCircle(160, 130, 100, TFT_DARKGREY);
+		TFT_fillArcOffsetted(160, 130, 100, 12, 0, v * 3.6 * 0.75, TFT_GREEN);
+		TFT_drawCircle(160, 130, 100, TFT_WHITE);
+		for(v = 0;v <= 100;v += 10) {
+			DrawLineByAngle(160, 130, v * 27 / 10 - 135, 80, 8, TFT_WHITE);
+		}
+
+		// Needle
+		drawLineByAngle(160, 130, i * 27 - 135, 75, TFT_RED);
+		TFT_fillCircle(160, 130, 6, TFT_RED);
+
+		// Value
+		_fg = TFT_YELLOW;
+		_bg = TFT_DARKGREY;
+		_transparent = 0;
+		sprintf(tmp, "%3d", i * 11);
+		TFT_print(tmp, CENTER, 170);
+	}
+
+	TFT_setFont(DEFAULT_FONT, NULL);
+	_fg = TFT_GREEN;
+	_bg = TFT_BLACK;
+}
+
+// Image as the JPEG and BMP decoders send it, a line or a block at a time
+//------------------------------
+static void scene_image(void) {
+	uint16_t block[16 * 16];
+	int x, y, i;
+
+	for(y = 0;y < 240;y += 16) {
+		for(x = 0;x < 320;x += 16) {
+			for(i = 0;i < 16 * 16;i++) {
+				uint16_t color = (uint16_t)((x * 7 + y * 131 + i * 3) & 0xffff);
+				block[i] = (color >> 8) | (color << 8);
+			}
+			send_data(x, y, x + 15, y + 15, 16 * 16, block);
+		}
+	}
+
+	for(y = 60;y < 180;y++) {
+		for(x = 0;x < 200;x++) {
+			uint16_t color = (uint16_t)(x * 300 + y);
+			tft_line[x] = (color >> 8) | (color << 8);
+		}
+		send_data(60, y, 259, y, 200, tft_line);
+	}
+}
+
+static const scene_t scenes[] = {
+	{"shapes", scene_shapes},
+	{"text", scene_text},
+	{"gauge", scene_gauge},
+	{"image", scene_image},
+	{NULL, NULL}
+};
+
+// Modes
+#define MODE_DIRECT  0
+#define MODE_FB      1
+#define MODE_PARTIAL 2
+
+static const char *mode_names[] = {"direct", "framebuffer", "partial fb"};
+
+//-------------------------------
+static uint64_t panel_hash(void) {
+	uint64_t h = 0xcbf29ce484222325ULL;
+	int x, y;
+
+	for(y = 0;y < _height;y++) {
+		for(x = 0;x < _width;x++) {
+			uint16_t c = panel_mem[y * PANEL_MAX_SIZE + x];
+			h = (h ^ (c & 0xff)) * 0x100000001b3ULL;
+			h = (h ^ (c >> 8)) * 0x100000001b3ULL;
+		}
+	}
+
+	return h;
+}
+
+//---------------------------------------
+static void write_ppm(const char *name) {
+	char path[64];
+	FILE *fp;
+	int x, y;
+
+	snprintf(path, sizeof(path), "build/tft_%s.ppm", name);
+	fp = fopen(path, "wb");
+	if (!fp) return;
+
+	fprintf(fp, "P6\n%d %d\n255\n", _width, _height);
+	for(y = 0;y < _height;y++) {
+		for(x = 0;x < _width;x++) {
+			uint16_t c = panel_mem[y * PANEL_MAX_SIZE + x];
+			fputc((c >> 8) & 0xf8, fp);
+			fputc((c >> 3) & 0xfc, fp);
+			fputc((c << 3) & 0xf8, fp);
+		}
+	}
+
+	fclose(fp);
+}
+
+//--------------------------------------------------------------------------------------
+static uint64_t render(const scene_t *scene, int mode, panel_stats_t *stats, uint64_t *ns) {
+	uint64_t t0;
+
+	tft_fb_deinit();
+	panel_clear(TFT_BLACK);
+	_initvar();
+
+	if (mode == MODE_FB) {
+		tft_fb_init(0, 0, _width - 1, _height - 1, TFT_BLACK);
+	} else if (mode == MODE_PARTIAL) {
+		tft_fb_init(100, 40, 259, 199, TFT_BLACK);
+	}
+
+	panel_reset_stats();
+
+	t0 = bench_now_ns();
+	scene->draw();
+	TFT_flush();
+	*ns = bench_now_ns() - t0;
+
+	panel_get_stats(stats);
+
+	tft_fb_deinit();
+
+	return panel_hash();
+}
+
+// Reads inside the framebuffer are from RAM, reads across its border flush it
+// and read the display
+//-------------------------------
+static int check_readback(void) {
+	static uint16_t fb_buf[64 * 64], panel_buf[64 * 64];
+	int fails = 0;
+
+	tft_fb_deinit();
+	panel_clear(TFT_BLACK);
+	_initvar();
+
+	tft_fb_init(0, 0, 159, 119, TFT_BLACK);
+	TFT_fillRect(40, 40, 100, 60, TFT_RED);
+	TFT_fillCircle(100, 100, 40, TFT_BLUE);
+
+	panel_reset_stats();
+	read_data(20, 20, 83, 83, 64 * 64, (uint8_t *)fb_buf);
+	if (readPixel(50, 45) != TFT_RED) {
+		printf("FAIL: framebuffer readPixel\n");
+		fails++;
+	}
+
+	panel_stats_t stats;
+	panel_get_stats(&stats);
+	if (stats.transfers) {
+		printf("FAIL: framebuffer read from the display\n");
+		fails++;
+	}
+
+	read_data(130, 100, 193, 163, 64 * 64, (uint8_t *)panel_buf);
+
+	// Display has the framebuffer changes
+	tft_fb_deinit();
+	read_data(20, 20, 83, 83, 64 * 64, (uint8_t *)panel_buf);
+
+	if (memcmp(fb_buf, panel_buf, sizeof(fb_buf))) {
+		printf("FAIL: framebuffer and display read differ\n");
+		fails++;
+	}
+
+	return fails;
+}
+
+int main(int argc, char *argv[]) {
+	panel_stats_t stats;
+	uint64_t hash[3];
+	uint64_t ns;
+	const scene_t *scene;
+	char tmp[64];
+	int golden = 0;
+	int write = 0;
+	int fails = 0;
+	int i, mode;
+
+	for(i = 1;i < argc;i++) {
+		if (!strcmp(argv[i], "-g")) golden = 1;
+		else if (!strcmp(argv[i], "-w")) write = 1;
+	}
+
+	tft_set_defaults();
+	TFT_type = 1;
+	if (tft_spi_init(3)) {
+		printf("display init failed\n");
+		return 1;
+	}
+	TFT_setRotation(LANDSCAPE);
+	TFT_setFont(DEFAULT_FONT, NULL);
+
+	if (golden) printf("static const tft_golden_t tft_golden[] = {\n");
+
+	for(scene = scenes;scene->name;scene++) {
+		for(mode = MODE_DIRECT;mode <= MODE_PARTIAL;mode++) {
+			hash[mode] = render(scene, mode, &stats, &ns);
+
+			if (golden) continue;
+
+			snprintf(tmp, sizeof(tmp), "%s %s", scene->name, mode_names[mode]);
+			bench_report(tmp, 1, ns);
+			printf("%-32s %8u windows %8u transfers %8u selects\n", "",
+				stats.windows, stats.transfers, stats.selects);
+
+			if (mode != MODE_DIRECT) {
+				if (hash[mode] != hash[MODE_DIRECT]) {
+					printf("FAIL: %s %s image differs from direct drawing\n", scene->name, mode_names[mode]);
+					fails++;
+				}
+			}
+		}
+
+		if (golden) {
+			printf("\t{\"%s\", 0x%016llxULL},\n", scene->name, (unsigned long long)hash[MODE_DIRECT]);
+			continue;
+		}
+
+		if (write) write_ppm(scene->name);
+
+		for(i = 0;tft_golden[i].name;i++) {
+			if (!strcmp(tft_golden[i].name, scene->name)) break;
+		}
+
+		if (!tft_golden[i].name || (tft_golden[i].hash != hash[MODE_DIRECT])) {
+			printf("FAIL: %s doesn't match the golden image\n", scene->name);
+			fails++;
+		}
+	}
+
+	if (golden) {
+		printf("\t{NULL, 0}\n};\n");
+		return 0;
+	}
+
+	fails += check_readback();
+
+	printf("\ncheck: %s\n", fails?"FAIL":"OK");
+
+	return fails?1:0;
+}
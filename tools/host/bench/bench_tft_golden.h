@@ -0,0 +1,25 @@
+/*
+ * Lua RTOS, golden images for bench_tft
+ *
+ * FNV-1a hash of the display memory after drawing each scene. Generated with
+ * bench_tft -g, check the images written by bench_tft -w before updating.
+ *
+ */
+
+#ifndef _HOST_BENCH_TFT_GOLDEN_H
+#define _HOST_BENCH_TFT_GOLDEN_H
+
+typedef struct {
+	const char *name;
+	uint64_t hash;
+} tft_golden_t;
+
+static const tft_golden_t tft_golden[] = {
+	{"shapes", 0xa06b251c2e0a38f8ULL},
+	{"text", 0x00bbaa0058f58371ULL},
+	{"gauge", 0xe1b02e1881752aefULL},
+	{"image", 0x09f166697e9a73b1ULL},
+	{NULL, 0}
+};
+
+#endif
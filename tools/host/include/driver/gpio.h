@@ -0,0 +1,21 @@
+/*
+ * Lua RTOS, driver/gpio.h for the Linux host build
+ *
+ */
+
+#ifndef _HOST_DRIVER_GPIO_H
+#define _HOST_DRIVER_GPIO_H
+
+#include "esp_err.h"
+
+typedef int gpio_num_t;
+
+typedef enum {
+	GPIO_MODE_INPUT = 1,
+	GPIO_MODE_OUTPUT = 2,
+} gpio_mode_t;
+
+static inline esp_err_t gpio_set_level(gpio_num_t gpio_num, uint32_t level) { return 0; }
+static inline esp_err_t gpio_set_direction(gpio_num_t gpio_num, gpio_mode_t mode) { return 0; }
+
+#endif
@@ -0,0 +1,14 @@
+/*
+ * Lua RTOS, esp_attr.h for the Linux host build
+ *
+ */
+
+#ifndef _HOST_ESP_ATTR_H
+#define _HOST_ESP_ATTR_H
+
+#define IRAM_ATTR
+#define DRAM_ATTR
+#define RTC_DATA_ATTR
+#define RTC_IRAM_ATTR
+
+#endif
@@ -0,0 +1,32 @@
+/*
+ * Lua RTOS, esp_err.h for the Linux host build
+ *
+ */
+
+#ifndef _HOST_ESP_ERR_H
+#define _HOST_ESP_ERR_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+typedef int32_t esp_err_t;
+
+#define ESP_OK          0
+#define ESP_FAIL        -1
+
+#define ESP_ERR_NO_MEM          0x101
+#define ESP_ERR_INVALID_ARG     0x102
+#define ESP_ERR_INVALID_STATE   0x103
+#define ESP_ERR_NOT_FOUND       0x105
+
+#define ESP_ERROR_CHECK(x) do {                                         \
+        esp_err_t rc = (x);                                             \
+        if (rc != ESP_OK) {                                             \
+            fprintf(stderr, "ESP_ERROR_CHECK failed: %s:%d (%d)\n",     \
+                    __FILE__, __LINE__, rc);                            \
+            abort();                                                    \
+        }                                                               \
+    } while(0);
+
+#endif
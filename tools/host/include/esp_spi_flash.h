@@ -0,0 +1,35 @@
+/*
+ * Lua RTOS, esp_spi_flash.h for the Linux host build
+ *
+ * Only the Lua flash region (CONFIG_LUA_RTOS_LUA_FLASH_BASE_ADDR) is emulated,
+ * see port/spi_flash.c.
+ *
+ */
+
+#ifndef _HOST_ESP_SPI_FLASH_H
+#define _HOST_ESP_SPI_FLASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+#define SPI_FLASH_SEC_SIZE  4096
+
+typedef enum {
+	SPI_FLASH_MMAP_DATA,
+	SPI_FLASH_MMAP_INST,
+} spi_flash_mmap_memory_t;
+
+typedef uint32_t spi_flash_mmap_handle_t;
+
+esp_err_t spi_flash_mmap(size_t src_addr, size_t size, spi_flash_mmap_memory_t memory,
+                         const void **out_ptr, spi_flash_mmap_handle_t *out_handle);
+void spi_flash_munmap(spi_flash_mmap_handle_t handle);
+
+esp_err_t spi_flash_read(size_t src_addr, void *dest, size_t size);
+esp_err_t spi_flash_write(size_t dest_addr, const void *src, size_t size);
+esp_err_t spi_flash_erase_sector(size_t sector);
+esp_err_t spi_flash_erase_range(size_t start_addr, size_t size);
+
+#endif
@@ -0,0 +1,13 @@
+/*
+ * Lua RTOS, esp_system.h for the Linux host build
+ *
+ */
+
+#ifndef _HOST_ESP_SYSTEM_H
+#define _HOST_ESP_SYSTEM_H
+
+#include <stdint.h>
+
+#include "esp_err.h"
+
+#endif
@@ -0,0 +1,14 @@
+/*
+ * Lua RTOS, esp_task.h for the Linux host build
+ *
+ */
+
+#ifndef _HOST_ESP_TASK_H
+#define _HOST_ESP_TASK_H
+
+#include "freertos/FreeRTOS.h"
+
+#define ESP_TASK_PRIO_MAX (configMAX_PRIORITIES)
+#define ESP_TASK_PRIO_MIN (0)
+
+#endif
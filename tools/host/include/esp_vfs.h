@@ -0,0 +1,54 @@
+/*
+ * Lua RTOS, esp_vfs.h for the Linux host build
+ *
+ * Registered file systems are reached with esp_vfs_host_get, that returns the
+ * operations registered for a base path, or through the syscall wrappers in
+ * port/syscalls.c, for programs linked with them.
+ *
+ */
+
+#ifndef _HOST_ESP_VFS_H
+#define _HOST_ESP_VFS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/dirent.h>
+
+#include "esp_err.h"
+
+#define ESP_VFS_FLAG_DEFAULT        0
+#define ESP_VFS_FLAG_CONTEXT_PTR    1
+
+typedef struct {
+    int fd_offset;
+    int flags;
+    size_t (*write)(int fd, const void * data, size_t size);
+    off_t (*lseek)(int fd, off_t size, int mode);
+    ssize_t (*read)(int fd, void * dst, size_t size);
+    int (*open)(const char * path, int flags, int mode);
+    int (*close)(int fd);
+    int (*fstat)(int fd, struct stat * st);
+    int (*stat)(const char * path, struct stat * st);
+    int (*link)(const char* n1, const char* n2);
+    int (*unlink)(const char *path);
+    int (*rename)(const char *src, const char *dst);
+    DIR* (*opendir)(const char* name);
+    struct dirent* (*readdir)(DIR* pdir);
+    int (*closedir)(DIR* pdir);
+    int (*mkdir)(const char* name, mode_t mode);
+    int (*fsync)(int fd);
+} esp_vfs_t;
+
+esp_err_t esp_vfs_register(const char* base_path, const esp_vfs_t* vfs, void* ctx);
+esp_err_t esp_vfs_unregister(const char* base_path);
+
+const esp_vfs_t *esp_vfs_host_get(const char *base_path);
+
+// Returns the index of the file system registered for path, or -1, and in
+// rpath the path relative to its base path
+int esp_vfs_host_find(const char *path, const char **rpath);
+const esp_vfs_t *esp_vfs_host_vfs(int index);
+
+#endif
@@ -0,0 +1,27 @@
+/*
+ * Lua RTOS, ff.h for the Linux host build
+ *
+ * The host build has no FAT file system, only the declarations used by the os
+ * module are provided (see port/fat.c).
+ *
+ */
+
+#ifndef _HOST_FF_H
+#define _HOST_FF_H
+
+#include "integer.h"
+
+typedef enum {
+	FR_OK = 0,
+	FR_NOT_READY = 3,
+	FR_NOT_ENABLED = 12,
+} FRESULT;
+
+typedef struct {
+	DWORD n_fatent;
+	WORD csize;
+} FATFS;
+
+FRESULT f_getfree(const char *path, DWORD *nclst, FATFS **fatfs);
+
+#endif
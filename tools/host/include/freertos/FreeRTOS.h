@@ -0,0 +1,66 @@
+/*
+ * Lua RTOS, FreeRTOS stand-in for the Linux host build
+ *
+ * Only the subset of the FreeRTOS API used by Lua RTOS is provided. Tasks are
+ * pthreads, and semaphores / queues are built on pthread mutexes and condition
+ * variables (see port/freertos.c).
+ *
+ */
+
+#ifndef _HOST_FREERTOS_H
+#define _HOST_FREERTOS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "sdkconfig.h"
+#include "esp_attr.h"
+
+typedef int32_t  BaseType_t;
+typedef uint32_t UBaseType_t;
+typedef uint32_t TickType_t;
+typedef int32_t  portBASE_TYPE;
+
+#define pdFALSE  ((BaseType_t)0)
+#define pdTRUE   ((BaseType_t)1)
+#define pdPASS   (pdTRUE)
+#define pdFAIL   (pdFALSE)
+
+#define configTICK_RATE_HZ        (CONFIG_FREERTOS_HZ)
+#define configMAX_PRIORITIES      (25)
+#define configMINIMAL_STACK_SIZE  (768)
+#define configUSE_16_BIT_TICKS    0
+#define configASSERT(x)
+
+#define portNUM_PROCESSORS        2
+#define portMAX_DELAY             ((TickType_t)0xffffffffUL)
+#define portTICK_PERIOD_MS        ((TickType_t)1000 / configTICK_RATE_HZ)
+#define portTICK_RATE_MS          portTICK_PERIOD_MS
+#define portYIELD()               vPortYield()
+#define portYIELD_FROM_ISR()      vPortYield()
+
+typedef struct {
+    volatile uint32_t owner;
+    volatile uint32_t count;
+} portMUX_TYPE;
+
+#define portMUX_INITIALIZER_UNLOCKED {.owner = 0, .count = 0}
+
+#define portENTER_CRITICAL(mux)      vPortEnterCritical(mux)
+#define portEXIT_CRITICAL(mux)       vPortExitCritical(mux)
+#define portENTER_CRITICAL_ISR(mux)  vPortEnterCritical(mux)
+#define portEXIT_CRITICAL_ISR(mux)   vPortExitCritical(mux)
+#define taskENTER_CRITICAL(mux)      vPortEnterCritical(mux)
+#define taskEXIT_CRITICAL(mux)       vPortExitCritical(mux)
+
+extern unsigned port_interruptNesting[portNUM_PROCESSORS];
+
+BaseType_t xPortGetCoreID();
+void vPortYield();
+size_t xPortGetFreeHeapSize();
+void vPortEnterCritical(portMUX_TYPE *mux);
+void vPortExitCritical(portMUX_TYPE *mux);
+void _frxt_setup_switch();
+
+#endif
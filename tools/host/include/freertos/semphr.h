@@ -0,0 +1,26 @@
+/*
+ * Lua RTOS, FreeRTOS semaphores stand-in for the Linux host build
+ *
+ */
+
+#ifndef _HOST_SEMPHR_H
+#define _HOST_SEMPHR_H
+
+#include "freertos/FreeRTOS.h"
+
+typedef struct host_sem *SemaphoreHandle_t;
+
+SemaphoreHandle_t xSemaphoreCreateBinary();
+SemaphoreHandle_t xSemaphoreCreateMutex();
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t max, UBaseType_t initial);
+BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t ticks);
+BaseType_t xSemaphoreGive(SemaphoreHandle_t sem);
+BaseType_t xSemaphoreTakeFromISR(SemaphoreHandle_t sem, BaseType_t *woken);
+BaseType_t xSemaphoreGiveFromISR(SemaphoreHandle_t sem, BaseType_t *woken);
+void vSemaphoreDelete(SemaphoreHandle_t sem);
+
+#define xSemaphoreCreateRecursiveMutex()      xSemaphoreCreateMutex()
+#define xSemaphoreTakeRecursive(sem, ticks)   xSemaphoreTake(sem, ticks)
+#define xSemaphoreGiveRecursive(sem)          xSemaphoreGive(sem)
+
+#endif
@@ -0,0 +1,33 @@
+/*
+ * Lua RTOS, FreeRTOS tasks stand-in for the Linux host build
+ *
+ */
+
+#ifndef _HOST_TASK_H
+#define _HOST_TASK_H
+
+#include "freertos/FreeRTOS.h"
+
+#define configNUM_THREAD_LOCAL_STORAGE_POINTERS 2
+#define tskNO_AFFINITY INT32_MAX
+
+typedef struct host_task *TaskHandle_t;
+typedef void (*TaskFunction_t)(void *);
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t code, const char *name, uint32_t stack,
+                                   void *arg, UBaseType_t prio, TaskHandle_t *handle,
+                                   BaseType_t core);
+void vTaskDelete(TaskHandle_t task);
+void vTaskDelay(TickType_t ticks);
+TickType_t xTaskGetTickCount();
+TaskHandle_t xTaskGetCurrentTaskHandle();
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task);
+void *pvTaskGetThreadLocalStoragePointer(TaskHandle_t task, BaseType_t index);
+void vTaskSetThreadLocalStoragePointer(TaskHandle_t task, BaseType_t index, void *value);
+void vTaskSuspendAll();
+BaseType_t xTaskResumeAll();
+
+#define xTaskCreate(code, name, stack, arg, prio, handle) \
+    xTaskCreatePinnedToCore(code, name, stack, arg, prio, handle, tskNO_AFFINITY)
+
+#endif
@@ -0,0 +1,23 @@
+/*
+ * Lua RTOS, newlib compatibility for the Linux host build
+ *
+ * This file is included before any other file (see Makefile), and provides
+ * the functions and declarations that Lua RTOS gets from the esp-idf newlib,
+ * and that are not present in glibc.
+ *
+ */
+
+#ifndef _HOST_COMPAT_H
+#define _HOST_COMPAT_H
+
+#include <stddef.h>
+#include <string.h>
+#include <time.h>
+
+#if !defined(__GLIBC__) || (__GLIBC__ < 2) || ((__GLIBC__ == 2) && (__GLIBC_MINOR__ < 38))
+size_t strlcpy(char *dst, const char *src, size_t size);
+size_t strlcat(char *dst, const char *src, size_t size);
+#define HOST_NEED_STRLCPY 1
+#endif
+
+#endif
@@ -0,0 +1,20 @@
+/*
+ * Lua RTOS, integer.h (FatFs integer types) for the Linux host build
+ *
+ */
+
+#ifndef _HOST_INTEGER_H
+#define _HOST_INTEGER_H
+
+#include <stdint.h>
+
+typedef int             INT;
+typedef unsigned int    UINT;
+typedef unsigned char   BYTE;
+typedef short           SHORT;
+typedef unsigned short  WORD;
+typedef unsigned short  WCHAR;
+typedef long            LONG;
+typedef unsigned long   DWORD;
+
+#endif
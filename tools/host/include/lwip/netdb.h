@@ -0,0 +1,13 @@
+/*
+ * Lua RTOS, lwip/netdb.h for the Linux host build
+ *
+ * Host name resolution is done by the host resolver.
+ *
+ */
+
+#ifndef _HOST_LWIP_NETDB_H
+#define _HOST_LWIP_NETDB_H
+
+#include <netdb.h>
+
+#endif
@@ -0,0 +1,19 @@
+/*
+ * Lua RTOS, lwip/sockets.h for the Linux host build
+ *
+ * The lwIP socket API is the BSD one, so the host sockets are used.
+ *
+ */
+
+#ifndef _HOST_LWIP_SOCKETS_H
+#define _HOST_LWIP_SOCKETS_H
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+#endif
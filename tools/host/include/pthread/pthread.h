@@ -0,0 +1,25 @@
+/*
+ * Lua RTOS, pthread.h for the Linux host build
+ *
+ * Lua RTOS threads are host threads. The CPU affinity set in the thread
+ * attributes is ignored.
+ *
+ */
+
+#ifndef _HOST_PTHREAD_H
+#define _HOST_PTHREAD_H
+
+#include <pthread.h>
+#include <sched.h>
+
+typedef int host_cpu_set_t;
+
+#define cpu_set_t host_cpu_set_t
+
+static inline int host_pthread_attr_setaffinity_np(pthread_attr_t *attr, size_t cpusetsize, const host_cpu_set_t *cpuset) {
+    return 0;
+}
+
+#define pthread_attr_setaffinity_np host_pthread_attr_setaffinity_np
+
+#endif
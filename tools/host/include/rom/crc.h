@@ -0,0 +1,9 @@
+/*
+ * Lua RTOS, rom/crc.h for the Linux host build
+ *
+ */
+
+#ifndef _HOST_ROM_CRC_H
+#define _HOST_ROM_CRC_H
+
+#endif
@@ -0,0 +1,9 @@
+/*
+ * Lua RTOS, rom/ets_sys.h for the Linux host build
+ *
+ */
+
+#ifndef _HOST_ROM_ETS_SYS_H
+#define _HOST_ROM_ETS_SYS_H
+
+#endif
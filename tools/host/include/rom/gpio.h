@@ -0,0 +1,9 @@
+/*
+ * Lua RTOS, rom/gpio.h for the Linux host build
+ *
+ */
+
+#ifndef _HOST_ROM_GPIO_H
+#define _HOST_ROM_GPIO_H
+
+#endif
@@ -0,0 +1,28 @@
+/*
+ * Lua RTOS, rom/lldesc.h for the Linux host build
+ *
+ * DMA linked list descriptor, with the same layout as the esp-idf one.
+ *
+ */
+
+#ifndef _HOST_ROM_LLDESC_H
+#define _HOST_ROM_LLDESC_H
+
+#include <stdint.h>
+#include <sys/queue.h>
+
+typedef struct lldesc_s {
+	volatile uint32_t size  :12,
+	                  length:12,
+	                  offset: 5,
+	                  sosf  : 1,
+	                  eof   : 1,
+	                  owner : 1;
+	volatile uint8_t *buf;
+	union {
+		volatile uint32_t empty;
+		STAILQ_ENTRY(lldesc_s) qe;
+	};
+} lldesc_t;
+
+#endif
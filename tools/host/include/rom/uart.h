@@ -0,0 +1,9 @@
+/*
+ * Lua RTOS, rom/uart.h for the Linux host build
+ *
+ */
+
+#ifndef _HOST_ROM_UART_H
+#define _HOST_ROM_UART_H
+
+#endif
@@ -0,0 +1,73 @@
+/*
+ * Lua RTOS, sdkconfig for the Linux host build
+ *
+ * This file replaces the sdkconfig.h generated by the esp-idf build system
+ * from the menuconfig options. Only the options that are meaningful in the
+ * host build are enabled.
+ *
+ */
+
+#ifndef _HOST_SDKCONFIG_H
+#define _HOST_SDKCONFIG_H
+
+#define CONFIG_LUA_RTOS_BOARD_OTHER 1
+
+#define CONFIG_LUA_RTOS_USE_SPIFFS 1
+#define CONFIG_LUA_RTOS_SPIFFS_LOG_BLOCK_SIZE 8192
+#define CONFIG_LUA_RTOS_SPIFFS_BASE_ADDR 0
+#define CONFIG_LUA_RTOS_SPIFFS_SIZE 1048576
+#define CONFIG_LUA_RTOS_SPIFFS_META_FLUSH_TIME 2
+#define CONFIG_LUA_RTOS_SPIFFS_GC_FREE_BLOCKS 8
+#define CONFIG_LUA_RTOS_SPIFFS_GC_IDLE_TIME 50
+
+#define CONFIG_LUA_RTOS_USE_HTTP_SERVER 1
+#define CONFIG_LUA_RTOS_HTTP_SERVER_PORT 8088
+#define CONFIG_LUA_RTOS_HTTP_SERVER_WORKERS 3
+#define CONFIG_LUA_RTOS_HTTP_SERVER_STACK_SIZE 6144
+#define CONFIG_LUA_RTOS_HTTP_SERVER_BUFFER_SIZE 2048
+#define CONFIG_LUA_RTOS_HTTP_SERVER_KEEP_ALIVE_TIMEOUT 5
+
+#define CONFIG_LUA_RTOS_LUA_TASK_PRIORITY 3
+#define CONFIG_LUA_RTOS_LUA_STACK_SIZE 20480
+#define CONFIG_LUA_RTOS_LUA_TASK_CPU 0
+#define CONFIG_LUA_RTOS_LUA_THREAD_STACK_SIZE 10240
+#define CONFIG_LUA_RTOS_LUA_THREAD_PRIORITY 20
+#define CONFIG_LUA_RTOS_LUA_THREAD_CPU 1
+#define CONFIG_LUA_RTOS_LUA_THREAD_HEAP_SIZE 0
+#define CONFIG_LUA_RTOS_LUA_THREAD_CHANNEL_SIZE 8
+#define CONFIG_LUA_RTOS_LUA_THREAD_POOL_WORKERS 2
+#define CONFIG_LUA_RTOS_LUA_THREAD_POOL_QUEUE 16
+#define CONFIG_LUA_RTOS_LUA_THREAD_POOL_TIMEOUT 1000
+#define CONFIG_LUA_RTOS_LUA_USE_POOL_ALLOC 1
+#define CONFIG_LUA_RTOS_LUA_GC_HIGH_WATERMARK 48
+#define CONFIG_LUA_RTOS_LUA_GC_LOW_WATERMARK 16
+#define CONFIG_LUA_RTOS_LUA_USE_FLASH_MODULES 1
+#define CONFIG_LUA_RTOS_LUA_FLASH_BASE_ADDR 0x110000
+#define CONFIG_LUA_RTOS_LUA_FLASH_SIZE 458752
+#define CONFIG_LUA_RTOS_LUA_USE_MODULE_CACHE 1
+#define CONFIG_LUA_RTOS_LUA_USE_PROFILER 1
+#define CONFIG_LUA_RTOS_LUA_PROFILER_STACKS 256
+
+#define CONFIG_LUA_RTOS_LUA_USE__G 1
+#define CONFIG_LUA_RTOS_LUA_USE_OS 1
+#define CONFIG_LUA_RTOS_LUA_USE_MATH 1
+#define CONFIG_LUA_RTOS_LUA_USE_TABLE 1
+#define CONFIG_LUA_RTOS_LUA_USE_IO 1
+#define CONFIG_LUA_RTOS_LUA_USE_STRING 1
+#define CONFIG_LUA_RTOS_LUA_USE_COROUTINE 1
+#define CONFIG_LUA_RTOS_LUA_USE_DEBUG 1
+#define CONFIG_LUA_RTOS_LUA_USE_UTF8 1
+#define CONFIG_LUA_RTOS_LUA_USE_PACKAGE 1
+#define CONFIG_LUA_RTOS_LUA_USE_PACK 1
+
+// The thread module of the host is port/thread.c
+#define CONFIG_LUA_RTOS_LUA_USE_THREAD 1
+#define CONFIG_LUA_RTOS_LUA_USE_EVENT 1
+#define CONFIG_LUA_RTOS_LUA_EVENT_QUEUE_SIZE 16
+
+// lua_cjson.c is registered with this option, that has no Kconfig entry
+#define CONFIG_LUA_RTOS_LUA_USE_CJSON 1
+
+#define CONFIG_FREERTOS_HZ 1000
+
+#endif
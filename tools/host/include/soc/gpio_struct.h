@@ -0,0 +1,9 @@
+/*
+ * Lua RTOS, soc/gpio_struct.h for the Linux host build
+ *
+ */
+
+#ifndef _HOST_SOC_GPIO_STRUCT_H
+#define _HOST_SOC_GPIO_STRUCT_H
+
+#endif
@@ -0,0 +1,9 @@
+/*
+ * Lua RTOS, soc/io_mux_reg.h for the Linux host build
+ *
+ */
+
+#ifndef _HOST_SOC_IO_MUX_REG_H
+#define _HOST_SOC_IO_MUX_REG_H
+
+#endif
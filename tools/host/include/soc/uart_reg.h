@@ -0,0 +1,9 @@
+/*
+ * Lua RTOS, soc/uart_reg.h for the Linux host build
+ *
+ */
+
+#ifndef _HOST_SOC_UART_REG_H
+#define _HOST_SOC_UART_REG_H
+
+#endif
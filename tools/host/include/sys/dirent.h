@@ -0,0 +1,36 @@
+/*
+ * Lua RTOS, sys/dirent.h for the Linux host build
+ *
+ * Same layout than the esp-idf newlib one, so that vfs implementations can
+ * embed a DIR at the start of its own directory structure.
+ *
+ */
+
+#ifndef _HOST_SYS_DIRENT_H
+#define _HOST_SYS_DIRENT_H
+
+#include <stdint.h>
+
+#ifndef MAXNAMLEN
+#define MAXNAMLEN 255
+#endif
+
+typedef struct {
+    uint16_t dd_vfs_idx;
+    uint16_t dd_rsv;
+} DIR;
+
+struct dirent {
+    int d_ino;
+    uint8_t d_type;
+#define DT_UNKNOWN  0
+#define DT_REG      1
+#define DT_DIR      2
+    char d_name[256];
+};
+
+DIR* opendir(const char* name);
+struct dirent* readdir(DIR* pdir);
+int closedir(DIR* pdir);
+
+#endif
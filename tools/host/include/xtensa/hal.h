@@ -0,0 +1,31 @@
+/*
+ * Lua RTOS, xtensa/hal.h for the Linux host build
+ *
+ * The cycle counter of the host is the time stamp counter on x86, and counts
+ * nanoseconds on other CPUs.
+ *
+ */
+
+#ifndef _HOST_XTENSA_HAL_H
+#define _HOST_XTENSA_HAL_H
+
+#include <stdint.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+static inline uint32_t xthal_get_ccount() {
+#if defined(__x86_64__) || defined(__i386__)
+	return (uint32_t)__rdtsc();
+#else
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint32_t)(ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+#endif
+}
+
+#endif
@@ -0,0 +1,36 @@
+-- Lua RTOS, allocations of the Lua test suite for the Linux host build
+--
+-- Run with luahost (see luahost.c) in the tests directory. The blocks allocated
+-- by gc.lua and big.lua are recorded, and replayed with realloc and with the
+-- Lua allocator (Lua/common/lalloc.c), with bench.alloc. Then the size classes
+-- of the Lua allocator, used by the state of this script, are checked.
+
+local function check(cond, msg)
+	if not cond then error("check failed: " .. msg, 2) end
+end
+
+bench.alloc("gc.lua", function()
+	dofile("gc.lua")
+end)
+
+-- big.lua yields, it's run in a coroutine as in all.lua
+bench.alloc("big.lua", function()
+	local f = coroutine.wrap(assert(loadfile("big.lua")))
+	check(f() == 'b', "big.lua")
+	check(f() == 'a', "big.lua")
+end)
+
+local stats = os.stats("lua")
+
+print()
+print(string.format("%-8s %8s %8s %8s %8s", "class", "slabs", "used", "free", "frag %"))
+for i, class in ipairs(stats) do
+	check(class.used + class.free >= class.slabs, "class " .. class.size)
+	check(class.requested <= class.used * class.size, "class " .. class.size)
+
+	print(string.format("%-8s %8d %8d %8d %8d", class.size .. " B", class.slabs, class.used, class.free, class.frag))
+end
+print(string.format("%d large blocks, %d KB, footprint %d KB",
+	stats.large, stats.large_bytes // 1024, stats.footprint // 1024))
+
+print("check: OK")
@@ -0,0 +1,273 @@
+/*
+ * Lua RTOS, allocation traces for the Linux host build
+ *
+ * While a trace is recorded, each block allocated by host_heap_alloc gets a slot,
+ * that is kept while the block is reallocated, and is reused when it's freed.
+ * The trace is the list of (slot, osize, nsize) operations, so it can be replayed
+ * with any lua_Alloc function, in the same order, without looking up the blocks.
+ *
+ * Blocks allocated before the trace is started are not recorded: if they are
+ * reallocated they are recorded as new blocks, and if they are freed they are
+ * not recorded.
+ *
+ * The footprint of realloc is modeled from the trace as the Lua allocator
+ * accounts the large blocks (see LALLOC_HEAP_BLOCK), without the heap
+ * fragmentation. The footprint of the Lua allocator is its own account.
+ *
+ */
+
+#include "luartos.h"
+
+#include "lua.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "alloctrace.h"
+#include "bench.h"
+#include "heap.h"
+#include "lalloc.h"
+
+typedef struct {
+	uint32_t slot;
+	uint32_t osize;   // 0 for new blocks
+	uint32_t nsize;   // 0 for freed blocks
+} trace_op_t;
+
+// A block in use, in the hash table of the blocks in use
+typedef struct {
+	void *ptr;
+	uint32_t slot;
+} trace_block_t;
+
+static trace_op_t *ops;
+static size_t nops, ops_size;
+
+static trace_block_t *blocks;
+static size_t nblocks, blocks_size;  // blocks_size is a power of 2
+
+static uint32_t *free_slots;
+static uint32_t nfree, free_size, slots;
+
+static void *check(void *ptr) {
+	if (!ptr) {
+		fprintf(stderr, "alloc trace: out of memory\n");
+		exit(1);
+	}
+
+	return ptr;
+}
+
+static size_t block_hash(void *ptr) {
+	return (size_t)(((uint64_t)(uintptr_t)ptr * 0x9E3779B97F4A7C15ULL) >> 32) & (blocks_size - 1);
+}
+
+// Position of ptr in the hash table, or of the empty entry where it goes
+static size_t block_pos(void *ptr) {
+	size_t i = block_hash(ptr);
+
+	while (blocks[i].ptr && (blocks[i].ptr != ptr)) {
+		i = (i + 1) & (blocks_size - 1);
+	}
+
+	return i;
+}
+
+static void block_put(void *ptr, uint32_t slot) {
+	trace_block_t *old = blocks;
+	size_t i, old_size = blocks_size;
+
+	if ((nblocks + 1) * 2 > blocks_size) {
+		blocks_size = blocks_size?blocks_size * 2:4096;
+		blocks = check(calloc(blocks_size, sizeof(trace_block_t)));
+
+		for(i = 0;i < old_size;i++) {
+			if (old[i].ptr) blocks[block_pos(old[i].ptr)] = old[i];
+		}
+
+		free(old);
+	}
+
+	i = block_pos(ptr);
+	if (!blocks[i].ptr) nblocks++;
+
+	blocks[i].ptr = ptr;
+	blocks[i].slot = slot;
+}
+
+// Removes an entry, moving back the entries after it that can't be reached without it
+static void block_remove(size_t i) {
+	size_t j = i, k;
+
+	for(;;) {
+		j = (j + 1) & (blocks_size - 1);
+		if (!blocks[j].ptr) break;
+
+		k = block_hash(blocks[j].ptr);
+		if ((j > i)?((k <= i) || (k > j)):((k <= i) && (k > j))) {
+			blocks[i] = blocks[j];
+			i = j;
+		}
+	}
+
+	blocks[i].ptr = NULL;
+	nblocks--;
+}
+
+static uint32_t slot_new() {
+	return nfree?free_slots[--nfree]:slots++;
+}
+
+static void slot_free(uint32_t slot) {
+	if (nfree == free_size) {
+		free_size = free_size?free_size * 2:1024;
+		free_slots = check(realloc(free_slots, free_size * sizeof(uint32_t)));
+	}
+
+	free_slots[nfree++] = slot;
+}
+
+static void trace_hook(void *ptr, size_t osize, void *nptr, size_t nsize) {
+	trace_op_t *op;
+	uint32_t slot;
+	size_t i;
+
+	if (ptr && blocks_size && blocks[i = block_pos(ptr)].ptr) {
+		slot = blocks[i].slot;
+		block_remove(i);
+	} else if (nptr) {
+		slot = slot_new();
+		osize = 0;
+	} else {
+		return;
+	}
+
+	if (nptr) {
+		block_put(nptr, slot);
+	} else {
+		slot_free(slot);
+	}
+
+	if (nops == ops_size) {
+		ops_size = ops_size?ops_size * 2:65536;
+		ops = check(realloc(ops, ops_size * sizeof(trace_op_t)));
+	}
+
+	op = &ops[nops++];
+	op->slot = slot;
+	op->osize = osize;
+	op->nsize = nsize;
+}
+
+void alloc_trace_start() {
+	alloc_trace_free();
+	host_heap_set_hook(trace_hook);
+}
+
+void alloc_trace_stop() {
+	host_heap_set_hook(NULL);
+}
+
+void alloc_trace_free() {
+	free(ops);
+	free(blocks);
+	free(free_slots);
+
+	ops = NULL;
+	blocks = NULL;
+	free_slots = NULL;
+	nops = ops_size = nblocks = blocks_size = 0;
+	nfree = free_size = slots = 0;
+}
+
+static void *libc_alloc(void *ud, void *ptr, size_t osize, size_t nsize) {
+	if (nsize == 0) {
+		free(ptr);
+		return NULL;
+	}
+
+	return realloc(ptr, nsize);
+}
+
+// Replays the trace with f, and returns its time
+static uint64_t replay(lua_Alloc f, void **slot_ptr) {
+	const trace_op_t *op, *end = ops + nops;
+	uint64_t t0, t1;
+
+	t0 = bench_now_ns();
+	for(op = ops;op < end;op++) {
+		slot_ptr[op->slot] = f(NULL, slot_ptr[op->slot], op->osize, op->nsize);
+	}
+	t1 = bench_now_ns();
+
+	return t1 - t0;
+}
+
+// Frees the blocks still in use after a replay
+static void release(lua_Alloc f, void **slot_ptr, const uint32_t *slot_size) {
+	uint32_t slot;
+
+	for(slot = 0;slot < slots;slot++) {
+		if (slot_ptr[slot]) {
+			f(NULL, slot_ptr[slot], slot_size[slot], 0);
+			slot_ptr[slot] = NULL;
+		}
+	}
+}
+
+static void report(const char *name, const char *alloc, uint64_t ns, size_t peak, uint32_t heap_calls) {
+	char label[64];
+
+	snprintf(label, sizeof(label), "%s, %s", name, alloc);
+
+	printf("%-32s %8u %10.2f ms %12.0f ops/s %8u KB peak %8u heap calls\n",
+		label, (uint32_t)nops, (double)ns / 1000000.0,
+		ns?(nops * 1000000000.0) / ns:0.0,
+		(uint32_t)((peak + 1023) / 1024), heap_calls
+	);
+}
+
+void alloc_trace_replay(const char *name) {
+	size_t footprint = 0, peak = 0;
+	uint32_t *slot_size;
+	const trace_op_t *op;
+	void **slot_ptr;
+	uint64_t ns;
+
+	alloc_trace_stop();
+
+	slot_ptr = check(calloc(slots + 1, sizeof(void *)));
+	slot_size = check(calloc(slots + 1, sizeof(uint32_t)));
+
+	// Modeled footprint of realloc, and size of the blocks in use at the end
+	for(op = ops;op < ops + nops;op++) {
+		if (op->osize) footprint -= LALLOC_HEAP_BLOCK(op->osize);
+		if (op->nsize) footprint += LALLOC_HEAP_BLOCK(op->nsize);
+		if (footprint > peak) peak = footprint;
+
+		slot_size[op->slot] = op->nsize;
+	}
+
+	ns = replay(libc_alloc, slot_ptr);
+	release(libc_alloc, slot_ptr, slot_size);
+	report(name, "realloc", ns, peak, nops);
+
+#if CONFIG_LUA_RTOS_LUA_USE_POOL_ALLOC
+	lalloc_stats_t before, after;
+
+	lalloc_reset_peak();
+	lalloc_get_stats(&before);
+
+	ns = replay(lalloc, slot_ptr);
+
+	lalloc_get_stats(&after);
+	release(lalloc, slot_ptr, slot_size);
+	report(name, "lalloc", ns, after.peak - before.footprint, after.heap_calls - before.heap_calls);
+#endif
+
+	free(slot_ptr);
+	free(slot_size);
+
+	alloc_trace_free();
+}
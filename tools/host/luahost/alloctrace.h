@@ -0,0 +1,18 @@
+/*
+ * Lua RTOS, allocation traces for the Linux host build
+ *
+ */
+
+#ifndef _HOST_ALLOCTRACE_H
+#define _HOST_ALLOCTRACE_H
+
+// Records the blocks allocated, reallocated and freed by host_heap_alloc
+void alloc_trace_start();
+void alloc_trace_stop();
+
+// Replays the recorded trace with realloc, and with the Lua allocator, reports
+// the time and peak footprint of each one, and frees the trace
+void alloc_trace_replay(const char *name);
+void alloc_trace_free();
+
+#endif
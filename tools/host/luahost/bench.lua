@@ -0,0 +1,265 @@
+-- Lua RTOS, Lua microbenchmarks for the Linux host build
+--
+-- Run with luahost (see luahost.c), that provides the bench module. Each
+-- benchmark reports the time, operations per second, and the peak heap.
+
+local N = tonumber(arg[1]) or 1
+
+local function check(cond, msg)
+	if not cond then error("check failed: " .. msg, 2) end
+end
+
+-- Table operations
+bench.run("table insert", 100000 * N, function(n)
+	local t = {}
+	for i = 1, n do t[#t + 1] = i end
+	check(#t == n, "table insert")
+end)
+
+bench.run("table hash set / get", 100000 * N, function(n)
+	local t, sum = {}, 0
+	for i = 1, n do t["k" .. (i % 1024)] = i end
+	for i = 1, n do sum = sum + t["k" .. (i % 1024)] end
+	check(sum > 0, "table hash")
+end)
+
+bench.run("table.sort", 20000 * N, function(n)
+	local t = {}
+	for i = 1, n do t[i] = (i * 7919) % n end
+	table.sort(t)
+	for i = 2, n do check(t[i - 1] <= t[i], "table.sort") end
+end)
+
+bench.run("table.concat", 50000 * N, function(n)
+	local t = {}
+	for i = 1, n do t[i] = tostring(i) end
+	check(#table.concat(t, ",") > n, "table.concat")
+end)
+
+-- String operations
+bench.run("string.format", 50000 * N, function(n)
+	local s
+	for i = 1, n do s = string.format("%d:%s:%5.2f", i, "abc", i / 3) end
+	check(s ~= nil, "string.format")
+end)
+
+bench.run("string.find / gsub", 20000 * N, function(n)
+	local text = "the quick brown fox jumps over the lazy dog"
+	local count = 0
+	for i = 1, n do
+		if text:find("lazy") then count = count + 1 end
+		text = text:gsub("o", "0"):gsub("0", "o")
+	end
+	check(count == n, "string.find")
+end)
+
+bench.run("string.rep / sub", 50000 * N, function(n)
+	local s = string.rep("lua rtos ", 16)
+	local len = 0
+	for i = 1, n do len = len + #s:sub(i % 64, i % 64 + 16) end
+	check(len > 0, "string.sub")
+end)
+
+-- JSON
+local doc = {
+	id = 12, name = "sensor", enabled = true, values = {1.5, 2.25, 3, 4, 5},
+	location = {lat = 41.38, lon = 2.17}, tags = {"temp", "hum", "room1"}
+}
+
+bench.run("cjson.encode", 20000 * N, function(n)
+	local s
+	for i = 1, n do s = cjson.encode(doc) end
+	check(#s > 0, "cjson.encode")
+end)
+
+bench.run("cjson.decode", 20000 * N, function(n)
+	local s, t = cjson.encode(doc)
+	for i = 1, n do t = cjson.decode(s) end
+	check(t.name == "sensor" and t.values[2] == 2.25, "cjson.decode")
+end)
+
+-- pack
+bench.run("pack.pack / unpack", 20000 * N, function(n)
+	local a, b, c
+	for i = 1, n do a, b, c = pack.unpack(pack.pack(i, "abc", true)) end
+	check(a == n and b == "abc" and c == true, "pack")
+end)
+
+-- File I/O, on SPIFFS
+local line = string.rep("x", 63) .. "\n"
+
+bench.run("file write (64 bytes lines)", 4000 * N, function(n)
+	local f = assert(io.open("/bench/bench.dat", "w"))
+	for i = 1, n do f:write(line) end
+	f:close()
+end)
+
+bench.run("file read (64 bytes lines)", 4000 * N, function(n)
+	local count = 0
+	for l in io.lines("/bench/bench.dat") do count = count + 1 end
+	check(count == n, "file read")
+end)
+
+bench.run("file open / close", 500 * N, function(n)
+	for i = 1, n do
+		local f = assert(io.open("/bench/bench.dat", "r"))
+		f:close()
+	end
+	os.remove("/bench/bench.dat")
+end)
+
+-- Garbage collector
+bench.run("gc, short lived tables", 100000 * N, function(n)
+	for i = 1, n do local t = {i, i + 1, x = i} end
+end)
+
+bench.run("gc, full collect (10000 objects)", 20 * N, function(n)
+	local keep = {}
+	for i = 1, 10000 do keep[i] = {i} end
+	for i = 1, n do collectgarbage("collect") end
+	check(#keep == 10000, "gc")
+end)
+
+-- Threads, each one in its own Lua state, and channels
+local function workers(w, n)
+	local jobs, done = thread.channel(), thread.channel()
+	for i = 1, w do
+		thread.spawn(function()
+			while true do
+				local m = jobs:receive()
+				if not m then break end
+				local sum = 0
+				for j = 1, m do sum = sum + (j * j) % 7 end
+				done:send(sum)
+			end
+		end)
+	end
+	-- keep one job in flight for each worker, as the channels are bounded
+	local sent, sum = math.min(w, n), 0
+	for i = 1, sent do jobs:send(20000) end
+	for i = 1, n do
+		sum = sum + done:receive()
+		if sent < n then jobs:send(20000) sent = sent + 1 end
+	end
+	for i = 1, w do jobs:send(false) end
+	check(sum > 0, "workers")
+end
+
+bench.run("threads, 1 worker", 40 * N, function(n) workers(1, n) end)
+bench.run("threads, 4 workers", 40 * N, function(n) workers(4, n) end)
+
+-- Short jobs, in a new thread each one, or in the thread pool
+bench.run("threads, spawn a thread by job", 500 * N, function(n)
+	local done, sum = thread.channel(), 0
+	for i = 1, n do
+		thread.spawn(function() done:send(i) end)
+		sum = sum + done:receive()
+	end
+	check(sum == n * (n + 1) // 2, "spawn jobs")
+end)
+
+bench.run("thread pool, submit / join", 500 * N, function(n)
+	local sum = 0
+	for i = 1, n do sum = sum + thread.submit(function() return i end):join() end
+	check(sum == n * (n + 1) // 2, "pool jobs")
+end)
+
+bench.run("thread pool, 16 jobs in flight", 500 * N, function(n)
+	local jobs, sum = {}, 0
+	for i = 1, n do
+		jobs[#jobs + 1] = thread.submit(function() return i end)
+		if #jobs == 16 or i == n then
+			for j = 1, #jobs do sum = sum + jobs[j]:join() end
+			jobs = {}
+		end
+	end
+	check(sum == n * (n + 1) // 2, "pool jobs")
+end)
+
+local function echo(n, value)
+	local req, rep = thread.channel(), thread.channel()
+	thread.spawn(function()
+		while true do
+			local m = req:receive()
+			if m == false then break end
+			rep:send(m)
+		end
+	end)
+	local m
+	for i = 1, n do
+		req:send(value(m))
+		m = rep:receive()
+	end
+	req:send(false)
+	return m
+end
+
+local text, block = string.rep("x", 1024), string.rep("x", 65536)
+
+bench.run("channel echo, 1 KB strings", 5000 * N, function(n)
+	check(#echo(n, function() return text end) == 1024, "channel strings")
+end)
+
+bench.run("channel echo, 64 KB strings", 5000 * N, function(n)
+	check(#echo(n, function() return block end) == 65536, "channel strings")
+end)
+
+bench.run("channel echo, 64 KB buffers", 5000 * N, function(n)
+	-- the buffer sent is left empty, so the one received is sent again
+	local b = thread.buffer(65536)
+	b = echo(n, function(m) return m or b end)
+	check(#b == 65536, "channel buffers")
+end)
+
+bench.run("channel echo, tables", 5000 * N, function(n)
+	check(echo(n, function() return doc end).location.lon == 2.17, "channel tables")
+end)
+
+-- The globals of a job, and the modules it loads, are not seen by the next one
+do
+	local jobs = {}
+	for i = 1, 8 do
+		jobs[i] = thread.submit(function()
+			leaked = i
+			package.loaded.leaked = i
+			return type(string.rep) == "function" and _G.leaked == i
+		end)
+	end
+	for i = 1, 8 do check(jobs[i]:join(), "globals of a job") end
+	for i = 1, 8 do
+		jobs[i] = thread.submit(function() return leaked == nil and package.loaded.leaked == nil end)
+	end
+	for i = 1, 8 do check(jobs[i]:join(), "globals of a previous job") end
+end
+
+-- Submit with a full queue raises an error after the timeout
+do
+	local go, jobs = thread.channel(64), {}
+	local ok, err
+	repeat
+		ok, err = pcall(thread.submit, function() return go:receive() end, 0, 10)
+		if ok then jobs[#jobs + 1] = err end
+	until not ok or #jobs > 64
+	check(not ok and err:find("thread pool is full") and #jobs > 0, "submit to a full queue")
+	for i = 1, #jobs do go:send(i) end
+	for i = 1, #jobs do check(jobs[i]:join(1000), "jobs of a full queue") end
+end
+
+-- A channel sent over itself, that is freed when it's collected
+do
+	local ch = thread.channel()
+	check(ch:send(ch) and ch:send(ch), "channel sent over itself")
+	local c = ch:receive()
+	c:send("x")
+	check(#ch == 2 and ch:receive() and ch:receive() == "x", "channel received from itself")
+end
+
+-- The buffers of a function that can't be moved are kept
+do
+	local b, p = thread.buffer("abc"), print
+	check(not pcall(thread.spawn, function() return b, p end), "function with a C function")
+	check(#b == 3 and b:get() == "abc", "buffers kept")
+end
+
+print()
+print("check: OK")
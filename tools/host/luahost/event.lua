@@ -0,0 +1,142 @@
+-- Lua RTOS, event loop for the Linux host build
+--
+-- A control loop broadcasts its state to a listener that takes 2 ms (as a
+-- logger that writes to a file), that runs in an isolated thread. Reports the
+-- broadcasts per second, that don't wait for the listener, and the calls per
+-- second of the same listener called by the control loop, as the broadcast did
+-- before. Then checks the arguments, one shot listeners, timers, the posts
+-- from interrupt handlers (event_post_isr, see Lua/modules/event.h), and that
+-- a coroutine with listeners is collected.
+
+local function check(cond, msg)
+	if not cond then error("check failed: " .. msg, 2) end
+end
+
+-- The calls queued to a thread (CONFIG_LUA_RTOS_LUA_EVENT_QUEUE_SIZE)
+local N = 16
+
+local function slow()
+	thread.sleepms(2)
+end
+
+-- Listener thread
+local ch = thread.channel()
+
+thread.spawn(function()
+	local e = event.create("state")
+	local count, sum = 0, 0
+
+	e:addlistener(function(name, i, t)
+		thread.sleepms(2)
+
+		count = count + 1
+		sum = sum + i + t.v
+
+		if count == N then
+			ch:send({count = count, sum = sum})
+		end
+	end)
+
+	ch:send("ready")
+	event.loop()
+end)
+
+check(ch:receive(1000) == "ready", "listener thread")
+
+local e = event.create("state")
+
+bench.run("broadcast, 2 ms listener", N, function(n)
+	for i = 1, n do
+		e:broadcast("temperature", i, {v = i})
+	end
+end)
+
+bench.run("call, 2 ms listener", N, function(n)
+	for i = 1, n do
+		slow("temperature", i, {v = i})
+	end
+end)
+
+local r = ch:receive(5000)
+check(r and r.count == N, "calls run by the listener thread")
+check(r.sum == N * (N + 1), "arguments")
+
+local s = e:stats()
+print(string.format("%-32s %8d broadcasts %8d queued %8d dispatched %8d dropped",
+	"", s.broadcasts, s.queued, s.dispatched, s.dropped))
+check(s.queued == N and s.dropped == 0, "calls queued")
+
+-- Arguments, with nil, and one shot listeners, in this thread
+local a = event.create()
+local got, once = nil, 0
+
+a:addlistener(function(...) got = table.pack(...) end)
+a:once(function() once = once + 1 end)
+
+check(a:broadcast(1, nil, "x", {y = 2}) == 2, "listeners queued")
+check(a:broadcast() == 1, "one shot listener removed")
+event.dispatch()
+
+check(got.n == 0, "no arguments")
+check(once == 1, "one shot listener")
+
+a:broadcast(1, nil, "x", {y = 2})
+event.dispatch()
+check(got.n == 4 and got[1] == 1 and got[2] == nil and got[3] == "x" and got[4].y == 2, "arguments with nil")
+
+-- Timers
+local ticks, after = 0, 0
+local tm = event.create()
+
+local id = tm:addlistener(function(what)
+	if what == "tick" then ticks = ticks + 1 else after = after + 1 end
+end)
+
+local every = tm:every(5, "tick")
+tm:after(20, "after")
+
+local start = os.time()
+while (ticks < 10) and (os.time() - start < 5) do
+	event.dispatch(100)
+end
+
+every:stop()
+event.dispatch(30)
+
+print(string.format("%-32s %8d ticks %8d after", "timers", ticks, after))
+check(ticks >= 10 and after == 1, "timers")
+check(tm:removelistener(id) and not tm:removelistener(id), "remove listener")
+
+-- Posts from interrupt handlers, deferred to the event task
+local irq = event.create("irq")
+local sum = 0
+
+irq:addlistener(function(v) sum = sum + v end)
+check(bench.post("irq", 7, 10) == 10, "posts deferred")
+
+start = os.time()
+while (sum < 70) and (os.time() - start < 5) do
+	event.dispatch(100)
+end
+
+check(sum == 70, "posts from interrupt handlers")
+
+-- A coroutine with listeners is collected, and its listeners removed
+local co = coroutine.create(function()
+	irq:addlistener(function() end)
+end)
+
+coroutine.resume(co)
+check(irq:stats().listeners == 2, "listener of a coroutine")
+
+local weak = setmetatable({co}, {__mode = "v"})
+co = nil
+
+-- The sink is closed in the first cycle, and the coroutine collected in the next one
+collectgarbage()
+collectgarbage()
+
+check(weak[1] == nil and irq:stats().listeners == 1, "coroutine with listeners collected")
+check(type(event.error) == "rotable", "event.error")
+
+print("check: OK")
@@ -0,0 +1,186 @@
+-- Lua RTOS, Lua modules in flash for the Linux host build
+--
+-- Run with luahost (see luahost.c) three times, in the same luahost process,
+-- as after a reboot each one (see Lua/common/lflash.h):
+--
+-- 1. generates the modules, requires them from files and puts them in flash
+--    with os.flashlua
+-- 2. requires them from flash, checks them, and puts them in flash again,
+--    without debug information, in the other slot
+-- 3. requires them from the stripped image, and checks them
+--
+-- Each run reports the time of the requires, and the heap used by the
+-- modules.
+
+local function check(cond, msg)
+	if not cond then error("check failed: " .. msg, 2) end
+end
+
+local DIR = "/flashmods"
+local MODULES = 16
+local FUNCTIONS = 16
+
+-- A module with FUNCTIONS functions, that return a value computed from their
+-- constants, and a table of strings
+local function source(m)
+	local s = {"local M = {}\n", "local shared = {}\n"}
+
+	for f = 1, FUNCTIONS do
+		s[#s + 1] = string.format([[
+function M.f%d(x)
+	local key = "key %d %d"
+	shared[key] = (shared[key] or 0) + 1
+	return x * %d + %d + #key, "value of m%d.f%d"
+end
+]], f, m, f, f, m, m, f)
+	end
+
+	s[#s + 1] = string.format("M.name = \"m%d\"\nM.shared = shared\nreturn M\n", m)
+
+	return table.concat(s)
+end
+
+local function expected(m, f, x)
+	return x * f + m + #string.format("key %d %d", m, f), string.format("value of m%d.f%d", m, f)
+end
+
+local function stage()
+	local fp = io.open(DIR .. "/stage", "r")
+	if not fp then return 1 end
+
+	local n = tonumber(fp:read("a"))
+	fp:close()
+
+	return n
+end
+
+local function set_stage(n)
+	local fp = assert(io.open(DIR .. "/stage", "w"))
+	fp:write(tostring(n))
+	fp:close()
+end
+
+local function files()
+	local list = {}
+
+	for m = 1, MODULES do
+		list["m" .. m] = DIR .. "/m" .. m .. ".lua"
+	end
+
+	return list
+end
+
+-- Requires the modules, and returns them, with the heap they use
+local function require_all(label)
+	local mods = {}
+	local before, after
+
+	collectgarbage()
+	before = bench.heap()
+
+	bench.run("require, " .. label, MODULES, function(n)
+		for m = 1, n do
+			package.loaded["m" .. m] = nil
+			mods[m] = require("m" .. m)
+		end
+	end)
+
+	collectgarbage()
+	after = bench.heap()
+
+	print(string.format("%-32s %8.1f KB heap used by the modules", "", (after - before) / 1024))
+
+	return mods
+end
+
+local function verify(mods, stripped)
+	local t = {}
+
+	for m = 1, MODULES do
+		local mod = mods[m]
+
+		check(mod.name == "m" .. m, "module name")
+
+		for f = 1, FUNCTIONS do
+			local r, s = mod["f" .. f](f)
+			local er, es = expected(m, f, f)
+
+			check(r == er, "result of m" .. m .. ".f" .. f)
+			check(s == es, "string of m" .. m .. ".f" .. f)
+
+			-- Strings in flash are interned: they are the same keys as the
+			-- strings created in RAM
+			t[s] = true
+			check(t[es], "string in flash as a table key")
+			check(mod.shared[string.format("key %d %d", m, f)] == 1, "string in flash as a table key")
+		end
+	end
+
+	-- The modules come from the flash image
+	local loader, data = package.searchers[2]("m1")
+	check(type(loader) == "function" and data == ":flash:", "flash searcher")
+
+	local info = debug.getinfo(mods[1].f1, "SL")
+	check(info.linedefined == 3, "line defined")
+	if stripped then
+		check(next(info.activelines) == nil, "stripped line information")
+	else
+		check(info.activelines[4] and info.activelines[5], "line information")
+	end
+
+	-- Functions in flash can be dumped and loaded back in RAM
+	local f = load(string.dump(mods[2].f3))
+	check(select(2, f(1)) == "value of m2.f3", "string.dump of a function in flash")
+
+	-- Full collections don't touch the objects in flash
+	mods[3] = nil
+	package.loaded.m3 = nil
+	collectgarbage()
+	collectgarbage()
+	check(require("m3").f1(2) == expected(3, 1, 2), "require after a collection")
+
+	local stats = os.stats("flash")
+	check(stats.modules[1] and #stats.modules == MODULES, "modules of the image")
+
+	print(string.format("%-32s %8d protos %8d strings %8.1f / %.1f KB in slot %d", "",
+		stats.protos, stats.strings, stats.size / 1024, stats.slot_size / 1024, stats.slot))
+end
+
+local function build(strip)
+	local size = os.flashlua(files(), strip)
+
+	print(string.format("%-32s %8.1f KB put in flash%s", "", size / 1024, strip and ", stripped" or ""))
+end
+
+package.path = DIR .. "/?.lua"
+
+local n = stage()
+
+if n == 1 then
+	check(os.stats("flash") == nil, "no flash image before the first run")
+
+	os.remove(DIR)
+	os.mkdir(DIR)
+
+	for m = 1, MODULES do
+		local fp = assert(io.open(DIR .. "/m" .. m .. ".lua", "w"))
+		fp:write(source(m))
+		fp:close()
+	end
+
+	local mods = require_all("from files")
+	check(mods[1].f1(1) == expected(1, 1, 1), "module from a file")
+
+	build(false)
+elseif n == 2 then
+	verify(require_all("from flash"), false)
+	build(true)
+else
+	verify(require_all("from flash, stripped"), true)
+end
+
+set_stage(n + 1)
+
+if n == 3 then
+	print("check: OK")
+end
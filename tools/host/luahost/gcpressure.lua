@@ -0,0 +1,65 @@
+-- Lua RTOS, garbage collector under memory pressure for the Linux host build
+--
+-- Run with luahost (see luahost.c) with a heap of 1 MB (-m 1024). Keeps a live
+-- set of about half the heap, and replaces its entries, with and without the
+-- tuning of the garbage collector by the free heap (Lua/common/gcpressure.h).
+-- Reports the time, the emergency collections, and their time, of each one.
+
+local function check(cond, msg)
+	if not cond then error("check failed: " .. msg, 2) end
+end
+
+local SLOTS = 2048
+
+-- Rows of a table, with two strings
+local function churn(n)
+	local live = {}
+
+	for i = 1, n do
+		local slot = i % SLOTS + 1
+		local row = {i, i * 2, tostring(i)}
+
+		row.name = "row " .. i .. string.rep("x", i % 64)
+		live[slot] = row
+	end
+
+	return live
+end
+
+local ITERATIONS = 400000
+
+local function run(enable)
+	local before, after
+
+	bench.gcpressure(enable)
+	collectgarbage()
+
+	before = os.stats("gc")
+	bench.run("churn, tuning " .. (enable and "on" or "off"), ITERATIONS, churn)
+	after = os.stats("gc")
+
+	local r = {
+		emergencies = after.emergencies - before.emergencies,
+		emergency_us = after.emergency_us - before.emergency_us,
+		-- The maximum is since the start
+		emergency_max_us = (after.emergencies > before.emergencies) and after.emergency_max_us or 0,
+		failed = after.failed - before.failed,
+		early = after.early - before.early,
+	}
+
+	print(string.format("%-32s %8d emergency collections %8.2f ms (max %.2f ms) %8d failed %8d early cycles",
+		"", r.emergencies, r.emergency_us / 1000, r.emergency_max_us / 1000, r.failed, r.early))
+
+	return r
+end
+
+local off = run(false)
+local on = run(true)
+
+bench.gcpressure(true)
+
+check(off.failed == 0 and on.failed == 0, "failed allocations")
+check(on.emergencies < off.emergencies, "emergency collections")
+check(on.early > 0, "early cycles")
+
+print("check: OK")
@@ -0,0 +1,433 @@
+/*
+ * Lua RTOS, Lua interpreter for the Linux host build
+ *
+ * Runs Lua scripts with the Lua RTOS core: the Lua VM with the readonly tables
+ * and their indexes, the base, io, os, string, table, math, coroutine, debug,
+ * utf8 and package libraries, and the pack and cjson modules. Files are on
+ * SPIFFS, over the flash emulator, as on the board.
+ *
+ * Each script is run in a new Lua state, as after a reboot of the board, and
+ * gets the Lua modules put in flash by the previous scripts with os.flashlua
+ * (see Lua/common/lflash.h). The exit status is the number of scripts that
+ * failed.
+ *
+ * Usage: luahost [-f flash image] [-i host dir[:path]] [-C dir] [-e chunk] [-m heap KB] script ...
+ *
+ * -f  flash image, loaded at start (if it exists) and saved at exit. Without it
+ *     the flash is in RAM, and is formatted at start.
+ * -i  copies the files of a host directory to path (default /).
+ * -C  changes the current directory before running the scripts.
+ * -e  runs chunk in each state, before the script.
+ * -m  size of the heap, allocations of the Lua states over it fail. Without it
+ *     the heap is not limited, and its size is HOST_HEAP_SIZE.
+ *
+ * Scripts get a bench module, to time and account the heap of the code under
+ * test (see bench.lua):
+ *
+ * bench.run(name, iterations, func): calls func(iterations) after a full
+ *     garbage collection, and reports the time, operations per second, and the
+ *     peak heap used over the heap in use before the call.
+ * bench.heap(): returns the heap in use, and its peak, in bytes.
+ * bench.alloc(name, func): calls func() and records the blocks it allocates,
+ *     then replays them with realloc and with the Lua allocator, and reports the
+ *     time, operations per second, and the peak footprint of each one (see
+ *     alloctrace.c and alloc.lua).
+ * bench.gcpressure(enable): enables or disables the tuning of the garbage
+ *     collector by the free heap (see Lua/common/gcpressure.h and gcpressure.lua).
+ * bench.post(name, value [, count]): posts value count times to the named event
+ *     as an interrupt handler does, with event_post_isr, and returns the number
+ *     of posts deferred to the event task (see Lua/modules/event.h and event.lua).
+ *
+ */
+
+#include "luartos.h"
+
+#include "lua.h"
+#include "lauxlib.h"
+#include "lualib.h"
+#include "lrotable.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/dirent.h>
+#include <sys/stat.h>
+#include <sys/status.h>
+
+#include "esp_vfs.h"
+#include "vfs.h"
+
+#include "alloctrace.h"
+#include "bench.h"
+#include "event.h"
+#include "flash_emu.h"
+#include "gcpressure.h"
+#include "heap.h"
+#include "lflash.h"
+#include "lprof.h"
+
+#define MAX_SCRIPTS 64
+
+// A file or directory copied from the host
+typedef struct host_file {
+	char *path;
+	char *data;
+	long size;   // -1 for directories
+	struct host_file *next;
+} host_file_t;
+
+static host_file_t *files = NULL, **files_last = &files;
+static const char *chunk = NULL;
+
+static void add_file(const char *path, char *data, long size) {
+	host_file_t *file;
+
+	file = calloc(1, sizeof(host_file_t));
+	if (!file || !(file->path = strdup(path))) {
+		fprintf(stderr, "out of memory\n");
+		exit(1);
+	}
+
+	file->data = data;
+	file->size = size;
+
+	*files_last = file;
+	files_last = &file->next;
+}
+
+// Reads the files of the host directory dir, to be written to path
+static void read_dir(const char *dir, const char *path) {
+	char hpath[PATH_MAX], fpath[PATH_MAX];
+	struct dirent *ent;
+	struct stat st;
+	char *data;
+	DIR *d;
+	FILE *fp;
+
+	d = opendir(dir);
+	if (!d) {
+		fprintf(stderr, "%s: %s\n", dir, strerror(errno));
+		exit(1);
+	}
+
+	while ((ent = readdir(d))) {
+		if ((strcmp(ent->d_name, ".") == 0) || (strcmp(ent->d_name, "..") == 0)) continue;
+
+		snprintf(hpath, sizeof(hpath), "%s/%s", dir, ent->d_name);
+		snprintf(fpath, sizeof(fpath), "%s%s%s", path, (path[strlen(path) - 1] == '/')?"":"/", ent->d_name);
+
+		if (stat(hpath, &st) < 0) continue;
+
+		if (S_ISDIR(st.st_mode)) {
+			add_file(fpath, NULL, -1);
+			read_dir(hpath, fpath);
+		} else if (S_ISREG(st.st_mode)) {
+			data = malloc(st.st_size + 1);
+			fp = fopen(hpath, "rb");
+			if (!data || !fp || (fread(data, 1, st.st_size, fp) != st.st_size)) {
+				fprintf(stderr, "%s: can't read\n", hpath);
+				exit(1);
+			}
+			fclose(fp);
+
+			add_file(fpath, data, st.st_size);
+		}
+	}
+
+	closedir(d);
+}
+
+static void write_files() {
+	host_file_t *file, *next;
+	FILE *fp;
+
+	for(file = files;file;file = next) {
+		next = file->next;
+
+		if (file->size < 0) {
+			if ((mkdir(file->path, 0755) < 0) && (errno != EEXIST)) {
+				fprintf(stderr, "mkdir %s: %s\n", file->path, strerror(errno));
+				exit(1);
+			}
+		} else {
+			fp = fopen(file->path, "wb");
+			if (!fp || (fwrite(file->data, 1, file->size, fp) != file->size) || fclose(fp)) {
+				fprintf(stderr, "%s: %s\n", file->path, strerror(errno));
+				exit(1);
+			}
+		}
+
+		free(file->path);
+		free(file->data);
+		free(file);
+	}
+
+	files = NULL;
+	files_last = &files;
+}
+
+static int bench_run(lua_State *L) {
+	const char *name = luaL_checkstring(L, 1);
+	uint32_t iterations = luaL_checkinteger(L, 2);
+	host_heap_stats_t heap;
+	uint64_t t0, t1;
+	size_t base;
+
+	luaL_checktype(L, 3, LUA_TFUNCTION);
+
+	lua_gc(L, LUA_GCCOLLECT, 0);
+
+	host_heap_reset_peak();
+	host_heap_get_stats(&heap);
+	base = heap.used;
+
+	lua_pushvalue(L, 3);
+	lua_pushinteger(L, iterations);
+
+	t0 = bench_now_ns();
+	lua_call(L, 1, 0);
+	t1 = bench_now_ns();
+
+	host_heap_get_stats(&heap);
+
+	printf("%-32s %8u %10.2f ms %12.0f ops/s %8u KB heap\n",
+		name, iterations, (double)(t1 - t0) / 1000000.0,
+		(t1 > t0)?(iterations * 1000000000.0) / (t1 - t0):0.0,
+		(uint32_t)((heap.peak - base + 1023) / 1024)
+	);
+
+	return 0;
+}
+
+static int bench_heap(lua_State *L) {
+	host_heap_stats_t heap;
+
+	host_heap_get_stats(&heap);
+
+	lua_pushinteger(L, heap.used);
+	lua_pushinteger(L, heap.peak);
+
+	return 2;
+}
+
+static int bench_alloc(lua_State *L) {
+	const char *name = luaL_checkstring(L, 1);
+	int status;
+
+	luaL_checktype(L, 2, LUA_TFUNCTION);
+
+	lua_gc(L, LUA_GCCOLLECT, 0);
+	lua_pushvalue(L, 2);
+
+	alloc_trace_start();
+	status = lua_pcall(L, 0, 0, 0);
+	alloc_trace_stop();
+
+	if (status != LUA_OK) {
+		alloc_trace_free();
+		return lua_error(L);
+	}
+
+	alloc_trace_replay(name);
+
+	return 0;
+}
+
+static int bench_gcpressure(lua_State *L) {
+	luaL_checktype(L, 1, LUA_TBOOLEAN);
+
+	gc_pressure_enable(lua_toboolean(L, 1));
+
+	return 0;
+}
+
+static int bench_post(lua_State *L) {
+	const char *name = luaL_checkstring(L, 1);
+	int value = luaL_checkinteger(L, 2);
+	int i, count = luaL_optinteger(L, 3, 1);
+	event_t *event;
+	int posted = 0;
+
+	event = event_create(name);
+	if (!event) {
+		return luaL_error(L, "can't create the event");
+	}
+
+	for(i = 0;i < count;i++) {
+		posted += event_post_isr(event, value);
+	}
+
+	event_unref(event);
+
+	lua_pushinteger(L, posted);
+	return 1;
+}
+
+static const luaL_Reg bench_funcs[] = {
+	{"run", bench_run},
+	{"heap", bench_heap},
+	{"alloc", bench_alloc},
+	{"gcpressure", bench_gcpressure},
+	{"post", bench_post},
+	{NULL, NULL}
+};
+
+static int luaopen_bench(lua_State *L) {
+	luaL_newlib(L, bench_funcs);
+
+	return 1;
+}
+
+static int traceback(lua_State *L) {
+	const char *msg = lua_tostring(L, 1);
+
+	if (!msg) {
+		msg = lua_pushfstring(L, "(error object is a %s value)", luaL_typename(L, 1));
+	}
+
+	luaL_traceback(L, L, msg, 1);
+
+	return 1;
+}
+
+// As luaos_pmain, without the boot scripts and the REPL
+static int pmain(lua_State *L) {
+	const char *script = lua_touserdata(L, 1);
+
+	luaL_openlibs(L);
+	luaL_requiref(L, "bench", luaopen_bench, 1);
+	lua_pop(L, 1);
+
+	lua_createtable(L, 1, 0);
+	lua_pushstring(L, script);
+	lua_rawseti(L, -2, 0);
+	lua_setglobal(L, "arg");
+
+	lua_pushcfunction(L, traceback);
+
+	if (chunk) {
+		if (luaL_loadstring(L, chunk) || lua_pcall(L, 0, 0, -2)) {
+			return lua_error(L);
+		}
+	}
+
+	if (luaL_loadfile(L, script) || lua_pcall(L, 0, 0, -2)) {
+		return lua_error(L);
+	}
+
+	return 0;
+}
+
+static int run(const char *script) {
+	lua_rtos_tcb_t *tcb;
+	lua_State *L;
+	int status;
+
+#if CONFIG_LUA_RTOS_LUA_USE_FLASH_MODULES
+	// The flash image built by the previous scripts with os.flashlua, as after a reboot
+	lflash_init();
+#endif
+
+	L = lua_newstate(host_heap_alloc, NULL);
+	if (!L) {
+		fprintf(stderr, "%s: cannot create state: not enough memory\n", script);
+		return 1;
+	}
+
+	// The Lua state of the task, as the Lua RTOS FreeRTOS adds keep it
+	tcb = pvTaskGetThreadLocalStoragePointer(NULL, THREAD_LOCAL_STORAGE_POINTER_ID);
+	if (!tcb) {
+		tcb = calloc(1, sizeof(lua_rtos_tcb_t));
+		vTaskSetThreadLocalStoragePointer(NULL, THREAD_LOCAL_STORAGE_POINTER_ID, tcb);
+	}
+	uxSetLuaState(L);
+
+	lua_pushcfunction(L, pmain);
+	lua_pushlightuserdata(L, (void *)script);
+	status = lua_pcall(L, 1, 0, 0);
+	if (status != LUA_OK) {
+		fflush(stdout);
+		fprintf(stderr, "%s: %s\n", script, lua_tostring(L, -1));
+	}
+
+#if CONFIG_LUA_RTOS_LUA_USE_PROFILER
+	// The board doesn't close the main state, a script can end while it's profiled
+	lprof_stop();
+	lprof_detach(L);
+#endif
+
+	lua_close(L);
+	uxSetLuaState(NULL);
+
+	return status != LUA_OK;
+}
+
+static void usage() {
+	fprintf(stderr, "usage: luahost [-f flash image] [-i host dir[:path]] [-C dir] [-e chunk] [-m heap KB] script ...\n");
+	exit(1);
+}
+
+int main(int argc, char *argv[]) {
+	const char *image = NULL, *cwd = NULL;
+	char *path;
+	int opt, fails = 0;
+
+	while ((opt = getopt(argc, argv, "f:i:C:e:m:")) != -1) {
+		switch (opt) {
+			case 'm': host_heap_set_size(atoi(optarg) * 1024); break;
+			case 'f': image = optarg; break;
+			case 'C': cwd = optarg; break;
+			case 'e': chunk = optarg; break;
+			case 'i':
+				path = strchr(optarg, ':');
+				if (path) *path++ = '\0';
+				if (!path || !*path) path = "/";
+				if (strcmp(path, "/") != 0) add_file(path, NULL, -1);
+				read_dir(optarg, path);
+				break;
+			default:
+				usage();
+		}
+	}
+
+	if (optind >= argc) {
+		usage();
+	}
+
+	if (flash_emu_init(SPIFFS_BASE_ADDR, SPIFFS_SIZE, (image && (access(image, F_OK) == 0))?image:NULL) < 0) {
+		fprintf(stderr, "can't create flash emulator\n");
+		return 1;
+	}
+
+	vfs_spiffs_register();
+	write_files();
+
+	if (cwd && (chdir(cwd) < 0)) {
+		fprintf(stderr, "%s: %s\n", cwd, strerror(errno));
+		return 1;
+	}
+
+#if LUA_USE_ROTABLE && CONFIG_LUA_RTOS_LUA_USE_ROTABLE_INDEX
+	luaR_hindex_init();
+#endif
+
+	status_set(STATUS_LUA_RUNNING);
+
+	for(;optind < argc;optind++) {
+		fails += run(argv[optind]);
+	}
+
+	// The image is a host file
+	esp_vfs_unregister("/spiffs");
+
+	if (image) {
+		flash_emu_save(image);
+	}
+
+	flash_emu_deinit();
+
+	return fails;
+}
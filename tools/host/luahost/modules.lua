@@ -0,0 +1,195 @@
+-- Lua RTOS, module index and bytecode cache for the Linux host build
+--
+-- Run with luahost (see luahost.c) twice, in the same luahost process, as
+-- after a reboot each one (see Lua/common/lmodcache.h):
+--
+-- 1. generates the modules, in the 5th template of package.path, on a SPIFFS
+--    with other files, and requires them without index and bytecode cache
+-- 2. requires them with the index and bytecode cache, then checks that
+--    changed, moved and removed modules are found and compiled again, and
+--    that a module in a relative template overrides the indexed one
+--
+-- Each run also times the requires as they were done before: looking for the
+-- file in each template of package.path, and compiling its source.
+
+local function check(cond, msg)
+	if not cond then error("check failed: " .. msg, 2) end
+end
+
+local DIR = "/app"
+local MODULES = 16
+local FUNCTIONS = 16
+local OTHER_FILES = 64
+
+package.path = "/lib/share/lua/?.lua;/lib/share/lua/?/init.lua;/lib/lua/?.lua;/lib/lua/?/init.lua;" ..
+	DIR .. "/?.lua;" .. DIR .. "/?/init.lua"
+
+local function source(m, v)
+	local s = {"local M = {}\n"}
+
+	for f = 1, FUNCTIONS do
+		s[#s + 1] = string.format([[
+function M.f%d(x)
+	local t = {x, x * 2, name = "m%d.f%d"}
+	for i = 1, #t do
+		x = x + t[i]
+	end
+	return x + %d
+end
+]], f, m, f, f)
+	end
+
+	s[#s + 1] = string.format("M.version = %d\nreturn M\n", v)
+
+	return table.concat(s)
+end
+
+local function write(file, s)
+	local fp = assert(io.open(file, "w"))
+	fp:write(s)
+	fp:close()
+end
+
+local function stats()
+	return os.stats("modules")
+end
+
+local function delta(before)
+	local after = stats()
+	local r = {}
+
+	for k, v in pairs(after) do
+		r[k] = v - before[k]
+	end
+
+	return r
+end
+
+-- Requires the modules as before the index and the bytecode cache
+local function require_uncached(label)
+	bench.run("require, " .. label, MODULES, function(n)
+		for m = 1, n do
+			local file = assert(package.searchpath("m" .. m, package.path))
+			assert(loadfile(file))("m" .. m, file)
+		end
+	end)
+end
+
+local function require_all(label)
+	local mods = {}
+	local before = stats()
+
+	bench.run("require, " .. label, MODULES, function(n)
+		for m = 1, n do
+			package.loaded["m" .. m] = nil
+			mods[m] = require("m" .. m)
+		end
+	end)
+
+	local d = delta(before)
+
+	print(string.format("%-32s %8d indexed %8d looked up %8d from bytecode cache %8d compiled", "",
+		d.index_hits, d.index_misses, d.cache_hits, d.compiles))
+
+	return mods, d
+end
+
+local function first_boot()
+	os.remove("/.modules")
+	os.mkdir(DIR)
+
+	for i = 1, OTHER_FILES do
+		write("/other" .. i .. ".txt", string.rep("x", 100 + i))
+	end
+
+	for m = 1, MODULES do
+		write(DIR .. "/m" .. m .. ".lua", source(m, 1))
+		os.remove(DIR .. "/m" .. m .. ".luac")
+	end
+
+	require_uncached("lookup and compile")
+
+	local mods, d = require_all("first boot")
+	check(d.index_misses == MODULES and d.compiles == MODULES, "first boot looks up and compiles the modules")
+	check(mods[1].f1(1) == 5, "module result")
+
+	for m = 1, MODULES do
+		local fp = io.open(DIR .. "/m" .. m .. ".luac")
+		check(fp, "bytecode cache of m" .. m)
+		fp:close()
+	end
+
+	write(DIR .. "/stage", "2")
+end
+
+local function next_boot()
+	require_uncached("lookup and compile")
+
+	local mods, d = require_all("next boot")
+	check(d.index_hits == MODULES and d.cache_hits == MODULES and d.compiles == 0,
+		"next boot uses the index and the bytecode cache")
+
+	for m = 1, MODULES do
+		check(mods[m].version == 1, "version of m" .. m)
+		check(mods[m]["f" .. FUNCTIONS](1) == 4 + FUNCTIONS, "result of m" .. m)
+	end
+
+	-- Debug information refers to the source
+	local info = debug.getinfo(mods[1].f1, "S")
+	check(info.source == "@" .. DIR .. "/m1.lua" and info.linedefined == 2, "source of the cached module")
+
+	-- A changed source is compiled again
+	write(DIR .. "/m2.lua", source(2, 2) .. "-- changed\n")
+	package.loaded.m2 = nil
+	local before = stats()
+	check(require("m2").version == 2, "changed module")
+	check(delta(before).compiles == 1, "changed module is compiled")
+
+	-- Also if it has the same size and time, as after a reboot without a clock set
+	write(DIR .. "/m5.lua", source(5, 5))
+	package.loaded.m5 = nil
+	before = stats()
+	check(require("m5").version == 5, "changed module with the same size")
+	check(delta(before).compiles == 1, "changed module with the same size is compiled")
+
+	-- A removed module is looked up again, and found in other template
+	os.remove(DIR .. "/m3.lua")
+	os.remove(DIR .. "/m3.luac")
+	os.mkdir("/lib")
+	os.mkdir("/lib/lua")
+	write("/lib/lua/m3.lua", source(3, 3))
+	package.loaded.m3 = nil
+	check(require("m3").version == 3, "moved module")
+
+	-- And a module that's not anywhere is not found
+	os.remove("/lib/lua/m3.lua")
+	package.loaded.m3 = nil
+	check(not pcall(require, "m3"), "removed module")
+
+	-- The index is for package.path
+	package.path = DIR .. "/?.lua"
+	package.loaded.m4 = nil
+	before = stats()
+	check(require("m4").version == 1, "module with other path")
+	check(delta(before).index_misses == 1, "index of other path")
+
+	-- A module placed in a relative template overrides the indexed one
+	package.path = "./?.lua;" .. DIR .. "/?.lua"
+	package.loaded.m6 = nil
+	check(require("m6").version == 1, "indexed module")
+	write("./m6.lua", source(6, 6))
+	package.loaded.m6 = nil
+	check(require("m6").version == 6, "module of a relative template")
+	os.remove("./m6.lua")
+	os.remove("./m6.luac")
+end
+
+local fp = io.open(DIR .. "/stage", "r")
+
+if not fp then
+	first_boot()
+else
+	fp:close()
+	next_boot()
+	print("check: OK")
+end
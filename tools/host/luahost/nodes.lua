@@ -0,0 +1,192 @@
+-- Lua RTOS, nodes of the Lua tables for the Linux host build
+--
+-- Run with the interpreter with the table nodes of Lua 5.3, and with the
+-- compact ones (LUA_USE_COMPACT_NODES, see Lua/src/lobject.h). Reports the heap
+-- used by each node of the hash part of a table, and the time of inserts,
+-- lookups and traversals of tables with string, integer and float keys, and
+-- collections of many small tables. Then checks keys of every type, next,
+-- dead keys and weak tables.
+
+local function check(cond, msg)
+	if not cond then error("check failed: " .. msg, 2) end
+end
+
+local SIZE = 1 << 14
+local ROUNDS = 20
+
+-- Keys, created before the tables, so their heap is not counted
+local strs, ints, floats = {}, {}, {}
+
+for i = 1, SIZE do
+	strs[i] = "key" .. i
+	ints[i] = -i
+	floats[i] = i + 0.5
+end
+
+-- Heap used by each node
+local function fill(keys)
+	local t = {}
+	for i = 1, #keys do
+		t[keys[i]] = i
+	end
+	return t
+end
+
+collectgarbage()
+local heap = bench.heap()
+local t = fill(strs)
+collectgarbage()
+
+print(string.format("%-32s %8.1f bytes per node", "hash part of a table",
+	(bench.heap() - heap) / SIZE))
+
+t = nil
+
+-- Inserts, lookups and traversals
+bench.run("inserts, string keys", ROUNDS * SIZE, function(n)
+	for r = 1, n // SIZE do fill(strs) end
+end)
+
+bench.run("inserts, integer keys", ROUNDS * SIZE, function(n)
+	for r = 1, n // SIZE do fill(ints) end
+end)
+
+bench.run("inserts, float keys", ROUNDS * SIZE, function(n)
+	for r = 1, n // SIZE do fill(floats) end
+end)
+
+local ts, ti, tf = fill(strs), fill(ints), fill(floats)
+
+bench.run("lookups, string keys", ROUNDS * SIZE, function(n)
+	for r = 1, n // SIZE do
+		local sum = 0
+		for i = 1, SIZE do sum = sum + ts[strs[i]] end
+		check(sum == SIZE * (SIZE + 1) // 2, "lookups of string keys")
+	end
+end)
+
+bench.run("lookups, integer keys", ROUNDS * SIZE, function(n)
+	for r = 1, n // SIZE do
+		local sum = 0
+		for i = 1, SIZE do sum = sum + ti[ints[i]] end
+		check(sum == SIZE * (SIZE + 1) // 2, "lookups of integer keys")
+	end
+end)
+
+bench.run("lookups, float keys", ROUNDS * SIZE, function(n)
+	for r = 1, n // SIZE do
+		local sum = 0
+		for i = 1, SIZE do sum = sum + tf[floats[i]] end
+		check(sum == SIZE * (SIZE + 1) // 2, "lookups of float keys")
+	end
+end)
+
+bench.run("traversals", ROUNDS * SIZE, function(n)
+	for r = 1, n // SIZE do
+		local count = 0
+		for k, v in pairs(ts) do
+			check(strs[v] == k, "key of a value")
+			count = count + 1
+		end
+		check(count == SIZE, "keys traversed")
+	end
+end)
+
+-- Collections of many small tables, the objects of a program
+local objs = {}
+
+for i = 1, SIZE do
+	objs[i] = {id = i, name = strs[i], x = i * 0.5, y = -i, visible = true}
+end
+
+bench.run("collections, small tables", ROUNDS, function(n)
+	for r = 1, n do collectgarbage() end
+end)
+
+objs = nil
+
+-- Keys of every type
+local f = function() end
+local co = coroutine.create(f)
+local keys = {"str", 1, -1, math.maxinteger, 0.5, 2^40, true, false, f, co, {}, math.huge, -math.huge}
+
+t = {}
+for i, k in ipairs(keys) do t[k] = i end
+for i, k in ipairs(keys) do check(t[k] == i, "key " .. tostring(k)) end
+
+t[1.0] = "one"
+check(t[1] == "one" and math.type(next({[3.0] = 1})) == "integer", "float keys with integral values")
+check(not pcall(function() t[0 / 0] = 1 end) and not pcall(function() t[nil] = 1 end), "NaN and nil keys")
+
+-- next, while the keys are removed
+t = fill(strs)
+local count = 0
+
+for k in pairs(t) do
+	t[k] = nil
+	count = count + 1
+end
+
+check(count == SIZE and next(t) == nil, "next, while removing keys")
+
+-- Dead keys: the keys of removed entries are collected, and next goes on
+t = {}
+for i = 1, 100 do t[{}] = i end
+for i = 1, 100 do t["k" .. i] = i end
+
+for key in pairs(t) do if type(key) == "table" then t[key] = nil end end
+collectgarbage()
+
+count = 0
+for key, v in pairs(t) do
+	check(type(key) == "string" and t[key] == v, "key after a collection")
+	count = count + 1
+end
+
+check(count == 100, "keys after a collection")
+
+-- Weak tables
+local weak_keys = setmetatable({}, {__mode = "k"})
+local weak_values = setmetatable({}, {__mode = "v"})
+local kept = {}
+
+for i = 1, 100 do
+	local o = {}
+	weak_keys[o] = i
+	weak_values[i] = o
+	weak_values["s" .. i] = "s" .. i
+	if i % 2 == 0 then kept[#kept + 1] = o end
+end
+
+collectgarbage()
+
+count = 0
+for key, v in pairs(weak_keys) do
+	check(type(key) == "table" and v % 2 == 0, "weak key kept")
+	count = count + 1
+end
+
+check(count == 50, "weak keys collected")
+
+count = 0
+for key, v in pairs(weak_values) do
+	check(type(v) == "string" or key % 2 == 0, "weak value kept")
+	count = count + 1
+end
+
+check(count == 150, "weak values collected")
+
+-- Ephemerons: a value that refers to its key doesn't keep it
+local eph = setmetatable({}, {__mode = "k"})
+
+for i = 1, 100 do
+	local o = {}
+	eph[o] = {o}
+end
+
+eph[kept[1]] = {kept[1]}
+collectgarbage()
+
+check(next(eph) == kept[1] and next(eph, kept[1]) == nil, "ephemerons collected")
+
+print("check: OK")
@@ -0,0 +1,165 @@
+-- Lua RTOS, sampling profiler for the Linux host build
+--
+-- Profiles a workload of the main thread, with a function that takes twice
+-- the time of other, and a C function, while an isolated thread runs other
+-- one (see Lua/common/lprof.h). Reports the time of the workload without and
+-- with the profiler, and the stacks that have more samples, and checks the
+-- collapsed stacks written by os.profile("dump"). Then checks that the time
+-- waited in a C function is counted, and that a thread with a hook is sampled.
+
+local function check(cond, msg)
+	if not cond then error("check failed: " .. msg, 2) end
+end
+
+local RATE = 1000
+local ROUNDS = 200
+
+local function spin(n)
+	local x = 0
+	for i = 1, n do
+		x = x + (i % 7) * 3
+	end
+	return x
+end
+
+-- Not tail calls, to have their frames in the stacks
+local function hot(n)
+	local x = spin(2 * n)
+	return x
+end
+
+local function warm(n)
+	local x = spin(n)
+	return x
+end
+
+local function sorting(n)
+	local t = {}
+	for i = 1, n do
+		t[i] = (i * 7919) % n
+	end
+	table.sort(t)
+	return t[1]
+end
+
+local function workload()
+	for i = 1, ROUNDS do
+		hot(20000)
+		warm(20000)
+		sorting(2000)
+	end
+end
+
+local function timed(label)
+	local t0 = os.clock()
+	workload()
+	local t = os.clock() - t0
+
+	print(string.format("%-32s %8.2f ms", label, t * 1000))
+
+	return t
+end
+
+-- Other thread, that spins until it's stopped
+local ready, stop, done = thread.channel(), thread.channel(), thread.channel()
+
+thread.spawn(function()
+	local function other(n)
+		local x = 0
+		for i = 1, n do x = x + i end
+		return x
+	end
+
+	ready:send(1)
+	while #stop == 0 do
+		other(10000)
+	end
+	done:send(1)
+end)
+
+ready:receive()
+
+local base = timed("workload")
+
+os.profile("start", RATE)
+local profiled = timed("workload, profiled at " .. RATE .. " Hz")
+os.profile("stop")
+
+stop:send(1)
+done:receive()
+
+local stats = os.stats("profile")
+check(not stats.running and stats.rate == RATE, "profiler stats")
+
+print(string.format("%-32s %8.1f %% overhead %8d samples %8d stacks %8d frames %8d dropped", "",
+	(profiled - base) * 100 / base, stats.samples, stats.stacks, stats.frames, stats.dropped))
+
+-- Collapsed stacks
+check(os.profile("dump", "/profile.txt") == stats.stacks, "stacks dumped")
+
+local stacks, total = {}, 0
+local by_frame = {}
+
+for line in io.lines("/profile.txt") do
+	local frames, count = line:match("^(.+) (%d+)$")
+	check(frames, "collapsed stack line " .. line)
+
+	count = tonumber(count)
+	total = total + count
+	stacks[#stacks + 1] = {frames = frames, count = count}
+
+	-- Samples of each function, in any frame of the stack
+	local seen = {}
+	for frame in frames:gmatch("[^;]+") do
+		local name = frame:match("^([^@ ]+)")
+		if not seen[name] then
+			by_frame[name] = (by_frame[name] or 0) + count
+			seen[name] = true
+		end
+	end
+end
+
+check(total == stats.samples, "samples of the stacks")
+
+table.sort(stacks, function(a, b) return a.count > b.count end)
+for i = 1, math.min(5, #stacks) do
+	print(string.format("%8d %s", stacks[i].count, stacks[i].frames))
+end
+
+check(by_frame.main and by_frame["thread"], "stacks of the main thread and the other thread")
+check(by_frame.hot and by_frame.warm and by_frame.hot > by_frame.warm, "hot function has more samples")
+check(by_frame.sort, "samples of a C function")
+check(by_frame.other, "samples of the other thread")
+
+-- The periods that a thread waits in a C function are counted in one sample
+local function count(name)
+	local n = 0
+
+	os.profile("dump", "/profile.txt")
+	for line in io.lines("/profile.txt") do
+		local frames, samples = line:match("^(.+) (%d+)$")
+		if frames:find(name, 1, true) then n = n + tonumber(samples) end
+	end
+
+	return n
+end
+
+os.profile("start", RATE)
+check(done:receive(200) == nil, "empty channel")
+os.profile("stop")
+
+local waited = count("receive [C]")
+print(string.format("%-32s %8d samples", "waiting 200 ms in C", waited))
+check(waited >= 100, "samples of the time waited in a C function")
+
+-- A thread with a hook is sampled, and the hook still runs
+local hooks = 0
+debug.sethook(function() hooks = hooks + 1 end, "", 1000)
+os.profile("start", RATE)
+warm(2000000)
+os.profile("stop")
+debug.sethook()
+
+check(hooks > 0 and count("warm@") > 0, "thread with a hook sampled")
+
+print("check: OK")
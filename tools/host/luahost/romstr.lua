@@ -0,0 +1,104 @@
+-- Lua RTOS, Lua strings in ROM for the Linux host build
+--
+-- Run with the interpreter without and with the Lua strings in ROM (see
+-- Lua/common/lromstr.h). Reports the heap in use and the strings in RAM of a
+-- new Lua state, the time of the first lookup of every field of the readonly
+-- tables of the modules, that creates its key, and the heap used by their
+-- keys. Then checks that the strings in ROM are the ones created by Lua.
+
+local function check(cond, msg)
+	if not cond then error("check failed: " .. msg, 2) end
+end
+
+local ROUNDS = 200
+
+-- Baseline of a new Lua state, after a full collection
+local strings = os.stats("strings")
+local heap = bench.heap()
+local rom = strings.rom ~= nil
+
+print(string.format("%-32s %8.1f KB heap %8d strings in RAM %8d in ROM (%.1f KB)",
+	rom and "new state, ROM strings" or "new state", heap / 1024, strings.ram,
+	strings.rom or 0, (strings.rom_size or 0) / 1024))
+
+-- Fields of the readonly tables, with their keys reversed, so the keys are
+-- created by each lookup
+local fields = {}
+
+for name, mod in pairs(_G) do
+	if type(mod) == "rotable" then
+		for k in pairs(mod) do
+			if type(k) == "string" then
+				fields[#fields + 1] = {mod, k:reverse()}
+			end
+		end
+	end
+end
+
+check(#fields > 100, "fields of the modules")
+
+-- Each round creates the keys, and a collection frees them
+bench.run("first lookups", ROUNDS * #fields, function(n)
+	for r = 1, n // #fields do
+		for i = 1, #fields do
+			local f = fields[i]
+			local v = f[1][f[2]:reverse()]
+		end
+		collectgarbage()
+	end
+end)
+
+-- Heap used by the keys
+local keys = {}
+
+collectgarbage()
+heap = bench.heap()
+strings = os.stats("strings")
+
+for i = 1, #fields do
+	keys[i] = fields[i][2]:reverse()
+end
+
+collectgarbage()
+
+local after = os.stats("strings")
+
+print(string.format("%-32s %8.1f KB heap used by %d keys %8d strings in RAM", "",
+	(bench.heap() - heap) / 1024, #keys, after.ram - strings.ram))
+
+-- The keys created are found in the readonly tables, and in the tables
+local t = {}
+
+for i = 1, #fields do
+	check(fields[i][1][keys[i]] ~= nil, "lookup of " .. keys[i])
+	t[keys[i]] = i
+end
+
+for i = 1, #fields do
+	local k = fields[i][2]:reverse()
+	check(keys[t[k]] == k, "table key " .. k)
+end
+
+-- Reserved words and metamethod names
+check(load("local function f() return nil end while false do end return f() == nil")(), "reserved words")
+check(load("return " .. ("wh" .. "ile")) == nil, "reserved word created at run time")
+
+local mt = {}
+mt["__ind" .. "ex"] = function(_, k) return k end
+check(setmetatable({}, mt).x == "x", "metamethod name created at run time")
+
+-- The strings of an isolated thread are the same
+local ch = thread.channel()
+
+thread.spawn(function()
+	ch:send(("ins" .. "ert"))
+end)
+
+check(table[ch:receive()] == table.insert, "string of an isolated thread")
+
+if rom then
+	check(after.ram == strings.ram, "keys in ROM")
+	check(after.rom_hits > strings.rom_hits, "ROM strings looked up")
+end
+
+print("check: OK")
@@ -0,0 +1,165 @@
+-- Lua RTOS, Lua VM dispatch for the Linux host build and the board
+--
+-- Workloads of the control loops run by the boards: a PID loop over a table
+-- of channels, reads of fields of tables and modules, calls of small functions
+-- and closures, string formatting, and recursive calls. Each one is timed with
+-- os.clock, so the script also runs on the board, and the results are checked.
+--
+-- make bench runs it with luahost, built with the switch dispatch of the Lua VM,
+-- with luahost_threaded, built with the threaded code dispatch, and with
+-- luahost_opprof, built with the opcode profile (os.stats("vm")), that reports
+-- the opcodes that take most of the time of each workload.
+
+local function check(cond, msg)
+	if not cond then error("check failed: " .. msg, 2) end
+end
+
+local scale = tonumber((...)) or 1
+
+-- PID controllers, over a table of channels
+local function pid(n)
+	local ch = {}
+
+	for c = 1, 8 do
+		ch[c] = {kp = 1.2, ki = 0.05, kd = 0.01, setpoint = c * 10, value = 0, integral = 0, last = 0}
+	end
+
+	for i = 1, n do
+		for c = 1, #ch do
+			local s = ch[c]
+			local err = s.setpoint - s.value
+			local out
+
+			s.integral = s.integral + err
+			if s.integral > 1000 then s.integral = 1000 elseif s.integral < -1000 then s.integral = -1000 end
+
+			out = s.kp * err + s.ki * s.integral + s.kd * (err - s.last)
+			s.last = err
+			s.value = s.value + out * 0.1
+		end
+	end
+
+	return ch[8].value
+end
+
+-- Field reads of tables and of readonly tables (modules)
+local function fields(n)
+	local t = {a = 1, b = 2, c = 3, d = 4}
+	local sum, f = 0
+
+	for i = 1, n do
+		sum = sum + t.a + t.b + t.c + t.d + math.pi // 1
+		f = string.format
+	end
+
+	return f and sum
+end
+
+-- Calls of small functions and closures, with upvalues
+local function calls(n)
+	local count = 0
+	local function inc(x) count = count + x; return count end
+	local function clamp(x, lo, hi) if x < lo then return lo elseif x > hi then return hi end return x end
+
+	for i = 1, n do
+		inc(clamp(i % 7, 1, 5))
+	end
+
+	return count
+end
+
+-- Integer and bitwise arithmetic, as the drivers do with registers
+local function bits(n)
+	local crc = 0xffff
+
+	for i = 1, n do
+		crc = crc ~ (i & 0xff)
+		for b = 1, 8 do
+			if crc & 1 ~= 0 then crc = (crc >> 1) ~ 0xa001 else crc = crc >> 1 end
+		end
+	end
+
+	return crc
+end
+
+-- String formatting and concatenation, as the loggers do
+local function strings(n)
+	local len = 0
+
+	for i = 1, n do
+		local s = "ch" .. (i % 8) .. "=" .. string.format("%.2f", i / 3)
+		len = len + #s
+	end
+
+	return len
+end
+
+local function fib(n)
+	if n < 2 then return n end
+	return fib(n - 1) + fib(n - 2)
+end
+
+local workloads = {
+	{"pid",     20000 * scale,  pid},
+	{"fields",  200000 * scale, fields},
+	{"calls",   400000 * scale, calls},
+	{"bits",    100000 * scale, bits},
+	{"strings", 40000 * scale,  strings},
+	{"fib",     27,             fib},
+}
+
+local profile = os.stats("vm")
+local total = 0
+local results = {}
+
+for _, w in ipairs(workloads) do
+	local name, n, f = w[1], w[2], w[3]
+
+	collectgarbage()
+	if profile then os.stats("vm", true) end
+
+	local t0 = os.clock()
+	results[name] = f(n)
+	local t = os.clock() - t0
+
+	total = total + t
+
+	print(string.format("%-32s %8d %10.2f ms %12.0f ops/s", name, n, t * 1000, t > 0 and n / t or 0))
+
+	-- The opcodes that take most of the time
+	if profile then
+		local ops = {}
+		local cycles = 0
+
+		for op, p in pairs(os.stats("vm")) do
+			ops[#ops + 1] = {op = op, count = p.count, cycles = p.cycles}
+			cycles = cycles + p.cycles
+		end
+
+		table.sort(ops, function(a, b) return a.cycles > b.cycles end)
+
+		for i = 1, math.min(5, #ops) do
+			print(string.format("%-32s %-10s %10d %6.1f %%", "", ops[i].op, ops[i].count,
+				cycles > 0 and ops[i].cycles * 100 / cycles or 0))
+		end
+	end
+end
+
+print(string.format("%-32s %8s %10.2f ms", "total", "", total * 1000))
+
+-- Results
+local count = 0
+for i = 1, 400000 * scale do
+	local x = i % 7
+	if x < 1 then x = 1 elseif x > 5 then x = 5 end
+	count = count + x
+end
+
+check(results.calls == count, "calls")
+check(results.fib == 196418, "fib")
+check(math.abs(results.pid - 80) < 1, "pid")
+check(results.fields == 200000 * scale * 13, "fields")
+check(results.bits >= 0 and results.bits <= 0xffff, "bits")
+check(results.strings > 0, "strings")
+
+print("check: OK")
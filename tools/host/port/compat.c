@@ -0,0 +1,42 @@
+/*
+ * Lua RTOS, newlib compatibility for the Linux host build
+ *
+ */
+
+#include "host_compat.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#if HOST_NEED_STRLCPY
+
+size_t strlcpy(char *dst, const char *src, size_t size) {
+	size_t len = strlen(src);
+
+	if (size) {
+		size_t n = (len >= size)?size - 1:len;
+
+		memcpy(dst, src, n);
+		dst[n] = '\0';
+	}
+
+	return len;
+}
+
+size_t strlcat(char *dst, const char *src, size_t size) {
+	size_t dlen = strnlen(dst, size);
+
+	if (dlen == size) {
+		return size + strlen(src);
+	}
+
+	return dlen + strlcpy(dst + dlen, src, size - dlen);
+}
+
+#endif
+
+// See sys/panic.c, abort instead of hang
+void panic(char *str) {
+	fprintf(stderr, "%s\n", str);
+	abort();
+}
@@ -0,0 +1,39 @@
+/*
+ * Lua RTOS, cpu driver and delays for the Linux host build
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <drivers/cpu.h>
+#include <sys/delay.h>
+
+void cpu_model(char *buffer) {
+	strcpy(buffer, "host");
+}
+
+int cpu_revission() {
+	return 0;
+}
+
+void cpu_sleep(int seconds) {
+	sleep(seconds);
+}
+
+int cpu_reset_reasons(char *buf) {
+	if (buf) {
+		sprintf(buf, "Vbat power on reset");
+	}
+
+	return 1;
+}
+
+void delay(unsigned int msec) {
+	usleep(msec * 1000);
+}
+
+void udelay(unsigned int usec) {
+	usleep(usec);
+}
@@ -0,0 +1,81 @@
+/*
+ * Lua RTOS, vfs registry for the Linux host build
+ *
+ */
+
+#include <string.h>
+
+#include "esp_vfs.h"
+
+#define HOST_VFS_MAX 8
+
+static struct {
+	const char *base;
+	esp_vfs_t vfs;
+} vfs_table[HOST_VFS_MAX];
+
+esp_err_t esp_vfs_register(const char* base_path, const esp_vfs_t* vfs, void* ctx) {
+	int i;
+
+	for(i = 0;i < HOST_VFS_MAX;i++) {
+		if (!vfs_table[i].base) {
+			vfs_table[i].base = base_path;
+			memcpy(&vfs_table[i].vfs, vfs, sizeof(esp_vfs_t));
+			return ESP_OK;
+		}
+	}
+
+	return ESP_ERR_NO_MEM;
+}
+
+esp_err_t esp_vfs_unregister(const char* base_path) {
+	int i;
+
+	for(i = 0;i < HOST_VFS_MAX;i++) {
+		if (vfs_table[i].base && (strcmp(vfs_table[i].base, base_path) == 0)) {
+			vfs_table[i].base = NULL;
+			return ESP_OK;
+		}
+	}
+
+	return ESP_ERR_INVALID_STATE;
+}
+
+const esp_vfs_t *esp_vfs_host_get(const char *base_path) {
+	int i;
+
+	for(i = 0;i < HOST_VFS_MAX;i++) {
+		if (vfs_table[i].base && (strcmp(vfs_table[i].base, base_path) == 0)) {
+			return &vfs_table[i].vfs;
+		}
+	}
+
+	return NULL;
+}
+
+int esp_vfs_host_find(const char *path, const char **rpath) {
+	size_t len;
+	int i;
+
+	// As in the esp-idf, the path must be longer than the base path, and
+	// continue with a '/'
+	for(i = 0;i < HOST_VFS_MAX;i++) {
+		if (vfs_table[i].base) {
+			len = strlen(vfs_table[i].base);
+			if ((strncmp(vfs_table[i].base, path, len) == 0) && (path[len] == '/')) {
+				*rpath = path + len;
+				return i;
+			}
+		}
+	}
+
+	return -1;
+}
+
+const esp_vfs_t *esp_vfs_host_vfs(int index) {
+	if ((index < 0) || (index >= HOST_VFS_MAX) || !vfs_table[index].base) {
+		return NULL;
+	}
+
+	return &vfs_table[index].vfs;
+}
@@ -0,0 +1,222 @@
+/*
+ * Lua RTOS, SPI display emulator for the Linux host build
+ *
+ * Provides the part of the drivers/espi.h API used by the tft module
+ * (Lua/modules/screen/tftspi.c), over an emulated display memory. Column and
+ * row address commands set the address window, and pixels written after a
+ * RAMWR command go to the window, row by row, as on an ILI9341 or ST7735
+ * display. RAMRD returns the window pixels as RGB666, after a dummy byte.
+ *
+ * SPI operations are counted, so that benchmarks can report the number of
+ * address windows and SPI transfers needed to draw something.
+ *
+ */
+
+#include "espi_panel.h"
+
+#include "drivers/espi.h"
+#include "screen/tftspi.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct spi_device_t {
+	int id;
+};
+
+static struct spi_device_t devices[2];
+static int ndevices = 0;
+
+uint16_t panel_mem[PANEL_MAX_SIZE * PANEL_MAX_SIZE];
+
+static panel_stats_t stats;
+static uint8_t cmd;           // last command
+static int wx1, wy1, wx2, wy2; // address window
+static int px, py;            // write / read position in the window
+
+//-----------------------------------------------------
+static void panel_window(int x1, int x2, int y1, int y2) {
+	wx1 = x1;
+	wx2 = x2;
+	wy1 = y1;
+	wy2 = y2;
+	px = x1;
+	py = y1;
+	stats.windows++;
+}
+
+//----------------------------------------
+static uint16_t *panel_next(void) {
+	uint16_t *p;
+
+	if ((py > wy2) || (px >= PANEL_MAX_SIZE) || (py >= PANEL_MAX_SIZE)) {
+		// Out of the window or the display memory
+		p = NULL;
+	} else {
+		p = &panel_mem[py * PANEL_MAX_SIZE + px];
+	}
+
+	if (++px > wx2) {
+		px = wx1;
+		py++;
+	}
+
+	return p;
+}
+
+//------------------------------------------
+static void panel_put(uint16_t color) {
+	uint16_t *p = panel_next();
+
+	if (p) *p = color;
+	stats.pixels++;
+}
+
+//============================
+void panel_clear(uint16_t color) {
+	int i;
+
+	for(i = 0;i < PANEL_MAX_SIZE * PANEL_MAX_SIZE;i++) {
+		panel_mem[i] = color;
+	}
+}
+
+//===========================================
+void panel_get_stats(panel_stats_t *pstats) {
+	*pstats = stats;
+}
+
+//=====================
+void panel_reset_stats() {
+	memset(&stats, 0, sizeof(stats));
+}
+
+//======================================================================================
+driver_error_t *espi_init(spi_host_device_t host, spi_device_interface_config_t *dev_config,
+						  spi_bus_config_t *bus_config, spi_device_handle_t *handle) {
+	if (ndevices == 2) {
+		return (driver_error_t *)malloc(sizeof(driver_error_t));
+	}
+
+	devices[ndevices].id = ndevices;
+	*handle = &devices[ndevices++];
+
+	return NULL;
+}
+
+//==============================================
+uint32_t espi_get_speed(spi_device_handle_t handle) {
+	return 40000000;
+}
+
+//===============================================================
+uint32_t espi_set_speed(spi_device_handle_t handle, uint32_t speed) {
+	return speed;
+}
+
+//===========================================================
+esp_err_t spi_device_select(spi_device_handle_t handle, int force) {
+	stats.selects++;
+	return ESP_OK;
+}
+
+//==================================================
+esp_err_t spi_device_deselect(spi_device_handle_t handle) {
+	return ESP_OK;
+}
+
+//==============================================================
+void disp_spi_transfer_cmd(spi_device_handle_t handle, int8_t c) {
+	cmd = (uint8_t)c;
+	px = wx1;
+	py = wy1;
+	stats.transfers++;
+}
+
+//===============================================================================================
+void disp_spi_transfer_addrwin(spi_device_handle_t handle, uint16_t x1, uint16_t x2, uint16_t y1, uint16_t y2) {
+	// CASET and PASET, with their data
+	panel_window(x1, x2, y1, y2);
+	stats.transfers += 4;
+}
+
+//==============================================================================
+void disp_spi_transfer_pixel(spi_device_handle_t handle, uint16_t color) {
+	disp_spi_transfer_cmd(handle, TFT_RAMWR);
+	panel_put(color);
+	stats.transfers++;
+}
+
+//==========================================================================================
+void disp_spi_set_pixel(spi_device_handle_t handle, uint16_t x, uint16_t y, uint16_t color) {
+	disp_spi_transfer_addrwin(handle, x, x+1, y, y+1);
+	disp_spi_transfer_pixel(handle, color);
+}
+
+//------------------------------------------------------------------------------------
+static void panel_write(const uint8_t *color, uint32_t len, uint8_t rep) {
+	uint32_t i;
+
+	for(i = 0;i < len;i++) {
+		if (rep) {
+			panel_put((uint16_t)color[0] | ((uint16_t)color[1] << 8));
+		} else {
+			// Wire order, most significant byte first
+			panel_put(((uint16_t)color[i << 1] << 8) | (uint16_t)color[(i << 1) + 1]);
+		}
+	}
+}
+
+//=====================================================================================================
+void disp_spi_transfer_color_async(spi_device_handle_t handle, uint8_t *color, uint32_t len, uint8_t rep) {
+	disp_spi_transfer_cmd(handle, TFT_RAMWR);
+	panel_write(color, len, rep);
+
+	// As the DMA pixel pipeline (see drivers/espi_disp.h)
+	stats.transfers += rep?1:(len + 511) / 512;
+}
+
+//======================================================================================================================
+void disp_spi_transfer_rect_async(spi_device_handle_t handle, uint8_t *color, uint32_t w, uint32_t h, uint32_t stride) {
+	uint32_t y;
+
+	disp_spi_transfer_cmd(handle, TFT_RAMWR);
+	for(y = 0;y < h;y++) {
+		panel_write(color + ((y * stride) << 1), w, 0);
+	}
+
+	stats.transfers += (w * h + 511) / 512;
+}
+
+//===================================================================================================
+void disp_spi_transfer_color_rep(spi_device_handle_t handle, uint8_t *color, uint32_t len, uint8_t rep) {
+	disp_spi_transfer_color_async(handle, color, len, rep);
+}
+
+//======================================================
+void disp_spi_transfer_wait(spi_device_handle_t handle) {
+}
+
+//============================================================================================================
+void spi_transfer_data(spi_device_handle_t handle, uint8_t *data, uint8_t *indata, uint32_t wrlen, uint32_t rdlen) {
+	uint16_t *p;
+	uint16_t color;
+	uint32_t i;
+
+	stats.transfers++;
+
+	if (!indata || !rdlen) return;
+
+	memset(indata, 0, rdlen);
+	if (cmd != TFT_RAMRD) return;
+
+	// Dummy byte, then R, G, B bytes with 6 significant bits
+	for(i = 1;i + 2 < rdlen;i += 3) {
+		p = panel_next();
+		color = p?*p:0;
+		indata[i] = (color >> 8) & 0xF8;
+		indata[i + 1] = (color >> 3) & 0xFC;
+		indata[i + 2] = (color << 3) & 0xF8;
+	}
+}
@@ -0,0 +1,28 @@
+/*
+ * Lua RTOS, SPI display emulator for the Linux host build
+ *
+ */
+
+#ifndef _HOST_ESPI_PANEL_H
+#define _HOST_ESPI_PANEL_H
+
+#include <stdint.h>
+
+// Maximum display dimension, in pixels
+#define PANEL_MAX_SIZE 320
+
+typedef struct {
+	uint32_t selects;       // number of spi_device_select calls
+	uint32_t windows;       // number of address windows set
+	uint32_t transfers;     // number of SPI transfers
+	uint64_t pixels;        // pixels written
+} panel_stats_t;
+
+// Display memory, PANEL_MAX_SIZE pixels per row, native colors (not in wire order)
+extern uint16_t panel_mem[PANEL_MAX_SIZE * PANEL_MAX_SIZE];
+
+void panel_clear(uint16_t color);
+void panel_get_stats(panel_stats_t *stats);
+void panel_reset_stats();
+
+#endif
@@ -0,0 +1,27 @@
+/*
+ * Lua RTOS, FAT file system for the Linux host build
+ *
+ * The host build has no SD card file system mounted, as in a board built
+ * without CONFIG_LUA_RTOS_USE_FAT (see vfs/fat.c).
+ *
+ */
+
+#include <stdio.h>
+
+#include "ff.h"
+#include "vfs/fat.h"
+
+void mount_fatfs() {
+	printf("FAT is not available in the host build\n");
+}
+
+void unmount_fatfs() {
+}
+
+int fat_cache_stats(sd_cache_stats_t *stats) {
+	return 0;
+}
+
+FRESULT f_getfree(const char *path, DWORD *nclst, FATFS **fatfs) {
+	return FR_NOT_ENABLED;
+}
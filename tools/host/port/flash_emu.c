@@ -0,0 +1,148 @@
+/*
+ * Lua RTOS, SPI flash emulator for the Linux host build
+ *
+ * Emulates the NOR flash used by SPIFFS in RAM: an erase sets all the bits of a
+ * 4K sector to 1, and a write can only clear bits. The flash can be loaded from
+ * and saved to an image file (for example the one built by mkspiffs).
+ *
+ * It provides the low level functions declared in esp_spiffs.h, and counts the
+ * operations done, so that benchmarks can report flash reads, writes and erases.
+ *
+ * A sector erase takes tens of milliseconds on the real flash, and it can be made to
+ * take a given time with flash_emu_set_erase_time. Reads and writes are not timed.
+ *
+ */
+
+#include "flash_emu.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <esp_spiffs.h>
+
+#define FLASH_SECTOR_SIZE 4096
+
+static uint8_t *flash = NULL;
+static uint32_t flash_base;
+static uint32_t flash_size;
+static flash_emu_stats_t stats;
+static uint32_t erase_us = 0;
+
+int flash_emu_init(uint32_t base, uint32_t size, const char *image) {
+	FILE *fp;
+
+	flash = malloc(size);
+	if (!flash) {
+		return -1;
+	}
+
+	memset(flash, 0xff, size);
+
+	flash_base = base;
+	flash_size = size;
+
+	if (image) {
+		fp = fopen(image, "rb");
+		if (fp) {
+			if (fread(flash, 1, size, fp) == 0) {
+				fprintf(stderr, "flash_emu: can't read image %s\n", image);
+			}
+			fclose(fp);
+		}
+	}
+
+	flash_emu_reset_stats();
+
+	return 0;
+}
+
+int flash_emu_save(const char *image) {
+	FILE *fp;
+	int res = 0;
+
+	fp = fopen(image, "wb");
+	if (!fp) {
+		return -1;
+	}
+
+	if (fwrite(flash, 1, flash_size, fp) != flash_size) {
+		res = -1;
+	}
+
+	fclose(fp);
+
+	return res;
+}
+
+void flash_emu_deinit() {
+	free(flash);
+	flash = NULL;
+}
+
+void flash_emu_get_stats(flash_emu_stats_t *s) {
+	memcpy(s, &stats, sizeof(flash_emu_stats_t));
+}
+
+void flash_emu_set_erase_time(uint32_t us) {
+	erase_us = us;
+}
+
+void flash_emu_reset_stats() {
+	memset(&stats, 0, sizeof(stats));
+}
+
+static int check_range(u32_t addr, u32_t size) {
+	return ((addr >= flash_base) && (addr + size <= flash_base + flash_size));
+}
+
+s32_t esp32_spi_flash_read(u32_t addr, u32_t size, u8_t *dst) {
+	if (!check_range(addr, size)) {
+		return SPIFFS_ERR_INTERNAL;
+	}
+
+	memcpy(dst, flash + (addr - flash_base), size);
+
+	stats.reads++;
+	stats.read_bytes += size;
+
+	return SPIFFS_OK;
+}
+
+s32_t esp32_spi_flash_write(u32_t addr, u32_t size, const u8_t *src) {
+	u8_t *cflash;
+
+	if (!check_range(addr, size)) {
+		return SPIFFS_ERR_INTERNAL;
+	}
+
+	// NOR flash: bits can only be changed from 1 to 0
+	cflash = flash + (addr - flash_base);
+	while (size--) {
+		*cflash++ &= *src++;
+		stats.write_bytes++;
+	}
+
+	stats.writes++;
+
+	return SPIFFS_OK;
+}
+
+s32_t esp32_spi_flash_erase(u32_t addr, u32_t size) {
+	addr &= ~(FLASH_SECTOR_SIZE - 1);
+
+	if (!check_range(addr, FLASH_SECTOR_SIZE)) {
+		return SPIFFS_ERR_INTERNAL;
+	}
+
+	memset(flash + (addr - flash_base), 0xff, FLASH_SECTOR_SIZE);
+
+	if (erase_us) {
+		usleep(erase_us);
+	}
+
+	stats.erases++;
+
+	return SPIFFS_OK;
+}
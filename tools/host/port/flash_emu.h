@@ -0,0 +1,26 @@
+/*
+ * Lua RTOS, SPI flash emulator for the Linux host build
+ *
+ */
+
+#ifndef _HOST_FLASH_EMU_H
+#define _HOST_FLASH_EMU_H
+
+#include <stdint.h>
+
+typedef struct {
+	uint32_t reads;         // number of read operations
+	uint32_t writes;        // number of write operations
+	uint32_t erases;        // number of sector erase operations
+	uint64_t read_bytes;    // bytes read
+	uint64_t write_bytes;   // bytes written
+} flash_emu_stats_t;
+
+int  flash_emu_init(uint32_t base, uint32_t size, const char *image);
+int  flash_emu_save(const char *image);
+void flash_emu_deinit();
+void flash_emu_get_stats(flash_emu_stats_t *stats);
+void flash_emu_reset_stats();
+void flash_emu_set_erase_time(uint32_t us);
+
+#endif
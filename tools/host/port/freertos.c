@@ -0,0 +1,413 @@
+/*
+ * Lua RTOS, FreeRTOS stand-in for the Linux host build
+ *
+ * Tasks are mapped to detached pthreads, and semaphores / queues to a counter /
+ * ring buffer protected by a pthread mutex / condition variable pair. Critical
+ * sections are mapped to a single global recursive mutex, as the host has no
+ * interrupts to mask.
+ *
+ */
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+struct host_sem {
+    pthread_mutex_t mtx;
+    pthread_cond_t  cond;
+    UBaseType_t count;
+    UBaseType_t max;
+};
+
+struct host_queue {
+    pthread_mutex_t mtx;
+    pthread_cond_t  not_empty;
+    pthread_cond_t  not_full;
+    UBaseType_t length;
+    UBaseType_t size;
+    UBaseType_t head;
+    UBaseType_t count;
+    uint8_t *items;
+};
+
+struct host_task {
+    pthread_t thread;
+    TaskFunction_t code;
+    void *arg;
+    BaseType_t core;
+    void *tls[configNUM_THREAD_LOCAL_STORAGE_POINTERS];
+};
+
+unsigned port_interruptNesting[portNUM_PROCESSORS];
+
+static __thread struct host_task *current_task = NULL;
+static pthread_mutex_t critical_mtx;
+static pthread_once_t critical_once = PTHREAD_ONCE_INIT;
+
+static void critical_init() {
+    pthread_mutexattr_t attr;
+
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&critical_mtx, &attr);
+    pthread_mutexattr_destroy(&attr);
+}
+
+static void ticks_to_abstime(TickType_t ticks, struct timespec *ts) {
+    uint64_t ns = (uint64_t)ticks * portTICK_PERIOD_MS * 1000000ULL;
+
+    clock_gettime(CLOCK_REALTIME, ts);
+
+    ns += ts->tv_nsec;
+    ts->tv_sec += ns / 1000000000ULL;
+    ts->tv_nsec = ns % 1000000000ULL;
+}
+
+BaseType_t xPortGetCoreID() {
+    struct host_task *task = xTaskGetCurrentTaskHandle();
+
+    if ((task->core < 0) || (task->core >= portNUM_PROCESSORS)) {
+        return 0;
+    }
+
+    return task->core;
+}
+
+void vPortYield() {
+    sched_yield();
+}
+
+void vPortEnterCritical(portMUX_TYPE *mux) {
+    pthread_once(&critical_once, critical_init);
+    pthread_mutex_lock(&critical_mtx);
+}
+
+void vPortExitCritical(portMUX_TYPE *mux) {
+    pthread_mutex_unlock(&critical_mtx);
+}
+
+void _frxt_setup_switch() {
+}
+
+/*
+ * Semaphores
+ */
+static SemaphoreHandle_t sem_create(UBaseType_t max, UBaseType_t initial) {
+    struct host_sem *sem = calloc(1, sizeof(struct host_sem));
+
+    if (!sem) {
+        return NULL;
+    }
+
+    pthread_mutex_init(&sem->mtx, NULL);
+    pthread_cond_init(&sem->cond, NULL);
+
+    sem->count = initial;
+    sem->max = max;
+
+    return sem;
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary() {
+    return sem_create(1, 0);
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex() {
+    return sem_create(1, 1);
+}
+
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t max, UBaseType_t initial) {
+    return sem_create(max, initial);
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t ticks) {
+    struct timespec ts;
+    int res = 0;
+
+    pthread_mutex_lock(&sem->mtx);
+
+    if (ticks != portMAX_DELAY) {
+        ticks_to_abstime(ticks, &ts);
+    }
+
+    while ((sem->count == 0) && (res != ETIMEDOUT)) {
+        if (ticks == portMAX_DELAY) {
+            pthread_cond_wait(&sem->cond, &sem->mtx);
+        } else {
+            res = pthread_cond_timedwait(&sem->cond, &sem->mtx, &ts);
+        }
+    }
+
+    if (sem->count == 0) {
+        pthread_mutex_unlock(&sem->mtx);
+        return pdFALSE;
+    }
+
+    sem->count--;
+
+    pthread_mutex_unlock(&sem->mtx);
+
+    return pdTRUE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t sem) {
+    pthread_mutex_lock(&sem->mtx);
+
+    if (sem->count >= sem->max) {
+        pthread_mutex_unlock(&sem->mtx);
+        return pdFALSE;
+    }
+
+    sem->count++;
+
+    pthread_cond_signal(&sem->cond);
+    pthread_mutex_unlock(&sem->mtx);
+
+    return pdTRUE;
+}
+
+BaseType_t xSemaphoreTakeFromISR(SemaphoreHandle_t sem, BaseType_t *woken) {
+    return xSemaphoreTake(sem, 0);
+}
+
+BaseType_t xSemaphoreGiveFromISR(SemaphoreHandle_t sem, BaseType_t *woken) {
+    return xSemaphoreGive(sem);
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t sem) {
+    if (sem) {
+        pthread_cond_destroy(&sem->cond);
+        pthread_mutex_destroy(&sem->mtx);
+        free(sem);
+    }
+}
+
+/*
+ * Queues
+ */
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t size) {
+    struct host_queue *queue = calloc(1, sizeof(struct host_queue));
+
+    if (!queue) {
+        return NULL;
+    }
+
+    queue->items = calloc(length, size);
+    if (!queue->items) {
+        free(queue);
+        return NULL;
+    }
+
+    pthread_mutex_init(&queue->mtx, NULL);
+    pthread_cond_init(&queue->not_empty, NULL);
+    pthread_cond_init(&queue->not_full, NULL);
+
+    queue->length = length;
+    queue->size = size;
+
+    return queue;
+}
+
+// Wait on cond while pred is true, up to ticks. Returns 0 on timeout.
+#define QUEUE_WAIT(queue, cond, pred, ticks) ({ \
+    struct timespec ts; \
+    int res = 0; \
+    if (ticks != portMAX_DELAY) ticks_to_abstime(ticks, &ts); \
+    while ((pred) && (res != ETIMEDOUT)) { \
+        if (ticks == portMAX_DELAY) { \
+            pthread_cond_wait(cond, &queue->mtx); \
+        } else { \
+            res = pthread_cond_timedwait(cond, &queue->mtx, &ts); \
+        } \
+    } \
+    !(pred); \
+})
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t ticks) {
+    pthread_mutex_lock(&queue->mtx);
+
+    if (!QUEUE_WAIT(queue, &queue->not_full, queue->count == queue->length, ticks)) {
+        pthread_mutex_unlock(&queue->mtx);
+        return pdFALSE;
+    }
+
+    memcpy(queue->items + ((queue->head + queue->count) % queue->length) * queue->size, item, queue->size);
+    queue->count++;
+
+    pthread_cond_signal(&queue->not_empty);
+    pthread_mutex_unlock(&queue->mtx);
+
+    return pdTRUE;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t ticks) {
+    pthread_mutex_lock(&queue->mtx);
+
+    if (!QUEUE_WAIT(queue, &queue->not_empty, queue->count == 0, ticks)) {
+        pthread_mutex_unlock(&queue->mtx);
+        return pdFALSE;
+    }
+
+    memcpy(item, queue->items + queue->head * queue->size, queue->size);
+    queue->head = (queue->head + 1) % queue->length;
+    queue->count--;
+
+    pthread_cond_signal(&queue->not_full);
+    pthread_mutex_unlock(&queue->mtx);
+
+    return pdTRUE;
+}
+
+BaseType_t xQueueSendFromISR(QueueHandle_t queue, const void *item, BaseType_t *woken) {
+    return xQueueSend(queue, item, 0);
+}
+
+BaseType_t xQueueReceiveFromISR(QueueHandle_t queue, void *item, BaseType_t *woken) {
+    return xQueueReceive(queue, item, 0);
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue) {
+    UBaseType_t count;
+
+    pthread_mutex_lock(&queue->mtx);
+    count = queue->count;
+    pthread_mutex_unlock(&queue->mtx);
+
+    return count;
+}
+
+BaseType_t xQueueReset(QueueHandle_t queue) {
+    pthread_mutex_lock(&queue->mtx);
+    queue->head = 0;
+    queue->count = 0;
+    pthread_cond_broadcast(&queue->not_full);
+    pthread_mutex_unlock(&queue->mtx);
+
+    return pdPASS;
+}
+
+void vQueueDelete(QueueHandle_t queue) {
+    if (queue) {
+        pthread_cond_destroy(&queue->not_full);
+        pthread_cond_destroy(&queue->not_empty);
+        pthread_mutex_destroy(&queue->mtx);
+        free(queue->items);
+        free(queue);
+    }
+}
+
+/*
+ * Tasks
+ */
+static void *task_entry(void *arg) {
+    struct host_task *task = (struct host_task *)arg;
+
+    current_task = task;
+    task->code(task->arg);
+
+    return NULL;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t code, const char *name, uint32_t stack,
+                                   void *arg, UBaseType_t prio, TaskHandle_t *handle,
+                                   BaseType_t core) {
+    struct host_task *task = calloc(1, sizeof(struct host_task));
+    pthread_attr_t attr;
+
+    if (!task) {
+        return pdFAIL;
+    }
+
+    task->code = code;
+    task->arg = arg;
+    task->core = core;
+
+    if (handle) {
+        *handle = task;
+    }
+
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+    if (pthread_create(&task->thread, &attr, task_entry, task) != 0) {
+        pthread_attr_destroy(&attr);
+        free(task);
+        return pdFAIL;
+    }
+
+    pthread_attr_destroy(&attr);
+
+    return pdPASS;
+}
+
+void vTaskDelete(TaskHandle_t task) {
+    if (!task || (task == current_task)) {
+        pthread_exit(NULL);
+    }
+
+    pthread_cancel(task->thread);
+}
+
+void vTaskDelay(TickType_t ticks) {
+    struct timespec ts;
+
+    ts.tv_sec = (ticks * portTICK_PERIOD_MS) / 1000;
+    ts.tv_nsec = ((ticks * portTICK_PERIOD_MS) % 1000) * 1000000L;
+
+    nanosleep(&ts, NULL);
+}
+
+TickType_t xTaskGetTickCount() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (TickType_t)((ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000ULL) / portTICK_PERIOD_MS);
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle() {
+    if (!current_task) {
+        // Thread not created by xTaskCreate (for example the main thread)
+        current_task = calloc(1, sizeof(struct host_task));
+        if (current_task) {
+            current_task->thread = pthread_self();
+        }
+    }
+
+    return current_task;
+}
+
+// Task stacks are pthread stacks, their use is not known
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task) {
+    return 0;
+}
+
+void *pvTaskGetThreadLocalStoragePointer(TaskHandle_t task, BaseType_t index) {
+    if (!task) task = xTaskGetCurrentTaskHandle();
+
+    return task->tls[index];
+}
+
+void vTaskSetThreadLocalStoragePointer(TaskHandle_t task, BaseType_t index, void *value) {
+    if (!task) task = xTaskGetCurrentTaskHandle();
+
+    task->tls[index] = value;
+}
+
+void vTaskSuspendAll() {
+    vPortEnterCritical(NULL);
+}
+
+BaseType_t xTaskResumeAll() {
+    vPortExitCritical(NULL);
+
+    return pdFALSE;
+}
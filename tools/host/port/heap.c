@@ -0,0 +1,103 @@
+/*
+ * Lua RTOS, heap accounting for the Linux host build
+ *
+ * On the board, the memory used by Lua is the heap. In the host build the Lua
+ * states are created with host_heap_alloc, that accounts the bytes in use and
+ * their peak, and xPortGetFreeHeapSize reports them from a nominal heap of
+ * HOST_HEAP_SIZE bytes. If the heap size is set by host_heap_set_size,
+ * allocations over it fail, as on the board. Memory allocated by C code is not
+ * accounted.
+ *
+ * Blocks are allocated with the Lua allocator (Lua/common/lalloc.c) if it's
+ * enabled in sdkconfig.h, as luaL_newstate does, or with realloc.
+ *
+ */
+
+#include "heap.h"
+
+#include <stdlib.h>
+
+#include "freertos/FreeRTOS.h"
+
+#if CONFIG_LUA_RTOS_LUA_USE_POOL_ALLOC
+#include "lalloc.h"
+#endif
+
+static host_heap_stats_t heap;
+static host_heap_hook_t heap_hook;
+static size_t heap_size = HOST_HEAP_SIZE;
+static int heap_limited = 0;
+
+static void *heap_realloc(void *ptr, size_t osize, size_t nsize) {
+#if CONFIG_LUA_RTOS_LUA_USE_POOL_ALLOC
+	return lalloc(NULL, ptr, osize, nsize);
+#else
+	if (nsize == 0) {
+		free(ptr);
+		return NULL;
+	}
+
+	return realloc(ptr, nsize);
+#endif
+}
+
+void *host_heap_alloc(void *ud, void *ptr, size_t osize, size_t nsize) {
+	void *nptr;
+
+	// osize is the type of the object if ptr is NULL
+	if (!ptr) osize = 0;
+
+	if (nsize == 0) {
+		heap_realloc(ptr, osize, 0);
+		if (heap_hook && ptr) heap_hook(ptr, osize, NULL, 0);
+
+		__atomic_sub_fetch(&heap.used, osize, __ATOMIC_RELAXED);
+		__atomic_add_fetch(&heap.frees, 1, __ATOMIC_RELAXED);
+
+		return NULL;
+	}
+
+	if (heap_limited && (nsize > osize) && (__atomic_load_n(&heap.used, __ATOMIC_RELAXED) + nsize - osize > heap_size)) {
+		return NULL;
+	}
+
+	nptr = heap_realloc(ptr, osize, nsize);
+	if (nptr) {
+		size_t used = __atomic_add_fetch(&heap.used, nsize - osize, __ATOMIC_RELAXED);
+		size_t peak = __atomic_load_n(&heap.peak, __ATOMIC_RELAXED);
+
+		while ((used > peak) && !__atomic_compare_exchange_n(&heap.peak, &peak, used, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+		__atomic_add_fetch(&heap.allocs, 1, __ATOMIC_RELAXED);
+
+		if (heap_hook) heap_hook(ptr, osize, nptr, nsize);
+	}
+
+	return nptr;
+}
+
+void host_heap_get_stats(host_heap_stats_t *stats) {
+	stats->used = __atomic_load_n(&heap.used, __ATOMIC_RELAXED);
+	stats->peak = __atomic_load_n(&heap.peak, __ATOMIC_RELAXED);
+	stats->allocs = __atomic_load_n(&heap.allocs, __ATOMIC_RELAXED);
+	stats->frees = __atomic_load_n(&heap.frees, __ATOMIC_RELAXED);
+}
+
+void host_heap_set_hook(host_heap_hook_t hook) {
+	heap_hook = hook;
+}
+
+void host_heap_set_size(size_t size) {
+	heap_size = size;
+	heap_limited = 1;
+}
+
+void host_heap_reset_peak() {
+	__atomic_store_n(&heap.peak, __atomic_load_n(&heap.used, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+}
+
+size_t xPortGetFreeHeapSize() {
+	size_t used = __atomic_load_n(&heap.used, __ATOMIC_RELAXED);
+
+	return (used < heap_size)?heap_size - used:0;
+}
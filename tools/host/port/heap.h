@@ -0,0 +1,33 @@
+/*
+ * Lua RTOS, heap accounting for the Linux host build
+ *
+ */
+
+#ifndef _HOST_HEAP_H
+#define _HOST_HEAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Default nominal heap size, for xPortGetFreeHeapSize
+#define HOST_HEAP_SIZE (4 * 1024 * 1024)
+
+typedef struct {
+	size_t used;      // bytes in use
+	size_t peak;      // maximum of used since the last host_heap_reset_peak
+	uint32_t allocs;  // allocations and reallocations
+	uint32_t frees;
+} host_heap_stats_t;
+
+// lua_Alloc function that accounts the memory used by the Lua states
+void *host_heap_alloc(void *ud, void *ptr, size_t osize, size_t nsize);
+
+// Called after each block is allocated, reallocated or freed by host_heap_alloc
+typedef void (*host_heap_hook_t)(void *ptr, size_t osize, void *nptr, size_t nsize);
+
+void host_heap_get_stats(host_heap_stats_t *stats);
+void host_heap_reset_peak();
+void host_heap_set_hook(host_heap_hook_t hook);
+void host_heap_set_size(size_t size);
+
+#endif
@@ -0,0 +1,108 @@
+/*
+ * Lua RTOS, file-backed SD card emulator for the Linux host build
+ *
+ * Sectors are read from and written to an image file, that can be mounted or
+ * inspected on the host. Commands are counted, and the card time is modeled:
+ * each command has an access time, a sector is 512 bytes on a 20 MHz one bit
+ * bus, and a write command has a programming time. The modeled time is added
+ * to the clock returned by sd_image_now, so latencies measured with it are the
+ * ones of the card.
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include "sd_image.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SD_IMAGE_ACCESS_US  100     // command and access time
+#define SD_IMAGE_PROGRAM_US 250     // write command programming time
+#define SD_IMAGE_SECTOR_US  205     // 512 bytes + CRC at 20 MHz
+
+static int fd = -1;
+static uint32_t size;
+static sd_image_stats_t stats;
+static uint64_t card_us;            // modeled card time, not reset with the stats
+
+static void busy(uint64_t us) {
+	stats.busy_us += us;
+	card_us += us;
+}
+
+const sd_cache_ops_t sd_image_ops = {
+	.read = sd_image_read,
+	.write = sd_image_write,
+	.now = sd_image_now,
+};
+
+int sd_image_init(const char *image, uint32_t nsectors) {
+	fd = open(image, O_RDWR | O_CREAT, 0644);
+	if (fd < 0) {
+		return -1;
+	}
+
+	if (ftruncate(fd, (off_t)nsectors * SD_CACHE_SECTOR_SIZE) < 0) {
+		close(fd);
+		fd = -1;
+		return -1;
+	}
+
+	size = nsectors;
+	sd_image_reset_stats();
+
+	return 0;
+}
+
+void sd_image_deinit() {
+	if (fd >= 0) close(fd);
+	fd = -1;
+}
+
+int sd_image_read(void *dev, uint32_t sector, uint8_t *buf, uint32_t count) {
+	size_t len = (size_t)count * SD_CACHE_SECTOR_SIZE;
+
+	if ((fd < 0) || (sector + count > size)) return -1;
+
+	stats.reads++;
+	stats.read_sectors += count;
+	busy(SD_IMAGE_ACCESS_US + count * SD_IMAGE_SECTOR_US);
+
+	if (pread(fd, buf, len, (off_t)sector * SD_CACHE_SECTOR_SIZE) != (ssize_t)len) return -1;
+
+	return 0;
+}
+
+int sd_image_write(void *dev, uint32_t sector, const uint8_t *buf, uint32_t count) {
+	size_t len = (size_t)count * SD_CACHE_SECTOR_SIZE;
+
+	if ((fd < 0) || (sector + count > size)) return -1;
+
+	stats.writes++;
+	stats.write_sectors += count;
+	busy(SD_IMAGE_ACCESS_US + SD_IMAGE_PROGRAM_US + count * SD_IMAGE_SECTOR_US);
+
+	if (pwrite(fd, buf, len, (off_t)sector * SD_CACHE_SECTOR_SIZE) != (ssize_t)len) return -1;
+
+	return 0;
+}
+
+uint64_t sd_image_now() {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000 + card_us;
+}
+
+void sd_image_get_stats(sd_image_stats_t *s) {
+	*s = stats;
+}
+
+void sd_image_reset_stats() {
+	memset(&stats, 0, sizeof(stats));
+}
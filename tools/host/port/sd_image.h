@@ -0,0 +1,32 @@
+/*
+ * Lua RTOS, file-backed SD card emulator for the Linux host build
+ *
+ */
+
+#ifndef _HOST_SD_IMAGE_H
+#define _HOST_SD_IMAGE_H
+
+#include <stdint.h>
+
+#include "drivers/sd_cache.h"
+
+typedef struct {
+	uint32_t reads;         // number of read commands
+	uint32_t writes;        // number of write commands
+	uint64_t read_sectors;  // sectors read
+	uint64_t write_sectors; // sectors written
+	uint64_t busy_us;       // modeled card time
+} sd_image_stats_t;
+
+// Card functions for sd_cache_create, the dev argument is ignored
+extern const sd_cache_ops_t sd_image_ops;
+
+int  sd_image_init(const char *image, uint32_t nsectors);
+void sd_image_deinit();
+int  sd_image_read(void *dev, uint32_t sector, uint8_t *buf, uint32_t count);
+int  sd_image_write(void *dev, uint32_t sector, const uint8_t *buf, uint32_t count);
+uint64_t sd_image_now();
+void sd_image_get_stats(sd_image_stats_t *stats);
+void sd_image_reset_stats();
+
+#endif
@@ -0,0 +1,111 @@
+/*
+ * Lua RTOS, SPI flash functions for the Linux host build
+ *
+ * Emulates the Lua flash region (see Lua/common/lflash.c) as a NOR flash: an
+ * erase sets all the bits of a 4K sector to 1, and a write can only clear bits.
+ *
+ * The region is allocated once per process, so it keeps its contents and its
+ * address between the Lua states run by luahost, as the flash and the cache
+ * mapping of the board between reboots. The region is read only, as the mapped
+ * flash: it's only made writable while a write or an erase is done, so that a
+ * store to an object in flash crashes on the host.
+ *
+ */
+
+#include <esp_spi_flash.h>
+
+#include <string.h>
+#include <sys/mman.h>
+
+#include <sdkconfig.h>
+
+#define REGION_BASE CONFIG_LUA_RTOS_LUA_FLASH_BASE_ADDR
+#define REGION_SIZE CONFIG_LUA_RTOS_LUA_FLASH_SIZE
+
+static uint8_t *region = NULL;
+
+static int region_init() {
+	void *p;
+
+	if (region) {
+		return 0;
+	}
+
+	p = mmap(NULL, REGION_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED) {
+		return -1;
+	}
+
+	memset(p, 0xff, REGION_SIZE);
+	mprotect(p, REGION_SIZE, PROT_READ);
+
+	region = p;
+
+	return 0;
+}
+
+static int check_range(size_t addr, size_t size) {
+	return (region_init() == 0) && (addr >= REGION_BASE) && (addr + size <= REGION_BASE + REGION_SIZE);
+}
+
+esp_err_t spi_flash_mmap(size_t src_addr, size_t size, spi_flash_mmap_memory_t memory,
+                         const void **out_ptr, spi_flash_mmap_handle_t *out_handle) {
+	if (!check_range(src_addr, size)) {
+		return ESP_ERR_INVALID_ARG;
+	}
+
+	*out_ptr = region + (src_addr - REGION_BASE);
+	*out_handle = 0;
+
+	return ESP_OK;
+}
+
+void spi_flash_munmap(spi_flash_mmap_handle_t handle) {
+}
+
+esp_err_t spi_flash_read(size_t src_addr, void *dest, size_t size) {
+	if (!check_range(src_addr, size)) {
+		return ESP_ERR_INVALID_ARG;
+	}
+
+	memcpy(dest, region + (src_addr - REGION_BASE), size);
+
+	return ESP_OK;
+}
+
+esp_err_t spi_flash_write(size_t dest_addr, const void *src, size_t size) {
+	const uint8_t *csrc = src;
+	uint8_t *cflash;
+
+	if (!check_range(dest_addr, size)) {
+		return ESP_ERR_INVALID_ARG;
+	}
+
+	mprotect(region, REGION_SIZE, PROT_READ | PROT_WRITE);
+
+	// NOR flash: bits can only be changed from 1 to 0
+	cflash = region + (dest_addr - REGION_BASE);
+	while (size--) {
+		*cflash++ &= *csrc++;
+	}
+
+	mprotect(region, REGION_SIZE, PROT_READ);
+
+	return ESP_OK;
+}
+
+esp_err_t spi_flash_erase_range(size_t start_addr, size_t size) {
+	if ((start_addr % SPI_FLASH_SEC_SIZE) || (size % SPI_FLASH_SEC_SIZE) || !check_range(start_addr, size)) {
+		return ESP_ERR_INVALID_ARG;
+	}
+
+	mprotect(region, REGION_SIZE, PROT_READ | PROT_WRITE);
+	memset(region + (start_addr - REGION_BASE), 0xff, size);
+	mprotect(region, REGION_SIZE, PROT_READ);
+
+	return ESP_OK;
+}
+
+esp_err_t spi_flash_erase_sector(size_t sector) {
+	return spi_flash_erase_range(sector * SPI_FLASH_SEC_SIZE, SPI_FLASH_SEC_SIZE);
+}
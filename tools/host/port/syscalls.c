@@ -0,0 +1,564 @@
+/*
+ * Lua RTOS, syscall wrappers for the Linux host build
+ *
+ * Routes the file system calls to the file systems registered with
+ * esp_vfs_register, as the esp-idf vfs component and the Lua RTOS syscall
+ * wrappers (see components/lua_rtos/syscalls) do on the target.
+ *
+ * Programs that use them are linked with -Wl,--wrap=<call> for each wrapped
+ * call (see HOST_WRAP in the Makefile). Paths are resolved to physical paths
+ * with the mount functions, and sent to the file system registered for its
+ * base path, if any. File descriptors of the registered file systems are
+ * returned above HOST_VFS_FD_BASE. Everything else goes to the host.
+ *
+ */
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "esp_vfs.h"
+
+#include "sys/mount.h"
+
+#define HOST_VFS_FD_BASE  (1 << 20)
+#define HOST_VFS_FD_SHIFT 12
+#define HOST_VFS_FD_MASK  ((1 << HOST_VFS_FD_SHIFT) - 1)
+
+// dd_vfs_idx of the directories opened in the host
+#define HOST_VFS_HOST_DIR 0xffff
+
+// glibc's struct dirent64
+struct host_dirent64 {
+	uint64_t d_ino;
+	int64_t d_off;
+	unsigned short d_reclen;
+	unsigned char d_type;
+	char d_name[256];
+};
+
+typedef struct {
+	DIR dir;
+	void *host;
+	struct dirent ent;
+} host_dir_t;
+
+int __real_open(const char *path, int flags, ...);
+int __real_close(int fd);
+ssize_t __real_read(int fd, void *dst, size_t size);
+ssize_t __real_write(int fd, const void *data, size_t size);
+off_t __real_lseek(int fd, off_t size, int mode);
+int __real_fstat(int fd, struct stat *st);
+int __real_stat(const char *path, struct stat *st);
+int __real_unlink(const char *path);
+int __real_rename(const char *src, const char *dst);
+int __real_mkdir(const char *path, mode_t mode);
+void *__real_opendir(const char *name);
+int __real_closedir(void *dir);
+FILE *__real_fopen(const char *path, const char *mode);
+int __real_fileno(FILE *fp);
+int __real_remove(const char *path);
+
+struct host_dirent64 *readdir64(void *dir);
+
+/*
+ * Resolves path to a physical path, and returns the index of the file system
+ * where it's placed, or -1 if it's a host path. In the first case, ppath must
+ * be freed by the caller.
+ */
+static int vfs_resolve(const char *path, char **ppath, const char **rpath) {
+	int index;
+
+	*ppath = NULL;
+
+	if (strncmp(path, "/dev/", 5) == 0) {
+		return -1;
+	}
+
+	*ppath = mount_resolve_to_physical(path);
+	if (!*ppath) {
+		return -1;
+	}
+
+	index = esp_vfs_host_find(*ppath, rpath);
+	if (index < 0) {
+		free(*ppath);
+		*ppath = NULL;
+	}
+
+	return index;
+}
+
+/*
+ * Returns the file system of a file descriptor, or NULL if it's a host file
+ * descriptor.
+ */
+static const esp_vfs_t *vfs_fd(int fd, int *local) {
+	if (fd < HOST_VFS_FD_BASE) {
+		return NULL;
+	}
+
+	*local = (fd - HOST_VFS_FD_BASE) & HOST_VFS_FD_MASK;
+
+	return esp_vfs_host_vfs((fd - HOST_VFS_FD_BASE) >> HOST_VFS_FD_SHIFT);
+}
+
+int __wrap_open(const char *path, int flags, ...) {
+	const esp_vfs_t *vfs;
+	const char *rpath;
+	char *ppath;
+	int index, fd, mode = 0;
+	va_list args;
+
+	if (flags & O_CREAT) {
+		va_start(args, flags);
+		mode = va_arg(args, int);
+		va_end(args);
+	}
+
+	index = vfs_resolve(path, &ppath, &rpath);
+	if (index < 0) {
+		return __real_open(path, flags, mode);
+	}
+
+	vfs = esp_vfs_host_vfs(index);
+	if (!vfs->open) {
+		free(ppath);
+		errno = ENOSYS;
+		return -1;
+	}
+
+	fd = vfs->open(rpath, flags, mode);
+	free(ppath);
+
+	if (fd < 0) {
+		return -1;
+	}
+
+	if (fd > HOST_VFS_FD_MASK) {
+		vfs->close(fd);
+		errno = ENFILE;
+		return -1;
+	}
+
+	return HOST_VFS_FD_BASE + (index << HOST_VFS_FD_SHIFT) + fd;
+}
+
+int __wrap_close(int fd) {
+	const esp_vfs_t *vfs;
+	int local;
+
+	if (fd < HOST_VFS_FD_BASE) {
+		return __real_close(fd);
+	}
+
+	if (!(vfs = vfs_fd(fd, &local))) {
+		errno = EBADF;
+		return -1;
+	}
+
+	return vfs->close(local);
+}
+
+ssize_t __wrap_read(int fd, void *dst, size_t size) {
+	const esp_vfs_t *vfs;
+	int local;
+
+	if (fd < HOST_VFS_FD_BASE) {
+		return __real_read(fd, dst, size);
+	}
+
+	if (!(vfs = vfs_fd(fd, &local)) || !vfs->read) {
+		errno = EBADF;
+		return -1;
+	}
+
+	return vfs->read(local, dst, size);
+}
+
+ssize_t __wrap_write(int fd, const void *data, size_t size) {
+	const esp_vfs_t *vfs;
+	int local;
+
+	if (fd < HOST_VFS_FD_BASE) {
+		return __real_write(fd, data, size);
+	}
+
+	if (!(vfs = vfs_fd(fd, &local)) || !vfs->write) {
+		errno = EBADF;
+		return -1;
+	}
+
+	return vfs->write(local, data, size);
+}
+
+off_t __wrap_lseek(int fd, off_t size, int mode) {
+	const esp_vfs_t *vfs;
+	int local;
+
+	if (fd < HOST_VFS_FD_BASE) {
+		return __real_lseek(fd, size, mode);
+	}
+
+	if (!(vfs = vfs_fd(fd, &local)) || !vfs->lseek) {
+		errno = EBADF;
+		return -1;
+	}
+
+	return vfs->lseek(local, size, mode);
+}
+
+int __wrap_fstat(int fd, struct stat *st) {
+	const esp_vfs_t *vfs;
+	int local;
+
+	if (fd < HOST_VFS_FD_BASE) {
+		return __real_fstat(fd, st);
+	}
+
+	if (!(vfs = vfs_fd(fd, &local)) || !vfs->fstat) {
+		errno = EBADF;
+		return -1;
+	}
+
+	return vfs->fstat(local, st);
+}
+
+int __wrap_stat(const char *path, struct stat *st) {
+	const esp_vfs_t *vfs;
+	const char *rpath;
+	char *ppath;
+	int index, res;
+
+	index = vfs_resolve(path, &ppath, &rpath);
+	if (index < 0) {
+		return __real_stat(path, st);
+	}
+
+	vfs = esp_vfs_host_vfs(index);
+	if (vfs->stat) {
+		res = vfs->stat(rpath, st);
+	} else {
+		errno = ENOSYS;
+		res = -1;
+	}
+
+	free(ppath);
+
+	return res;
+}
+
+int __wrap_unlink(const char *path) {
+	const esp_vfs_t *vfs;
+	const char *rpath;
+	char *ppath;
+	int index, res;
+
+	index = vfs_resolve(path, &ppath, &rpath);
+	if (index < 0) {
+		return __real_unlink(path);
+	}
+
+	vfs = esp_vfs_host_vfs(index);
+	if (vfs->unlink) {
+		res = vfs->unlink(rpath);
+	} else {
+		errno = ENOSYS;
+		res = -1;
+	}
+
+	free(ppath);
+
+	return res;
+}
+
+int __wrap_rename(const char *src, const char *dst) {
+	const esp_vfs_t *vfs;
+	const char *rsrc, *rdst;
+	char *psrc, *pdst;
+	int isrc, idst, res;
+
+	isrc = vfs_resolve(src, &psrc, &rsrc);
+	idst = vfs_resolve(dst, &pdst, &rdst);
+
+	if ((isrc < 0) && (idst < 0)) {
+		return __real_rename(src, dst);
+	}
+
+	vfs = esp_vfs_host_vfs(isrc);
+	if (isrc != idst) {
+		errno = EXDEV;
+		res = -1;
+	} else if (vfs->rename) {
+		res = vfs->rename(rsrc, rdst);
+	} else {
+		errno = ENOSYS;
+		res = -1;
+	}
+
+	free(psrc);
+	free(pdst);
+
+	return res;
+}
+
+int __wrap_mkdir(const char *path, mode_t mode) {
+	const esp_vfs_t *vfs;
+	const char *rpath;
+	char *ppath;
+	int index, res;
+
+	index = vfs_resolve(path, &ppath, &rpath);
+	if (index < 0) {
+		return __real_mkdir(path, mode);
+	}
+
+	vfs = esp_vfs_host_vfs(index);
+	if (vfs->mkdir) {
+		res = vfs->mkdir(rpath, mode);
+	} else {
+		errno = ENOSYS;
+		res = -1;
+	}
+
+	free(ppath);
+
+	return res;
+}
+
+/*
+ * glibc's fopen and remove don't reach the wrapped open and unlink, so they are
+ * wrapped too. Files of the registered file systems are streams over the
+ * wrapped calls, as newlib does on the target. The streams are kept in a list,
+ * for fileno.
+ */
+typedef struct host_stream {
+	int fd;
+	FILE *fp;
+	struct host_stream *next;
+} host_stream_t;
+
+static host_stream_t *streams;
+
+static ssize_t cookie_read(void *cookie, char *buf, size_t size) {
+	return __wrap_read(((host_stream_t *)cookie)->fd, buf, size);
+}
+
+static ssize_t cookie_write(void *cookie, const char *buf, size_t size) {
+	return __wrap_write(((host_stream_t *)cookie)->fd, buf, size);
+}
+
+static int cookie_seek(void *cookie, off64_t *offset, int whence) {
+	off_t res;
+
+	res = __wrap_lseek(((host_stream_t *)cookie)->fd, *offset, whence);
+	if (res < 0) {
+		return -1;
+	}
+
+	*offset = res;
+
+	return 0;
+}
+
+static int cookie_close(void *cookie) {
+	host_stream_t *stream = (host_stream_t *)cookie;
+	host_stream_t **link;
+	int fd = stream->fd;
+
+	for(link = &streams;*link;link = &(*link)->next) {
+		if (*link == stream) {
+			*link = stream->next;
+			break;
+		}
+	}
+
+	free(stream);
+
+	return __wrap_close(fd);
+}
+
+FILE *__wrap_fopen(const char *path, const char *mode) {
+	cookie_io_functions_t io = {cookie_read, cookie_write, cookie_seek, cookie_close};
+	host_stream_t *stream;
+	const char *rpath;
+	char *ppath;
+	int flags, fd;
+	FILE *fp;
+
+	if (vfs_resolve(path, &ppath, &rpath) < 0) {
+		return __real_fopen(path, mode);
+	}
+
+	free(ppath);
+
+	switch (*mode) {
+		case 'r': flags = 0; break;
+		case 'w': flags = O_CREAT | O_TRUNC; break;
+		case 'a': flags = O_CREAT; break;
+		default:
+			errno = EINVAL;
+			return NULL;
+	}
+
+	if (strchr(mode, '+')) {
+		flags |= O_RDWR;
+	} else {
+		flags |= (*mode == 'r')?O_RDONLY:O_WRONLY;
+	}
+
+	fd = __wrap_open(path, flags, 0666);
+	if (fd < 0) {
+		return NULL;
+	}
+
+	if ((*mode == 'a') && (__wrap_lseek(fd, 0, SEEK_END) < 0)) {
+		__wrap_close(fd);
+		return NULL;
+	}
+
+	stream = calloc(1, sizeof(host_stream_t));
+	if (!stream) {
+		__wrap_close(fd);
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	fp = fopencookie(stream, mode, io);
+	if (!fp) {
+		free(stream);
+		__wrap_close(fd);
+		return NULL;
+	}
+
+	stream->fd = fd;
+	stream->fp = fp;
+	stream->next = streams;
+	streams = stream;
+
+	return fp;
+}
+
+// glibc's fileno returns -1 for the streams of fopencookie
+int __wrap_fileno(FILE *fp) {
+	host_stream_t *stream;
+
+	for(stream = streams;stream;stream = stream->next) {
+		if (stream->fp == fp) {
+			return stream->fd;
+		}
+	}
+
+	return __real_fileno(fp);
+}
+
+int __wrap_remove(const char *path) {
+	const char *rpath;
+	char *ppath;
+
+	if (vfs_resolve(path, &ppath, &rpath) < 0) {
+		return __real_remove(path);
+	}
+
+	free(ppath);
+
+	return __wrap_unlink(path);
+}
+
+DIR *__wrap_opendir(const char *name) {
+	const esp_vfs_t *vfs;
+	const char *rpath;
+	host_dir_t *hdir;
+	char *ppath;
+	DIR *dir;
+	int index;
+
+	index = vfs_resolve(name, &ppath, &rpath);
+	if (index < 0) {
+		hdir = calloc(1, sizeof(host_dir_t));
+		if (!hdir) {
+			errno = ENOMEM;
+			return NULL;
+		}
+
+		hdir->host = __real_opendir(name);
+		if (!hdir->host) {
+			free(hdir);
+			return NULL;
+		}
+
+		hdir->dir.dd_vfs_idx = HOST_VFS_HOST_DIR;
+
+		return &hdir->dir;
+	}
+
+	vfs = esp_vfs_host_vfs(index);
+	if (vfs->opendir) {
+		dir = vfs->opendir(rpath);
+		if (dir) {
+			dir->dd_vfs_idx = index;
+		}
+	} else {
+		errno = ENOSYS;
+		dir = NULL;
+	}
+
+	free(ppath);
+
+	return dir;
+}
+
+struct dirent *__wrap_readdir(DIR *pdir) {
+	const esp_vfs_t *vfs;
+	struct host_dirent64 *de;
+	host_dir_t *hdir;
+
+	if (pdir->dd_vfs_idx != HOST_VFS_HOST_DIR) {
+		vfs = esp_vfs_host_vfs(pdir->dd_vfs_idx);
+		if (!vfs || !vfs->readdir) {
+			errno = EBADF;
+			return NULL;
+		}
+
+		return vfs->readdir(pdir);
+	}
+
+	hdir = (host_dir_t *)pdir;
+
+	if (!(de = readdir64(hdir->host))) {
+		return NULL;
+	}
+
+	hdir->ent.d_ino = (int)de->d_ino;
+	hdir->ent.d_type = (de->d_type == 4)?DT_DIR:((de->d_type == 8)?DT_REG:DT_UNKNOWN);
+	strlcpy(hdir->ent.d_name, de->d_name, sizeof(hdir->ent.d_name));
+
+	return &hdir->ent;
+}
+
+int __wrap_closedir(DIR *pdir) {
+	const esp_vfs_t *vfs;
+	host_dir_t *hdir;
+	int res;
+
+	if (pdir->dd_vfs_idx != HOST_VFS_HOST_DIR) {
+		vfs = esp_vfs_host_vfs(pdir->dd_vfs_idx);
+		if (!vfs || !vfs->closedir) {
+			errno = EBADF;
+			return -1;
+		}
+
+		return vfs->closedir(pdir);
+	}
+
+	hdir = (host_dir_t *)pdir;
+	res = __real_closedir(hdir->host);
+	free(hdir);
+
+	return res;
+}
@@ -0,0 +1,44 @@
+/*
+ * Lua RTOS, syslog for the Linux host build
+ *
+ */
+
+#include <stdio.h>
+#include <stdarg.h>
+
+#include <sys/syslog.h>
+
+static int log_mask = LOG_UPTO(LOG_WARNING);
+
+int setlogmask(int mask) {
+	int old = log_mask;
+
+	if (mask) {
+		log_mask = mask;
+	}
+
+	return old;
+}
+
+void vsyslog(int pri, const char *fmt, va_list ap) {
+	if (!(LOG_MASK(LOG_PRI(pri)) & log_mask)) {
+		return;
+	}
+
+	vfprintf(stderr, fmt, ap);
+	fprintf(stderr, "\n");
+}
+
+void syslog(int pri, const char *fmt, ...) {
+	va_list ap;
+
+	va_start(ap, fmt);
+	vsyslog(pri, fmt, ap);
+	va_end(ap);
+}
+
+void openlog(const char *ident, int logstat, int logfac) {
+}
+
+void closelog(void) {
+}
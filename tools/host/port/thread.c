@@ -0,0 +1,114 @@
+/*
+ * Lua RTOS, thread module for the Linux host build
+ *
+ * Lua/modules/thread.c needs the Lua RTOS pthread extensions. This stand-in
+ * has the isolated threads (see Lua/modules/thread_isolate.h), that run as
+ * host threads, their channels and buffers, the thread pool (see
+ * Lua/modules/thread_pool.h), and the sleep functions.
+ *
+ */
+
+#include "luartos.h"
+
+#include "lua.h"
+#include "lauxlib.h"
+#include "modules.h"
+#include "thread_isolate.h"
+#include "thread_pool.h"
+
+#if CONFIG_LUA_RTOS_LUA_USE_PROFILER
+#include "lprof.h"
+#endif
+
+#include <pthread.h>
+#include <unistd.h>
+
+static int thid = 0;
+
+static void *thread_start_task(void *arg) {
+	lua_State *IL = (lua_State *)arg;
+
+	thread_isolate_started(IL);
+
+	if (lua_pcall(IL, 0, 0, 0) != LUA_OK) {
+		lua_writestringerror("%s\n", lua_tostring(IL, -1));
+	}
+
+#if CONFIG_LUA_RTOS_LUA_USE_PROFILER
+	lprof_detach(IL);
+#endif
+
+	thread_isolate_close(IL);
+
+	return NULL;
+}
+
+static int thread_spawn(lua_State *L) {
+	pthread_attr_t attr;
+	lua_State *IL;
+	pthread_t id;
+	int res, n;
+
+	IL = thread_isolate_new(L, 1, CONFIG_LUA_RTOS_LUA_THREAD_HEAP_SIZE * 1024);
+	n = __sync_add_and_fetch(&thid, 1);
+
+#if CONFIG_LUA_RTOS_LUA_USE_PROFILER
+	char name[16];
+
+	snprintf(name, sizeof(name), "thread %d", n);
+	lprof_attach(IL, name);
+#endif
+
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+	res = pthread_create(&id, &attr, thread_start_task, IL);
+	pthread_attr_destroy(&attr);
+
+	if (res) {
+#if CONFIG_LUA_RTOS_LUA_USE_PROFILER
+		lprof_detach(IL);
+#endif
+		thread_isolate_cancel(IL);
+		return luaL_error(L, "cannot start thread");
+	}
+
+	lua_pushinteger(L, n);
+	return 1;
+}
+
+static int thread_sleep(lua_State *L) {
+	sleep(luaL_checkinteger(L, 1));
+	return 0;
+}
+
+static int thread_sleepms(lua_State *L) {
+	usleep(luaL_checkinteger(L, 1) * 1000);
+	return 0;
+}
+
+static int thread_sleepus(lua_State *L) {
+	usleep(luaL_checkinteger(L, 1));
+	return 0;
+}
+
+static const LUA_REG_TYPE thread[] = {
+	{ LSTRKEY( "spawn"   ),			LFUNCVAL( thread_spawn   ) },
+	{ LSTRKEY( "channel" ),			LFUNCVAL( thread_isolate_channel ) },
+	{ LSTRKEY( "buffer"  ),			LFUNCVAL( thread_isolate_buffer  ) },
+	{ LSTRKEY( "submit"  ),			LFUNCVAL( thread_pool_submit     ) },
+	{ LSTRKEY( "poolstats" ),		LFUNCVAL( thread_pool_stats      ) },
+	{ LSTRKEY( "sleep"   ),			LFUNCVAL( thread_sleep   ) },
+	{ LSTRKEY( "sleepms" ),			LFUNCVAL( thread_sleepms ) },
+	{ LSTRKEY( "sleepus" ),			LFUNCVAL( thread_sleepus ) },
+	{ LSTRKEY( "usleep"  ),			LFUNCVAL( thread_sleepus ) },
+	{ LNILKEY, LNILVAL }
+};
+
+int luaopen_thread(lua_State *L) {
+	thread_isolate_open(L);
+	thread_pool_open(L);
+	return 0;
+}
+
+MODULE_REGISTER_MAPPED(THREAD, thread, thread, luaopen_thread);
@@ -0,0 +1,85 @@
+/*
+ * Lua RTOS, console UART for the Linux host build
+ *
+ * The console UART functions used by the io, os and console code, over the
+ * standard input and output of the process. Other units don't exist in the
+ * host build, reads time out and writes are discarded.
+ *
+ */
+
+#include "luartos.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <drivers/uart.h>
+
+static pthread_once_t uart_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t uart_mtx;
+
+// The console lock is taken again by the code that writes under it
+static void uart_lock_init() {
+	pthread_mutexattr_t attr;
+
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(&uart_mtx, &attr);
+	pthread_mutexattr_destroy(&attr);
+}
+
+void uart_lock(int unit) {
+	pthread_once(&uart_once, uart_lock_init);
+	pthread_mutex_lock(&uart_mtx);
+}
+
+void uart_unlock(int unit) {
+	pthread_mutex_unlock(&uart_mtx);
+}
+
+void uart_write(int8_t unit, char byte) {
+	if (unit != CONSOLE_UART) return;
+
+	while ((write(STDOUT_FILENO, &byte, 1) < 0) && (errno == EINTR));
+}
+
+void uart_writes(int8_t unit, char *s) {
+	while (*s) {
+		uart_write(unit, *s++);
+	}
+}
+
+// Returns 1 if a byte is received before timeout milliseconds
+uint8_t uart_read(int8_t unit, char *c, uint32_t timeout) {
+	struct pollfd pfd;
+
+	if (unit != CONSOLE_UART) return 0;
+
+	pfd.fd = STDIN_FILENO;
+	pfd.events = POLLIN;
+
+	if (poll(&pfd, 1, (timeout == portMAX_DELAY)?-1:(int)timeout) <= 0) {
+		return 0;
+	}
+
+	return (read(STDIN_FILENO, c, 1) == 1);
+}
+
+int uart_read_block(int8_t unit, char *buff, int len, uint32_t timeout) {
+	int n;
+
+	for(n = 0;n < len;n++) {
+		if (!uart_read(unit, &buff[n], timeout)) break;
+	}
+
+	return n;
+}
+
+void uart_consume(int8_t unit) {
+	char c;
+
+	while (uart_read(unit, &c, 0));
+}